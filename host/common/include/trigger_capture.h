@@ -0,0 +1,230 @@
+/**
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (c) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* This file provides a triggered RX capture engine. Received samples are
+ * kept in a preallocated ring of stream buffers, and only the samples
+ * surrounding a trigger event are handed off to the caller.
+ *
+ * Typical usage:
+ *
+ *  trigcap_init(&tc, &config);
+ *
+ *  while (trigcap_get_state(tc) != TRIGCAP_STATE_DONE) {
+ *      status = trigcap_rx(tc, dev, timeout_ms);
+ *      ...
+ *  }
+ *
+ *  trigcap_write(tc, write_fn, user_data);
+ *  trigcap_deinit(tc);
+ */
+
+#ifndef TRIGGER_CAPTURE_H_
+#define TRIGGER_CAPTURE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libbladeRF.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Default size of power detection windows, in samples */
+#define TRIGCAP_WINDOW_DEFAULT  64
+
+/* Power detection threshold used to disable the power detector */
+#define TRIGCAP_THRESHOLD_OFF   (0.0)
+
+enum trigcap_state {
+    TRIGCAP_STATE_ARMED,        /**< Filling the pre-trigger history */
+    TRIGCAP_STATE_TRIGGERED,    /**< Collecting post-trigger samples */
+    TRIGCAP_STATE_DONE,         /**< Capture around the trigger is complete */
+};
+
+struct trigcap_config {
+    unsigned int samples_per_buffer;    /**< Samples per bladerf_sync_rx()
+                                         *   call. This must match the value
+                                         *   provided to bladerf_sync_config().
+                                         */
+
+    uint64_t pre_samples;               /**< Samples to retain prior to the
+                                         *   trigger point */
+
+    uint64_t post_samples;              /**< Samples to capture after and
+                                         *   including the trigger point */
+
+    double threshold_dbfs;              /**< Mean power of a detection window,
+                                         *   in dB relative to full scale, at or
+                                         *   above which the capture is
+                                         *   triggered. Values >= 0 disable
+                                         *   the power detector, leaving only
+                                         *   trigcap_fire(). */
+
+    unsigned int window;                /**< Power detection window length, in
+                                         *   samples. Must be nonzero. */
+};
+
+struct trigcap;
+
+/**
+ * Write callback used by trigcap_write()
+ *
+ * @param   user_data   Data provided to trigcap_write()
+ * @param   samples     Host-endian SC16 Q11 samples. The callback may modify
+ *                      these in place.
+ * @param   n           Number of samples
+ * @param   timestamp   Timestamp of the first sample
+ *
+ * @return 0 on success, or a nonzero value to abort the write. This value is
+ *         returned by trigcap_write().
+ */
+typedef int (*trigcap_write_fn)(void *user_data, int16_t *samples,
+                                unsigned int n, uint64_t timestamp);
+
+/**
+ * Initialize a default trigger capture configuration
+ *
+ * @param[out]  config  Configuration to populate
+ */
+void trigcap_config_init(struct trigcap_config *config);
+
+/**
+ * Allocate the capture ring and arm the trigger
+ *
+ * @param[out]  tc      Trigger capture handle
+ * @param[in]   config  Capture configuration
+ *
+ * @return 0 on success, BLADERF_ERR_INVAL on an invalid configuration, or
+ *         BLADERF_ERR_MEM on memory allocation failure
+ */
+int trigcap_init(struct trigcap **tc, const struct trigcap_config *config);
+
+/**
+ * Free a trigger capture handle
+ *
+ * @param   tc      Trigger capture handle
+ */
+void trigcap_deinit(struct trigcap *tc);
+
+/**
+ * Discard the ring's contents and re-arm the trigger
+ *
+ * @param   tc      Trigger capture handle
+ */
+void trigcap_reset(struct trigcap *tc);
+
+/**
+ * Trigger the capture at the specified timestamp, independent of the power
+ * detector. This may be called from a thread other than the one feeding
+ * samples to the handle, and is intended for use with external trigger
+ * sources (e.g., bladerf_trigger_fire()).
+ *
+ * This has no effect if the capture has already been triggered.
+ *
+ * @param   tc          Trigger capture handle
+ * @param   timestamp   RX timestamp of the trigger point
+ */
+void trigcap_fire(struct trigcap *tc, uint64_t timestamp);
+
+/**
+ * Get the buffer that the next block of samples should be received into.
+ *
+ * @param   tc      Trigger capture handle
+ *
+ * @return Buffer with room for `samples_per_buffer` samples
+ */
+int16_t *trigcap_next_buffer(struct trigcap *tc);
+
+/**
+ * Account for a block of samples received into the buffer returned by
+ * trigcap_next_buffer(), running the power detector over it if the capture
+ * has not yet been triggered.
+ *
+ * Samples are converted to host endianness in place.
+ *
+ * @param   tc      Trigger capture handle
+ * @param   meta    Metadata of the block, as filled in by bladerf_sync_rx()
+ *                  using the BLADERF_FORMAT_SC16_Q11_META format
+ *
+ * @return Updated capture state
+ */
+enum trigcap_state trigcap_commit(struct trigcap *tc,
+                                  const struct bladerf_metadata *meta);
+
+/**
+ * Receive a block of samples into the ring and process it. This is a
+ * convenience wrapper around trigcap_next_buffer(), bladerf_sync_rx(),
+ * and trigcap_commit().
+ *
+ * @pre The RX module has been configured via bladerf_sync_config() using the
+ *      BLADERF_FORMAT_SC16_Q11_META format, and has been enabled.
+ *
+ * @param   tc          Trigger capture handle
+ * @param   dev         Device handle
+ * @param   timeout_ms  Timeout for bladerf_sync_rx()
+ *
+ * @return 0 on success, BLADERF_ERR_* value on failure
+ */
+int trigcap_rx(struct trigcap *tc, struct bladerf *dev,
+               unsigned int timeout_ms);
+
+/**
+ * @param   tc      Trigger capture handle
+ *
+ * @return Current capture state
+ */
+enum trigcap_state trigcap_get_state(struct trigcap *tc);
+
+/**
+ * @param   tc      Trigger capture handle
+ *
+ * @return Timestamp of the trigger point. Only valid once the capture has
+ *         been triggered.
+ */
+uint64_t trigcap_trigger_timestamp(struct trigcap *tc);
+
+/**
+ * Pass the samples surrounding the trigger point to the provided callback,
+ * in order. The callback is called once for each stream buffer (or portion
+ * thereof) in the capture. Gaps in the META timestamps (e.g., due to
+ * overruns) are reflected by its `timestamp` argument.
+ *
+ * @pre trigcap_get_state() returns TRIGCAP_STATE_DONE
+ *
+ * @param   tc          Trigger capture handle
+ * @param   write_fn    Callback to write samples
+ * @param   user_data   Passed to `write_fn`
+ *
+ * @return 0 on success, BLADERF_ERR_INVAL if the capture is not complete,
+ *         or the nonzero value returned by `write_fn`
+ */
+int trigcap_write(struct trigcap *tc, trigcap_write_fn write_fn,
+                  void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
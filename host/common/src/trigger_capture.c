@@ -0,0 +1,413 @@
+/**
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (c) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
+
+#include "host_config.h"
+#include "minmax.h"
+#include "thread.h"
+#include "trigger_capture.h"
+
+/* Full scale magnitude of an SC16 Q11 sample */
+#define SC16Q11_FULL_SCALE  2048
+
+/* Bookkeeping for each stream buffer in the ring */
+struct trigcap_block {
+    uint64_t timestamp;         /* Timestamp of the first sample */
+    unsigned int count;         /* Number of valid samples */
+};
+
+struct trigcap {
+    struct trigcap_config config;
+
+    int16_t *ring;                  /* num_blocks * samples_per_buffer
+                                     *   SC16 Q11 samples */
+    struct trigcap_block *blocks;
+    unsigned int num_blocks;
+    uint64_t num_committed;         /* Total blocks committed to the ring */
+    uint64_t next_timestamp;        /* Expected timestamp of the next block */
+
+    int64_t threshold;              /* Window power sum threshold,
+                                     *   or -1 if disabled */
+
+    /* Power detector state, carried across blocks */
+    int64_t window_sum;
+    unsigned int window_fill;
+    uint64_t window_timestamp;
+
+    /* Accessed by both the streaming thread and trigcap_fire() callers */
+    MUTEX lock;
+    enum trigcap_state state;
+    uint64_t trigger_timestamp;
+    bool fire_pending;
+    uint64_t fire_timestamp;
+};
+
+/* Sum of I^2 + Q^2 over n samples */
+static int64_t power_sum(const int16_t *s, unsigned int n)
+{
+    int64_t sum = 0;
+    unsigned int i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    int64_t lanes[2];
+
+    for (; (i + 4) <= n; i += 4) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) &s[2 * i]);
+
+        /* I^2 + Q^2 for 4 samples. These are treated as unsigned, as
+         * the sum of two squared int16_t values may exceed INT32_MAX. */
+        const __m128i p = _mm_madd_epi16(v, v);
+
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(p, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(p, zero));
+    }
+
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    sum = lanes[0] + lanes[1];
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    int64x2_t acc = vdupq_n_s64(0);
+
+    for (; (i + 4) <= n; i += 4) {
+        const int16x8_t v = vld1q_s16(&s[2 * i]);
+        const int16x4_t lo = vget_low_s16(v);
+        const int16x4_t hi = vget_high_s16(v);
+
+        acc = vpadalq_s32(acc, vmull_s16(lo, lo));
+        acc = vpadalq_s32(acc, vmull_s16(hi, hi));
+    }
+
+    sum = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+#endif
+
+    for (; i < n; i++) {
+        const int32_t si = s[2 * i];
+        const int32_t sq = s[2 * i + 1];
+        sum += (int64_t) (si * si) + (int64_t) (sq * sq);
+    }
+
+    return sum;
+}
+
+/* Run the power detector over a block of samples.
+ *
+ * Returns true and sets trigger_timestamp to the start of the first window
+ * whose power meets the threshold, if any. */
+static bool detect(struct trigcap *tc, const int16_t *samples,
+                   unsigned int n, uint64_t timestamp,
+                   uint64_t *trigger_timestamp)
+{
+    const unsigned int window = tc->config.window;
+    unsigned int i = 0;
+
+    /* Windows may not span discontinuities */
+    if (timestamp != tc->next_timestamp) {
+        tc->window_sum = 0;
+        tc->window_fill = 0;
+    }
+
+    while (i < n) {
+        const unsigned int to_add = uint_min(window - tc->window_fill, n - i);
+
+        if (tc->window_fill == 0) {
+            tc->window_timestamp = timestamp + i;
+        }
+
+        tc->window_sum += power_sum(&samples[2 * i], to_add);
+        tc->window_fill += to_add;
+        i += to_add;
+
+        if (tc->window_fill == window) {
+            const bool triggered = (tc->window_sum >= tc->threshold);
+
+            tc->window_sum = 0;
+            tc->window_fill = 0;
+
+            if (triggered) {
+                *trigger_timestamp = tc->window_timestamp;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void trigcap_config_init(struct trigcap_config *config)
+{
+    config->samples_per_buffer = 8192;
+    config->pre_samples = 0;
+    config->post_samples = 0;
+    config->threshold_dbfs = TRIGCAP_THRESHOLD_OFF;
+    config->window = TRIGCAP_WINDOW_DEFAULT;
+}
+
+int trigcap_init(struct trigcap **tc_out, const struct trigcap_config *config)
+{
+    struct trigcap *tc;
+    uint64_t num_blocks;
+    const unsigned int spb = config->samples_per_buffer;
+
+    *tc_out = NULL;
+
+    if (spb == 0 || config->window == 0 ||
+        (config->pre_samples == 0 && config->post_samples == 0)) {
+        return BLADERF_ERR_INVAL;
+    }
+
+    /* The trigger point may land anywhere within a block, so allow for one
+     * partial block on either side of it */
+    num_blocks = (config->pre_samples + spb - 1) / spb +
+                 (config->post_samples + spb - 1) / spb + 2;
+
+    if (num_blocks > (SIZE_MAX / (2 * sizeof(int16_t) * spb))) {
+        return BLADERF_ERR_INVAL;
+    }
+
+    tc = calloc(1, sizeof(*tc));
+    if (tc == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    tc->config = *config;
+    tc->num_blocks = (unsigned int) num_blocks;
+    tc->ring = malloc((size_t) num_blocks * spb * 2 * sizeof(int16_t));
+    tc->blocks = calloc((size_t) num_blocks, sizeof(tc->blocks[0]));
+
+    if (tc->ring == NULL || tc->blocks == NULL) {
+        free(tc->ring);
+        free(tc->blocks);
+        free(tc);
+        return BLADERF_ERR_MEM;
+    }
+
+    if (config->threshold_dbfs < 0) {
+        const double full_scale = (double) SC16Q11_FULL_SCALE *
+                                           SC16Q11_FULL_SCALE;
+
+        tc->threshold = (int64_t) (config->window * full_scale *
+                                   pow(10.0, config->threshold_dbfs / 10.0));
+    } else {
+        tc->threshold = -1;
+    }
+
+    MUTEX_INIT(&tc->lock);
+    trigcap_reset(tc);
+
+    *tc_out = tc;
+    return 0;
+}
+
+void trigcap_deinit(struct trigcap *tc)
+{
+    if (tc != NULL) {
+        free(tc->ring);
+        free(tc->blocks);
+        free(tc);
+    }
+}
+
+void trigcap_reset(struct trigcap *tc)
+{
+    tc->num_committed = 0;
+    tc->next_timestamp = 0;
+    tc->window_sum = 0;
+    tc->window_fill = 0;
+
+    MUTEX_LOCK(&tc->lock);
+    tc->state = TRIGCAP_STATE_ARMED;
+    tc->trigger_timestamp = 0;
+    tc->fire_pending = false;
+    MUTEX_UNLOCK(&tc->lock);
+}
+
+void trigcap_fire(struct trigcap *tc, uint64_t timestamp)
+{
+    MUTEX_LOCK(&tc->lock);
+    if (tc->state == TRIGCAP_STATE_ARMED && !tc->fire_pending) {
+        tc->fire_pending = true;
+        tc->fire_timestamp = timestamp;
+    }
+    MUTEX_UNLOCK(&tc->lock);
+}
+
+int16_t *trigcap_next_buffer(struct trigcap *tc)
+{
+    const unsigned int idx = (unsigned int) (tc->num_committed %
+                                             tc->num_blocks);
+
+    return &tc->ring[(size_t) idx * tc->config.samples_per_buffer * 2];
+}
+
+enum trigcap_state trigcap_commit(struct trigcap *tc,
+                                  const struct bladerf_metadata *meta)
+{
+    const unsigned int idx = (unsigned int) (tc->num_committed %
+                                             tc->num_blocks);
+    int16_t *samples = trigcap_next_buffer(tc);
+    const unsigned int count = uint_min(meta->actual_count,
+                                        tc->config.samples_per_buffer);
+    const uint64_t block_end = meta->timestamp + count;
+    enum trigcap_state state;
+    uint64_t trigger_timestamp;
+
+#if BLADERF_BIG_ENDIAN
+    unsigned int i;
+    for (i = 0; i < 2 * count; i++) {
+        samples[i] = LE16_TO_HOST(samples[i]);
+    }
+#endif
+
+    tc->blocks[idx].timestamp = meta->timestamp;
+    tc->blocks[idx].count = count;
+    tc->num_committed++;
+
+    MUTEX_LOCK(&tc->lock);
+    state = tc->state;
+
+    if (state == TRIGCAP_STATE_ARMED) {
+        /* An external trigger takes effect once the block containing its
+         * timestamp has been received, so that none of the pre-trigger
+         * history is overwritten before then. */
+        if (tc->fire_pending && tc->fire_timestamp < block_end) {
+            tc->trigger_timestamp = tc->fire_timestamp;
+            tc->fire_pending = false;
+            state = TRIGCAP_STATE_TRIGGERED;
+        } else if (tc->threshold >= 0) {
+            MUTEX_UNLOCK(&tc->lock);
+
+            if (detect(tc, samples, count, meta->timestamp,
+                       &trigger_timestamp)) {
+                MUTEX_LOCK(&tc->lock);
+                tc->trigger_timestamp = trigger_timestamp;
+                tc->fire_pending = false;
+                state = TRIGCAP_STATE_TRIGGERED;
+            } else {
+                MUTEX_LOCK(&tc->lock);
+            }
+        }
+    }
+
+    if (state == TRIGCAP_STATE_TRIGGERED &&
+        block_end >= tc->trigger_timestamp + tc->config.post_samples) {
+        state = TRIGCAP_STATE_DONE;
+    }
+
+    tc->state = state;
+    MUTEX_UNLOCK(&tc->lock);
+
+    tc->next_timestamp = block_end;
+    return state;
+}
+
+int trigcap_rx(struct trigcap *tc, struct bladerf *dev,
+               unsigned int timeout_ms)
+{
+    int status;
+    struct bladerf_metadata meta;
+
+    memset(&meta, 0, sizeof(meta));
+    meta.flags = BLADERF_META_FLAG_RX_NOW;
+
+    status = bladerf_sync_rx(dev, trigcap_next_buffer(tc),
+                             tc->config.samples_per_buffer, &meta,
+                             timeout_ms);
+
+    if (status == 0) {
+        trigcap_commit(tc, &meta);
+    }
+
+    return status;
+}
+
+enum trigcap_state trigcap_get_state(struct trigcap *tc)
+{
+    enum trigcap_state state;
+
+    MUTEX_LOCK(&tc->lock);
+    state = tc->state;
+    MUTEX_UNLOCK(&tc->lock);
+
+    return state;
+}
+
+uint64_t trigcap_trigger_timestamp(struct trigcap *tc)
+{
+    uint64_t timestamp;
+
+    MUTEX_LOCK(&tc->lock);
+    timestamp = tc->trigger_timestamp;
+    MUTEX_UNLOCK(&tc->lock);
+
+    return timestamp;
+}
+
+int trigcap_write(struct trigcap *tc, trigcap_write_fn write_fn,
+                  void *user_data)
+{
+    int status = 0;
+    uint64_t i, first, start, end;
+    const unsigned int spb = tc->config.samples_per_buffer;
+
+    if (trigcap_get_state(tc) != TRIGCAP_STATE_DONE) {
+        return BLADERF_ERR_INVAL;
+    }
+
+    /* Range of timestamps to write */
+    start = tc->trigger_timestamp -
+                u64_min(tc->trigger_timestamp, tc->config.pre_samples);
+    end = tc->trigger_timestamp + tc->config.post_samples;
+
+    /* Oldest block still present in the ring */
+    first = tc->num_committed - u64_min(tc->num_committed, tc->num_blocks);
+
+    for (i = first; i < tc->num_committed && status == 0; i++) {
+        const unsigned int idx = (unsigned int) (i % tc->num_blocks);
+        const struct trigcap_block *b = &tc->blocks[idx];
+        const uint64_t b_start = u64_max(b->timestamp, start);
+        const uint64_t b_end = u64_min(b->timestamp + b->count, end);
+
+        if (b_start < b_end) {
+            const size_t offset = (size_t) (b_start - b->timestamp);
+            int16_t *samples = &tc->ring[((size_t) idx * spb +
+                                                offset) * 2];
+
+            status = write_fn(user_data, samples,
+                              (unsigned int) (b_end - b_start), b_start);
+        }
+    }
+
+    return status;
+}
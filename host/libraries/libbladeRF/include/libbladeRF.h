@@ -113,6 +113,9 @@ typedef enum {
     BLADERF_BACKEND_LIBUSB, /**< libusb */
     BLADERF_BACKEND_CYPRESS, /**< CyAPI */
     BLADERF_BACKEND_DUMMY = 100, /**< Dummy used for development purposes */
+    BLADERF_BACKEND_SIM = 101,   /**< Simulated device, for testing without
+                                  *   hardware */
+    BLADERF_BACKEND_REPLAY = 102, /**< Replay of a recorded USB trace */
 } bladerf_backend;
 
 /** Length of device serial number string, including NUL-terminator */
@@ -256,6 +259,11 @@ int CALL_CONV bladerf_open_with_devinfo(struct bladerf **device,
  *   - libusb:  libusb (See libusb changelog notes for required version, given
  *   your OS and controller)
  *   - cypress: Cypress CyUSB/CyAPI backend (Windows only)
+ *   - sim:     Simulated device. Only available when libbladeRF is built
+ *   with -DENABLE_BACKEND_SIM=ON, and only used when explicitly requested.
+ *   - replay:  Replay of a USB trace recorded with BLADERF_USB_TRACE. Only
+ *   available when libbladeRF is built with -DENABLE_USB_TRACE=ON, and only
+ *   used when explicitly requested.
  *
  * If no arguments are provided after the backend, the first encountered
  * device on the specified backend will be opened. Note that a backend is
@@ -4184,6 +4192,24 @@ int CALL_CONV bladerf_write_trigger(struct bladerf *dev,
                                     bladerf_trigger_signal signal,
                                     uint8_t val);
 
+/**
+ * Get the number of control requests issued to the device since it was
+ * opened.
+ *
+ * Each request is a single NIOS II peripheral access, consisting of one USB
+ * bulk transfer to the device and one back. This is intended to be sampled
+ * before and after other calls, to determine how many requests they issue.
+ * Firmware and flash operations are not included.
+ *
+ * @param   dev             Device handle
+ * @param   count           Pointer to variable that the count is read into
+ *
+ * @return 0 on success, value from \ref RETCODES list on failure
+ */
+API_EXPORT
+int CALL_CONV bladerf_get_ctrl_request_count(struct bladerf *dev,
+                                             uint64_t *count);
+
 /** @} (End of LOW_LEVEL) */
 
 /**
@@ -140,6 +140,12 @@ const char * backend2str(bladerf_backend backend)
         case BLADERF_BACKEND_CYPRESS:
             return BACKEND_STR_CYPRESS;
 
+        case BLADERF_BACKEND_SIM:
+            return BACKEND_STR_SIM;
+
+        case BLADERF_BACKEND_REPLAY:
+            return BACKEND_STR_REPLAY;
+
         default:
             return BACKEND_STR_ANY;
     }
@@ -155,6 +161,10 @@ int str2backend(const char *str, bladerf_backend *backend)
         *backend = BLADERF_BACKEND_LINUX;
     } else if (!strcasecmp(BACKEND_STR_CYPRESS, str)) {
         *backend = BLADERF_BACKEND_CYPRESS;
+    } else if (!strcasecmp(BACKEND_STR_SIM, str)) {
+        *backend = BLADERF_BACKEND_SIM;
+    } else if (!strcasecmp(BACKEND_STR_REPLAY, str)) {
+        *backend = BLADERF_BACKEND_REPLAY;
     } else if (!strcasecmp(BACKEND_STR_ANY, str)) {
         *backend = BLADERF_BACKEND_ANY;
     } else {
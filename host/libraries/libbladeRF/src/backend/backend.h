@@ -33,6 +33,8 @@
 #define BACKEND_STR_LIBUSB "libusb"
 #define BACKEND_STR_LINUX  "linux"
 #define BACKEND_STR_CYPRESS "cypress"
+#define BACKEND_STR_SIM    "sim"
+#define BACKEND_STR_REPLAY "replay"
 
 /**
  * Specifies what to probe for
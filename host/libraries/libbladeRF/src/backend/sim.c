@@ -0,0 +1,1625 @@
+/*
+ * Simulated device backend
+ *
+ * This backend stands in for a bladeRF attached over USB 3.0, so that
+ * libbladeRF and the programs built upon it can be exercised without
+ * hardware. It is selected with the "sim" device identifier backend (e.g.,
+ * "sim:"), and is never reported by a device probe or opened on behalf of the
+ * "*" backend.
+ *
+ * What is modeled:
+ *  - FX3 firmware v2.0.0 and an autoloaded 40 kLE FPGA v0.6.0, so that all of
+ *    the capabilities of that FPGA (timestamps, FPGA tuning, scheduled
+ *    retunes, ...) are available.
+ *
+ *  - The LMS6002D and Si5338 register files. The LMS6002D's VTUNE comparator
+ *    reports HIGH/NORM/LOW around the VCOCAP value expected for the
+ *    programmed VCO frequency, so the host-based VCOCAP search converges.
+ *
+ *  - The FPGA's RX and TX timestamp counters, which run at the Si5338's
+ *    sample rate while a module is enabled.
+ *
+ *  - RX sample streams, containing a full-scale Fs/4 tone whose phase follows
+ *    the sample timestamp, or the FPGA's sample counter when counter mode is
+ *    enabled. When timestamps are enabled, each message carries a metadata
+ *    header, exactly as the FPGA provides them.
+ *
+ *  - TX sample streams, which are consumed at the sample rate. Message
+ *    timestamps are honored: future timestamps idle the transmitter until
+ *    they are reached, and timestamps that have already passed are counted
+ *    as late.
+ *
+ *  - The NIOS II retune queues. Retunes are applied immediately, or queued
+ *    until the module's timestamp counter reaches the requested time.
+ *    Queued retunes are applied as stream transfers complete, or as
+ *    timestamps are read.
+ *
+ *  - Approximately 8192 samples of device buffering, beyond which RX samples
+ *    are lost if the host does not keep up.
+ *
+ * The simulator is configured via the following environment variables,
+ * which are read when the device is opened:
+ *
+ *  - BLADERF_SIM_THROTTLE      Pace streams at the sample rate (default: 1).
+ *                              When disabled, transfers complete as quickly
+ *                              as the USB bus allows, and timestamps advance
+ *                              only with the stream.
+ *  - BLADERF_SIM_SPEED         "super" (default) or "high". The latter
+ *                              selects USB 2.0 sized messages.
+ *  - BLADERF_SIM_LATENCY_US    Delay from when a transfer's samples are
+ *                              available until it completes (default: 0)
+ *  - BLADERF_SIM_STALL_RATE    Probability of a transfer stalling (default: 0)
+ *  - BLADERF_SIM_STALL_MS      Duration of a stall (default: 10)
+ *  - BLADERF_SIM_OVERRUN_RATE  Probability of a buffer's worth of RX samples
+ *                              being dropped ahead of a transfer (default: 0)
+ *
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <errno.h>
+
+#include "rel_assert.h"
+#include "bladerf_priv.h"
+#include "backend/backend.h"
+#include "backend/backend_config.h"
+#include "async.h"
+#include "metadata.h"
+#include "capabilities.h"
+#include "flash_fields.h"
+#include "si5338.h"
+#include "nios_pkt_retune.h"
+#include "conversions.h"
+#include "log.h"
+
+#define SIM_FW_VERSION          "2.0.0"
+#define SIM_FPGA_VERSION        "0.6.0"
+#define SIM_FPGA_SIZE           "40"
+#define SIM_VCTCXO_TRIM         0x8000
+#define SIM_SERIAL              "53494d00000000000000000000000000"
+
+/* Sample rate both modules start out with */
+#define SIM_DEFAULT_SAMPLE_RATE 1000000
+
+#define SIM_TRANSFER_TIMEOUT_MS 1000
+
+/* Number of samples the device can hold while the host is not accepting
+ * them, before RX samples are dropped */
+#define SIM_FIFO_SAMPLES        8192
+
+/* RX tone amplitude (SC16 Q11) */
+#define SIM_TONE_AMPLITUDE      2047
+
+/* Depth of the NIOS II retune queues */
+#define SIM_RETUNE_QUEUE_MAX    16
+
+/* VTUNE comparator values, as read from bits [7:6] of PLL register 0xA */
+#define SIM_VTUNE_NORM          0x00
+#define SIM_VTUNE_LOW           0x01
+#define SIM_VTUNE_HIGH          0x02
+
+/* VCOCAP values within this distance of the ideal value yield VTUNE NORM */
+#define SIM_VTUNE_NORM_HALF     5
+
+/* Longest interval a stream sleeps before rechecking its state */
+#define SIM_WAIT_MAX_NS         (10 * 1000 * 1000ull)
+
+/* Approximate USB throughput, in bytes per second, which limits how quickly
+ * transfers complete when the simulator is not throttled */
+#define SIM_USB_RATE_SUPER      (350 * 1000 * 1000ull)
+#define SIM_USB_RATE_HIGH       (40 * 1000 * 1000ull)
+
+#define NSEC_PER_SEC            1000000000ull
+
+struct sim_config {
+    bool throttle;
+    bladerf_dev_speed speed;
+    unsigned int latency_us;
+    double stall_rate;
+    unsigned int stall_ms;
+    double overrun_rate;
+};
+
+struct sim_retune {
+    uint64_t timestamp;
+    uint16_t nint;
+    uint32_t nfrac;
+    uint8_t freqsel;
+    uint8_t vcocap;
+    bool low_band;
+    bool quick_tune;
+};
+
+struct sim_module {
+    bool enabled;
+    double sample_rate;     /* Rate of the timestamp counter, in Hz */
+    uint64_t timestamp;     /* Timestamp counter value at anchor_ns */
+    uint64_t anchor_ns;
+
+    struct sim_retune retunes[SIM_RETUNE_QUEUE_MAX];
+    unsigned int retune_count;
+    unsigned int retune_idx;
+
+    int16_t iq_gain;
+    int16_t iq_phase;
+    uint8_t trigger;
+
+    /* Event counts, logged when a stream completes */
+    uint64_t transfers;
+    uint64_t overruns;          /* RX samples dropped; includes injected */
+    uint64_t injected_overruns;
+    uint64_t underruns;         /* TX ran out of samples */
+    uint64_t late;              /* TX messages with a timestamp in the past */
+    uint64_t stalls;
+    uint64_t retunes_applied;
+};
+
+struct bladerf_sim {
+    /* Protects everything below. Held only briefly, and may be acquired
+     * while holding a stream's lock, but not vice versa. */
+    MUTEX lock;
+
+    struct sim_config config;
+    uint64_t prng;
+
+    uint8_t lms_regs[128];
+    uint8_t si5338_regs[256];
+
+    uint32_t config_gpio;
+    uint32_t xb_gpio;
+    uint32_t xb_gpio_dir;
+    uint16_t vctcxo_dac;
+    bladerf_vctcxo_tamer_mode tamer_mode;
+    bool fw_loopback;
+
+    struct sim_module modules[NUM_MODULES];
+};
+
+struct sim_transfer {
+    void *buffer;
+    uint64_t submit_ns;
+};
+
+struct sim_stream_data {
+    size_t num_transfers;           /* Total # of transfers */
+    size_t num_avail;               /* # of currently available transfers */
+    size_t head;                    /* Index of the oldest in-flight transfer */
+    struct sim_transfer *transfers; /* In-flight transfers, oldest at head */
+
+    /* Signaled when a buffer is submitted or the stream is shut down */
+    pthread_cond_t wakeup;
+
+    bool meta;              /* Buffers consist of metadata messages */
+    bool counter_mode;      /* RX samples are replaced by a counter */
+
+    bool started;
+    uint64_t pos;           /* Timestamp following the last transfer */
+
+    /* Schedule for the transfer at head, set when it reaches the front
+     * of the queue */
+    bool head_scheduled;
+    bool head_timed_out;
+    uint64_t head_start;    /* Timestamp of its first sample */
+    uint64_t head_end;      /* Timestamp following its last sample */
+    uint64_t head_due_ns;   /* Time at which it completes */
+
+    uint64_t bus_free_ns;   /* Time at which the previous transfer's data
+                             * finished crossing the bus */
+};
+
+static inline struct bladerf_sim *sim_backend(struct bladerf *dev)
+{
+    assert(dev && dev->backend);
+    return (struct bladerf_sim *) dev->backend;
+}
+
+/* Each peripheral access stands in for one NIOS II request, and is counted as
+ * the USB backend counts those. Called with dev->ctrl_lock held. */
+static inline struct bladerf_sim *sim_request(struct bladerf *dev)
+{
+    dev->ctrl_requests++;
+    return sim_backend(dev);
+}
+
+static uint64_t sim_now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t) t.tv_sec * NSEC_PER_SEC + (uint64_t) t.tv_nsec;
+}
+
+/* Returns true with the specified probability */
+static bool sim_chance(struct bladerf_sim *sim, double probability)
+{
+    uint64_t x;
+
+    if (probability <= 0.0) {
+        return false;
+    }
+
+    /* xorshift64 */
+    x = sim->prng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sim->prng = x;
+
+    return (x >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+/******************************************************************************
+ * Configuration
+ ******************************************************************************/
+
+static bool env_uint(const char *name, unsigned int max, unsigned int *value)
+{
+    bool ok = true;
+    const char *str = getenv(name);
+
+    if (str != NULL) {
+        *value = str2uint(str, 0, max, &ok);
+        if (!ok) {
+            log_warning("Invalid %s value: %s\n", name, str);
+        }
+    }
+
+    return ok;
+}
+
+static bool env_probability(const char *name, double *value)
+{
+    bool ok = true;
+    const char *str = getenv(name);
+
+    if (str != NULL) {
+        *value = str2double(str, 0.0, 1.0, &ok);
+        if (!ok) {
+            log_warning("Invalid %s value: %s\n", name, str);
+        }
+    }
+
+    return ok;
+}
+
+static int sim_load_config(struct sim_config *cfg)
+{
+    const char *str;
+    bool ok = true;
+
+    cfg->throttle = true;
+    cfg->speed = BLADERF_DEVICE_SPEED_SUPER;
+    cfg->latency_us = 0;
+    cfg->stall_rate = 0.0;
+    cfg->stall_ms = 10;
+    cfg->overrun_rate = 0.0;
+
+    str = getenv("BLADERF_SIM_THROTTLE");
+    if (str != NULL && str2bool(str, &cfg->throttle) != 0) {
+        log_warning("Invalid BLADERF_SIM_THROTTLE value: %s\n", str);
+        ok = false;
+    }
+
+    str = getenv("BLADERF_SIM_SPEED");
+    if (str != NULL) {
+        if (!strcasecmp(str, "high")) {
+            cfg->speed = BLADERF_DEVICE_SPEED_HIGH;
+        } else if (strcasecmp(str, "super")) {
+            log_warning("Invalid BLADERF_SIM_SPEED value: %s\n", str);
+            ok = false;
+        }
+    }
+
+    ok = env_uint("BLADERF_SIM_LATENCY_US", 10000000, &cfg->latency_us) && ok;
+    ok = env_probability("BLADERF_SIM_STALL_RATE", &cfg->stall_rate) && ok;
+    ok = env_uint("BLADERF_SIM_STALL_MS", 60000, &cfg->stall_ms) && ok;
+    ok = env_probability("BLADERF_SIM_OVERRUN_RATE", &cfg->overrun_rate) && ok;
+
+    return ok ? 0 : BLADERF_ERR_INVAL;
+}
+
+/******************************************************************************
+ * Timestamp counters and retune queues
+ *
+ * These must be called with sim->lock held.
+ ******************************************************************************/
+
+static uint64_t sim_counter(struct bladerf_sim *sim, bladerf_module module,
+                            uint64_t now_ns)
+{
+    const struct sim_module *m = &sim->modules[module];
+
+    /* When not running in real time, the counter only moves with the
+     * module's stream */
+    if (!sim->config.throttle || !m->enabled || now_ns <= m->anchor_ns) {
+        return m->timestamp;
+    }
+
+    return m->timestamp +
+           (uint64_t) ((now_ns - m->anchor_ns) * m->sample_rate / NSEC_PER_SEC);
+}
+
+/* Time at which a module's counter reaches the specified timestamp */
+static uint64_t sim_counter_time(struct bladerf_sim *sim,
+                                 bladerf_module module, uint64_t timestamp)
+{
+    const struct sim_module *m = &sim->modules[module];
+
+    if (timestamp <= m->timestamp) {
+        return m->anchor_ns;
+    }
+
+    return m->anchor_ns +
+           (uint64_t) ((timestamp - m->timestamp) * NSEC_PER_SEC /
+                       m->sample_rate);
+}
+
+/* VCOCAP value in the middle of the VTUNE NORM window, for the frequency the
+ * PLL at the specified base address is programmed to */
+static int sim_vcocap_center(struct bladerf_sim *sim, uint8_t base)
+{
+    static const double vco_range[4][2] = {
+        { 3800e6, 4535e6 },     /* VCO4 */
+        { 4535e6, 5408e6 },     /* VCO3 */
+        { 5408e6, 6480e6 },     /* VCO2 */
+        { 6480e6, 7600e6 },     /* VCO1 */
+    };
+
+    const uint8_t *regs = sim->lms_regs;
+    const uint8_t freqsel = regs[base + 5] >> 2;
+    const unsigned int vco = (freqsel >> 3) & 0x7;
+    const uint16_t nint = (regs[base] << 1) | (regs[base + 1] >> 7);
+    const uint32_t nfrac = ((regs[base + 1] & 0x7f) << 16) |
+                           (regs[base + 2] << 8) | regs[base + 3];
+    double f_vco, low, high;
+    int vcocap;
+
+    if (vco < 4) {
+        return 32;
+    }
+
+    f_vco = 38.4e6 * (nint + nfrac / 8388608.0);
+    low = vco_range[vco - 4][0];
+    high = vco_range[vco - 4][1];
+
+    vcocap = (int) (15.0 + 40.0 * (f_vco - low) / (high - low) + 0.5);
+
+    if (vcocap < SIM_VTUNE_NORM_HALF + 1) {
+        vcocap = SIM_VTUNE_NORM_HALF + 1;
+    } else if (vcocap > 62 - SIM_VTUNE_NORM_HALF) {
+        vcocap = 62 - SIM_VTUNE_NORM_HALF;
+    }
+
+    return vcocap;
+}
+
+static uint8_t sim_vtune(struct bladerf_sim *sim, uint8_t base)
+{
+    const int vcocap = sim->lms_regs[base + 9] & 0x3f;
+    const int center = sim_vcocap_center(sim, base);
+
+    if (vcocap < center - SIM_VTUNE_NORM_HALF) {
+        return SIM_VTUNE_HIGH;
+    } else if (vcocap > center + SIM_VTUNE_NORM_HALF) {
+        return SIM_VTUNE_LOW;
+    } else {
+        return SIM_VTUNE_NORM;
+    }
+}
+
+/* Program the PLL as the NIOS II does for a retune request */
+static void sim_apply_retune(struct bladerf_sim *sim, bladerf_module module,
+                             const struct sim_retune *r)
+{
+    const uint8_t base = (module == BLADERF_MODULE_RX) ? 0x20 : 0x10;
+    uint8_t *regs = sim->lms_regs;
+    uint8_t vcocap;
+
+    regs[base + 0] = r->nint >> 1;
+    regs[base + 1] = ((r->nint & 1) << 7) | ((r->nfrac >> 16) & 0x7f);
+    regs[base + 2] = (r->nfrac >> 8) & 0xff;
+    regs[base + 3] = r->nfrac & 0xff;
+    regs[base + 5] = (r->freqsel << 2) | (r->low_band ? 1 : 2);
+
+    /* Without a quick tune, the NIOS II searches for the VCOCAP value
+     * centered in the VTUNE NORM window */
+    vcocap = r->quick_tune ? r->vcocap : (uint8_t) sim_vcocap_center(sim, base);
+    regs[base + 9] = (regs[base + 9] & ~0x3f) | (vcocap & 0x3f);
+
+    sim->modules[module].retunes_applied++;
+
+    log_verbose("sim: %s retune applied: nint=%u nfrac=%u freqsel=0x%02x "
+                "vcocap=%u\n", module2str(module), r->nint, r->nfrac,
+                r->freqsel, vcocap);
+}
+
+/* Apply queued retunes that have come due */
+static void sim_run_retunes(struct bladerf_sim *sim, bladerf_module module,
+                            uint64_t now_ns)
+{
+    struct sim_module *m = &sim->modules[module];
+    const uint64_t counter = sim_counter(sim, module, now_ns);
+
+    while (m->retune_count > 0 &&
+           m->retunes[m->retune_idx].timestamp <= counter) {
+
+        sim_apply_retune(sim, module, &m->retunes[m->retune_idx]);
+        m->retune_idx = (m->retune_idx + 1) % SIM_RETUNE_QUEUE_MAX;
+        m->retune_count--;
+    }
+}
+
+/******************************************************************************
+ * Device open/close and identification
+ ******************************************************************************/
+
+/* The simulator is never "found" -- it must be requested explicitly */
+static int sim_probe(backend_probe_target probe_target,
+                     struct bladerf_devinfo_list *info_list)
+{
+    return 0;
+}
+
+static bool sim_matches(bladerf_backend backend)
+{
+    return backend == BLADERF_BACKEND_SIM;
+}
+
+static void sim_set_version(struct bladerf_version *version, const char *str)
+{
+    /* describe was allocated by the caller */
+    strncpy((char *) version->describe, str, BLADERF_VERSION_STR_MAX);
+    str2version(version->describe, version);
+}
+
+static int sim_open(struct bladerf *dev, struct bladerf_devinfo *info)
+{
+    int status;
+    struct bladerf_sim *sim;
+    struct bladerf_devinfo ident;
+
+    if (info->backend != BLADERF_BACKEND_SIM) {
+        return BLADERF_ERR_NODEV;
+    }
+
+    bladerf_init_devinfo(&ident);
+    ident.backend = BLADERF_BACKEND_SIM;
+    ident.usb_bus = 0;
+    ident.usb_addr = 0;
+    ident.instance = 0;
+    strncpy(ident.serial, SIM_SERIAL, BLADERF_SERIAL_LENGTH - 1);
+    ident.serial[BLADERF_SERIAL_LENGTH - 1] = '\0';
+
+    if (!bladerf_devinfo_matches(&ident, info)) {
+        return BLADERF_ERR_NODEV;
+    }
+
+    sim = calloc(1, sizeof(*sim));
+    if (sim == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    status = sim_load_config(&sim->config);
+    if (status != 0) {
+        free(sim);
+        return status;
+    }
+
+    MUTEX_INIT(&sim->lock);
+    sim->prng = 0x5eed5eed5eed5eedull;
+    sim->vctcxo_dac = SIM_VCTCXO_TRIM;
+    sim->tamer_mode = BLADERF_VCTCXO_TAMER_DISABLED;
+
+    /* LMS6002D chip version */
+    sim->lms_regs[0x04] = 0x22;
+
+    /* LNA gain at its reset value (max) */
+    sim->lms_regs[0x75] = 0xd0;
+
+    memcpy(&dev->ident, &ident, sizeof(ident));
+    dev->backend = sim;
+    dev->fn = &backend_fns_sim;
+
+    dev->transfer_timeout[BLADERF_MODULE_TX] = SIM_TRANSFER_TIMEOUT_MS;
+    dev->transfer_timeout[BLADERF_MODULE_RX] = SIM_TRANSFER_TIMEOUT_MS;
+
+    sim_set_version(&dev->fw_version, SIM_FW_VERSION);
+    capabilities_init_pre_fpga_load(dev);
+
+    /* The FPGA is always autoloaded */
+    sim_set_version(&dev->fpga_version, SIM_FPGA_VERSION);
+    capabilities_init_post_fpga_load(dev);
+
+    /* Give the sample clocks a valid configuration, so that timestamp
+     * rates can be read back before init_device() sets them */
+    status = si5338_set_sample_rate(dev, BLADERF_MODULE_RX,
+                                    SIM_DEFAULT_SAMPLE_RATE, NULL);
+    if (status == 0) {
+        status = si5338_set_sample_rate(dev, BLADERF_MODULE_TX,
+                                        SIM_DEFAULT_SAMPLE_RATE, NULL);
+    }
+
+    if (status != 0) {
+        free(sim);
+        dev->backend = NULL;
+        dev->fn = NULL;
+        return status;
+    }
+
+    log_debug("Opened simulated device (throttle=%d, speed=%s)\n",
+              sim->config.throttle, devspeed2str(sim->config.speed));
+
+    return 0;
+}
+
+static void sim_close(struct bladerf *dev)
+{
+    struct bladerf_sim *sim = dev->backend;
+
+    if (sim != NULL) {
+        pthread_mutex_destroy(&sim->lock);
+        free(sim);
+        dev->backend = NULL;
+    }
+}
+
+static int sim_load_fpga(struct bladerf *dev, uint8_t *image,
+                         size_t image_size)
+{
+    /* The image is accepted, but the simulated FPGA does not change */
+    return 0;
+}
+
+static int sim_is_fpga_configured(struct bladerf *dev)
+{
+    return 1;
+}
+
+static int sim_erase_flash_blocks(struct bladerf *dev,
+                                  uint32_t eb, uint16_t count)
+{
+    log_debug("The simulated device does not support flash writes.\n");
+    return BLADERF_ERR_UNSUPPORTED;
+}
+
+static int sim_read_flash_pages(struct bladerf *dev, uint8_t *buf,
+                                uint32_t page, uint32_t count)
+{
+    /* Erased flash */
+    memset(buf, 0xff, (size_t) count * BLADERF_FLASH_PAGE_SIZE);
+    return 0;
+}
+
+static int sim_write_flash_pages(struct bladerf *dev, const uint8_t *buf,
+                                 uint32_t page, uint32_t count)
+{
+    log_debug("The simulated device does not support flash writes.\n");
+    return BLADERF_ERR_UNSUPPORTED;
+}
+
+static int sim_device_reset(struct bladerf *dev)
+{
+    return 0;
+}
+
+static int sim_jump_to_bootloader(struct bladerf *dev)
+{
+    return BLADERF_ERR_UNSUPPORTED;
+}
+
+static int sim_get_cal(struct bladerf *dev, char *cal)
+{
+    int status;
+    char dac[7];
+
+    memset(cal, 0xff, CAL_BUFFER_SIZE);
+
+    status = add_field(cal, CAL_BUFFER_SIZE, "B", SIM_FPGA_SIZE);
+    if (status == 0) {
+        snprintf(dac, sizeof(dac), "%u", SIM_VCTCXO_TRIM);
+        status = add_field(cal, CAL_BUFFER_SIZE, "DAC", dac);
+    }
+
+    return status < 0 ? BLADERF_ERR_UNEXPECTED : 0;
+}
+
+static int sim_get_otp(struct bladerf *dev, char *otp)
+{
+    int status;
+
+    memset(otp, 0xff, OTP_BUFFER_SIZE);
+
+    status = add_field(otp, OTP_BUFFER_SIZE, "S", SIM_SERIAL);
+    return status < 0 ? BLADERF_ERR_UNEXPECTED : 0;
+}
+
+static int sim_get_device_speed(struct bladerf *dev, bladerf_dev_speed *speed)
+{
+    *speed = sim_backend(dev)->config.speed;
+    return 0;
+}
+
+/******************************************************************************
+ * Peripheral access
+ ******************************************************************************/
+
+static int sim_config_gpio_write(struct bladerf *dev, uint32_t val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->config_gpio = val;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_config_gpio_read(struct bladerf *dev, uint32_t *val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *val = sim->config_gpio;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_expansion_gpio_write(struct bladerf *dev,
+                                    uint32_t mask, uint32_t val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->xb_gpio = (sim->xb_gpio & ~mask) | (val & mask);
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_expansion_gpio_read(struct bladerf *dev, uint32_t *val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *val = sim->xb_gpio;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_expansion_gpio_dir_write(struct bladerf *dev,
+                                        uint32_t mask, uint32_t outputs)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->xb_gpio_dir = (sim->xb_gpio_dir & ~mask) | (outputs & mask);
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_expansion_gpio_dir_read(struct bladerf *dev, uint32_t *outputs)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *outputs = sim->xb_gpio_dir;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_set_iq_gain_correction(struct bladerf *dev,
+                                      bladerf_module module, int16_t value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->modules[module].iq_gain = value;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_set_iq_phase_correction(struct bladerf *dev,
+                                       bladerf_module module, int16_t value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->modules[module].iq_phase = value;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_get_iq_gain_correction(struct bladerf *dev,
+                                      bladerf_module module, int16_t *value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *value = sim->modules[module].iq_gain;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_get_iq_phase_correction(struct bladerf *dev,
+                                       bladerf_module module, int16_t *value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *value = sim->modules[module].iq_phase;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_get_timestamp(struct bladerf *dev, bladerf_module module,
+                             uint64_t *value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+    const uint64_t now = sim_now_ns();
+
+    MUTEX_LOCK(&sim->lock);
+    sim_run_retunes(sim, module, now);
+    *value = sim_counter(sim, module, now);
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_si5338_write(struct bladerf *dev, uint8_t addr, uint8_t data)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->si5338_regs[addr] = data;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_si5338_read(struct bladerf *dev, uint8_t addr, uint8_t *data)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *data = sim->si5338_regs[addr];
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_lms_write(struct bladerf *dev, uint8_t addr, uint8_t data)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    /* Bit 7 requests an atomic multi-register write, which is inherently
+     * the case here */
+    addr &= 0x7f;
+
+    MUTEX_LOCK(&sim->lock);
+    sim->lms_regs[addr] = data;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_lms_read(struct bladerf *dev, uint8_t addr, uint8_t *data)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    addr &= 0x7f;
+
+    MUTEX_LOCK(&sim->lock);
+    if (addr == 0x1a || addr == 0x2a) {
+        /* PLL register 0xA: VTUNE comparator outputs in bits [7:6] */
+        *data = (sim->lms_regs[addr] & 0x3f) |
+                (sim_vtune(sim, addr & 0xf0) << 6);
+    } else {
+        *data = sim->lms_regs[addr];
+    }
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_vctcxo_dac_write(struct bladerf *dev, uint16_t value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->vctcxo_dac = value;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_vctcxo_dac_read(struct bladerf *dev, uint16_t *value)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *value = sim->vctcxo_dac;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_set_vctcxo_tamer_mode(struct bladerf *dev,
+                                     bladerf_vctcxo_tamer_mode mode)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->tamer_mode = mode;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_get_vctcxo_tamer_mode(struct bladerf *dev,
+                                     bladerf_vctcxo_tamer_mode *mode)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *mode = sim->tamer_mode;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_xb_spi(struct bladerf *dev, uint32_t value)
+{
+    /* No expansion board is attached */
+    sim_request(dev);
+    return 0;
+}
+
+static int sim_set_firmware_loopback(struct bladerf *dev, bool enable)
+{
+    struct bladerf_sim *sim = sim_backend(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    sim->fw_loopback = enable;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_get_firmware_loopback(struct bladerf *dev, bool *is_enabled)
+{
+    struct bladerf_sim *sim = sim_backend(dev);
+
+    MUTEX_LOCK(&sim->lock);
+    *is_enabled = sim->fw_loopback;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+/* Rate at which a module's timestamp counter runs */
+static double sim_sample_rate(struct bladerf *dev, bladerf_module module)
+{
+    struct bladerf_rational_rate rate;
+    int status;
+
+    status = si5338_get_rational_sample_rate(dev, module, &rate);
+    if (status != 0 || rate.den == 0 || (rate.integer == 0 && rate.num == 0)) {
+        log_debug("sim: Invalid %s sample rate configuration. Using %u Hz.\n",
+                  module2str(module), SIM_DEFAULT_SAMPLE_RATE);
+        return SIM_DEFAULT_SAMPLE_RATE;
+    }
+
+    return rate.integer + (double) rate.num / rate.den;
+}
+
+static int sim_enable_module(struct bladerf *dev, bladerf_module module,
+                             bool enable)
+{
+    struct bladerf_sim *sim = sim_backend(dev);
+    struct sim_module *m = &sim->modules[module];
+    const double rate = enable ? sim_sample_rate(dev, module) : 0.0;
+    uint64_t now;
+
+    MUTEX_LOCK(&sim->lock);
+    now = sim_now_ns();
+
+    if (enable && !m->enabled) {
+        m->sample_rate = rate;
+        m->anchor_ns = now;
+        m->enabled = true;
+    } else if (!enable && m->enabled) {
+        sim_run_retunes(sim, module, now);
+        m->timestamp = sim_counter(sim, module, now);
+        m->anchor_ns = now;
+        m->enabled = false;
+    }
+
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+/******************************************************************************
+ * Sample streams
+ ******************************************************************************/
+
+static inline size_t sim_msg_samples(struct bladerf *dev)
+{
+    return bytes_to_sc16q11(dev->msg_size - METADATA_HEADER_SIZE);
+}
+
+/* Sample timestamps spanned by a transfer */
+static size_t sim_payload_samples(struct bladerf_stream *stream)
+{
+    const struct sim_stream_data *sd = stream->backend_data;
+
+    if (sd->meta) {
+        const size_t n_msgs = async_stream_buf_bytes(stream) /
+                              stream->dev->msg_size;
+        return n_msgs * sim_msg_samples(stream->dev);
+    } else {
+        return stream->samples_per_buffer;
+    }
+}
+
+static void sim_fill_samples(int16_t *samples, uint64_t timestamp,
+                             size_t count, bool counter_mode)
+{
+    static const int16_t tone[4][2] = {
+        {  SIM_TONE_AMPLITUDE,  0                   },
+        {  0,                   SIM_TONE_AMPLITUDE  },
+        { -SIM_TONE_AMPLITUDE,  0                   },
+        {  0,                  -SIM_TONE_AMPLITUDE  },
+    };
+
+    size_t i;
+
+    if (counter_mode) {
+        /* The FPGA's counter increments with each sample, so its low
+         * 32 bits track the timestamp */
+        uint32_t *counter = (uint32_t *) samples;
+
+        for (i = 0; i < count; i++) {
+            counter[i] = HOST_TO_LE32((uint32_t) (timestamp + i));
+        }
+
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        const int16_t *s = tone[(timestamp + i) & 3];
+        samples[2 * i]     = HOST_TO_LE16(s[0]);
+        samples[2 * i + 1] = HOST_TO_LE16(s[1]);
+    }
+}
+
+static void sim_fill_rx(struct bladerf_stream *stream, void *buffer,
+                        uint64_t timestamp)
+{
+    const struct sim_stream_data *sd = stream->backend_data;
+
+    if (sd->meta) {
+        const size_t msg_size = stream->dev->msg_size;
+        const size_t msg_samples = sim_msg_samples(stream->dev);
+        const size_t n_msgs = async_stream_buf_bytes(stream) / msg_size;
+        uint8_t *msg = buffer;
+        size_t i;
+
+        for (i = 0; i < n_msgs; i++) {
+            metadata_set(msg, timestamp, 0);
+            sim_fill_samples((int16_t *) (msg + METADATA_HEADER_SIZE),
+                             timestamp, msg_samples, sd->counter_mode);
+
+            msg += msg_size;
+            timestamp += msg_samples;
+        }
+    } else {
+        sim_fill_samples(buffer, timestamp, stream->samples_per_buffer,
+                         sd->counter_mode);
+    }
+}
+
+/* Determine the span of TX timestamps a buffer occupies. Must be called with
+ * sim->lock held. */
+static uint64_t sim_consume_tx(struct bladerf_stream *stream, void *buffer,
+                               uint64_t pos, uint64_t counter)
+{
+    const bool meta = ((struct sim_stream_data *) stream->backend_data)->meta;
+    struct bladerf_sim *sim = sim_backend(stream->dev);
+    struct sim_module *m = &sim->modules[BLADERF_MODULE_TX];
+    const size_t msg_size = stream->dev->msg_size;
+    const size_t msg_samples = sim_msg_samples(stream->dev);
+    const size_t n_msgs = meta ? async_stream_buf_bytes(stream) / msg_size : 1;
+    const uint8_t *msg = buffer;
+    size_t i;
+
+    for (i = 0; i < n_msgs; i++) {
+        uint64_t timestamp = meta ? metadata_get_timestamp(msg) : 0;
+
+        if (timestamp != 0) {
+            if (timestamp < counter) {
+                m->late++;
+                timestamp = counter;
+            }
+
+            /* The transmitter idles until a future timestamp is reached */
+            if (timestamp > pos) {
+                pos = timestamp;
+            }
+        } else if (pos < counter) {
+            m->underruns++;
+            pos = counter;
+        }
+
+        pos += meta ? msg_samples : stream->samples_per_buffer;
+        msg += msg_size;
+    }
+
+    return pos;
+}
+
+/* Determine when the transfer at the head of the queue completes. Returns
+ * false if the module is not enabled, and no samples are flowing. */
+static bool sim_schedule_transfer(struct bladerf_stream *stream, uint64_t now)
+{
+    struct bladerf_sim *sim = sim_backend(stream->dev);
+    struct sim_stream_data *sd = stream->backend_data;
+    struct sim_transfer *t = &sd->transfers[sd->head];
+    struct sim_module *m = &sim->modules[stream->module];
+    const struct sim_config *cfg = &sim->config;
+    const uint64_t latency_ns = cfg->latency_us * 1000ull;
+    const uint64_t payload = sim_payload_samples(stream);
+    const unsigned int timeout_ms = stream->dev->transfer_timeout[stream->module];
+    uint64_t due;
+
+    MUTEX_LOCK(&sim->lock);
+
+    if (!m->enabled) {
+        MUTEX_UNLOCK(&sim->lock);
+        return false;
+    }
+
+    if (!sd->started) {
+        sd->pos = sim_counter(sim, stream->module, now);
+        sd->started = true;
+    }
+
+    if (stream->module == BLADERF_MODULE_RX) {
+        if (cfg->throttle) {
+            /* Samples accumulate in the device while no transfer is
+             * waiting for them, and are lost once the host falls further
+             * behind than the device can buffer */
+            const uint64_t counter =
+                sim_counter(sim, BLADERF_MODULE_RX, t->submit_ns);
+
+            if (counter > sd->pos + payload + SIM_FIFO_SAMPLES) {
+                log_debug("sim: RX overrun. %"PRIu64" samples dropped.\n",
+                          counter - payload - sd->pos);
+
+                m->overruns++;
+                sd->pos = counter - payload;
+            }
+        }
+
+        if (sim_chance(sim, cfg->overrun_rate)) {
+            m->overruns++;
+            m->injected_overruns++;
+            sd->pos += payload;
+        }
+
+        sd->head_start = sd->pos;
+        sd->head_end = sd->pos + payload;
+
+        if (cfg->throttle) {
+            due = sim_counter_time(sim, BLADERF_MODULE_RX, sd->head_end);
+        } else {
+            due = now;
+        }
+    } else {
+        /* The transmitter has had the samples since they were submitted */
+        const uint64_t counter =
+            sim_counter(sim, BLADERF_MODULE_TX, t->submit_ns);
+
+        sd->head_start = sd->pos;
+        sd->head_end = sim_consume_tx(stream, t->buffer, sd->pos, counter);
+
+        /* The transfer completes once the device has room for it */
+        if (cfg->throttle && sd->head_end > SIM_FIFO_SAMPLES) {
+            due = sim_counter_time(sim, BLADERF_MODULE_TX,
+                                   sd->head_end - SIM_FIFO_SAMPLES);
+        } else {
+            due = now;
+        }
+    }
+
+    if (cfg->throttle) {
+        due += latency_ns;
+    } else {
+        const uint64_t usb_rate = (cfg->speed == BLADERF_DEVICE_SPEED_SUPER) ?
+                                  SIM_USB_RATE_SUPER : SIM_USB_RATE_HIGH;
+
+        if (due < sd->bus_free_ns) {
+            due = sd->bus_free_ns;
+        }
+
+        due += async_stream_buf_bytes(stream) * NSEC_PER_SEC / usb_rate;
+        sd->bus_free_ns = due;
+
+        if (due < t->submit_ns + latency_ns) {
+            due = t->submit_ns + latency_ns;
+        }
+    }
+
+    if (sim_chance(sim, cfg->stall_rate)) {
+        m->stalls++;
+        due += cfg->stall_ms * 1000000ull;
+    }
+
+    MUTEX_UNLOCK(&sim->lock);
+
+    sd->head_timed_out = false;
+    if (timeout_ms != 0 &&
+        due > t->submit_ns + timeout_ms * 1000000ull) {
+        due = t->submit_ns + timeout_ms * 1000000ull;
+        sd->head_timed_out = true;
+    }
+
+    sd->head_due_ns = due;
+    sd->head_scheduled = true;
+    return true;
+}
+
+/* Wait on the stream's wakeup condition until the specified time, or for at
+ * most SIM_WAIT_MAX_NS. Must be called with stream->lock held. */
+static void sim_wait(struct bladerf_stream *stream, uint64_t until_ns)
+{
+    struct sim_stream_data *sd = stream->backend_data;
+    const uint64_t now = sim_now_ns();
+    struct timespec t;
+
+    if (until_ns > now + SIM_WAIT_MAX_NS) {
+        until_ns = now + SIM_WAIT_MAX_NS;
+    }
+
+    t.tv_sec = (time_t) (until_ns / NSEC_PER_SEC);
+    t.tv_nsec = (long) (until_ns % NSEC_PER_SEC);
+
+    pthread_cond_timedwait(&sd->wakeup, &stream->lock, &t);
+}
+
+/* Precondition: A transfer is available. */
+static void submit_transfer(struct bladerf_stream *stream, void *buffer)
+{
+    struct sim_stream_data *sd = stream->backend_data;
+    const size_t in_flight = sd->num_transfers - sd->num_avail;
+    struct sim_transfer *t;
+
+    assert(sd->num_avail != 0);
+
+    t = &sd->transfers[(sd->head + in_flight) % sd->num_transfers];
+    t->buffer = buffer;
+    t->submit_ns = sim_now_ns();
+
+    sd->num_avail--;
+    pthread_cond_signal(&sd->wakeup);
+}
+
+/* Progress the transfer at the head of the queue, completing it if it is
+ * due. Must be called with stream->lock held. */
+static void sim_run_transfer(struct bladerf_stream *stream)
+{
+    struct bladerf *dev = stream->dev;
+    struct bladerf_sim *sim = sim_backend(dev);
+    struct sim_stream_data *sd = stream->backend_data;
+    struct sim_transfer *t = &sd->transfers[sd->head];
+    const unsigned int timeout_ms = dev->transfer_timeout[stream->module];
+    struct bladerf_metadata metadata;
+    uint64_t now = sim_now_ns();
+    void *buffer, *next_buffer;
+
+    if (!sd->head_scheduled && !sim_schedule_transfer(stream, now)) {
+        if (timeout_ms != 0 &&
+            now >= t->submit_ns + timeout_ms * 1000000ull) {
+            log_debug("sim: %s transfer timed out with the module disabled\n",
+                      module2str(stream->module));
+
+            stream->error_code = BLADERF_ERR_TIMEOUT;
+            stream->state = STREAM_SHUTTING_DOWN;
+        } else {
+            sim_wait(stream, now + SIM_WAIT_MAX_NS);
+        }
+
+        return;
+    }
+
+    if (now < sd->head_due_ns) {
+        sim_wait(stream, sd->head_due_ns);
+        return;
+    }
+
+    buffer = t->buffer;
+    sd->head_scheduled = false;
+    sd->head = (sd->head + 1) % sd->num_transfers;
+    sd->num_avail++;
+    pthread_cond_signal(&stream->can_submit_buffer);
+
+    if (sd->head_timed_out) {
+        log_debug("sim: %s transfer timed out\n", module2str(stream->module));
+        stream->error_code = BLADERF_ERR_TIMEOUT;
+        stream->state = STREAM_SHUTTING_DOWN;
+        return;
+    }
+
+    if (stream->module == BLADERF_MODULE_RX) {
+        sim_fill_rx(stream, buffer, sd->head_start);
+    }
+
+    MUTEX_LOCK(&sim->lock);
+    sd->pos = sd->head_end;
+    sim->modules[stream->module].transfers++;
+
+    if (!sim->config.throttle) {
+        sim->modules[stream->module].timestamp = sd->pos;
+    }
+
+    sim_run_retunes(sim, stream->module, now);
+    MUTEX_UNLOCK(&sim->lock);
+
+    /* Currently unused - zero out for out own debugging sanity... */
+    memset(&metadata, 0, sizeof(metadata));
+
+    next_buffer = stream->cb(dev, stream, &metadata, buffer,
+                             stream->samples_per_buffer, stream->user_data);
+
+    if (next_buffer == BLADERF_STREAM_SHUTDOWN) {
+        stream->state = STREAM_SHUTTING_DOWN;
+    } else if (next_buffer != BLADERF_STREAM_NO_DATA) {
+        submit_transfer(stream, next_buffer);
+    }
+}
+
+static int sim_init_stream(struct bladerf_stream *stream, size_t num_transfers)
+{
+    struct sim_stream_data *stream_data;
+
+    stream_data = calloc(1, sizeof(*stream_data));
+    if (stream_data == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    stream_data->transfers = calloc(num_transfers,
+                                    sizeof(stream_data->transfers[0]));
+    if (stream_data->transfers == NULL) {
+        free(stream_data);
+        return BLADERF_ERR_MEM;
+    }
+
+    if (pthread_cond_init(&stream_data->wakeup, NULL) != 0) {
+        free(stream_data->transfers);
+        free(stream_data);
+        return BLADERF_ERR_UNEXPECTED;
+    }
+
+    stream_data->num_transfers = num_transfers;
+    stream_data->num_avail = num_transfers;
+
+    stream->backend_data = stream_data;
+    return 0;
+}
+
+static int sim_stream(struct bladerf_stream *stream, bladerf_module module)
+{
+    size_t i;
+    void *buffer;
+    struct bladerf_metadata metadata;
+    struct bladerf *dev = stream->dev;
+    struct bladerf_sim *sim = sim_backend(dev);
+    struct sim_stream_data *stream_data = stream->backend_data;
+    struct sim_module *m = &sim->modules[module];
+
+    /* Currently unused, so zero it out for a sanity check when debugging */
+    memset(&metadata, 0, sizeof(metadata));
+
+    MUTEX_LOCK(&sim->lock);
+    stream_data->meta = (sim->config_gpio & BLADERF_GPIO_TIMESTAMP) != 0;
+    stream_data->counter_mode =
+        (sim->config_gpio & BLADERF_GPIO_COUNTER_ENABLE) != 0;
+    MUTEX_UNLOCK(&sim->lock);
+
+    MUTEX_LOCK(&stream->lock);
+
+    stream_data->started = false;
+    stream_data->head_scheduled = false;
+    stream_data->bus_free_ns = 0;
+
+    /* Set up initial set of buffers */
+    for (i = 0; i < stream_data->num_transfers; i++) {
+        if (module == BLADERF_MODULE_TX) {
+            buffer = stream->cb(dev,
+                                stream,
+                                &metadata,
+                                NULL,
+                                stream->samples_per_buffer,
+                                stream->user_data);
+
+            if (buffer == BLADERF_STREAM_SHUTDOWN) {
+                stream->state = STREAM_SHUTTING_DOWN;
+                break;
+            }
+        } else {
+            buffer = stream->buffers[i];
+        }
+
+        if (buffer != BLADERF_STREAM_NO_DATA) {
+            submit_transfer(stream, buffer);
+        }
+    }
+
+    while (stream->state != STREAM_DONE) {
+        if (stream->state == STREAM_SHUTTING_DOWN) {
+            /* Cancel anything still in flight */
+            stream_data->num_avail = stream_data->num_transfers;
+            stream_data->head_scheduled = false;
+            stream->state = STREAM_DONE;
+            pthread_cond_broadcast(&stream->can_submit_buffer);
+        } else if (stream_data->num_avail == stream_data->num_transfers) {
+            sim_wait(stream, sim_now_ns() + SIM_WAIT_MAX_NS);
+        } else {
+            sim_run_transfer(stream);
+        }
+    }
+
+    MUTEX_UNLOCK(&stream->lock);
+
+    MUTEX_LOCK(&sim->lock);
+    log_debug("sim: %s stream done. Transfers: %"PRIu64", overruns: %"PRIu64
+              " (%"PRIu64" injected), underruns: %"PRIu64", late: %"PRIu64
+              ", stalls: %"PRIu64", retunes: %"PRIu64"\n",
+              module2str(module), m->transfers, m->overruns,
+              m->injected_overruns, m->underruns, m->late, m->stalls,
+              m->retunes_applied);
+    MUTEX_UNLOCK(&sim->lock);
+
+    return 0;
+}
+
+/* The top-level code will have aquired the stream->lock for us */
+static int sim_submit_stream_buffer(struct bladerf_stream *stream,
+                                    void *buffer, unsigned int timeout_ms,
+                                    bool nonblock)
+{
+    int status = 0;
+    struct sim_stream_data *stream_data = stream->backend_data;
+    struct timespec timeout_abs;
+
+    if (buffer == BLADERF_STREAM_SHUTDOWN) {
+        if (stream_data->num_avail == stream_data->num_transfers) {
+            stream->state = STREAM_DONE;
+        } else {
+            stream->state = STREAM_SHUTTING_DOWN;
+        }
+
+        pthread_cond_signal(&stream_data->wakeup);
+        return 0;
+    }
+
+    if (stream_data->num_avail == 0) {
+        if (nonblock) {
+            log_debug("Non-blocking buffer submission requested, but no "
+                      "transfers are currently available.\n");
+
+            return BLADERF_ERR_WOULD_BLOCK;
+        }
+
+        if (timeout_ms != 0) {
+            status = populate_abs_timeout(&timeout_abs, timeout_ms);
+            if (status != 0) {
+                return BLADERF_ERR_UNEXPECTED;
+            }
+
+            while (stream_data->num_avail == 0 && status == 0) {
+                status = pthread_cond_timedwait(&stream->can_submit_buffer,
+                                                &stream->lock,
+                                                &timeout_abs);
+            }
+        } else {
+            while (stream_data->num_avail == 0 && status == 0) {
+                status = pthread_cond_wait(&stream->can_submit_buffer,
+                                           &stream->lock);
+            }
+        }
+    }
+
+    if (status == ETIMEDOUT) {
+        log_debug("%s: Timed out waiting for a transfer to become available.\n",
+                  __FUNCTION__);
+        return BLADERF_ERR_TIMEOUT;
+    } else if (status != 0) {
+        return BLADERF_ERR_UNEXPECTED;
+    } else {
+        submit_transfer(stream, buffer);
+        return 0;
+    }
+}
+
+static void sim_deinit_stream(struct bladerf_stream *stream)
+{
+    struct sim_stream_data *stream_data = stream->backend_data;
+
+    if (stream_data != NULL) {
+        pthread_cond_destroy(&stream_data->wakeup);
+        free(stream_data->transfers);
+        free(stream_data);
+        stream->backend_data = NULL;
+    }
+}
+
+static int sim_retune(struct bladerf *dev, bladerf_module module,
+                      uint64_t timestamp, uint16_t nint, uint32_t nfrac,
+                      uint8_t freqsel, uint8_t vcocap, bool low_band,
+                      bool quick_tune)
+{
+    int status = 0;
+    struct bladerf_sim *sim = sim_request(dev);
+    struct sim_module *m = &sim->modules[module];
+    const uint64_t now = sim_now_ns();
+    struct sim_retune r;
+
+    r.timestamp = timestamp;
+    r.nint = nint;
+    r.nfrac = nfrac;
+    r.freqsel = freqsel;
+    r.vcocap = vcocap;
+    r.low_band = low_band;
+    r.quick_tune = quick_tune;
+
+    MUTEX_LOCK(&sim->lock);
+
+    if (timestamp == NIOS_PKT_RETUNE_CLEAR_QUEUE) {
+        m->retune_count = 0;
+        m->retune_idx = 0;
+    } else if (timestamp == NIOS_PKT_RETUNE_NOW) {
+        sim_apply_retune(sim, module, &r);
+    } else {
+        sim_run_retunes(sim, module, now);
+
+        if (m->retune_count >= SIM_RETUNE_QUEUE_MAX) {
+            log_debug("The FPGA's retune queue is full. Try again after "
+                      "a previous request has completed.\n");
+            status = BLADERF_ERR_QUEUE_FULL;
+        } else {
+            const unsigned int i =
+                (m->retune_idx + m->retune_count) % SIM_RETUNE_QUEUE_MAX;
+
+            m->retunes[i] = r;
+            m->retune_count++;
+
+            /* Timestamps that have already passed are applied right away */
+            sim_run_retunes(sim, module, now);
+        }
+    }
+
+    MUTEX_UNLOCK(&sim->lock);
+    return status;
+}
+
+static int sim_load_fw_from_bootloader(bladerf_backend backend,
+                                       uint8_t bus, uint8_t addr,
+                                       struct fx3_firmware *fw)
+{
+    return BLADERF_ERR_UNSUPPORTED;
+}
+
+static int sim_read_fw_log(struct bladerf *dev, logger_entry *e)
+{
+    *e = LOG_EOF;
+    return 0;
+}
+
+static int sim_read_trigger(struct bladerf *dev, bladerf_module module,
+                            bladerf_trigger_signal trigger, uint8_t *val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    if (trigger != BLADERF_TRIGGER_J71_4) {
+        log_debug("Invalid trigger: %d\n", trigger);
+        return BLADERF_ERR_INVAL;
+    }
+
+    MUTEX_LOCK(&sim->lock);
+    *val = sim->modules[module].trigger;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+static int sim_write_trigger(struct bladerf *dev, bladerf_module module,
+                             bladerf_trigger_signal trigger, uint8_t val)
+{
+    struct bladerf_sim *sim = sim_request(dev);
+
+    if (trigger != BLADERF_TRIGGER_J71_4) {
+        log_debug("Invalid trigger: %d\n", trigger);
+        return BLADERF_ERR_INVAL;
+    }
+
+    MUTEX_LOCK(&sim->lock);
+    sim->modules[module].trigger = val;
+    MUTEX_UNLOCK(&sim->lock);
+    return 0;
+}
+
+const struct backend_fns backend_fns_sim = {
+    FIELD_INIT(.matches, sim_matches),
+
+    FIELD_INIT(.probe, sim_probe),
+
+    FIELD_INIT(.open, sim_open),
+    FIELD_INIT(.close, sim_close),
+
+    FIELD_INIT(.load_fpga, sim_load_fpga),
+    FIELD_INIT(.is_fpga_configured, sim_is_fpga_configured),
+
+    FIELD_INIT(.erase_flash_blocks, sim_erase_flash_blocks),
+    FIELD_INIT(.read_flash_pages, sim_read_flash_pages),
+    FIELD_INIT(.write_flash_pages, sim_write_flash_pages),
+
+    FIELD_INIT(.device_reset, sim_device_reset),
+    FIELD_INIT(.jump_to_bootloader, sim_jump_to_bootloader),
+
+    FIELD_INIT(.get_cal, sim_get_cal),
+    FIELD_INIT(.get_otp, sim_get_otp),
+    FIELD_INIT(.get_device_speed, sim_get_device_speed),
+
+    FIELD_INIT(.config_gpio_write, sim_config_gpio_write),
+    FIELD_INIT(.config_gpio_read, sim_config_gpio_read),
+
+    FIELD_INIT(.expansion_gpio_write, sim_expansion_gpio_write),
+    FIELD_INIT(.expansion_gpio_read, sim_expansion_gpio_read),
+    FIELD_INIT(.expansion_gpio_dir_write, sim_expansion_gpio_dir_write),
+    FIELD_INIT(.expansion_gpio_dir_read, sim_expansion_gpio_dir_read),
+
+    FIELD_INIT(.set_iq_gain_correction, sim_set_iq_gain_correction),
+    FIELD_INIT(.set_iq_phase_correction, sim_set_iq_phase_correction),
+    FIELD_INIT(.get_iq_gain_correction, sim_get_iq_gain_correction),
+    FIELD_INIT(.get_iq_phase_correction, sim_get_iq_phase_correction),
+
+    FIELD_INIT(.get_timestamp, sim_get_timestamp),
+
+    FIELD_INIT(.si5338_write, sim_si5338_write),
+    FIELD_INIT(.si5338_read, sim_si5338_read),
+
+    FIELD_INIT(.lms_write, sim_lms_write),
+    FIELD_INIT(.lms_read, sim_lms_read),
+
+    FIELD_INIT(.vctcxo_dac_write, sim_vctcxo_dac_write),
+    FIELD_INIT(.vctcxo_dac_read, sim_vctcxo_dac_read),
+
+    FIELD_INIT(.set_vctcxo_tamer_mode, sim_set_vctcxo_tamer_mode),
+    FIELD_INIT(.get_vctcxo_tamer_mode, sim_get_vctcxo_tamer_mode),
+
+    FIELD_INIT(.xb_spi, sim_xb_spi),
+
+    FIELD_INIT(.set_firmware_loopback, sim_set_firmware_loopback),
+    FIELD_INIT(.get_firmware_loopback, sim_get_firmware_loopback),
+
+    FIELD_INIT(.enable_module, sim_enable_module),
+
+    FIELD_INIT(.init_stream, sim_init_stream),
+    FIELD_INIT(.stream, sim_stream),
+    FIELD_INIT(.submit_stream_buffer, sim_submit_stream_buffer),
+    FIELD_INIT(.deinit_stream, sim_deinit_stream),
+
+    FIELD_INIT(.retune, sim_retune),
+
+    FIELD_INIT(.load_fw_from_bootloader, sim_load_fw_from_bootloader),
+
+    FIELD_INIT(.read_fw_log, sim_read_fw_log),
+
+    FIELD_INIT(.read_trigger, sim_read_trigger),
+    FIELD_INIT(.write_trigger, sim_write_trigger),
+};
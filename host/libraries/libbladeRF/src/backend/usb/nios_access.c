@@ -66,6 +66,8 @@ static int nios_access(struct bladerf *dev, uint8_t *buf)
 
     print_buf("NIOS II request:\n", buf, NIOS_PKT_LEN);
 
+    dev->ctrl_requests++;
+
     /* Send the command */
     status = usb->fn->bulk_transfer(driver, PERIPHERAL_EP_OUT,
                                      buf, NIOS_PKT_LEN,
@@ -94,6 +94,8 @@ static int nios_access(struct bladerf *dev, uint8_t peripheral,
 
     print_buf("NIOS II access request:\n", buf, 16);
 
+    dev->ctrl_requests++;
+
     /* Send the command */
     status = usb->fn->bulk_transfer(driver, PERIPHERAL_EP_OUT,
                                      buf, sizeof(buf),
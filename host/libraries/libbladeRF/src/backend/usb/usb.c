@@ -40,6 +40,10 @@
 #include "nios_legacy_access.h"
 #include "nios_access.h"
 
+#ifdef ENABLE_USB_TRACE
+#   include "usb_trace.h"
+#endif
+
 #if ENABLE_USB_DEV_RESET_ON_OPEN
 bool bladerf_usb_reset_device_on_open = true;
 #endif
@@ -219,7 +223,8 @@ static bool usb_matches(bladerf_backend backend)
     return backend == BLADERF_BACKEND_ANY ||
            backend == BLADERF_BACKEND_LINUX ||
            backend == BLADERF_BACKEND_LIBUSB ||
-           backend == BLADERF_BACKEND_CYPRESS;
+           backend == BLADERF_BACKEND_CYPRESS ||
+           backend == BLADERF_BACKEND_REPLAY;
 }
 
 static int usb_probe(backend_probe_target probe_target,
@@ -310,6 +315,17 @@ static int usb_open(struct bladerf *dev, struct bladerf_devinfo *info)
         return status;
     }
 
+#ifdef ENABLE_USB_TRACE
+    if (getenv("BLADERF_USB_TRACE")) {
+        status = usb_trace_start(usb, getenv("BLADERF_USB_TRACE"),
+                                 &dev->ident);
+        if (status != 0) {
+            log_warning("Failed to start USB trace: %s\n",
+                        bladerf_strerror(status));
+        }
+    }
+#endif
+
     dev->transfer_timeout[BLADERF_MODULE_TX] = BULK_TIMEOUT_MS;
     dev->transfer_timeout[BLADERF_MODULE_RX] = BULK_TIMEOUT_MS;
 
@@ -0,0 +1,988 @@
+/*
+ * USB traffic replay driver
+ *
+ * This USB driver stands in for a device by playing back a trace recorded
+ * with BLADERF_USB_TRACE (see usb_trace.h). It is selected with the "replay"
+ * device identifier backend (e.g., "replay:"), and is never reported by a
+ * device probe or opened on behalf of the "*" backend. The trace is taken
+ * from the BLADERF_USB_REPLAY environment variable.
+ *
+ * Device operations (control and bulk transfers, alt settings, ...) must be
+ * issued in the order in which they were recorded. Each is matched against
+ * the next recorded operation, and completes with its recorded data and
+ * status after its recorded duration. Once an operation does not match the
+ * trace, the replay has diverged from the recording, and all subsequent
+ * operations fail with BLADERF_ERR_UNEXPECTED.
+ *
+ * Streams are replayed per module, independently of device operations.
+ * Each completes its transfers at the times they were recorded to have
+ * completed, relative to the start of the stream, providing the recorded RX
+ * samples. A stream that failed when it was recorded fails with the same
+ * error once its recorded transfers have completed.
+ *
+ * BLADERF_USB_REPLAY_SPEED scales the recorded timing. A value of 2.0
+ * replays twice as fast as recorded, and 0 replays as quickly as possible.
+ *
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "rel_assert.h"
+#include "host_config.h"
+#include "bladerf_priv.h"
+#include "async.h"
+#include "conversions.h"
+#include "log.h"
+#include "usb_trace.h"
+
+/* Longest time a stream waits before rechecking its state */
+#define REPLAY_WAIT_MAX_NS      (10 * 1000 * 1000ull)
+
+#define NSEC_PER_SEC            1000000000ull
+
+struct replay_event {
+    uint64_t offset;            /* File offset of the record's payload */
+    struct trace_record r;
+};
+
+struct replay_channel {
+    struct replay_event *events;
+    size_t num_events;
+    size_t max_events;
+    size_t next;                /* Next event to be replayed */
+};
+
+struct usb_replay {
+    FILE *file;
+    MUTEX lock;                 /* Protects the file and control channel */
+    double speed;
+    bool diverged;
+
+    struct replay_channel channels[TRACE_NUM_CHANNELS];
+};
+
+struct replay_transfer {
+    void *buffer;
+    uint64_t submit_ns;
+};
+
+struct replay_stream_data {
+    size_t num_transfers;               /* Total # of transfers */
+    size_t num_avail;                   /* # of currently available transfers */
+    size_t head;                        /* Index of the oldest transfer */
+    struct replay_transfer *transfers;  /* In-flight transfers, oldest at
+                                         * head */
+
+    /* Signaled when a buffer is submitted or the stream is shut down */
+    pthread_cond_t wakeup;
+
+    struct usb_replay *rp;
+    struct replay_channel *ch;
+    uint64_t start_ns;          /* Time at which the replay started */
+    uint64_t rec_start_ns;      /* Trace time at which the recording started */
+
+    uint8_t *scratch;           /* Holds metadata-only payloads */
+    size_t scratch_len;
+    bool warned_len;
+};
+
+static int file_seek(FILE *f, uint64_t offset)
+{
+#if BLADERF_OS_WINDOWS
+    return _fseeki64(f, (__int64) offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+/******************************************************************************
+ * Trace loading
+ ******************************************************************************/
+
+static int channel_append(struct replay_channel *ch,
+                          const struct replay_event *ev)
+{
+    struct replay_event *events;
+    size_t max_events;
+
+    if (ch->num_events == ch->max_events) {
+        max_events = ch->max_events == 0 ? 1024 : 2 * ch->max_events;
+        events = realloc(ch->events, max_events * sizeof(events[0]));
+        if (events == NULL) {
+            return BLADERF_ERR_MEM;
+        }
+
+        ch->events = events;
+        ch->max_events = max_events;
+    }
+
+    ch->events[ch->num_events++] = *ev;
+    return 0;
+}
+
+static int replay_load(struct usb_replay *rp, struct bladerf_devinfo *ident)
+{
+    int status;
+    uint8_t buf[TRACE_FILE_HDR_LEN];
+    struct replay_event ev;
+    uint64_t offset;
+
+    if (fread(buf, 1, TRACE_FILE_HDR_LEN, rp->file) != TRACE_FILE_HDR_LEN ||
+        memcmp(buf, TRACE_MAGIC, 8) != 0) {
+        log_error("USB replay: Not a bladeRF USB trace.\n");
+        return BLADERF_ERR_INVAL;
+    }
+
+    if (trace_get_le32(buf + 8) != TRACE_VERSION) {
+        log_error("USB replay: Unsupported trace version: %u\n",
+                  trace_get_le32(buf + 8));
+        return BLADERF_ERR_INVAL;
+    }
+
+    bladerf_init_devinfo(ident);
+    ident->backend = BLADERF_BACKEND_REPLAY;
+    ident->usb_bus = buf[24];
+    ident->usb_addr = buf[25];
+    ident->instance = trace_get_le32(buf + 28);
+    memcpy(ident->serial, buf + 32, 32);
+    ident->serial[32] = '\0';
+
+    offset = TRACE_FILE_HDR_LEN;
+
+    while (fread(buf, 1, TRACE_RECORD_HDR_LEN, rp->file) ==
+                                                    TRACE_RECORD_HDR_LEN) {
+
+        trace_unpack_record(buf, &ev.r);
+        ev.offset = offset + TRACE_RECORD_HDR_LEN;
+        offset = ev.offset + ev.r.length;
+
+        if (file_seek(rp->file, offset) != 0) {
+            return BLADERF_ERR_IO;
+        }
+
+        status = channel_append(&rp->channels[trace_channel(&ev.r)], &ev);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    /* A trace whose recording was cut short may end with a partial record.
+     * A payload cut short is caught when it is read. */
+    if (!feof(rp->file)) {
+        return BLADERF_ERR_IO;
+    }
+
+    log_debug("USB replay: Loaded %zu control and %zu/%zu RX/TX stream "
+              "records\n", rp->channels[TRACE_CHANNEL_CTRL].num_events,
+              rp->channels[TRACE_CHANNEL_RX].num_events,
+              rp->channels[TRACE_CHANNEL_TX].num_events);
+
+    return 0;
+}
+
+/* Read (up to) len bytes of an event's payload. Must be called with
+ * rp->lock held. */
+static int replay_read(struct usb_replay *rp, const struct replay_event *ev,
+                       void *buf, size_t len)
+{
+    if (len > ev->r.length) {
+        len = ev->r.length;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (file_seek(rp->file, ev->offset) != 0 ||
+        fread(buf, 1, len, rp->file) != len) {
+        log_error("USB replay: Failed to read trace payload.\n");
+        return BLADERF_ERR_IO;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Device operations
+ ******************************************************************************/
+
+static const char *type2str(uint16_t type)
+{
+    switch (type) {
+        case TRACE_GET_SPEED:       return "get_speed";
+        case TRACE_CHANGE_SETTING:  return "change_setting";
+        case TRACE_CONTROL:         return "control_transfer";
+        case TRACE_BULK:            return "bulk_transfer";
+        case TRACE_STRING_DESC:     return "get_string_descriptor";
+        default:                    return "unknown";
+    }
+}
+
+/* Report a divergence at the operation last taken from the trace. Operations
+ * are numbered from 1. */
+static void replay_diverged(struct usb_replay *rp, const char *what)
+{
+    struct replay_channel *ch = &rp->channels[TRACE_CHANNEL_CTRL];
+
+    log_error("USB replay: Diverged from the trace at operation %zu: %s\n",
+              ch->next, what);
+    rp->diverged = true;
+}
+
+/* Take the next operation from the trace, which must be of the specified
+ * type. Must be called with rp->lock held. Returns NULL if the replay has
+ * diverged from the trace. */
+static struct replay_event *replay_next(struct usb_replay *rp, uint16_t type)
+{
+    struct replay_channel *ch = &rp->channels[TRACE_CHANNEL_CTRL];
+    struct replay_event *ev;
+    char what[80];
+
+    if (rp->diverged) {
+        return NULL;
+    }
+
+    if (ch->next >= ch->num_events) {
+        ch->next++;
+        snprintf(what, sizeof(what), "%s after the end of the trace",
+                 type2str(type));
+        replay_diverged(rp, what);
+        return NULL;
+    }
+
+    ev = &ch->events[ch->next++];
+    if (ev->r.type != type) {
+        snprintf(what, sizeof(what), "%s in place of %s",
+                 type2str(type), type2str(ev->r.type));
+        replay_diverged(rp, what);
+        return NULL;
+    }
+
+    return ev;
+}
+
+/* Check that data sent to the device matches what was recorded. A mismatch
+ * is reported, but is not considered a divergence, as the structure of the
+ * exchange is unchanged. Must be called with rp->lock held. */
+static int replay_check_out(struct usb_replay *rp,
+                            const struct replay_event *ev,
+                            const void *buf, size_t len)
+{
+    int status;
+    uint8_t *recorded;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    recorded = malloc(len);
+    if (recorded == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    status = replay_read(rp, ev, recorded, len);
+    if (status == 0 && memcmp(recorded, buf, len) != 0) {
+        log_warning("USB replay: %s data at operation %zu differs from "
+                    "the trace\n", type2str(ev->r.type),
+                    rp->channels[TRACE_CHANNEL_CTRL].next);
+    }
+
+    free(recorded);
+    return status;
+}
+
+/* Wait out an operation's recorded duration. Must be called without
+ * rp->lock held, so that streams are not held up. */
+static void replay_delay(struct usb_replay *rp, uint32_t duration_us)
+{
+    if (rp->speed > 0.0 && duration_us != 0) {
+        usleep((unsigned int) (duration_us / rp->speed));
+    }
+}
+
+/* Complete an operation with its recorded status, or an error if the replay
+ * has diverged from the trace or the trace could not be read. */
+static int replay_finish(struct usb_replay *rp, struct replay_event *ev,
+                         int status)
+{
+    uint32_t duration_us = 0;
+
+    if (ev == NULL) {
+        status = BLADERF_ERR_UNEXPECTED;
+    } else if (status == 0) {
+        status = ev->r.status;
+        duration_us = ev->r.duration_us;
+    }
+
+    MUTEX_UNLOCK(&rp->lock);
+
+    replay_delay(rp, duration_us);
+    return status;
+}
+
+static int replay_probe(backend_probe_target probe_target,
+                        struct bladerf_devinfo_list *info_list)
+{
+    return 0;
+}
+
+static void replay_free(struct usb_replay *rp)
+{
+    size_t i;
+
+    for (i = 0; i < TRACE_NUM_CHANNELS; i++) {
+        free(rp->channels[i].events);
+    }
+
+    if (rp->file != NULL) {
+        fclose(rp->file);
+    }
+
+    free(rp);
+}
+
+static int replay_open(void **driver, struct bladerf_devinfo *info_in,
+                       struct bladerf_devinfo *info_out)
+{
+    int status;
+    bool ok = true;
+    struct usb_replay *rp;
+    struct bladerf_devinfo ident;
+    const char *path = getenv("BLADERF_USB_REPLAY");
+    const char *speed = getenv("BLADERF_USB_REPLAY_SPEED");
+
+    if (info_in->backend != BLADERF_BACKEND_REPLAY) {
+        return BLADERF_ERR_NODEV;
+    }
+
+    if (path == NULL) {
+        log_warning("BLADERF_USB_REPLAY must specify the trace to replay.\n");
+        return BLADERF_ERR_NODEV;
+    }
+
+    rp = calloc(1, sizeof(*rp));
+    if (rp == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    rp->speed = 1.0;
+    if (speed != NULL) {
+        rp->speed = str2double(speed, 0.0, 1e6, &ok);
+        if (!ok) {
+            log_warning("Invalid BLADERF_USB_REPLAY_SPEED value: %s\n", speed);
+            free(rp);
+            return BLADERF_ERR_INVAL;
+        }
+    }
+
+    rp->file = fopen(path, "rb");
+    if (rp->file == NULL) {
+        log_error("USB replay: Failed to open %s\n", path);
+        free(rp);
+        return BLADERF_ERR_NODEV;
+    }
+
+    status = replay_load(rp, &ident);
+    if (status != 0) {
+        replay_free(rp);
+        return status;
+    }
+
+    if (!bladerf_devinfo_matches(&ident, info_in)) {
+        replay_free(rp);
+        return BLADERF_ERR_NODEV;
+    }
+
+    MUTEX_INIT(&rp->lock);
+    memcpy(info_out, &ident, sizeof(ident));
+    *driver = rp;
+
+    log_debug("USB replay: Replaying %s at %gx speed\n", path, rp->speed);
+    return 0;
+}
+
+static void replay_close(void *driver)
+{
+    struct usb_replay *rp = driver;
+    struct replay_channel *ch = &rp->channels[TRACE_CHANNEL_CTRL];
+
+    if (!rp->diverged && ch->next != ch->num_events) {
+        log_debug("USB replay: Closed with %zu operations left in the trace\n",
+                  ch->num_events - ch->next);
+    }
+
+    pthread_mutex_destroy(&rp->lock);
+    replay_free(rp);
+}
+
+static int replay_get_speed(void *driver, bladerf_dev_speed *speed)
+{
+    struct usb_replay *rp = driver;
+    struct replay_event *ev;
+
+    MUTEX_LOCK(&rp->lock);
+
+    ev = replay_next(rp, TRACE_GET_SPEED);
+    if (ev != NULL) {
+        *speed = (bladerf_dev_speed) ev->r.arg0;
+    }
+
+    return replay_finish(rp, ev, 0);
+}
+
+static int replay_change_setting(void *driver, uint8_t setting)
+{
+    struct usb_replay *rp = driver;
+    struct replay_event *ev;
+
+    MUTEX_LOCK(&rp->lock);
+
+    ev = replay_next(rp, TRACE_CHANGE_SETTING);
+    if (ev != NULL && ev->r.arg0 != setting) {
+        replay_diverged(rp, "alt setting differs");
+        ev = NULL;
+    }
+
+    return replay_finish(rp, ev, 0);
+}
+
+static int replay_control_transfer(void *driver,
+                                   usb_target target_type,
+                                   usb_request req_type,
+                                   usb_direction direction,
+                                   uint8_t request, uint16_t wvalue,
+                                   uint16_t windex,
+                                   void *buffer, uint32_t buffer_len,
+                                   uint32_t timeout_ms)
+{
+    struct usb_replay *rp = driver;
+    struct replay_event *ev;
+    int status = 0;
+
+    const uint32_t arg0 = (uint32_t) target_type | ((uint32_t) req_type << 8) |
+                          ((uint32_t) direction << 16) |
+                          ((uint32_t) request << 24);
+
+    const uint32_t arg1 = (uint32_t) wvalue | ((uint32_t) windex << 16);
+
+    MUTEX_LOCK(&rp->lock);
+
+    ev = replay_next(rp, TRACE_CONTROL);
+    if (ev != NULL &&
+        (ev->r.arg0 != arg0 || ev->r.arg1 != arg1 ||
+         ev->r.length != buffer_len)) {
+        replay_diverged(rp, "control request differs");
+        ev = NULL;
+    }
+
+    if (ev != NULL) {
+        if (direction == USB_DIR_DEVICE_TO_HOST) {
+            status = replay_read(rp, ev, buffer, buffer_len);
+        } else {
+            status = replay_check_out(rp, ev, buffer, buffer_len);
+        }
+    }
+
+    return replay_finish(rp, ev, status);
+}
+
+static int replay_bulk_transfer(void *driver, uint8_t endpoint,
+                                void *buffer, uint32_t buffer_len,
+                                uint32_t timeout_ms)
+{
+    struct usb_replay *rp = driver;
+    struct replay_event *ev;
+    int status = 0;
+
+    MUTEX_LOCK(&rp->lock);
+
+    ev = replay_next(rp, TRACE_BULK);
+    if (ev != NULL &&
+        (ev->r.arg0 != endpoint || ev->r.length != buffer_len)) {
+        replay_diverged(rp, "bulk transfer differs");
+        ev = NULL;
+    }
+
+    if (ev != NULL) {
+        if (endpoint & USB_DIR_DEVICE_TO_HOST) {
+            status = replay_read(rp, ev, buffer, buffer_len);
+        } else {
+            status = replay_check_out(rp, ev, buffer, buffer_len);
+        }
+    }
+
+    return replay_finish(rp, ev, status);
+}
+
+static int replay_get_string_descriptor(void *driver, uint8_t index,
+                                        void *buffer, uint32_t buffer_len)
+{
+    struct usb_replay *rp = driver;
+    struct replay_event *ev;
+    int status = 0;
+
+    MUTEX_LOCK(&rp->lock);
+
+    ev = replay_next(rp, TRACE_STRING_DESC);
+    if (ev != NULL && ev->r.arg0 != index) {
+        replay_diverged(rp, "string descriptor index differs");
+        ev = NULL;
+    }
+
+    if (ev != NULL) {
+        status = replay_read(rp, ev, buffer, buffer_len);
+    }
+
+    return replay_finish(rp, ev, status);
+}
+
+/******************************************************************************
+ * Streams
+ ******************************************************************************/
+
+static void replay_wait(struct bladerf_stream *stream, uint64_t until_ns)
+{
+    struct replay_stream_data *sd = stream->backend_data;
+    const uint64_t now = trace_now_ns();
+    struct timespec t;
+
+    if (until_ns > now + REPLAY_WAIT_MAX_NS) {
+        until_ns = now + REPLAY_WAIT_MAX_NS;
+    }
+
+    t.tv_sec = (time_t) (until_ns / NSEC_PER_SEC);
+    t.tv_nsec = (long) (until_ns % NSEC_PER_SEC);
+
+    pthread_cond_timedwait(&sd->wakeup, &stream->lock, &t);
+}
+
+/* Precondition: A transfer is available. */
+static void submit_transfer(struct bladerf_stream *stream, void *buffer)
+{
+    struct replay_stream_data *sd = stream->backend_data;
+    const size_t in_flight = sd->num_transfers - sd->num_avail;
+    struct replay_transfer *t;
+
+    assert(sd->num_avail != 0);
+
+    t = &sd->transfers[(sd->head + in_flight) % sd->num_transfers];
+    t->buffer = buffer;
+    t->submit_ns = trace_now_ns();
+
+    sd->num_avail--;
+    pthread_cond_signal(&sd->wakeup);
+}
+
+/* Fill an RX buffer with the samples recorded for a transfer */
+static int replay_fill_rx(struct bladerf_stream *stream,
+                          const struct replay_event *ev, void *buffer)
+{
+    struct replay_stream_data *sd = stream->backend_data;
+    struct usb_replay *rp = sd->rp;
+    const size_t len = async_stream_buf_bytes(stream);
+    size_t num_msgs, msg_size, i;
+    uint8_t *scratch;
+    int status;
+
+    if (ev->r.arg1 != len && !sd->warned_len) {
+        log_warning("USB replay: RX buffers are %zu bytes, but %u bytes were "
+                    "recorded\n", len, ev->r.arg1);
+        sd->warned_len = true;
+    }
+
+    if (ev->r.length < len) {
+        memset(buffer, 0, len);
+    }
+
+    MUTEX_LOCK(&rp->lock);
+
+    if (!(ev->r.flags & TRACE_FLAG_META_ONLY)) {
+        status = replay_read(rp, ev, buffer, len);
+        MUTEX_UNLOCK(&rp->lock);
+        return status;
+    }
+
+    /* Only the metadata headers were recorded. Place them at the start of
+     * each message, leaving the samples zeroed. */
+    if (ev->r.length > sd->scratch_len) {
+        scratch = realloc(sd->scratch, ev->r.length);
+        if (scratch == NULL) {
+            MUTEX_UNLOCK(&rp->lock);
+            return BLADERF_ERR_MEM;
+        }
+
+        sd->scratch = scratch;
+        sd->scratch_len = ev->r.length;
+    }
+
+    status = replay_read(rp, ev, sd->scratch, ev->r.length);
+    MUTEX_UNLOCK(&rp->lock);
+
+    if (status != 0) {
+        return status;
+    }
+
+    num_msgs = ev->r.length / TRACE_META_HDR_LEN;
+    msg_size = num_msgs == 0 ? 0 : ev->r.arg1 / num_msgs;
+
+    for (i = 0; i < num_msgs && (i + 1) * msg_size <= len; i++) {
+        memcpy((uint8_t *) buffer + i * msg_size,
+               sd->scratch + i * TRACE_META_HDR_LEN, TRACE_META_HDR_LEN);
+    }
+
+    return 0;
+}
+
+/* Find the next recorded transfer completion. Returns NULL if the recorded
+ * stream has ended, having updated the stream's state accordingly. */
+static struct replay_event *replay_next_buffer(struct bladerf_stream *stream)
+{
+    struct replay_stream_data *sd = stream->backend_data;
+    struct replay_channel *ch = sd->ch;
+    struct replay_event *ev;
+
+    while (ch->next < ch->num_events) {
+        ev = &ch->events[ch->next];
+
+        switch (ev->r.type) {
+            case TRACE_STREAM_BUFFER:
+                return ev;
+
+            case TRACE_STREAM_END:
+                if (ev->r.status != 0) {
+                    log_debug("USB replay: Recorded %s stream failed: %s\n",
+                              module2str(stream->module),
+                              bladerf_strerror(ev->r.status));
+
+                    ch->next++;
+                    stream->error_code = ev->r.status;
+                    stream->state = STREAM_SHUTTING_DOWN;
+                }
+                return NULL;
+
+            default:
+                ch->next++;
+                break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Progress the transfer at the head of the queue, completing it if it is
+ * due. Must be called with stream->lock held. */
+static void replay_run_transfer(struct bladerf_stream *stream)
+{
+    struct bladerf *dev = stream->dev;
+    struct replay_stream_data *sd = stream->backend_data;
+    struct replay_transfer *t = &sd->transfers[sd->head];
+    const unsigned int timeout_ms = dev->transfer_timeout[stream->module];
+    struct bladerf_metadata metadata;
+    const uint64_t now = trace_now_ns();
+    struct replay_event *ev;
+    uint64_t due_ns;
+    void *buffer, *next_buffer;
+    int status;
+
+    ev = replay_next_buffer(stream);
+    if (ev == NULL) {
+        if (stream->state != STREAM_RUNNING) {
+            return;
+        }
+
+        /* The recording ended here. Transfers time out, as they would
+         * had the device stopped responding. */
+        if (timeout_ms != 0 &&
+            now >= t->submit_ns + timeout_ms * 1000000ull) {
+            log_debug("USB replay: %s transfer timed out at the end of the "
+                      "recorded stream\n", module2str(stream->module));
+
+            stream->error_code = BLADERF_ERR_TIMEOUT;
+            stream->state = STREAM_SHUTTING_DOWN;
+        } else {
+            replay_wait(stream, now + REPLAY_WAIT_MAX_NS);
+        }
+
+        return;
+    }
+
+    if (sd->rp->speed > 0.0) {
+        due_ns = sd->start_ns + (uint64_t)
+                    ((ev->r.timestamp_ns - sd->rec_start_ns) / sd->rp->speed);
+
+        if (now < due_ns) {
+            replay_wait(stream, due_ns);
+            return;
+        }
+    }
+
+    sd->ch->next++;
+
+    buffer = t->buffer;
+    sd->head = (sd->head + 1) % sd->num_transfers;
+    sd->num_avail++;
+    pthread_cond_signal(&stream->can_submit_buffer);
+
+    if (stream->module == BLADERF_MODULE_RX) {
+        status = replay_fill_rx(stream, ev, buffer);
+        if (status != 0) {
+            stream->error_code = status;
+            stream->state = STREAM_SHUTTING_DOWN;
+            return;
+        }
+    }
+
+    /* Currently unused - zero out for out own debugging sanity... */
+    memset(&metadata, 0, sizeof(metadata));
+
+    next_buffer = stream->cb(dev, stream, &metadata, buffer,
+                             stream->samples_per_buffer, stream->user_data);
+
+    if (next_buffer == BLADERF_STREAM_SHUTDOWN) {
+        stream->state = STREAM_SHUTTING_DOWN;
+    } else if (next_buffer != BLADERF_STREAM_NO_DATA) {
+        submit_transfer(stream, next_buffer);
+    }
+}
+
+static int replay_init_stream(void *driver, struct bladerf_stream *stream,
+                              size_t num_transfers)
+{
+    struct replay_stream_data *stream_data;
+
+    stream_data = calloc(1, sizeof(*stream_data));
+    if (stream_data == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    stream_data->transfers = calloc(num_transfers,
+                                    sizeof(stream_data->transfers[0]));
+    if (stream_data->transfers == NULL) {
+        free(stream_data);
+        return BLADERF_ERR_MEM;
+    }
+
+    if (pthread_cond_init(&stream_data->wakeup, NULL) != 0) {
+        free(stream_data->transfers);
+        free(stream_data);
+        return BLADERF_ERR_UNEXPECTED;
+    }
+
+    stream_data->num_transfers = num_transfers;
+    stream_data->num_avail = num_transfers;
+    stream_data->rp = driver;
+
+    stream->backend_data = stream_data;
+    return 0;
+}
+
+static int replay_stream(void *driver, struct bladerf_stream *stream,
+                         bladerf_module module)
+{
+    size_t i;
+    void *buffer;
+    struct bladerf_metadata metadata;
+    struct bladerf *dev = stream->dev;
+    struct usb_replay *rp = driver;
+    struct replay_stream_data *stream_data = stream->backend_data;
+    struct replay_channel *ch;
+
+    ch = &rp->channels[module == BLADERF_MODULE_TX ?
+                            TRACE_CHANNEL_TX : TRACE_CHANNEL_RX];
+
+    /* Skip ahead to the start of the next recorded stream */
+    while (ch->next < ch->num_events &&
+           ch->events[ch->next].r.type != TRACE_STREAM_START) {
+        ch->next++;
+    }
+
+    if (ch->next == ch->num_events) {
+        log_error("USB replay: The trace contains no further %s streams.\n",
+                  module2str(module));
+        return BLADERF_ERR_UNEXPECTED;
+    }
+
+    if (ch->events[ch->next].r.flags != stream->format ||
+        ch->events[ch->next].r.arg1 != stream->samples_per_buffer) {
+        log_warning("USB replay: %s stream format or buffer size differs "
+                    "from the trace.\n", module2str(module));
+    }
+
+    stream_data->ch = ch;
+    stream_data->rec_start_ns = ch->events[ch->next].r.timestamp_ns;
+    stream_data->start_ns = trace_now_ns();
+    stream_data->warned_len = false;
+    ch->next++;
+
+    /* Currently unused, so zero it out for a sanity check when debugging */
+    memset(&metadata, 0, sizeof(metadata));
+
+    MUTEX_LOCK(&stream->lock);
+
+    /* Set up initial set of buffers */
+    for (i = 0; i < stream_data->num_transfers; i++) {
+        if (module == BLADERF_MODULE_TX) {
+            buffer = stream->cb(dev,
+                                stream,
+                                &metadata,
+                                NULL,
+                                stream->samples_per_buffer,
+                                stream->user_data);
+
+            if (buffer == BLADERF_STREAM_SHUTDOWN) {
+                stream->state = STREAM_SHUTTING_DOWN;
+                break;
+            }
+        } else {
+            buffer = stream->buffers[i];
+        }
+
+        if (buffer != BLADERF_STREAM_NO_DATA) {
+            submit_transfer(stream, buffer);
+        }
+    }
+
+    while (stream->state != STREAM_DONE) {
+        if (stream->state == STREAM_SHUTTING_DOWN) {
+            /* Cancel anything still in flight */
+            stream_data->num_avail = stream_data->num_transfers;
+            stream->state = STREAM_DONE;
+            pthread_cond_broadcast(&stream->can_submit_buffer);
+        } else if (stream_data->num_avail == stream_data->num_transfers) {
+            replay_wait(stream, trace_now_ns() + REPLAY_WAIT_MAX_NS);
+        } else {
+            replay_run_transfer(stream);
+        }
+    }
+
+    MUTEX_UNLOCK(&stream->lock);
+
+    return 0;
+}
+
+/* The top-level code will have aquired the stream->lock for us */
+static int replay_submit_stream_buffer(void *driver,
+                                       struct bladerf_stream *stream,
+                                       void *buffer, unsigned int timeout_ms,
+                                       bool nonblock)
+{
+    int status = 0;
+    struct replay_stream_data *stream_data = stream->backend_data;
+    struct timespec timeout_abs;
+
+    if (buffer == BLADERF_STREAM_SHUTDOWN) {
+        if (stream_data->num_avail == stream_data->num_transfers) {
+            stream->state = STREAM_DONE;
+        } else {
+            stream->state = STREAM_SHUTTING_DOWN;
+        }
+
+        pthread_cond_signal(&stream_data->wakeup);
+        return 0;
+    }
+
+    if (stream_data->num_avail == 0) {
+        if (nonblock) {
+            log_debug("Non-blocking buffer submission requested, but no "
+                      "transfers are currently available.\n");
+
+            return BLADERF_ERR_WOULD_BLOCK;
+        }
+
+        if (timeout_ms != 0) {
+            status = populate_abs_timeout(&timeout_abs, timeout_ms);
+            if (status != 0) {
+                return BLADERF_ERR_UNEXPECTED;
+            }
+
+            while (stream_data->num_avail == 0 && status == 0) {
+                status = pthread_cond_timedwait(&stream->can_submit_buffer,
+                                                &stream->lock,
+                                                &timeout_abs);
+            }
+        } else {
+            while (stream_data->num_avail == 0 && status == 0) {
+                status = pthread_cond_wait(&stream->can_submit_buffer,
+                                           &stream->lock);
+            }
+        }
+    }
+
+    if (status == ETIMEDOUT) {
+        log_debug("%s: Timed out waiting for a transfer to become available.\n",
+                  __FUNCTION__);
+        return BLADERF_ERR_TIMEOUT;
+    } else if (status != 0) {
+        return BLADERF_ERR_UNEXPECTED;
+    } else {
+        submit_transfer(stream, buffer);
+        return 0;
+    }
+}
+
+static int replay_deinit_stream(void *driver, struct bladerf_stream *stream)
+{
+    struct replay_stream_data *stream_data = stream->backend_data;
+
+    if (stream_data != NULL) {
+        pthread_cond_destroy(&stream_data->wakeup);
+        free(stream_data->transfers);
+        free(stream_data->scratch);
+        free(stream_data);
+        stream->backend_data = NULL;
+    }
+
+    return 0;
+}
+
+static int replay_open_bootloader(void **driver, uint8_t bus, uint8_t addr)
+{
+    return BLADERF_ERR_NODEV;
+}
+
+static void replay_close_bootloader(void *driver)
+{
+}
+
+static const struct usb_fns replay_fns = {
+    FIELD_INIT(.probe, replay_probe),
+    FIELD_INIT(.open, replay_open),
+    FIELD_INIT(.close, replay_close),
+    FIELD_INIT(.get_speed, replay_get_speed),
+    FIELD_INIT(.change_setting, replay_change_setting),
+    FIELD_INIT(.control_transfer, replay_control_transfer),
+    FIELD_INIT(.bulk_transfer, replay_bulk_transfer),
+    FIELD_INIT(.get_string_descriptor, replay_get_string_descriptor),
+    FIELD_INIT(.init_stream, replay_init_stream),
+    FIELD_INIT(.stream, replay_stream),
+    FIELD_INIT(.submit_stream_buffer, replay_submit_stream_buffer),
+    FIELD_INIT(.deinit_stream, replay_deinit_stream),
+    FIELD_INIT(.open_bootloader, replay_open_bootloader),
+    FIELD_INIT(.close_bootloader, replay_close_bootloader),
+};
+
+const struct usb_driver usb_driver_replay = {
+    FIELD_INIT(.id, BLADERF_BACKEND_REPLAY),
+    FIELD_INIT(.fn, &replay_fns)
+};
@@ -0,0 +1,501 @@
+/*
+ * USB traffic recorder
+ *
+ * Wraps the function table of an opened USB driver, writing each operation
+ * performed through it to a trace file (see usb_trace.h), along with its
+ * start time, duration, and result. Stream buffers are captured by
+ * interposing on the stream callback: completed RX buffers are recorded as
+ * they are handed to the callback, and TX buffers as they are submitted.
+ *
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "rel_assert.h"
+#include "bladerf_priv.h"
+#include "async.h"
+#include "log.h"
+#include "usb_trace.h"
+
+/* Stdio buffering for the trace file */
+#define TRACE_FILE_BUF_SIZE     (1024 * 1024)
+
+struct usb_trace;
+
+/* The application's stream callback, which the recorder interposes on */
+struct trace_stream {
+    struct usb_trace *trace;
+    bladerf_stream_cb cb;
+    void *user_data;
+};
+
+struct usb_trace {
+    const struct usb_fns *fn;   /* Wrapped driver */
+    void *driver;
+
+    FILE *file;
+    MUTEX lock;                 /* Serializes writes to the trace */
+    bool write_failed;
+    uint64_t start_ns;
+    enum trace_samples samples;
+
+    struct trace_stream streams[NUM_MODULES];
+};
+
+static const struct usb_fns usb_trace_fns;
+
+uint64_t trace_now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec;
+}
+
+/* Time base of the recorded timestamps and durations, which must not jump
+ * when the wall clock is adjusted */
+static uint64_t trace_clock_ns(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec;
+#else
+    return trace_now_ns();
+#endif
+}
+
+static void trace_begin(struct trace_record *r, enum trace_type type)
+{
+    memset(r, 0, sizeof(*r));
+    r->type = type;
+    r->timestamp_ns = trace_clock_ns();
+}
+
+static void trace_write(struct usb_trace *t, struct trace_record *r,
+                        const void *payload)
+{
+    uint8_t hdr[TRACE_RECORD_HDR_LEN];
+    const uint64_t now = trace_clock_ns();
+    bool ok;
+
+    MUTEX_LOCK(&t->lock);
+
+    r->duration_us = (uint32_t) ((now - r->timestamp_ns) / 1000);
+    r->timestamp_ns -= t->start_ns;
+
+    trace_pack_record(hdr, r);
+    ok = fwrite(hdr, 1, sizeof(hdr), t->file) == sizeof(hdr);
+    if (ok && r->length != 0) {
+        ok = fwrite(payload, 1, r->length, t->file) == r->length;
+    }
+
+    if (!ok && !t->write_failed) {
+        log_error("Failed to write USB trace. The trace is incomplete.\n");
+        t->write_failed = true;
+    }
+
+    MUTEX_UNLOCK(&t->lock);
+}
+
+/* Record a stream buffer, with as much of its content as the sample payload
+ * mode calls for */
+static void trace_write_buffer(struct usb_trace *t, struct trace_record *r,
+                               struct bladerf_stream *stream,
+                               const void *buffer, size_t num_samples)
+{
+    const size_t len = samples_to_bytes(stream->format, num_samples);
+    const size_t msg_size = stream->dev->msg_size;
+    uint8_t *headers = NULL;
+    size_t i;
+
+    r->arg0 = stream->module;
+    r->arg1 = (uint32_t) len;
+
+    if (t->samples == TRACE_SAMPLES_ALL) {
+        r->length = (uint32_t) len;
+        trace_write(t, r, buffer);
+        return;
+    }
+
+    if (t->samples == TRACE_SAMPLES_META &&
+        stream->format == BLADERF_FORMAT_SC16_Q11_META && msg_size != 0) {
+
+        headers = malloc((len / msg_size) * TRACE_META_HDR_LEN);
+        if (headers != NULL) {
+            for (i = 0; i < len / msg_size; i++) {
+                memcpy(headers + i * TRACE_META_HDR_LEN,
+                       (const uint8_t *) buffer + i * msg_size,
+                       TRACE_META_HDR_LEN);
+            }
+
+            r->flags = TRACE_FLAG_META_ONLY;
+            r->length = (uint32_t) ((len / msg_size) * TRACE_META_HDR_LEN);
+        }
+    }
+
+    trace_write(t, r, headers);
+    free(headers);
+}
+
+static int trace_probe(backend_probe_target probe_target,
+                       struct bladerf_devinfo_list *info_list)
+{
+    /* The recorder is never listed as a driver */
+    return BLADERF_ERR_NODEV;
+}
+
+static int trace_open(void **driver, struct bladerf_devinfo *info_in,
+                      struct bladerf_devinfo *info_out)
+{
+    /* Recording starts via usb_trace_start() on an already-open driver */
+    return BLADERF_ERR_NODEV;
+}
+
+static void trace_close(void *driver)
+{
+    struct usb_trace *t = driver;
+
+    t->fn->close(t->driver);
+
+    if (fclose(t->file) != 0 && !t->write_failed) {
+        log_error("Failed to write USB trace. The trace is incomplete.\n");
+    }
+
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
+
+static int trace_get_speed(void *driver, bladerf_dev_speed *speed)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+
+    trace_begin(&r, TRACE_GET_SPEED);
+    r.status = t->fn->get_speed(t->driver, speed);
+    r.arg0 = r.status == 0 ? (uint32_t) *speed : 0;
+    trace_write(t, &r, NULL);
+
+    return r.status;
+}
+
+static int trace_change_setting(void *driver, uint8_t setting)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+
+    trace_begin(&r, TRACE_CHANGE_SETTING);
+    r.arg0 = setting;
+    r.status = t->fn->change_setting(t->driver, setting);
+    trace_write(t, &r, NULL);
+
+    return r.status;
+}
+
+static int trace_control_transfer(void *driver,
+                                  usb_target target_type,
+                                  usb_request req_type,
+                                  usb_direction direction,
+                                  uint8_t request, uint16_t wvalue,
+                                  uint16_t windex,
+                                  void *buffer, uint32_t buffer_len,
+                                  uint32_t timeout_ms)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+
+    trace_begin(&r, TRACE_CONTROL);
+    r.arg0 = (uint32_t) target_type | ((uint32_t) req_type << 8) |
+             ((uint32_t) direction << 16) | ((uint32_t) request << 24);
+    r.arg1 = (uint32_t) wvalue | ((uint32_t) windex << 16);
+    r.length = buffer_len;
+
+    r.status = t->fn->control_transfer(t->driver, target_type, req_type,
+                                       direction, request, wvalue, windex,
+                                       buffer, buffer_len, timeout_ms);
+
+    trace_write(t, &r, buffer);
+    return r.status;
+}
+
+static int trace_bulk_transfer(void *driver, uint8_t endpoint,
+                               void *buffer, uint32_t buffer_len,
+                               uint32_t timeout_ms)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+
+    trace_begin(&r, TRACE_BULK);
+    r.arg0 = endpoint;
+    r.length = buffer_len;
+
+    r.status = t->fn->bulk_transfer(t->driver, endpoint, buffer, buffer_len,
+                                    timeout_ms);
+
+    trace_write(t, &r, buffer);
+    return r.status;
+}
+
+static int trace_get_string_descriptor(void *driver, uint8_t index,
+                                       void *buffer, uint32_t buffer_len)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+
+    trace_begin(&r, TRACE_STRING_DESC);
+    r.arg0 = index;
+
+    r.status = t->fn->get_string_descriptor(t->driver, index,
+                                            buffer, buffer_len);
+
+    if (r.status == 0) {
+        r.length = buffer_len;
+    }
+
+    trace_write(t, &r, buffer);
+    return r.status;
+}
+
+static int trace_init_stream(void *driver, struct bladerf_stream *stream,
+                             size_t num_transfers)
+{
+    struct usb_trace *t = driver;
+    return t->fn->init_stream(t->driver, stream, num_transfers);
+}
+
+/* Called by the wrapped driver, with stream->lock held */
+static void *trace_stream_cb(struct bladerf *dev,
+                             struct bladerf_stream *stream,
+                             struct bladerf_metadata *meta,
+                             void *samples, size_t num_samples,
+                             void *user_data)
+{
+    struct trace_stream *ts = user_data;
+    struct usb_trace *t = ts->trace;
+    struct trace_record r;
+    void *next;
+
+    if (samples != NULL) {
+        trace_begin(&r, TRACE_STREAM_BUFFER);
+
+        if (stream->module == BLADERF_MODULE_RX) {
+            trace_write_buffer(t, &r, stream, samples, num_samples);
+        } else {
+            r.arg0 = stream->module;
+            r.arg1 = (uint32_t) samples_to_bytes(stream->format, num_samples);
+            trace_write(t, &r, NULL);
+        }
+    }
+
+    trace_begin(&r, TRACE_STREAM_SUBMIT);
+    next = ts->cb(dev, stream, meta, samples, num_samples, ts->user_data);
+
+    if (next != BLADERF_STREAM_SHUTDOWN && next != BLADERF_STREAM_NO_DATA) {
+        if (stream->module == BLADERF_MODULE_TX) {
+            trace_write_buffer(t, &r, stream, next,
+                               stream->samples_per_buffer);
+        } else {
+            r.arg0 = stream->module;
+            r.arg1 = (uint32_t) async_stream_buf_bytes(stream);
+            trace_write(t, &r, NULL);
+        }
+    }
+
+    return next;
+}
+
+static int trace_stream(void *driver, struct bladerf_stream *stream,
+                        bladerf_module module)
+{
+    struct usb_trace *t = driver;
+    struct trace_stream *ts = &t->streams[module];
+    struct trace_record r;
+    int status;
+
+    trace_begin(&r, TRACE_STREAM_START);
+    r.flags = (uint16_t) stream->format;
+    r.arg0 = module;
+    r.arg1 = (uint32_t) stream->samples_per_buffer;
+    trace_write(t, &r, NULL);
+
+    /* The callback is swapped out only while the wrapped driver runs the
+     * stream, and is restored before the caller sees the stream again */
+    MUTEX_LOCK(&stream->lock);
+    ts->trace = t;
+    ts->cb = stream->cb;
+    ts->user_data = stream->user_data;
+    stream->cb = trace_stream_cb;
+    stream->user_data = ts;
+    MUTEX_UNLOCK(&stream->lock);
+
+    status = t->fn->stream(t->driver, stream, module);
+
+    MUTEX_LOCK(&stream->lock);
+    stream->cb = ts->cb;
+    stream->user_data = ts->user_data;
+    MUTEX_UNLOCK(&stream->lock);
+
+    trace_begin(&r, TRACE_STREAM_END);
+    r.arg0 = module;
+    r.status = status == 0 ? stream->error_code : status;
+    trace_write(t, &r, NULL);
+
+    return status;
+}
+
+/* The top-level code will have acquired the stream->lock for us */
+static int trace_submit_stream_buffer(void *driver,
+                                      struct bladerf_stream *stream,
+                                      void *buffer, unsigned int timeout_ms,
+                                      bool nonblock)
+{
+    struct usb_trace *t = driver;
+    struct trace_record r;
+    int status;
+
+    trace_begin(&r, TRACE_STREAM_SUBMIT);
+    status = t->fn->submit_stream_buffer(t->driver, stream, buffer,
+                                         timeout_ms, nonblock);
+
+    if (buffer != BLADERF_STREAM_SHUTDOWN) {
+        r.status = status;
+
+        if (stream->module == BLADERF_MODULE_TX && status == 0) {
+            trace_write_buffer(t, &r, stream, buffer,
+                               stream->samples_per_buffer);
+        } else {
+            r.arg0 = stream->module;
+            r.arg1 = (uint32_t) async_stream_buf_bytes(stream);
+            trace_write(t, &r, NULL);
+        }
+    }
+
+    return status;
+}
+
+static int trace_deinit_stream(void *driver, struct bladerf_stream *stream)
+{
+    struct usb_trace *t = driver;
+    return t->fn->deinit_stream(t->driver, stream);
+}
+
+static int trace_open_bootloader(void **driver, uint8_t bus, uint8_t addr)
+{
+    return BLADERF_ERR_NODEV;
+}
+
+static void trace_close_bootloader(void *driver)
+{
+}
+
+static int trace_write_file_hdr(struct usb_trace *t,
+                                const struct bladerf_devinfo *ident)
+{
+    uint8_t hdr[TRACE_FILE_HDR_LEN];
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, TRACE_MAGIC, 8);
+    trace_put_le32(hdr + 8, TRACE_VERSION);
+    trace_put_le32(hdr + 12, t->samples);
+    trace_put_le64(hdr + 16, (uint64_t) time(NULL));
+    hdr[24] = ident->usb_bus;
+    hdr[25] = ident->usb_addr;
+    trace_put_le32(hdr + 28, ident->instance);
+    memcpy(hdr + 32, ident->serial, strnlen(ident->serial, 32));
+
+    if (fwrite(hdr, 1, sizeof(hdr), t->file) != sizeof(hdr)) {
+        return BLADERF_ERR_IO;
+    }
+
+    return 0;
+}
+
+int usb_trace_start(struct bladerf_usb *usb, const char *path,
+                    const struct bladerf_devinfo *ident)
+{
+    int status;
+    struct usb_trace *t;
+    const char *samples = getenv("BLADERF_USB_TRACE_SAMPLES");
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    if (samples == NULL || !strcasecmp(samples, "meta")) {
+        t->samples = TRACE_SAMPLES_META;
+    } else if (!strcasecmp(samples, "all")) {
+        t->samples = TRACE_SAMPLES_ALL;
+    } else if (!strcasecmp(samples, "none")) {
+        t->samples = TRACE_SAMPLES_NONE;
+    } else {
+        log_warning("Invalid BLADERF_USB_TRACE_SAMPLES value: %s\n", samples);
+        free(t);
+        return BLADERF_ERR_INVAL;
+    }
+
+    t->file = fopen(path, "wb");
+    if (t->file == NULL) {
+        log_debug("Failed to open USB trace file: %s\n", path);
+        free(t);
+        return BLADERF_ERR_IO;
+    }
+
+    setvbuf(t->file, NULL, _IOFBF, TRACE_FILE_BUF_SIZE);
+
+    status = trace_write_file_hdr(t, ident);
+    if (status != 0) {
+        fclose(t->file);
+        free(t);
+        return status;
+    }
+
+    MUTEX_INIT(&t->lock);
+    t->start_ns = trace_clock_ns();
+    t->fn = usb->fn;
+    t->driver = usb->driver;
+
+    usb->fn = &usb_trace_fns;
+    usb->driver = t;
+
+    log_debug("Recording USB traffic to %s\n", path);
+    return 0;
+}
+
+static const struct usb_fns usb_trace_fns = {
+    FIELD_INIT(.probe, trace_probe),
+    FIELD_INIT(.open, trace_open),
+    FIELD_INIT(.close, trace_close),
+    FIELD_INIT(.get_speed, trace_get_speed),
+    FIELD_INIT(.change_setting, trace_change_setting),
+    FIELD_INIT(.control_transfer, trace_control_transfer),
+    FIELD_INIT(.bulk_transfer, trace_bulk_transfer),
+    FIELD_INIT(.get_string_descriptor, trace_get_string_descriptor),
+    FIELD_INIT(.init_stream, trace_init_stream),
+    FIELD_INIT(.stream, trace_stream),
+    FIELD_INIT(.submit_stream_buffer, trace_submit_stream_buffer),
+    FIELD_INIT(.deinit_stream, trace_deinit_stream),
+    FIELD_INIT(.open_bootloader, trace_open_bootloader),
+    FIELD_INIT(.close_bootloader, trace_close_bootloader),
+};
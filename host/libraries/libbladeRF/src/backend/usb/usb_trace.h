@@ -0,0 +1,237 @@
+/*
+ * USB traffic traces
+ *
+ * The USB backend can record the traffic exchanged with a device's USB
+ * driver (struct usb_fns) to a trace file, which the "replay" USB driver
+ * plays back in place of the device. This file defines the trace file format
+ * shared by the two.
+ *
+ * A trace consists of a TRACE_FILE_HDR_LEN byte file header followed by
+ * records. All values are little-endian.
+ *
+ *  File header:
+ *      [0:7]   Magic "BRFTRACE"
+ *      [8:11]  Format version (TRACE_VERSION)
+ *      [12:15] Sample payload mode (enum trace_samples)
+ *      [16:23] Wall-clock time at which recording started, in seconds
+ *              since the epoch
+ *      [24]    USB bus number
+ *      [25]    USB address
+ *      [26:27] Reserved
+ *      [28:31] Device instance
+ *      [32:63] Serial number (not NUL-terminated)
+ *
+ *  Record header, followed by `length` bytes of payload:
+ *      [0:7]   Time at which the operation began, in ns since the start of
+ *              the recording
+ *      [8:11]  Duration of the operation, in us
+ *      [12:13] Record type (enum trace_type)
+ *      [14:15] Flags (TRACE_FLAG_*)
+ *      [16:19] Status (0 or a BLADERF_ERR_* value)
+ *      [20:23] arg0 (type-specific)
+ *      [24:27] arg1 (type-specific)
+ *      [28:31] Payload length, in bytes
+ *
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef BACKEND_USB_TRACE_H_
+#define BACKEND_USB_TRACE_H_
+
+#include <stdint.h>
+
+#include "bladerf_priv.h"
+#include "usb.h"
+
+#define TRACE_MAGIC             "BRFTRACE"
+#define TRACE_VERSION           1
+
+#define TRACE_FILE_HDR_LEN      64
+#define TRACE_RECORD_HDR_LEN    32
+
+/* Size of the metadata header at the start of each stream message */
+#define TRACE_META_HDR_LEN      16
+
+/* Record types, and the use of their arguments and payloads.
+ *
+ * Device operations, replayed in order:
+ *
+ *  TRACE_GET_SPEED         arg0: bladerf_dev_speed
+ *  TRACE_CHANGE_SETTING    arg0: alt setting
+ *  TRACE_CONTROL           arg0: target | (type << 8) | (dir << 16) |
+ *                                (request << 24)
+ *                          arg1: wValue | (wIndex << 16)
+ *                          Payload: data sent or received
+ *  TRACE_BULK              arg0: endpoint
+ *                          Payload: data sent or received
+ *  TRACE_STRING_DESC       arg0: descriptor index
+ *                          Payload: data received
+ *
+ * Stream events, replayed per module at their recorded times:
+ *
+ *  TRACE_STREAM_START      arg0: module, arg1: samples per buffer
+ *                          flags: bladerf_format
+ *  TRACE_STREAM_SUBMIT     A buffer was submitted.
+ *                          arg0: module, arg1: buffer length in bytes
+ *                          Payload: TX samples, per the sample payload mode
+ *  TRACE_STREAM_BUFFER     A transfer completed.
+ *                          arg0: module, arg1: buffer length in bytes
+ *                          Payload: RX samples, per the sample payload mode
+ *  TRACE_STREAM_END        arg0: module, status: stream status
+ */
+enum trace_type {
+    TRACE_GET_SPEED = 1,
+    TRACE_CHANGE_SETTING,
+    TRACE_CONTROL,
+    TRACE_BULK,
+    TRACE_STRING_DESC,
+    TRACE_STREAM_START,
+    TRACE_STREAM_SUBMIT,
+    TRACE_STREAM_BUFFER,
+    TRACE_STREAM_END,
+};
+
+/* Sample payload modes, selected with BLADERF_USB_TRACE_SAMPLES */
+enum trace_samples {
+    TRACE_SAMPLES_ALL,      /* Entire buffers ("all") */
+    TRACE_SAMPLES_META,     /* Only the metadata header of each message
+                             * ("meta"). Other buffers have no payload. */
+    TRACE_SAMPLES_NONE,     /* No sample payloads ("none") */
+};
+
+/* The payload holds only the metadata headers of the buffer's messages. */
+#define TRACE_FLAG_META_ONLY    (1 << 0)
+
+/* Stream records are grouped with the module they pertain to */
+#define TRACE_CHANNEL_CTRL      0
+#define TRACE_CHANNEL_RX        1
+#define TRACE_CHANNEL_TX        2
+#define TRACE_NUM_CHANNELS      3
+
+struct trace_record {
+    uint64_t timestamp_ns;
+    uint32_t duration_us;
+    uint16_t type;
+    uint16_t flags;
+    int32_t status;
+    uint32_t arg0;
+    uint32_t arg1;
+    uint32_t length;
+};
+
+static inline void trace_put_le16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+}
+
+static inline void trace_put_le32(uint8_t *buf, uint32_t val)
+{
+    trace_put_le16(buf, val & 0xffff);
+    trace_put_le16(buf + 2, val >> 16);
+}
+
+static inline void trace_put_le64(uint8_t *buf, uint64_t val)
+{
+    trace_put_le32(buf, (uint32_t) val);
+    trace_put_le32(buf + 4, (uint32_t) (val >> 32));
+}
+
+static inline uint16_t trace_get_le16(const uint8_t *buf)
+{
+    return (uint16_t) (buf[0] | (buf[1] << 8));
+}
+
+static inline uint32_t trace_get_le32(const uint8_t *buf)
+{
+    return trace_get_le16(buf) | ((uint32_t) trace_get_le16(buf + 2) << 16);
+}
+
+static inline uint64_t trace_get_le64(const uint8_t *buf)
+{
+    return trace_get_le32(buf) | ((uint64_t) trace_get_le32(buf + 4) << 32);
+}
+
+static inline void trace_pack_record(uint8_t *buf, const struct trace_record *r)
+{
+    trace_put_le64(buf, r->timestamp_ns);
+    trace_put_le32(buf + 8, r->duration_us);
+    trace_put_le16(buf + 12, r->type);
+    trace_put_le16(buf + 14, r->flags);
+    trace_put_le32(buf + 16, (uint32_t) r->status);
+    trace_put_le32(buf + 20, r->arg0);
+    trace_put_le32(buf + 24, r->arg1);
+    trace_put_le32(buf + 28, r->length);
+}
+
+static inline void trace_unpack_record(const uint8_t *buf,
+                                       struct trace_record *r)
+{
+    r->timestamp_ns = trace_get_le64(buf);
+    r->duration_us = trace_get_le32(buf + 8);
+    r->type = trace_get_le16(buf + 12);
+    r->flags = trace_get_le16(buf + 14);
+    r->status = (int32_t) trace_get_le32(buf + 16);
+    r->arg0 = trace_get_le32(buf + 20);
+    r->arg1 = trace_get_le32(buf + 24);
+    r->length = trace_get_le32(buf + 28);
+}
+
+/* Channel a record is replayed on */
+static inline unsigned int trace_channel(const struct trace_record *r)
+{
+    switch (r->type) {
+        case TRACE_STREAM_START:
+        case TRACE_STREAM_SUBMIT:
+        case TRACE_STREAM_BUFFER:
+        case TRACE_STREAM_END:
+            return r->arg0 == BLADERF_MODULE_TX ?
+                        TRACE_CHANNEL_TX : TRACE_CHANNEL_RX;
+
+        default:
+            return TRACE_CHANNEL_CTRL;
+    }
+}
+
+/* Current time in ns, from the same clock used by the stream code */
+uint64_t trace_now_ns(void);
+
+/**
+ * Record all subsequent traffic through a USB driver that has been opened
+ *
+ * On success, usb->fn and usb->driver are replaced by a recording wrapper,
+ * which closes the trace and the original driver when it is closed.
+ *
+ * The BLADERF_USB_TRACE_SAMPLES environment variable selects which sample
+ * data is recorded: "meta" (default), "all", or "none". Stream buffers are
+ * written from the driver's transfer callback, so "all" may cause overruns
+ * and underruns at high sample rates.
+ *
+ * @param[inout]    usb     USB backend handle
+ * @param[in]       path    Trace file to create
+ * @param[in]       ident   Device that was opened
+ *
+ * @return 0 on success, BLADERF_ERR_* value on failure. The USB driver is
+ *         left untouched on failure.
+ */
+int usb_trace_start(struct bladerf_usb *usb, const char *path,
+                    const struct bladerf_devinfo *ident);
+
+#endif
@@ -2179,3 +2179,15 @@ int bladerf_write_trigger(struct bladerf *dev,
 
     return status;
 }
+
+/*------------------------------------------------------------------------------
+ * Control request statistics
+ *----------------------------------------------------------------------------*/
+int bladerf_get_ctrl_request_count(struct bladerf *dev, uint64_t *count)
+{
+    MUTEX_LOCK(&dev->ctrl_lock);
+    *count = dev->ctrl_requests;
+    MUTEX_UNLOCK(&dev->ctrl_lock);
+
+    return 0;
+}
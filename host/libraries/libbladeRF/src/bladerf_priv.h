@@ -137,6 +137,10 @@ struct bladerf {
 
     /* Which mode of operation we use for tuning */
     bladerf_tuning_mode tuning_mode;
+
+    /* Number of control requests (NIOS II peripheral accesses) issued to the
+     * device. Backends increment this with ctrl_lock held. */
+    uint64_t ctrl_requests;
 };
 
 /*
@@ -1,6 +1,7 @@
 #ifndef TEST_COMMON_H_
 #define TEST_COMMON_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 #include "host_config.h"
@@ -77,4 +78,30 @@ unsigned int get_rand_freq(uint64_t *prng_state, bool xb200_enabled);
 int wait_for_timestamp(struct bladerf *dev, bladerf_module module,
                        uint64_t timestamp, unsigned int timeout_ms);
 
+#ifdef CLOCK_MONOTONIC
+/**
+ * Read the monotonic clock, for measuring elapsed time
+ *
+ * @return  current time, in nanoseconds
+ */
+uint64_t now_ns(void);
+#endif
+
+/**
+ * qsort() comparison function for uint64_t values, in ascending order
+ */
+int compare_u64(const void *a, const void *b);
+
+/**
+ * Get a percentile of a set of durations
+ *
+ * @param[in]   sorted_ns   Durations, in nanoseconds, sorted in ascending order
+ *                          (e.g., via qsort() with compare_u64())
+ * @param[in]   n           Number of durations. Must be non-zero.
+ * @param[in]   q           Quantile, from 0.0 to 1.0
+ *
+ * @return  duration at the specified percentile, in microseconds
+ */
+double percentile_us(const uint64_t *sorted_ns, size_t n, double q);
+
 #endif
@@ -83,3 +83,30 @@ int wait_for_timestamp(struct bladerf *dev, bladerf_module module,
 
     return status;
 }
+
+#ifdef CLOCK_MONOTONIC
+uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+#endif
+
+int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+double percentile_us(const uint64_t *sorted_ns, size_t n, double q)
+{
+    size_t idx = (size_t) (q * n);
+
+    if (idx >= n) {
+        idx = n - 1;
+    }
+
+    return sorted_ns[idx] / 1000.0;
+}
@@ -0,0 +1,48 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef CTRL_BENCH_H_
+#define CTRL_BENCH_H_
+
+#include <libbladeRF.h>
+
+#define DEFAULT_ITERATIONS  200
+
+/* A control-path operation to benchmark */
+struct ctrl_op {
+    const char *name;
+
+    /* Optional. Called once before the operation is timed, e.g., to select a
+     * tuning mode. */
+    int (*setup)(struct bladerf *dev);
+
+    /* Perform the operation. The iteration number may be used to vary the
+     * value that is written. */
+    int (*run)(struct bladerf *dev, unsigned int i);
+};
+
+extern const struct ctrl_op ctrl_ops[];
+extern const unsigned int num_ctrl_ops;
+
+#endif
@@ -0,0 +1,443 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* This program measures the latency of libbladeRF's control-path calls, and
+ * counts the control requests each one issues to the device. The JSON output
+ * may be compared between builds to catch control-path regressions. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <libbladeRF.h>
+#include <getopt.h>
+
+#include "host_config.h"
+#include "conversions.h"
+#include "log.h"
+#include "test_common.h"
+#include "ctrl_bench.h"
+
+#define OPTSTR "hd:i:o:t:l"
+const struct option long_options[] = {
+    { "help",           no_argument,        0,  'h' },
+    { "device",         required_argument,  0,  'd' },
+    { "iterations",     required_argument,  0,  'i' },
+    { "output",         required_argument,  0,  'o' },
+    { "tests",          required_argument,  0,  't' },
+    { "list",           no_argument,        0,  'l' },
+
+    /* Verbosity options */
+    { "verbosity",      required_argument,  0,  1,  },
+    { "lib-verbosity",  required_argument,  0,  2,  },
+    { 0,                0,                  0,  0   },
+};
+
+struct app_params {
+    const char *device_str;
+    const char *output;
+    unsigned int iterations;
+    bool *selected;             /* Which of ctrl_ops[] to run */
+};
+
+struct op_result {
+    int status;
+    unsigned int calls;
+    double latency_us[5];       /* p50, p90, p99, max, mean */
+    uint64_t requests_min;
+    uint64_t requests_max;
+    double requests_mean;
+};
+
+static void print_usage(const char *argv0)
+{
+    printf("Usage: %s [options]\n", argv0);
+    printf("libbladeRF_test_ctrl_bench: Measure control-path call latencies and\n");
+    printf("the number of control requests each call issues.\n");
+    printf("\n");
+
+    printf("Options:\n");
+    printf("    -d, --device <device>       Use the specified device. By default,\n");
+    printf("                                any device found will be used.\n");
+    printf("    -i, --iterations <n>        Timed calls per test. Default = %u.\n", DEFAULT_ITERATIONS);
+    printf("    -o, --output <file>         Write results to <file>. Default = stdout.\n");
+    printf("    -t, --tests <list>          Comma-separated list of tests to run.\n");
+    printf("                                By default, all tests are run.\n");
+    printf("    -l, --list                  List the available tests and exit.\n");
+    printf("    -h, --help                  Show this help text\n");
+    printf("    --verbosity <level>         Set test verbosity (Default: info)\n");
+    printf("    --lib-verbosity <level>     Set libbladeRF verbosity (Default: warning)\n");
+    printf("\n");
+
+    printf("Notes:\n");
+    printf("    Each test performs one untimed call before the timed calls, so\n");
+    printf("    that one-time work (e.g., loading calibration tables) is excluded.\n");
+    printf("\n");
+    printf("    Control requests are NIOS II peripheral accesses, each consisting\n");
+    printf("    of one USB transfer to the device and one back. Unlike latencies,\n");
+    printf("    these counts are deterministic, so any change in them between\n");
+    printf("    builds indicates a change in the control path.\n");
+    printf("\n");
+}
+
+static void list_ops(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_ctrl_ops; i++) {
+        printf("%s\n", ctrl_ops[i].name);
+    }
+}
+
+static int select_ops(const char *str, bool *selected)
+{
+    char *list = strdup(str);
+    char *tok;
+    unsigned int i;
+    int status = 0;
+
+    if (list == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    for (tok = strtok(list, ","); tok != NULL && status == 0;
+         tok = strtok(NULL, ",")) {
+
+        for (i = 0; i < num_ctrl_ops; i++) {
+            if (!strcasecmp(tok, ctrl_ops[i].name)) {
+                selected[i] = true;
+                break;
+            }
+        }
+
+        if (i == num_ctrl_ops) {
+            log_error("Unknown test: %s\n", tok);
+            status = -1;
+        }
+    }
+
+    free(list);
+    return status;
+}
+
+static int handle_cmdline(int argc, char *argv[], struct app_params *p)
+{
+    int c;
+    int idx;
+    bool ok;
+    unsigned int i;
+    bladerf_log_level level;
+    const char *tests = NULL;
+
+    memset(p, 0, sizeof(*p));
+    p->iterations = DEFAULT_ITERATIONS;
+
+    p->selected = calloc(num_ctrl_ops, sizeof(p->selected[0]));
+    if (p->selected == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    while ((c = getopt_long(argc, argv, OPTSTR, long_options, &idx)) >= 0) {
+        switch (c) {
+            case 1:
+                level = str2loglevel(optarg, &ok);
+                if (!ok) {
+                    log_error("Invalid log level provided: %s\n", optarg);
+                    return -1;
+                } else {
+                    log_set_verbosity(level);
+                }
+                break;
+
+            case 2:
+                level = str2loglevel(optarg, &ok);
+                if (!ok) {
+                    log_error("Invalid log level provided: %s\n", optarg);
+                    return -1;
+                } else {
+                    bladerf_log_set_verbosity(level);
+                }
+                break;
+
+            case 'h':
+                return 1;
+
+            case 'l':
+                list_ops();
+                return 2;
+
+            case 'd':
+                p->device_str = optarg;
+                break;
+
+            case 'i':
+                p->iterations = str2uint(optarg, 1, UINT_MAX, &ok);
+                if (!ok) {
+                    log_error("Invalid iteration count: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'o':
+                p->output = optarg;
+                break;
+
+            case 't':
+                tests = optarg;
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    if (tests != NULL) {
+        return select_ops(tests, p->selected);
+    }
+
+    for (i = 0; i < num_ctrl_ops; i++) {
+        p->selected[i] = true;
+    }
+
+    return 0;
+}
+
+static void run_op(struct bladerf *dev, const struct ctrl_op *op,
+                   unsigned int iterations, uint64_t *latency_ns,
+                   struct op_result *r)
+{
+    uint64_t before, after, t0, t1;
+    uint64_t total_ns = 0;
+    uint64_t total_requests = 0;
+    unsigned int i;
+
+    memset(r, 0, sizeof(*r));
+    r->requests_min = UINT64_MAX;
+
+    if (op->setup != NULL) {
+        r->status = op->setup(dev);
+        if (r->status != 0) {
+            return;
+        }
+    }
+
+    r->status = op->run(dev, 0);
+
+    for (i = 1; i <= iterations && r->status == 0; i++) {
+        bladerf_get_ctrl_request_count(dev, &before);
+
+        t0 = now_ns();
+        r->status = op->run(dev, i);
+        t1 = now_ns();
+
+        bladerf_get_ctrl_request_count(dev, &after);
+
+        if (r->status == 0) {
+            const uint64_t requests = after - before;
+
+            latency_ns[r->calls++] = t1 - t0;
+            total_ns += t1 - t0;
+            total_requests += requests;
+
+            if (requests < r->requests_min) {
+                r->requests_min = requests;
+            }
+
+            if (requests > r->requests_max) {
+                r->requests_max = requests;
+            }
+        }
+    }
+
+    if (r->calls == 0) {
+        r->requests_min = 0;
+        return;
+    }
+
+    qsort(latency_ns, r->calls, sizeof(latency_ns[0]), compare_u64);
+
+    r->latency_us[0] = percentile_us(latency_ns, r->calls, 0.50);
+    r->latency_us[1] = percentile_us(latency_ns, r->calls, 0.90);
+    r->latency_us[2] = percentile_us(latency_ns, r->calls, 0.99);
+    r->latency_us[3] = latency_ns[r->calls - 1] / 1000.0;
+    r->latency_us[4] = total_ns / 1000.0 / r->calls;
+    r->requests_mean = (double) total_requests / r->calls;
+}
+
+static void print_header(FILE *out, struct bladerf *dev,
+                         const struct app_params *p)
+{
+    struct bladerf_version lib_version, fw_version, fpga_version;
+    struct bladerf_devinfo info;
+
+    bladerf_version(&lib_version);
+
+    if (bladerf_get_devinfo(dev, &info) != 0) {
+        memset(&info, 0, sizeof(info));
+    }
+
+    if (bladerf_fw_version(dev, &fw_version) != 0) {
+        fw_version.describe = "unknown";
+    }
+
+    if (bladerf_fpga_version(dev, &fpga_version) != 0) {
+        fpga_version.describe = "unknown";
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"libbladeRF_version\": \"%s\",\n", lib_version.describe);
+    fprintf(out, "  \"fw_version\": \"%s\",\n", fw_version.describe);
+    fprintf(out, "  \"fpga_version\": \"%s\",\n", fpga_version.describe);
+    fprintf(out, "  \"backend\": \"%s\",\n", backend_description(info.backend));
+    fprintf(out, "  \"serial\": \"%s\",\n", info.serial);
+    fprintf(out, "  \"usb_speed\": \"%s\",\n",
+            devspeed2str(bladerf_device_speed(dev)));
+    fprintf(out, "  \"iterations\": %u,\n", p->iterations);
+    fprintf(out, "  \"results\": [");
+}
+
+static void print_result(FILE *out, bool first, const struct ctrl_op *op,
+                         const struct op_result *r)
+{
+    fprintf(out, "%s\n    {\n", first ? "" : ",");
+    fprintf(out, "      \"name\": \"%s\",\n", op->name);
+    fprintf(out, "      \"status\": \"%s\",\n",
+            r->status == 0 ? "ok" : bladerf_strerror(r->status));
+    fprintf(out, "      \"calls\": %u,\n", r->calls);
+    fprintf(out, "      \"latency_us\": { \"p50\": %.3f, \"p90\": %.3f, "
+                 "\"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f },\n",
+            r->latency_us[0], r->latency_us[1], r->latency_us[2],
+            r->latency_us[3], r->latency_us[4]);
+    fprintf(out, "      \"requests_per_call\": { \"min\": %llu, "
+                 "\"mean\": %.3f, \"max\": %llu }\n",
+            (unsigned long long) r->requests_min, r->requests_mean,
+            (unsigned long long) r->requests_max);
+    fprintf(out, "    }");
+    fflush(out);
+}
+
+static int run_tests(struct bladerf *dev, const struct app_params *p,
+                     FILE *out)
+{
+    uint64_t *latency_ns;
+    struct op_result r;
+    unsigned int i;
+    unsigned int num_failed = 0;
+    bool first = true;
+
+    latency_ns = calloc(p->iterations, sizeof(latency_ns[0]));
+    if (latency_ns == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    print_header(out, dev, p);
+
+    for (i = 0; i < num_ctrl_ops; i++) {
+        if (!p->selected[i]) {
+            continue;
+        }
+
+        log_info("Running %s...\n", ctrl_ops[i].name);
+
+        run_op(dev, &ctrl_ops[i], p->iterations, latency_ns, &r);
+
+        /* Not every FPGA supports every operation */
+        if (r.status != 0 && r.status != BLADERF_ERR_UNSUPPORTED) {
+            log_error("%s failed: %s\n", ctrl_ops[i].name,
+                      bladerf_strerror(r.status));
+            num_failed++;
+        }
+
+        print_result(out, first, &ctrl_ops[i], &r);
+        first = false;
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    free(latency_ns);
+    return num_failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int status;
+    struct app_params p;
+    struct bladerf *dev = NULL;
+    FILE *out = stdout;
+
+    status = handle_cmdline(argc, argv, &p);
+    if (status != 0) {
+        if (status == 1) {
+            print_usage(argv[0]);
+        }
+
+        free(p.selected);
+        return status < 0 ? EXIT_FAILURE : 0;
+    }
+
+    status = bladerf_open(&dev, p.device_str);
+    if (status != 0) {
+        log_error("Failed to open device: %s\n", bladerf_strerror(status));
+        free(p.selected);
+        return EXIT_FAILURE;
+    }
+
+    status = bladerf_is_fpga_configured(dev);
+    if (status < 0) {
+        log_error("Failed to determine FPGA state: %s\n",
+                  bladerf_strerror(status));
+        goto out;
+    } else if (status == 0) {
+        log_error("FPGA is not loaded.\n");
+        status = -1;
+        goto out;
+    }
+
+    if (p.output != NULL) {
+        out = fopen(p.output, "w");
+        if (out == NULL) {
+            log_error("Failed to open output file - %s\n", strerror(errno));
+            status = -1;
+            goto out;
+        }
+    }
+
+    status = run_tests(dev, &p, out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+out:
+    bladerf_close(dev);
+    free(p.selected);
+    return status == 0 ? 0 : EXIT_FAILURE;
+}
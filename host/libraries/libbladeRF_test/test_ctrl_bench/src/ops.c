@@ -0,0 +1,410 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Each operation below performs a single libbladeRF control call. Setters
+ * alternate between valid values, so that every call has an effect. Expansion
+ * GPIO and trigger writes restore the values read during setup, so that they
+ * do not disturb anything connected to the device. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libbladeRF.h>
+
+#include "ctrl_bench.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static const unsigned int freqs[] = {
+    915000000, 2400000000u, 433000000, 1575420000
+};
+
+static const unsigned int samplerates[] = { 2000000, 4000000, 10000000 };
+
+static const unsigned int bandwidths[] = { 1500000, 5000000, 28000000 };
+
+static uint32_t xb_gpio;
+static uint32_t xb_gpio_dir;
+static uint8_t trigger_reg;
+static struct bladerf_trigger trigger;
+
+/* Registers */
+
+static int lms_read(struct bladerf *dev, unsigned int i)
+{
+    uint8_t val;
+    return bladerf_lms_read(dev, 0x04, &val);
+}
+
+/* As in test_peripheral_timing, register writes target read-only
+ * registers, so they have no effect on the device */
+static int lms_write(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_lms_write(dev, 0x04, 0xaa);
+}
+
+static int si5338_read(struct bladerf *dev, unsigned int i)
+{
+    uint8_t val;
+    return bladerf_si5338_read(dev, 0x00, &val);
+}
+
+static int si5338_write(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_si5338_write(dev, 0x00, 0xaa);
+}
+
+static int config_gpio_read(struct bladerf *dev, unsigned int i)
+{
+    uint32_t val;
+    return bladerf_config_gpio_read(dev, &val);
+}
+
+/* Frequency */
+
+static int setup_host_tuning(struct bladerf *dev)
+{
+    return bladerf_set_tuning_mode(dev, BLADERF_TUNING_MODE_HOST);
+}
+
+static int setup_fpga_tuning(struct bladerf *dev)
+{
+    return bladerf_set_tuning_mode(dev, BLADERF_TUNING_MODE_FPGA);
+}
+
+static int set_frequency(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_frequency(dev, BLADERF_MODULE_RX,
+                                 freqs[i % ARRAY_SIZE(freqs)]);
+}
+
+static int get_frequency(struct bladerf *dev, unsigned int i)
+{
+    unsigned int freq;
+    return bladerf_get_frequency(dev, BLADERF_MODULE_RX, &freq);
+}
+
+/* Gain */
+
+static int set_lna_gain(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_lna_gain(dev, (i & 1) ? BLADERF_LNA_GAIN_MID :
+                                               BLADERF_LNA_GAIN_MAX);
+}
+
+static int get_lna_gain(struct bladerf *dev, unsigned int i)
+{
+    bladerf_lna_gain gain;
+    return bladerf_get_lna_gain(dev, &gain);
+}
+
+static int set_rxvga1(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_rxvga1(dev, (i & 1) ? BLADERF_RXVGA1_GAIN_MIN :
+                                             BLADERF_RXVGA1_GAIN_MAX);
+}
+
+static int get_rxvga1(struct bladerf *dev, unsigned int i)
+{
+    int gain;
+    return bladerf_get_rxvga1(dev, &gain);
+}
+
+static int set_rxvga2(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_rxvga2(dev, (i & 1) ? BLADERF_RXVGA2_GAIN_MIN :
+                                             BLADERF_RXVGA2_GAIN_MAX);
+}
+
+static int get_rxvga2(struct bladerf *dev, unsigned int i)
+{
+    int gain;
+    return bladerf_get_rxvga2(dev, &gain);
+}
+
+static int set_txvga1(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_txvga1(dev, (i & 1) ? BLADERF_TXVGA1_GAIN_MIN :
+                                             BLADERF_TXVGA1_GAIN_MAX);
+}
+
+static int get_txvga1(struct bladerf *dev, unsigned int i)
+{
+    int gain;
+    return bladerf_get_txvga1(dev, &gain);
+}
+
+static int set_txvga2(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_txvga2(dev, (i & 1) ? BLADERF_TXVGA2_GAIN_MIN :
+                                             BLADERF_TXVGA2_GAIN_MAX);
+}
+
+static int get_txvga2(struct bladerf *dev, unsigned int i)
+{
+    int gain;
+    return bladerf_get_txvga2(dev, &gain);
+}
+
+static int set_gain(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_gain(dev, BLADERF_MODULE_RX, (i & 1) ? 10 : 40);
+}
+
+/* Sample rate, bandwidth, and LPF */
+
+static int set_sample_rate(struct bladerf *dev, unsigned int i)
+{
+    unsigned int actual;
+    return bladerf_set_sample_rate(dev, BLADERF_MODULE_RX,
+                                   samplerates[i % ARRAY_SIZE(samplerates)],
+                                   &actual);
+}
+
+static int get_sample_rate(struct bladerf *dev, unsigned int i)
+{
+    unsigned int rate;
+    return bladerf_get_sample_rate(dev, BLADERF_MODULE_RX, &rate);
+}
+
+static int set_bandwidth(struct bladerf *dev, unsigned int i)
+{
+    unsigned int actual;
+    return bladerf_set_bandwidth(dev, BLADERF_MODULE_RX,
+                                 bandwidths[i % ARRAY_SIZE(bandwidths)],
+                                 &actual);
+}
+
+static int get_bandwidth(struct bladerf *dev, unsigned int i)
+{
+    unsigned int bw;
+    return bladerf_get_bandwidth(dev, BLADERF_MODULE_RX, &bw);
+}
+
+static int set_lpf_mode(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_lpf_mode(dev, BLADERF_MODULE_RX,
+                                (i & 1) ? BLADERF_LPF_NORMAL :
+                                          BLADERF_LPF_BYPASSED);
+}
+
+static int get_lpf_mode(struct bladerf *dev, unsigned int i)
+{
+    bladerf_lpf_mode mode;
+    return bladerf_get_lpf_mode(dev, BLADERF_MODULE_RX, &mode);
+}
+
+/* IQ corrections */
+
+static int set_corr_dc(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_LMS_DCOFF_I,
+                                  (i & 1) ? 128 : 0);
+}
+
+static int get_corr_dc(struct bladerf *dev, unsigned int i)
+{
+    int16_t val;
+    return bladerf_get_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_LMS_DCOFF_I, &val);
+}
+
+static int set_corr_phase(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_FPGA_PHASE,
+                                  (i & 1) ? 256 : 0);
+}
+
+static int get_corr_phase(struct bladerf *dev, unsigned int i)
+{
+    int16_t val;
+    return bladerf_get_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_FPGA_PHASE, &val);
+}
+
+static int set_corr_gain(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_set_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_FPGA_GAIN,
+                                  (i & 1) ? 256 : 0);
+}
+
+static int get_corr_gain(struct bladerf *dev, unsigned int i)
+{
+    int16_t val;
+    return bladerf_get_correction(dev, BLADERF_MODULE_RX,
+                                  BLADERF_CORR_FPGA_GAIN, &val);
+}
+
+/* Timestamps */
+
+static int get_timestamp_rx(struct bladerf *dev, unsigned int i)
+{
+    uint64_t ts;
+    return bladerf_get_timestamp(dev, BLADERF_MODULE_RX, &ts);
+}
+
+static int get_timestamp_tx(struct bladerf *dev, unsigned int i)
+{
+    uint64_t ts;
+    return bladerf_get_timestamp(dev, BLADERF_MODULE_TX, &ts);
+}
+
+/* Triggers */
+
+static int setup_trigger(struct bladerf *dev)
+{
+    int status;
+
+    status = bladerf_trigger_init(dev, BLADERF_MODULE_RX,
+                                  BLADERF_TRIGGER_J71_4, &trigger);
+    if (status != 0) {
+        return status;
+    }
+
+    return bladerf_read_trigger(dev, BLADERF_MODULE_RX,
+                                BLADERF_TRIGGER_J71_4, &trigger_reg);
+}
+
+static int read_trigger(struct bladerf *dev, unsigned int i)
+{
+    uint8_t val;
+    return bladerf_read_trigger(dev, BLADERF_MODULE_RX,
+                                BLADERF_TRIGGER_J71_4, &val);
+}
+
+static int write_trigger(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_write_trigger(dev, BLADERF_MODULE_RX,
+                                 BLADERF_TRIGGER_J71_4, trigger_reg);
+}
+
+static int trigger_state(struct bladerf *dev, unsigned int i)
+{
+    bool armed, fired, fire_req;
+    uint64_t resv1, resv2;
+
+    return bladerf_trigger_state(dev, &trigger, &armed, &fired, &fire_req,
+                                 &resv1, &resv2);
+}
+
+/* Expansion GPIO */
+
+static int setup_xb_gpio(struct bladerf *dev)
+{
+    int status;
+
+    status = bladerf_expansion_gpio_read(dev, &xb_gpio);
+    if (status != 0) {
+        return status;
+    }
+
+    return bladerf_expansion_gpio_dir_read(dev, &xb_gpio_dir);
+}
+
+static int xb_gpio_read(struct bladerf *dev, unsigned int i)
+{
+    uint32_t val;
+    return bladerf_expansion_gpio_read(dev, &val);
+}
+
+static int xb_gpio_write(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_expansion_gpio_write(dev, xb_gpio);
+}
+
+static int xb_gpio_masked_write(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_expansion_gpio_masked_write(dev, 0xffffffff, xb_gpio);
+}
+
+static int xb_gpio_dir_read(struct bladerf *dev, unsigned int i)
+{
+    uint32_t val;
+    return bladerf_expansion_gpio_dir_read(dev, &val);
+}
+
+static int xb_gpio_dir_write(struct bladerf *dev, unsigned int i)
+{
+    return bladerf_expansion_gpio_dir_write(dev, xb_gpio_dir);
+}
+
+#define OP(name_)               { #name_, NULL, name_ }
+#define OP_SETUP(name_, setup_) { #name_, setup_, name_ }
+
+const struct ctrl_op ctrl_ops[] = {
+    OP(lms_read),
+    OP(lms_write),
+    OP(si5338_read),
+    OP(si5338_write),
+    OP(config_gpio_read),
+
+    { "set_frequency_host", setup_host_tuning, set_frequency },
+    { "get_frequency_host", setup_host_tuning, get_frequency },
+    { "set_frequency_fpga", setup_fpga_tuning, set_frequency },
+    { "get_frequency_fpga", setup_fpga_tuning, get_frequency },
+
+    OP(set_lna_gain),
+    OP(get_lna_gain),
+    OP(set_rxvga1),
+    OP(get_rxvga1),
+    OP(set_rxvga2),
+    OP(get_rxvga2),
+    OP(set_txvga1),
+    OP(get_txvga1),
+    OP(set_txvga2),
+    OP(get_txvga2),
+    OP(set_gain),
+
+    OP(set_sample_rate),
+    OP(get_sample_rate),
+    OP(set_bandwidth),
+    OP(get_bandwidth),
+    OP(set_lpf_mode),
+    OP(get_lpf_mode),
+
+    OP(set_corr_dc),
+    OP(get_corr_dc),
+    OP(set_corr_phase),
+    OP(get_corr_phase),
+    OP(set_corr_gain),
+    OP(get_corr_gain),
+
+    OP(get_timestamp_rx),
+    OP(get_timestamp_tx),
+
+    OP_SETUP(read_trigger, setup_trigger),
+    OP_SETUP(write_trigger, setup_trigger),
+    OP_SETUP(trigger_state, setup_trigger),
+
+    OP_SETUP(xb_gpio_read, setup_xb_gpio),
+    OP_SETUP(xb_gpio_write, setup_xb_gpio),
+    OP_SETUP(xb_gpio_masked_write, setup_xb_gpio),
+    OP_SETUP(xb_gpio_dir_read, setup_xb_gpio),
+    OP_SETUP(xb_gpio_dir_write, setup_xb_gpio),
+};
+
+const unsigned int num_ctrl_ops = ARRAY_SIZE(ctrl_ops);
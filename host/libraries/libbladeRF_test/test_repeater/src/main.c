@@ -30,16 +30,20 @@
 #include "conversions.h"    /* Conversion routines from host/common */
 #include "repeater.h"
 
-#define OPTARG_STR "d:s:t:r:S:b:B:T:v:h"
+#define OPTARG_STR "d:s:t:r:S:b:B:T:P:l:p:v:h"
 
 static struct option long_options[] = {
     { "device",         required_argument,  0,  'd'},
     { "samplerate",     required_argument,  0,  's'},
     { "tx-freq",        required_argument,  0,  't'},
     { "rx-freq",        required_argument,  0,  'r'},
+    { "bandwidth",      required_argument,  0,  'b'},
     { "num-samples",    required_argument,  0,  'S'},
     { "num-buffers",    required_argument,  0,  'B'},
     { "num-transfers",  required_argument,  0,  'T'},
+    { "prefill",        required_argument,  0,  'P'},
+    { "latency",        required_argument,  0,  'l'},
+    { "process",        required_argument,  0,  'p'},
     { "verbosity",      required_argument,  0,  'v'},
     { "help",           no_argument,        0,  'h'},
     { 0,                0,                  0,  0},
@@ -57,6 +61,31 @@ static const struct numeric_suffix FREQ_SUFFIXES[] = {
 static const int NUM_FREQ_SUFFIXES =
         sizeof(FREQ_SUFFIXES) / sizeof(struct numeric_suffix);
 
+/* Negate samples, shifting their phase by 180 degrees */
+static void process_invert(int16_t *samples, unsigned int num_samples,
+                           void *arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < 2 * num_samples; i++) {
+        samples[i] = -samples[i];
+    }
+}
+
+/* Swap I and Q, mirroring the spectrum about the center frequency */
+static void process_swap_iq(int16_t *samples, unsigned int num_samples,
+                            void *arg)
+{
+    unsigned int i;
+    int16_t tmp;
+
+    for (i = 0; i < 2 * num_samples; i += 2) {
+        tmp = samples[i];
+        samples[i] = samples[i + 1];
+        samples[i + 1] = tmp;
+    }
+}
+
 static void usage(const char *argv0)
 {
     printf("Simple full duplex repeater test\n\n");
@@ -84,10 +113,27 @@ static void usage(const char *argv0)
                                         DEFAULT_NUM_BUFFERS);
 
     printf("  -T, --num-transfers <n>   Number of transfers to use. Default is %d.\n"
-           "                            This value should be *at least* 2 less than the\n"
-           "                            number of buffers being used.\n\n",
+           "                            The number of buffers must exceed the sum of\n"
+           "                            this value and the prefill count.\n\n",
                                         DEFAULT_NUM_TRANSFERS);
 
+    printf("  -P, --prefill <n>         Number of buffers to receive before starting\n"
+           "                            TX. Without timestamps, this sets how far TX\n"
+           "                            runs behind RX. Default is the number of\n"
+           "                            transfers, or 1 when a latency is specified.\n\n");
+
+    printf("  -l, --latency <ms>        Retransmit each sample the specified number\n"
+           "                            of milliseconds after it was received, using\n"
+           "                            timestamped (metadata) streams. Buffers that\n"
+           "                            cannot make it in time are dropped, and the\n"
+           "                            time taken to forward buffers is reported.\n\n");
+
+    printf("  -p, --process <hook>      Processing applied to samples before they are\n"
+           "                            retransmitted:\n"
+           "                              none    No processing (default)\n"
+           "                              invert  Shift phase by 180 degrees\n"
+           "                              swapiq  Swap I and Q, mirroring the spectrum\n\n");
+
     printf("  -v, --verbosity <level>   Set libbladeRF verbosity level.\n\n");
 
     printf("  -h, --help                Show this text\n\n");
@@ -97,6 +143,7 @@ static int handle_args(int argc, char *argv[], struct repeater_config *config)
 {
     int opt, opt_idx;
     bool conv_ok;
+    double latency_ms;
 
     repeater_config_init(config);
 
@@ -190,6 +237,38 @@ static int handle_args(int argc, char *argv[], struct repeater_config *config)
                 }
                 break;
 
+            case 'P':
+                config->prefill = str2int(optarg, 1, INT_MAX, &conv_ok);
+                if (!conv_ok) {
+                    fprintf(stderr, "\nError: Invalid prefill count: %s\n\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+
+            case 'l':
+                latency_ms = str2double(optarg, 0.001, 60000.0, &conv_ok);
+                if (!conv_ok) {
+                    fprintf(stderr, "\nError: Invalid latency: %s\n\n",
+                            optarg);
+                    return -1;
+                }
+                config->latency_us = (unsigned int) (latency_ms * 1000.0 + 0.5);
+                break;
+
+            case 'p':
+                if (!strcasecmp(optarg, "none")) {
+                    config->process = NULL;
+                } else if (!strcasecmp(optarg, "invert")) {
+                    config->process = process_invert;
+                } else if (!strcasecmp(optarg, "swapiq")) {
+                    config->process = process_swap_iq;
+                } else {
+                    fprintf(stderr, "Unknown processing hook: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
             case 'v':
                 if (!strcasecmp(optarg, "critical")) {
                     config->verbosity = BLADERF_LOG_LEVEL_CRITICAL;
@@ -226,11 +305,13 @@ static int handle_args(int argc, char *argv[], struct repeater_config *config)
         return -1;
     }
 
-    if (config->num_buffers < (config->num_transfers + 2)) {
+    if (config->num_buffers <=
+            (config->num_transfers + repeater_prefill(config))) {
         fprintf(stderr, "\nError: "
-                "# buffers (%u) must be at least 2 greater than "
-                "# transfers (%u)\n\n", config->num_buffers,
-                config->num_transfers);
+                "# buffers (%u) must be greater than the sum of "
+                "# transfers (%u) and the prefill count (%u)\n\n",
+                config->num_buffers, config->num_transfers,
+                repeater_prefill(config));
         return -1;
     }
 
@@ -23,49 +23,78 @@
  * This file implements the guts of the simple full-duplex repeater.
  *
  * We run two threads to block on bladerf_stream() calls and handle
- * callbacks, while the "main" thread waits for user input to shut down.
+ * callbacks, along with a TX task that feeds the TX stream, while the "main"
+ * thread waits for user input to shut down.
  *
- * When starting a TX stream, an initial set of callbacks are immediately fired
- * off to fill the initial set of transfers. Before starting the TX stream, we
- * first wait to start the RX stream has filled enough buffers to account for
- * the initial set of TX transfers. This is referred to as the "prefill count"
- * in this code.
+ * Received samples are never copied; the buffers the RX stream receives into
+ * are handed to the TX stream as-is. All sample buffers belong to the RX
+ * stream, and those not currently in flight are held in one of two queues:
  *
- * We set the prefill count halfway between the total number of buffers and
- * transfers:
+ *   free:      Buffers available for the RX stream to receive into
+ *   filled:    Received buffers awaiting TX, in the order they were received
+ *
+ * The RX callback runs the optional processing hook on each received buffer,
+ * queues it as filled, and returns a free buffer to receive into next. The TX
+ * task submits filled buffers to the TX stream via
+ * bladerf_submit_stream_buffer() as soon as they become available, rather than
+ * waiting for a TX callback to ask for them. The TX callback therefore only
+ * returns transmitted buffers to the free queue, and always returns
+ * BLADERF_STREAM_NO_DATA.
+ *
+ * Before starting the TX stream, the TX task waits for the RX stream to fill
+ * a number of buffers. This is referred to as the "prefill count" in this
+ * code. Without timestamps, this buffering is what the transmitter runs
+ * behind the receiver by, so it sets both the latency and the tolerance to
+ * scheduling hiccups. It defaults to the number of transfers, and may be
+ * lowered to as little as a single buffer.
+ *
+ * Up to the number of transfers may be in flight for each stream, so the
+ * number of buffers must exceed the sum of the number of transfers and the
+ * prefill count:
  *
  *                           +---------+  <-- # buffers (32)
  *                           |         |
- *                           +---------+  <-- prefill count (24)
+ *                           +---------+  <-- # transfers + prefill count (16)
  *                           |         |
- *                           +---------+  <-- # transfers (16)
+ *                           +---------+  <-- # transfers (8)
  *                           |         |
  *                           |         |
  *                           +---------+  0
  *
+ * When a latency is specified, the streams use the SC16 Q11 metadata format
+ * instead. Each message in a received buffer carries the timestamp of its
+ * first sample, which the TX task rewrites to schedule the message for
+ * transmission the requested latency later. The RX and TX timestamp counters
+ * are independent, so the offset between them is measured once the RX stream
+ * is running. The RX to TX latency is then exact, provided that each buffer
+ * reaches the device in time; buffers that are already due by the time they
+ * are submitted are dropped and counted as late. The TX stream is started
+ * after a single buffer has been received by default, as further prefilling
+ * only delays its first messages.
  *
+ * The timestamps are also used to measure how long after their first sample
+ * was received buffers are submitted for TX, and the margin this leaves to
+ * their TX timestamp. These are reported via the statistics hotkey and upon
+ * exiting, separately for forwarded and late buffers, and indicate how low
+ * the latency may be set.
  *
- * Although we designate each thread "RX" or "TX", note that these threads
- * may receive callbacks for the other module. Therefore, the callbacks
- * cannot block [1] and must be implemented in a thread-safe manner;
- * accesses to buffer management data are locked via a mutex.
- *
- * [1] If a TX callback were to block to wait for RX buffers to
- *     fill more, deadlock could occur because two TX callbacks could be fired
- *     off before an RX callback is exectuted to release the TX callbacks.
+ * Callbacks for one module may occur in the context of the other module's
+ * thread, so accesses to buffer management data are locked via a mutex. This
+ * lock is held only briefly, and never while calling into libbladeRF.
  *
- *
- * Overruns and underruns are not handled intelligently in this simple test.
- * If either occur (they shouldn't), the associated tasks shut down and wait
- * for the user to terminate the program.
+ * Overruns are not handled intelligently in this simple test. If the RX
+ * stream runs out of free buffers, the RX task shuts down and waits for the
+ * user to terminate the program.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <pthread.h>
 #include <libbladeRF.h>
 #include "rel_assert.h"
+#include "host_config.h"
 
 #include "repeater.h"
 #include "minmax.h"
@@ -111,7 +140,7 @@ static int term_init()
         return status;
     }
 
-    memcpy(&termios_new, &termios_backup, sizeof(termios_new));
+    memcpy(&termios_new, termios_backup, sizeof(termios_new));
 
     termios_new.c_cc[VMIN] = 1;
     termios_new.c_cc[VTIME] = 0;
@@ -175,30 +204,57 @@ static char get_key()
 #define KEY_INC_RXVGA2      '8'
 #define KEY_DEC_LNAGAIN     '9'
 #define KEY_INC_LNAGAIN     '0'
+#define KEY_STATS           's'
 #define KEY_QUIT            'q'
 #define KEY_HELP            'h'
 
+/* Metadata messages, as they appear in a SC16 Q11 META stream buffer */
+#define MSG_SIZE_SUPER          2048
+#define MSG_SIZE_HIGH           1024
+#define MSG_HEADER_SIZE         16
+#define MSG_TIMESTAMP_OFFSET    4
 
-struct buf_mgmt
+#define BYTES_PER_SAMPLE        (2 * sizeof(int16_t))
+
+/* Timeout on handing a buffer to the TX stream, after which the TX task
+ * checks whether it should shut down before trying again */
+#define TX_SUBMIT_TIMEOUT_MS    250
+
+/* FIFO of sample buffers */
+struct buf_queue
 {
-    int rx_idx;         /* Next sample buffer to RX into. < 0 indicates stop */
-    int tx_idx;         /* Next sample buffer to TX from. < 0 indicates stop */
-    size_t num_filled;  /* Number of buffers filled with RX data awaiting TX */
+    void **bufs;
+    size_t head;        /* Index of the oldest buffer */
+    size_t count;       /* Number of buffers queued */
+};
 
-    size_t prefill_count;   /* Since the initial set of TX callbacks will look
-                               to fill all available transfers, we must
-                               ensure that the RX task has prefilled a
-                               sufficient number of buffers */
+struct buf_mgmt
+{
+    bool shutdown;          /* Set to stop the RX and TX tasks */
 
-    void **samples;         /* Sample buffers */
+    void **samples;         /* Sample buffers, allocated by the RX stream */
     size_t num_buffers;     /* # of sample buffers */
 
-    /* Used to signal the TX thread when a few samplse have been buffered up */
+    struct buf_queue free;      /* Buffers available to receive into */
+    struct buf_queue filled;    /* Buffers filled with RX data awaiting TX */
+
+    size_t prefill_count;   /* # of buffers to receive before starting TX */
+
+    /* Used to signal the TX task when samples are available */
     pthread_cond_t  samples_available;
 
     pthread_mutex_t lock;
 };
 
+/* Statistics for a duration, in samples */
+struct sample_stats
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+};
+
 struct repeater
 {
     struct bladerf *device;
@@ -213,6 +269,30 @@ struct repeater
 
     struct buf_mgmt buf_mgmt;
 
+    repeater_process_fn process;    /**< Processing hook */
+    void *process_arg;              /**< Processing hook argument */
+
+    bool timestamps;            /**< Streams use the SC16 Q11 META format */
+    unsigned int sample_rate;   /**< Sample rate, in Hz */
+    uint64_t latency;           /**< RX to TX latency, in samples */
+    int64_t tx_offset;          /**< TX timestamp counter - RX counter */
+
+    size_t msg_size;            /**< Metadata message size, in bytes */
+    size_t msg_samples;         /**< Samples per message */
+    size_t msgs_per_buffer;     /**< Messages per buffer */
+
+    bool rx_started;            /**< A buffer has been received */
+    uint64_t rx_next;           /**< Expected timestamp of the next buffer */
+
+    /* The following are protected by buf_mgmt.lock */
+    uint64_t rx_frontier;       /**< Timestamp following the last sample
+                                     received */
+    uint64_t discontinuities;   /**< Gaps in the received timestamps */
+    uint64_t forwarded;         /**< Buffers submitted for TX */
+    struct sample_stats age;    /**< Time from receiving forwarded buffers'
+                                     first sample to submitting them for TX */
+    struct sample_stats late;   /**< Age of buffers dropped for being late */
+
     int gain_txvga1;            /**< TX VGA1 gain */
     int gain_txvga2;            /**< TX VGA2 gain */
     int gain_rxvga1;            /**< RX VGA1 gain */
@@ -232,6 +312,12 @@ void repeater_config_init(struct repeater_config *c)
     c->num_buffers = DEFAULT_NUM_BUFFERS;
     c->num_transfers = DEFAULT_NUM_TRANSFERS;
     c->samples_per_buffer = DEFAULT_SAMPLES_PER_BUFFER;
+    c->prefill = 0;
+
+    c->latency_us = 0;
+
+    c->process = NULL;
+    c->process_arg = NULL;
 
     c->verbosity = BLADERF_LOG_LEVEL_INFO;
 }
@@ -242,6 +328,65 @@ void repeater_config_deinit(struct repeater_config *c)
     c->device_str = NULL;
 }
 
+int repeater_prefill(const struct repeater_config *c)
+{
+    if (c->prefill != 0) {
+        return c->prefill;
+    } else if (c->latency_us != 0) {
+        return 1;
+    } else {
+        return c->num_transfers;
+    }
+}
+
+static inline void queue_push(struct buf_queue *q, size_t size, void *buf)
+{
+    assert(q->count < size);
+    q->bufs[(q->head + q->count) % size] = buf;
+    q->count++;
+}
+
+static inline void *queue_pop(struct buf_queue *q, size_t size)
+{
+    void *buf;
+
+    assert(q->count != 0);
+    buf = q->bufs[q->head];
+    q->head = (q->head + 1) % size;
+    q->count--;
+
+    return buf;
+}
+
+static void stats_update(struct sample_stats *s, uint64_t value)
+{
+    if (s->count == 0 || value < s->min) {
+        s->min = value;
+    }
+
+    if (s->count == 0 || value > s->max) {
+        s->max = value;
+    }
+
+    s->total += value;
+    s->count++;
+}
+
+static inline uint64_t msg_get_timestamp(const uint8_t *msg)
+{
+    uint64_t timestamp;
+    memcpy(&timestamp, msg + MSG_TIMESTAMP_OFFSET, sizeof(timestamp));
+    return LE64_TO_HOST(timestamp);
+}
+
+/* Fill in a TX message header, clearing the flags */
+static inline void msg_set_header(uint8_t *msg, uint64_t timestamp)
+{
+    memset(msg, 0, MSG_HEADER_SIZE);
+    timestamp = HOST_TO_LE64(timestamp);
+    memcpy(msg + MSG_TIMESTAMP_OFFSET, &timestamp, sizeof(timestamp));
+}
+
 static void *tx_stream_callback(struct bladerf *dev,
                                 struct bladerf_stream *stream,
                                 struct bladerf_metadata *meta,
@@ -249,77 +394,242 @@ static void *tx_stream_callback(struct bladerf *dev,
                                 size_t num_samples,
                                 void *user_data)
 {
-    void *ret;
+    void *ret = BLADERF_STREAM_NO_DATA;
     struct repeater *repeater = (struct repeater *)user_data;
 
     pthread_mutex_lock(&repeater->buf_mgmt.lock);
 
-    if (repeater->buf_mgmt.tx_idx < 0) {
-        ret = NULL;
-    } else {
+    /* The TX task submits buffers, so we just need to reclaim buffers that
+     * have been transmitted. No buffer is provided when the stream starts. */
+    if (samples != NULL) {
+        queue_push(&repeater->buf_mgmt.free, repeater->buf_mgmt.num_buffers,
+                   samples);
+    }
 
-        /* We shouldn't encounter underruns, but for the sake of simplicity
-         * in this test/example, we'll just error out if we hit one */
-        if (repeater->buf_mgmt.num_filled == 0) {
-            ret = NULL;
-            print_error(repeater,
-                        "TX underrun encountered. Terminating TX task.\r\n");
-        } else {
+    if (repeater->buf_mgmt.shutdown) {
+        ret = BLADERF_STREAM_SHUTDOWN;
+    }
 
-            ret = repeater->buf_mgmt.samples[repeater->buf_mgmt.tx_idx++];
+    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
 
-            if (repeater->buf_mgmt.tx_idx >= (int)repeater->buf_mgmt.num_buffers) {
-                repeater->buf_mgmt.tx_idx = 0;
-            }
+    return ret;
+}
 
-            repeater->buf_mgmt.num_filled--;
-        }
+void * tx_stream_run(void *repeater_)
+{
+    int status;
+    struct repeater *repeater = (struct repeater *)repeater_;
+
+    status = bladerf_stream(repeater->tx_stream, BLADERF_MODULE_TX);
+    if (status < 0) {
+        print_error(repeater, "TX stream failure: %s\r\n",
+                    bladerf_strerror(status));
     }
 
-    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
+    return NULL;
+}
+
+/* Measure the offset between the TX and RX timestamp counters. The RX counter
+ * is read before and after the TX counter, to estimate its value at the time
+ * the TX counter was read. */
+static int measure_tx_offset(struct repeater *repeater)
+{
+    int status;
+    uint64_t rx_before, rx_after, tx;
+
+    status = bladerf_get_timestamp(repeater->device, BLADERF_MODULE_RX,
+                                   &rx_before);
+    if (status == 0) {
+        status = bladerf_get_timestamp(repeater->device, BLADERF_MODULE_TX,
+                                       &tx);
+    }
+
+    if (status == 0) {
+        status = bladerf_get_timestamp(repeater->device, BLADERF_MODULE_RX,
+                                       &rx_after);
+    }
+
+    if (status == 0) {
+        repeater->tx_offset =
+            (int64_t) (tx - (rx_before + (rx_after - rx_before) / 2));
+    }
+
+    return status;
+}
+
+static bool shutting_down(struct buf_mgmt *b)
+{
+    bool ret;
+
+    pthread_mutex_lock(&b->lock);
+    ret = b->shutdown;
+    pthread_mutex_unlock(&b->lock);
 
     return ret;
 }
 
+/* Wait for the next received buffer and prepare it for transmission.
+ * Returns NULL when shutting down. */
+static void *next_tx_buffer(struct repeater *repeater)
+{
+    struct buf_mgmt *b = &repeater->buf_mgmt;
+    void *buf = NULL;
+    uint64_t timestamp, age;
+    uint8_t *msg;
+    size_t i;
+
+    pthread_mutex_lock(&b->lock);
+
+    while (buf == NULL && !b->shutdown) {
+        if (b->filled.count == 0) {
+            pthread_cond_wait(&b->samples_available, &b->lock);
+            continue;
+        }
+
+        buf = queue_pop(&b->filled, b->num_buffers);
+
+        if (repeater->timestamps) {
+            /* The receiver has made it at least as far as rx_frontier, so
+             * the buffer is late if its first sample is due by then */
+            timestamp = msg_get_timestamp(buf);
+            age = repeater->rx_frontier - timestamp;
+
+            if (age >= repeater->latency) {
+                queue_push(&b->free, b->num_buffers, buf);
+                stats_update(&repeater->late, age);
+                buf = NULL;
+            } else {
+                stats_update(&repeater->age, age);
+            }
+        }
+    }
+
+    if (buf != NULL) {
+        repeater->forwarded++;
+    }
+
+    pthread_mutex_unlock(&b->lock);
+
+    if (buf != NULL && repeater->timestamps) {
+        msg = buf;
+        for (i = 0; i < repeater->msgs_per_buffer; i++) {
+            timestamp = msg_get_timestamp(msg);
+            timestamp += repeater->tx_offset + repeater->latency;
+            msg_set_header(msg, timestamp);
+            msg += repeater->msg_size;
+        }
+    }
+
+    return buf;
+}
+
 void * tx_task_run(void *repeater_)
 {
     int status;
     struct repeater *repeater = (struct repeater *)repeater_;
+    struct buf_mgmt *b = &repeater->buf_mgmt;
+    pthread_t stream_task;
     bool exit_early = false;
+    void *buf;
 
     /* Wait for RX task to buffer up some samples before we begin
      * consuming them */
-    pthread_mutex_lock(&repeater->buf_mgmt.lock);
-    while(repeater->buf_mgmt.num_filled < repeater->buf_mgmt.prefill_count &&
-          repeater->buf_mgmt.tx_idx >= 0) {
+    pthread_mutex_lock(&b->lock);
+    while (b->filled.count < b->prefill_count && !b->shutdown) {
 
-        status = pthread_cond_wait(&repeater->buf_mgmt.samples_available,
-                          &repeater->buf_mgmt.lock);
+        status = pthread_cond_wait(&b->samples_available, &b->lock);
 
         if (status != 0) {
             print_error(repeater, "TX startup wait failed (%d)\n", status);
             exit_early = true;
+            break;
         }
     }
 
-    exit_early |= repeater->buf_mgmt.tx_idx < 0;
-    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
+    exit_early |= b->shutdown;
+    pthread_mutex_unlock(&b->lock);
 
-    if (!exit_early) {
-        /* Call stream */
-        status = bladerf_stream(repeater->tx_stream, BLADERF_MODULE_TX);
+    if (exit_early) {
+        printf("EARLY EXIT\r\n");
+        return NULL;
+    }
 
-        if (status < 0) {
-            print_error(repeater, "TX stream failure: %s\r\n",
-                    bladerf_strerror(status));
+    if (repeater->timestamps) {
+        status = measure_tx_offset(repeater);
+        if (status != 0) {
+            print_error(repeater, "Failed to read timestamps: %s\r\n",
+                        bladerf_strerror(status));
+            return NULL;
         }
-    } else {
-        printf("EARLY EXIT\r\n");
     }
 
+    status = pthread_create(&stream_task, NULL, tx_stream_run, repeater);
+    if (status != 0) {
+        print_error(repeater, "Failed to start TX stream task.\r\n");
+        return NULL;
+    }
+
+    while ((buf = next_tx_buffer(repeater)) != NULL) {
+        do {
+            status = bladerf_submit_stream_buffer(repeater->tx_stream, buf,
+                                                  TX_SUBMIT_TIMEOUT_MS);
+        } while (status == BLADERF_ERR_TIMEOUT && !shutting_down(b));
+
+        if (status != 0) {
+            if (status != BLADERF_ERR_TIMEOUT) {
+                print_error(repeater, "Failed to submit TX buffer: %s. "
+                            "Terminating TX task.\r\n",
+                            bladerf_strerror(status));
+            }
+            break;
+        }
+    }
+
+    /* Wait for the user to shut down before stopping the TX stream */
+    pthread_mutex_lock(&b->lock);
+    while (!b->shutdown) {
+        pthread_cond_wait(&b->samples_available, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    bladerf_submit_stream_buffer(repeater->tx_stream,
+                                 BLADERF_STREAM_SHUTDOWN, 0);
+
+    pthread_join(stream_task, NULL);
+
     return NULL;
 }
 
+/* Check the timestamps of a received buffer's messages and run the processing
+ * hook on their samples. Returns the number of discontinuities found. */
+static uint64_t rx_process_msgs(struct repeater *repeater, uint8_t *msg)
+{
+    uint64_t discontinuities = 0;
+    uint64_t timestamp;
+    size_t i;
+
+    for (i = 0; i < repeater->msgs_per_buffer; i++) {
+        timestamp = msg_get_timestamp(msg);
+
+        if (repeater->rx_started && timestamp != repeater->rx_next) {
+            discontinuities++;
+        }
+
+        repeater->rx_started = true;
+        repeater->rx_next = timestamp + repeater->msg_samples;
+
+        if (repeater->process) {
+            repeater->process((int16_t *) (msg + MSG_HEADER_SIZE),
+                              (unsigned int) repeater->msg_samples,
+                              repeater->process_arg);
+        }
+
+        msg += repeater->msg_size;
+    }
+
+    return discontinuities;
+}
+
 static void *rx_stream_callback(struct bladerf *dev,
                                 struct bladerf_stream *stream,
                                 struct bladerf_metadata *meta,
@@ -328,33 +638,42 @@ static void *rx_stream_callback(struct bladerf *dev,
                                 void *user_data)
 {
     struct repeater *repeater = (struct repeater *)user_data;
+    struct buf_mgmt *b = &repeater->buf_mgmt;
+    uint64_t discontinuities = 0;
     void *ret;
 
-    pthread_mutex_lock(&repeater->buf_mgmt.lock);
+    /* Until it is queued, we have the buffer to ourselves */
+    if (repeater->timestamps) {
+        discontinuities = rx_process_msgs(repeater, samples);
+    } else if (repeater->process) {
+        repeater->process(samples, (unsigned int) num_samples,
+                          repeater->process_arg);
+    }
 
-    if (repeater->buf_mgmt.rx_idx < 0) {
-        ret = NULL;
+    pthread_mutex_lock(&b->lock);
+
+    if (b->shutdown) {
+        ret = BLADERF_STREAM_SHUTDOWN;
     } else {
-        ret = repeater->buf_mgmt.samples[repeater->buf_mgmt.rx_idx++];
+        queue_push(&b->filled, b->num_buffers, samples);
 
-        /* Wrap back around */
-        if (repeater->buf_mgmt.rx_idx >= (int)repeater->buf_mgmt.num_buffers) {
-            repeater->buf_mgmt.rx_idx = 0;
-        }
+        repeater->rx_frontier = repeater->rx_next;
+        repeater->discontinuities += discontinuities;
 
-        if (repeater->buf_mgmt.num_filled >= 2 * repeater->buf_mgmt.num_buffers) {
+        if (b->free.count == 0) {
             /* We shouldn't encounter overruns, but if we do, we'll just
              * error out of the program, for the sake of simplicity */
-            print_error(repeater,
-                        "RX Overrun encountered. Terminating RX task.\r\n");
-            ret = NULL;
+            print_error(repeater, "RX overrun encountered (no free buffers). "
+                        "Terminating RX task.\r\n");
+            ret = BLADERF_STREAM_SHUTDOWN;
         } else {
-            repeater->buf_mgmt.num_filled++;
+            ret = queue_pop(&b->free, b->num_buffers);
         }
-        pthread_cond_signal(&repeater->buf_mgmt.samples_available);
+
+        pthread_cond_signal(&b->samples_available);
     }
 
-    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
+    pthread_mutex_unlock(&b->lock);
 
     return ret;
 }
@@ -381,18 +700,17 @@ static inline void repeater_init(struct repeater *repeater,
     pthread_mutex_init(&repeater->buf_mgmt.lock, NULL);
     pthread_cond_init(&repeater->buf_mgmt.samples_available, NULL);
 
-    repeater->buf_mgmt.num_filled = 0;
+    repeater->buf_mgmt.shutdown = false;
     repeater->buf_mgmt.num_buffers = config->num_buffers;
-
-    /* We must prefill, at a minimum, 1 + the number of TX transfers,
-     * since the intial set of TX callbacks will look to populate each
-     * transfer. Below, we try to set the prefill count halfway between
-     * the number of buffers and the number of transfers. */
-    repeater->buf_mgmt.prefill_count = config->num_transfers;
-    repeater->buf_mgmt.prefill_count +=
-        (repeater->buf_mgmt.num_buffers - config->num_transfers) / 2;
+    repeater->buf_mgmt.prefill_count = repeater_prefill(config);
 
     assert(repeater->buf_mgmt.prefill_count != 0);
+    assert(repeater->buf_mgmt.num_buffers >
+           config->num_transfers + repeater->buf_mgmt.prefill_count);
+
+    repeater->process = config->process;
+    repeater->process_arg = config->process_arg;
+    repeater->timestamps = config->latency_us != 0;
 
     bladerf_log_set_verbosity(config->verbosity);
 }
@@ -462,6 +780,7 @@ static int init_device(struct repeater *repeater, struct repeater_config *config
         goto init_device_error;
     } else {
         printf("Actual RX sample rate is %d Hz\r\n", actual_value);
+        repeater->sample_rate = actual_value;
     }
 
     status = bladerf_set_frequency(repeater->device,
@@ -561,13 +880,25 @@ static int init_streams(struct repeater *repeater,
                         struct repeater_config *config)
 {
     int status;
+    int i;
+    struct buf_mgmt *b = &repeater->buf_mgmt;
+    const bladerf_format format = repeater->timestamps ?
+                                    BLADERF_FORMAT_SC16_Q11_META :
+                                    BLADERF_FORMAT_SC16_Q11;
+
+    b->free.bufs = calloc(config->num_buffers, sizeof(b->free.bufs[0]));
+    b->filled.bufs = calloc(config->num_buffers, sizeof(b->filled.bufs[0]));
+    if (b->free.bufs == NULL || b->filled.bufs == NULL) {
+        perror("calloc");
+        return BLADERF_ERR_MEM;
+    }
 
     status = bladerf_init_stream(&repeater->rx_stream,
                                  repeater->device,
                                  rx_stream_callback,
-                                 &repeater->buf_mgmt.samples,
+                                 &b->samples,
                                  config->num_buffers,
-                                 BLADERF_FORMAT_SC16_Q11,
+                                 format,
                                  config->samples_per_buffer,
                                  config->num_transfers,
                                  repeater);
@@ -575,17 +906,20 @@ static int init_streams(struct repeater *repeater,
         fprintf(stderr, "Failed to initialize RX stream: %s\r\n",
                 bladerf_strerror(status));
         return status;
-    } else {
-        repeater->buf_mgmt.rx_idx = 0;
     }
 
+    /* The RX stream starts off receiving into the first buffers */
+    for (i = config->num_transfers; i < config->num_buffers; i++) {
+        queue_push(&b->free, b->num_buffers, b->samples[i]);
+    }
 
+    /* The TX stream is fed the RX stream's buffers, so it needs none */
     status = bladerf_init_stream(&repeater->tx_stream,
                                  repeater->device,
                                  tx_stream_callback,
                                  NULL,
                                  config->num_buffers,
-                                 BLADERF_FORMAT_SC16_Q11,
+                                 format,
                                  config->samples_per_buffer,
                                  config->num_transfers,
                                  repeater);
@@ -593,11 +927,46 @@ static int init_streams(struct repeater *repeater,
         fprintf(stderr, "Failed to initialize TX stream: %s\r\n",
                 bladerf_strerror(status));
         return status;
+    }
+
+    return 0;
+}
+
+/* Determine the layout of metadata messages and the latency in samples */
+static int init_timestamps(struct repeater *repeater,
+                           struct repeater_config *config)
+{
+    double buffer_ms;
+
+    if (bladerf_device_speed(repeater->device) == BLADERF_DEVICE_SPEED_HIGH) {
+        repeater->msg_size = MSG_SIZE_HIGH;
     } else {
-        repeater->buf_mgmt.tx_idx = 0;
+        repeater->msg_size = MSG_SIZE_SUPER;
     }
 
-    repeater->buf_mgmt.num_buffers = config->num_buffers;
+    repeater->msg_samples =
+        (repeater->msg_size - MSG_HEADER_SIZE) / BYTES_PER_SAMPLE;
+
+    repeater->msgs_per_buffer =
+        config->samples_per_buffer * BYTES_PER_SAMPLE / repeater->msg_size;
+
+    repeater->latency = (uint64_t) config->latency_us *
+                        repeater->sample_rate / 1000000;
+
+    /* A buffer cannot be forwarded before all of it has been received */
+    buffer_ms = 1000.0 * repeater->msgs_per_buffer * repeater->msg_samples /
+                repeater->sample_rate;
+
+    if (repeater->latency <=
+        repeater->msgs_per_buffer * repeater->msg_samples) {
+        fprintf(stderr, "Latency (%.3f ms) must exceed the duration of a "
+                "buffer (%.3f ms).\r\n", config->latency_us / 1000.0,
+                buffer_ms);
+        return BLADERF_ERR_INVAL;
+    }
+
+    printf("RX to TX latency is %.3f ms (%"PRIu64" samples)\r\n",
+           config->latency_us / 1000.0, repeater->latency);
 
     return 0;
 }
@@ -607,12 +976,12 @@ static int start_tasks(struct repeater *repeater)
     int status;
 
     status = pthread_create(&repeater->rx_task, NULL, rx_task_run, repeater);
-    if (status < 0) {
+    if (status != 0) {
         return -1;
     }
 
     status = pthread_create(&repeater->tx_task, NULL, tx_task_run, repeater);
-    if (status < 0) {
+    if (status != 0) {
         pthread_cancel(repeater->rx_task);
         pthread_join(repeater->rx_task, NULL);
         return -1;
@@ -623,20 +992,17 @@ static int start_tasks(struct repeater *repeater)
 
 static void stop_tasks(struct repeater *repeater)
 {
-    print_error(repeater, "Stoppping RX and tasks...\r\n");
-    pthread_mutex_lock(&repeater->buf_mgmt.lock);
-    repeater->buf_mgmt.tx_idx = -1;
-    repeater->buf_mgmt.rx_idx = -1;
-    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
-    pthread_join(repeater->rx_task, NULL);
+    print_error(repeater, "Stoppping RX and TX tasks...\r\n");
 
-    /* Fire off the "samples available" signal to the TX thread, in case
-     * it is still awaiting for the prefill completion */
+    /* Fire off the "samples available" signal to the TX task, in case
+     * it is waiting for buffers */
     pthread_mutex_lock(&repeater->buf_mgmt.lock);
+    repeater->buf_mgmt.shutdown = true;
     pthread_cond_signal(&repeater->buf_mgmt.samples_available);
     pthread_mutex_unlock(&repeater->buf_mgmt.lock);
-    pthread_join(repeater->tx_task, NULL);
 
+    pthread_join(repeater->rx_task, NULL);
+    pthread_join(repeater->tx_task, NULL);
 }
 
 static void deinit(struct repeater *repeater)
@@ -657,6 +1023,9 @@ static void deinit(struct repeater *repeater)
         bladerf_close(repeater->device);
         repeater->device = NULL;
     }
+
+    free(repeater->buf_mgmt.free.bufs);
+    free(repeater->buf_mgmt.filled.bufs);
 }
 
 static int init(struct repeater *repeater, struct repeater_config *config)
@@ -672,6 +1041,13 @@ static int init(struct repeater *repeater, struct repeater_config *config)
         return -1;
     }
 
+    if (repeater->timestamps) {
+        status = init_timestamps(repeater, config);
+        if (status < 0) {
+            return -1;
+        }
+    }
+
     /* Allocate streams */
     status = init_streams(repeater, config);
     if (status < 0) {
@@ -701,10 +1077,73 @@ static void repeater_help()
     printf("LNA Gain: Decrement = %c, Increment = %c\r\n",
             KEY_DEC_LNAGAIN, KEY_INC_LNAGAIN);
 
+    printf("Statistics: %c\r\n", KEY_STATS);
     printf("Quit: q\r\n");
     printf("Hotkey list: h\r\n\r\n");
 }
 
+static inline double samples2ms(struct repeater *repeater, double samples)
+{
+    return 1000.0 * samples / repeater->sample_rate;
+}
+
+static void repeater_stats(struct repeater *repeater)
+{
+    uint64_t forwarded, discontinuities;
+    struct sample_stats age, late;
+
+    pthread_mutex_lock(&repeater->buf_mgmt.lock);
+    forwarded = repeater->forwarded;
+    late = repeater->late;
+    discontinuities = repeater->discontinuities;
+    age = repeater->age;
+    pthread_mutex_unlock(&repeater->buf_mgmt.lock);
+
+    printf("\r\nStatistics\r\n");
+    printf("------------------------------------------------\r\n");
+    printf("Buffers forwarded: %"PRIu64"\r\n", forwarded);
+
+    if (!repeater->timestamps) {
+        printf("\r\n");
+        return;
+    }
+
+    printf("Late buffers (dropped): %"PRIu64"\r\n", late.count);
+    printf("RX discontinuities: %"PRIu64"\r\n", discontinuities);
+    printf("Configured RX to TX latency: %.3f ms\r\n",
+           samples2ms(repeater, (double) repeater->latency));
+
+    /* Age is measured from a buffer's first sample to the last sample
+     * received at the time it was submitted for TX. The margin is what
+     * remained of the latency at that time. */
+    if (age.count != 0) {
+        printf("Age of forwarded buffers: "
+               "min %.3f ms, avg %.3f ms, max %.3f ms\r\n",
+               samples2ms(repeater, (double) age.min),
+               samples2ms(repeater, (double) age.total / age.count),
+               samples2ms(repeater, (double) age.max));
+
+        printf("Margin to TX timestamp: "
+               "min %.3f ms, avg %.3f ms, max %.3f ms\r\n",
+               samples2ms(repeater,
+                          (double) repeater->latency - (double) age.max),
+               samples2ms(repeater, (double) repeater->latency -
+                                    (double) age.total / age.count),
+               samples2ms(repeater,
+                          (double) repeater->latency - (double) age.min));
+    }
+
+    if (late.count != 0) {
+        printf("Age of late buffers: "
+               "min %.3f ms, avg %.3f ms, max %.3f ms\r\n",
+               samples2ms(repeater, (double) late.min),
+               samples2ms(repeater, (double) late.total / late.count),
+               samples2ms(repeater, (double) late.max));
+    }
+
+    printf("\r\n");
+}
+
 static const char *lnagain2str(bladerf_lna_gain gain)
 {
     switch (gain) {
@@ -887,6 +1326,10 @@ static int repeater_handle_key(struct repeater *repeater, char key)
             }
             break;
 
+        case KEY_STATS:
+            repeater_stats(repeater);
+            break;
+
         case KEY_HELP:
             repeater_help();
             break;
@@ -927,8 +1370,10 @@ int repeater_run(struct repeater_config *config)
         /* Stop tasks */
         stop_tasks(&repeater);
 
-        deinit(&repeater);
+        repeater_stats(&repeater);
     }
 
+    deinit(&repeater);
+
     return term_deinit();
 }
@@ -22,12 +22,26 @@
 #define REPEATER_H__
 
 #define DEFAULT_NUM_BUFFERS         32
-#define DEFAULT_NUM_TRANSFERS       16
+#define DEFAULT_NUM_TRANSFERS       8
 #define DEFAULT_SAMPLES_PER_BUFFER  8192
 #define DEFAULT_SAMPLE_RATE         1000000
 #define DEFAULT_FREQUENCY           1000000000
 #define DEFAULT_BANDWIDTH           DEFAULT_SAMPLE_RATE
 
+/**
+ * Sample processing hook
+ *
+ * This is called from the RX stream callback with each block of received
+ * samples, before the block is queued for transmission. Samples are processed
+ * in place. As this runs in a stream callback, it must not block.
+ *
+ * @param   samples     SC16Q11 samples, as interleaved I and Q values
+ * @param   num_samples Number of samples
+ * @param   arg         User-provided argument
+ */
+typedef void (*repeater_process_fn)(int16_t *samples, unsigned int num_samples,
+                                    void *arg);
+
 /**
  * Application configuration
  */
@@ -43,7 +57,15 @@ struct repeater_config
     int num_buffers;            /**< Number of buffers to allocate and use */
     int num_transfers;          /**< Number of transfers to allocate and use */
     int samples_per_buffer;     /**< Number of SC16Q11 samples per buffer */
+    int prefill;                /**< Number of buffers to receive before
+                                     starting TX. 0 selects a default. */
+
+    unsigned int latency_us;    /**< RX to TX latency, in microseconds. When
+                                     non-zero, samples are forwarded using
+                                     timestamped (metadata) streams. */
 
+    repeater_process_fn process;    /**< Optional processing hook */
+    void *process_arg;              /**< Argument passed to process() */
 
     bladerf_log_level verbosity;    /** Library verbosity */
 };
@@ -62,6 +84,18 @@ void repeater_config_init(struct repeater_config *c);
  */
 void repeater_config_deinit(struct repeater_config *c);
 
+/**
+ * Get the number of buffers that will be received before TX is started
+ *
+ * This is the configured prefill count, or if none was specified, the
+ * number of transfers (or 1, when a latency has been specified).
+ *
+ * @param   c   Repeater configuration
+ *
+ * @return  Prefill count
+ */
+int repeater_prefill(const struct repeater_config *c);
+
 /**
  * Kick off repeater test
  *
@@ -0,0 +1,465 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libbladeRF.h>
+
+#include "host_config.h"
+#include "conversions.h"
+#include "log.h"
+#include "test_common.h"
+#include "bench.h"
+
+/* Metadata messages, as they appear in a SC16 Q11 META stream buffer */
+#define MSG_SIZE_SUPER          2048
+#define MSG_SIZE_HIGH           1024
+#define MSG_HEADER_SIZE         16
+#define MSG_TIMESTAMP_OFFSET    4
+
+#define BYTES_PER_SAMPLE        (2 * sizeof(int16_t))
+
+struct bench_state {
+    const struct bench_params *p;
+    const struct bench_case *c;
+    struct bench_result *r;
+
+    uint64_t *latency_ns;       /* Recorded call latencies */
+    size_t num_latencies;
+
+    size_t msg_size;            /* Metadata message size, in bytes */
+    size_t payload;             /* Samples carried by a buffer */
+
+    bool started;               /* The first buffer has been transferred */
+    bool done;
+    uint64_t start_ns;
+    uint64_t last_ns;
+    double cpu_start;
+    double cpu_end;
+
+    bool have_timestamp;
+    uint64_t next_timestamp;    /* Expected timestamp of the next RX sample */
+
+    /* Async streams */
+    void **buffers;
+    unsigned int idx;           /* Next stream buffer to hand to libbladeRF */
+    void *app_buf;              /* Application buffer the async API copies */
+};
+
+const char *bench_api2str(enum bench_api api)
+{
+    switch (api) {
+        case BENCH_API_SYNC:
+            return "sync";
+
+        case BENCH_API_ASYNC:
+            return "async";
+
+        case BENCH_API_ZEROCOPY:
+            return "zerocopy";
+
+        default:
+            return "unknown";
+    }
+}
+
+const char *bench_format2str(bladerf_format format)
+{
+    switch (format) {
+        case BLADERF_FORMAT_SC16_Q11:
+            return "sc16q11";
+
+        case BLADERF_FORMAT_SC16_Q11_META:
+            return "sc16q11_meta";
+
+        default:
+            return "unknown";
+    }
+}
+
+/* CPU time consumed by all of the process's threads, including libbladeRF's
+ * and the USB library's */
+static double cpu_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static inline void record_latency(struct bench_state *s, uint64_t ns)
+{
+    if (s->num_latencies < MAX_LATENCY_SAMPLES) {
+        s->latency_ns[s->num_latencies++] = ns;
+    }
+}
+
+static void calc_percentiles(struct bench_state *s)
+{
+    static const double q[4] = { 0.50, 0.90, 0.99, 0.999 };
+    const size_t n = s->num_latencies;
+    size_t i;
+
+    if (n == 0) {
+        return;
+    }
+
+    qsort(s->latency_ns, n, sizeof(s->latency_ns[0]), compare_u64);
+
+    for (i = 0; i < 4; i++) {
+        s->r->latency_us[i] = percentile_us(s->latency_ns, n, q[i]);
+    }
+
+    s->r->latency_us[4] = s->latency_ns[n - 1] / 1000.0;
+}
+
+/* Account for a received block that starts at the specified timestamp */
+static inline void check_timestamp(struct bench_state *s,
+                                   uint64_t timestamp, size_t count)
+{
+    if (s->have_timestamp && timestamp != s->next_timestamp) {
+        s->r->overruns++;
+    }
+
+    s->have_timestamp = true;
+    s->next_timestamp = timestamp + count;
+}
+
+static void check_rx_msgs(struct bench_state *s, const uint8_t *buf)
+{
+    const size_t msg_samples = (s->msg_size - MSG_HEADER_SIZE) /
+                               BYTES_PER_SAMPLE;
+    const size_t n_msgs = s->c->buffer_size * BYTES_PER_SAMPLE / s->msg_size;
+    uint64_t timestamp;
+    size_t i;
+
+    for (i = 0; i < n_msgs; i++) {
+        memcpy(&timestamp, buf + MSG_TIMESTAMP_OFFSET, sizeof(timestamp));
+        check_timestamp(s, LE64_TO_HOST(timestamp), msg_samples);
+        buf += s->msg_size;
+    }
+}
+
+/* Fill a buffer with a ramp. In META buffers, each message header is left
+ * zeroed; a timestamp of 0 requests transmission as soon as possible. */
+static void fill_tx_buf(struct bench_state *s, void *buf)
+{
+    const size_t len = s->c->buffer_size;
+    int16_t *samples = buf;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        samples[2 * i]     = HOST_TO_LE16((int16_t) (i % 2048));
+        samples[2 * i + 1] = HOST_TO_LE16((int16_t) -(i % 2048));
+    }
+
+    if (s->c->format == BLADERF_FORMAT_SC16_Q11_META) {
+        uint8_t *msg = buf;
+
+        for (i = 0; i < len * BYTES_PER_SAMPLE / s->msg_size; i++) {
+            memset(msg, 0, MSG_HEADER_SIZE);
+            msg += s->msg_size;
+        }
+    }
+}
+
+static int run_sync(struct bladerf *dev, struct bench_state *s)
+{
+    const struct bench_case *c = s->c;
+    const bladerf_module module = s->p->module;
+    const bool meta = (c->format == BLADERF_FORMAT_SC16_Q11_META);
+    const uint64_t duration_ns = s->p->duration_ms * 1000000ull;
+    struct bladerf_metadata md;
+    int16_t *buf;
+    int status;
+
+    status = bladerf_sync_config(dev, module, c->format, c->num_buffers,
+                                 c->buffer_size, c->num_transfers,
+                                 s->p->timeout_ms);
+    if (status != 0) {
+        log_error("Failed to configure sync interface: %s\n",
+                  bladerf_strerror(status));
+        return status;
+    }
+
+    buf = calloc(c->buffer_size, BYTES_PER_SAMPLE);
+    if (buf == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    if (module == BLADERF_MODULE_TX) {
+        /* A burst must end with a zero sample */
+        fill_tx_buf(s, buf);
+        buf[2 * c->buffer_size - 2] = buf[2 * c->buffer_size - 1] = 0;
+    }
+
+    status = bladerf_enable_module(dev, module, true);
+    if (status != 0) {
+        log_error("Failed to enable module: %s\n", bladerf_strerror(status));
+        free(buf);
+        return status;
+    }
+
+    memset(&md, 0, sizeof(md));
+
+    while (status == 0 && !s->done) {
+        const uint64_t t0 = now_ns();
+        uint64_t t1;
+        size_t count = c->buffer_size;
+
+        if (module == BLADERF_MODULE_RX) {
+            md.flags = BLADERF_META_FLAG_RX_NOW;
+            status = bladerf_sync_rx(dev, buf, c->buffer_size,
+                                     meta ? &md : NULL, s->p->timeout_ms);
+
+            if (status == 0 && meta) {
+                count = md.actual_count;
+                if (md.status & BLADERF_META_STATUS_OVERRUN) {
+                    s->r->overruns++;
+                }
+                check_timestamp(s, md.timestamp, count);
+            }
+        } else {
+            md.flags = s->started ? 0 : (BLADERF_META_FLAG_TX_BURST_START |
+                                         BLADERF_META_FLAG_TX_NOW);
+            status = bladerf_sync_tx(dev, buf, c->buffer_size,
+                                     meta ? &md : NULL, s->p->timeout_ms);
+        }
+
+        t1 = now_ns();
+
+        if (status != 0) {
+            log_error("Sync %s failed: %s\n", module2str(module),
+                      bladerf_strerror(status));
+        } else if (!s->started) {
+            s->started = true;
+            s->start_ns = t1;
+            s->cpu_start = cpu_seconds();
+        } else {
+            record_latency(s, t1 - t0);
+            s->r->samples += count;
+            s->r->calls++;
+            s->done = (t1 - s->start_ns) >= duration_ns;
+        }
+
+        s->last_ns = t1;
+    }
+
+    s->cpu_end = cpu_seconds();
+
+    if (status == 0 && meta && module == BLADERF_MODULE_TX) {
+        md.flags = BLADERF_META_FLAG_TX_BURST_END;
+        status = bladerf_sync_tx(dev, buf, c->buffer_size, &md,
+                                 s->p->timeout_ms);
+    }
+
+    if (bladerf_enable_module(dev, module, false) != 0) {
+        log_warning("Failed to disable module\n");
+    }
+
+    free(buf);
+    return status;
+}
+
+static void *stream_callback(struct bladerf *dev, struct bladerf_stream *stream,
+                             struct bladerf_metadata *meta, void *samples,
+                             size_t num_samples, void *user_data)
+{
+    struct bench_state *s = (struct bench_state *) user_data;
+    const struct bench_case *c = s->c;
+    const size_t bytes = c->buffer_size * BYTES_PER_SAMPLE;
+    void *next;
+
+    if (s->done) {
+        return BLADERF_STREAM_SHUTDOWN;
+    }
+
+    if (samples != NULL) {
+        const uint64_t now = now_ns();
+
+        if (s->p->module == BLADERF_MODULE_RX) {
+            if (c->format == BLADERF_FORMAT_SC16_Q11_META) {
+                check_rx_msgs(s, samples);
+            }
+
+            if (c->api == BENCH_API_ASYNC) {
+                memcpy(s->app_buf, samples, bytes);
+            }
+        }
+
+        if (!s->started) {
+            s->started = true;
+            s->start_ns = now;
+            s->cpu_start = cpu_seconds();
+        } else {
+            record_latency(s, now - s->last_ns);
+            s->r->samples += s->payload;
+            s->r->calls++;
+
+            if ((now - s->start_ns) >= s->p->duration_ms * 1000000ull) {
+                s->done = true;
+                s->cpu_end = cpu_seconds();
+            }
+        }
+
+        s->last_ns = now;
+
+        if (s->done) {
+            return BLADERF_STREAM_SHUTDOWN;
+        }
+    }
+
+    next = s->buffers[s->idx];
+    s->idx = (s->idx + 1) % c->num_buffers;
+
+    if (s->p->module == BLADERF_MODULE_TX && c->api == BENCH_API_ASYNC) {
+        memcpy(next, s->app_buf, bytes);
+    }
+
+    return next;
+}
+
+static int run_stream(struct bladerf *dev, struct bench_state *s)
+{
+    const struct bench_case *c = s->c;
+    const bladerf_module module = s->p->module;
+    struct bladerf_stream *stream;
+    unsigned int i;
+    int status;
+
+    s->app_buf = calloc(c->buffer_size, BYTES_PER_SAMPLE);
+    if (s->app_buf == NULL) {
+        return BLADERF_ERR_MEM;
+    }
+
+    status = bladerf_init_stream(&stream, dev, stream_callback, &s->buffers,
+                                 c->num_buffers, c->format, c->buffer_size,
+                                 c->num_transfers, s);
+    if (status != 0) {
+        log_error("Failed to initialize stream: %s\n",
+                  bladerf_strerror(status));
+        free(s->app_buf);
+        return status;
+    }
+
+    if (module == BLADERF_MODULE_TX) {
+        fill_tx_buf(s, s->app_buf);
+
+        /* Zero-copy buffers are filled once, and resubmitted as-is */
+        if (c->api == BENCH_API_ZEROCOPY) {
+            for (i = 0; i < c->num_buffers; i++) {
+                memcpy(s->buffers[i], s->app_buf,
+                       c->buffer_size * BYTES_PER_SAMPLE);
+            }
+        }
+
+        s->idx = 0;
+    } else {
+        /* The first num_transfers buffers are submitted by libbladeRF */
+        s->idx = c->num_transfers % c->num_buffers;
+    }
+
+    status = bladerf_set_stream_timeout(dev, module, s->p->timeout_ms);
+    if (status != 0) {
+        log_error("Failed to set stream timeout: %s\n",
+                  bladerf_strerror(status));
+        goto out;
+    }
+
+    status = bladerf_enable_module(dev, module, true);
+    if (status != 0) {
+        log_error("Failed to enable module: %s\n", bladerf_strerror(status));
+        goto out;
+    }
+
+    status = bladerf_stream(stream, module);
+    if (status != 0) {
+        log_error("Stream error: %s\n", bladerf_strerror(status));
+    }
+
+    if (!s->done) {
+        s->cpu_end = cpu_seconds();
+    }
+
+    if (bladerf_enable_module(dev, module, false) != 0) {
+        log_warning("Failed to disable module\n");
+    }
+
+out:
+    bladerf_deinit_stream(stream);
+    free(s->app_buf);
+    return status;
+}
+
+int bench_run(struct bladerf *dev, const struct bench_params *p,
+              const struct bench_case *c, struct bench_result *r)
+{
+    struct bench_state s;
+
+    memset(r, 0, sizeof(*r));
+    memset(&s, 0, sizeof(s));
+
+    s.p = p;
+    s.c = c;
+    s.r = r;
+
+    if (bladerf_device_speed(dev) == BLADERF_DEVICE_SPEED_HIGH) {
+        s.msg_size = MSG_SIZE_HIGH;
+    } else {
+        s.msg_size = MSG_SIZE_SUPER;
+    }
+
+    /* Samples per buffer, excluding metadata headers */
+    if (c->format == BLADERF_FORMAT_SC16_Q11_META) {
+        s.payload = (c->buffer_size * BYTES_PER_SAMPLE / s.msg_size) *
+                    ((s.msg_size - MSG_HEADER_SIZE) / BYTES_PER_SAMPLE);
+    } else {
+        s.payload = c->buffer_size;
+    }
+
+    r->overruns_valid = (p->module == BLADERF_MODULE_RX &&
+                         c->format == BLADERF_FORMAT_SC16_Q11_META);
+
+    s.latency_ns = malloc(MAX_LATENCY_SAMPLES * sizeof(s.latency_ns[0]));
+    if (s.latency_ns == NULL) {
+        r->status = BLADERF_ERR_MEM;
+        return r->status;
+    }
+
+    if (c->api == BENCH_API_SYNC) {
+        r->status = run_sync(dev, &s);
+    } else {
+        r->status = run_stream(dev, &s);
+    }
+
+    if (s.started) {
+        r->seconds = (s.last_ns - s.start_ns) * 1e-9;
+        r->cpu_seconds = s.cpu_end - s.cpu_start;
+    }
+
+    calc_percentiles(&s);
+    free(s.latency_ns);
+
+    return r->status;
+}
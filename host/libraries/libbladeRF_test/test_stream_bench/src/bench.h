@@ -0,0 +1,120 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef STREAM_BENCH_H_
+#define STREAM_BENCH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libbladeRF.h>
+
+/* Device config defaults */
+#define DEFAULT_SAMPLERATE      10000000
+#define DEFAULT_FREQUENCY       1000000000
+
+/* Benchmark defaults */
+#define DEFAULT_DURATION_MS     2000
+#define DEFAULT_TIMEOUT_MS      1000
+
+/* Maximum number of values in each swept parameter list */
+#define MAX_SWEEP_VALUES        16
+
+/* Maximum number of call latencies recorded per case */
+#define MAX_LATENCY_SAMPLES     (1 << 20)
+
+enum bench_api {
+    BENCH_API_SYNC,     /* bladerf_sync_rx() / bladerf_sync_tx() */
+    BENCH_API_ASYNC,    /* Stream callback copies to/from application buffers */
+    BENCH_API_ZEROCOPY, /* Stream callback uses the stream's buffers in place */
+};
+
+struct bench_case {
+    enum bench_api api;
+    bladerf_format format;
+    unsigned int buffer_size;       /* Units of samples */
+    unsigned int num_buffers;
+    unsigned int num_transfers;
+};
+
+struct bench_result {
+    int status;                 /* 0 or a BLADERF_ERR_* value */
+
+    uint64_t samples;           /* Samples moved after the first buffer */
+    double seconds;             /* Wall time spanned by those samples */
+    double cpu_seconds;         /* Process CPU time (all threads) */
+
+    /* Sync: time spent in each bladerf_sync_rx/tx() call.
+     * Async: interval between successive stream callbacks. */
+    uint64_t calls;
+    double latency_us[5];       /* p50, p90, p99, p99.9, max */
+
+    bool overruns_valid;        /* Only RX with metadata can detect these */
+    uint64_t overruns;          /* Discontinuities in the RX timestamps */
+};
+
+struct bench_params {
+    const char *device_str;
+    bladerf_module module;
+    unsigned int samplerate;
+    unsigned int frequency;
+    unsigned int duration_ms;
+    unsigned int timeout_ms;
+
+    /* Values to sweep. Every combination is benchmarked. */
+    enum bench_api apis[MAX_SWEEP_VALUES];
+    unsigned int num_apis;
+
+    bladerf_format formats[MAX_SWEEP_VALUES];
+    unsigned int num_formats;
+
+    unsigned int buffer_sizes[MAX_SWEEP_VALUES];
+    unsigned int num_buffer_sizes;
+
+    unsigned int buffer_counts[MAX_SWEEP_VALUES];
+    unsigned int num_buffer_counts;
+
+    unsigned int xfer_counts[MAX_SWEEP_VALUES];
+    unsigned int num_xfer_counts;
+};
+
+const char *bench_api2str(enum bench_api api);
+const char *bench_format2str(bladerf_format format);
+
+/**
+ * Benchmark one combination of stream parameters. The device must already be
+ * configured. The module is enabled for the duration of the run.
+ *
+ * @param[in]   dev     Device handle
+ * @param[in]   p       Benchmark parameters
+ * @param[in]   c       Stream parameters to benchmark
+ * @param[out]  r       Results
+ *
+ * @return 0 on success, or a BLADERF_ERR_* value on failure. This is also
+ *         stored in r->status; the results of a failed run cover the samples
+ *         transferred before the failure.
+ */
+int bench_run(struct bladerf *dev, const struct bench_params *p,
+              const struct bench_case *c, struct bench_result *r);
+
+#endif
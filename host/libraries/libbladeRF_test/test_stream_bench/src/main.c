@@ -0,0 +1,594 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <libbladeRF.h>
+#include <getopt.h>
+
+#include "host_config.h"
+#include "conversions.h"
+#include "log.h"
+#include "bench.h"
+
+#define OPTSTR "hd:s:f:m:t:T:A:F:B:C:X:o:"
+const struct option long_options[] = {
+    { "help",           no_argument,        0,  'h' },
+
+    /* Device configuration */
+    { "device",         required_argument,  0,  'd' },
+    { "samplerate",     required_argument,  0,  's' },
+    { "frequency",      required_argument,  0,  'f' },
+    { "module",         required_argument,  0,  'm' },
+
+    /* Benchmark configuration */
+    { "duration",       required_argument,  0,  't' },
+    { "timeout",        required_argument,  0,  'T' },
+    { "output",         required_argument,  0,  'o' },
+
+    /* Swept stream parameters */
+    { "api",            required_argument,  0,  'A' },
+    { "format",         required_argument,  0,  'F' },
+    { "buffer-size",    required_argument,  0,  'B' },
+    { "buffer-count",   required_argument,  0,  'C' },
+    { "num-xfers",      required_argument,  0,  'X' },
+
+    /* Verbosity options */
+    { "verbosity",      required_argument,  0,  1,  },
+    { "lib-verbosity",  required_argument,  0,  2,  },
+    { 0,                0,                  0,  0   },
+};
+
+const struct numeric_suffix freq_suffixes[] = {
+    { "K",   1000 },
+    { "kHz", 1000 },
+    { "M",   1000000 },
+    { "MHz", 1000000 },
+    { "G",   1000000000 },
+    { "GHz", 1000000000 },
+};
+
+const unsigned int num_freq_suffixes = sizeof(freq_suffixes) / sizeof(freq_suffixes[0]);
+
+const struct numeric_suffix size_suffixes[] = {
+    { "K",  1024 },
+    { "M",  1024 * 1024 },
+};
+
+const unsigned int num_size_suffixes = sizeof(size_suffixes) / sizeof(size_suffixes[0]);
+
+static const char *default_apis        = "sync,async,zerocopy";
+static const char *default_formats     = "sc16q11,sc16q11_meta";
+static const char *default_buf_sizes   = "4096,8192,16384";
+static const char *default_buf_counts  = "16,32";
+static const char *default_xfer_counts = "8,16";
+
+static void print_usage(const char *argv0)
+{
+    printf("Usage: %s [options]\n", argv0);
+    printf("libbladeRF_test_stream_bench: Measure streaming throughput, CPU load\n");
+    printf("and call latency over a sweep of stream parameters.\n");
+    printf("\n");
+
+    printf("Device configuration options:\n");
+    printf("    -d, --device <device>       Use the specified device. By default,\n");
+    printf("                                any device found will be used.\n");
+    printf("    -s, --samplerate <value>    Sample rate. Default = %u.\n", DEFAULT_SAMPLERATE);
+    printf("    -f, --frequency <value>     Frequency. Default = %u.\n", DEFAULT_FREQUENCY);
+    printf("    -m, --module <rx|tx>        Module to stream. Default = rx.\n");
+    printf("\n");
+
+    printf("Benchmark configuration options:\n");
+    printf("    -t, --duration <ms>         Duration of each run. Default = %u.\n", DEFAULT_DURATION_MS);
+    printf("    -T, --timeout <ms>          Stream timeout. Default = %u.\n", DEFAULT_TIMEOUT_MS);
+    printf("    -o, --output <file>         Write results to <file>. Default = stdout.\n");
+    printf("\n");
+
+    printf("Swept parameters (comma-separated lists):\n");
+    printf("    -A, --api <list>            sync, async, zerocopy.\n");
+    printf("                                Default = %s.\n", default_apis);
+    printf("    -F, --format <list>         sc16q11 (or plain), sc16q11_meta (or meta).\n");
+    printf("                                Default = %s.\n", default_formats);
+    printf("    -B, --buffer-size <list>    Samples per buffer; multiples of 1024.\n");
+    printf("                                Default = %s.\n", default_buf_sizes);
+    printf("    -C, --buffer-count <list>   # of stream buffers. Default = %s.\n", default_buf_counts);
+    printf("    -X, --num-xfers <list>      # in-flight transfers. Default = %s.\n", default_xfer_counts);
+    printf("\n");
+
+    printf("Misc options:\n");
+    printf("    -h, --help                  Show this help text\n");
+    printf("    --verbosity <level>         Set test verbosity (Default: info)\n");
+    printf("    --lib-verbosity <level>     Set libbladeRF verbosity (Default: warning)\n");
+    printf("\n");
+
+    printf("Notes:\n");
+    printf("    Every combination of the swept parameters is run, except those\n");
+    printf("    with at least as many transfers as buffers.\n");
+    printf("\n");
+    printf("    The async API copies each buffer to or from an application buffer\n");
+    printf("    in the stream callback. The zerocopy API hands the stream's own\n");
+    printf("    buffers back to libbladeRF untouched.\n");
+    printf("\n");
+    printf("    Latencies are the duration of each bladerf_sync_rx/tx() call for\n");
+    printf("    the sync API, and the interval between stream callbacks otherwise.\n");
+    printf("    Overruns are counted for RX with metadata only; they are null in\n");
+    printf("    all other results.\n");
+    printf("\n");
+}
+
+/* Split a comma-separated list in place. Returns the number of items, or 0
+ * if there are too many. */
+static unsigned int split_list(char *str, char *items[MAX_SWEEP_VALUES])
+{
+    unsigned int n = 0;
+    char *tok;
+
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_SWEEP_VALUES) {
+            log_error("At most %u values may be swept.\n", MAX_SWEEP_VALUES);
+            return 0;
+        }
+
+        items[n++] = tok;
+    }
+
+    return n;
+}
+
+static int parse_apis(const char *str, struct bench_params *p)
+{
+    char *items[MAX_SWEEP_VALUES];
+    char *list = strdup(str);
+    unsigned int i;
+    int status = 0;
+
+    if (list == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    p->num_apis = split_list(list, items);
+
+    for (i = 0; i < p->num_apis && status == 0; i++) {
+        if (!strcasecmp(items[i], "sync")) {
+            p->apis[i] = BENCH_API_SYNC;
+        } else if (!strcasecmp(items[i], "async")) {
+            p->apis[i] = BENCH_API_ASYNC;
+        } else if (!strcasecmp(items[i], "zerocopy")) {
+            p->apis[i] = BENCH_API_ZEROCOPY;
+        } else {
+            log_error("Invalid API: %s\n", items[i]);
+            status = -1;
+        }
+    }
+
+    free(list);
+    return (status == 0 && p->num_apis != 0) ? 0 : -1;
+}
+
+static int parse_formats(const char *str, struct bench_params *p)
+{
+    char *items[MAX_SWEEP_VALUES];
+    char *list = strdup(str);
+    unsigned int i;
+    int status = 0;
+
+    if (list == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    p->num_formats = split_list(list, items);
+
+    for (i = 0; i < p->num_formats && status == 0; i++) {
+        if (!strcasecmp(items[i], "sc16q11") ||
+            !strcasecmp(items[i], "plain")) {
+            p->formats[i] = BLADERF_FORMAT_SC16_Q11;
+        } else if (!strcasecmp(items[i], "sc16q11_meta") ||
+                   !strcasecmp(items[i], "meta")) {
+            p->formats[i] = BLADERF_FORMAT_SC16_Q11_META;
+        } else {
+            log_error("Invalid format: %s\n", items[i]);
+            status = -1;
+        }
+    }
+
+    free(list);
+    return (status == 0 && p->num_formats != 0) ? 0 : -1;
+}
+
+static int parse_uints(const char *str, const char *desc, unsigned int min,
+                       unsigned int multiple, unsigned int *values,
+                       unsigned int *count)
+{
+    char *items[MAX_SWEEP_VALUES];
+    char *list = strdup(str);
+    unsigned int i;
+    int status = 0;
+    bool ok;
+
+    if (list == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    *count = split_list(list, items);
+
+    for (i = 0; i < *count && status == 0; i++) {
+        values[i] = str2uint_suffix(items[i], min, UINT_MAX,
+                                    size_suffixes, num_size_suffixes, &ok);
+
+        if (!ok || (values[i] % multiple) != 0) {
+            log_error("Invalid %s: %s\n", desc, items[i]);
+            status = -1;
+        }
+    }
+
+    free(list);
+    return (status == 0 && *count != 0) ? 0 : -1;
+}
+
+static void init_params(struct bench_params *p)
+{
+    memset(p, 0, sizeof(*p));
+
+    p->module = BLADERF_MODULE_RX;
+    p->samplerate = DEFAULT_SAMPLERATE;
+    p->frequency = DEFAULT_FREQUENCY;
+    p->duration_ms = DEFAULT_DURATION_MS;
+    p->timeout_ms = DEFAULT_TIMEOUT_MS;
+}
+
+static int handle_cmdline(int argc, char *argv[], struct bench_params *p,
+                          const char **output)
+{
+    int c;
+    int idx;
+    bool ok;
+    bladerf_log_level level;
+    const char *apis = default_apis;
+    const char *formats = default_formats;
+    const char *buf_sizes = default_buf_sizes;
+    const char *buf_counts = default_buf_counts;
+    const char *xfer_counts = default_xfer_counts;
+
+    init_params(p);
+
+    while ((c = getopt_long(argc, argv, OPTSTR, long_options, &idx)) >= 0) {
+        switch (c) {
+            case 1:
+                level = str2loglevel(optarg, &ok);
+                if (!ok) {
+                    log_error("Invalid log level provided: %s\n", optarg);
+                    return -1;
+                } else {
+                    log_set_verbosity(level);
+                }
+                break;
+
+            case 2:
+                level = str2loglevel(optarg, &ok);
+                if (!ok) {
+                    log_error("Invalid log level provided: %s\n", optarg);
+                    return -1;
+                } else {
+                    bladerf_log_set_verbosity(level);
+                }
+                break;
+
+            case 'h':
+                return 1;
+
+            case 'd':
+                p->device_str = optarg;
+                break;
+
+            case 's':
+                p->samplerate = str2uint_suffix(optarg,
+                                                BLADERF_SAMPLERATE_MIN,
+                                                BLADERF_SAMPLERATE_REC_MAX,
+                                                freq_suffixes,
+                                                num_freq_suffixes,
+                                                &ok);
+                if (!ok) {
+                    log_error("Invalid sample rate: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'f':
+                p->frequency = str2uint_suffix(optarg,
+                                               BLADERF_FREQUENCY_MIN,
+                                               BLADERF_FREQUENCY_MAX,
+                                               freq_suffixes,
+                                               num_freq_suffixes,
+                                               &ok);
+                if (!ok) {
+                    log_error("Invalid frequency: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'm':
+                p->module = str2module(optarg);
+                if (p->module == BLADERF_MODULE_INVALID) {
+                    log_error("Invalid module: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 't':
+                p->duration_ms = str2uint(optarg, 1, UINT_MAX, &ok);
+                if (!ok) {
+                    log_error("Invalid duration: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'T':
+                p->timeout_ms = str2uint(optarg, 1, UINT_MAX, &ok);
+                if (!ok) {
+                    log_error("Invalid timeout: %s\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 'o':
+                *output = optarg;
+                break;
+
+            case 'A':
+                apis = optarg;
+                break;
+
+            case 'F':
+                formats = optarg;
+                break;
+
+            case 'B':
+                buf_sizes = optarg;
+                break;
+
+            case 'C':
+                buf_counts = optarg;
+                break;
+
+            case 'X':
+                xfer_counts = optarg;
+                break;
+
+            default:
+                return -1;
+        }
+    }
+
+    if (parse_apis(apis, p) != 0 ||
+        parse_formats(formats, p) != 0 ||
+        parse_uints(buf_sizes, "buffer size", 1024, 1024,
+                    p->buffer_sizes, &p->num_buffer_sizes) != 0 ||
+        parse_uints(buf_counts, "buffer count", 2, 1,
+                    p->buffer_counts, &p->num_buffer_counts) != 0 ||
+        parse_uints(xfer_counts, "transfer count", 1, 1,
+                    p->xfer_counts, &p->num_xfer_counts) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int init_device(struct bladerf **dev, struct bench_params *p)
+{
+    int status;
+    unsigned int actual;
+
+    status = bladerf_open(dev, p->device_str);
+    if (status != 0) {
+        log_error("Failed to open device: %s\n", bladerf_strerror(status));
+        return status;
+    }
+
+    status = bladerf_is_fpga_configured(*dev);
+    if (status < 0) {
+        log_error("Failed to determine FPGA state: %s\n",
+                  bladerf_strerror(status));
+        goto out;
+    } else if (status == 0) {
+        log_error("FPGA is not loaded.\n");
+        status = BLADERF_ERR_NODEV;
+        goto out;
+    }
+
+    status = bladerf_set_frequency(*dev, p->module, p->frequency);
+    if (status != 0) {
+        log_error("Failed to set frequency: %s\n", bladerf_strerror(status));
+        goto out;
+    }
+
+    status = bladerf_set_sample_rate(*dev, p->module, p->samplerate, &actual);
+    if (status != 0) {
+        log_error("Failed to set sample rate: %s\n", bladerf_strerror(status));
+        goto out;
+    }
+
+    p->samplerate = actual;
+
+out:
+    if (status != 0) {
+        bladerf_close(*dev);
+        *dev = NULL;
+    }
+
+    return status;
+}
+
+static void print_header(FILE *out, struct bladerf *dev,
+                         const struct bench_params *p)
+{
+    struct bladerf_version lib_version;
+    struct bladerf_devinfo info;
+
+    bladerf_version(&lib_version);
+
+    if (bladerf_get_devinfo(dev, &info) != 0) {
+        memset(&info, 0, sizeof(info));
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"libbladeRF_version\": \"%s\",\n", lib_version.describe);
+    fprintf(out, "  \"backend\": \"%s\",\n", backend_description(info.backend));
+    fprintf(out, "  \"serial\": \"%s\",\n", info.serial);
+    fprintf(out, "  \"usb_speed\": \"%s\",\n",
+            devspeed2str(bladerf_device_speed(dev)));
+    fprintf(out, "  \"module\": \"%s\",\n", module2str(p->module));
+    fprintf(out, "  \"samplerate\": %u,\n", p->samplerate);
+    fprintf(out, "  \"duration_ms\": %u,\n", p->duration_ms);
+    fprintf(out, "  \"results\": [");
+}
+
+static void print_result(FILE *out, bool first, const struct bench_case *c,
+                         const struct bench_result *r)
+{
+    const double msps = (r->seconds > 0) ? r->samples / r->seconds / 1e6 : 0;
+    const double cpu_load = (r->seconds > 0) ? r->cpu_seconds / r->seconds : 0;
+
+    fprintf(out, "%s\n    {\n", first ? "" : ",");
+    fprintf(out, "      \"api\": \"%s\",\n", bench_api2str(c->api));
+    fprintf(out, "      \"format\": \"%s\",\n", bench_format2str(c->format));
+    fprintf(out, "      \"buffer_size\": %u,\n", c->buffer_size);
+    fprintf(out, "      \"num_buffers\": %u,\n", c->num_buffers);
+    fprintf(out, "      \"num_transfers\": %u,\n", c->num_transfers);
+    fprintf(out, "      \"status\": \"%s\",\n",
+            r->status == 0 ? "ok" : bladerf_strerror(r->status));
+    fprintf(out, "      \"samples\": %llu,\n", (unsigned long long) r->samples);
+    fprintf(out, "      \"seconds\": %.6f,\n", r->seconds);
+    fprintf(out, "      \"msps\": %.4f,\n", msps);
+    fprintf(out, "      \"cpu_load\": %.4f,\n", cpu_load);
+    fprintf(out, "      \"cpu_load_per_msps\": %.6f,\n",
+            msps > 0 ? cpu_load / msps : 0);
+    fprintf(out, "      \"calls\": %llu,\n", (unsigned long long) r->calls);
+    fprintf(out, "      \"latency_us\": { \"p50\": %.3f, \"p90\": %.3f, "
+                 "\"p99\": %.3f, \"p99_9\": %.3f, \"max\": %.3f },\n",
+            r->latency_us[0], r->latency_us[1], r->latency_us[2],
+            r->latency_us[3], r->latency_us[4]);
+
+    if (r->overruns_valid) {
+        fprintf(out, "      \"overruns\": %llu\n",
+                (unsigned long long) r->overruns);
+    } else {
+        fprintf(out, "      \"overruns\": null\n");
+    }
+
+    fprintf(out, "    }");
+    fflush(out);
+}
+
+static int run_sweep(struct bladerf *dev, const struct bench_params *p,
+                     FILE *out)
+{
+    struct bench_case c;
+    struct bench_result r;
+    unsigned int a, f, b, n, x;
+    unsigned int num_failed = 0;
+    bool first = true;
+
+    print_header(out, dev, p);
+
+    for (a = 0; a < p->num_apis; a++) {
+    for (f = 0; f < p->num_formats; f++) {
+    for (b = 0; b < p->num_buffer_sizes; b++) {
+    for (n = 0; n < p->num_buffer_counts; n++) {
+    for (x = 0; x < p->num_xfer_counts; x++) {
+        c.api = p->apis[a];
+        c.format = p->formats[f];
+        c.buffer_size = p->buffer_sizes[b];
+        c.num_buffers = p->buffer_counts[n];
+        c.num_transfers = p->xfer_counts[x];
+
+        if (c.num_transfers >= c.num_buffers) {
+            log_debug("Skipping %u transfers with %u buffers\n",
+                      c.num_transfers, c.num_buffers);
+            continue;
+        }
+
+        log_info("Running %s %s: buffer size=%u, buffers=%u, xfers=%u\n",
+                 bench_api2str(c.api), bench_format2str(c.format),
+                 c.buffer_size, c.num_buffers, c.num_transfers);
+
+        if (bench_run(dev, p, &c, &r) != 0) {
+            num_failed++;
+        }
+
+        print_result(out, first, &c, &r);
+        first = false;
+    }
+    }
+    }
+    }
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+
+    return num_failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int status;
+    struct bench_params p;
+    struct bladerf *dev = NULL;
+    const char *output = NULL;
+    FILE *out = stdout;
+
+    status = handle_cmdline(argc, argv, &p, &output);
+    if (status > 0) {
+        print_usage(argv[0]);
+        return 0;
+    } else if (status < 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (output != NULL) {
+        out = fopen(output, "w");
+        if (out == NULL) {
+            log_error("Failed to open output file - %s\n", strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    status = init_device(&dev, &p);
+    if (status == 0) {
+        status = run_sweep(dev, &p, out);
+        bladerf_close(dev);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return status == 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,540 @@
+/*
+ * This file is part of the bladeRF project:
+ *   http://www.github.com/nuand/bladeRF
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* This program records a fixed sequence of USB operations against a fake USB
+ * driver, replays the resulting trace with the "replay" USB driver, and checks
+ * that the replay returns what the fake driver did. This is done for each of
+ * the "all" and "meta" sample payload modes. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bladerf_priv.h"
+#include "async.h"
+#include "log.h"
+#include "backend/usb/usb.h"
+#include "backend/usb/usb_trace.h"
+
+#define DEFAULT_TRACE_FILE  "libbladeRF_test_usb_trace.trace"
+
+#define NUM_CTRL            4       /* Control transfers issued */
+#define CTRL_LEN            8
+#define CTRL_REQ_FAIL       0x99    /* Request the fake driver rejects */
+#define BULK_LEN            16
+#define STRING_LEN          32
+
+#define MSG_SIZE            2048
+#define SAMPLES_PER_BUFFER  4096
+#define BUFFER_BYTES        (SAMPLES_PER_BUFFER * 4)
+#define NUM_BUFFERS         4
+#define NUM_TRANSFERS       2
+#define NUM_RX_BUFFERS      16      /* RX buffers received before stopping */
+
+/* The replay driver, which is otherwise only reached via usb.c's list */
+extern const struct usb_driver usb_driver_replay;
+
+/* Everything the sequence of operations returned */
+struct results {
+    int status[NUM_CTRL + 8];
+    unsigned int num_status;
+
+    char string[STRING_LEN];
+    bladerf_dev_speed speed;
+    uint8_t ctrl[NUM_CTRL][CTRL_LEN];
+    uint8_t bulk[BULK_LEN];
+
+    uint8_t rx[NUM_RX_BUFFERS][BUFFER_BYTES];
+    unsigned int num_rx;
+    int stream_error;
+};
+
+/* The replay driver's only use of bladerf_priv.c, which is not built into
+ * this program, as it would pull in the rest of libbladeRF */
+int populate_abs_timeout(struct timespec *t, unsigned int timeout_ms)
+{
+    if (clock_gettime(CLOCK_REALTIME, t) != 0) {
+        return BLADERF_ERR_UNEXPECTED;
+    }
+
+    t->tv_sec += timeout_ms / 1000 + (t->tv_nsec / 1000000 +
+                                      timeout_ms % 1000) / 1000;
+    t->tv_nsec = (t->tv_nsec + (timeout_ms % 1000) * 1000000l) % 1000000000l;
+    return 0;
+}
+
+/******************************************************************************
+ * Fake USB driver
+ *
+ * Returns data derived from each request, and streams RX buffers holding a
+ * counter, with a timestamp in each message's metadata header.
+ ******************************************************************************/
+
+static int fake_probe(backend_probe_target probe_target,
+                      struct bladerf_devinfo_list *info_list)
+{
+    return 0;
+}
+
+static int fake_open(void **driver, struct bladerf_devinfo *info_in,
+                     struct bladerf_devinfo *info_out)
+{
+    return 0;
+}
+
+static void fake_close(void *driver)
+{
+}
+
+static int fake_get_speed(void *driver, bladerf_dev_speed *speed)
+{
+    *speed = BLADERF_DEVICE_SPEED_SUPER;
+    return 0;
+}
+
+static int fake_change_setting(void *driver, uint8_t setting)
+{
+    return 0;
+}
+
+static int fake_control_transfer(void *driver,
+                                 usb_target target_type,
+                                 usb_request req_type,
+                                 usb_direction direction,
+                                 uint8_t request, uint16_t wvalue,
+                                 uint16_t windex,
+                                 void *buffer, uint32_t buffer_len,
+                                 uint32_t timeout_ms)
+{
+    uint32_t i;
+
+    if (request == CTRL_REQ_FAIL) {
+        return BLADERF_ERR_TIMEOUT;
+    }
+
+    if (direction == USB_DIR_DEVICE_TO_HOST) {
+        for (i = 0; i < buffer_len; i++) {
+            ((uint8_t *) buffer)[i] = (uint8_t) (request + wvalue + i);
+        }
+    }
+
+    return 0;
+}
+
+static int fake_bulk_transfer(void *driver, uint8_t endpoint,
+                              void *buffer, uint32_t buffer_len,
+                              uint32_t timeout_ms)
+{
+    uint32_t i;
+
+    if (endpoint & 0x80) {
+        for (i = 0; i < buffer_len; i++) {
+            ((uint8_t *) buffer)[i] = (uint8_t) (0xa0 + i);
+        }
+    }
+
+    return 0;
+}
+
+static int fake_get_string_descriptor(void *driver, uint8_t index,
+                                      void *buffer, uint32_t buffer_len)
+{
+    memset(buffer, 0, buffer_len);
+    snprintf(buffer, buffer_len, "fake string %u", index);
+    return 0;
+}
+
+static int fake_init_stream(void *driver, struct bladerf_stream *stream,
+                            size_t num_transfers)
+{
+    return 0;
+}
+
+static void fake_fill_rx(uint8_t *buffer, unsigned int n)
+{
+    size_t i;
+
+    for (i = 0; i < BUFFER_BYTES; i++) {
+        buffer[i] = (uint8_t) (n * 7 + i);
+    }
+
+    for (i = 0; i < BUFFER_BYTES / MSG_SIZE; i++) {
+        trace_put_le64(buffer + i * MSG_SIZE + 4, n * 1000 + i);
+    }
+}
+
+/* Completes RX transfers as quickly as they are submitted */
+static int fake_stream(void *driver, struct bladerf_stream *stream,
+                       bladerf_module module)
+{
+    void *queue[NUM_TRANSFERS + 1];
+    unsigned int head = 0, tail = 0, n = 0;
+    struct bladerf_metadata metadata;
+    void *buffer, *next;
+    size_t i;
+
+    memset(&metadata, 0, sizeof(metadata));
+
+    MUTEX_LOCK(&stream->lock);
+
+    for (i = 0; i < NUM_TRANSFERS; i++) {
+        queue[tail++ % ARRAY_SIZE(queue)] = stream->buffers[i];
+    }
+
+    while (stream->state == STREAM_RUNNING && head != tail) {
+        buffer = queue[head++ % ARRAY_SIZE(queue)];
+        fake_fill_rx(buffer, n++);
+
+        next = stream->cb(stream->dev, stream, &metadata, buffer,
+                          stream->samples_per_buffer, stream->user_data);
+
+        if (next == BLADERF_STREAM_SHUTDOWN) {
+            stream->state = STREAM_DONE;
+        } else if (next != BLADERF_STREAM_NO_DATA) {
+            queue[tail++ % ARRAY_SIZE(queue)] = next;
+        }
+    }
+
+    stream->state = STREAM_DONE;
+    MUTEX_UNLOCK(&stream->lock);
+    return 0;
+}
+
+static int fake_submit_stream_buffer(void *driver,
+                                     struct bladerf_stream *stream,
+                                     void *buffer, unsigned int timeout_ms,
+                                     bool nonblock)
+{
+    return 0;
+}
+
+static int fake_deinit_stream(void *driver, struct bladerf_stream *stream)
+{
+    return 0;
+}
+
+static int fake_open_bootloader(void **driver, uint8_t bus, uint8_t addr)
+{
+    return BLADERF_ERR_NODEV;
+}
+
+static void fake_close_bootloader(void *driver)
+{
+}
+
+static const struct usb_fns fake_fns = {
+    FIELD_INIT(.probe, fake_probe),
+    FIELD_INIT(.open, fake_open),
+    FIELD_INIT(.close, fake_close),
+    FIELD_INIT(.get_speed, fake_get_speed),
+    FIELD_INIT(.change_setting, fake_change_setting),
+    FIELD_INIT(.control_transfer, fake_control_transfer),
+    FIELD_INIT(.bulk_transfer, fake_bulk_transfer),
+    FIELD_INIT(.get_string_descriptor, fake_get_string_descriptor),
+    FIELD_INIT(.init_stream, fake_init_stream),
+    FIELD_INIT(.stream, fake_stream),
+    FIELD_INIT(.submit_stream_buffer, fake_submit_stream_buffer),
+    FIELD_INIT(.deinit_stream, fake_deinit_stream),
+    FIELD_INIT(.open_bootloader, fake_open_bootloader),
+    FIELD_INIT(.close_bootloader, fake_close_bootloader),
+};
+
+/******************************************************************************
+ * Sequence of operations
+ ******************************************************************************/
+
+static void *rx_callback(struct bladerf *dev, struct bladerf_stream *stream,
+                         struct bladerf_metadata *meta, void *samples,
+                         size_t num_samples, void *user_data)
+{
+    struct results *res = user_data;
+
+    if (samples == NULL) {
+        return BLADERF_STREAM_NO_DATA;
+    }
+
+    memcpy(res->rx[res->num_rx++], samples, BUFFER_BYTES);
+    if (res->num_rx == NUM_RX_BUFFERS) {
+        return BLADERF_STREAM_SHUTDOWN;
+    }
+
+    return stream->buffers[res->num_rx % NUM_BUFFERS];
+}
+
+static int run_stream(struct bladerf_usb *usb, bladerf_format format,
+                      struct results *res)
+{
+    struct bladerf dev;
+    struct bladerf_stream stream;
+    void *buffers[NUM_BUFFERS];
+    size_t i;
+    int status;
+
+    memset(&dev, 0, sizeof(dev));
+    dev.msg_size = MSG_SIZE;
+    dev.transfer_timeout[BLADERF_MODULE_RX] = 1000;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.dev = &dev;
+    stream.module = BLADERF_MODULE_RX;
+    stream.format = format;
+    stream.cb = rx_callback;
+    stream.user_data = res;
+    stream.samples_per_buffer = SAMPLES_PER_BUFFER;
+    stream.num_buffers = NUM_BUFFERS;
+    stream.buffers = buffers;
+
+    for (i = 0; i < NUM_BUFFERS; i++) {
+        buffers[i] = calloc(1, BUFFER_BYTES);
+        if (buffers[i] == NULL) {
+            while (i-- > 0) {
+                free(buffers[i]);
+            }
+            return BLADERF_ERR_MEM;
+        }
+    }
+
+    MUTEX_INIT(&stream.lock);
+    pthread_cond_init(&stream.can_submit_buffer, NULL);
+
+    status = usb->fn->init_stream(usb->driver, &stream, NUM_TRANSFERS);
+    if (status == 0) {
+        stream.state = STREAM_RUNNING;
+        status = usb->fn->stream(usb->driver, &stream, BLADERF_MODULE_RX);
+        res->stream_error = stream.error_code;
+        usb->fn->deinit_stream(usb->driver, &stream);
+    }
+
+    pthread_cond_destroy(&stream.can_submit_buffer);
+    pthread_mutex_destroy(&stream.lock);
+
+    for (i = 0; i < NUM_BUFFERS; i++) {
+        free(buffers[i]);
+    }
+
+    return status;
+}
+
+static void run_ops(struct bladerf_usb *usb, bladerf_format format,
+                    struct results *res)
+{
+    void *d = usb->driver;
+    unsigned int i;
+    uint8_t out[BULK_LEN];
+    int *status = res->status;
+
+    memset(res, 0, sizeof(*res));
+
+    *status++ = usb->fn->get_string_descriptor(d, 3, res->string, STRING_LEN);
+    *status++ = usb->fn->get_speed(d, &res->speed);
+    *status++ = usb->fn->change_setting(d, 1);
+
+    for (i = 0; i < NUM_CTRL; i++) {
+        *status++ = usb->fn->control_transfer(d, USB_TARGET_DEVICE,
+                                              USB_REQUEST_VENDOR,
+                                              USB_DIR_DEVICE_TO_HOST,
+                                              i == NUM_CTRL - 1 ?
+                                                CTRL_REQ_FAIL : 0x10 + i,
+                                              i, 0, res->ctrl[i], CTRL_LEN,
+                                              1000);
+    }
+
+    memset(out, 0x55, sizeof(out));
+    *status++ = usb->fn->bulk_transfer(d, 0x01, out, BULK_LEN, 1000);
+    *status++ = usb->fn->bulk_transfer(d, 0x81, res->bulk, BULK_LEN, 1000);
+
+    *status++ = run_stream(usb, format, res);
+    *status++ = usb->fn->change_setting(d, 0);
+
+    res->num_status = (unsigned int) (status - res->status);
+}
+
+/******************************************************************************
+ * Record, replay, and compare
+ ******************************************************************************/
+
+static int record(const char *path, const struct bladerf_devinfo *ident,
+                  bladerf_format format, struct results *res)
+{
+    struct bladerf_usb usb;
+    int status;
+
+    usb.fn = &fake_fns;
+    usb.driver = NULL;
+
+    status = usb_trace_start(&usb, path, ident);
+    if (status != 0) {
+        fprintf(stderr, "Failed to start recording: %s\n",
+                bladerf_strerror(status));
+        return status;
+    }
+
+    run_ops(&usb, format, res);
+    usb.fn->close(usb.driver);
+    return 0;
+}
+
+static int replay(const struct bladerf_devinfo *ident, bladerf_format format,
+                  struct results *res)
+{
+    struct bladerf_usb usb;
+    struct bladerf_devinfo info, replayed;
+    int status;
+
+    bladerf_init_devinfo(&info);
+    info.backend = BLADERF_BACKEND_REPLAY;
+
+    usb.fn = usb_driver_replay.fn;
+    status = usb.fn->open(&usb.driver, &info, &replayed);
+    if (status != 0) {
+        fprintf(stderr, "Failed to open the trace: %s\n",
+                bladerf_strerror(status));
+        return status;
+    }
+
+    if (strcmp(replayed.serial, ident->serial) != 0 ||
+        replayed.usb_bus != ident->usb_bus ||
+        replayed.usb_addr != ident->usb_addr) {
+        fprintf(stderr, "Replayed device differs from the recorded one\n");
+        usb.fn->close(usb.driver);
+        return BLADERF_ERR_UNEXPECTED;
+    }
+
+    run_ops(&usb, format, res);
+    usb.fn->close(usb.driver);
+    return 0;
+}
+
+/* Returns the number of mismatches */
+static unsigned int compare(const struct results *rec,
+                            const struct results *play, bool meta_only)
+{
+    unsigned int i, j, fails = 0;
+
+    for (i = 0; i < rec->num_status; i++) {
+        if (rec->status[i] != play->status[i]) {
+            fprintf(stderr, "  Operation %u: status %d, expected %d\n",
+                    i, play->status[i], rec->status[i]);
+            fails++;
+        }
+    }
+
+    if (strcmp(rec->string, play->string) != 0 || rec->speed != play->speed ||
+        memcmp(rec->ctrl, play->ctrl, sizeof(rec->ctrl)) != 0 ||
+        memcmp(rec->bulk, play->bulk, sizeof(rec->bulk)) != 0) {
+        fprintf(stderr, "  Control or bulk transfer data differs\n");
+        fails++;
+    }
+
+    if (rec->num_rx != play->num_rx || rec->stream_error != play->stream_error) {
+        fprintf(stderr, "  Received %u RX buffers (error %d), expected %u "
+                "(error %d)\n", play->num_rx, play->stream_error,
+                rec->num_rx, rec->stream_error);
+        return fails + 1;
+    }
+
+    for (i = 0; i < rec->num_rx; i++) {
+        if (!meta_only) {
+            if (memcmp(rec->rx[i], play->rx[i], BUFFER_BYTES) != 0) {
+                fprintf(stderr, "  RX buffer %u differs\n", i);
+                fails++;
+            }
+            continue;
+        }
+
+        for (j = 0; j < BUFFER_BYTES / MSG_SIZE; j++) {
+            if (memcmp(rec->rx[i] + j * MSG_SIZE, play->rx[i] + j * MSG_SIZE,
+                       TRACE_META_HDR_LEN) != 0) {
+                fprintf(stderr, "  RX buffer %u: message %u header differs\n",
+                        i, j);
+                fails++;
+            }
+        }
+    }
+
+    return fails;
+}
+
+static struct results rec_results, play_results;
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *samples;
+        bladerf_format format;
+        bool meta_only;
+    } modes[] = {
+        { "all",    BLADERF_FORMAT_SC16_Q11,        false },
+        { "meta",   BLADERF_FORMAT_SC16_Q11_META,   true  },
+    };
+
+    const char *path = argc > 1 ? argv[1] : DEFAULT_TRACE_FILE;
+    struct bladerf_devinfo ident;
+    unsigned int i, fails = 0;
+    int status;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [trace file]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bladerf_init_devinfo(&ident);
+    strcpy(ident.serial, "0123456789abcdef0123456789abcdef");
+    ident.usb_bus = 3;
+    ident.usb_addr = 7;
+
+    setenv("BLADERF_USB_REPLAY", path, 1);
+    setenv("BLADERF_USB_REPLAY_SPEED", "0", 1);
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        printf("Recording and replaying with samples=%s...\n",
+               modes[i].samples);
+
+        setenv("BLADERF_USB_TRACE_SAMPLES", modes[i].samples, 1);
+
+        status = record(path, &ident, modes[i].format, &rec_results);
+        if (status == 0) {
+            status = replay(&ident, modes[i].format, &play_results);
+        }
+
+        if (status != 0) {
+            fails++;
+        } else if (compare(&rec_results, &play_results,
+                           modes[i].meta_only) != 0) {
+            fails++;
+        }
+    }
+
+    remove(path);
+
+    if (fails != 0) {
+        printf("FAILED: %u of %u modes\n", fails,
+               (unsigned int) ARRAY_SIZE(modes));
+        return EXIT_FAILURE;
+    }
+
+    printf("PASSED\n");
+    return EXIT_SUCCESS;
+}
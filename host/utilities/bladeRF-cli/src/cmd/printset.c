@@ -24,6 +24,7 @@
 #include "host_config.h"
 #include "cmd.h"
 #include "conversions.h"
+#include "rxtx.h"
 
 #define PRINTSET_DECL(x) \
     int print_##x(struct cli_state *, int, char **); int set_##x(struct cli_state *, int, char **);
@@ -376,6 +377,7 @@ int set_frequency(struct cli_state *state, int argc, char **argv)
                         rv = CLI_RET_LIBBLADERF;
                     } else {
                         printf( "  Set RX frequency: %10uHz\n", freq );
+                        rxtx_notify_retune(state->rx, freq);
                     }
                 }
             }
@@ -396,6 +398,7 @@ int set_frequency(struct cli_state *state, int argc, char **argv)
                         rv = CLI_RET_LIBBLADERF;
                     } else {
                         printf( "  Set TX frequency: %10uHz\n", freq );
+                        rxtx_notify_retune(state->tx, freq);
                     }
                 }
             }
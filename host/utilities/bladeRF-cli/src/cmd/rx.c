@@ -38,6 +38,13 @@
 #   define EOL "\n"
 #endif
 
+/* Multipliers for the rotate_time parameter, in seconds */
+static const struct numeric_suffix rx_time_suffixes[] = {
+    { FIELD_INIT(.suffix, "s"), FIELD_INIT(.multiplier, 1) },
+    { FIELD_INIT(.suffix, "m"), FIELD_INIT(.multiplier, 60) },
+    { FIELD_INIT(.suffix, "h"), FIELD_INIT(.multiplier, 60 * 60) },
+};
+
 /**
  * Peform adjustments on received samples before writing them out:
  *  (1) Mask off FPGA markers
@@ -94,6 +101,23 @@ static int rx_write_bin_sc16q11(struct rxtx_data *rx,
     }
 }
 
+/* returns 0 on success, CLI_RET_* on failure (and calls set_last_error()) */
+static int rx_write_cmp_sc16q11(struct rxtx_data *rx,
+                                int16_t *samples, size_t n_samples)
+{
+    int status;
+
+    MUTEX_LOCK(&rx->file_mgmt.file_lock);
+    status = cmp_writer_write(rx->file_mgmt.cmp_writer, samples, n_samples);
+    MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
+    if (status != 0) {
+        set_last_error(&rx->last_error, ETYPE_CLI, status);
+    }
+
+    return status;
+}
+
 /* returns 0 on success, CLI_RET_* on failure (and calls set_last_error()) */
 static int rx_write_csv_sc16q11(struct rxtx_data *rx,
                                 int16_t *samples, size_t n_samples)
@@ -119,6 +143,119 @@ static int rx_write_csv_sc16q11(struct rxtx_data *rx,
     return status;
 }
 
+/* Switch to the next file of a split capture, if the block about to be
+ * written would exceed the current file's limits. This is a no-op for
+ * unsplit captures.
+ *
+ * returns 0 on success, CLI_RET_* on failure */
+static int rx_rotate(struct rxtx_data *rx, uint64_t timestamp, size_t n)
+{
+    int status = 0;
+
+    MUTEX_LOCK(&rx->file_mgmt.file_lock);
+    if (rx->file_mgmt.rotator != NULL) {
+        status = rotator_update(rx->file_mgmt.rotator, timestamp,
+                                2 * n * sizeof(int16_t),
+                                &rx->file_mgmt.file);
+    }
+    MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
+    return status;
+}
+
+/* Write out a portion of a trigger capture */
+static int rx_write_trigcap(void *rx_arg, int16_t *samples,
+                            unsigned int n, uint64_t timestamp)
+{
+    int status = 0;
+    struct rxtx_data *rx = (struct rxtx_data *) rx_arg;
+    struct rx_params *rx_params = rx->params;
+
+    MUTEX_LOCK(&rx->file_mgmt.file_meta_lock);
+    if (rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+        status = sigmf_meta_update(&rx->file_mgmt.sigmf, timestamp, n);
+    }
+    MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
+
+    if (status == 0) {
+        status = rx_rotate(rx, timestamp, n);
+    }
+
+    if (status == 0) {
+        status = rx_params->write_samples(rx, samples, n);
+    }
+
+    if (status != 0) {
+        set_last_error(&rx->last_error, ETYPE_CLI, status);
+    }
+
+    return status;
+}
+
+/* Keep received samples in a ring until the trigger fires, and then write
+ * out only those surrounding the trigger point */
+static int rx_task_exec_trigger(struct rxtx_data *rx, struct cli_state *s)
+{
+    int status;
+    unsigned int timeout_ms;
+    unsigned int samples_per_buffer;
+    struct trigcap *tc;
+    struct trigcap_config config;
+    struct rx_params *rx_params = rx->params;
+    enum trigcap_state state = TRIGCAP_STATE_ARMED;
+
+    MUTEX_LOCK(&rx->data_mgmt.lock);
+    timeout_ms = rx->data_mgmt.timeout_ms;
+    samples_per_buffer = (unsigned int) rx->data_mgmt.samples_per_buffer;
+    MUTEX_UNLOCK(&rx->data_mgmt.lock);
+
+    MUTEX_LOCK(&rx->param_lock);
+    config = rx_params->trigcap;
+    if (rx_params->trigger != RX_TRIGGER_POWER) {
+        config.threshold_dbfs = TRIGCAP_THRESHOLD_OFF;
+    }
+    MUTEX_UNLOCK(&rx->param_lock);
+
+    config.samples_per_buffer = samples_per_buffer;
+
+    status = trigcap_init(&tc, &config);
+    if (status != 0) {
+        set_last_error(&rx->last_error, ETYPE_BLADERF, status);
+        return status;
+    }
+
+    /* Make the capture visible to rxtx_notify_trigger() */
+    MUTEX_LOCK(&rx->param_lock);
+    rx_params->tc = tc;
+    MUTEX_UNLOCK(&rx->param_lock);
+
+    while (status == 0 && state != TRIGCAP_STATE_DONE) {
+        unsigned char requests = rxtx_get_requests(rx, RXTX_TASK_REQ_STOP);
+        if (requests & (RXTX_TASK_REQ_STOP | RXTX_TASK_REQ_SHUTDOWN)) {
+            break;
+        }
+
+        status = trigcap_rx(tc, s->dev, timeout_ms);
+        if (status != 0) {
+            set_last_error(&rx->last_error, ETYPE_BLADERF, status);
+        } else {
+            state = trigcap_get_state(tc);
+        }
+    }
+
+    MUTEX_LOCK(&rx->param_lock);
+    rx_params->tc = NULL;
+    MUTEX_UNLOCK(&rx->param_lock);
+
+    /* Nothing is written if the capture was stopped prior to completion */
+    if (status == 0 && state == TRIGCAP_STATE_DONE) {
+        status = trigcap_write(tc, rx_write_trigcap, rx);
+    }
+
+    trigcap_deinit(tc);
+    return status;
+}
+
 static int rx_task_exec_running(struct rxtx_data *rx, struct cli_state *s)
 {
     int status = 0;
@@ -128,6 +265,9 @@ static int rx_task_exec_running(struct rxtx_data *rx, struct cli_state *s)
     size_t samples_read = 0;
     int (*write_samples)(struct rxtx_data *rx, int16_t *samples, size_t n);
     unsigned int timeout_ms;
+    struct bladerf_metadata meta;
+    struct bladerf_metadata *meta_ptr = NULL;
+    bool sigmf = false;
 
     /* Read the parameters that will be used for the sync transfers */
     MUTEX_LOCK(&rx->data_mgmt.lock);
@@ -140,6 +280,21 @@ static int rx_task_exec_running(struct rxtx_data *rx, struct cli_state *s)
     write_samples = ((struct rx_params*)rx->params)->write_samples;
     MUTEX_UNLOCK(&rx->param_lock);
 
+    /* The SigMF format records the timestamps of each block */
+    MUTEX_LOCK(&rx->file_mgmt.file_meta_lock);
+    if (rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+        meta_ptr = &meta;
+        sigmf = true;
+    }
+    MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
+
+    /* Split captures name each file after its first timestamp */
+    MUTEX_LOCK(&rx->file_mgmt.file_lock);
+    if (rx->file_mgmt.rotator != NULL) {
+        meta_ptr = &meta;
+    }
+    MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
     /* Allocate a buffer for the block of samples */
     samples = malloc(samples_per_buffer * sizeof(uint16_t) * 2);
     if (samples == NULL) {
@@ -162,26 +317,47 @@ static int rx_task_exec_running(struct rxtx_data *rx, struct cli_state *s)
             break;
         }
 
+        if (meta_ptr != NULL) {
+            memset(&meta, 0, sizeof(meta));
+            meta.flags = BLADERF_META_FLAG_RX_NOW;
+        }
+
         /* Read the samples into the sample buffer */
-        status = bladerf_sync_rx(s->dev, samples, samples_per_buffer, NULL,
+        status = bladerf_sync_rx(s->dev, samples, samples_per_buffer, meta_ptr,
                                  timeout_ms);
 
         if (status != 0) {
             set_last_error(&rx->last_error, ETYPE_BLADERF, status);
         } else {
-            size_t to_write = min_sz(samples_per_buffer,
-                                     (num_samples - samples_read));
+            /* Following an overrun, only actual_count samples are valid */
+            size_t n_read = (meta_ptr != NULL) ? meta.actual_count :
+                                                 (size_t) samples_per_buffer;
+
+            size_t to_write = min_sz(n_read, (num_samples - samples_read));
+
+            if (sigmf) {
+                MUTEX_LOCK(&rx->file_mgmt.file_meta_lock);
+                status = sigmf_meta_update(&rx->file_mgmt.sigmf,
+                                           meta.timestamp, to_write);
+                MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
+            }
+
+            if (status == 0 && meta_ptr != NULL) {
+                status = rx_rotate(rx, meta.timestamp, to_write);
+            }
 
             /* Write the samples to the output file */
-            sc16q11_sample_fixup(samples, to_write);
-            status = write_samples(rx, samples, to_write);
+            if (status == 0) {
+                sc16q11_sample_fixup(samples, to_write);
+                status = write_samples(rx, samples, to_write);
+            }
 
             if (status != 0) {
                 set_last_error(&rx->last_error, ETYPE_CLI, status);
             }
-        }
 
-        samples_read += samples_per_buffer;
+            samples_read += n_read;
+        }
     }
 
     /* Free the sample buffer */
@@ -201,6 +377,7 @@ void *rx_task(void *cli_state_arg)
     struct cli_state *cli_state = (struct cli_state *) cli_state_arg;
     struct rxtx_data *rx = cli_state->rx;
     struct rx_params *rx_params = rx->params;
+    enum rx_trigger trigger;
     MUTEX *dev_lock = &cli_state->dev_lock;
 
     task_state = rxtx_get_state(rx);
@@ -224,6 +401,7 @@ void *rx_task(void *cli_state_arg)
                 /* This should be set to an appropriate value upon
                  * encountering an error condition */
                 enum error_type err_type = ETYPE_BUG;
+                bladerf_format stream_fmt;
 
                 /* Clear the last error */
                 set_last_error(&rx->last_error, ETYPE_ERRNO, 0);
@@ -238,9 +416,28 @@ void *rx_task(void *cli_state_arg)
                         break;
 
                     case RXTX_FMT_BIN_SC16Q11:
+                    case RXTX_FMT_SIGMF_SC16Q11:
                         rx_params->write_samples = rx_write_bin_sc16q11;
                         break;
 
+                    case RXTX_FMT_CMP_SC16Q11:
+                        rx_params->write_samples = rx_write_cmp_sc16q11;
+
+                        /* Start up the compression workers */
+                        MUTEX_LOCK(&rx->data_mgmt.lock);
+                        MUTEX_LOCK(&rx->file_mgmt.file_lock);
+                        status = cmp_writer_open(&rx->file_mgmt.cmp_writer,
+                                                 rx->file_mgmt.file,
+                                                 &rx->file_mgmt.cmp,
+                                                 rx->data_mgmt.samples_per_buffer);
+                        MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+                        MUTEX_UNLOCK(&rx->data_mgmt.lock);
+
+                        if (status != 0) {
+                            err_type = ETYPE_CLI;
+                        }
+                        break;
+
                     default:
                         status = CLI_RET_INVPARAM;
                         set_last_error(&rx->last_error, ETYPE_CLI, status);
@@ -251,15 +448,35 @@ void *rx_task(void *cli_state_arg)
                     assert(rx->file_mgmt.path);
                 }
 
+                if (rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+                    stream_fmt = BLADERF_FORMAT_SC16_Q11_META;
+                } else {
+                    stream_fmt = BLADERF_FORMAT_SC16_Q11;
+                }
+
                 MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
 
+                MUTEX_LOCK(&rx->file_mgmt.file_lock);
+                if (rx->file_mgmt.rotator != NULL) {
+                    stream_fmt = BLADERF_FORMAT_SC16_Q11_META;
+                }
+                MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
+                /* Trigger captures locate the trigger point by timestamp */
+                MUTEX_LOCK(&rx->param_lock);
+                trigger = rx_params->trigger;
+                if (trigger != RX_TRIGGER_OFF) {
+                    stream_fmt = BLADERF_FORMAT_SC16_Q11_META;
+                }
+                MUTEX_UNLOCK(&rx->param_lock);
+
                 /* Set up the reception stream and buffer information */
                 if (status == 0) {
                     MUTEX_LOCK(&rx->data_mgmt.lock);
 
                     status = bladerf_sync_config(cli_state->dev,
                                                  BLADERF_MODULE_RX,
-                                                 BLADERF_FORMAT_SC16_Q11,
+                                                 stream_fmt,
                                                  rx->data_mgmt.num_buffers,
                                                  rx->data_mgmt.samples_per_buffer,
                                                  rx->data_mgmt.num_transfers,
@@ -276,6 +493,29 @@ void *rx_task(void *cli_state_arg)
                     rxtx_set_state(rx, RXTX_STATE_RUNNING);
                 } else {
                     set_last_error(&rx->last_error, err_type, status);
+
+                    MUTEX_LOCK(&rx->file_mgmt.file_lock);
+                    if (rx->file_mgmt.cmp_writer != NULL) {
+                        cmp_writer_close(rx->file_mgmt.cmp_writer);
+                        rx->file_mgmt.cmp_writer = NULL;
+                    }
+
+                    if (rx->file_mgmt.rotator != NULL) {
+                        rotator_stop(rx->file_mgmt.rotator);
+                        rx->file_mgmt.rotator = NULL;
+                        rx->file_mgmt.file = NULL;
+                    }
+                    MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
+                    /* Don't leave behind metadata for a capture that
+                     * never started */
+                    MUTEX_LOCK(&rx->file_mgmt.file_meta_lock);
+                    if (rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+                        sigmf_meta_abort(&rx->file_mgmt.sigmf,
+                                         rx->file_mgmt.path);
+                    }
+                    MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
+
                     rxtx_set_state(rx, RXTX_STATE_IDLE);
                 }
             }
@@ -291,7 +531,15 @@ void *rx_task(void *cli_state_arg)
                 if (status < 0) {
                     set_last_error(&rx->last_error, ETYPE_BLADERF, status);
                 } else {
-                    status = rx_task_exec_running(rx, cli_state);
+                    MUTEX_LOCK(&rx->param_lock);
+                    trigger = rx_params->trigger;
+                    MUTEX_UNLOCK(&rx->param_lock);
+
+                    if (trigger != RX_TRIGGER_OFF) {
+                        status = rx_task_exec_trigger(rx, cli_state);
+                    } else {
+                        status = rx_task_exec_running(rx, cli_state);
+                    }
 
                     MUTEX_LOCK(dev_lock);
                     disable_status = bladerf_enable_module(cli_state->dev,
@@ -303,6 +551,40 @@ void *rx_task(void *cli_state_arg)
                     }
                 }
 
+                /* Flush out remaining compressed blocks and the index */
+                MUTEX_LOCK(&rx->file_mgmt.file_lock);
+                if (rx->file_mgmt.cmp_writer != NULL) {
+                    status = cmp_writer_close(rx->file_mgmt.cmp_writer);
+                    rx->file_mgmt.cmp_writer = NULL;
+
+                    if (status != 0) {
+                        set_last_error(&rx->last_error, ETYPE_CLI, status);
+                    }
+                }
+
+                /* Close out the final file of a split capture */
+                if (rx->file_mgmt.rotator != NULL) {
+                    status = rotator_stop(rx->file_mgmt.rotator);
+                    rx->file_mgmt.rotator = NULL;
+                    rx->file_mgmt.file = NULL;
+
+                    if (status != 0) {
+                        set_last_error(&rx->last_error, ETYPE_CLI, status);
+                    }
+                }
+                MUTEX_UNLOCK(&rx->file_mgmt.file_lock);
+
+                /* Merge the capture index into the sidecar */
+                MUTEX_LOCK(&rx->file_mgmt.file_meta_lock);
+                if (rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+                    status = sigmf_meta_finish(&rx->file_mgmt.sigmf,
+                                               rx->file_mgmt.path);
+                    if (status != 0) {
+                        set_last_error(&rx->last_error, ETYPE_CLI, status);
+                    }
+                }
+                MUTEX_UNLOCK(&rx->file_mgmt.file_meta_lock);
+
                 rxtx_set_state(rx, RXTX_STATE_STOP);
                 break;
 
@@ -327,6 +609,10 @@ void *rx_task(void *cli_state_arg)
 static int rx_cmd_start(struct cli_state *s)
 {
     int status;
+    struct rx_params *rx_params = s->rx->params;
+    uint64_t rotate_bytes;
+    unsigned int rotate_secs;
+    uint64_t rotate_samples = 0;
 
     /* Check that we can start up in our current state */
     status = rxtx_cmd_start_check(s, s->rx, "rx");
@@ -334,9 +620,79 @@ static int rx_cmd_start(struct cli_state *s)
         return status;
     }
 
+    MUTEX_LOCK(&s->rx->param_lock);
+    if (rx_params->trigger != RX_TRIGGER_OFF &&
+        rx_params->trigcap.pre_samples == 0 &&
+        rx_params->trigcap.post_samples == 0) {
+        status = CLI_RET_INVPARAM;
+    }
+    MUTEX_UNLOCK(&s->rx->param_lock);
+
+    if (status != 0) {
+        cli_err(s, "rx", "The pre and post parameters may not both be 0 "
+                         "for triggered captures.\n");
+        return status;
+    }
+
+    MUTEX_LOCK(&s->rx->param_lock);
+    rotate_bytes = rx_params->rotate_bytes;
+    rotate_secs = rx_params->rotate_secs;
+    MUTEX_UNLOCK(&s->rx->param_lock);
+
+    if (rotate_bytes != 0 || rotate_secs != 0) {
+        if (s->rx->file_mgmt.format != RXTX_FMT_BIN_SC16Q11) {
+            cli_err(s, "rx", "Split captures (rotate_size, rotate_time) "
+                             "require the bin format.\n");
+            return CLI_RET_INVPARAM;
+        }
+
+        /* Time limits are applied using the sample timestamps */
+        if (rotate_secs != 0) {
+            unsigned int rate;
+
+            status = bladerf_get_sample_rate(s->dev, BLADERF_MODULE_RX, &rate);
+            if (status != 0) {
+                s->last_lib_error = status;
+                return CLI_RET_LIBBLADERF;
+            }
+
+            rotate_samples = (uint64_t) rotate_secs * rate;
+        }
+    }
+
+    /* Record the device configuration for the capture metadata */
+    if (s->rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+        MUTEX_LOCK(&s->rx->file_mgmt.file_meta_lock);
+        status = sigmf_meta_start(&s->rx->file_mgmt.sigmf, s->dev);
+        if (status != 0) {
+            MUTEX_UNLOCK(&s->rx->file_mgmt.file_meta_lock);
+            s->last_lib_error = status;
+            return CLI_RET_LIBBLADERF;
+        }
+
+        /* Write the sidecar up front and begin the capture index, so an
+         * interrupted capture still leaves usable metadata behind */
+        status = sigmf_meta_open(&s->rx->file_mgmt.sigmf,
+                                 s->rx->file_mgmt.path);
+        if (status != 0) {
+            sigmf_meta_abort(&s->rx->file_mgmt.sigmf, s->rx->file_mgmt.path);
+        }
+        MUTEX_UNLOCK(&s->rx->file_mgmt.file_meta_lock);
+
+        if (status != 0) {
+            return status;
+        }
+    }
+
     /* Set up output file */
     MUTEX_LOCK(&s->rx->file_mgmt.file_lock);
-    if(s->rx->file_mgmt.format == RXTX_FMT_CSV_SC16Q11) {
+    if (rotate_bytes != 0 || rotate_samples != 0) {
+        status = rotator_start(&s->rx->file_mgmt.rotator,
+                               s->rx->file_mgmt.path,
+                               rotate_bytes, rotate_samples,
+                               &s->rx->file_mgmt.file);
+
+    } else if(s->rx->file_mgmt.format == RXTX_FMT_CSV_SC16Q11) {
         status = expand_and_open(s->rx->file_mgmt.path, "w",
                                  &s->rx->file_mgmt.file);
 
@@ -348,6 +704,12 @@ static int rx_cmd_start(struct cli_state *s)
     MUTEX_UNLOCK(&s->rx->file_mgmt.file_lock);
 
     if (status != 0) {
+        if (s->rx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+            MUTEX_LOCK(&s->rx->file_mgmt.file_meta_lock);
+            sigmf_meta_abort(&s->rx->file_mgmt.sigmf, s->rx->file_mgmt.path);
+            MUTEX_UNLOCK(&s->rx->file_mgmt.file_meta_lock);
+        }
+
         return status;
     }
 
@@ -368,10 +730,18 @@ static int rx_cmd_start(struct cli_state *s)
 static void rx_print_config(struct rxtx_data *rx)
 {
     size_t n_samples;
+    enum rx_trigger trigger;
+    struct trigcap_config trigcap;
+    uint64_t rotate_bytes;
+    unsigned int rotate_secs;
     struct rx_params *rx_params = rx->params;
 
     MUTEX_LOCK(&rx->param_lock);
     n_samples = rx_params->n_samples;
+    trigger = rx_params->trigger;
+    trigcap = rx_params->trigcap;
+    rotate_bytes = rx_params->rotate_bytes;
+    rotate_secs = rx_params->rotate_secs;
     MUTEX_UNLOCK(&rx->param_lock);
 
     rxtx_print_state(rx, "\n  State: ", "\n");
@@ -379,11 +749,29 @@ static void rx_print_config(struct rxtx_data *rx)
     rxtx_print_file(rx, "  File: ", "\n");
     rxtx_print_file_format(rx, "  File format: ", "\n");
 
-    if (n_samples) {
+    if (trigger != RX_TRIGGER_OFF) {
+        if (trigger == RX_TRIGGER_POWER) {
+            printf("  Trigger: power >= %.1f dBFS\n", trigcap.threshold_dbfs);
+        } else {
+            printf("  Trigger: external\n");
+        }
+
+        printf("  Pre-trigger samples: %" PRIu64 "\n", trigcap.pre_samples);
+        printf("  Post-trigger samples: %" PRIu64 "\n", trigcap.post_samples);
+    } else if (n_samples) {
         printf("  # Samples: %" PRIu64  "\n", (uint64_t)n_samples);
     } else {
         printf("  # Samples: infinite\n");
     }
+
+    if (rotate_bytes != 0) {
+        printf("  Split files at: %" PRIu64 " bytes\n", rotate_bytes);
+    }
+
+    if (rotate_secs != 0) {
+        printf("  Split files every: %u s\n", rotate_secs);
+    }
+
     rxtx_print_stream_info(rx, "  ", "\n");
 
     printf("\n");
@@ -426,6 +814,133 @@ static int rx_cmd_config(struct cli_state *s, int argc, char **argv)
                     return CLI_RET_INVPARAM;
                 }
 
+            } else if (!strcasecmp("trigger", argv[i])) {
+                /* Configure trigger capture mode */
+                enum rx_trigger trigger;
+
+                if (!strcasecmp("off", val)) {
+                    trigger = RX_TRIGGER_OFF;
+                } else if (!strcasecmp("power", val)) {
+                    trigger = RX_TRIGGER_POWER;
+                } else if (!strcasecmp("ext", val)) {
+                    trigger = RX_TRIGGER_EXT;
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+                MUTEX_LOCK(&s->rx->param_lock);
+                rx_params->trigger = trigger;
+                MUTEX_UNLOCK(&s->rx->param_lock);
+
+            } else if (!strcasecmp("pre", argv[i]) ||
+                       !strcasecmp("post", argv[i])) {
+                /* Configure samples captured around the trigger point */
+                uint64_t n;
+                bool ok;
+
+                n = str2uint64_suffix(val, 0, UINT32_MAX, rxtx_kmg_suffixes,
+                                      rxtx_kmg_suffixes_len, &ok);
+
+                if (ok) {
+                    MUTEX_LOCK(&s->rx->param_lock);
+                    if (!strcasecmp("pre", argv[i])) {
+                        rx_params->trigcap.pre_samples = n;
+                    } else {
+                        rx_params->trigcap.post_samples = n;
+                    }
+                    MUTEX_UNLOCK(&s->rx->param_lock);
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+            } else if (!strcasecmp("threshold", argv[i])) {
+                /* Configure power trigger threshold, in dBFS */
+                double threshold;
+                bool ok;
+
+                threshold = str2double(val, -120.0, -0.1, &ok);
+
+                if (ok) {
+                    MUTEX_LOCK(&s->rx->param_lock);
+                    rx_params->trigcap.threshold_dbfs = threshold;
+                    MUTEX_UNLOCK(&s->rx->param_lock);
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+            } else if (!strcasecmp("rotate_size", argv[i])) {
+                /* Configure split capture file size limit */
+                uint64_t n;
+                bool ok;
+
+                n = str2uint64_suffix(val, 0, UINT64_MAX, rxtx_kmg_suffixes,
+                                      rxtx_kmg_suffixes_len, &ok);
+
+                if (ok) {
+                    MUTEX_LOCK(&s->rx->param_lock);
+                    rx_params->rotate_bytes = n;
+                    MUTEX_UNLOCK(&s->rx->param_lock);
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+            } else if (!strcasecmp("rotate_time", argv[i])) {
+                /* Configure split capture duration limit, in seconds */
+                unsigned int secs;
+                bool ok;
+
+                secs = str2uint_suffix(val, 0, UINT_MAX, rx_time_suffixes,
+                                       ARRAY_SIZE(rx_time_suffixes), &ok);
+
+                if (ok) {
+                    MUTEX_LOCK(&s->rx->param_lock);
+                    rx_params->rotate_secs = secs;
+                    MUTEX_UNLOCK(&s->rx->param_lock);
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+            } else if (!strcasecmp("preproc", argv[i])) {
+                /* Configure compressed format preprocessor */
+                enum cmp_preproc preproc;
+                bool ok;
+
+                preproc = cmp_str2preproc(val, &ok);
+
+                if (ok) {
+                    MUTEX_LOCK(&s->rx->file_mgmt.file_meta_lock);
+                    s->rx->file_mgmt.cmp.preproc = preproc;
+                    MUTEX_UNLOCK(&s->rx->file_mgmt.file_meta_lock);
+                } else {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                }
+
+            } else if (!strcasecmp("level", argv[i])) {
+                /* Configure compressed format DEFLATE level */
+                unsigned int level;
+                bool ok;
+
+                level = str2uint(val, 0, 9, &ok);
+
+                if (!ok) {
+                    cli_err(s, argv[0], RXTX_ERRMSG_VALUE(argv[i], val));
+                    return CLI_RET_INVPARAM;
+                } else if (level != 0 && !cmp_deflate_supported()) {
+                    cli_err(s, argv[0], "DEFLATE support is not available in "
+                            "this build. Only level=0 may be used.\n");
+                    return CLI_RET_INVPARAM;
+                }
+
+                MUTEX_LOCK(&s->rx->file_mgmt.file_meta_lock);
+                s->rx->file_mgmt.cmp.level = level;
+                MUTEX_UNLOCK(&s->rx->file_mgmt.file_meta_lock);
+
             } else {
                 cli_err(s, argv[0],
                         "Unrecognized config parameter: %s\n", argv[i]);
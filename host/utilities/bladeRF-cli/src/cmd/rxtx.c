@@ -207,6 +207,7 @@ void rxtx_print_file_format(struct rxtx_data *rxtx,
                             const char *prefix, const char *suffix)
 {
     enum rxtx_fmt fmt;
+    struct cmp_params cmp;
 
     MUTEX_LOCK(&rxtx->file_mgmt.file_meta_lock);
     fmt = rxtx->file_mgmt.format;
@@ -219,6 +220,21 @@ void rxtx_print_file_format(struct rxtx_data *rxtx,
         case RXTX_FMT_BIN_SC16Q11:
             printf("%sSC16 Q11, Binary%s", prefix, suffix);
             break;
+        case RXTX_FMT_SIGMF_SC16Q11:
+            printf("%sSC16 Q11, SigMF%s", prefix, suffix);
+            break;
+        case RXTX_FMT_CMP_SC16Q11:
+            MUTEX_LOCK(&rxtx->file_mgmt.file_meta_lock);
+            cmp = rxtx->file_mgmt.cmp;
+            MUTEX_UNLOCK(&rxtx->file_mgmt.file_meta_lock);
+
+            printf("%sSC16 Q11, Compressed (", prefix);
+            if (rxtx->module == BLADERF_MODULE_RX) {
+                printf("preproc=%s, level=%u, ",
+                       cmp_preproc2str(cmp.preproc), cmp.level);
+            }
+            printf("threads=%u)%s", cmp.threads, suffix);
+            break;
         default:
             printf("%sNot configured%s", prefix, suffix);
     }
@@ -280,6 +296,10 @@ enum rxtx_fmt rxtx_str2fmt(const char *str)
         ret = RXTX_FMT_CSV_SC16Q11;
     } else if (!strcasecmp("bin", str)) {
         ret = RXTX_FMT_BIN_SC16Q11;
+    } else if (!strcasecmp("sigmf", str)) {
+        ret = RXTX_FMT_SIGMF_SC16Q11;
+    } else if (!strcasecmp("compressed", str)) {
+        ret = RXTX_FMT_CMP_SC16Q11;
     }
 
     return ret;
@@ -309,6 +329,17 @@ struct rxtx_data *rxtx_data_alloc(bladerf_module module)
             return NULL;
         } else {
             rx_params->n_samples = 100000;
+            rx_params->trigger = RX_TRIGGER_OFF;
+            rx_params->tc = NULL;
+
+            trigcap_config_init(&rx_params->trigcap);
+            rx_params->trigcap.pre_samples = 1024 * 1024;
+            rx_params->trigcap.post_samples = 1024 * 1024;
+            rx_params->trigcap.threshold_dbfs = -20.0;
+
+            rx_params->rotate_bytes = 0;
+            rx_params->rotate_secs = 0;
+
             ret->params = rx_params;
         }
     } else {
@@ -338,6 +369,11 @@ struct rxtx_data *rxtx_data_alloc(bladerf_module module)
     ret->file_mgmt.file = NULL;
     ret->file_mgmt.path = NULL;
     ret->file_mgmt.format = RXTX_FMT_BIN_SC16Q11;
+    sigmf_meta_init(&ret->file_mgmt.sigmf, module);
+    cmp_params_init(&ret->file_mgmt.cmp);
+    ret->file_mgmt.cmp_writer = NULL;
+    ret->file_mgmt.cmp_reader = NULL;
+    ret->file_mgmt.rotator = NULL;
     MUTEX_INIT(&ret->file_mgmt.file_lock);
     MUTEX_INIT(&ret->file_mgmt.file_meta_lock);
 
@@ -415,6 +451,51 @@ void rxtx_shutdown(struct cli_state *s, struct rxtx_data *rxtx)
     }
 
     free(rxtx->file_mgmt.path);
+    sigmf_meta_deinit(&rxtx->file_mgmt.sigmf);
+}
+
+void rxtx_notify_retune(struct rxtx_data *rxtx, unsigned int frequency)
+{
+    MUTEX_LOCK(&rxtx->file_mgmt.file_meta_lock);
+    sigmf_meta_retune(&rxtx->file_mgmt.sigmf, frequency);
+    MUTEX_UNLOCK(&rxtx->file_mgmt.file_meta_lock);
+}
+
+void rxtx_notify_trigger(struct rxtx_data *rxtx, uint64_t timestamp)
+{
+    struct rx_params *rx_params;
+
+    if (rxtx->module != BLADERF_MODULE_RX) {
+        return;
+    }
+
+    rx_params = rxtx->params;
+
+    MUTEX_LOCK(&rxtx->param_lock);
+    if (rx_params->trigger == RX_TRIGGER_EXT && rx_params->tc != NULL) {
+        trigcap_fire(rx_params->tc, timestamp);
+    }
+    MUTEX_UNLOCK(&rxtx->param_lock);
+}
+
+bool rxtx_trigger_capture_armed(struct rxtx_data *rxtx)
+{
+    bool armed = false;
+    struct rx_params *rx_params;
+
+    if (rxtx->module != BLADERF_MODULE_RX) {
+        return false;
+    }
+
+    rx_params = rxtx->params;
+
+    MUTEX_LOCK(&rxtx->param_lock);
+    if (rx_params->trigger == RX_TRIGGER_EXT && rx_params->tc != NULL) {
+        armed = (trigcap_get_state(rx_params->tc) == TRIGCAP_STATE_ARMED);
+    }
+    MUTEX_UNLOCK(&rxtx->param_lock);
+
+    return armed;
 }
 
 void rxtx_data_free(struct rxtx_data *rxtx)
@@ -511,6 +592,18 @@ int rxtx_handle_config_param(struct cli_state *s, struct rxtx_data *rxtx,
                 MUTEX_UNLOCK(&rxtx->data_mgmt.lock);
                 status = 1;
             }
+        } else if (!strcasecmp("threads", param)) {
+            tmp = str2uint(*val, 1, CMP_THREADS_MAX, &ok);
+
+            if (!ok) {
+                cli_err(s, argv0, RXTX_ERRMSG_VALUE(param, *val));
+                status = CLI_RET_INVPARAM;
+            } else {
+                MUTEX_LOCK(&rxtx->file_mgmt.file_meta_lock);
+                rxtx->file_mgmt.cmp.threads = tmp;
+                MUTEX_UNLOCK(&rxtx->file_mgmt.file_meta_lock);
+                status = 1;
+            }
         } else if (!strcasecmp("timeout", param)) {
             tmp = str2uint_suffix(*val, 1, UINT_MAX, rxtx_time_suffixes,
                                   rxtx_time_suffixes_len, &ok);
@@ -22,6 +22,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <stdbool.h>
+#include <stdint.h>
 #include <libbladeRF.h>
 
 #include "common.h"
@@ -72,6 +73,35 @@ bool rxtx_task_running(struct rxtx_data *rxtx);
  */
 void rxtx_shutdown(struct cli_state *s, struct rxtx_data *rxtx);
 
+/**
+ * Notify the RX/TX task that the module's frequency has been changed. This
+ * is recorded in the capture metadata of formats that support it.
+ *
+ * @param   rxtx        RX/TX data handle
+ * @param   frequency   Frequency the module has been tuned to
+ */
+void rxtx_notify_retune(struct rxtx_data *rxtx, unsigned int frequency);
+
+/**
+ * Notify the RX task that a trigger has been fired. If the RX task is
+ * performing a capture with `trigger=ext`, the capture is triggered at the
+ * specified timestamp.
+ *
+ * @param   rxtx        RX data handle. No action is taken for TX handles.
+ * @param   timestamp   RX timestamp at which the trigger was fired
+ */
+void rxtx_notify_trigger(struct rxtx_data *rxtx, uint64_t timestamp);
+
+/**
+ * Test whether the RX task is waiting on a trigger to be fired
+ *
+ * @param   rxtx        RX data handle
+ *
+ * @return true if a `trigger=ext` capture is waiting on a trigger,
+ *         false otherwise
+ */
+bool rxtx_trigger_capture_armed(struct rxtx_data *rxtx);
+
 /**
  * Release any rx/tx wait commands
  *
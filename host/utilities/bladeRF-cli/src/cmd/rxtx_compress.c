@@ -0,0 +1,1130 @@
+/*
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef CLI_ENABLE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "rel_assert.h"
+#include "host_config.h"
+#include "thread.h"
+#include "minmax.h"
+#include "common.h"
+#include "rxtx_compress.h"
+
+#define CMP_FILE_MAGIC      "bRFz"
+#define CMP_INDEX_MAGIC     "bRFi"
+#define CMP_VERSION         1
+
+#define CMP_FILE_HDR_LEN    16
+#define CMP_BLOCK_HDR_LEN   16
+#define CMP_INDEX_ENTRY_LEN 16
+#define CMP_FOOTER_LEN      16
+
+/* Bytes per sample, without any preprocessing */
+#define CMP_SAMPLE_BYTES    (2 * sizeof(int16_t))
+
+/* Worst case DEFLATE expansion, rounded up generously from zlib's
+ * compressBound(). Blocks that would expand are stored uncompressed, but
+ * the codec still needs room to try. */
+#define CMP_BOUND(n)        ((n) + ((n) >> 8) + 64)
+
+/* Two slots per thread keeps every worker busy while the consumer handles
+ * completed blocks */
+#define CMP_SLOTS_PER_THREAD 2
+
+enum slot_state {
+    SLOT_FREE,          /* Available to the consumer */
+    SLOT_QUEUED,        /* Awaiting a worker */
+    SLOT_BUSY,          /* Being processed by a worker */
+    SLOT_DONE,          /* Processed; awaiting the consumer */
+};
+
+struct cmp_slot {
+    enum slot_state state;
+    int status;                 /* Result of processing */
+
+    int16_t *samples;           /* Host-endian samples */
+    size_t num_samples;
+
+    uint16_t *values;           /* Transformed I/Q values */
+    uint8_t *packed;            /* Preprocessed bytes */
+    uint8_t *block;             /* Block header + payload */
+    size_t block_len;
+};
+
+struct cmp_pool {
+    pthread_t *threads;
+    unsigned int num_threads;
+    bool threads_started;
+
+    struct cmp_slot *slots;
+    unsigned int num_slots;
+
+    /* Jobs are submitted to, taken from, and retired from the slot ring in
+     * order. Slot i is used by jobs i, i + num_slots, ... */
+    uint64_t submitted;
+    uint64_t taken;
+    uint64_t retired;
+
+    bool shutdown;
+    MUTEX lock;
+    pthread_cond_t work_avail;
+    pthread_cond_t work_done;
+
+    int (*process)(struct cmp_pool *pool, struct cmp_slot *slot);
+    enum cmp_preproc preproc;
+    unsigned int level;
+};
+
+struct cmp_writer {
+    struct cmp_pool pool;
+    FILE *f;
+    unsigned int samples_per_block;
+
+    uint64_t file_offset;       /* Offset of the next block to be written */
+    uint64_t num_samples;       /* Samples written so far */
+
+    uint64_t *index;            /* (file offset, first sample) pairs */
+    size_t num_blocks;
+    size_t max_blocks;
+};
+
+struct cmp_reader {
+    struct cmp_pool pool;
+    FILE *f;
+    unsigned int samples_per_block;
+    size_t max_block_len;
+
+    uint64_t *index;            /* (file offset, first sample) pairs */
+    size_t num_blocks;
+    uint64_t num_samples;
+
+    size_t next_block;          /* Next block to read from the file */
+    struct cmp_slot *cur;       /* Block currently being consumed */
+    size_t cur_pos;             /* Position within cur->samples */
+    size_t skip;                /* Samples to skip in the next block */
+};
+
+static inline void put_le16(uint8_t *buf, uint16_t val)
+{
+    buf[0] = val & 0xff;
+    buf[1] = (val >> 8) & 0xff;
+}
+
+static inline void put_le32(uint8_t *buf, uint32_t val)
+{
+    put_le16(buf, val & 0xffff);
+    put_le16(buf + 2, val >> 16);
+}
+
+static inline void put_le64(uint8_t *buf, uint64_t val)
+{
+    put_le32(buf, (uint32_t) val);
+    put_le32(buf + 4, (uint32_t) (val >> 32));
+}
+
+static inline uint16_t get_le16(const uint8_t *buf)
+{
+    return (uint16_t) (buf[0] | (buf[1] << 8));
+}
+
+static inline uint32_t get_le32(const uint8_t *buf)
+{
+    return get_le16(buf) | ((uint32_t) get_le16(buf + 2) << 16);
+}
+
+static inline uint64_t get_le64(const uint8_t *buf)
+{
+    return get_le32(buf) | ((uint64_t) get_le32(buf + 4) << 32);
+}
+
+static int file_seek(FILE *f, uint64_t offset)
+{
+#if BLADERF_OS_WINDOWS
+    return _fseeki64(f, (__int64) offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t) offset, SEEK_SET);
+#endif
+}
+
+static int file_size(FILE *f, uint64_t *size)
+{
+#if BLADERF_OS_WINDOWS
+    __int64 pos;
+    if (_fseeki64(f, 0, SEEK_END) != 0 || (pos = _ftelli64(f)) < 0) {
+        return -1;
+    }
+#else
+    off_t pos;
+    if (fseeko(f, 0, SEEK_END) != 0 || (pos = ftello(f)) < 0) {
+        return -1;
+    }
+#endif
+
+    *size = (uint64_t) pos;
+    return 0;
+}
+
+/*******************************************************************************
+ * Block encoding
+ ******************************************************************************/
+
+static inline uint16_t zigzag(int16_t v)
+{
+    const uint16_t u = (uint16_t) v;
+    return (uint16_t) ((u << 1) ^ (uint16_t) (0 - (u >> 15)));
+}
+
+static inline int16_t unzigzag(uint16_t z)
+{
+    return (int16_t) ((z >> 1) ^ (uint16_t) (0 - (z & 1)));
+}
+
+/* Pack `n` values of `width` bits each, LSB first. Packing unmodified values
+ * with a width of 16 yields little-endian int16_t's. */
+static size_t pack_bits(const uint16_t *in, size_t n, unsigned int width,
+                        uint8_t *out)
+{
+    size_t i;
+    uint64_t acc = 0;
+    unsigned int acc_bits = 0;
+    uint8_t *start = out;
+
+    for (i = 0; i < n; i++) {
+        acc |= (uint64_t) in[i] << acc_bits;
+        acc_bits += width;
+
+        while (acc_bits >= 8) {
+            *out++ = (uint8_t) acc;
+            acc >>= 8;
+            acc_bits -= 8;
+        }
+    }
+
+    if (acc_bits != 0) {
+        *out++ = (uint8_t) acc;
+    }
+
+    return (size_t) (out - start);
+}
+
+static void unpack_bits(const uint8_t *in, size_t n, unsigned int width,
+                        uint16_t *out)
+{
+    size_t i;
+    uint64_t acc = 0;
+    unsigned int acc_bits = 0;
+    const uint64_t mask = (1u << width) - 1;
+
+    for (i = 0; i < n; i++) {
+        while (acc_bits < width) {
+            acc |= (uint64_t) *in++ << acc_bits;
+            acc_bits += 8;
+        }
+
+        out[i] = (uint16_t) (acc & mask);
+        acc >>= width;
+        acc_bits -= width;
+    }
+}
+
+static inline size_t packed_len(size_t n_values, unsigned int width)
+{
+    return (n_values * width + 7) / 8;
+}
+
+/* Apply the preprocessor's transform, returning the number of bits required
+ * to represent the largest transformed value */
+static unsigned int transform(enum cmp_preproc preproc, const int16_t *in,
+                              size_t n_values, uint16_t *out)
+{
+    size_t i;
+    uint16_t all = 0;
+    unsigned int width;
+    int16_t prev_i = 0, prev_q = 0;
+
+    switch (preproc) {
+        case CMP_PREPROC_PACK:
+            for (i = 0; i < n_values; i++) {
+                out[i] = zigzag(in[i]);
+                all |= out[i];
+            }
+            break;
+
+        case CMP_PREPROC_DELTA:
+            for (i = 0; i < n_values; i += 2) {
+                out[i]     = zigzag((int16_t) (uint16_t) (in[i] - prev_i));
+                out[i + 1] = zigzag((int16_t) (uint16_t) (in[i + 1] - prev_q));
+                prev_i = in[i];
+                prev_q = in[i + 1];
+                all |= out[i] | out[i + 1];
+            }
+            break;
+
+        default:
+            memcpy(out, in, n_values * sizeof(out[0]));
+            return 16;
+    }
+
+    for (width = 0; all != 0; width++) {
+        all >>= 1;
+    }
+
+    return width;
+}
+
+static void untransform(enum cmp_preproc preproc, const uint16_t *in,
+                        size_t n_values, int16_t *out)
+{
+    size_t i;
+    int16_t prev_i = 0, prev_q = 0;
+
+    switch (preproc) {
+        case CMP_PREPROC_PACK:
+            for (i = 0; i < n_values; i++) {
+                out[i] = unzigzag(in[i]);
+            }
+            break;
+
+        case CMP_PREPROC_DELTA:
+            for (i = 0; i < n_values; i += 2) {
+                prev_i = (int16_t) (uint16_t) (prev_i + unzigzag(in[i]));
+                prev_q = (int16_t) (uint16_t) (prev_q + unzigzag(in[i + 1]));
+                out[i] = prev_i;
+                out[i + 1] = prev_q;
+            }
+            break;
+
+        default:
+            memcpy(out, in, n_values * sizeof(out[0]));
+    }
+}
+
+static int encode_block(struct cmp_pool *pool, struct cmp_slot *slot)
+{
+    const size_t n_values = 2 * slot->num_samples;
+    uint8_t *hdr = slot->block;
+    uint8_t *payload = slot->block + CMP_BLOCK_HDR_LEN;
+    enum cmp_codec codec = CMP_CODEC_NONE;
+    unsigned int width;
+    size_t raw_len, payload_len;
+
+    width = transform(pool->preproc, slot->samples, n_values, slot->values);
+
+    if (pool->level == 0) {
+        raw_len = pack_bits(slot->values, n_values, width, payload);
+        payload_len = raw_len;
+    } else {
+#ifdef CLI_ENABLE_ZLIB
+        uLongf dest_len = (uLongf) CMP_BOUND(n_values * sizeof(int16_t));
+
+        raw_len = pack_bits(slot->values, n_values, width, slot->packed);
+
+        if (compress2(payload, &dest_len, slot->packed, (uLong) raw_len,
+                      (int) pool->level) == Z_OK && dest_len < raw_len) {
+            codec = CMP_CODEC_DEFLATE;
+            payload_len = dest_len;
+        } else {
+            /* Incompressible; store the preprocessed data as-is */
+            memcpy(payload, slot->packed, raw_len);
+            payload_len = raw_len;
+        }
+#else
+        return CLI_RET_UNKNOWN;
+#endif
+    }
+
+    hdr[0] = (uint8_t) pool->preproc;
+    hdr[1] = (uint8_t) width;
+    hdr[2] = (uint8_t) codec;
+    hdr[3] = 0;
+    put_le32(&hdr[4], (uint32_t) slot->num_samples);
+    put_le32(&hdr[8], (uint32_t) raw_len);
+    put_le32(&hdr[12], (uint32_t) payload_len);
+
+    slot->block_len = CMP_BLOCK_HDR_LEN + payload_len;
+    return 0;
+}
+
+static int decode_block(struct cmp_pool *pool, struct cmp_slot *slot)
+{
+    const uint8_t *hdr = slot->block;
+    const uint8_t *payload = slot->block + CMP_BLOCK_HDR_LEN;
+    const uint8_t *packed;
+    const enum cmp_preproc preproc = (enum cmp_preproc) hdr[0];
+    const unsigned int width = hdr[1];
+    const enum cmp_codec codec = (enum cmp_codec) hdr[2];
+    const size_t n_samples = get_le32(&hdr[4]);
+    const size_t raw_len = get_le32(&hdr[8]);
+    const size_t payload_len = get_le32(&hdr[12]);
+
+    /* Decoding is fully described by the block header */
+    (void) pool;
+
+    /* The block's length and sample count have already been validated
+     * against our buffer sizes when it was read */
+    if (preproc > CMP_PREPROC_DELTA || width > 16 ||
+        (preproc == CMP_PREPROC_NONE && width != 16) ||
+        raw_len != packed_len(2 * n_samples, width)) {
+        return CLI_RET_FILEOP;
+    }
+
+    switch (codec) {
+        case CMP_CODEC_NONE:
+            if (payload_len != raw_len) {
+                return CLI_RET_FILEOP;
+            }
+            packed = payload;
+            break;
+
+#ifdef CLI_ENABLE_ZLIB
+        case CMP_CODEC_DEFLATE: {
+            uLongf dest_len = (uLongf) raw_len;
+            if (uncompress(slot->packed, &dest_len, payload,
+                           (uLong) payload_len) != Z_OK ||
+                dest_len != raw_len) {
+                return CLI_RET_FILEOP;
+            }
+            packed = slot->packed;
+            break;
+        }
+#endif
+
+        default:
+            /* Unknown codec, or one not compiled in */
+            return CLI_RET_INVPARAM;
+    }
+
+    unpack_bits(packed, 2 * n_samples, width, slot->values);
+    untransform(preproc, slot->values, 2 * n_samples, slot->samples);
+    slot->num_samples = n_samples;
+
+    return 0;
+}
+
+/*******************************************************************************
+ * Worker pool
+ ******************************************************************************/
+
+static void *pool_worker(void *arg)
+{
+    struct cmp_pool *pool = (struct cmp_pool *) arg;
+    struct cmp_slot *slot;
+    int status;
+
+    MUTEX_LOCK(&pool->lock);
+
+    while (true) {
+        while (!pool->shutdown && pool->taken == pool->submitted) {
+            pthread_cond_wait(&pool->work_avail, &pool->lock);
+        }
+
+        if (pool->shutdown) {
+            break;
+        }
+
+        slot = &pool->slots[pool->taken % pool->num_slots];
+        pool->taken++;
+        slot->state = SLOT_BUSY;
+        MUTEX_UNLOCK(&pool->lock);
+
+        status = pool->process(pool, slot);
+
+        MUTEX_LOCK(&pool->lock);
+        slot->status = status;
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pool->work_done);
+    }
+
+    MUTEX_UNLOCK(&pool->lock);
+    return NULL;
+}
+
+static void pool_deinit(struct cmp_pool *pool)
+{
+    unsigned int i;
+
+    if (pool->threads_started) {
+        MUTEX_LOCK(&pool->lock);
+        pool->shutdown = true;
+        pthread_cond_broadcast(&pool->work_avail);
+        MUTEX_UNLOCK(&pool->lock);
+
+        for (i = 0; i < pool->num_threads; i++) {
+            pthread_join(pool->threads[i], NULL);
+        }
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work_avail);
+        pthread_cond_destroy(&pool->work_done);
+    }
+
+    if (pool->slots != NULL) {
+        for (i = 0; i < pool->num_slots; i++) {
+            free(pool->slots[i].samples);
+            free(pool->slots[i].values);
+            free(pool->slots[i].packed);
+            free(pool->slots[i].block);
+        }
+    }
+
+    free(pool->slots);
+    free(pool->threads);
+}
+
+static int pool_init(struct cmp_pool *pool, unsigned int num_threads,
+                     size_t samples_per_block, size_t max_block_len,
+                     int (*process)(struct cmp_pool *, struct cmp_slot *))
+{
+    unsigned int i;
+    const size_t n_values = 2 * samples_per_block;
+
+    memset(pool, 0, sizeof(*pool));
+
+    num_threads = uint_max(1, uint_min(num_threads, CMP_THREADS_MAX));
+    pool->num_threads = num_threads;
+    pool->num_slots = CMP_SLOTS_PER_THREAD * num_threads;
+    pool->process = process;
+
+    pool->threads = calloc(pool->num_threads, sizeof(pool->threads[0]));
+    pool->slots = calloc(pool->num_slots, sizeof(pool->slots[0]));
+    if (pool->threads == NULL || pool->slots == NULL) {
+        goto fail;
+    }
+
+    for (i = 0; i < pool->num_slots; i++) {
+        struct cmp_slot *slot = &pool->slots[i];
+
+        slot->state = SLOT_FREE;
+        slot->samples = malloc(n_values * sizeof(slot->samples[0]));
+        slot->values = malloc(n_values * sizeof(slot->values[0]));
+        slot->packed = malloc(n_values * sizeof(int16_t));
+        slot->block = malloc(max_block_len);
+
+        if (slot->samples == NULL || slot->values == NULL ||
+            slot->packed == NULL || slot->block == NULL) {
+            goto fail;
+        }
+    }
+
+    MUTEX_INIT(&pool->lock);
+    pthread_cond_init(&pool->work_avail, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->threads_started = true;
+
+    for (i = 0; i < pool->num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0) {
+            /* Only join the threads that were actually started */
+            pool->num_threads = i;
+            goto fail;
+        }
+    }
+
+    return 0;
+
+fail:
+    pool_deinit(pool);
+    return CLI_RET_MEM;
+}
+
+/* Slot that the next job will be submitted to */
+static inline struct cmp_slot *pool_next_slot(struct cmp_pool *pool)
+{
+    return &pool->slots[pool->submitted % pool->num_slots];
+}
+
+/* Oldest slot that has not yet been retired */
+static inline struct cmp_slot *pool_oldest_slot(struct cmp_pool *pool)
+{
+    return &pool->slots[pool->retired % pool->num_slots];
+}
+
+static inline bool pool_full(struct cmp_pool *pool)
+{
+    return pool->submitted - pool->retired == pool->num_slots;
+}
+
+static inline bool pool_empty(struct cmp_pool *pool)
+{
+    return pool->submitted == pool->retired;
+}
+
+static void pool_submit(struct cmp_pool *pool)
+{
+    MUTEX_LOCK(&pool->lock);
+    pool_next_slot(pool)->state = SLOT_QUEUED;
+    pool->submitted++;
+    pthread_cond_signal(&pool->work_avail);
+    MUTEX_UNLOCK(&pool->lock);
+}
+
+/* Wait for the oldest outstanding job to complete */
+static int pool_wait_oldest(struct cmp_pool *pool)
+{
+    struct cmp_slot *slot = pool_oldest_slot(pool);
+    int status;
+
+    MUTEX_LOCK(&pool->lock);
+    while (slot->state != SLOT_DONE) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    status = slot->status;
+    MUTEX_UNLOCK(&pool->lock);
+
+    return status;
+}
+
+static bool pool_oldest_done(struct cmp_pool *pool)
+{
+    bool done;
+
+    MUTEX_LOCK(&pool->lock);
+    done = pool_oldest_slot(pool)->state == SLOT_DONE;
+    MUTEX_UNLOCK(&pool->lock);
+
+    return done;
+}
+
+static inline void pool_retire_oldest(struct cmp_pool *pool)
+{
+    pool_oldest_slot(pool)->state = SLOT_FREE;
+    pool->retired++;
+}
+
+/*******************************************************************************
+ * Parameters
+ ******************************************************************************/
+
+void cmp_params_init(struct cmp_params *p)
+{
+    p->threads = CMP_THREADS_DEFAULT;
+    p->preproc = CMP_PREPROC_DELTA;
+#ifdef CLI_ENABLE_ZLIB
+    p->level = 1;
+#else
+    p->level = 0;
+#endif
+}
+
+bool cmp_deflate_supported(void)
+{
+#ifdef CLI_ENABLE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *cmp_preproc2str(enum cmp_preproc preproc)
+{
+    switch (preproc) {
+        case CMP_PREPROC_NONE:
+            return "none";
+        case CMP_PREPROC_PACK:
+            return "pack";
+        case CMP_PREPROC_DELTA:
+            return "delta";
+        default:
+            return "unknown";
+    }
+}
+
+enum cmp_preproc cmp_str2preproc(const char *str, bool *ok)
+{
+    *ok = true;
+
+    if (!strcasecmp(str, "none")) {
+        return CMP_PREPROC_NONE;
+    } else if (!strcasecmp(str, "pack")) {
+        return CMP_PREPROC_PACK;
+    } else if (!strcasecmp(str, "delta")) {
+        return CMP_PREPROC_DELTA;
+    }
+
+    *ok = false;
+    return CMP_PREPROC_NONE;
+}
+
+/*******************************************************************************
+ * Writer
+ ******************************************************************************/
+
+/* Write the oldest block to the file, once it has been encoded */
+static int writer_flush_oldest(struct cmp_writer *w)
+{
+    struct cmp_slot *slot = pool_oldest_slot(&w->pool);
+    int status;
+
+    status = pool_wait_oldest(&w->pool);
+    if (status != 0) {
+        return status;
+    }
+
+    if (w->num_blocks == w->max_blocks) {
+        const size_t new_max = w->max_blocks == 0 ? 1024 : 2 * w->max_blocks;
+        uint64_t *tmp = realloc(w->index, 2 * new_max * sizeof(w->index[0]));
+
+        if (tmp == NULL) {
+            return CLI_RET_MEM;
+        }
+
+        w->index = tmp;
+        w->max_blocks = new_max;
+    }
+
+    if (fwrite(slot->block, 1, slot->block_len, w->f) != slot->block_len) {
+        return CLI_RET_FILEOP;
+    }
+
+    w->index[2 * w->num_blocks] = w->file_offset;
+    w->index[2 * w->num_blocks + 1] = w->num_samples;
+    w->num_blocks++;
+
+    w->file_offset += slot->block_len;
+    w->num_samples += slot->num_samples;
+
+    pool_retire_oldest(&w->pool);
+    return 0;
+}
+
+int cmp_writer_open(struct cmp_writer **w_out, FILE *f,
+                    const struct cmp_params *p,
+                    unsigned int samples_per_block)
+{
+    int status;
+    struct cmp_writer *w;
+    uint8_t hdr[CMP_FILE_HDR_LEN];
+    const size_t raw_max = samples_per_block * CMP_SAMPLE_BYTES;
+
+    *w_out = NULL;
+
+    if (p->level != 0 && !cmp_deflate_supported()) {
+        return CLI_RET_INVPARAM;
+    }
+
+    w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    w->f = f;
+    w->samples_per_block = samples_per_block;
+
+    status = pool_init(&w->pool, p->threads, samples_per_block,
+                       CMP_BLOCK_HDR_LEN + CMP_BOUND(raw_max), encode_block);
+    if (status != 0) {
+        free(w);
+        return status;
+    }
+
+    w->pool.preproc = p->preproc;
+    w->pool.level = p->level;
+
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, CMP_FILE_MAGIC, 4);
+    put_le16(&hdr[4], CMP_VERSION);
+    put_le32(&hdr[8], samples_per_block);
+
+    if (fwrite(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) {
+        pool_deinit(&w->pool);
+        free(w);
+        return CLI_RET_FILEOP;
+    }
+
+    w->file_offset = sizeof(hdr);
+    *w_out = w;
+    return 0;
+}
+
+int cmp_writer_write(struct cmp_writer *w, const int16_t *samples, size_t n)
+{
+    int status = 0;
+    struct cmp_slot *slot;
+
+    assert(n <= w->samples_per_block);
+
+    /* Write out any blocks that are ready without waiting on the workers,
+     * and only block when there are no slots left. */
+    while (status == 0 && !pool_empty(&w->pool) &&
+           (pool_full(&w->pool) || pool_oldest_done(&w->pool))) {
+        status = writer_flush_oldest(w);
+    }
+
+    if (status == 0) {
+        slot = pool_next_slot(&w->pool);
+        memcpy(slot->samples, samples, n * CMP_SAMPLE_BYTES);
+        slot->num_samples = n;
+        pool_submit(&w->pool);
+    }
+
+    return status;
+}
+
+int cmp_writer_close(struct cmp_writer *w)
+{
+    int status = 0;
+    size_t i;
+    uint8_t buf[CMP_INDEX_ENTRY_LEN];
+
+    while (status == 0 && !pool_empty(&w->pool)) {
+        status = writer_flush_oldest(w);
+    }
+
+    /* Append the block index and footer */
+    for (i = 0; status == 0 && i < w->num_blocks; i++) {
+        put_le64(&buf[0], w->index[2 * i]);
+        put_le64(&buf[8], w->index[2 * i + 1]);
+
+        if (fwrite(buf, 1, sizeof(buf), w->f) != sizeof(buf)) {
+            status = CLI_RET_FILEOP;
+        }
+    }
+
+    if (status == 0) {
+        put_le64(&buf[0], w->file_offset);
+        put_le32(&buf[8], (uint32_t) w->num_blocks);
+        memcpy(&buf[12], CMP_INDEX_MAGIC, 4);
+
+        if (fwrite(buf, 1, CMP_FOOTER_LEN, w->f) != CMP_FOOTER_LEN) {
+            status = CLI_RET_FILEOP;
+        }
+    }
+
+    pool_deinit(&w->pool);
+    free(w->index);
+    free(w);
+
+    return status;
+}
+
+/*******************************************************************************
+ * Reader
+ ******************************************************************************/
+
+static int reader_add_block(struct cmp_reader *r, size_t *max_blocks,
+                            uint64_t offset, uint64_t first_sample)
+{
+    if (r->num_blocks == *max_blocks) {
+        const size_t new_max = *max_blocks == 0 ? 1024 : 2 * (*max_blocks);
+        uint64_t *tmp = realloc(r->index, 2 * new_max * sizeof(r->index[0]));
+
+        if (tmp == NULL) {
+            return CLI_RET_MEM;
+        }
+
+        r->index = tmp;
+        *max_blocks = new_max;
+    }
+
+    r->index[2 * r->num_blocks] = offset;
+    r->index[2 * r->num_blocks + 1] = first_sample;
+    r->num_blocks++;
+
+    return 0;
+}
+
+/* Load the index written by cmp_writer_close() */
+static int reader_load_index(struct cmp_reader *r, uint64_t size)
+{
+    uint8_t buf[CMP_INDEX_ENTRY_LEN];
+    uint64_t index_offset;
+    size_t i, num_blocks, max_blocks = 0;
+    int status = 0;
+
+    if (size < CMP_FILE_HDR_LEN + CMP_FOOTER_LEN ||
+        file_seek(r->f, size - CMP_FOOTER_LEN) != 0 ||
+        fread(buf, 1, CMP_FOOTER_LEN, r->f) != CMP_FOOTER_LEN ||
+        memcmp(&buf[12], CMP_INDEX_MAGIC, 4)) {
+        return CLI_RET_FILEOP;
+    }
+
+    index_offset = get_le64(&buf[0]);
+    num_blocks = get_le32(&buf[8]);
+
+    if (index_offset + (uint64_t) num_blocks * CMP_INDEX_ENTRY_LEN +
+            CMP_FOOTER_LEN != size ||
+        file_seek(r->f, index_offset) != 0) {
+        return CLI_RET_FILEOP;
+    }
+
+    for (i = 0; i < num_blocks && status == 0; i++) {
+        if (fread(buf, 1, CMP_INDEX_ENTRY_LEN, r->f) != CMP_INDEX_ENTRY_LEN) {
+            status = CLI_RET_FILEOP;
+        } else {
+            status = reader_add_block(r, &max_blocks,
+                                      get_le64(&buf[0]), get_le64(&buf[8]));
+        }
+    }
+
+    return status;
+}
+
+/* Rebuild the index by walking the block headers. This is used when a
+ * capture was not closed cleanly. A trailing partial block is ignored. */
+static int reader_scan_blocks(struct cmp_reader *r, uint64_t size)
+{
+    uint8_t hdr[CMP_BLOCK_HDR_LEN];
+    uint64_t offset = CMP_FILE_HDR_LEN;
+    uint64_t first_sample = 0;
+    size_t max_blocks = 0;
+    int status = 0;
+
+    r->num_blocks = 0;
+
+    if (file_seek(r->f, offset) != 0) {
+        return CLI_RET_FILEOP;
+    }
+
+    while (status == 0 && offset + CMP_BLOCK_HDR_LEN <= size) {
+        uint64_t block_len;
+
+        if (fread(hdr, 1, sizeof(hdr), r->f) != sizeof(hdr)) {
+            break;
+        }
+
+        block_len = CMP_BLOCK_HDR_LEN + (uint64_t) get_le32(&hdr[12]);
+        if (offset + block_len > size || block_len > r->max_block_len) {
+            break;
+        }
+
+        status = reader_add_block(r, &max_blocks, offset, first_sample);
+
+        first_sample += get_le32(&hdr[4]);
+        offset += block_len;
+
+        if (file_seek(r->f, offset) != 0) {
+            status = CLI_RET_FILEOP;
+        }
+    }
+
+    return status;
+}
+
+/* Read blocks from the file and queue them for decoding, until all slots
+ * are in use */
+static int reader_fill(struct cmp_reader *r)
+{
+    while (!pool_full(&r->pool) && r->next_block < r->num_blocks) {
+        struct cmp_slot *slot = pool_next_slot(&r->pool);
+        size_t payload_len;
+
+        if (fread(slot->block, 1, CMP_BLOCK_HDR_LEN, r->f) !=
+                CMP_BLOCK_HDR_LEN) {
+            return CLI_RET_FILEOP;
+        }
+
+        payload_len = get_le32(&slot->block[12]);
+        if (CMP_BLOCK_HDR_LEN + payload_len > r->max_block_len ||
+            get_le32(&slot->block[4]) > r->samples_per_block) {
+            return CLI_RET_FILEOP;
+        }
+
+        if (fread(slot->block + CMP_BLOCK_HDR_LEN, 1, payload_len, r->f) !=
+                payload_len) {
+            return CLI_RET_FILEOP;
+        }
+
+        slot->block_len = CMP_BLOCK_HDR_LEN + payload_len;
+        r->next_block++;
+        pool_submit(&r->pool);
+    }
+
+    return 0;
+}
+
+int cmp_reader_open(struct cmp_reader **r_out, FILE *f, unsigned int threads)
+{
+    int status;
+    struct cmp_reader *r;
+    uint8_t hdr[CMP_FILE_HDR_LEN];
+    uint64_t size;
+    size_t raw_max;
+
+    *r_out = NULL;
+
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+        memcmp(hdr, CMP_FILE_MAGIC, 4) ||
+        get_le16(&hdr[4]) != CMP_VERSION ||
+        get_le32(&hdr[8]) == 0 || file_size(f, &size) != 0) {
+        return CLI_RET_INVPARAM;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    r->f = f;
+    r->samples_per_block = get_le32(&hdr[8]);
+    raw_max = r->samples_per_block * CMP_SAMPLE_BYTES;
+    r->max_block_len = CMP_BLOCK_HDR_LEN + CMP_BOUND(raw_max);
+
+    status = reader_load_index(r, size);
+    if (status != 0) {
+        status = reader_scan_blocks(r, size);
+    }
+
+    if (status != 0) {
+        free(r->index);
+        free(r);
+        return status;
+    }
+
+    if (r->num_blocks != 0) {
+        /* Determine the total length from the final block */
+        const uint64_t last = r->index[2 * (r->num_blocks - 1)];
+
+        if (file_seek(f, last) != 0 ||
+            fread(hdr, 1, CMP_BLOCK_HDR_LEN, f) != CMP_BLOCK_HDR_LEN) {
+            status = CLI_RET_FILEOP;
+        } else {
+            r->num_samples = r->index[2 * r->num_blocks - 1] +
+                             get_le32(&hdr[4]);
+        }
+    }
+
+    if (status == 0) {
+        status = pool_init(&r->pool, threads, r->samples_per_block,
+                           r->max_block_len, decode_block);
+    }
+
+    if (status == 0) {
+        status = cmp_reader_seek(r, 0);
+        if (status == CLI_RET_INVPARAM) {
+            /* Empty capture */
+            status = 0;
+        }
+
+        if (status != 0) {
+            pool_deinit(&r->pool);
+        }
+    }
+
+    if (status != 0) {
+        free(r->index);
+        free(r);
+    } else {
+        *r_out = r;
+    }
+
+    return status;
+}
+
+int cmp_reader_read(struct cmp_reader *r, int16_t *samples, size_t n,
+                    size_t *n_read)
+{
+    int status = 0;
+    size_t to_copy;
+
+    *n_read = 0;
+
+    while (*n_read < n) {
+        if (r->cur == NULL) {
+            status = reader_fill(r);
+            if (status != 0 || pool_empty(&r->pool)) {
+                /* Error or end of file */
+                break;
+            }
+
+            status = pool_wait_oldest(&r->pool);
+            if (status != 0) {
+                break;
+            }
+
+            r->cur = pool_oldest_slot(&r->pool);
+            r->cur_pos = min_sz(r->skip, r->cur->num_samples);
+            r->skip = 0;
+        }
+
+        to_copy = min_sz(n - *n_read, r->cur->num_samples - r->cur_pos);
+        memcpy(&samples[2 * (*n_read)], &r->cur->samples[2 * r->cur_pos],
+               to_copy * CMP_SAMPLE_BYTES);
+
+        *n_read += to_copy;
+        r->cur_pos += to_copy;
+
+        if (r->cur_pos == r->cur->num_samples) {
+            r->cur = NULL;
+            pool_retire_oldest(&r->pool);
+        }
+    }
+
+    return status;
+}
+
+int cmp_reader_seek(struct cmp_reader *r, uint64_t sample)
+{
+    size_t lo, hi, mid;
+
+    /* Discard anything that has been read ahead */
+    while (!pool_empty(&r->pool)) {
+        pool_wait_oldest(&r->pool);
+        pool_retire_oldest(&r->pool);
+    }
+
+    r->cur = NULL;
+    r->skip = 0;
+    r->next_block = r->num_blocks;
+
+    if (sample >= r->num_samples) {
+        return CLI_RET_INVPARAM;
+    }
+
+    /* All blocks but the last are normally full, so try a direct lookup
+     * before falling back to a search of the index */
+    mid = (size_t) (sample / r->samples_per_block);
+    if (mid >= r->num_blocks || r->index[2 * mid + 1] > sample ||
+        (mid + 1 < r->num_blocks && r->index[2 * (mid + 1) + 1] <= sample)) {
+
+        lo = 0;
+        hi = r->num_blocks - 1;
+        while (lo < hi) {
+            mid = lo + (hi - lo + 1) / 2;
+            if (r->index[2 * mid + 1] <= sample) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        mid = lo;
+    }
+
+    if (file_seek(r->f, r->index[2 * mid]) != 0) {
+        return CLI_RET_FILEOP;
+    }
+
+    r->next_block = mid;
+    r->skip = (size_t) (sample - r->index[2 * mid + 1]);
+
+    return 0;
+}
+
+void cmp_reader_close(struct cmp_reader *r)
+{
+    if (r != NULL) {
+        pool_deinit(&r->pool);
+        free(r->index);
+        free(r);
+    }
+}
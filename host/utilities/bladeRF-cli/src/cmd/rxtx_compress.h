@@ -0,0 +1,215 @@
+/**
+ * @file rxtx_compress.h
+ *
+ * @brief Block-compressed sample files for the rx and tx commands
+ *
+ * Each stream buffer is encoded as an independent block by a pool of worker
+ * threads, so encoding and decoding scale with the number of cores and any
+ * block may be decoded without reference to the others.
+ *
+ * File layout (all values little-endian):
+ *
+ *  File header
+ *      0x00  char[4]   Magic "bRFz"
+ *      0x04  uint16_t  Version
+ *      0x06  uint16_t  Reserved
+ *      0x08  uint32_t  Samples per block
+ *      0x0c  uint32_t  Reserved
+ *
+ *  Blocks, each consisting of a block header followed by its payload
+ *      0x00  uint8_t   Preprocessor (enum cmp_preproc)
+ *      0x01  uint8_t   Bits per packed value
+ *      0x02  uint8_t   Codec (enum cmp_codec)
+ *      0x03  uint8_t   Reserved
+ *      0x04  uint32_t  Number of samples
+ *      0x08  uint32_t  Length of the preprocessed data, in bytes
+ *      0x0c  uint32_t  Length of the payload, in bytes
+ *
+ *  Block index, written when the file is closed
+ *      0x00  uint64_t  File offset of block header
+ *      0x08  uint64_t  Index of the block's first sample
+ *      ...             (repeated for each block)
+ *
+ *  Footer
+ *      0x00  uint64_t  File offset of the block index
+ *      0x08  uint32_t  Number of blocks
+ *      0x0c  char[4]   Magic "bRFi"
+ *
+ * If the index is missing (e.g., the capture was interrupted), readers
+ * rebuild it by walking the block headers.
+ *
+ * Nothing outside of rxtx.c, rx.c, and tx.c should require anything
+ * defined in this file.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef RXTX_COMPRESS_H__
+#define RXTX_COMPRESS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Lossless transforms applied to each block prior to the codec */
+enum cmp_preproc {
+    CMP_PREPROC_NONE = 0,   /* Little-endian int16_t I, Q */
+    CMP_PREPROC_PACK,       /* Zig-zag encoded, bit-packed I, Q */
+    CMP_PREPROC_DELTA,      /* Per-channel deltas, zig-zag encoded and
+                             *   bit-packed */
+};
+
+enum cmp_codec {
+    CMP_CODEC_NONE = 0,     /* Preprocessed data is stored as-is */
+    CMP_CODEC_DEFLATE,      /* zlib DEFLATE */
+};
+
+#define CMP_THREADS_DEFAULT 2
+#define CMP_THREADS_MAX     64
+
+/* Compression settings */
+struct cmp_params {
+    unsigned int threads;       /* # of worker threads */
+    enum cmp_preproc preproc;   /* Preprocessor to apply when writing */
+    unsigned int level;         /* DEFLATE level (1-9), or 0 to only apply
+                                 *   the preprocessor */
+};
+
+struct cmp_writer;
+struct cmp_reader;
+
+/**
+ * Initialize compression parameters to their defaults
+ *
+ * @param   p   Parameters to initialize
+ */
+void cmp_params_init(struct cmp_params *p);
+
+/**
+ * Query whether DEFLATE support has been compiled in
+ *
+ * @return true if a nonzero level may be used, false otherwise
+ */
+bool cmp_deflate_supported(void);
+
+/**
+ * Convert a preprocessor to a string
+ *
+ * @param   preproc     Preprocessor
+ *
+ * @return string representation
+ */
+const char *cmp_preproc2str(enum cmp_preproc preproc);
+
+/**
+ * Convert a string to a preprocessor
+ *
+ * @param[in]   str     Preprocessor name
+ * @param[out]  ok      Set true on success, false otherwise
+ *
+ * @return preprocessor value, valid only if `ok` is true
+ */
+enum cmp_preproc cmp_str2preproc(const char *str, bool *ok);
+
+/**
+ * Start a compressed file and its worker threads
+ *
+ * @param[out]  w                   Writer handle
+ * @param[in]   f                   File to write to. This must remain open
+ *                                  until cmp_writer_close() is called.
+ * @param[in]   p                   Compression settings
+ * @param[in]   samples_per_block   Maximum # of samples per block
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int cmp_writer_open(struct cmp_writer **w, FILE *f,
+                    const struct cmp_params *p,
+                    unsigned int samples_per_block);
+
+/**
+ * Queue a block of samples for compression. Completed blocks are written
+ * to the file, in order, from the calling thread. This only blocks if
+ * all workers are busy.
+ *
+ * @param   w           Writer handle
+ * @param   samples     Host-endian SC16 Q11 samples
+ * @param   n           Number of samples. Must not exceed the
+ *                      `samples_per_block` value provided to
+ *                      cmp_writer_open().
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int cmp_writer_write(struct cmp_writer *w, const int16_t *samples, size_t n);
+
+/**
+ * Flush all pending blocks, write the block index, and stop worker threads.
+ * The associated file is not closed.
+ *
+ * @param   w       Writer handle. Freed by this call.
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int cmp_writer_close(struct cmp_writer *w);
+
+/**
+ * Open a compressed file and start its worker threads.
+ *
+ * @param[out]  r           Reader handle
+ * @param[in]   f           File to read. This must remain open until
+ *                          cmp_reader_close() is called.
+ * @param[in]   threads     # of worker threads
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int cmp_reader_open(struct cmp_reader **r, FILE *f, unsigned int threads);
+
+/**
+ * Read decompressed samples. Blocks following the current one are
+ * decompressed by the worker threads ahead of the caller.
+ *
+ * @param[in]   r           Reader handle
+ * @param[out]  samples     Buffer to fill with host-endian SC16 Q11 samples
+ * @param[in]   n           Number of samples to read
+ * @param[out]  n_read      Number of samples read. This will be less than
+ *                          `n` only upon reaching the end of the file.
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int cmp_reader_read(struct cmp_reader *r, int16_t *samples, size_t n,
+                    size_t *n_read);
+
+/**
+ * Reposition the reader, using the block index
+ *
+ * @param   r           Reader handle
+ * @param   sample      Sample index to seek to
+ *
+ * @return 0 on success, CLI_RET_INVPARAM if `sample` is beyond the end of the
+ *         file, or another CLI_RET_* value on failure
+ */
+int cmp_reader_seek(struct cmp_reader *r, uint64_t sample);
+
+/**
+ * Stop worker threads and free the reader. The associated file is not
+ * closed.
+ *
+ * @param   r       Reader handle
+ */
+void cmp_reader_close(struct cmp_reader *r);
+
+#endif
@@ -31,6 +31,10 @@
 #include "cmd.h"
 #include "conversions.h"
 #include "thread.h"
+#include "rxtx_sigmf.h"
+#include "rxtx_compress.h"
+#include "rxtx_rotate.h"
+#include "trigger_capture.h"
 
 #define RXTX_ERRMSG_VALUE(param, value) \
     "Invalid value for \"%s\" (%s)\n", param, value
@@ -56,7 +60,9 @@
 enum rxtx_fmt {
     RXTX_FMT_INVALID = -1,
     RXTX_FMT_CSV_SC16Q11,   /* CSV (Comma-separated, one entry per line) */
-    RXTX_FMT_BIN_SC16Q11    /* Binary (big-endian), c16 I,Q */
+    RXTX_FMT_BIN_SC16Q11,   /* Binary (big-endian), c16 I,Q */
+    RXTX_FMT_SIGMF_SC16Q11, /* Binary c16 I,Q with a SigMF JSON sidecar */
+    RXTX_FMT_CMP_SC16Q11    /* Block-compressed c16 I,Q */
 };
 
 enum rxtx_state {
@@ -96,6 +102,16 @@ struct file_mgmt
                                      * of the following file metadata items */
     char *path;                     /* Path associated with 'file'. */
     enum rxtx_fmt format;           /* File format */
+    struct sigmf_meta sigmf;        /* Capture metadata for the SigMF
+                                     *   format */
+    struct cmp_params cmp;          /* Settings for the compressed format */
+
+    /* Only accessed by the task, while 'file' is open */
+    struct cmp_writer *cmp_writer;  /* Compressed RX output */
+    struct cmp_reader *cmp_reader;  /* Compressed TX input */
+    struct file_rotator *rotator;   /* Split-file RX output. 'file' is
+                                     *   owned by the rotator when this
+                                     *   is non-NULL. */
 };
 
 
@@ -138,10 +154,31 @@ struct tx_params
     unsigned int repeat;        /* # of repetitions */
 };
 
+enum rx_trigger
+{
+    RX_TRIGGER_OFF,             /* Write all received samples */
+    RX_TRIGGER_POWER,           /* Write samples surrounding the point at
+                                 *   which the RX power crosses a threshold */
+    RX_TRIGGER_EXT,             /* Write samples surrounding the point at
+                                 *   which a trigger is fired */
+};
+
 struct rx_params
 {
     size_t n_samples;           /* Number of samples to receive */
     int (*write_samples)(struct rxtx_data *rx, int16_t *samples, size_t n);
+
+    enum rx_trigger trigger;        /* Trigger capture mode */
+    struct trigcap_config trigcap;  /* Trigger capture settings. The
+                                     *   samples per buffer are filled in
+                                     *   when the capture is started. */
+    struct trigcap *tc;             /* Trigger capture in progress */
+
+    uint64_t rotate_bytes;          /* Split the capture into files of at
+                                     *   most this many bytes, if nonzero */
+    unsigned int rotate_secs;       /* Split the capture into files spanning
+                                     *   at most this many seconds, if
+                                     *   nonzero */
 };
 
 /* Multipliers in units of 1024 */
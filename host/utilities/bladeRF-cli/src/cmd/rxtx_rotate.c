@@ -0,0 +1,450 @@
+/*
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef __linux__
+/* Required for fallocate() */
+#   define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "host_config.h"
+
+#if BLADERF_OS_LINUX
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "rel_assert.h"
+#include "thread.h"
+#include "minmax.h"
+#include "common.h"
+#include "input.h"
+#include "rxtx_rotate.h"
+
+/* Upper bound on the space preallocated for each file */
+#define ROTATE_PREALLOC_MAX (1024 * 1024 * 1024)
+
+/* A completed file, to be closed and renamed by the background thread */
+struct rotate_job {
+    FILE *f;
+    char *tmp_path;
+    uint64_t timestamp;         /* Timestamp of the file's first sample */
+    uint64_t size;              /* Bytes written to the file */
+    bool keep;                  /* Remove the file if false */
+    struct rotate_job *next;
+};
+
+struct file_rotator {
+    char *prefix;               /* Expanded path, up to its extension */
+    char *ext;                  /* Path's extension, or "" */
+    uint64_t max_bytes;
+    uint64_t max_samples;
+    uint64_t prealloc;          /* Bytes to preallocate for each file */
+
+    /* File currently being written. Only accessed by the writer. */
+    FILE *cur;
+    char *cur_tmp_path;
+    uint64_t cur_bytes;
+    uint64_t cur_timestamp;
+    bool cur_started;
+
+    /* Items below are shared with the background thread */
+    pthread_t thread;
+    MUTEX lock;
+    pthread_cond_t work;        /* Signals the background thread */
+    pthread_cond_t ready;       /* Signals the writer that a file is ready */
+
+    unsigned int seq;           /* Sequence # for temporary file names */
+    FILE *next;                 /* Preallocated file for the next rotation */
+    char *next_tmp_path;
+    bool next_requested;
+
+    struct rotate_job *jobs;
+    struct rotate_job *jobs_tail;
+
+    int error;                  /* First error encountered, or 0 */
+    bool stop;
+};
+
+/* Open and preallocate a file with a temporary name.
+ *
+ * Returns 0 on success, CLI_RET_* on failure */
+static int open_tmp(struct file_rotator *r, unsigned int seq,
+                    FILE **f, char **tmp_path)
+{
+    int status;
+    const size_t len = strlen(r->prefix) + strlen(r->ext) + 32;
+
+    *tmp_path = malloc(len);
+    if (*tmp_path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    snprintf(*tmp_path, len, "%s%s.%u.part", r->prefix, r->ext, seq);
+
+    status = expand_and_open(*tmp_path, "wb", f);
+    if (status != 0) {
+        free(*tmp_path);
+        *tmp_path = NULL;
+        return status;
+    }
+
+#if BLADERF_OS_LINUX
+    /* Reserve space without changing the file's size, so a file left behind
+     * by an interrupted capture contains no padding. This is only a hint;
+     * not all filesystems support it. */
+    if (r->prealloc != 0) {
+        fallocate(fileno(*f), FALLOC_FL_KEEP_SIZE, 0, (off_t) r->prealloc);
+    }
+#endif
+
+    return 0;
+}
+
+/* Returns 0 on success, CLI_RET_* on failure */
+static int finish_job(struct file_rotator *r, const struct rotate_job *job)
+{
+    int status = 0;
+    char *final_path;
+    const size_t len = strlen(r->prefix) + strlen(r->ext) + 32;
+
+    if (fflush(job->f) != 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+#if BLADERF_OS_LINUX
+    /* Release any preallocated space that went unused */
+    if (status == 0 && r->prealloc != 0) {
+        if (ftruncate(fileno(job->f), (off_t) job->size) != 0) {
+            status = CLI_RET_FILEOP;
+        }
+    }
+#endif
+
+    if (fclose(job->f) != 0 && status == 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+    if (!job->keep) {
+        remove(job->tmp_path);
+        return status;
+    }
+
+    final_path = malloc(len);
+    if (final_path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    snprintf(final_path, len, "%s_%016" PRIu64 "%s",
+             r->prefix, job->timestamp, r->ext);
+
+    if (rename(job->tmp_path, final_path) != 0 && status == 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+    free(final_path);
+    return status;
+}
+
+static void *rotator_thread(void *arg)
+{
+    struct file_rotator *r = (struct file_rotator *) arg;
+
+    MUTEX_LOCK(&r->lock);
+
+    while (!r->stop || r->jobs != NULL) {
+        if (r->next_requested && !r->stop) {
+            /* Prepare the next file first, as the writer may be waiting */
+            int status;
+            FILE *f;
+            char *tmp_path;
+            const unsigned int seq = r->seq++;
+
+            r->next_requested = false;
+            MUTEX_UNLOCK(&r->lock);
+
+            status = open_tmp(r, seq, &f, &tmp_path);
+
+            MUTEX_LOCK(&r->lock);
+            if (status == 0) {
+                r->next = f;
+                r->next_tmp_path = tmp_path;
+            } else if (r->error == 0) {
+                r->error = status;
+            }
+
+            pthread_cond_signal(&r->ready);
+
+        } else if (r->jobs != NULL) {
+            int status;
+            struct rotate_job *job = r->jobs;
+
+            r->jobs = job->next;
+            if (r->jobs == NULL) {
+                r->jobs_tail = NULL;
+            }
+
+            MUTEX_UNLOCK(&r->lock);
+
+            status = finish_job(r, job);
+            free(job->tmp_path);
+            free(job);
+
+            MUTEX_LOCK(&r->lock);
+            if (status != 0 && r->error == 0) {
+                r->error = status;
+            }
+
+        } else {
+            pthread_cond_wait(&r->work, &r->lock);
+        }
+    }
+
+    MUTEX_UNLOCK(&r->lock);
+    return NULL;
+}
+
+/* Hand off the current file to the background thread.
+ *
+ * @pre r->lock is held */
+static int queue_current(struct file_rotator *r)
+{
+    struct rotate_job *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    job->f = r->cur;
+    job->tmp_path = r->cur_tmp_path;
+    job->timestamp = r->cur_timestamp;
+    job->size = r->cur_bytes;
+    job->keep = r->cur_started;
+    job->next = NULL;
+
+    if (r->jobs_tail != NULL) {
+        r->jobs_tail->next = job;
+    } else {
+        r->jobs = job;
+    }
+    r->jobs_tail = job;
+
+    r->cur = NULL;
+    r->cur_tmp_path = NULL;
+
+    pthread_cond_signal(&r->work);
+    return 0;
+}
+
+static void rotator_free(struct file_rotator *r)
+{
+    free(r->cur_tmp_path);
+    free(r->prefix);
+    free(r);
+}
+
+int rotator_start(struct file_rotator **r_out, const char *path,
+                  uint64_t max_bytes, uint64_t max_samples, FILE **f)
+{
+    int status;
+    struct file_rotator *r;
+    char *expanded, *sep, *dot;
+
+    *r_out = NULL;
+    *f = NULL;
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    expanded = input_expand_path(path);
+    if (expanded == NULL) {
+        free(r);
+        return CLI_RET_MEM;
+    }
+
+    /* Split the extension off of the file name, ignoring leading dots */
+    sep = strrchr(expanded, '/');
+#if BLADERF_OS_WINDOWS
+    {
+        char *bsep = strrchr(expanded, '\\');
+        if (sep == NULL || (bsep != NULL && bsep > sep)) {
+            sep = bsep;
+        }
+    }
+#endif
+    sep = (sep == NULL) ? expanded : sep + 1;
+
+    dot = strrchr(sep, '.');
+    if (dot == NULL || dot == sep) {
+        dot = &expanded[strlen(expanded)];
+    }
+
+    /* Store the prefix and extension in a single allocation */
+    r->prefix = malloc(2 * strlen(expanded) + 2);
+    if (r->prefix == NULL) {
+        free(expanded);
+        free(r);
+        return CLI_RET_MEM;
+    }
+
+    memcpy(r->prefix, expanded, dot - expanded);
+    r->prefix[dot - expanded] = '\0';
+    r->ext = &r->prefix[dot - expanded + 1];
+    strcpy(r->ext, dot);
+    free(expanded);
+
+    r->max_bytes = max_bytes;
+    r->max_samples = max_samples;
+
+    /* Preallocate up to the size of a complete file, when it's known */
+    if (max_bytes != 0) {
+        r->prealloc = u64_min(max_bytes, ROTATE_PREALLOC_MAX);
+    }
+
+    if (max_samples != 0) {
+        const uint64_t bytes = max_samples * 2 * sizeof(int16_t);
+        r->prealloc = u64_min(r->prealloc != 0 ? r->prealloc :
+                                                 ROTATE_PREALLOC_MAX, bytes);
+    }
+
+    /* The first file is opened here, so that errors are reported
+     * immediately */
+    status = open_tmp(r, r->seq++, &r->cur, &r->cur_tmp_path);
+    if (status != 0) {
+        rotator_free(r);
+        return status;
+    }
+
+    MUTEX_INIT(&r->lock);
+    pthread_cond_init(&r->work, NULL);
+    pthread_cond_init(&r->ready, NULL);
+    r->next_requested = true;
+
+    if (pthread_create(&r->thread, NULL, rotator_thread, r) != 0) {
+        fclose(r->cur);
+        remove(r->cur_tmp_path);
+        pthread_cond_destroy(&r->work);
+        pthread_cond_destroy(&r->ready);
+        rotator_free(r);
+        return CLI_RET_UNKNOWN;
+    }
+
+    *f = r->cur;
+    *r_out = r;
+    return 0;
+}
+
+int rotator_update(struct file_rotator *r, uint64_t timestamp, uint64_t len,
+                   FILE **f)
+{
+    int status;
+
+    if (r->cur_started &&
+        ((r->max_bytes != 0 && (r->cur_bytes + len) > r->max_bytes) ||
+         (r->max_samples != 0 &&
+          (timestamp - r->cur_timestamp) >= r->max_samples))) {
+
+        MUTEX_LOCK(&r->lock);
+
+        while (r->next == NULL && r->error == 0) {
+            pthread_cond_wait(&r->ready, &r->lock);
+        }
+
+        status = r->error;
+        if (status == 0) {
+            status = queue_current(r);
+        }
+
+        if (status == 0) {
+            r->cur = r->next;
+            r->cur_tmp_path = r->next_tmp_path;
+            r->cur_bytes = 0;
+            r->cur_started = false;
+
+            r->next = NULL;
+            r->next_tmp_path = NULL;
+            r->next_requested = true;
+            pthread_cond_signal(&r->work);
+        }
+
+        MUTEX_UNLOCK(&r->lock);
+
+        if (status != 0) {
+            return status;
+        }
+    } else {
+        /* Report background failures promptly */
+        MUTEX_LOCK(&r->lock);
+        status = r->error;
+        MUTEX_UNLOCK(&r->lock);
+
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    if (!r->cur_started) {
+        r->cur_timestamp = timestamp;
+        r->cur_started = true;
+    }
+
+    r->cur_bytes += len;
+    *f = r->cur;
+    return 0;
+}
+
+int rotator_stop(struct file_rotator *r)
+{
+    int status;
+
+    MUTEX_LOCK(&r->lock);
+    status = queue_current(r);
+    r->stop = true;
+    pthread_cond_signal(&r->work);
+    MUTEX_UNLOCK(&r->lock);
+
+    pthread_join(r->thread, NULL);
+
+    /* Discard the file prepared for the next rotation */
+    if (r->next != NULL) {
+        fclose(r->next);
+        remove(r->next_tmp_path);
+        free(r->next_tmp_path);
+    }
+
+    if (status == 0) {
+        status = r->error;
+    } else if (r->cur != NULL) {
+        /* Couldn't hand off the current file; clean it up here */
+        fclose(r->cur);
+    }
+
+    pthread_cond_destroy(&r->work);
+    pthread_cond_destroy(&r->ready);
+    rotator_free(r);
+
+    return status;
+}
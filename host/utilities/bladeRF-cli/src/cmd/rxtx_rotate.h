@@ -0,0 +1,87 @@
+/**
+ * @file rxtx_rotate.h
+ *
+ * @brief Split-file (rotating) output for the rx command
+ *
+ * A capture is split across a series of files, each named after the META
+ * timestamp of its first sample. Files are rotated once they reach a size
+ * limit or span a number of samples, whichever comes first.
+ *
+ * To keep the RX task from blocking on filesystem metadata operations, a
+ * background thread opens and preallocates the next file ahead of time,
+ * and closes, truncates, and renames each completed file. While being
+ * written, a file has a temporary ".part" name.
+ *
+ * Nothing outside of rxtx.c, rx.c, and tx.c should require anything
+ * defined in this file.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef RXTX_ROTATE_H__
+#define RXTX_ROTATE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+struct file_rotator;
+
+/**
+ * Open the first file of a split capture and start the background thread
+ *
+ * @param[out]  r               Rotator handle
+ * @param[in]   path            Path of the capture. Each file's timestamp is
+ *                              inserted ahead of the path's extension.
+ * @param[in]   max_bytes       Maximum size of each file, or 0 for no limit
+ * @param[in]   max_samples     Maximum number of samples spanned by each
+ *                              file, or 0 for no limit
+ * @param[out]  f               First file to write to
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int rotator_start(struct file_rotator **r, const char *path,
+                  uint64_t max_bytes, uint64_t max_samples, FILE **f);
+
+/**
+ * Account for a block that is about to be written, switching to the next
+ * file if the block would exceed the current file's limits. This only
+ * blocks if the background thread has not yet prepared the next file.
+ *
+ * @param[in]       r           Rotator handle
+ * @param[in]       timestamp   Timestamp of the block's first sample
+ * @param[in]       len         Length of the block, in bytes
+ * @param[in,out]   f           File to write the block to. Updated if the
+ *                              files have been rotated.
+ *
+ * @return 0 on success, CLI_RET_* on failure, including failures that
+ *         occurred on the background thread
+ */
+int rotator_update(struct file_rotator *r, uint64_t timestamp, uint64_t len,
+                   FILE **f);
+
+/**
+ * Close the current file, wait for all background operations to complete,
+ * and free the rotator.
+ *
+ * @param   r       Rotator handle
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int rotator_stop(struct file_rotator *r);
+
+#endif
@@ -0,0 +1,552 @@
+/*
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "rel_assert.h"
+#include "host_config.h"
+#include "common.h"
+#include "input.h"
+#include "version.h"
+#include "rxtx_sigmf.h"
+
+#if BLADERF_BIG_ENDIAN
+#   define SIGMF_DATATYPE "ci16_be"
+#else
+#   define SIGMF_DATATYPE "ci16_le"
+#endif
+
+#define SIGMF_VERSION "0.0.1"
+
+/* Format of a capture index entry. Each is a self-contained JSON object on
+ * a line of its own ("JSON Lines"). */
+#define SIGMF_INDEX_FMT \
+    "{\"core:sample_start\": %" PRIu64 ", " \
+    "\"core:global_index\": %" PRIu64 ", " \
+    "\"core:frequency\": %u, " \
+    "\"bladerf:discontinuity\": %d, " \
+    "\"bladerf:retune\": %d}\n"
+
+#define SIGMF_INDEX_SCAN_FMT \
+    "{\"core:sample_start\": %" SCNu64 ", " \
+    "\"core:global_index\": %" SCNu64 ", " \
+    "\"core:frequency\": %u, " \
+    "\"bladerf:discontinuity\": %d, " \
+    "\"bladerf:retune\": %d}"
+
+/* Upper bound on the length of an index line */
+#define SIGMF_INDEX_LINE_MAX 256
+
+/* A contiguous run of samples in the data file, as read from the index */
+struct sigmf_capture {
+    uint64_t sample_start;      /* Offset of the segment in the data file,
+                                 *   in samples */
+    uint64_t timestamp;         /* Device timestamp of the first sample */
+    unsigned int frequency;     /* Frequency in effect for this segment */
+    int discontinuity;          /* Segment follows dropped samples */
+    int retune;                 /* Segment follows a retune */
+};
+
+/* Upper bound on the size of a sidecar we're willing to parse */
+#define SIGMF_META_MAX_LEN (64 * 1024 * 1024)
+
+void sigmf_meta_init(struct sigmf_meta *m, bladerf_module module)
+{
+    memset(m, 0, sizeof(*m));
+    m->module = module;
+}
+
+void sigmf_meta_deinit(struct sigmf_meta *m)
+{
+    if (m->index != NULL) {
+        fclose(m->index);
+        m->index = NULL;
+    }
+
+    m->num_captures = 0;
+}
+
+int sigmf_meta_start(struct sigmf_meta *m, struct bladerf *dev)
+{
+    int status;
+    time_t now;
+    struct tm *now_tm;
+
+    m->num_captures = 0;
+    m->num_samples = 0;
+    m->next_timestamp = 0;
+    m->retune_pending = false;
+    memset(m->gain, 0, sizeof(m->gain));
+
+    status = bladerf_get_sample_rate(dev, m->module, &m->sample_rate);
+    if (status != 0) {
+        return status;
+    }
+
+    status = bladerf_get_bandwidth(dev, m->module, &m->bandwidth);
+    if (status != 0) {
+        return status;
+    }
+
+    status = bladerf_get_frequency(dev, m->module, &m->frequency);
+    if (status != 0) {
+        return status;
+    }
+
+    if (m->module == BLADERF_MODULE_RX) {
+        bladerf_lna_gain lna;
+
+        status = bladerf_get_lna_gain(dev, &lna);
+        if (status != 0) {
+            return status;
+        }
+
+        switch (lna) {
+            case BLADERF_LNA_GAIN_MAX:
+                m->gain[0] = BLADERF_LNA_GAIN_MAX_DB;
+                break;
+
+            case BLADERF_LNA_GAIN_MID:
+                m->gain[0] = BLADERF_LNA_GAIN_MID_DB;
+                break;
+
+            default:
+                m->gain[0] = 0;
+        }
+
+        status = bladerf_get_rxvga1(dev, &m->gain[1]);
+        if (status == 0) {
+            status = bladerf_get_rxvga2(dev, &m->gain[2]);
+        }
+    } else {
+        status = bladerf_get_txvga1(dev, &m->gain[0]);
+        if (status == 0) {
+            status = bladerf_get_txvga2(dev, &m->gain[1]);
+        }
+    }
+
+    if (status != 0) {
+        return status;
+    }
+
+    now = time(NULL);
+    now_tm = gmtime(&now);
+    if (now_tm == NULL ||
+        strftime(m->datetime, sizeof(m->datetime),
+                 "%Y-%m-%dT%H:%M:%SZ", now_tm) == 0) {
+        m->datetime[0] = '\0';
+    }
+
+    return 0;
+}
+
+void sigmf_meta_retune(struct sigmf_meta *m, unsigned int frequency)
+{
+    m->retune_pending = true;
+    m->retune_frequency = frequency;
+}
+
+static int add_capture(struct sigmf_meta *m, uint64_t timestamp)
+{
+    const bool discontinuity = (m->num_captures != 0 &&
+                                timestamp != m->next_timestamp);
+    const bool retune = m->retune_pending;
+
+    if (m->retune_pending) {
+        m->frequency = m->retune_frequency;
+        m->retune_pending = false;
+    }
+
+    m->num_captures++;
+
+    if (m->index == NULL) {
+        return CLI_RET_FILEOP;
+    }
+
+    /* Flush each entry, so the index survives the capture being cut short */
+    fprintf(m->index, SIGMF_INDEX_FMT, m->num_samples, timestamp,
+            m->frequency, discontinuity ? 1 : 0, retune ? 1 : 0);
+
+    if (fflush(m->index) != 0 || ferror(m->index)) {
+        return CLI_RET_FILEOP;
+    }
+
+    return 0;
+}
+
+int sigmf_meta_update(struct sigmf_meta *m, uint64_t timestamp, size_t count)
+{
+    int status = 0;
+
+    if (m->num_captures == 0 || m->retune_pending ||
+        timestamp != m->next_timestamp) {
+
+        status = add_capture(m, timestamp);
+    }
+
+    m->num_samples += count;
+    m->next_timestamp = timestamp + count;
+
+    return status;
+}
+
+/* Derive the path of the sidecar or index from that of the data file. The
+ * ".sigmf-data" extension is replaced, if present. Otherwise, the specified
+ * extension is appended. */
+static char *meta_path(const char *data_path, const char *ext)
+{
+    const size_t data_ext_len = strlen(SIGMF_DATA_EXT);
+    size_t base_len = strlen(data_path);
+    char *ret;
+
+    if (base_len > data_ext_len &&
+        !strcmp(&data_path[base_len - data_ext_len], SIGMF_DATA_EXT)) {
+        base_len -= data_ext_len;
+    }
+
+    ret = malloc(base_len + strlen(ext) + 1);
+    if (ret != NULL) {
+        memcpy(ret, data_path, base_len);
+        strcpy(&ret[base_len], ext);
+    }
+
+    return ret;
+}
+
+static void write_global(FILE *f, const struct sigmf_meta *m, bool final)
+{
+    fprintf(f, "    \"global\": {\n");
+    fprintf(f, "        \"core:datatype\": \"%s\",\n", SIGMF_DATATYPE);
+    fprintf(f, "        \"core:sample_rate\": %u,\n", m->sample_rate);
+    fprintf(f, "        \"core:version\": \"%s\",\n", SIGMF_VERSION);
+    fprintf(f, "        \"core:hw\": \"bladeRF\",\n");
+    fprintf(f, "        \"core:recorder\": \"bladeRF-cli %s\",\n",
+            BLADERF_CLI_VERSION);
+    fprintf(f, "        \"bladerf:module\": \"%s\",\n",
+            m->module == BLADERF_MODULE_RX ? "rx" : "tx");
+    fprintf(f, "        \"bladerf:bandwidth\": %u,\n", m->bandwidth);
+
+    if (m->module == BLADERF_MODULE_RX) {
+        fprintf(f, "        \"bladerf:lna_gain\": %d,\n", m->gain[0]);
+        fprintf(f, "        \"bladerf:rxvga1\": %d,\n", m->gain[1]);
+        fprintf(f, "        \"bladerf:rxvga2\": %d", m->gain[2]);
+    } else {
+        fprintf(f, "        \"bladerf:txvga1\": %d,\n", m->gain[0]);
+        fprintf(f, "        \"bladerf:txvga2\": %d", m->gain[1]);
+    }
+
+    /* The sample count is only known once the capture completes */
+    if (final) {
+        fprintf(f, ",\n        \"bladerf:sample_count\": %" PRIu64 "\n",
+                m->num_samples);
+    } else {
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "    },\n");
+}
+
+static int close_file(FILE *f, int status)
+{
+    if (ferror(f)) {
+        status = CLI_RET_FILEOP;
+    }
+
+    if (fclose(f) != 0 && status == 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+    return status;
+}
+
+/* Remove the sidecar or index associated with the specified data file */
+static int remove_meta_file(const char *data_path, const char *ext)
+{
+    int status = 0;
+    char *path;
+    char *expanded = NULL;
+
+    path = meta_path(data_path, ext);
+    if (path != NULL) {
+        expanded = input_expand_path(path);
+        free(path);
+    }
+
+    if (expanded == NULL) {
+        status = CLI_RET_MEM;
+    } else if (remove(expanded) != 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+    free(expanded);
+    return status;
+}
+
+int sigmf_meta_open(struct sigmf_meta *m, const char *data_path)
+{
+    int status;
+    FILE *f;
+    char *path;
+
+    sigmf_meta_deinit(m);
+
+    path = meta_path(data_path, SIGMF_META_EXT);
+    if (path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    status = expand_and_open(path, "w", &f);
+    free(path);
+
+    if (status != 0) {
+        return status;
+    }
+
+    fprintf(f, "{\n");
+    write_global(f, m, false);
+    fprintf(f, "    \"captures\": [],\n");
+    fprintf(f, "    \"annotations\": []\n");
+    fprintf(f, "}\n");
+
+    status = close_file(f, 0);
+    if (status != 0) {
+        return status;
+    }
+
+    path = meta_path(data_path, SIGMF_INDEX_EXT);
+    if (path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    status = expand_and_open(path, "w+", &m->index);
+    free(path);
+
+    return status;
+}
+
+/* Read the next entry from the capture index. Returns false at the end of the
+ * index, or upon encountering a malformed entry. */
+static bool read_capture(FILE *index, struct sigmf_capture *c)
+{
+    char line[SIGMF_INDEX_LINE_MAX];
+
+    if (fgets(line, sizeof(line), index) == NULL) {
+        return false;
+    }
+
+    return sscanf(line, SIGMF_INDEX_SCAN_FMT, &c->sample_start, &c->timestamp,
+                  &c->frequency, &c->discontinuity, &c->retune) == 5;
+}
+
+int sigmf_meta_finish(struct sigmf_meta *m, const char *data_path)
+{
+    int status;
+    bool first;
+    FILE *f;
+    char *path;
+    struct sigmf_capture c;
+
+    if (m->index == NULL) {
+        return CLI_RET_FILEOP;
+    }
+
+    /* Re-read the index from the start */
+    if (fflush(m->index) != 0 || fseek(m->index, 0, SEEK_SET) != 0) {
+        return CLI_RET_FILEOP;
+    }
+
+    path = meta_path(data_path, SIGMF_META_EXT);
+    if (path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    status = expand_and_open(path, "w", &f);
+    free(path);
+
+    if (status != 0) {
+        return status;
+    }
+
+    fprintf(f, "{\n");
+    write_global(f, m, true);
+
+    fprintf(f, "    \"captures\": [");
+    for (first = true; read_capture(m->index, &c); first = false) {
+        fprintf(f, "%s\n        {\n", first ? "" : ",");
+        fprintf(f, "            \"core:sample_start\": %" PRIu64 ",\n",
+                c.sample_start);
+        fprintf(f, "            \"core:global_index\": %" PRIu64 ",\n",
+                c.timestamp);
+
+        if (first && m->datetime[0] != '\0') {
+            fprintf(f, "            \"core:datetime\": \"%s\",\n",
+                    m->datetime);
+        }
+
+        fprintf(f, "            \"core:frequency\": %u\n", c.frequency);
+        fprintf(f, "        }");
+    }
+    fprintf(f, "\n    ],\n");
+
+    /* Flag discontinuities and retunes as zero-length annotations so they
+     * show up in SigMF viewers */
+    if (fseek(m->index, 0, SEEK_SET) != 0) {
+        status = CLI_RET_FILEOP;
+    }
+
+    fprintf(f, "    \"annotations\": [");
+    for (first = true; status == 0 && read_capture(m->index, &c); ) {
+        if (!c.discontinuity && !c.retune) {
+            continue;
+        }
+
+        fprintf(f, "%s\n        {\n", first ? "" : ",");
+        fprintf(f, "            \"core:sample_start\": %" PRIu64 ",\n",
+                c.sample_start);
+        fprintf(f, "            \"core:sample_count\": 0,\n");
+        fprintf(f, "            \"core:comment\": \"%s\"\n",
+                c.discontinuity ? (c.retune ? "discontinuity, retune" :
+                                              "discontinuity")
+                                : "retune");
+        fprintf(f, "        }");
+
+        first = false;
+    }
+    fprintf(f, "\n    ]\n");
+    fprintf(f, "}\n");
+
+    if (ferror(m->index)) {
+        status = CLI_RET_FILEOP;
+    }
+
+    status = close_file(f, status);
+
+    /* The index has been merged into the sidecar, and is no longer needed */
+    sigmf_meta_deinit(m);
+
+    if (status == 0) {
+        status = remove_meta_file(data_path, SIGMF_INDEX_EXT);
+    }
+
+    return status;
+}
+
+void sigmf_meta_abort(struct sigmf_meta *m, const char *data_path)
+{
+    sigmf_meta_deinit(m);
+
+    /* Either file may not have been created yet */
+    remove_meta_file(data_path, SIGMF_META_EXT);
+    remove_meta_file(data_path, SIGMF_INDEX_EXT);
+}
+
+/* Locate the value associated with the specified key. This is not a
+ * general JSON parser; it's only intended to handle the flat key/value
+ * pairs in the "global" object of a sidecar. */
+static const char *find_value(const char *json, const char *key)
+{
+    const char *p = strstr(json, key);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    p = strchr(p + strlen(key), ':');
+    if (p == NULL) {
+        return NULL;
+    }
+
+    p++;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+
+    return p;
+}
+
+int sigmf_meta_check(const char *data_path, unsigned int *sample_rate)
+{
+    int status;
+    FILE *f = NULL;
+    char *path = NULL;
+    char *json = NULL;
+    const char *val;
+    long len;
+
+    if (sample_rate != NULL) {
+        *sample_rate = 0;
+    }
+
+    path = meta_path(data_path, SIGMF_META_EXT);
+    if (path == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    status = expand_and_open(path, "rb", &f);
+    if (status != 0) {
+        goto out;
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 ||
+        len > SIGMF_META_MAX_LEN || fseek(f, 0, SEEK_SET) != 0) {
+        status = CLI_RET_FILEOP;
+        goto out;
+    }
+
+    json = malloc(len + 1);
+    if (json == NULL) {
+        status = CLI_RET_MEM;
+        goto out;
+    }
+
+    if (fread(json, 1, len, f) != (size_t) len) {
+        status = CLI_RET_FILEOP;
+        goto out;
+    }
+
+    json[len] = '\0';
+
+    val = find_value(json, "\"core:datatype\"");
+    if (val == NULL || strncmp(val, "\"" SIGMF_DATATYPE "\"",
+                               strlen(SIGMF_DATATYPE) + 2)) {
+        status = CLI_RET_INVPARAM;
+        goto out;
+    }
+
+    val = find_value(json, "\"core:sample_rate\"");
+    if (val != NULL && sample_rate != NULL) {
+        double rate = strtod(val, NULL);
+        if (rate > 0 && rate <= UINT32_MAX) {
+            *sample_rate = (unsigned int) (rate + 0.5);
+        }
+    }
+
+out:
+    if (f != NULL) {
+        fclose(f);
+    }
+
+    free(json);
+    free(path);
+    return status;
+}
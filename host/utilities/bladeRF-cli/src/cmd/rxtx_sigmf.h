@@ -0,0 +1,172 @@
+/**
+ * @file rxtx_sigmf.h
+ *
+ * @brief SigMF capture metadata support for the rx and tx commands
+ *
+ * Sample data is written to the configured file as raw SC16 Q11 (SigMF
+ * datatype ci16), exactly as in the binary format. A JSON sidecar describing
+ * the device configuration is written alongside it when the capture starts,
+ * and capture segments are appended to a separate index file as they begin.
+ * When the capture completes, the index is merged into the sidecar's
+ * "captures" array and removed. A new segment is started at the beginning of
+ * the capture, at every discontinuity in the META timestamps, and at every
+ * retune. Each segment records both its sample offset in the data file and
+ * its device timestamp (core:global_index), so a reader can locate any
+ * timestamp by finding its segment and computing the offset directly.
+ *
+ * Nothing outside of rxtx.c, rx.c, and tx.c should require anything
+ * defined in this file.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef RXTX_SIGMF_H__
+#define RXTX_SIGMF_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <libbladeRF.h>
+
+#define SIGMF_DATA_EXT ".sigmf-data"
+#define SIGMF_META_EXT ".sigmf-meta"
+
+/* Capture index, appended to as the capture progresses. It is merged into
+ * the sidecar and removed when the capture completes. */
+#define SIGMF_INDEX_EXT ".sigmf-index"
+
+struct sigmf_meta
+{
+    bladerf_module module;
+
+    /* Device settings captured when the stream is started */
+    unsigned int sample_rate;
+    unsigned int bandwidth;
+    unsigned int frequency;
+    int gain[3];                /* LNA/RXVGA1/RXVGA2 or TXVGA1/TXVGA2 (dB) */
+    char datetime[32];          /* ISO 8601 UTC time the capture started */
+
+    /* Capture index. Each capture segment is written out as a line of JSON
+     * as soon as it starts, so that a capture that is cut short still has an
+     * index for the samples that made it to the data file. */
+    FILE *index;
+    uint64_t num_captures;
+
+    uint64_t num_samples;       /* Samples written to the data file */
+    uint64_t next_timestamp;    /* Expected timestamp of the next block */
+
+    /* Retune noted by the control path, applied at the next block */
+    bool retune_pending;
+    unsigned int retune_frequency;
+};
+
+/**
+ * Initialize metadata
+ *
+ * @param   m       Metadata to initialize
+ * @param   module  Module the capture is associated with
+ */
+void sigmf_meta_init(struct sigmf_meta *m, bladerf_module module);
+
+/**
+ * Close the capture index, if a capture was not finished
+ *
+ * @param   m       Metadata to deinitialize
+ */
+void sigmf_meta_deinit(struct sigmf_meta *m);
+
+/**
+ * Record the device's current settings and the start time of the capture.
+ *
+ * @pre Caller must be allowed to perform device control operations
+ *
+ * @param   m       Metadata to populate
+ * @param   dev     Device handle
+ *
+ * @return 0 on success, BLADERF_ERR_* on failure
+ */
+int sigmf_meta_start(struct sigmf_meta *m, struct bladerf *dev);
+
+/**
+ * Write a sidecar describing the capture, without any capture segments, and
+ * create a new capture index alongside it. This is called following
+ * sigmf_meta_start(), before any samples are written.
+ *
+ * @param   m           Metadata handle
+ * @param   data_path   Path to the data file
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int sigmf_meta_open(struct sigmf_meta *m, const char *data_path);
+
+/**
+ * Note that the frequency has been changed. A new capture segment will be
+ * started at the next block passed to sigmf_meta_update().
+ *
+ * @param   m           Metadata handle
+ * @param   frequency   New frequency
+ */
+void sigmf_meta_retune(struct sigmf_meta *m, unsigned int frequency);
+
+/**
+ * Account for a block of samples that is about to be appended to the data
+ * file, starting a new capture segment if needed. New segments are appended
+ * to the capture index immediately.
+ *
+ * @param   m           Metadata handle
+ * @param   timestamp   Timestamp of the first sample in the block
+ * @param   count       Number of samples in the block
+ *
+ * @return 0 on success, CLI_RET_FILEOP if the index could not be written
+ */
+int sigmf_meta_update(struct sigmf_meta *m, uint64_t timestamp, size_t count);
+
+/**
+ * Finalize the JSON sidecar associated with the specified data file, merging
+ * the capture index into it and removing the index.
+ *
+ * @param   m           Metadata handle
+ * @param   data_path   Path to the data file
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int sigmf_meta_finish(struct sigmf_meta *m, const char *data_path);
+
+/**
+ * Close the capture index and remove both it and the sidecar associated with
+ * the specified data file. This is used to clean up after a capture that
+ * failed to start.
+ *
+ * @param   m           Metadata handle
+ * @param   data_path   Path to the data file
+ */
+void sigmf_meta_abort(struct sigmf_meta *m, const char *data_path);
+
+/**
+ * Read the JSON sidecar associated with the specified data file and ensure
+ * the data file is readable as host-endian SC16 Q11 samples.
+ *
+ * @param[in]   data_path       Path to the data file
+ * @param[out]  sample_rate     Sample rate from the sidecar, or 0 if not
+ *                              present. May be NULL.
+ *
+ * @return 0 on success, CLI_RET_* on failure
+ */
+int sigmf_meta_check(const char *data_path, unsigned int *sample_rate);
+
+#endif
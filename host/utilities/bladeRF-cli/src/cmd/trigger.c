@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include "common.h"
 #include "conversions.h"
+#include "rxtx.h"
 #include <string.h>
 
 int print_trigger(struct cli_state *state,
@@ -162,6 +163,19 @@ static inline int config_trigger(struct cli_state *state,
             goto out;
         }
 
+        /* Mark the trigger point of any pending RX trigger capture */
+        if (rxtx_trigger_capture_armed(state->rx)) {
+            uint64_t timestamp;
+
+            status = bladerf_get_timestamp(state->dev, BLADERF_MODULE_RX,
+                                           &timestamp);
+            if (status != 0) {
+                goto out;
+            }
+
+            rxtx_notify_trigger(state->rx, timestamp);
+        }
+
         printf("\n %s %s trigger fire request submitted successfully.\n\n",
                sig_str, module_str);
 
@@ -103,6 +103,7 @@ static int tx_task_exec_running(struct rxtx_data *tx, struct cli_state *s)
         /* Keep adding to the buffer until it is full or a failure occurs */
         while (buffer_samples_remaining > 0 && status == 0 && state != DONE) {
             size_t samples_populated = 0;
+            bool eof = false;
 
             switch (state) {
                 case INIT:
@@ -111,17 +112,34 @@ static int tx_task_exec_running(struct rxtx_data *tx, struct cli_state *s)
                     MUTEX_LOCK(&tx->file_mgmt.file_lock);
 
                     /* Read from the input file */
-                    samples_populated = fread(tx_buffer_current,
-                                              2 * sizeof(int16_t),
-                                              buffer_samples_remaining,
-                                              tx->file_mgmt.file);
+                    if (tx->file_mgmt.cmp_reader != NULL) {
+                        status = cmp_reader_read(tx->file_mgmt.cmp_reader,
+                                                 tx_buffer_current,
+                                                 buffer_samples_remaining,
+                                                 &samples_populated);
+
+                        if (status != 0) {
+                            set_last_error(&tx->last_error, ETYPE_CLI, status);
+                        } else {
+                            eof = (samples_populated < buffer_samples_remaining);
+                        }
+                    } else {
+                        samples_populated = fread(tx_buffer_current,
+                                                  2 * sizeof(int16_t),
+                                                  buffer_samples_remaining,
+                                                  tx->file_mgmt.file);
+
+                        eof = feof(tx->file_mgmt.file);
+                    }
 
                     assert(samples_populated <= UINT_MAX);
 
                     /* If the end of the file was reached, determine whether
                      * to delay, re-read from the file, or pad the rest of the
                      * buffer and finish */
-                    if (feof(tx->file_mgmt.file)) {
+                    if (status != 0) {
+                        /* Error already recorded */
+                    } else if (eof) {
                         repeats_remaining--;
 
                         if ((repeats_remaining > 0) || repeat_infinite) {
@@ -135,8 +153,17 @@ static int tx_task_exec_running(struct rxtx_data *tx, struct cli_state *s)
                         }
 
                         /* Clear the EOF condition and rewind the file */
-                        clearerr(tx->file_mgmt.file);
-                        rewind(tx->file_mgmt.file);
+                        if (tx->file_mgmt.cmp_reader != NULL) {
+                            status = cmp_reader_seek(tx->file_mgmt.cmp_reader,
+                                                     0);
+                            if (status != 0) {
+                                set_last_error(&tx->last_error,
+                                               ETYPE_CLI, status);
+                            }
+                        } else {
+                            clearerr(tx->file_mgmt.file);
+                            rewind(tx->file_mgmt.file);
+                        }
                     }
 
                     /* Check for errors */
@@ -356,6 +383,55 @@ tx_csv_to_sc16q11_out:
     return status;
 }
 
+/* Ensure a SigMF recording contains samples we can transmit as-is, and warn
+ * if it was recorded at a different sample rate than is currently in use.
+ *
+ * return 0 on success, CLI_RET_* on failure
+ */
+static int tx_check_sigmf(struct cli_state *s)
+{
+    int status;
+    unsigned int file_rate, dev_rate;
+    struct rxtx_data *tx = s->tx;
+
+    status = sigmf_meta_check(tx->file_mgmt.path, &file_rate);
+    if (status == CLI_RET_INVPARAM) {
+        cli_err(s, "tx", "SigMF recording does not contain SC16 Q11 "
+                         "samples in host byte order.\n");
+        return CLI_RET_CMD_HANDLED;
+    } else if (status != 0) {
+        cli_err(s, "tx", "Failed to read SigMF metadata for %s\n",
+                tx->file_mgmt.path);
+        return status;
+    }
+
+    status = bladerf_get_sample_rate(s->dev, tx->module, &dev_rate);
+    if (status != 0) {
+        s->last_lib_error = status;
+        return CLI_RET_LIBBLADERF;
+    }
+
+    if (file_rate != 0 && file_rate != dev_rate) {
+        printf("  Warning: Recording's sample rate (%u Hz) differs from "
+               "the current\n"
+               "           TX sample rate (%u Hz).\n\n",
+               file_rate, dev_rate);
+    }
+
+    return 0;
+}
+
+/* Stop the decompression workers, if they were started for this run */
+static void tx_close_cmp_reader(struct rxtx_data *tx)
+{
+    MUTEX_LOCK(&tx->file_mgmt.file_lock);
+    if (tx->file_mgmt.cmp_reader != NULL) {
+        cmp_reader_close(tx->file_mgmt.cmp_reader);
+        tx->file_mgmt.cmp_reader = NULL;
+    }
+    MUTEX_UNLOCK(&tx->file_mgmt.file_lock);
+}
+
 void *tx_task(void *cli_state_arg)
 {
     int status = 0;
@@ -415,6 +491,7 @@ void *tx_task(void *cli_state_arg)
                     rxtx_set_state(tx, RXTX_STATE_RUNNING);
                 } else {
                     set_last_error(&tx->last_error, err_type, status);
+                    tx_close_cmp_reader(tx);
                     rxtx_set_state(tx, RXTX_STATE_IDLE);
                 }
             }
@@ -447,6 +524,8 @@ void *tx_task(void *cli_state_arg)
                                 disable_status);
                     }
                 }
+
+                tx_close_cmp_reader(tx);
                 rxtx_set_state(tx, RXTX_STATE_STOP);
                 break;
 
@@ -489,12 +568,39 @@ static int tx_cmd_start(struct cli_state *s)
         }
     }
 
+    if (status == 0 &&
+        s->tx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11) {
+        status = tx_check_sigmf(s);
+    }
+
     if (status == 0) {
         MUTEX_LOCK(&s->tx->file_mgmt.file_lock);
 
-        assert(s->tx->file_mgmt.format == RXTX_FMT_BIN_SC16Q11);
+        assert(s->tx->file_mgmt.format == RXTX_FMT_BIN_SC16Q11 ||
+               s->tx->file_mgmt.format == RXTX_FMT_SIGMF_SC16Q11 ||
+               s->tx->file_mgmt.format == RXTX_FMT_CMP_SC16Q11);
         status = expand_and_open(s->tx->file_mgmt.path, "rb",
                                  &s->tx->file_mgmt.file);
+
+        /* Validate the file and start up the decompression workers */
+        if (status == 0 &&
+            s->tx->file_mgmt.format == RXTX_FMT_CMP_SC16Q11) {
+            status = cmp_reader_open(&s->tx->file_mgmt.cmp_reader,
+                                     s->tx->file_mgmt.file,
+                                     s->tx->file_mgmt.cmp.threads);
+
+            if (status != 0) {
+                fclose(s->tx->file_mgmt.file);
+                s->tx->file_mgmt.file = NULL;
+
+                if (status == CLI_RET_INVPARAM) {
+                    cli_err(s, "tx", "%s is not a valid compressed "
+                            "sample file.\n", s->tx->file_mgmt.path);
+                    status = CLI_RET_CMD_HANDLED;
+                }
+            }
+        }
+
         MUTEX_UNLOCK(&s->tx->file_mgmt.file_lock);
     }
 
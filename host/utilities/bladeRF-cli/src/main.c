@@ -25,17 +25,31 @@
 #include <errno.h>
 #include <pthread.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <libbladeRF.h>
 #include "input/input.h"
 #include "str_queue.h"
 #include "script.h"
 #include "common.h"
 #include "cmd.h"
+#include "stream.h"
+#include "conversions.h"
 #include "version.h"
 
 
 #define OPTSTR "e:L:d:f:l:s:ipv:h"
 
+/* Multipliers in units of 1024, for sample counts */
+static const struct numeric_suffix kmg_suffixes[] = {
+    { FIELD_INIT(.suffix, "K"), FIELD_INIT(.multiplier, 1024) },
+    { FIELD_INIT(.suffix, "k"), FIELD_INIT(.multiplier, 1024) },
+    { FIELD_INIT(.suffix, "M"), FIELD_INIT(.multiplier, 1024 * 1024)},
+    { FIELD_INIT(.suffix, "m"), FIELD_INIT(.multiplier, 1024 * 1024)},
+    { FIELD_INIT(.suffix, "G"), FIELD_INIT(.multiplier, 1024 * 1024 * 1024)},
+    { FIELD_INIT(.suffix, "g"), FIELD_INIT(.multiplier, 1024 * 1024 * 1024)}
+};
+
 static const struct option longopts[] = {
     { "exec",               required_argument,  0, 'e' },
     { "flash-fpga",         required_argument,  0, 'L' },
@@ -50,6 +64,12 @@ static const struct option longopts[] = {
     { "version",            no_argument,        0,  2  },
     { "help",               no_argument,        0, 'h' },
     { "help-interactive",   no_argument,        0,  3  },
+    { "rx",                 required_argument,  0,  4  },
+    { "tx",                 required_argument,  0,  5  },
+    { "num-samples",        required_argument,  0,  6  },
+    { "stream-buffers",     required_argument,  0,  7  },
+    { "stream-samples",     required_argument,  0,  8  },
+    { "stream-xfers",       required_argument,  0,  9  },
     { 0,                    0,                  0,  0  },
 };
 
@@ -72,6 +92,8 @@ struct rc_config {
     char *flash_fpga_file;
     char *fpga_file;
     char *script_file;
+
+    struct stream_config stream;
 };
 
 static void init_rc_config(struct rc_config *rc)
@@ -93,6 +115,8 @@ static void init_rc_config(struct rc_config *rc)
     rc->flash_fpga_file = NULL;
     rc->fpga_file = NULL;
     rc->script_file = NULL;
+
+    stream_config_init(&rc->stream);
 }
 
 static void deinit_rc_config(struct rc_config *rc)
@@ -102,6 +126,8 @@ static void deinit_rc_config(struct rc_config *rc)
     free(rc->flash_fpga_file);
     free(rc->fpga_file);
     free(rc->script_file);
+
+    stream_config_deinit(&rc->stream);
 }
 
 /* Fetch runtime-configuration info
@@ -234,6 +260,68 @@ int get_rc_config(int argc, char *argv[], struct rc_config *rc,
                 rc->show_help_interactive = true;
                 break;
 
+            case 4:
+            case 5:
+            {
+                char **file = (c == 4) ? &rc->stream.rx_file :
+                                         &rc->stream.tx_file;
+
+                if (*file != NULL) {
+                    fprintf(stderr, "Error: %s file specified more "
+                            "than once.\n", (c == 4) ? "RX" : "TX");
+                    return -1;
+                }
+
+                *file = strdup(optarg);
+                if (!*file) {
+                    perror("strdup");
+                    return -1;
+                }
+                break;
+            }
+
+            case 6:
+            {
+                bool ok;
+
+                rc->stream.rx_samples =
+                    str2uint64_suffix(optarg, 0, UINT64_MAX, kmg_suffixes,
+                                      ARRAY_SIZE(kmg_suffixes), &ok);
+
+                if (!ok) {
+                    fprintf(stderr, "Invalid number of samples: %s\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case 7:
+            case 8:
+            case 9:
+            {
+                unsigned int val;
+                bool ok;
+
+                val = str2uint_suffix(optarg, 1, UINT_MAX, kmg_suffixes,
+                                      ARRAY_SIZE(kmg_suffixes), &ok);
+
+                if (!ok) {
+                    fprintf(stderr, "Invalid value for --%s: %s\n",
+                            longopts[optidx].name, optarg);
+                    return -1;
+                }
+
+                if (c == 7) {
+                    rc->stream.num_buffers = val;
+                } else if (c == 8) {
+                    rc->stream.samples_per_buffer = val;
+                } else {
+                    rc->stream.num_transfers = val;
+                }
+                break;
+            }
+
             default:
                 return -1;
         }
@@ -273,6 +361,19 @@ void usage(const char *argv0)
     printf("      --help-interactive           Print help information for all interactive\n");
     printf("                                   commands.\n");
     printf("\n");
+    printf("Stream mode options:\n");
+    printf("      --rx <file>                  Write received SC16 Q11 samples to <file>.\n");
+    printf("                                   Use - for stdout.\n");
+    printf("      --tx <file>                  Transmit SC16 Q11 samples read from <file>.\n");
+    printf("                                   Use - for stdin.\n");
+    printf("      --num-samples <n>            Number of samples to receive. The default\n");
+    printf("                                   of 0 receives until interrupted or until the\n");
+    printf("                                   output is closed.\n");
+    printf("      --stream-buffers <n>         Number of stream buffers. (Default: 32)\n");
+    printf("      --stream-samples <n>         Samples per stream buffer. This is also the\n");
+    printf("                                   size of each read or write. (Default: 32K)\n");
+    printf("      --stream-xfers <n>           Number of USB transfers. (Default: 16)\n");
+    printf("\n");
     printf("Notes:\n");
     printf("  The -d option takes a device specifier string. See the bladerf_open()\n");
     printf("  documentation for more information about the format of this string.\n");
@@ -288,6 +389,12 @@ void usage(const char *argv0)
     printf("  are later followed by 'rx/tx wait [timeout]' to ensure the program will\n");
     printf("  not attempt to exit before reception/transmission is complete.\n");
     printf("\n");
+    printf("  In stream mode (--rx and/or --tx), -e commands are executed to configure\n");
+    printf("  the device, and then samples are streamed directly to/from the specified\n");
+    printf("  files. When receiving to stdout, all other output is sent to stderr.\n");
+    printf("  For example:\n");
+    printf("    %s -e 'set samplerate rx 10M' --rx - | dsp_tool\n", argv0);
+    printf("\n");
 }
 
 static void print_error_need_devarg()
@@ -421,6 +528,39 @@ void check_for_bootloader_devs()
            "      downloading firmware to the device(s).\n\n");
 }
 
+/* Execute -e commands and then run stream mode
+ *
+ * Returns 0 on success, nonzero on failure */
+static int run_stream(struct rc_config *rc, struct cli_state *state,
+                      struct str_queue *exec_list)
+{
+    int status = 0;
+    char *line;
+
+    if (!state->dev) {
+        print_error_need_devarg();
+        return -1;
+    }
+
+    while (status == 0 && (line = str_queue_deq(exec_list)) != NULL) {
+        status = cmd_handle(state, line);
+        free(line);
+
+        if (status < 0) {
+            const char *error = cli_strerror(status, state->last_lib_error);
+            if (error) {
+                cli_err(state, "Error", "%s\n", error);
+            }
+        }
+    }
+
+    if (status == 0) {
+        status = stream_run(state, &rc->stream);
+    }
+
+    return status;
+}
+
 int main(int argc, char *argv[])
 {
     int status = 0;
@@ -472,6 +612,21 @@ int main(int argc, char *argv[])
         exit_immediately = true;
     }
 
+    if (!exit_immediately && stream_requested(&rc.stream)) {
+        if (rc.interactive_mode || rc.script_file) {
+            fprintf(stderr, "Error: --rx and --tx may not be used with "
+                    "-i or -s.\n");
+            status = -1;
+            goto main_issues;
+        }
+
+        /* Claim stdout prior to printing anything */
+        status = stream_open(&rc.stream);
+        if (status) {
+            goto main_issues;
+        }
+    }
+
     if (!exit_immediately) {
         check_for_bootloader_devs();
 
@@ -505,6 +660,12 @@ int main(int argc, char *argv[])
             }
         }
 
+        /* Stream samples directly, bypassing the interactive rx/tx tasks */
+        if (stream_requested(&rc.stream)) {
+            status = run_stream(&rc, state, &exec_list);
+            goto main_issues;
+        }
+
         /* Drop into interactive mode or begin executing commands from a a
          * command-line list or a script. If we're not requested to do either,
          * exit cleanly */
@@ -0,0 +1,584 @@
+/*
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <libbladeRF.h>
+
+#include "host_config.h"
+
+#if BLADERF_OS_WINDOWS
+#   include <io.h>
+#else
+#   include <unistd.h>
+#   include <poll.h>
+#endif
+
+#include "thread.h"
+#include "stream.h"
+
+#ifndef O_BINARY
+#   define O_BINARY 0
+#endif
+
+/* Set upon SIGINT/SIGTERM, a closed RX output, or a failure in either
+ * direction, to bring both directions to a halt */
+static volatile sig_atomic_t stream_stop = 0;
+
+#if !BLADERF_OS_WINDOWS
+/* Self-pipe written to when stopping, to wake a read blocked on the TX
+ * input. The write end is non-blocking, so that it is safe to use from the
+ * signal handler. */
+static int stream_wake[2] = { -1, -1 };
+#endif
+
+struct stream_tx_args {
+    struct cli_state *s;
+    struct stream_config *c;
+    int status;
+};
+
+/* Bring both directions to a halt. This is async-signal-safe. */
+static void stream_request_stop(void)
+{
+    stream_stop = 1;
+
+#if !BLADERF_OS_WINDOWS
+    if (stream_wake[1] >= 0) {
+        const char c = 0;
+        const int saved_errno = errno;
+
+        /* A full pipe already has a wakeup pending */
+        if (write(stream_wake[1], &c, 1) < 0) {
+            errno = saved_errno;
+        }
+    }
+#endif
+}
+
+static void stream_sighandler(int signo)
+{
+    (void) signo;
+    stream_request_stop();
+}
+
+static void stream_init_signals(void)
+{
+#if BLADERF_OS_WINDOWS
+    signal(SIGINT, stream_sighandler);
+    signal(SIGTERM, stream_sighandler);
+#else
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = stream_sighandler;
+
+    /* SA_RESTART is intentionally omitted, such that blocking calls return
+     * and observe stream_stop */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Detect a closed output via EPIPE, rather than being terminated */
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+#if !BLADERF_OS_WINDOWS
+static int stream_wake_open(void)
+{
+    int i;
+
+    if (pipe(stream_wake) != 0) {
+        stream_wake[0] = stream_wake[1] = -1;
+        return errno;
+    }
+
+    for (i = 0; i < 2; i++) {
+        const int flags = fcntl(stream_wake[i], F_GETFL);
+        if (flags < 0 ||
+            fcntl(stream_wake[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            return errno;
+        }
+    }
+
+    return 0;
+}
+
+static void stream_wake_close(void)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (stream_wake[i] >= 0) {
+            close(stream_wake[i]);
+            stream_wake[i] = -1;
+        }
+    }
+}
+
+/* Wait for `fd` to become readable.
+ *
+ * Returns 0 when `fd` is readable, EINTR if a stop was requested, or an
+ * errno value on failure */
+static int wait_readable(int fd)
+{
+    struct pollfd fds[2];
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = stream_wake[0];
+    fds[1].events = POLLIN;
+
+    while (!stream_stop) {
+        fds[0].revents = fds[1].revents = 0;
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+
+        if (fds[1].revents != 0) {
+            break;
+        }
+
+        /* Errors and hangups are reported by the subsequent read() */
+        if (fds[0].revents != 0) {
+            return 0;
+        }
+    }
+
+    return EINTR;
+}
+#endif
+
+/* Returns 0 on success, or an errno value on failure */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *) buf;
+
+    while (len > 0) {
+        const int n = (int) write(fd, p, (unsigned int) len);
+
+        if (n < 0) {
+            if (errno == EINTR && !stream_stop) {
+                continue;
+            }
+            return errno;
+        }
+
+        p += n;
+        len -= (size_t) n;
+    }
+
+    return 0;
+}
+
+/* Fill `buf`, unless the end of the input is reached first.
+ *
+ * Returns 0 on success, EINTR if a stop was requested, or an errno value on
+ * failure */
+static int read_full(int fd, void *buf, size_t len, size_t *n_read)
+{
+    char *p = (char *) buf;
+
+    *n_read = 0;
+
+    while (*n_read < len) {
+        int n;
+
+#if !BLADERF_OS_WINDOWS
+        const int err = wait_readable(fd);
+        if (err != 0) {
+            return err;
+        }
+#endif
+
+        n = (int) read(fd, p + *n_read, (unsigned int) (len - *n_read));
+
+        if (n < 0) {
+            if (errno == EINTR && !stream_stop) {
+                continue;
+            }
+            return errno;
+        } else if (n == 0) {
+            break;
+        }
+
+        *n_read += (size_t) n;
+    }
+
+    return 0;
+}
+
+static int stream_rx(struct cli_state *s, struct stream_config *c)
+{
+    int status = 0;
+    uint64_t remaining = c->rx_samples;
+    const size_t buf_len = c->samples_per_buffer * 2 * sizeof(int16_t);
+    int16_t *buf;
+
+    buf = malloc(buf_len);
+    if (buf == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    while (!stream_stop && (c->rx_samples == 0 || remaining > 0)) {
+        unsigned int n = c->samples_per_buffer;
+        int err;
+
+        if (c->rx_samples != 0 && remaining < n) {
+            n = (unsigned int) remaining;
+        }
+
+        status = bladerf_sync_rx(s->dev, buf, n, NULL, c->timeout_ms);
+        if (status != 0) {
+            fprintf(stderr, "RX failed: %s\n", bladerf_strerror(status));
+            s->last_lib_error = status;
+            status = CLI_RET_LIBBLADERF;
+            break;
+        }
+
+#if BLADERF_BIG_ENDIAN
+        {
+            unsigned int i;
+            for (i = 0; i < 2 * n; i++) {
+                buf[i] = LE16_TO_HOST(buf[i]);
+            }
+        }
+#endif
+
+        err = write_all(c->rx_fd, buf, n * 2 * sizeof(int16_t));
+        if (err == EPIPE) {
+            /* The reader has gone away; this is a normal way to end */
+            break;
+        } else if (err != 0 && !(err == EINTR && stream_stop)) {
+            fprintf(stderr, "Failed to write RX samples: %s\n",
+                    strerror(err));
+            status = CLI_RET_FILEOP;
+            break;
+        }
+
+        remaining -= n;
+    }
+
+    free(buf);
+    return status;
+}
+
+static int stream_tx(struct cli_state *s, struct stream_config *c)
+{
+    int status = 0;
+    bool eof = false;
+    const size_t buf_len = c->samples_per_buffer * 2 * sizeof(int16_t);
+    int16_t *buf;
+    unsigned int i;
+
+    buf = malloc(buf_len);
+    if (buf == NULL) {
+        return CLI_RET_MEM;
+    }
+
+    while (status == 0 && !stream_stop && !eof) {
+        size_t n_read;
+        int err;
+
+        err = read_full(c->tx_fd, buf, buf_len, &n_read);
+        if (err != 0) {
+            if (err != EINTR) {
+                fprintf(stderr, "Failed to read TX samples: %s\n",
+                        strerror(err));
+                status = CLI_RET_FILEOP;
+            }
+            break;
+        }
+
+        /* Pad out a partial final buffer, dropping any partial sample */
+        if (n_read < buf_len) {
+            n_read -= n_read % (2 * sizeof(int16_t));
+            memset((char *) buf + n_read, 0, buf_len - n_read);
+            eof = true;
+
+            if (n_read == 0) {
+                break;
+            }
+        }
+
+#if BLADERF_BIG_ENDIAN
+        for (i = 0; i < 2 * c->samples_per_buffer; i++) {
+            buf[i] = HOST_TO_LE16(buf[i]);
+        }
+#endif
+
+        status = bladerf_sync_tx(s->dev, buf, c->samples_per_buffer, NULL,
+                                 c->timeout_ms);
+        if (status != 0) {
+            fprintf(stderr, "TX failed: %s\n", bladerf_strerror(status));
+            s->last_lib_error = status;
+            status = CLI_RET_LIBBLADERF;
+        }
+    }
+
+    /* Flush zero samples through the device to ensure samples reach the RFFE
+     * before the TX module is disabled */
+    if (status == 0) {
+        memset(buf, 0, buf_len);
+        for (i = 0; i < (c->num_buffers + 1) && status == 0; i++) {
+            status = bladerf_sync_tx(s->dev, buf, c->samples_per_buffer,
+                                     NULL, c->timeout_ms);
+        }
+
+        if (status != 0) {
+            s->last_lib_error = status;
+            status = CLI_RET_LIBBLADERF;
+        }
+    }
+
+    free(buf);
+    return status;
+}
+
+static void *stream_tx_thread(void *arg)
+{
+    struct stream_tx_args *args = (struct stream_tx_args *) arg;
+
+    args->status = stream_tx(args->s, args->c);
+    if (args->status != 0) {
+        stream_request_stop();
+    }
+
+    return NULL;
+}
+
+static int stream_enable(struct cli_state *s, bladerf_module m, bool enable)
+{
+    int status;
+
+    MUTEX_LOCK(&s->dev_lock);
+    status = bladerf_enable_module(s->dev, m, enable);
+    MUTEX_UNLOCK(&s->dev_lock);
+
+    if (status != 0) {
+        fprintf(stderr, "Failed to %s %s module: %s\n",
+                enable ? "enable" : "disable",
+                m == BLADERF_MODULE_RX ? "RX" : "TX",
+                bladerf_strerror(status));
+        s->last_lib_error = status;
+        status = CLI_RET_LIBBLADERF;
+    }
+
+    return status;
+}
+
+static int stream_configure(struct cli_state *s, struct stream_config *c,
+                            bladerf_module m)
+{
+    int status;
+
+    status = bladerf_sync_config(s->dev, m, BLADERF_FORMAT_SC16_Q11,
+                                 c->num_buffers, c->samples_per_buffer,
+                                 c->num_transfers, c->timeout_ms);
+
+    if (status != 0) {
+        fprintf(stderr, "Failed to configure %s stream: %s\n",
+                m == BLADERF_MODULE_RX ? "RX" : "TX",
+                bladerf_strerror(status));
+        s->last_lib_error = status;
+        return CLI_RET_LIBBLADERF;
+    }
+
+    return stream_enable(s, m, true);
+}
+
+void stream_config_init(struct stream_config *c)
+{
+    c->rx_file = NULL;
+    c->tx_file = NULL;
+    c->rx_samples = 0;
+
+    /* Use the same stream defaults as the interactive rx/tx commands */
+    c->samples_per_buffer = 32 * 1024;
+    c->num_buffers = 32;
+    c->num_transfers = 16;
+    c->timeout_ms = 1000;
+
+    c->rx_fd = -1;
+    c->tx_fd = -1;
+}
+
+void stream_config_deinit(struct stream_config *c)
+{
+    if (c->rx_fd >= 0) {
+        close(c->rx_fd);
+        c->rx_fd = -1;
+    }
+
+    if (c->tx_fd >= 0) {
+        close(c->tx_fd);
+        c->tx_fd = -1;
+    }
+
+    free(c->rx_file);
+    free(c->tx_file);
+    c->rx_file = NULL;
+    c->tx_file = NULL;
+}
+
+bool stream_requested(const struct stream_config *c)
+{
+    return c->rx_file != NULL || c->tx_file != NULL;
+}
+
+int stream_open(struct stream_config *c)
+{
+    if (c->rx_file != NULL) {
+        if (!strcmp(c->rx_file, "-")) {
+            /* Take over stdout for samples, and send text to stderr */
+            fflush(stdout);
+            c->rx_fd = dup(fileno(stdout));
+            if (c->rx_fd < 0 || dup2(fileno(stderr), fileno(stdout)) < 0) {
+                perror("Failed to redirect stdout");
+                return CLI_RET_FILEOP;
+            }
+        } else {
+            c->rx_fd = open(c->rx_file, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+                            0644);
+            if (c->rx_fd < 0) {
+                fprintf(stderr, "Failed to open RX output \"%s\": %s\n",
+                        c->rx_file, strerror(errno));
+                return CLI_RET_FILEOP;
+            }
+        }
+
+#if BLADERF_OS_WINDOWS
+        _setmode(c->rx_fd, _O_BINARY);
+#endif
+    }
+
+    if (c->tx_file != NULL) {
+        if (!strcmp(c->tx_file, "-")) {
+            c->tx_fd = dup(fileno(stdin));
+        } else {
+            c->tx_fd = open(c->tx_file, O_RDONLY | O_BINARY);
+        }
+
+        if (c->tx_fd < 0) {
+            fprintf(stderr, "Failed to open TX input \"%s\": %s\n",
+                    c->tx_file, strerror(errno));
+            return CLI_RET_FILEOP;
+        }
+
+#if BLADERF_OS_WINDOWS
+        _setmode(c->tx_fd, _O_BINARY);
+#endif
+    }
+
+    return 0;
+}
+
+int stream_run(struct cli_state *s, struct stream_config *c)
+{
+    int status = 0;
+    bool rx_enabled = false;
+    bool tx_enabled = false;
+    bool tx_thread_started = false;
+    pthread_t tx_thread;
+    struct stream_tx_args tx_args;
+
+#if !BLADERF_OS_WINDOWS
+    status = stream_wake_open();
+    if (status != 0) {
+        fprintf(stderr, "Failed to create stream wakeup pipe: %s\n",
+                strerror(status));
+        stream_wake_close();
+        return CLI_RET_UNKNOWN;
+    }
+#endif
+
+    stream_init_signals();
+
+    if (c->rx_fd >= 0) {
+        status = stream_configure(s, c, BLADERF_MODULE_RX);
+        rx_enabled = (status == 0);
+    }
+
+    if (status == 0 && c->tx_fd >= 0) {
+        status = stream_configure(s, c, BLADERF_MODULE_TX);
+        tx_enabled = (status == 0);
+    }
+
+    if (status == 0) {
+        if (rx_enabled && tx_enabled) {
+            /* TX runs alongside RX. Reception continues after the TX input
+             * is exhausted, whereas TX stops when reception completes. */
+            tx_args.s = s;
+            tx_args.c = c;
+            tx_args.status = 0;
+
+            if (pthread_create(&tx_thread, NULL, stream_tx_thread,
+                               &tx_args) != 0) {
+                fprintf(stderr, "Failed to start TX thread.\n");
+                status = CLI_RET_UNKNOWN;
+            } else {
+                tx_thread_started = true;
+            }
+        }
+
+        if (status == 0 && rx_enabled) {
+            status = stream_rx(s, c);
+            stream_request_stop();
+        } else if (status == 0) {
+            status = stream_tx(s, c);
+        }
+
+        if (tx_thread_started) {
+            pthread_join(tx_thread, NULL);
+            if (status == 0) {
+                status = tx_args.status;
+            }
+        }
+    }
+
+    if (rx_enabled) {
+        const int disable_status = stream_enable(s, BLADERF_MODULE_RX, false);
+        if (status == 0) {
+            status = disable_status;
+        }
+    }
+
+    if (tx_enabled) {
+        const int disable_status = stream_enable(s, BLADERF_MODULE_TX, false);
+        if (status == 0) {
+            status = disable_status;
+        }
+    }
+
+#if !BLADERF_OS_WINDOWS
+    stream_wake_close();
+#endif
+
+    return status;
+}
@@ -0,0 +1,102 @@
+/*
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* Headless streaming mode (--rx/--tx)
+ *
+ * Samples are moved directly between the libbladeRF sync interface and a
+ * file descriptor, using one stream-buffer-sized read() or write() per
+ * block. This bypasses the interactive rx/tx tasks and stdio buffering, so
+ * bladeRF-cli may be placed in a pipeline:
+ *
+ *  bladeRF-cli -e 'set samplerate rx 10M' --rx - | dsp_tool
+ */
+#ifndef STREAM_H__
+#define STREAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "common.h"
+
+/* Stream mode configuration */
+struct stream_config {
+    char *rx_file;                  /**< RX output, "-" for stdout, or NULL */
+    char *tx_file;                  /**< TX input, "-" for stdin, or NULL */
+
+    uint64_t rx_samples;            /**< Samples to receive, or 0 to receive
+                                     *   until interrupted or the output is
+                                     *   closed */
+
+    unsigned int samples_per_buffer;
+    unsigned int num_buffers;
+    unsigned int num_transfers;
+    unsigned int timeout_ms;
+
+    /* Set by stream_open() */
+    int rx_fd;
+    int tx_fd;
+};
+
+/**
+ * Initialize a stream configuration with default values
+ *
+ * @param   c       Configuration to initialize
+ */
+void stream_config_init(struct stream_config *c);
+
+/**
+ * Close any files opened by stream_open() and free `c`'s members
+ *
+ * @param   c       Stream configuration
+ */
+void stream_config_deinit(struct stream_config *c);
+
+/**
+ * @return true if stream mode has been requested via --rx or --tx
+ */
+bool stream_requested(const struct stream_config *c);
+
+/**
+ * Open the RX output and TX input.
+ *
+ * If RX samples are to be written to stdout, stdout is reassigned to
+ * stderr, such that any messages printed by the CLI do not corrupt the
+ * sample stream. This should be called prior to printing anything.
+ *
+ * @param   c       Stream configuration
+ *
+ * @return 0 on success, CLI_RET_* on failure (and prints an error message)
+ */
+int stream_open(struct stream_config *c);
+
+/**
+ * Stream samples until the requested number of samples have been received,
+ * the TX input is exhausted, the RX output is closed, or SIGINT/SIGTERM is
+ * received.
+ *
+ * @pre stream_open() has been called successfully, and a device is open
+ *
+ * @param   s       CLI state
+ * @param   c       Stream configuration
+ *
+ * @return 0 on success, CLI_RET_* on failure (and prints an error message)
+ */
+int stream_run(struct cli_state *s, struct stream_config *c);
+
+#endif
@@ -0,0 +1,326 @@
+/**
+ * @brief   PHY throughput benchmark
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "benchmark.h"
+#include "phy.h"
+#include "radio_config.h"
+#include "utils.h"
+
+//Give up once no frame has been transmitted or received for this long
+#define BENCHMARK_IDLE_MS 2000
+//Interval at which the transmit count is checked in transmit-only mode
+#define BENCHMARK_POLL_MS 10
+
+struct sender {
+    struct phy_handle *phy;
+    unsigned int num_frames;
+    unsigned int queued;            //number of frames queued for transmission
+};
+
+static const char *stage_names[PHY_NUM_STAGES] = {
+    "tx",
+    "capture",
+    "filter",
+    "demod",
+};
+
+/**
+ * Fill a data frame with its index and a pattern derived from the index
+ */
+static void fill_frame(uint8_t *frame, uint32_t index)
+{
+    unsigned int k;
+
+    frame[0] = DATA_FRAME_CODE;
+    frame[1] = (uint8_t) index;
+    frame[2] = (uint8_t) (index >> 8);
+    frame[3] = (uint8_t) (index >> 16);
+    frame[4] = (uint8_t) (index >> 24);
+    for (k = 5; k < DATA_FRAME_LENGTH; k++){
+        frame[k] = (uint8_t) (k * 37 + index * 101);
+    }
+}
+
+/**
+ * Check a received frame against the pattern written by fill_frame()
+ *
+ * @param[in]   frame       received frame
+ * @param[out]  index       index of the frame
+ *
+ * @return      true if the frame is intact
+ */
+static bool check_frame(const uint8_t *frame, uint32_t *index)
+{
+    uint8_t expected[DATA_FRAME_LENGTH];
+
+    *index = (uint32_t) frame[1] | ((uint32_t) frame[2] << 8) |
+             ((uint32_t) frame[3] << 16) | ((uint32_t) frame[4] << 24);
+    if (frame[0] != DATA_FRAME_CODE){
+        return false;
+    }
+    fill_frame(expected, *index);
+    return memcmp(frame, expected, DATA_FRAME_LENGTH) == 0;
+}
+
+/**
+ * Thread function which queues the benchmark's frames for transmission
+ */
+static void *send_frames(void *arg)
+{
+    struct sender *s = (struct sender *) arg;
+    uint8_t frame[DATA_FRAME_LENGTH];
+
+    for (s->queued = 0; s->queued < s->num_frames; s->queued++){
+        fill_frame(frame, s->queued);
+        if (phy_fill_tx_buf(s->phy, frame, DATA_FRAME_LENGTH) != 0){
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Wait until the PHY has transmitted num_frames frames, or until it has made no
+ * progress for BENCHMARK_IDLE_MS
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int wait_for_tx(struct phy_handle *phy, unsigned int num_frames)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    struct timespec timeout_abs;
+    struct phy_stats stats;
+    uint64_t last_count = 0;
+    unsigned int idle_ms = 0;
+    int status = 0;
+
+    pthread_mutex_lock(&lock);
+    while (status == 0){
+        phy_get_stats(phy, &stats);
+        if (stats.tx_frames >= num_frames){
+            break;
+        }
+        if (stats.tx_frames != last_count){
+            last_count = stats.tx_frames;
+            idle_ms = 0;
+        }else if (idle_ms >= BENCHMARK_IDLE_MS){
+            status = -1;
+            break;
+        }
+        //Nothing signals this condition; it only provides a timed wait
+        if (create_timeout_abs(BENCHMARK_POLL_MS, &timeout_abs) != 0){
+            status = -1;
+            break;
+        }
+        status = pthread_cond_timedwait(&cond, &lock, &timeout_abs);
+        if (status == ETIMEDOUT){
+            status = 0;
+        }
+        idle_ms += BENCHMARK_POLL_MS;
+    }
+    pthread_mutex_unlock(&lock);
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&cond);
+    return (status == 0) ? 0 : -1;
+}
+
+static void print_results(const struct benchmark_params *bench, bool transmit,
+                          bool receive, unsigned int valid, unsigned int unique,
+                          unsigned int corrupt, int64_t elapsed_us,
+                          const struct phy_stats *stats)
+{
+    double elapsed = elapsed_us / 1e6;
+    uint64_t frames;
+    int i;
+
+    printf("Frames:             %u\n", bench->num_frames);
+    if (transmit){
+        printf("Transmitted:        %llu\n", (unsigned long long) stats->tx_frames);
+    }
+    if (receive){
+        printf("Received:           %u intact (%u unique), %u corrupt, "
+               "%llu dropped (rx ring full)\n", valid, unique, corrupt,
+               (unsigned long long) stats->rx_frames_dropped);
+        printf("Blocks received:    %llu (%llu dropped)\n",
+               (unsigned long long) stats->rx_blocks,
+               (unsigned long long) stats->rx_blocks_dropped);
+    }
+    printf("Elapsed:            %.3f s\n", elapsed);
+
+    frames = receive ? unique : stats->tx_frames;
+    if (elapsed > 0.0){
+        printf("Throughput:         %.1f frames/s\n", frames / elapsed);
+        if (receive){
+            //How much faster than the radio's sample rate the receiver ran
+            printf("Real-time factor:   %.2fx\n",
+                   (double) stats->rx_blocks * NUM_SAMPLES_RX /
+                   (elapsed * BLADERF_SAMPLE_RATE));
+        }
+    }
+
+    printf("CPU time per frame:\n");
+    for (i = 0; i < PHY_NUM_STAGES; i++){
+        if ((i == PHY_STAGE_TX && !transmit) || (i != PHY_STAGE_TX && !receive)){
+            continue;
+        }
+        frames = (i == PHY_STAGE_TX) ? stats->tx_frames : unique;
+        if (!stats->cpu_time_valid || frames == 0){
+            printf("    %-15s n/a\n", stage_names[i]);
+        }else{
+            printf("    %-15s %.1f us\n", stage_names[i],
+                   (double) stats->cpu_time_us[i] / frames);
+        }
+    }
+}
+
+int benchmark_run(const struct benchmark_params *bench, struct radio_params *params)
+{
+    struct phy_handle *phy = NULL;
+    struct phy_io *io;
+    struct phy_stats stats;
+    struct sender sender;
+    pthread_t sender_thread;
+    struct timespec start, end;
+    bool transmit, receive;
+    bool tx_on = false, rx_on = false, sender_on = false;
+    bool *seen = NULL;
+    unsigned int valid = 0, unique = 0, corrupt = 0;
+    uint32_t index;
+    uint8_t *frame;
+    int status = -1;
+
+    if (bench->rx_file != NULL && bench->tx_file != NULL){
+        fprintf(stderr, "Only one of the rx and tx files may be given\n");
+        return -1;
+    }
+    transmit = (bench->rx_file == NULL);
+    receive = (bench->tx_file == NULL);
+
+    if (bench->rx_file == NULL && bench->tx_file == NULL){
+        io = phy_io_open_loopback(&bench->channel);
+    }else{
+        io = phy_io_open_file(bench->rx_file, bench->tx_file);
+    }
+    if (io == NULL){
+        return -1;
+    }
+    //phy_init_io() closes io on failure
+    phy = phy_init_io(io, params);
+    if (phy == NULL){
+        fprintf(stderr, "Couldn't initialize PHY\n");
+        return -1;
+    }
+
+    seen = calloc(bench->num_frames, sizeof(seen[0]));
+    if (seen == NULL){
+        perror("calloc");
+        goto out;
+    }
+
+    if (clock_gettime(CLOCK_REALTIME, &start) != 0){
+        perror("clock_gettime");
+        goto out;
+    }
+    end = start;
+
+    if (receive){
+        if (phy_start_receiver(phy) != 0){
+            fprintf(stderr, "Couldn't start PHY receiver\n");
+            goto out;
+        }
+        rx_on = true;
+    }
+    if (transmit){
+        if (phy_start_transmitter(phy) != 0){
+            fprintf(stderr, "Couldn't start PHY transmitter\n");
+            goto out;
+        }
+        tx_on = true;
+        sender.phy = phy;
+        sender.num_frames = bench->num_frames;
+        sender.queued = 0;
+        if (pthread_create(&sender_thread, NULL, send_frames, &sender) != 0){
+            fprintf(stderr, "Couldn't create sender thread\n");
+            goto out;
+        }
+        sender_on = true;
+    }
+
+    if (receive){
+        //Receive until every frame has arrived, or until nothing more arrives
+        while (unique < bench->num_frames){
+            frame = phy_request_rx_buf(phy, BENCHMARK_IDLE_MS);
+            if (frame == NULL){
+                break;
+            }
+            if (check_frame(frame, &index)){
+                valid++;
+                //An rx file may hold more frames than were asked for
+                if (index < bench->num_frames && !seen[index]){
+                    seen[index] = true;
+                    unique++;
+                    clock_gettime(CLOCK_REALTIME, &end);
+                }
+            }else{
+                corrupt++;
+            }
+            phy_release_rx_buf(phy);
+        }
+    }else{
+        if (wait_for_tx(phy, bench->num_frames) != 0){
+            fprintf(stderr, "Transmitter stalled\n");
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+    }
+    status = 0;
+
+    out:
+        //Stop the threads first, so that their CPU times are complete
+        if (tx_on){
+            phy_stop_transmitter(phy);
+        }
+        if (sender_on){
+            pthread_join(sender_thread, NULL);
+            if (sender.queued < bench->num_frames && status == 0 && !receive){
+                fprintf(stderr, "Only %u of %u frames were queued\n", sender.queued,
+                        bench->num_frames);
+            }
+        }
+        if (rx_on){
+            phy_stop_receiver(phy);
+        }
+        if (status == 0){
+            phy_get_stats(phy, &stats);
+            print_results(bench, transmit, receive, valid, unique, corrupt,
+                          timespec_diff_us(&end, &start), &stats);
+        }
+        free(seen);
+        phy_close(phy);
+        return status;
+}
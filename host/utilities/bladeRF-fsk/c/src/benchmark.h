@@ -0,0 +1,65 @@
+/**
+ * @file
+ * @brief   PHY throughput benchmark
+ *
+ * Runs the PHY without the link layer, over one of the sample I/O
+ * implementations in phy_io.h, and reports the frame rate along with the CPU
+ * time spent per frame by each PHY thread:
+ *
+ *  - loopback:  frames are transmitted and received by the same PHY over the
+ *               simulated channel (neither file given)
+ *  - transmit:  frames are modulated and written to a file (tx_file given)
+ *  - receive:   frames are demodulated from a file (rx_file given), such as one
+ *               written in transmit mode, or a capture from a bladeRF
+ *
+ * Each frame is a data frame carrying its index and a pattern derived from it,
+ * so the receiver can count the frames that arrived intact.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include "common.h"
+#include "phy_io.h"
+
+/**
+ * Benchmark parameters
+ */
+struct benchmark_params {
+    unsigned int num_frames;        //Number of frames to transmit, or expected in
+                                    //the rx file
+    const char *rx_file;            //SC16 Q11 file to receive from, or NULL
+    const char *tx_file;            //SC16 Q11 file to transmit to, or NULL
+    struct phy_io_channel channel;  //Loopback channel impairments
+};
+
+/**
+ * Run the benchmark and print the results to stdout
+ *
+ * @param[in]   bench       benchmark parameters. At most one of rx_file and
+ *                          tx_file may be given.
+ * @param[in]   params      radio parameters (RX front end and CPU pinning)
+ *
+ * @return      0 on success, -1 on failure
+ */
+int benchmark_run(const struct benchmark_params *bench, struct radio_params *params);
+
+#endif
@@ -278,7 +278,9 @@ int main(int argc, char *argv[])
             "  Device 2> bladeRF-fsk -d *:serial=f0 -r 924M -t 904M --tx-vga2 5\n"
             "Example: File transfer between two devices at 904MHz/924MHz.\n"
             "  Receiver   > bladeRF-fsk -d *:serial=4a -r 904M -t 924M -o rx.jpg\n"
-            "  Transmitter> bladeRF-fsk -d *:serial=f0 -r 924M -t 904M -i puppy.jpg\n\n"
+            "  Transmitter> bladeRF-fsk -d *:serial=f0 -r 924M -t 904M -i puppy.jpg\n"
+            "Example: Benchmark the modem over a noisy loopback channel.\n"
+            "  > bladeRF-fsk --benchmark 500 --snr 15 --freq-offset 2000\n\n"
         );
         return 0;
     } else if (status > 0) {
@@ -286,6 +288,12 @@ int main(int argc, char *argv[])
         return status;
     }
 
+    if (config->benchmark){
+        status = benchmark_run(&config->bench, &config->params);
+        config_deinit(config);
+        return (status == 0) ? 0 : 1;
+    }
+
     if (config->quiet == false){
         printf("=============== bladeRF-fsk ================\n");
     }
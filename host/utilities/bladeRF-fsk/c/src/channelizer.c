@@ -0,0 +1,615 @@
+/**
+ * @brief   Polyphase filterbank channelizer
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "host_config.h"
+
+#include "channelizer.h"
+
+/* Number of groups of N input samples held in the input buffer, in addition
+ * to the filter history. The buffer is compacted when it fills. */
+#define CHAN_BUF_GROUPS     256
+
+struct complexf {
+    float real;
+    float imag;
+};
+
+struct channelizer {
+    unsigned int n;             /* Number of channels, N */
+    size_t taps_per_phase;      /* Taps in each polyphase component, L */
+
+    /* Prototype filter, zero-padded to L * N taps, such that the taps of
+     * polyphase component r are taps[l * N + r] */
+    float *taps;
+
+    /* Input samples. The first (L * N - 1) are the filter history. */
+    struct complexf *buf;
+    size_t hist_len;            /* L * N - 1 */
+    size_t buf_len;             /* hist_len + CHAN_BUF_GROUPS * N */
+    size_t buf_pos;             /* Number of samples in buf */
+    unsigned int fill;          /* Samples in buf since the last output */
+
+    /* N-point FFT */
+    struct complexf *fft_buf;
+    struct complexf *twiddle;   /* exp(-j*2*pi*k/N), for k < N/2 */
+    size_t *bitrev;             /* Bit-reversal permutation */
+    struct complexf *rot;       /* exp(j*2*pi*k/N): channel k's mixer phase
+                                 * at the newest sample of each group */
+};
+
+/* In-place, radix-2, decimation-in-time forward FFT */
+static void fft(struct channelizer *chan, struct complexf *x)
+{
+    const size_t n = chan->n;
+    size_t i, j, k, span;
+
+    for (i = 0; i < n; i++) {
+        j = chan->bitrev[i];
+        if (j > i) {
+            struct complexf tmp = x[i];
+            x[i] = x[j];
+            x[j] = tmp;
+        }
+    }
+
+    for (span = 1; span < n; span *= 2) {
+        const size_t stride = n / (2 * span);
+
+        for (i = 0; i < n; i += 2 * span) {
+            for (k = 0; k < span; k++) {
+                const struct complexf w = chan->twiddle[k * stride];
+                struct complexf *a = &x[i + k];
+                struct complexf *b = &x[i + k + span];
+                struct complexf t;
+
+                t.real = w.real * b->real - w.imag * b->imag;
+                t.imag = w.real * b->imag + w.imag * b->real;
+
+                b->real = a->real - t.real;
+                b->imag = a->imag - t.imag;
+                a->real += t.real;
+                a->imag += t.imag;
+            }
+        }
+    }
+}
+
+static inline int16_t clamp_sc16(float val)
+{
+    if (val >= 32767.0f) {
+        return INT16_MAX;
+    } else if (val <= -32768.0f) {
+        return INT16_MIN;
+    }
+    return (int16_t) lrintf(val);
+}
+
+/* Compute one output sample of every channel, given the index in chan->buf
+ * of the newest sample of a group.
+ *
+ * Channel k's output is
+ *      y_k = sum over i of h[i] * x[t - i] * exp(-j*2*pi*k*(t - i)/N)
+ *
+ * Splitting i into l * N + r, this is
+ *      y_k = exp(-j*2*pi*k*t/N) * sum over r of v[r] * exp(j*2*pi*k*r/N)
+ * where
+ *      v[r] = sum over l of h[l * N + r] * x[t - l * N - r]
+ *
+ * The sum over r is an inverse DFT, which is element (N - k) mod N of the
+ * forward DFT. Counting t from the first sample after a reset, the newest
+ * sample of each group is at t = N - 1 (mod N), so the leading term is
+ * exp(j*2*pi*k/N) for every group. */
+static void channelize_group(struct channelizer *chan, size_t t,
+                             struct complex_sample *const *outputs, size_t out)
+{
+    const unsigned int n = chan->n;
+    const struct complexf *newest = &chan->buf[t];
+    struct complexf *v = chan->fft_buf;
+    size_t l;
+    unsigned int r, k;
+
+    for (r = 0; r < n; r++) {
+        v[r].real = v[r].imag = 0.0f;
+    }
+
+    for (l = 0; l < chan->taps_per_phase; l++) {
+        const float *h = &chan->taps[l * n];
+        const struct complexf *x = newest - l * n;
+
+        for (r = 0; r < n; r++) {
+            v[r].real += h[r] * x[-(ptrdiff_t) r].real;
+            v[r].imag += h[r] * x[-(ptrdiff_t) r].imag;
+        }
+    }
+
+    fft(chan, v);
+
+    for (k = 0; k < n; k++) {
+        const struct complexf y = v[(n - k) & (n - 1)];
+        const struct complexf w = chan->rot[k];
+
+        outputs[k][out].i = clamp_sc16(y.real * w.real - y.imag * w.imag);
+        outputs[k][out].q = clamp_sc16(y.real * w.imag + y.imag * w.real);
+    }
+}
+
+size_t channelizer_process(struct channelizer *chan, const int16_t *input,
+                           size_t count, struct complex_sample *const *outputs)
+{
+    size_t pos, i, n, end, out = 0;
+
+    for (pos = 0; pos < count; pos += n) {
+        /* Copy as much input as fits into the buffer */
+        n = count - pos;
+        if (n > chan->buf_len - chan->buf_pos) {
+            n = chan->buf_len - chan->buf_pos;
+        }
+        end = chan->buf_pos + n;
+        for (i = 0; i < n; i++) {
+            chan->buf[chan->buf_pos + i].real = input[2 * (pos + i)];
+            chan->buf[chan->buf_pos + i].imag = input[2 * (pos + i) + 1];
+        }
+
+        /* Produce an output for each completed group */
+        for (i = chan->buf_pos + (chan->n - chan->fill); i <= end; i += chan->n) {
+            channelize_group(chan, i - 1, outputs, out++);
+        }
+        chan->fill = (unsigned int) ((chan->fill + n) % chan->n);
+        chan->buf_pos = end;
+
+        /* Compact the buffer when it is full, keeping the filter history and
+         * the partial group */
+        if (chan->buf_pos == chan->buf_len) {
+            const size_t keep = chan->hist_len + chan->fill;
+
+            memmove(chan->buf, &chan->buf[chan->buf_pos - keep],
+                    keep * sizeof(chan->buf[0]));
+            chan->buf_pos = keep;
+        }
+    }
+
+    return out;
+}
+
+void channelizer_reset(struct channelizer *chan)
+{
+    size_t i;
+
+    if (chan != NULL) {
+        for (i = 0; i < chan->hist_len; i++) {
+            chan->buf[i].real = chan->buf[i].imag = 0.0f;
+        }
+        chan->buf_pos = chan->hist_len;
+        chan->fill = 0;
+    }
+}
+
+unsigned int channelizer_num_channels(const struct channelizer *chan)
+{
+    return chan->n;
+}
+
+struct channelizer *channelizer_init_taps(unsigned int num_channels,
+                                          const float *taps, size_t num_taps)
+{
+    struct channelizer *chan;
+    size_t i, b, bits;
+
+    if (num_channels < 1 || num_channels > CHANNELIZER_MAX_CHANNELS ||
+        (num_channels & (num_channels - 1)) != 0) {
+        fprintf(stderr, "Number of channels must be a power of 2, up to %d.\n",
+                CHANNELIZER_MAX_CHANNELS);
+        return NULL;
+    } else if (taps == NULL || num_taps < 1) {
+        fprintf(stderr, "Channelizer requires at least one tap.\n");
+        return NULL;
+    }
+
+    chan = calloc(1, sizeof(chan[0]));
+    if (chan == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+
+    chan->n = num_channels;
+    chan->taps_per_phase = (num_taps + num_channels - 1) / num_channels;
+    chan->hist_len = chan->taps_per_phase * num_channels - 1;
+    chan->buf_len = chan->hist_len + CHAN_BUF_GROUPS * num_channels;
+
+    chan->taps = calloc(chan->taps_per_phase * num_channels, sizeof(chan->taps[0]));
+    chan->buf = malloc(chan->buf_len * sizeof(chan->buf[0]));
+    chan->fft_buf = malloc(num_channels * sizeof(chan->fft_buf[0]));
+    chan->twiddle = malloc((num_channels / 2 + 1) * sizeof(chan->twiddle[0]));
+    chan->bitrev = malloc(num_channels * sizeof(chan->bitrev[0]));
+    chan->rot = malloc(num_channels * sizeof(chan->rot[0]));
+
+    if (chan->taps == NULL || chan->buf == NULL || chan->fft_buf == NULL ||
+        chan->twiddle == NULL || chan->bitrev == NULL || chan->rot == NULL) {
+        perror("malloc");
+        channelizer_deinit(chan);
+        return NULL;
+    }
+
+    memcpy(chan->taps, taps, num_taps * sizeof(taps[0]));
+
+    for (i = 0; i < num_channels / 2; i++) {
+        const double theta = -2.0 * M_PI * (double) i / (double) num_channels;
+        chan->twiddle[i].real = (float) cos(theta);
+        chan->twiddle[i].imag = (float) sin(theta);
+    }
+
+    for (bits = 0; ((size_t) 1 << bits) < num_channels; bits++);
+
+    for (i = 0; i < num_channels; i++) {
+        size_t rev = 0;
+        for (b = 0; b < bits; b++) {
+            if (i & ((size_t) 1 << b)) {
+                rev |= (size_t) 1 << (bits - 1 - b);
+            }
+        }
+        chan->bitrev[i] = rev;
+    }
+
+    /* exp(-j*2*pi*k*(N - 1)/N), as described in channelize_group() */
+    for (i = 0; i < num_channels; i++) {
+        const double theta = 2.0 * M_PI * (double) i / (double) num_channels;
+        chan->rot[i].real = (float) cos(theta);
+        chan->rot[i].imag = (float) sin(theta);
+    }
+
+    channelizer_reset(chan);
+    return chan;
+}
+
+struct channelizer *channelizer_init(unsigned int num_channels)
+{
+    struct channelizer *chan = NULL;
+    float *taps;
+    size_t num_taps, i;
+    double sum = 0.0;
+
+    if (num_channels < 1 || num_channels > CHANNELIZER_MAX_CHANNELS) {
+        return channelizer_init_taps(num_channels, NULL, 0);
+    }
+
+    num_taps = CHANNELIZER_TAPS_PER_CHANNEL * num_channels;
+    taps = malloc(num_taps * sizeof(taps[0]));
+    if (taps == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    /* Windowed sinc with its cutoff at 1/(2N) cycles/sample */
+    for (i = 0; i < num_taps; i++) {
+        const double m = (double) i - (num_taps - 1) / 2.0;
+        const double x = 2.0 * M_PI * i / (num_taps - 1);
+        const double sinc = (m == 0.0) ? 1.0 :
+                            sin(M_PI * m / num_channels) / (M_PI * m / num_channels);
+        const double window = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x)
+                              - 0.01168 * cos(3 * x);
+
+        taps[i] = (float) (sinc * window);
+        sum += taps[i];
+    }
+
+    /* Unity gain at DC */
+    for (i = 0; i < num_taps; i++) {
+        taps[i] = (float) (taps[i] / sum);
+    }
+
+    chan = channelizer_init_taps(num_channels, taps, num_taps);
+    free(taps);
+    return chan;
+}
+
+void channelizer_deinit(struct channelizer *chan)
+{
+    if (chan != NULL) {
+        free(chan->taps);
+        free(chan->buf);
+        free(chan->fft_buf);
+        free(chan->twiddle);
+        free(chan->bitrev);
+        free(chan->rot);
+        free(chan);
+    }
+}
+
+#ifdef CHANNELIZER_TEST
+#include <time.h>
+#include "utils.h"
+
+/* Test parameters */
+#define TEST_AMPLITUDE      1000.0
+#define TEST_GROUPS         4096        /* Output samples per channel */
+#define TEST_SETTLE         64          /* Outputs skipped while the filter fills */
+#define TEST_PASS_OFFSET    0.25        /* Passband tone offset, in channels */
+#define TEST_STOP_OFFSET    0.75        /* Stopband tone offset, in channels */
+#define TEST_MAX_RIPPLE_DB  0.1
+#define TEST_MIN_REJECT_DB  80.0
+
+/* Benchmark parameters */
+#define BENCH_CHANNELS      16
+#define BENCH_NUM_SAMPLES   (BENCH_CHANNELS * 16384)
+#define BENCH_ITERATIONS    16
+
+/* Generate a tone at the provided frequency, in channels (Fs) relative to the
+ * input's center frequency */
+static void gen_tone(int16_t *samples, size_t count, unsigned int n, double freq)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        const double theta = 2.0 * M_PI * freq * (double) i / (double) n;
+        samples[2 * i]     = (int16_t) lrint(TEST_AMPLITUDE * cos(theta));
+        samples[2 * i + 1] = (int16_t) lrint(TEST_AMPLITUDE * sin(theta));
+    }
+}
+
+/* Power of a channel's output, relative to the test tone, in dB */
+static double power_db(const struct complex_sample *samples, size_t count)
+{
+    double pwr = 0.0;
+    size_t i;
+
+    for (i = TEST_SETTLE; i < count; i++) {
+        pwr += (double) samples[i].i * samples[i].i +
+               (double) samples[i].q * samples[i].q;
+    }
+    pwr /= (double) (count - TEST_SETTLE);
+
+    return 10.0 * log10(pwr / (TEST_AMPLITUDE * TEST_AMPLITUDE) + 1e-30);
+}
+
+/* Center frequency of channel k, in channels */
+static double center(unsigned int k, unsigned int n)
+{
+    return (k < n / 2) ? (double) k : (double) k - (double) n;
+}
+
+static int alloc_outputs(unsigned int n, size_t len, struct complex_sample **outputs)
+{
+    unsigned int k;
+
+    for (k = 0; k < n; k++) {
+        outputs[k] = malloc(len * sizeof(outputs[k][0]));
+        if (outputs[k] == NULL) {
+            perror("malloc");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_outputs(unsigned int n, struct complex_sample **outputs)
+{
+    unsigned int k;
+
+    for (k = 0; k < n; k++) {
+        free(outputs[k]);
+        outputs[k] = NULL;
+    }
+}
+
+/* Pass a tone through each channel's passband, and through the stopband of its
+ * neighbor, and check the power seen by every channel */
+static int test_response(unsigned int n)
+{
+    struct complex_sample *outputs[CHANNELIZER_MAX_CHANNELS] = { NULL };
+    struct channelizer *chan = NULL;
+    int16_t *input = NULL;
+    const size_t count = (size_t) TEST_GROUPS * n;
+    unsigned int tone, k;
+    size_t out;
+    double pwr;
+    int status = -1;
+
+    chan = channelizer_init(n);
+    input = malloc(2 * count * sizeof(input[0]));
+    if (chan == NULL || input == NULL || alloc_outputs(n, TEST_GROUPS + 1, outputs)) {
+        fprintf(stderr, "Failed to allocate test resources.\n");
+        goto out;
+    }
+
+    for (tone = 0; tone < n; tone++) {
+        /* In the passband of channel `tone` */
+        gen_tone(input, count, n, center(tone, n) + TEST_PASS_OFFSET);
+        channelizer_reset(chan);
+        out = channelizer_process(chan, input, count, outputs);
+        if (out != TEST_GROUPS) {
+            fprintf(stderr, "N=%u: Expected %d outputs, got %zu.\n", n,
+                    TEST_GROUPS, out);
+            goto out;
+        }
+
+        for (k = 0; k < n; k++) {
+            pwr = power_db(outputs[k], out);
+            if (k == tone && fabs(pwr) > TEST_MAX_RIPPLE_DB) {
+                fprintf(stderr, "N=%u: Channel %u passband gain is %.2f dB.\n",
+                        n, k, pwr);
+                goto out;
+            } else if (k != tone && pwr > -TEST_MIN_REJECT_DB) {
+                fprintf(stderr, "N=%u: Channel %u sees channel %u's tone at "
+                        "%.1f dB.\n", n, k, tone, pwr);
+                goto out;
+            }
+        }
+
+        /* In the stopband of channel `tone`, when there are other channels */
+        if (n > 1) {
+            gen_tone(input, count, n, center(tone, n) + TEST_STOP_OFFSET);
+            channelizer_reset(chan);
+            out = channelizer_process(chan, input, count, outputs);
+            pwr = power_db(outputs[tone], out);
+            if (pwr > -TEST_MIN_REJECT_DB) {
+                fprintf(stderr, "N=%u: Channel %u stopband gain is %.1f dB.\n",
+                        n, tone, pwr);
+                goto out;
+            }
+        }
+    }
+
+    status = 0;
+
+out:
+    free_outputs(n, outputs);
+    free(input);
+    channelizer_deinit(chan);
+    return status;
+}
+
+/* Check that processing a stream in blocks of varying size, including partial
+ * groups, yields the same output as processing it all at once */
+static int test_blocks(unsigned int n)
+{
+    struct complex_sample *whole[CHANNELIZER_MAX_CHANNELS] = { NULL };
+    struct complex_sample *parts[CHANNELIZER_MAX_CHANNELS] = { NULL };
+    struct complex_sample *cursor[CHANNELIZER_MAX_CHANNELS];
+    struct channelizer *chan = NULL;
+    int16_t *input = NULL;
+    const size_t count = (size_t) TEST_GROUPS * n + n / 2;
+    size_t i, pos, len, out_whole, out_parts = 0;
+    unsigned int k;
+    int status = -1;
+
+    chan = channelizer_init(n);
+    input = malloc(2 * count * sizeof(input[0]));
+    if (chan == NULL || input == NULL ||
+        alloc_outputs(n, TEST_GROUPS + 1, whole) ||
+        alloc_outputs(n, TEST_GROUPS + 1, parts)) {
+        fprintf(stderr, "Failed to allocate test resources.\n");
+        goto out;
+    }
+
+    srand(n);
+    for (i = 0; i < 2 * count; i++) {
+        input[i] = (int16_t) ((rand() % 4001) - 2000);
+    }
+
+    out_whole = channelizer_process(chan, input, count, whole);
+
+    channelizer_reset(chan);
+    for (pos = 0; pos < count; pos += len) {
+        len = 1 + (size_t) rand() % (3 * n + 997);
+        if (len > count - pos) {
+            len = count - pos;
+        }
+        for (k = 0; k < n; k++) {
+            cursor[k] = &parts[k][out_parts];
+        }
+        out_parts += channelizer_process(chan, &input[2 * pos], len, cursor);
+    }
+
+    if (out_whole != out_parts || out_whole != TEST_GROUPS) {
+        fprintf(stderr, "N=%u: Output counts differ: %zu vs. %zu.\n", n,
+                out_whole, out_parts);
+        goto out;
+    }
+    for (k = 0; k < n; k++) {
+        if (memcmp(whole[k], parts[k], out_whole * sizeof(whole[k][0])) != 0) {
+            fprintf(stderr, "N=%u: Channel %u output depends on block size.\n",
+                    n, k);
+            goto out;
+        }
+    }
+
+    status = 0;
+
+out:
+    free_outputs(n, whole);
+    free_outputs(n, parts);
+    free(input);
+    channelizer_deinit(chan);
+    return status;
+}
+
+static int benchmark(void)
+{
+    struct complex_sample *outputs[CHANNELIZER_MAX_CHANNELS] = { NULL };
+    struct channelizer *chan = NULL;
+    int16_t *input = NULL;
+    struct timespec start, end;
+    size_t i;
+    int iter;
+    int status = -1;
+
+    chan = channelizer_init(BENCH_CHANNELS);
+    input = malloc(2 * BENCH_NUM_SAMPLES * sizeof(input[0]));
+    if (chan == NULL || input == NULL ||
+        alloc_outputs(BENCH_CHANNELS, BENCH_NUM_SAMPLES / BENCH_CHANNELS + 1,
+                      outputs)) {
+        fprintf(stderr, "Failed to allocate benchmark resources.\n");
+        goto out;
+    }
+
+    srand(0);
+    for (i = 0; i < 2 * BENCH_NUM_SAMPLES; i++) {
+        input[i] = (int16_t) ((rand() % 4001) - 2000);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    for (iter = 0; iter < BENCH_ITERATIONS; iter++) {
+        channelizer_process(chan, input, BENCH_NUM_SAMPLES, outputs);
+    }
+    clock_gettime(CLOCK_REALTIME, &end);
+
+    printf("%d channels: %.2f MSamples/s in\n", BENCH_CHANNELS,
+           BENCH_ITERATIONS * (BENCH_NUM_SAMPLES / 1e6) /
+           (timespec_diff_us(&end, &start) / 1e6));
+    status = 0;
+
+out:
+    free_outputs(BENCH_CHANNELS, outputs);
+    free(input);
+    channelizer_deinit(chan);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n;
+    int status = 0;
+
+    if (argc == 2 && !strcmp(argv[1], "--benchmark")) {
+        return benchmark() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [--benchmark]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (n = 1; n <= CHANNELIZER_MAX_CHANNELS && status == 0; n *= 2) {
+        status = test_response(n);
+        if (status == 0) {
+            status = test_blocks(n);
+        }
+        printf("%2u channels: %s\n", n, status == 0 ? "Pass" : "Fail");
+    }
+
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
@@ -0,0 +1,116 @@
+/**
+ * @file
+ * @brief   Polyphase filterbank channelizer
+ *
+ * Splits a wideband signal into N adjacent channels, each decimated by N. With
+ * an input sample rate of N * Fs, channel k is centered at k * Fs (k < N/2) or
+ * (k - N) * Fs (k >= N/2) relative to the input's center frequency, and is
+ * output at a sample rate of Fs.
+ *
+ * The prototype low-pass filter is split into N polyphase components, so that
+ * one output sample of every channel costs one pass over the filter taps and
+ * one N-point FFT.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CHANNELIZER_H_
+#define CHANNELIZER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/* Maximum number of channels */
+#define CHANNELIZER_MAX_CHANNELS    64
+
+/* Number of prototype filter taps per channel used by channelizer_init() */
+#define CHANNELIZER_TAPS_PER_CHANNEL 16
+
+struct channelizer;
+
+/**
+ * Create a channelizer with a default prototype filter: a Blackman-Harris
+ * windowed sinc of CHANNELIZER_TAPS_PER_CHANNEL * N taps, with its cutoff at the
+ * channel edge (Fs / 2). Each channel's response is flat to within 0.1 dB out
+ * to Fs / 4, and at least 80 dB down beyond 3 * Fs / 4.
+ *
+ * @param[in]   num_channels    Number of channels, N. Must be a power of 2, and
+ *                              at most CHANNELIZER_MAX_CHANNELS.
+ *
+ * @return      `channelizer` handle on success,
+ *              or NULL on failure or invalid parameter
+ */
+struct channelizer *channelizer_init(unsigned int num_channels);
+
+/**
+ * Create a channelizer with the provided prototype filter
+ *
+ * @param[in]   num_channels    Number of channels, N. Must be a power of 2, and
+ *                              at most CHANNELIZER_MAX_CHANNELS.
+ * @param[in]   taps            Low-pass prototype filter taps, at the input
+ *                              sample rate. A DC gain of 1 preserves the
+ *                              amplitude of each channel's signal.
+ * @param[in]   num_taps        Number of taps contained within `taps`
+ *
+ * @return      `channelizer` handle on success,
+ *              or NULL on failure or invalid parameter
+ */
+struct channelizer *channelizer_init_taps(unsigned int num_channels,
+                                          const float *taps, size_t num_taps);
+
+/**
+ * Deinitialize and deallocate the provided channelizer
+ *
+ * @param   chan        Channelizer to deinitialize
+ */
+void channelizer_deinit(struct channelizer *chan);
+
+/**
+ * Clear the channelizer's state, as if it had been newly constructed
+ *
+ * @param   chan        Channelizer to reset
+ */
+void channelizer_reset(struct channelizer *chan);
+
+/**
+ * @param   chan        Channelizer
+ *
+ * @return  Number of channels, N
+ */
+unsigned int channelizer_num_channels(const struct channelizer *chan);
+
+/**
+ * Channelize a block of samples. Filter state, and any partial group of N input
+ * samples, is carried across calls, so a stream may be processed in blocks of
+ * any size.
+ *
+ * @param[in]   chan        Channelizer to use
+ * @param[in]   input       Input SC16Q11 samples (interleaved I/Q)
+ * @param[in]   count       Number of input samples to process
+ * @param[out]  outputs     N output buffers, one per channel. Each must have
+ *                          room for (count / N) + 1 samples.
+ *
+ * @return  Number of samples written to each output buffer
+ */
+size_t channelizer_process(struct channelizer *chan, const int16_t *input,
+                           size_t count, struct complex_sample *const *outputs);
+
+#endif
@@ -32,6 +32,12 @@ struct complex_sample {
     int16_t q;
 };
 
+//Implementation of the RX front end (channel filter + power normalization)
+enum rx_frontend {
+    RX_FRONTEND_FUSED,    //Single pass over each block, in cache-sized tiles
+    RX_FRONTEND_SPLIT,    //Separate filter and pnorm passes over the whole block
+};
+
 struct radio_params {
     //TX
     unsigned int tx_freq;
@@ -42,6 +48,16 @@ struct radio_params {
     bladerf_lna_gain rx_lna_gain;    //Range: 0 to 6 dB
     int rx_vga1_gain;    //Range: 5 to 30 dB
     int rx_vga2_gain;    //Range: 0 to 30 dB
+    //CPUs on which to run the RX capture, filter, and demod threads, or -1 to
+    //leave a thread unpinned
+    int rx_cpus[3];
+    //RX front end implementation
+    enum rx_frontend rx_frontend;
+    //Number of adjacent channels received at once (see phy_mchan.h). The RX
+    //sample rate and bandwidth are scaled by this. 0 is treated as 1.
+    unsigned int rx_channels;
+    //Modem samples per symbol: 4, 8, or 16. 0 selects SAMP_PER_SYMB.
+    unsigned int samp_per_symb;
 };
 
 #endif
@@ -26,9 +26,13 @@
 #include <getopt.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <math.h>
 
 #include "config.h"
 #include "conversions.h"
+#include "radio_config.h"
+#include "fsk.h"
+#include "rx_ch_filter.h"
 
 #ifdef DEBUG_CONFIG
 #   define pr_dbg(...) fprintf(stderr, "[CONFIG] " __VA_ARGS__)
@@ -47,12 +51,23 @@
 #define OPTION_RXLNA    0x80
 #define OPTION_RXVGA1   0x81
 #define OPTION_RXVGA2   0x82
+#define OPTION_RXCPUS   0x83
+#define OPTION_RXFRONT  0x84
 
 #define OPTION_TXFREQ   't'
 #define OPTION_OUTPUT   'o'
 #define OPTION_TXVGA1   0x90
 #define OPTION_TXVGA2   0x91
 
+#define OPTION_BENCH    0xa0
+#define OPTION_SNR      0xa1
+#define OPTION_FREQOFF  0xa2
+#define OPTION_DROPRATE 0xa3
+#define OPTION_RXFILE   0xa4
+#define OPTION_TXFILE   0xa5
+
+#define OPTION_SPS      0xb0
+
 #define RX_FREQ_DEFAULT 904000000
 #define RX_LNA_DEFAULT  BLADERF_LNA_GAIN_MAX
 #define RX_VGA1_DEFAULT BLADERF_RXVGA1_GAIN_MAX
@@ -62,6 +77,8 @@
 #define TX_VGA1_DEFAULT BLADERF_TXVGA1_GAIN_MAX
 #define TX_VGA2_DEFAULT BLADERF_TXVGA2_GAIN_MIN
 
+#define BENCH_DROP_LEN_DEFAULT  1024
+
 static struct option long_options[] = {
     { "help",     no_argument,        NULL,   OPTION_HELP     },
     { "device",   required_argument,  NULL,   OPTION_DEVICE   },
@@ -72,12 +89,23 @@ static struct option long_options[] = {
     { "rx-vga1",  required_argument,  NULL,   OPTION_RXVGA1   },
     { "rx-vga2",  required_argument,  NULL,   OPTION_RXVGA2   },
     { "rx-freq",  required_argument,  NULL,   OPTION_RXFREQ   },
+    { "rx-cpus",  required_argument,  NULL,   OPTION_RXCPUS   },
+    { "rx-frontend", required_argument, NULL, OPTION_RXFRONT  },
 
     { "input",    required_argument,  NULL,   OPTION_INPUT    },
     { "tx-vga1",  required_argument,  NULL,   OPTION_TXVGA1   },
     { "tx-vga2",  required_argument,  NULL,   OPTION_TXVGA2   },
     { "tx-freq",  required_argument,  NULL,   OPTION_TXFREQ   },
 
+    { "benchmark",   required_argument, NULL, OPTION_BENCH    },
+    { "snr",         required_argument, NULL, OPTION_SNR      },
+    { "freq-offset", required_argument, NULL, OPTION_FREQOFF  },
+    { "drop-rate",   required_argument, NULL, OPTION_DROPRATE },
+    { "rx-file",     required_argument, NULL, OPTION_RXFILE   },
+    { "tx-file",     required_argument, NULL, OPTION_TXFILE   },
+
+    { "sps",      required_argument,  NULL,   OPTION_SPS      },
+
     { NULL,       0,                  NULL,   0               },
 };
 
@@ -114,6 +142,15 @@ static struct config *alloc_config_with_defaults()
     config->params.rx_vga1_gain    = RX_VGA1_DEFAULT;
     config->params.rx_vga2_gain    = RX_VGA2_DEFAULT;
 
+    config->params.rx_cpus[0]       = -1;
+    config->params.rx_cpus[1]       = -1;
+    config->params.rx_cpus[2]       = -1;
+    config->params.rx_frontend      = RX_FRONTEND_FUSED;
+    config->params.rx_channels      = 1;
+
+    /* Modem defaults */
+    config->params.samp_per_symb    = SAMP_PER_SYMB;
+
 
     /* TX defaults */
     config->tx_input            = NULL;
@@ -123,6 +160,11 @@ static struct config *alloc_config_with_defaults()
     config->params.tx_vga1_gain    = TX_VGA1_DEFAULT;
     config->params.tx_vga2_gain    = TX_VGA2_DEFAULT;
 
+
+    /* Benchmark defaults: an ideal loopback channel */
+    config->bench.channel.snr_db        = INFINITY;
+    config->bench.channel.drop_len      = BENCH_DROP_LEN_DEFAULT;
+
     return config;
 }
 
@@ -131,6 +173,11 @@ static int init_remaining_params(struct config *config)
 {
     int status;
 
+    //The benchmark does not use a device, nor the data input/output
+    if (config->benchmark) {
+        return 0;
+    }
+
     if (config->bladerf_dev == NULL) {
         status = bladerf_open(&config->bladerf_dev, NULL);
         if (status != 0) {
@@ -160,6 +207,7 @@ int config_init_from_cmdline(int argc, char * const argv[],
     int c, idx;
     bool valid;
     struct stat file_info;
+    size_t filter_len;
 
     config = alloc_config_with_defaults();
     if (config == NULL) {
@@ -251,6 +299,30 @@ int config_init_from_cmdline(int argc, char * const argv[],
                 }
                 break;
 
+            case OPTION_RXCPUS:
+                if (sscanf(optarg, "%d,%d,%d", &config->params.rx_cpus[0],
+                           &config->params.rx_cpus[1],
+                           &config->params.rx_cpus[2]) != 3 ||
+                    config->params.rx_cpus[0] < -1 ||
+                    config->params.rx_cpus[1] < -1 ||
+                    config->params.rx_cpus[2] < -1) {
+                    status = -1;
+                    fprintf(stderr, "Invalid RX CPUs: %s\n", optarg);
+                    goto out;
+                }
+                break;
+
+            case OPTION_RXFRONT:
+                if (!strcasecmp(optarg, "fused")) {
+                    config->params.rx_frontend = RX_FRONTEND_FUSED;
+                } else if (!strcasecmp(optarg, "split")) {
+                    config->params.rx_frontend = RX_FRONTEND_SPLIT;
+                } else {
+                    status = -1;
+                    fprintf(stderr, "Invalid RX front end: %s\n", optarg);
+                    goto out;
+                }
+                break;
 
             case OPTION_INPUT:
                 if (config->tx_input == NULL) {
@@ -321,6 +393,66 @@ int config_init_from_cmdline(int argc, char * const argv[],
             case OPTION_QUIET:
                 config->quiet = true;
                 break;
+
+            case OPTION_SPS:
+                config->params.samp_per_symb = str2uint(optarg, 1, UINT_MAX, &valid);
+                if (!valid || rx_ch_filter_for_sps(config->params.samp_per_symb,
+                                                   &filter_len) == NULL) {
+                    status = -1;
+                    fprintf(stderr, "Invalid samples per symbol: %s\n", optarg);
+                    goto out;
+                }
+                break;
+
+            case OPTION_BENCH:
+                config->bench.num_frames = str2uint(optarg, 1, UINT_MAX, &valid);
+                if (!valid) {
+                    status = -1;
+                    fprintf(stderr, "Invalid number of benchmark frames: %s\n",
+                            optarg);
+                    goto out;
+                }
+                config->benchmark = true;
+                break;
+
+            case OPTION_SNR:
+                config->bench.channel.snr_db =
+                    str2double(optarg, -INFINITY, INFINITY, &valid);
+                if (!valid) {
+                    status = -1;
+                    fprintf(stderr, "Invalid SNR: %s\n", optarg);
+                    goto out;
+                }
+                break;
+
+            case OPTION_FREQOFF:
+                config->bench.channel.freq_offset =
+                    str2double(optarg, -BLADERF_SAMPLE_RATE / 2.0,
+                               BLADERF_SAMPLE_RATE / 2.0, &valid);
+                if (!valid) {
+                    status = -1;
+                    fprintf(stderr, "Invalid frequency offset: %s\n", optarg);
+                    goto out;
+                }
+                break;
+
+            case OPTION_DROPRATE:
+                config->bench.channel.drop_rate =
+                    str2double(optarg, 0.0, 1.0, &valid);
+                if (!valid) {
+                    status = -1;
+                    fprintf(stderr, "Invalid drop rate: %s\n", optarg);
+                    goto out;
+                }
+                break;
+
+            case OPTION_RXFILE:
+                config->bench.rx_file = optarg;
+                break;
+
+            case OPTION_TXFILE:
+                config->bench.tx_file = optarg;
+                break;
         }
     }
 
@@ -379,11 +511,29 @@ void config_print_options()
 "   --rx-lna <value>        RX LNA gain. Values: bypass, mid, max (default)\n"
 "   --rx-vga1 <value>       RX VGA1 gain. Range: %d to %d. Default = %d.\n"
 "   --rx-vga2 <value>       RX VGA2 gain. Range: %d to %d. Default = %d.\n"
+"   --rx-cpus <c,f,d>       Pin the RX capture, filter, and demod threads to\n"
+"                            these CPUs (-1 = unpinned). Default: -1,-1,-1\n"
+"   --rx-frontend <value>   RX filter/normalization implementation.\n"
+"                            Values: fused (default), split\n"
 "\n"
 "   -t, --tx-freq <freq>    TX frequency. Default: %d\n"
 "   -i, --input <file>      TX data input. stdin is used if not specified.\n"
 "   --tx-vga1 <value>       TX VGA1 gain. Range: %d to %d. Default = %d.\n"
-"   --tx-vga2 <value>       TX VGA2 gain. Range: %d to %d. Default = %d.\n",
+"   --tx-vga2 <value>       TX VGA2 gain. Range: %d to %d. Default = %d.\n"
+"\n"
+"   --sps <value>           Modem samples per symbol. Both ends must use the\n"
+"                            same value. Values: 4, 8, 16. Default: %d\n"
+"\n"
+"   --benchmark <frames>    Benchmark the modem with this many frames, rather\n"
+"                            than transferring data. No device is used.\n"
+"   --rx-file <file>        Benchmark: receive from this SC16 Q11 file.\n"
+"   --tx-file <file>        Benchmark: transmit to this SC16 Q11 file.\n"
+"                            Without either file, the modem's output is\n"
+"                            looped back to its input.\n"
+"   --snr <dB>              Loopback SNR. Default: inf (no noise)\n"
+"   --freq-offset <Hz>      Loopback frequency offset. Default: 0\n"
+"   --drop-rate <p>         Loopback probability of dropping %d samples\n"
+"                            from each burst. Range: 0 to 1. Default: 0\n",
 
     RX_FREQ_DEFAULT,
     BLADERF_RXVGA1_GAIN_MIN, BLADERF_RXVGA1_GAIN_MAX, RX_VGA1_DEFAULT,
@@ -391,7 +541,11 @@ void config_print_options()
 
     TX_FREQ_DEFAULT,
     BLADERF_TXVGA1_GAIN_MIN, BLADERF_TXVGA1_GAIN_MAX, TX_VGA1_DEFAULT,
-    BLADERF_TXVGA2_GAIN_MIN, BLADERF_TXVGA2_GAIN_MAX, TX_VGA2_DEFAULT
+    BLADERF_TXVGA2_GAIN_MIN, BLADERF_TXVGA2_GAIN_MAX, TX_VGA2_DEFAULT,
+
+    SAMP_PER_SYMB,
+
+    BENCH_DROP_LEN_DEFAULT
 
     );
 }
@@ -416,6 +570,10 @@ void print_config(const struct config *config)
     printf("    LNA gain:       %d\n", config->params.rx_lna_gain);
     printf("    VGA1 gain:      %d\n", config->params.rx_vga1_gain);
     printf("    VGA2 gain:      %d\n", config->params.rx_vga2_gain);
+    printf("    CPUs:           %d,%d,%d\n", config->params.rx_cpus[0],
+           config->params.rx_cpus[1], config->params.rx_cpus[2]);
+    printf("    Front end:      %s\n",
+           config->params.rx_frontend == RX_FRONTEND_FUSED ? "fused" : "split");
     printf("\n");
     printf("TX Parameters:\n");
     printf("    Input handle:   %p\n", config->tx_input);
@@ -423,6 +581,21 @@ void print_config(const struct config *config)
     printf("    VGA1 gain:      %d\n", config->params.tx_vga1_gain);
     printf("    VGA2 gain:      %d\n", config->params.tx_vga2_gain);
     printf("\n");
+    printf("Modem Parameters:\n");
+    printf("    Samples/symbol: %u\n", config->params.samp_per_symb);
+    printf("\n");
+    if (config->benchmark) {
+        printf("Benchmark Parameters:\n");
+        printf("    Frames:         %u\n", config->bench.num_frames);
+        printf("    RX file:        %s\n",
+               config->bench.rx_file ? config->bench.rx_file : "(none)");
+        printf("    TX file:        %s\n",
+               config->bench.tx_file ? config->bench.tx_file : "(none)");
+        printf("    SNR (dB):       %g\n", config->bench.channel.snr_db);
+        printf("    Freq offset:    %g\n", config->bench.channel.freq_offset);
+        printf("    Drop rate:      %g\n", config->bench.channel.drop_rate);
+        printf("\n");
+    }
 }
 
 int main(int argc, char *argv[])
@@ -26,6 +26,7 @@
 #include <libbladeRF.h>
 
 #include "common.h"
+#include "benchmark.h"
 
 /**
  * Application configuration parameters
@@ -37,6 +38,8 @@ struct config {
     FILE *tx_input;                 //File to read transmitted data from
     long int tx_filesize;           //Size of the tx_input file, if it is not stdin
     bool quiet;                     //Option to suppress printing of banner message
+    bool benchmark;                 //Run the PHY benchmark instead of a transfer
+    struct benchmark_params bench;  //Benchmark parameters
 };
 
 
@@ -28,9 +28,21 @@
 #include <string.h>
 #include <limits.h>
 #include <inttypes.h>
-
-#include "correlator.h"
+#include <math.h>
 #include "host_config.h"
+#include "correlator.h"
+#include "utils.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define CORR_USE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
+
+#ifdef HAVE_AVX_FMA
+#   include <immintrin.h>
+#endif
 
 #ifdef ENABLE_CORR_DEBUG_MSG
 #   define DBG(...) fprintf(stderr, "[Corr]  " __VA_ARGS__)
@@ -42,14 +54,44 @@
 
 #define LOG_FILE_SUFFIX  "_correlator_log.csv"
 
+/* With CORR_BACKEND_AUTO, the FFT backend is used for references of at least
+ * this many (decimated) samples. Use `bladeRF-fsk_test_correlator --benchmark`
+ * to compare the backends on a particular machine. */
+#define CORR_FFT_MIN_LEN    128
+
+/* The FFT length is the smallest power of 2 that is >= this multiple of the
+ * reference length. Larger FFTs yield more results per transform, at the
+ * cost of additional work per transform. */
+#define CORR_FFT_LEN_MULT   4
+
+/* Number of (decimated) results computed per block by the direct backend */
+#define CORR_BLOCK_LEN      256
+
+/* Reference and power arrays are padded to a multiple of this many floats,
+ * such that the vector kernels need no remainder handling */
+#define CORR_PAD_FLOATS     8
+
+/* Alignment of the reference and power arrays, in bytes */
+#define CORR_ALIGNMENT      32
+
+/* The reference is scaled by 1/2048 for each of the reference and input
+ * samples, so that input samples need not be scaled when loaded */
+#define CORR_SCALE          (1.0f / (2048.0f * 2048.0f))
+
 struct complexf {
     float real;
     float imag;
 };
 
 struct correlator {
-    struct complexf *ref;       /* Reference signal to correlate against */
+    /* Conjugated reference signal to correlate against, scaled by
+     * CORR_SCALE and zero-padded to `padded_len` */
+    float *ref_re;
+    float *ref_im;
+    void *ref_alloc;
+
     size_t len;                 /* Length of reference sig, insamples */
+    size_t padded_len;          /* len, padded to CORR_PAD_FLOATS */
 
     float threshold_pwr;        /* Correlation power threshold */
 
@@ -67,10 +109,33 @@ struct correlator {
     uint64_t match_timestamp;   /* Timestamp when we found our max
                                  * correlation value */
 
-    struct complexf *buf;       /* Sample buffer */
-    struct complexf *ins1;      /* Insertion points */
-    struct complexf *ins2;
-    struct complexf *end;       /* Pointer to element past buf */
+    enum corr_backend backend;
+
+    /* Kernels selected for this machine */
+    void (*correlate_block)(struct correlator *corr, size_t count);
+    bool (*any_above)(const float *pwr, size_t n, float threshold);
+
+    /* Input samples, as split real/imag arrays. The first (len - 1)
+     * elements are the history carried over from the previous block. For
+     * the direct backend, this is followed by up to `block_len` new
+     * samples, and padding that may be read (and multiplied by zero-valued
+     * reference samples) by the kernels. */
+    float *hist_re;
+    float *hist_im;
+    void *hist_alloc;
+
+    size_t block_len;           /* Results per block */
+    float *pwr;                 /* Correlation power of each result in the
+                                 * current block */
+    void *pwr_alloc;
+
+    /* FFT backend */
+    size_t fft_len;             /* Transform length, N (a power of 2) */
+    struct complexf *fft_ref;   /* Conjugated reference spectrum, scaled
+                                 * by 1/N */
+    struct complexf *fft_buf;   /* Transform working buffer */
+    struct complexf *twiddle;   /* exp(-j*2*pi*k/N), for k < N/2 */
+    size_t *bitrev;             /* Bit-reversal permutation */
 
 #   ifdef LOG_CORRELATOR_OUTPUT
     FILE *out;
@@ -78,7 +143,7 @@ struct correlator {
 };
 
 #ifdef LOG_CORRELATION_SIGNAL
-static void save_reference_sig(struct complexf *ref, size_t len)
+static void save_reference_sig(const struct correlator *corr)
 {
     size_t i;
     FILE *out = fopen("corr_sig.csv", "w");
@@ -87,15 +152,315 @@ static void save_reference_sig(struct complexf *ref, size_t len)
         return;
     }
 
-    for (i = 0; i < len; i++) {
-        fprintf(out, "%f,%f\n", ref[i].real, ref[i].imag);
+    for (i = 0; i < corr->len; i++) {
+        fprintf(out, "%f,%f\n", corr->ref_re[i] * 2048.0f,
+                                corr->ref_im[i] * 2048.0f);
     }
 
     fclose(out);
 }
 #endif
 
-struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
+/* Compute the power of the complex dot product of `n` input samples and
+ * reference samples. `n` is a multiple of CORR_PAD_FLOATS, and `ref_re` and
+ * `ref_im` are CORR_ALIGNMENT-aligned. */
+static inline float corr_dot_pwr(const float *x_re, const float *x_im,
+                                 const float *ref_re, const float *ref_im,
+                                 size_t n)
+{
+    size_t k;
+    float re, im;
+
+#if defined(CORR_USE_SSE)
+    __m128 acc_re = _mm_setzero_ps();
+    __m128 acc_im = _mm_setzero_ps();
+    __m128 sum;
+
+    for (k = 0; k < n; k += 4) {
+        const __m128 xr = _mm_loadu_ps(&x_re[k]);
+        const __m128 xi = _mm_loadu_ps(&x_im[k]);
+        const __m128 rr = _mm_load_ps(&ref_re[k]);
+        const __m128 ri = _mm_load_ps(&ref_im[k]);
+
+        acc_re = _mm_add_ps(acc_re, _mm_sub_ps(_mm_mul_ps(rr, xr),
+                                               _mm_mul_ps(ri, xi)));
+        acc_im = _mm_add_ps(acc_im, _mm_add_ps(_mm_mul_ps(rr, xi),
+                                               _mm_mul_ps(ri, xr)));
+    }
+
+    sum = _mm_add_ps(_mm_movelh_ps(acc_re, acc_im),
+                     _mm_movehl_ps(acc_im, acc_re));
+
+    re = _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+    im = _mm_cvtss_f32(_mm_add_ss(_mm_shuffle_ps(sum, sum, 2),
+                                  _mm_shuffle_ps(sum, sum, 3)));
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t acc_re = vdupq_n_f32(0.0f);
+    float32x4_t acc_im = vdupq_n_f32(0.0f);
+    float32x2_t sum_re, sum_im;
+
+    for (k = 0; k < n; k += 4) {
+        const float32x4_t xr = vld1q_f32(&x_re[k]);
+        const float32x4_t xi = vld1q_f32(&x_im[k]);
+        const float32x4_t rr = vld1q_f32(&ref_re[k]);
+        const float32x4_t ri = vld1q_f32(&ref_im[k]);
+
+        acc_re = vmlaq_f32(acc_re, rr, xr);
+        acc_re = vmlsq_f32(acc_re, ri, xi);
+        acc_im = vmlaq_f32(acc_im, rr, xi);
+        acc_im = vmlaq_f32(acc_im, ri, xr);
+    }
+
+    sum_re = vadd_f32(vget_low_f32(acc_re), vget_high_f32(acc_re));
+    sum_im = vadd_f32(vget_low_f32(acc_im), vget_high_f32(acc_im));
+
+    re = vget_lane_f32(vpadd_f32(sum_re, sum_re), 0);
+    im = vget_lane_f32(vpadd_f32(sum_im, sum_im), 0);
+
+#else
+    re = im = 0.0f;
+
+    for (k = 0; k < n; k++) {
+        re += ref_re[k] * x_re[k] - ref_im[k] * x_im[k];
+        im += ref_re[k] * x_im[k] + ref_im[k] * x_re[k];
+    }
+#endif
+
+    return re * re + im * im;
+}
+
+/* Returns true if any of the first `n` values in `pwr` exceed `threshold`.
+ * `n` is a multiple of CORR_PAD_FLOATS, and `pwr` is
+ * CORR_ALIGNMENT-aligned. */
+static bool any_above(const float *pwr, size_t n, float threshold)
+{
+    size_t k;
+
+#if defined(CORR_USE_SSE)
+    const __m128 t = _mm_set1_ps(threshold);
+    __m128 above = _mm_setzero_ps();
+
+    for (k = 0; k < n; k += 4) {
+        above = _mm_or_ps(above, _mm_cmpgt_ps(_mm_load_ps(&pwr[k]), t));
+    }
+
+    return _mm_movemask_ps(above) != 0;
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t t = vdupq_n_f32(threshold);
+    uint32x4_t above = vdupq_n_u32(0);
+    uint32x2_t folded;
+
+    for (k = 0; k < n; k += 4) {
+        above = vorrq_u32(above, vcgtq_f32(vld1q_f32(&pwr[k]), t));
+    }
+
+    folded = vorr_u32(vget_low_u32(above), vget_high_u32(above));
+    return (vget_lane_u32(folded, 0) | vget_lane_u32(folded, 1)) != 0;
+
+#else
+    bool above = false;
+
+    for (k = 0; k < n; k++) {
+        above |= pwr[k] > threshold;
+    }
+
+    return above;
+#endif
+}
+
+#ifdef HAVE_AVX_FMA
+AVX_FMA_TARGET
+static inline float corr_dot_pwr_avx(const float *x_re, const float *x_im,
+                                     const float *ref_re, const float *ref_im,
+                                     size_t n)
+{
+    __m256 acc_re = _mm256_setzero_ps();
+    __m256 acc_im = _mm256_setzero_ps();
+    __m128 sum_re, sum_im;
+    float re, im;
+    size_t k;
+
+    for (k = 0; k < n; k += 8) {
+        const __m256 xr = _mm256_loadu_ps(&x_re[k]);
+        const __m256 xi = _mm256_loadu_ps(&x_im[k]);
+        const __m256 rr = _mm256_load_ps(&ref_re[k]);
+        const __m256 ri = _mm256_load_ps(&ref_im[k]);
+
+        acc_re = _mm256_fmadd_ps(rr, xr, acc_re);
+        acc_re = _mm256_fnmadd_ps(ri, xi, acc_re);
+        acc_im = _mm256_fmadd_ps(rr, xi, acc_im);
+        acc_im = _mm256_fmadd_ps(ri, xr, acc_im);
+    }
+
+    sum_re = _mm_add_ps(_mm256_castps256_ps128(acc_re),
+                        _mm256_extractf128_ps(acc_re, 1));
+    sum_im = _mm_add_ps(_mm256_castps256_ps128(acc_im),
+                        _mm256_extractf128_ps(acc_im, 1));
+
+    /* Reduce both sums together: [re0+re2, re1+re3, im0+im2, im1+im3] */
+    sum_re = _mm_add_ps(_mm_movelh_ps(sum_re, sum_im),
+                        _mm_movehl_ps(sum_im, sum_re));
+
+    re = _mm_cvtss_f32(_mm_add_ss(sum_re, _mm_shuffle_ps(sum_re, sum_re, 1)));
+    im = _mm_cvtss_f32(_mm_add_ss(_mm_shuffle_ps(sum_re, sum_re, 2),
+                                  _mm_shuffle_ps(sum_re, sum_re, 3)));
+
+    return re * re + im * im;
+}
+
+AVX_FMA_TARGET
+static bool any_above_avx(const float *pwr, size_t n, float threshold)
+{
+    const __m256 t = _mm256_set1_ps(threshold);
+    __m256 above = _mm256_setzero_ps();
+    size_t k;
+
+    for (k = 0; k < n; k += 8) {
+        above = _mm256_or_ps(above, _mm256_cmp_ps(_mm256_load_ps(&pwr[k]), t,
+                                                  _CMP_GT_OQ));
+    }
+
+    return _mm256_movemask_ps(above) != 0;
+}
+#endif
+
+/* Compute the correlation power of the first `count` results of the current
+ * block of the direct backend into corr->pwr. Result j covers inputs j
+ * through j + len - 1. */
+static void correlate_block(struct correlator *corr, size_t count)
+{
+    size_t j;
+
+    for (j = 0; j < count; j++) {
+        corr->pwr[j] = corr_dot_pwr(&corr->hist_re[j], &corr->hist_im[j],
+                                    corr->ref_re, corr->ref_im,
+                                    corr->padded_len);
+    }
+}
+
+#ifdef HAVE_AVX_FMA
+AVX_FMA_TARGET
+static void correlate_block_avx(struct correlator *corr, size_t count)
+{
+    size_t j;
+
+    for (j = 0; j < count; j++) {
+        corr->pwr[j] = corr_dot_pwr_avx(&corr->hist_re[j], &corr->hist_im[j],
+                                        corr->ref_re, corr->ref_im,
+                                        corr->padded_len);
+    }
+}
+#endif
+
+/* In-place, radix-2, decimation-in-time forward FFT */
+static void fft(struct correlator *corr, struct complexf *x)
+{
+    const size_t n = corr->fft_len;
+    size_t i, j, k, span;
+
+    for (i = 0; i < n; i++) {
+        j = corr->bitrev[i];
+        if (j > i) {
+            struct complexf tmp = x[i];
+            x[i] = x[j];
+            x[j] = tmp;
+        }
+    }
+
+    for (span = 1; span < n; span *= 2) {
+        const size_t stride = n / (2 * span);
+
+        for (i = 0; i < n; i += 2 * span) {
+            for (k = 0; k < span; k++) {
+                const struct complexf w = corr->twiddle[k * stride];
+                struct complexf *a = &x[i + k];
+                struct complexf *b = &x[i + k + span];
+                struct complexf t;
+
+                t.real = w.real * b->real - w.imag * b->imag;
+                t.imag = w.real * b->imag + w.imag * b->real;
+
+                b->real = a->real - t.real;
+                b->imag = a->imag - t.imag;
+                a->real += t.real;
+                a->imag += t.imag;
+            }
+        }
+    }
+}
+
+/* Set up the FFT backend, following initialization of the reference
+ *
+ * Returns 0 on success, -1 on failure */
+static int fft_init(struct correlator *corr)
+{
+    size_t i, bits;
+    size_t n = 1;
+
+    while (n < CORR_FFT_LEN_MULT * corr->len) {
+        n *= 2;
+    }
+
+    corr->fft_len = n;
+
+    corr->fft_ref = malloc(n * sizeof(corr->fft_ref[0]));
+    corr->fft_buf = malloc(n * sizeof(corr->fft_buf[0]));
+    corr->twiddle = malloc((n / 2) * sizeof(corr->twiddle[0]));
+    corr->bitrev  = malloc(n * sizeof(corr->bitrev[0]));
+
+    if (corr->fft_ref == NULL || corr->fft_buf == NULL ||
+        corr->twiddle == NULL || corr->bitrev == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (i = 0; i < n / 2; i++) {
+        const double theta = -2.0 * M_PI * (double) i / (double) n;
+        corr->twiddle[i].real = (float) cos(theta);
+        corr->twiddle[i].imag = (float) sin(theta);
+    }
+
+    for (bits = 0; ((size_t) 1 << bits) < n; bits++);
+
+    for (i = 0; i < n; i++) {
+        size_t b, rev = 0;
+        for (b = 0; b < bits; b++) {
+            if (i & ((size_t) 1 << b)) {
+                rev |= (size_t) 1 << (bits - 1 - b);
+            }
+        }
+        corr->bitrev[i] = rev;
+    }
+
+    /* The result for the newest sample x[m] is
+     *  sum over k of ref[k] * x[m - (len - 1) + k]
+     *
+     * Given a transform input s[] holding x[m - (len - 1)] onward, this is
+     * the circular cross correlation of s[] with conj(ref[]), which is
+     * obtained via IFFT(FFT(s) * conj(FFT(conj(ref)))). */
+    for (i = 0; i < n; i++) {
+        if (i < corr->len) {
+            corr->fft_ref[i].real = corr->ref_re[i];
+            corr->fft_ref[i].imag = -corr->ref_im[i];
+        } else {
+            corr->fft_ref[i].real = corr->fft_ref[i].imag = 0.0f;
+        }
+    }
+
+    fft(corr, corr->fft_ref);
+
+    for (i = 0; i < n; i++) {
+        corr->fft_ref[i].real /= (float) n;
+        corr->fft_ref[i].imag /= -(float) n;
+    }
+
+    return 0;
+}
+
+struct correlator *corr_init_backend(uint8_t *syms, size_t n, unsigned int sps,
+                                     enum corr_backend backend)
 {
     int status = -1;
     size_t i;
@@ -128,22 +493,29 @@ struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
     }
 #   endif
 
+    ret->correlate_block = correlate_block;
+    ret->any_above = any_above;
+
+#ifdef HAVE_AVX_FMA
+    if (cpu_has_avx_fma()) {
+        ret->correlate_block = correlate_block_avx;
+        ret->any_above = any_above_avx;
+    }
+#endif
+
     //Length is the ceiling of (sps*n/DECIMATION_FACTOR)
     ret->len = 1 + (sps*n-1)/DECIMATION_FACTOR;
+    ret->padded_len = (ret->len + CORR_PAD_FLOATS - 1) &
+                        ~((size_t) CORR_PAD_FLOATS - 1);
 
-    ret->ref = malloc(ret->len * sizeof(ret->ref[0]));
-    if (ret->ref == NULL) {
+    ret->ref_re = alloc_aligned(2 * ret->padded_len * sizeof(float),
+                                CORR_ALIGNMENT, &ret->ref_alloc);
+    if (ret->ref_re == NULL) {
         perror("malloc");
         goto out;
     }
 
-    /* Buffer is 2x as a means to implement a shift register using
-     * moving insertion points */
-    ret->buf = malloc(2 * ret->len * sizeof(ret->buf[0]));
-    if (ret->buf == NULL) {
-        perror("malloc");
-        goto out;
-    }
+    ret->ref_im = ret->ref_re + ret->padded_len;
 
     raw_samples = malloc(sps * n * sizeof(raw_samples[0]));
     if (raw_samples == NULL) {
@@ -152,26 +524,52 @@ struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
     }
 
     //generate preamble waveform
-    fsk = fsk_init();
+    fsk = fsk_init_sps(sps);
     if (fsk == NULL){
         fprintf(stderr, "Couldn't initialize FSK modulator\n");
         goto out;
     }
     fsk_mod(fsk, syms, (int)n/8, raw_samples);
-    //Convert sc16q11 to complexf and decimate
-       for (i = 0; i < ret->len; i ++){
-        ret->ref[i].real = raw_samples[i*DECIMATION_FACTOR].i/2048.0f;
-        ret->ref[i].imag = raw_samples[i*DECIMATION_FACTOR].q/2048.0f;
-       }
-
-    /* Take the complex conjugate of our modulated reference signal
-     * to avoid needing to do this each time we perform a dot product
-     * operation later */
+
+    /* Convert sc16q11 to float and decimate. The complex conjugate of our
+     * modulated reference signal is taken here to avoid needing to do this
+     * each time we perform a dot product operation later. */
     for (i = 0; i < ret->len; i++) {
-        ret->ref[i].imag = -ret->ref[i].imag;
+        ret->ref_re[i] =  raw_samples[i*DECIMATION_FACTOR].i * CORR_SCALE;
+        ret->ref_im[i] = -raw_samples[i*DECIMATION_FACTOR].q * CORR_SCALE;
+    }
+
+    if (backend == CORR_BACKEND_AUTO) {
+        backend = (ret->len >= CORR_FFT_MIN_LEN) ? CORR_BACKEND_FFT :
+                                                   CORR_BACKEND_DIRECT;
+    }
+
+    ret->backend = backend;
+
+    if (backend == CORR_BACKEND_FFT) {
+        if (fft_init(ret) != 0) {
+            goto out;
+        }
+
+        ret->block_len = ret->fft_len - ret->len + 1;
+    } else {
+        ret->block_len = CORR_BLOCK_LEN;
+    }
+
+    ret->hist_re = alloc_aligned(2 * (ret->len + ret->block_len +
+                                      CORR_PAD_FLOATS) * sizeof(float),
+                                 CORR_ALIGNMENT, &ret->hist_alloc);
+
+    ret->pwr = alloc_aligned((ret->block_len + CORR_PAD_FLOATS) *
+                                sizeof(float), CORR_ALIGNMENT, &ret->pwr_alloc);
+
+    if (ret->hist_re == NULL || ret->pwr == NULL) {
+        perror("malloc");
+        goto out;
     }
 
-    ret->end = &ret->buf[2 * ret->len];
+    ret->hist_im = ret->hist_re + ret->len + ret->block_len + CORR_PAD_FLOATS;
+
     //Maximum power is ret->len/DECIMATION_FACTOR * ret->len/DECIMATION_FACTOR
     ret->threshold_pwr = ret->len * ret->len * 0.5625f;
 
@@ -180,7 +578,7 @@ struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
     corr_reset(ret);
 
 #   ifdef LOG_CORRELATION_SIGNAL
-    save_reference_sig(ret->ref, ret->len);
+    save_reference_sig(ret);
 #   endif
 
     status = 0;
@@ -190,6 +588,8 @@ struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
         n, ret->len);
 
     DBG("Correlator power threshold: %f\n", ret->threshold_pwr);
+    DBG("Correlator backend: %s (FFT length: %zd)\n",
+        backend == CORR_BACKEND_FFT ? "FFT" : "direct", ret->fft_len);
 
 
 out:
@@ -204,11 +604,26 @@ out:
     return ret;
 }
 
+struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps)
+{
+    return corr_init_backend(syms, n, sps, CORR_BACKEND_AUTO);
+}
+
+enum corr_backend corr_get_backend(const struct correlator *corr)
+{
+    return corr->backend;
+}
+
 void corr_deinit(struct correlator *corr)
 {
     if (corr) {
-        free(corr->ref);
-        free(corr->buf);
+        free(corr->ref_alloc);
+        free(corr->hist_alloc);
+        free(corr->pwr_alloc);
+        free(corr->fft_ref);
+        free(corr->fft_buf);
+        free(corr->twiddle);
+        free(corr->bitrev);
 
 #       ifdef LOG_CORRELATOR_OUTPUT
         if (corr->out != NULL) {
@@ -220,110 +635,336 @@ void corr_deinit(struct correlator *corr)
     }
 }
 
-static inline void reset_insertion_points(struct correlator *corr)
-{
-    corr->ins1 = corr->buf;
-    corr->ins2 = corr->buf + corr->len;
-}
-
 void corr_reset(struct correlator *corr)
 {
     size_t i;
 
     if (corr != NULL) {
-        reset_insertion_points(corr);
         corr->match_timestamp = CORRELATOR_NO_RESULT;
         corr->max = corr->threshold_pwr;
         corr->countdown = COUNTDOWN_INACTIVE;
 
-        for (i = 0; i < (2 * corr->len); i++) {
-            corr->buf[i].real = corr->buf[i].imag = 0.0f;
+        for (i = 0; i < (corr->len - 1); i++) {
+            corr->hist_re[i] = corr->hist_im[i] = 0.0f;
         }
     }
 }
 
-uint64_t corr_process(struct correlator *corr,
-                      const struct complex_sample *samples, size_t n,
-                      uint64_t timestamp)
+/* Track the correlation peak, given the correlation power for the sample at
+ * the specified timestamp.
+ *
+ * Returns true when the countdown following a peak has completed, in which
+ * case the peak's timestamp is written to `detected` and the correlator
+ * is reset. */
+static inline bool update_peak(struct correlator *corr, float result_pwr,
+                               uint64_t timestamp, uint64_t *detected)
 {
-    size_t i, j;
+#   ifdef LOG_CORRELATOR_OUTPUT
+    fprintf(corr->out, "%f, %"PRIu64"\n", result_pwr, timestamp);
+#   endif
 
-    uint64_t detected = CORRELATOR_NO_RESULT;
+    if (result_pwr > corr->max) {
+        corr->max = result_pwr;
+        corr->countdown = corr->num_counts;
+        corr->match_timestamp = timestamp;
+
+        DBG("Got a match at %"PRIu64", result_pwr=%f. Resetting countdown.\n",
+            timestamp, result_pwr);
+
+    } else if (corr->countdown != COUNTDOWN_INACTIVE) {
+        //Find the peak
 
-    for (i = 0; i < n; i += DECIMATION_FACTOR) {
-        struct complexf *ref = corr->ref + corr->len - 1;
-        struct complexf *buf = corr->ins2;
-        struct complexf result;
-        float result_pwr;
+        if (--corr->countdown == 0) {
+            /* We have a result! */
+            *detected = corr->match_timestamp;
 
-        /* Insert sample */
-        //Scale by 1/2048
-        corr->ins1->real = corr->ins2->real = samples[i].i/2048.0f;
-        corr->ins1->imag = corr->ins2->imag = samples[i].q/2048.0f;
+            DBG("Countdown complete. Acquired at: %"PRIu64"\n", *detected);
 
-        result.real = result.imag = 0;
+            corr_reset(corr);
+            return true;
+        } else {
+            DBG("Countdown @ %u\n", corr->countdown);
+        }
+    }
+
+    return false;
+}
+
+/* Search the `count` results in corr->pwr for a peak, where the first result
+ * corresponds to `*timestamp`. `*timestamp` is advanced past the block.
+ *
+ * Returns true if a match was detected, with its timestamp in `detected` */
+static bool scan_block(struct correlator *corr, size_t count,
+                       uint64_t *timestamp, uint64_t *detected)
+{
+    size_t j;
+
+#   ifndef LOG_CORRELATOR_OUTPUT
+    /* Nothing can change unless a peak is being tracked, or a result
+     * exceeds the current maximum. This is the common case. */
+    if (corr->countdown == COUNTDOWN_INACTIVE) {
+        const size_t padded = (count + CORR_PAD_FLOATS - 1) &
+                                ~((size_t) CORR_PAD_FLOATS - 1);
+
+        /* Power is non-negative and corr->max is positive, so zeroed
+         * padding does not affect the result */
+        for (j = count; j < padded; j++) {
+            corr->pwr[j] = 0.0f;
+        }
+
+        if (!corr->any_above(corr->pwr, padded, corr->max)) {
+            *timestamp += count * DECIMATION_FACTOR;
+            return false;
+        }
+    }
+#   endif
+
+    for (j = 0; j < count; j++) {
+        /* Exit early with a result */
+        if (update_peak(corr, corr->pwr[j], *timestamp, detected)) {
+            return true;
+        }
+
+        *timestamp += DECIMATION_FACTOR;
+    }
+
+    return false;
+}
+
+static uint64_t corr_process_direct(struct correlator *corr,
+                                    const struct complex_sample *samples,
+                                    size_t n, uint64_t timestamp)
+{
+    const size_t hist = corr->len - 1;
+    size_t i = 0;
+
+    uint64_t detected = CORRELATOR_NO_RESULT;
+
+    while (i < n) {
+        size_t count = 0;
+
+        /* Insert samples following the history */
+        for ( ; i < n && count < corr->block_len; i += DECIMATION_FACTOR) {
+            corr->hist_re[hist + count] = samples[i].i;
+            corr->hist_im[hist + count] = samples[i].q;
+            count++;
+        }
 
         /* Cross correlate */
-        for (j = 0; j < corr->len; j ++) {
-            result.real += ref->real * buf->real - ref->imag * buf->imag;
-            result.imag += ref->real * buf->imag + ref->imag * buf->real;
+        corr->correlate_block(corr, count);
 
-            ref--;
-            buf--;
+        /* Retain the most recent samples for the next block */
+        memmove(corr->hist_re, &corr->hist_re[count],
+                hist * sizeof(corr->hist_re[0]));
+        memmove(corr->hist_im, &corr->hist_im[count],
+                hist * sizeof(corr->hist_im[0]));
+
+        if (scan_block(corr, count, &timestamp, &detected)) {
+            return detected;
         }
+    }
 
-        result_pwr = result.real * result.real + result.imag * result.imag;
+    return detected;
+}
 
-#       ifdef LOG_CORRELATOR_OUTPUT
-        fprintf(corr->out, "%f, %"PRIu64"\n", result_pwr, timestamp);
-#       endif
+static uint64_t corr_process_fft(struct correlator *corr,
+                                 const struct complex_sample *samples,
+                                 size_t n, uint64_t timestamp)
+{
+    const size_t hist = corr->len - 1;
+    struct complexf *x = corr->fft_buf;
+    size_t i = 0, j;
 
-        if (result_pwr > corr->max) {
-            corr->max = result_pwr;
-            corr->countdown = corr->num_counts;
-            corr->match_timestamp = timestamp;
+    uint64_t detected = CORRELATOR_NO_RESULT;
 
-            DBG("Got a match at %"PRIu64", result_pwr=%f. Resetting countdown.\n",
-                timestamp, result_pwr);
+    while (i < n) {
+        size_t count = 0;
 
-        } else if (corr->countdown != COUNTDOWN_INACTIVE) {
-            //Find the peak
+        /* Overlap-save: the previous (len - 1) samples, followed by up to
+         * block_len new samples, zero-padded to the transform length */
+        for (j = 0; j < hist; j++) {
+            x[j].real = corr->hist_re[j];
+            x[j].imag = corr->hist_im[j];
+        }
 
-            if (--corr->countdown == 0) {
-                /* We have a result! Exit early with it */
-                detected = corr->match_timestamp;
+        for ( ; i < n && count < corr->block_len; i += DECIMATION_FACTOR) {
+            x[hist + count].real = samples[i].i;
+            x[hist + count].imag = samples[i].q;
+            count++;
+        }
 
-                DBG("Countdown complete. Acquired at: %"PRIu64"\n", detected);
+        for (j = hist + count; j < corr->fft_len; j++) {
+            x[j].real = x[j].imag = 0.0f;
+        }
 
-                corr_reset(corr);
-                return detected;
-            } else {
-                DBG("Countdown @ %u\n", corr->countdown);
-            }
+        /* Retain the most recent samples for the next block */
+        for (j = 0; j < hist; j++) {
+            corr->hist_re[j] = x[count + j].real;
+            corr->hist_im[j] = x[count + j].imag;
         }
 
-        /* Update insertion points */
-        corr->ins2++;
-        if (corr->ins2 == corr->end) {
-            reset_insertion_points(corr);
-        } else {
-            corr->ins1++;
+        fft(corr, x);
+
+        /* Apply the reference. The conjugate is taken such that a second
+         * forward transform yields the conjugate of the inverse transform,
+         * which does not affect the power of the result. */
+        for (j = 0; j < corr->fft_len; j++) {
+            const struct complexf a = x[j];
+            const struct complexf b = corr->fft_ref[j];
+
+            x[j].real = a.real * b.real - a.imag * b.imag;
+            x[j].imag = -(a.real * b.imag + a.imag * b.real);
+        }
+
+        fft(corr, x);
+
+        for (j = 0; j < count; j++) {
+            corr->pwr[j] = x[j].real * x[j].real + x[j].imag * x[j].imag;
         }
 
-        /* Update record of which timestamp we're on...*/
-        timestamp += 2;
+        if (scan_block(corr, count, &timestamp, &detected)) {
+            return detected;
+        }
     }
 
     return detected;
 }
 
+uint64_t corr_process(struct correlator *corr,
+                      const struct complex_sample *samples, size_t n,
+                      uint64_t timestamp)
+{
+    if (corr->backend == CORR_BACKEND_FFT) {
+        return corr_process_fft(corr, samples, n, timestamp);
+    } else {
+        return corr_process_direct(corr, samples, n, timestamp);
+    }
+}
+
 #ifdef CORRELATOR_TEST
 #include <string.h>
 #include <errno.h>
-#include "utils.h"
+#include <time.h>
 
 static uint8_t code_a[] = { 0x2E, 0x69, 0x2C, 0xF0 };
 
+/* Benchmark parameters */
+#define BENCH_SPS           8
+#define BENCH_NUM_SAMPLES   (1024 * 1024)
+#define BENCH_PREAMBLE_POS  (BENCH_NUM_SAMPLES - 4096)
+#define BENCH_ITERATIONS    4
+#define BENCH_CHUNK_LEN     16384   /* SYNC_BUFFER_SIZE, as used by the PHY */
+
+/* Process the provided samples in chunks, as the PHY does, and return the
+ * acquisition timestamp */
+static uint64_t bench_run(struct correlator *corr,
+                          const struct complex_sample *samples, size_t n)
+{
+    size_t i, to_process;
+    uint64_t acquisition = CORRELATOR_NO_RESULT;
+
+    corr_reset(corr);
+
+    for (i = 0; i < n && acquisition == CORRELATOR_NO_RESULT; i += to_process) {
+        to_process = n - i;
+        if (to_process > BENCH_CHUNK_LEN) {
+            to_process = BENCH_CHUNK_LEN;
+        }
+
+        acquisition = corr_process(corr, &samples[i], to_process, i);
+    }
+
+    return acquisition;
+}
+
+/* Compare the direct and FFT backends for a range of preamble lengths,
+ * using a randomly generated preamble embedded in noise */
+static int benchmark(void)
+{
+    static const enum corr_backend backends[] = {
+        CORR_BACKEND_DIRECT, CORR_BACKEND_FFT
+    };
+
+    int status = 0;
+    size_t len_bytes, i, b;
+    struct complex_sample *samples = NULL;
+    uint8_t *preamble = NULL;
+    struct fsk_handle *fsk = NULL;
+
+    samples = malloc(BENCH_NUM_SAMPLES * sizeof(samples[0]));
+    preamble = malloc(64);
+    fsk = fsk_init();
+    if (samples == NULL || preamble == NULL || fsk == NULL) {
+        fprintf(stderr, "Failed to allocate benchmark resources.\n");
+        status = -1;
+        goto out;
+    }
+
+    srand(0);
+
+    printf("%8s %10s %12s %12s %14s\n",
+           "Symbols", "Ref len", "Backend", "MSamples/s", "Acquisition");
+
+    for (len_bytes = 1; len_bytes <= 64 && status == 0; len_bytes *= 2) {
+        uint64_t acquisitions[2];
+
+        for (i = 0; i < len_bytes; i++) {
+            preamble[i] = (uint8_t) rand();
+        }
+
+        for (i = 0; i < BENCH_NUM_SAMPLES; i++) {
+            samples[i].i = (int16_t) ((rand() % 401) - 200);
+            samples[i].q = (int16_t) ((rand() % 401) - 200);
+        }
+
+        fsk_mod(fsk, preamble, (int) len_bytes,
+                &samples[BENCH_PREAMBLE_POS - len_bytes * 8 * BENCH_SPS]);
+
+        for (b = 0; b < ARRAY_SIZE(backends); b++) {
+            struct correlator *corr;
+            struct timespec start, end;
+            double t;
+            int iter;
+
+            corr = corr_init_backend(preamble, len_bytes * 8, BENCH_SPS,
+                                     backends[b]);
+            if (corr == NULL) {
+                fprintf(stderr, "Failed to initialize correlator.\n");
+                status = -1;
+                break;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &start);
+            for (iter = 0; iter < BENCH_ITERATIONS; iter++) {
+                acquisitions[b] = bench_run(corr, samples, BENCH_NUM_SAMPLES);
+            }
+            clock_gettime(CLOCK_REALTIME, &end);
+
+            t = elapsed(&start, &end);
+
+            printf("%8zd %10zd %12s %12.2f %14"PRIu64"\n",
+                   len_bytes * 8, 1 + (len_bytes * 8 * BENCH_SPS - 1) /
+                                  DECIMATION_FACTOR,
+                   backends[b] == CORR_BACKEND_FFT ? "fft" : "direct",
+                   BENCH_ITERATIONS * (BENCH_NUM_SAMPLES / 1e6) / t,
+                   acquisitions[b]);
+
+            corr_deinit(corr);
+        }
+
+        if (status == 0 && acquisitions[0] != acquisitions[1]) {
+            fprintf(stderr, "Backend acquisitions differ!\n");
+            status = -1;
+        }
+    }
+
+out:
+    fsk_close(fsk);
+    free(preamble);
+    free(samples);
+    return status;
+}
+
 int main(int argc, char *argv[])
 {
     FILE *in = NULL;
@@ -338,11 +979,15 @@ int main(int argc, char *argv[])
 
     int num_samples;
 
+    if (argc == 2 && !strcmp(argv[1], "--benchmark")) {
+        return benchmark() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (argc != 3) {
         fprintf(stderr, "Usage: %s <CSV input file> <sps>\n", argv[0]);
+        fprintf(stderr, "       %s --benchmark\n", argv[0]);
         return EXIT_FAILURE;
     }
-
     num_samples = load_samples_from_csv_file(argv[1], false, 0, &raw_samples);
     if (num_samples < 0){
         fprintf(stderr, "Couldn't load samples from file\n");
@@ -35,6 +35,19 @@ struct correlator;
 //use every other sample. If 3 the correlator will use every third sample. And so on.
 #define DECIMATION_FACTOR 2
 
+/**
+ * Method used to compute the cross correlation
+ */
+enum corr_backend {
+    CORR_BACKEND_AUTO,      /**< Select a backend based upon the length of
+                             *   the reference signal */
+    CORR_BACKEND_DIRECT,    /**< Direct dot product for each input sample.
+                             *   O(len) per sample. */
+    CORR_BACKEND_FFT,       /**< FFT-based overlap-save, which computes
+                             *   blocks of results at O(log(len)) per
+                             *   sample */
+};
+
 /**
  * Create a correlator. This is currently limited to symbol lengths that are
  * a multiple of 8 (a byte).
@@ -47,6 +60,26 @@ struct correlator;
  */
 struct correlator *corr_init(uint8_t *syms, size_t n, unsigned int sps);
 
+/**
+ * Create a correlator using the specified backend. corr_init() is equivalent
+ * to calling this function with CORR_BACKEND_AUTO.
+ *
+ * @param   syms                Symbols to correlate against
+ * @param   n                   Number of symbols in `syms`. Must be a multiple of 8.
+ * @param   sps                 Samples per symbol for modulation.
+ * @param   backend             Correlation method
+ *
+ * @return correlator handle on success, NULL on failure
+ */
+struct correlator *corr_init_backend(uint8_t *syms, size_t n, unsigned int sps,
+                                     enum corr_backend backend);
+
+/**
+ * @return The backend in use by the provided correlator. This is never
+ *         CORR_BACKEND_AUTO.
+ */
+enum corr_backend corr_get_backend(const struct correlator *corr);
+
 /**
  * Deinitialize and deallocate the provided correlator
  */
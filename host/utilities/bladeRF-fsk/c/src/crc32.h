@@ -27,6 +27,7 @@
 #ifndef CRC32_CALC_H_
 #define CRC32_CALC_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -34,4 +35,24 @@
  */
 uint32_t crc32(void *data, size_t len);
 
+/**
+ * Update a CRC32 checksum with an additional `len` bytes of `data`.
+ *
+ * This allows a checksum to be computed over data that is not contiguous
+ * in memory. The following are equivalent:
+ *
+ *  crc = crc32(data, len);
+ *
+ *  crc = crc32_update(0, data, n);
+ *  crc = crc32_update(crc, data + n, len - n);
+ *
+ * @param   crc     Value returned by a previous call, or 0 to begin a new
+ *                  checksum
+ * @param   data    Data to include in the checksum
+ * @param   len     Length of `data`, in bytes
+ *
+ * @return Updated CRC32 checksum
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
 #endif
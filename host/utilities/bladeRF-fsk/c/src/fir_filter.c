@@ -23,10 +23,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <math.h>
 #include "host_config.h"
-
 #include "fir_filter.h"
+#include "utils.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define FIR_USE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
+
+#ifdef HAVE_AVX_FMA
+#   include <immintrin.h>
+#endif
 
 #ifdef ENABLE_FIR_FILTER_DEBUG_MSG
 #   define DBG(...) fprintf(stderr, "[FIR] " __VA_ARGS__)
@@ -34,51 +47,276 @@
 #   define DBG(...)
 #endif
 
+/* Tap arrays are padded to a multiple of this many floats (4 complex taps),
+ * such that the multiply-accumulate kernels need no remainder handling */
+#define FIR_PAD_FLOATS  8
+
+/* Alignment of tap and state buffers, in bytes */
+#define FIR_ALIGNMENT   32
+
+/* Input samples are processed in chunks of up to this many samples, which
+ * bounds the size of the working buffer */
+#define FIR_CHUNK_LEN   4096
+
 struct fir_filter {
 
-    float *taps;        /* Filter taps */
+    float *taps;        /* Filter taps, in the order in which they are applied
+                         * to the state buffer (i.e., reversed), with each tap
+                         * duplicated for I and Q. For interpolating filters,
+                         * there is one set of `padded_len` taps per phase. */
+    void *taps_alloc;
+
     size_t length;      /* Length of the filter, in taps */
+    size_t sub_len;     /* Taps applied per output sample. For interpolating
+                         * filters, this is the length of each phase. */
+    size_t padded_len;  /* sub_len, in floats, padded to FIR_PAD_FLOATS */
 
     /* Interpolation or decimation factor */
     unsigned int factor;
+    bool interpolate;
+
+    /* Offset of the next decimated output into the upcoming input */
+    size_t phase;
+
+    /* Filters a chunk of input with the kernel selected for this machine */
+    size_t (*filter_chunk)(struct fir_filter *f, size_t chunk,
+                           struct complex_sample *output, float *out_float,
+                           size_t n_out);
+
+    /* Filter state: interleaved float I/Q. The first (sub_len - 1) samples
+     * are the history carried over from the previous chunk. This is
+     * followed by up to FIR_CHUNK_LEN input samples, and zeroed padding
+     * that may be read (and multiplied by zero-valued taps) by the
+     * kernels. */
+    float *state;
+    void *state_alloc;
+};
 
-    /* Insertion points into "shift register" implementation that utilizes
-     * two copies of data to achieve a contiguious shifting window. */
-    size_t ins1;
-    size_t ins2;
+/* Multiply-accumulate kernel: computes the sum of the products of `n` floats
+ * of interleaved I/Q state and (duplicated) taps. `n` is a multiple of
+ * FIR_PAD_FLOATS, and `h` is FIR_ALIGNMENT-aligned. */
+typedef void (*fir_mac_fn)(const float *x, const float *h, size_t n,
+                           float *result_i, float *result_q);
 
-    /* Filter state buffers */
-    int32_t *i;
-    int32_t *q;
-};
+static inline void fir_mac(const float *x, const float *h, size_t n,
+                           float *result_i, float *result_q)
+{
+    size_t k;
+
+#if defined(FIR_USE_SSE)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    for (k = 0; k < n; k += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&x[k]),
+                                           _mm_load_ps(&h[k])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&x[k + 4]),
+                                           _mm_load_ps(&h[k + 4])));
+    }
+
+    acc0 = _mm_add_ps(acc0, acc1);
+    acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+
+    *result_i = _mm_cvtss_f32(acc0);
+    *result_q = _mm_cvtss_f32(_mm_shuffle_ps(acc0, acc0, 1));
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x2_t sum;
+
+    for (k = 0; k < n; k += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(&x[k]), vld1q_f32(&h[k]));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(&x[k + 4]), vld1q_f32(&h[k + 4]));
+    }
+
+    acc0 = vaddq_f32(acc0, acc1);
+    sum = vadd_f32(vget_low_f32(acc0), vget_high_f32(acc0));
+
+    *result_i = vget_lane_f32(sum, 0);
+    *result_q = vget_lane_f32(sum, 1);
+
+#else
+    float acc_i = 0.0f;
+    float acc_q = 0.0f;
+
+    for (k = 0; k < n; k += 2) {
+        acc_i += x[k] * h[k];
+        acc_q += x[k + 1] * h[k + 1];
+    }
+
+    *result_i = acc_i;
+    *result_q = acc_q;
+#endif
+}
+
+#ifdef HAVE_AVX_FMA
+AVX_FMA_TARGET
+static inline void fir_mac_avx(const float *x, const float *h, size_t n,
+                               float *result_i, float *result_q)
+{
+    __m256 acc = _mm256_setzero_ps();
+    __m128 sum;
+    size_t k;
+
+    for (k = 0; k < n; k += 8) {
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(&x[k]), _mm256_load_ps(&h[k]),
+                              acc);
+    }
 
-static void fir_reset(struct fir_filter *filt)
+    /* Lanes alternate between I and Q */
+    sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                     _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+
+    *result_i = _mm_cvtss_f32(sum);
+    *result_q = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, 1));
+}
+#endif
+
+/* Round and saturate a filter output to an SC16Q11 sample value */
+static inline int16_t fir_to_sc16(float val)
+{
+    val += (val >= 0.0f) ? 0.5f : -0.5f;
+
+    if (val >= 32767.0f) {
+        return INT16_MAX;
+    } else if (val <= -32768.0f) {
+        return INT16_MIN;
+    } else {
+        return (int16_t) val;
+    }
+}
+
+/* Store an output sample, either rounded to SC16Q11 or as interleaved float
+ * I/Q */
+static inline void fir_store(struct complex_sample *output, float *out_float,
+                             size_t idx, float i, float q)
+{
+    if (out_float != NULL) {
+        out_float[2 * idx] = i;
+        out_float[2 * idx + 1] = q;
+    } else {
+        output[idx].i = fir_to_sc16(i);
+        output[idx].q = fir_to_sc16(q);
+    }
+}
+
+/* Filter a chunk of input without interpolating, starting at the current
+ * decimation phase. `padded_len` is a constant at the specialized call sites
+ * in fir_filter_chunk(), which gives the kernel a constant trip count there,
+ * so that its loop is fully unrolled.
+ *
+ * Returns the updated number of output samples. */
+static inline size_t fir_decim_chunk(struct fir_filter *f, size_t chunk,
+                                     const size_t padded_len,
+                                     struct complex_sample *output,
+                                     float *out_float, size_t n_out,
+                                     fir_mac_fn mac)
 {
     size_t n;
 
-    for (n = 0; n < (2 * filt->length); n++) {
-        filt->i[n] = 0;
-        filt->q[n] = 0;
+    for (n = f->phase; n < chunk; n += f->factor) {
+        float i, q;
+
+        mac(&f->state[2 * n], f->taps, padded_len, &i, &q);
+
+        fir_store(output, out_float, n_out++, i, q);
     }
 
-    /* Remember, state is 2 copies: array len is 2 * filt->length elts */
-    filt->ins1  = 0;
-    filt->ins2  = filt->length;
+    f->phase = n - chunk;
+
+    return n_out;
+}
+
+/* Filter a chunk of input that has been appended to the history, with the
+ * multiply-accumulate kernel `mac`. This is inlined into a wrapper for each
+ * kernel, in which `mac` is a constant.
+ *
+ * Returns the updated number of output samples. */
+static inline size_t fir_filter_chunk(struct fir_filter *f, size_t chunk,
+                                      struct complex_sample *output,
+                                      float *out_float, size_t n_out,
+                                      fir_mac_fn mac)
+{
+    size_t n;
+
+    if (f->interpolate) {
+        for (n = 0; n < chunk; n++) {
+            unsigned int p;
+
+            for (p = 0; p < f->factor; p++) {
+                float i, q;
+
+                mac(&f->state[2 * n], &f->taps[p * f->padded_len],
+                    f->padded_len, &i, &q);
+
+                fir_store(output, out_float, n_out++, i, q);
+            }
+        }
+
+        return n_out;
+    }
+
+    /* Specialized for the 16, 32, and 64 tap RX channel filters */
+    switch (f->padded_len) {
+        case 32:
+            return fir_decim_chunk(f, chunk, 32, output, out_float, n_out, mac);
+        case 64:
+            return fir_decim_chunk(f, chunk, 64, output, out_float, n_out, mac);
+        case 128:
+            return fir_decim_chunk(f, chunk, 128, output, out_float, n_out,
+                                   mac);
+        default:
+            return fir_decim_chunk(f, chunk, f->padded_len, output, out_float,
+                                   n_out, mac);
+    }
+}
+
+static size_t fir_chunk_default(struct fir_filter *f, size_t chunk,
+                                struct complex_sample *output,
+                                float *out_float, size_t n_out)
+{
+    return fir_filter_chunk(f, chunk, output, out_float, n_out, fir_mac);
+}
+
+#ifdef HAVE_AVX_FMA
+AVX_FMA_TARGET
+static size_t fir_chunk_avx(struct fir_filter *f, size_t chunk,
+                            struct complex_sample *output,
+                            float *out_float, size_t n_out)
+{
+    return fir_filter_chunk(f, chunk, output, out_float, n_out, fir_mac_avx);
+}
+#endif
+
+void fir_reset(struct fir_filter *filt)
+{
+    memset(filt->state, 0,
+           (2 * (filt->sub_len - 1 + FIR_CHUNK_LEN) + filt->padded_len) *
+                sizeof(filt->state[0]));
+
+    filt->phase = 0;
 }
 
 void fir_deinit(struct fir_filter *filt)
 {
     if (filt) {
-        free(filt->q);
-        free(filt->i);
-        free(filt->taps);
+        free(filt->state_alloc);
+        free(filt->taps_alloc);
         free(filt);
     }
 }
 
-struct fir_filter * fir_init(const float *taps, size_t length)
+static struct fir_filter * fir_create(const float *taps, size_t length,
+                                      unsigned int factor, bool interpolate)
 {
     struct fir_filter *filt;
+    size_t num_phases, phase, t;
+
+    if (taps == NULL || length == 0 || factor == 0) {
+        return NULL;
+    }
 
     filt = calloc(1, sizeof(filt[0]));
     if (!filt) {
@@ -86,88 +324,153 @@ struct fir_filter * fir_init(const float *taps, size_t length)
         return NULL;
     }
 
-    /* Filter state is a sliding window implemented with 2 copies of data */
-    filt->i = calloc(2 * length, sizeof(filt->i[0]));
-    if (!filt->i) {
-        perror("calloc");
-        fir_deinit(filt);
-        return NULL;
+    filt->length = length;
+    filt->factor = factor;
+    filt->interpolate = interpolate;
+    filt->filter_chunk = fir_chunk_default;
+
+#ifdef HAVE_AVX_FMA
+    if (cpu_has_avx_fma()) {
+        filt->filter_chunk = fir_chunk_avx;
+    }
+#endif
+
+    /* An interpolating filter is split into `factor` phases, each of which
+     * is applied to the input at its original rate */
+    if (interpolate) {
+        num_phases = factor;
+        filt->sub_len = (length + factor - 1) / factor;
+    } else {
+        num_phases = 1;
+        filt->sub_len = length;
     }
 
-    filt->q = calloc(2 * length, sizeof(filt->q[0]));
-    if (!filt->i) {
+    filt->padded_len = (2 * filt->sub_len + FIR_PAD_FLOATS - 1) /
+                            FIR_PAD_FLOATS * FIR_PAD_FLOATS;
+
+    filt->taps = alloc_aligned(num_phases * filt->padded_len *
+                                    sizeof(filt->taps[0]),
+                               FIR_ALIGNMENT, &filt->taps_alloc);
+    if (!filt->taps) {
         perror("calloc");
         fir_deinit(filt);
         return NULL;
     }
 
-    filt->taps = calloc(length, sizeof(filt->taps[0]));
-    if (!filt->taps) {
+    filt->state = alloc_aligned((2 * (filt->sub_len - 1 + FIR_CHUNK_LEN) +
+                                    filt->padded_len) * sizeof(filt->state[0]),
+                                FIR_ALIGNMENT, &filt->state_alloc);
+    if (!filt->state) {
         perror("calloc");
         fir_deinit(filt);
         return NULL;
     }
 
-    memcpy(filt->taps, taps, length * sizeof(filt->taps[0]));
-    filt->length = length;
+    /* Output sample y[n*L + p] of phase p is the sum over k of
+     *  taps[p + k*L] * x[n - k]
+     *
+     * The state holds x[n - (sub_len - 1)] ... x[n] in increasing order,
+     * so each phase's taps are stored in reverse. Unused taps are zero. */
+    for (phase = 0; phase < num_phases; phase++) {
+        float *dest = &filt->taps[phase * filt->padded_len];
+
+        for (t = 0; t < filt->sub_len; t++) {
+            const size_t idx = phase + (filt->sub_len - 1 - t) * num_phases;
+            const float tap = (idx < length) ? taps[idx] : 0.0f;
+
+            dest[2 * t] = tap;
+            dest[2 * t + 1] = tap;
+        }
+    }
 
     fir_reset(filt);
+
+    DBG("Created %s filter: %zu taps, factor %u, %zu taps/output\n",
+        interpolate ? "interpolating" : "decimating", length, factor,
+        filt->sub_len);
+
     return filt;
 }
 
-void fir_process(struct fir_filter *f, int16_t *input,
-                    struct complex_sample *output, size_t count)
+struct fir_filter * fir_init(const float *taps, size_t length)
 {
-    /* Index into input/output buffers */
-    size_t inout_idx;
+    return fir_create(taps, length, 1, false);
+}
 
-    /* Index into f->taps array */
-    size_t t;
+struct fir_filter * fir_init_decim(const float *taps, size_t length,
+                                   unsigned int factor)
+{
+    return fir_create(taps, length, factor, false);
+}
 
-    /* Index into f->i and f->q state arrays */
-    size_t s;
+struct fir_filter * fir_init_interp(const float *taps, size_t length,
+                                    unsigned int factor)
+{
+    return fir_create(taps, length, factor, true);
+}
 
-    for (inout_idx = 0; inout_idx < (2*count); inout_idx += 2) {
-        int32_t i = input[inout_idx];
-        int32_t q = input[inout_idx+1];
-        float result_i = 0;
-        float result_q = 0;
+size_t fir_max_output(const struct fir_filter *filt, size_t count)
+{
+    if (filt->interpolate) {
+        return count * filt->factor;
+    } else {
+        return (count + filt->factor - 1) / filt->factor;
+    }
+}
 
-        /* Insert samples */
-        f->i[f->ins1] = f->i[f->ins2] = i;
-        f->q[f->ins1] = f->q[f->ins2] = q;
+static size_t fir_run(struct fir_filter *f, const int16_t *input,
+                      size_t count, struct complex_sample *output,
+                      float *out_float)
+{
+    /* History length, in samples */
+    const size_t hist = f->sub_len - 1;
 
-        /* Convolve */
-        for (t = 0, s = f->ins2; t < f->length; t++, s--) {
-            float tmp_i, tmp_q;
+    /* Number of output samples produced */
+    size_t n_out = 0;
 
-            tmp_i = f->taps[t] * f->i[s];
-            tmp_q = f->taps[t] * f->q[s];
+    while (count > 0) {
+        const size_t chunk = (count < FIR_CHUNK_LEN) ? count : FIR_CHUNK_LEN;
+        float *x = &f->state[2 * hist];
+        size_t n;
 
-            result_i += tmp_i;
-            result_q += tmp_q;
+        /* Append the chunk to the history */
+        for (n = 0; n < 2 * chunk; n++) {
+            x[n] = input[n];
         }
 
-        /* Update output sample */
-        output[inout_idx/2].i = (int16_t) roundf(result_i);
-        output[inout_idx/2].q = (int16_t) roundf(result_q);
-
-        /* Advance insertion points */
-        f->ins2++;
-        if (f->ins2 == (2 * f->length)) {
-            f->ins1 = 0;
-            f->ins2 = f->length;
-        } else {
-            f->ins1++;
-        }
+        n_out = f->filter_chunk(f, chunk, output, out_float, n_out);
+
+        /* Retain the most recent samples as history for the next chunk */
+        memmove(f->state, &f->state[2 * chunk], 2 * hist * sizeof(f->state[0]));
+
+        input += 2 * chunk;
+        count -= chunk;
     }
+
+    return n_out;
+}
+
+size_t fir_process_block(struct fir_filter *f, const int16_t *input,
+                         size_t count, struct complex_sample *output)
+{
+    return fir_run(f, input, count, output, NULL);
+}
+
+size_t fir_process_block_float(struct fir_filter *f, const int16_t *input,
+                               size_t count, float *output)
+{
+    return fir_run(f, input, count, NULL, output);
+}
+
+void fir_process(struct fir_filter *f, int16_t *input,
+                    struct complex_sample *output, size_t count)
+{
+    fir_process_block(f, input, count, output);
 }
 
 #ifdef FIR_FILTER_TEST
-#include <stdbool.h>
 #include "conversions.h"
 #include "rx_ch_filter.h"
-#include "utils.h"
 
 int main(int argc, char *argv[])
 {
@@ -183,17 +486,23 @@ int main(int argc, char *argv[])
     static const unsigned int max_chunk_size = 1024 * 1024 * 1024;
 
     unsigned int chunk_size = 4096;
-    size_t n_read, n_written;
+    unsigned int factor = 1;
+    bool interpolate = false;
+    size_t n_read, n_out, n_written;
     bool done = false;
 
-    if (argc < 3 || argc > 4) {
+    if (argc < 3 || argc > 5) {
         fprintf(stderr,
                 "Filter sc16q11 samples from <infile> and write"
                 "them to <outfile>.\n\n");
 
         fprintf(stderr,
-                "Usage: %s <infile> <outfile> [# chunk size(samples)]\n",
-                argv[0]);
+                "Usage: %s <infile> <outfile> [# chunk size(samples)] "
+                "[d<M> | i<L>]\n\n", argv[0]);
+
+        fprintf(stderr,
+                "d<M> decimates the output by M, and i<L> interpolates "
+                "the input by L.\n");
 
         return EXIT_FAILURE;
     }
@@ -207,7 +516,26 @@ int main(int argc, char *argv[])
         }
     }
 
-    filt = fir_init(rx_ch_filter, rx_ch_filter_len);
+    if (argc == 5) {
+        bool valid = (argv[4][0] == 'd' || argv[4][0] == 'i');
+
+        if (valid) {
+            interpolate = (argv[4][0] == 'i');
+            factor = str2uint(&argv[4][1], 1, 64, &valid);
+        }
+
+        if (!valid) {
+            fprintf(stderr, "Invalid resampling option: %s\n", argv[4]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (interpolate) {
+        filt = fir_init_interp(rx_ch_filter, rx_ch_filter_len, factor);
+    } else {
+        filt = fir_init_decim(rx_ch_filter, rx_ch_filter_len, factor);
+    }
+
     if (!filt) {
         fprintf(stderr, "Failed to allocate filter.\n");
         return EXIT_FAILURE;
@@ -218,13 +546,14 @@ int main(int argc, char *argv[])
         perror("calloc");
         goto out;
     }
-    tempbuf = calloc(2*sizeof(int16_t), chunk_size);
+    tempbuf = calloc(2*sizeof(int16_t), fir_max_output(filt, chunk_size));
     if (!tempbuf) {
         perror("calloc");
         goto out;
     }
 
-    outbuf = calloc(sizeof(struct complex_sample), chunk_size);
+    outbuf = calloc(sizeof(struct complex_sample),
+                    fir_max_output(filt, chunk_size));
     if (!outbuf) {
         perror("calloc");
         goto out;
@@ -246,12 +575,12 @@ int main(int argc, char *argv[])
         n_read = fread(inbuf, 2*sizeof(int16_t), chunk_size, infile);
         done = n_read != chunk_size;
 
-        fir_process(filt, inbuf, outbuf, n_read);
+        n_out = fir_process_block(filt, inbuf, n_read, outbuf);
         //convert
-        conv_struct_to_samples(outbuf, (unsigned int) n_read, tempbuf);
+        conv_struct_to_samples(outbuf, (unsigned int) n_out, tempbuf);
 
-        n_written = fwrite(tempbuf, 2*sizeof(int16_t), n_read, outfile);
-        if (n_written != n_read) {
+        n_written = fwrite(tempbuf, 2*sizeof(int16_t), n_out, outfile);
+        if (n_written != n_out) {
             fprintf(stderr, "Short write encountered. Exiting.\n");
             status = -1;
             goto out;
@@ -28,7 +28,8 @@
 struct fir_filter;
 
 /**
- * Construct a FIR filter with provided taps and decimation factor
+ * Construct a FIR filter with provided taps. The output sample rate is equal
+ * to the input sample rate.
  *
  * @param[in]   taps        Filter taps.
  *
@@ -39,6 +40,42 @@ struct fir_filter;
  */
 struct fir_filter * fir_init(const float *taps, size_t num_taps);
 
+/**
+ * Construct a decimating FIR filter, which filters the input signal and then
+ * retains every `factor`-th sample. Only the retained outputs are computed.
+ *
+ * @param[in]   taps        Filter taps.
+ *
+ * @param[in]   num_tamps   Number of taps contained within `taps`
+ *
+ * @param[in]   factor      Decimation factor, M. Must be >= 1.
+ *
+ * @return      `fir_filter` handle on success,
+ *              or NULL on failure or invalid parameter
+ */
+struct fir_filter * fir_init_decim(const float *taps, size_t num_taps,
+                                   unsigned int factor);
+
+/**
+ * Construct a polyphase interpolating FIR filter, which upsamples the input
+ * signal by `factor` and applies the provided filter, without computing
+ * products of the inserted zeros.
+ *
+ * Note that the taps should include a gain of `factor` to preserve the
+ * amplitude of the input signal.
+ *
+ * @param[in]   taps        Filter taps.
+ *
+ * @param[in]   num_tamps   Number of taps contained within `taps`
+ *
+ * @param[in]   factor      Interpolation factor, L. Must be >= 1.
+ *
+ * @return      `fir_filter` handle on success,
+ *              or NULL on failure or invalid parameter
+ */
+struct fir_filter * fir_init_interp(const float *taps, size_t num_taps,
+                                    unsigned int factor);
+
 /**
  * Deinitialize and deallocate the provided filter
  *
@@ -46,9 +83,64 @@ struct fir_filter * fir_init(const float *taps, size_t num_taps);
  */
 void fir_deinit(struct fir_filter *filt);
 
+/**
+ * Clear the filter's state, as if it had been newly constructed
+ *
+ * @param   filt        Filter to reset
+ */
+void fir_reset(struct fir_filter *filt);
+
+/**
+ * Get the maximum number of output samples that fir_process_block() may
+ * produce for the provided number of input samples.
+ *
+ * @param   filt        Filter
+ * @param   count       Number of input samples
+ *
+ * @return  Required size of the `output` buffer, in samples
+ */
+size_t fir_max_output(const struct fir_filter *filt, size_t count);
+
+/**
+ * Filter a block of samples, decimating or interpolating them as configured
+ * via fir_init_decim() or fir_init_interp(). Filter state (and the decimation
+ * phase) is carried across calls, so a stream may be processed in blocks of
+ * any size.
+ *
+ * @param[in]   filt        Filter to use
+ * @param[in]   input       Input SC16Q11 samples (interleaved I/Q)
+ * @param[in]   count       Number of input samples to process
+ * @param[out]  output      Output SC16Q11 samples. Must have room for
+ *                          fir_max_output() samples.
+ *
+ * @return  Number of samples written to `output`
+ */
+size_t fir_process_block(struct fir_filter *filt, const int16_t *input,
+                         size_t count, struct complex_sample *output);
+
+/**
+ * Filter a block of samples as fir_process_block() does, but write the
+ * unrounded filter output as floats. This allows the output to be consumed
+ * by a following stage (e.g., pnorm_block_float()) without a round trip
+ * through SC16Q11.
+ *
+ * @param[in]   filt        Filter to use
+ * @param[in]   input       Input SC16Q11 samples (interleaved I/Q)
+ * @param[in]   count       Number of input samples to process
+ * @param[out]  output      Output samples, as interleaved float I/Q. Must
+ *                          have room for fir_max_output() samples.
+ *
+ * @return  Number of samples written to `output`
+ */
+size_t fir_process_block_float(struct fir_filter *filt, const int16_t *input,
+                               size_t count, float *output);
+
 /**
  * Perform filter operation over the provided samples
  *
+ * This is equivalent to fir_process_block(), for filters created with
+ * fir_init(), which produce one output sample per input sample.
+ *
  * @parm[in]    filt        Filter to use
  *
  * @param[in]   input       Input SC16Q11 samples
@@ -0,0 +1,301 @@
+/**
+ * @brief   Single-producer, single-consumer ring of preallocated frame slots
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "host_config.h"
+#include "frame_ring.h"
+
+struct frame_ring {
+    uint8_t *slots;             //num_slots * slot_size bytes of frame storage
+    size_t *lengths;            //committed length of each slot
+    size_t slot_size;
+    unsigned int mask;          //num_slots - 1
+
+    /* Free-running indices. head is only advanced by the producer, and tail
+     * only by the consumer; (head - tail) is the number of filled slots. The
+     * lock orders these updates against the slot contents. */
+    unsigned int head;
+    unsigned int tail;
+    pthread_mutex_t lock;
+};
+
+struct frame_ring *frame_ring_init(unsigned int num_slots, size_t slot_size)
+{
+    struct frame_ring *ring;
+    int status;
+
+    if (num_slots == 0 || (num_slots & (num_slots - 1)) != 0) {
+        fprintf(stderr, "%s: Number of slots (%u) must be a power of two\n",
+                __FUNCTION__, num_slots);
+        return NULL;
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+
+    status = pthread_mutex_init(&ring->lock, NULL);
+    if (status != 0) {
+        fprintf(stderr, "%s: Error initializing pthread_mutex\n", __FUNCTION__);
+        free(ring);
+        return NULL;
+    }
+
+    ring->slots = malloc(num_slots * slot_size);
+    ring->lengths = calloc(num_slots, sizeof(ring->lengths[0]));
+    if (ring->slots == NULL || ring->lengths == NULL) {
+        perror("malloc");
+        frame_ring_deinit(ring);
+        return NULL;
+    }
+
+    ring->slot_size = slot_size;
+    ring->mask = num_slots - 1;
+
+    return ring;
+}
+
+void frame_ring_deinit(struct frame_ring *ring)
+{
+    if (ring != NULL) {
+        pthread_mutex_destroy(&ring->lock);
+        free(ring->slots);
+        free(ring->lengths);
+        free(ring);
+    }
+}
+
+uint8_t *frame_ring_write_slot(struct frame_ring *ring)
+{
+    unsigned int head, tail;
+
+    pthread_mutex_lock(&ring->lock);
+    head = ring->head;
+    tail = ring->tail;
+    pthread_mutex_unlock(&ring->lock);
+
+    if (head - tail > ring->mask) {
+        return NULL;
+    }
+
+    return &ring->slots[(head & ring->mask) * ring->slot_size];
+}
+
+void frame_ring_commit(struct frame_ring *ring, size_t length)
+{
+    assert(length <= ring->slot_size);
+
+    pthread_mutex_lock(&ring->lock);
+    assert(ring->head - ring->tail <= ring->mask);
+    ring->lengths[ring->head & ring->mask] = length;
+    ring->head++;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+uint8_t *frame_ring_read_slot(struct frame_ring *ring, size_t *length)
+{
+    unsigned int head, tail;
+    size_t slot_length;
+
+    pthread_mutex_lock(&ring->lock);
+    head = ring->head;
+    tail = ring->tail;
+    slot_length = ring->lengths[tail & ring->mask];
+    pthread_mutex_unlock(&ring->lock);
+
+    if (head == tail) {
+        return NULL;
+    }
+
+    if (length != NULL) {
+        *length = slot_length;
+    }
+
+    return &ring->slots[(tail & ring->mask) * ring->slot_size];
+}
+
+void frame_ring_release(struct frame_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    assert(ring->head != ring->tail);
+    ring->tail++;
+    pthread_mutex_unlock(&ring->lock);
+}
+
+unsigned int frame_ring_count(struct frame_ring *ring)
+{
+    unsigned int count;
+
+    pthread_mutex_lock(&ring->lock);
+    count = ring->head - ring->tail;
+    pthread_mutex_unlock(&ring->lock);
+
+    return count;
+}
+
+#ifdef FRAME_RING_TEST
+#include <string.h>
+
+#if BLADERF_OS_WINDOWS || BLADERF_OS_OSX
+#   include "clock_gettime.h"
+#else
+#   include <time.h>
+#endif
+
+#define TEST_SLOT_SIZE  1009
+#define TEST_NUM_SLOTS  8
+
+/* The producer and consumer wait upon each other using a condition variable
+ * paired with the ring, in the same manner as the PHY */
+struct test_state {
+    struct frame_ring *ring;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    unsigned int num_frames;
+    unsigned int errors;
+};
+
+static void notify(struct test_state *t)
+{
+    pthread_mutex_lock(&t->lock);
+    pthread_cond_signal(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+}
+
+static size_t test_frame_length(unsigned int i)
+{
+    return 1 + (i * 7919) % TEST_SLOT_SIZE;
+}
+
+static void *producer(void *arg)
+{
+    struct test_state *t = (struct test_state *) arg;
+    unsigned int i;
+    uint8_t *slot;
+    size_t length;
+
+    for (i = 0; i < t->num_frames; i++) {
+        pthread_mutex_lock(&t->lock);
+        while ((slot = frame_ring_write_slot(t->ring)) == NULL) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        length = test_frame_length(i);
+        memset(slot, (uint8_t) i, length);
+        memcpy(slot, &i, sizeof(i) < length ? sizeof(i) : length);
+
+        frame_ring_commit(t->ring, length);
+        notify(t);
+    }
+
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct test_state *t = (struct test_state *) arg;
+    unsigned int i, seq;
+    uint8_t *slot;
+    size_t length, j;
+
+    for (i = 0; i < t->num_frames; i++) {
+        pthread_mutex_lock(&t->lock);
+        while ((slot = frame_ring_read_slot(t->ring, &length)) == NULL) {
+            pthread_cond_wait(&t->cond, &t->lock);
+        }
+        pthread_mutex_unlock(&t->lock);
+
+        if (length != test_frame_length(i)) {
+            t->errors++;
+        } else if (length >= sizeof(seq)) {
+            memcpy(&seq, slot, sizeof(seq));
+            if (seq != i) {
+                t->errors++;
+            }
+            for (j = sizeof(seq); j < length; j++) {
+                if (slot[j] != (uint8_t) i) {
+                    t->errors++;
+                    break;
+                }
+            }
+        }
+
+        frame_ring_release(t->ring);
+        notify(t);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct test_state t;
+    pthread_t prod, cons;
+    struct timespec start, end;
+    double elapsed;
+    int status = EXIT_FAILURE;
+
+    memset(&t, 0, sizeof(t));
+    t.num_frames = (argc > 1) ? (unsigned int) atoi(argv[1]) : 1000000;
+
+    t.ring = frame_ring_init(TEST_NUM_SLOTS, TEST_SLOT_SIZE);
+    if (t.ring == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    pthread_mutex_init(&t.lock, NULL);
+    pthread_cond_init(&t.cond, NULL);
+
+    clock_gettime(CLOCK_REALTIME, &start);
+    if (pthread_create(&cons, NULL, consumer, &t) != 0 ||
+        pthread_create(&prod, NULL, producer, &t) != 0) {
+        fprintf(stderr, "Failed to create threads\n");
+        goto out;
+    }
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    clock_gettime(CLOCK_REALTIME, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("%u frames through a %u-slot ring in %.3f s (%.0f frames/s): %s\n",
+           t.num_frames, TEST_NUM_SLOTS, elapsed, t.num_frames / elapsed,
+           (t.errors == 0 && frame_ring_count(t.ring) == 0) ? "PASSED" : "FAILED");
+
+    if (t.errors == 0) {
+        status = 0;
+    }
+
+out:
+    pthread_cond_destroy(&t.cond);
+    pthread_mutex_destroy(&t.lock);
+    frame_ring_deinit(t.ring);
+    return status;
+}
+#endif
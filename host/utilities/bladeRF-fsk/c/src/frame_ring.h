@@ -0,0 +1,106 @@
+/**
+ * @file
+ * @brief   Single-producer, single-consumer ring of preallocated frame slots
+ *
+ * Frames are built directly in a slot by the producer and processed directly
+ * from that slot by the consumer, so no copies are made when handing a frame
+ * between threads. The lock held by the ring only guards its indices, and is
+ * never held while a slot is being filled or processed.
+ *
+ * The ring does not block. Callers which need to wait for a frame (or for a
+ * free slot) should pair it with their own condition variable, as the PHY
+ * does.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FRAME_RING_H_
+#define FRAME_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Opaque handle to a frame ring */
+struct frame_ring;
+
+/**
+ * Create a frame ring
+ *
+ * @param[in]   num_slots   Number of frame slots. Must be a power of two.
+ * @param[in]   slot_size   Size of each slot, in bytes
+ *
+ * @return      allocated frame ring on success, NULL on failure
+ */
+struct frame_ring *frame_ring_init(unsigned int num_slots, size_t slot_size);
+
+/**
+ * Free a frame ring. Does nothing if ring is NULL
+ *
+ * @param[in]   ring        frame ring to free
+ */
+void frame_ring_deinit(struct frame_ring *ring);
+
+/**
+ * (Producer) Get the next free slot. The slot is not made available to the
+ * consumer until frame_ring_commit() is called, so a producer may fill a slot
+ * and then discard it simply by not committing it.
+ *
+ * @param[in]   ring        frame ring
+ *
+ * @return      pointer to slot_size bytes, or NULL if the ring is full
+ */
+uint8_t *frame_ring_write_slot(struct frame_ring *ring);
+
+/**
+ * (Producer) Make the slot returned by frame_ring_write_slot() available to
+ * the consumer
+ *
+ * @param[in]   ring        frame ring
+ * @param[in]   length      number of valid bytes in the slot
+ */
+void frame_ring_commit(struct frame_ring *ring, size_t length);
+
+/**
+ * (Consumer) Get the oldest committed slot. This slot remains valid until
+ * frame_ring_release() is called.
+ *
+ * @param[in]   ring        frame ring
+ * @param[out]  length      if non-NULL, set to the length given to
+ *                          frame_ring_commit()
+ *
+ * @return      pointer to the frame, or NULL if the ring is empty
+ */
+uint8_t *frame_ring_read_slot(struct frame_ring *ring, size_t *length);
+
+/**
+ * (Consumer) Return the slot returned by frame_ring_read_slot() to the
+ * producer
+ *
+ * @param[in]   ring        frame ring
+ */
+void frame_ring_release(struct frame_ring *ring);
+
+/**
+ * @param[in]   ring        frame ring
+ *
+ * @return      number of committed slots not yet released by the consumer
+ */
+unsigned int frame_ring_count(struct frame_ring *ring);
+
+#endif
@@ -24,7 +24,16 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <string.h>
 #include "host_config.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define FSK_USE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
+
 #include "fsk.h"
 
 #ifdef DEBUG_MODE
@@ -33,11 +42,35 @@
     #define DEBUG_MSG(...)
 #endif
 
+//Number of samples processed per block by fsk_demod_fast(). Must be a multiple of 4.
+#define FSK_DEMOD_BLOCK_LEN 256
+
 //internal structs
+//Bit slicer state of fsk_demod_fast()
+struct fsk_slicer {
+    int byte;                       //Current index in data_buf
+    int bit;                        //Current bit index (0 - 7)
+    int samp;                       //Samples of the current symbol integrated so far
+    double dphase_tot;              //Phase change over the current symbol so far
+};
+
+//Integrates the phase change over each symbol period and slices bits. See
+//fsk_slice().
+typedef void (*fsk_slice_fn)(const float *dphase, int count, int samp_per_symb,
+                             struct fsk_slicer *s, uint8_t *data_buf);
+
 struct fsk_handle {
     struct complex_sample *sample_table;
     int points_per_rev;
     int samp_per_symb;
+    //Modulated samples for each (phase state, byte) pair, and the phase state
+    //following each pair. See fsk_gen_byte_table().
+    struct complex_sample *byte_table;
+    uint8_t *byte_next_state;
+    int phase_step;                 //Samples table positions per phase state
+    int num_phase_states;
+    int samp_per_byte;
+    fsk_slice_fn slice;             //Bit slicer, specialized for samp_per_symb if possible
     //These variables keep track of the demodulator's state when a call to fsk_demod()
     //did not fully demodulate the last byte, meaning it needs to be called again with
     //more samples to finish demodulating that last byte
@@ -45,8 +78,9 @@ struct fsk_handle {
                                     //in a call to fsk_demod()
     uint8_t last_byte;
     double last_phase;
+    struct complex_sample last_sample;  //Sample from which last_phase was computed
     double curr_dphase_tot;
-    int curr_samp_index;            //Current samples index (0 - SAMP_PER_SYMB-1)
+    int curr_samp_index;            //Current samples index (0 - samp_per_symb-1)
     int curr_bit_index;
 };
 
@@ -108,49 +142,152 @@ static struct complex_sample *fsk_gen_samples_table(int points_per_rev)
     return sample_table;
 }
 
-unsigned int fsk_mod(struct fsk_handle *fsk, uint8_t *data_buf, int num_bytes,
+/**
+ * Modulate one byte, sample by sample, starting from the specified position in the
+ * samples table. This is used to generate the byte table.
+ *
+ * @param[in]   fsk             pointer to fsk handle
+ * @param[in]   byte            byte to modulate
+ * @param[in]   samp_table_pos  initial position in samples table
+ * @param[out]  samples         buffer to place 8*samp_per_symb IQ samples in
+ *
+ * @return      final position in samples table
+ */
+static int fsk_mod_byte(struct fsk_handle *fsk, uint8_t byte, int samp_table_pos,
                         struct complex_sample *samples)
 {
-
-    int samp_table_pos;        //current position in samples table
-    int byte;                //current byte (0-(num_bytes-1))
     int bit;                //current bit (0-7) in byte
     int samp;                //current sample in symbol period (0-(samps_per_symb-1))
-    int i;                    //index in samples buffer
+    int i = 0;                //index in samples buffer
 
-    //Set initial position to 0 (1 + 0j)
-    samp_table_pos = 0;
-    i = 0;
-    for (byte = 0; byte < num_bytes; byte++){
-        for (bit = 0; bit < 8; bit++){
-            //Check for 1
-            if ( ((data_buf[byte] >> bit) & 0x01) == 0x01 ){
-                //This bit is a 1. Rotate phase CCW
-                for (samp = 0; samp < fsk->samp_per_symb; samp++){
-                    if (samp_table_pos == fsk->points_per_rev - 1){
-                        samp_table_pos = 0;
-                    }else{
-                        samp_table_pos += 1;    //Increment phase
-                    }
-                    samples[i].i = fsk->sample_table[samp_table_pos].i;
-                    samples[i].q = fsk->sample_table[samp_table_pos].q;
-                    i++;
+    for (bit = 0; bit < 8; bit++){
+        //Check for 1
+        if ( ((byte >> bit) & 0x01) == 0x01 ){
+            //This bit is a 1. Rotate phase CCW
+            for (samp = 0; samp < fsk->samp_per_symb; samp++){
+                if (samp_table_pos == fsk->points_per_rev - 1){
+                    samp_table_pos = 0;
+                }else{
+                    samp_table_pos += 1;    //Increment phase
                 }
-            }else{
-                //This bit is a 0. Rotate phase CW
-                for (samp = 0; samp < fsk->samp_per_symb; samp++){
-                    if (samp_table_pos == 0){
-                        samp_table_pos = fsk->points_per_rev - 1;
-                    }else{
-                        samp_table_pos -= 1;    //Decrement phase
-                    }
-                    samples[i].i = fsk->sample_table[samp_table_pos].i;
-                    samples[i].q = fsk->sample_table[samp_table_pos].q;
-                    i++;
+                samples[i].i = fsk->sample_table[samp_table_pos].i;
+                samples[i].q = fsk->sample_table[samp_table_pos].q;
+                i++;
+            }
+        }else{
+            //This bit is a 0. Rotate phase CW
+            for (samp = 0; samp < fsk->samp_per_symb; samp++){
+                if (samp_table_pos == 0){
+                    samp_table_pos = fsk->points_per_rev - 1;
+                }else{
+                    samp_table_pos -= 1;    //Decrement phase
                 }
+                samples[i].i = fsk->sample_table[samp_table_pos].i;
+                samples[i].q = fsk->sample_table[samp_table_pos].q;
+                i++;
             }
         }
     }
+    return samp_table_pos;
+}
+
+/**
+ * Generate the byte table: the modulated samples for each (phase state, byte) pair,
+ * along with the phase state following each byte.
+ *
+ * Every symbol rotates the phase by +/- samp_per_symb table positions, so at byte
+ * boundaries the phase can only be a multiple of gcd(points_per_rev, samp_per_symb).
+ * Each of these possible phases is a "phase state."
+ *
+ * @param[in]   fsk             pointer to fsk handle, with sample_table initialized
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int fsk_gen_byte_table(struct fsk_handle *fsk)
+{
+    int a = fsk->points_per_rev;
+    int b = fsk->samp_per_symb;
+    int tmp, state, byte, end_pos;
+
+    //Greatest common divisor
+    while (b != 0){
+        tmp = a % b;
+        a = b;
+        b = tmp;
+    }
+    fsk->phase_step = a;
+    fsk->num_phase_states = fsk->points_per_rev / fsk->phase_step;
+    fsk->samp_per_byte = 8 * fsk->samp_per_symb;
+
+    fsk->byte_table = malloc(fsk->num_phase_states * 256 * fsk->samp_per_byte *
+                                sizeof(struct complex_sample));
+    fsk->byte_next_state = malloc(fsk->num_phase_states * 256);
+    if (fsk->byte_table == NULL || fsk->byte_next_state == NULL){
+        perror("malloc");
+        return -1;
+    }
+
+    for (state = 0; state < fsk->num_phase_states; state++){
+        for (byte = 0; byte < 256; byte++){
+            end_pos = fsk_mod_byte(fsk, (uint8_t) byte, state * fsk->phase_step,
+                        &fsk->byte_table[(state * 256 + byte) * fsk->samp_per_byte]);
+            fsk->byte_next_state[state * 256 + byte] =
+                        (uint8_t) (end_pos / fsk->phase_step);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Modulate bytes via the byte table, continuing from the specified phase state
+ *
+ * @param[in]       fsk         pointer to fsk handle
+ * @param[in]       data_buf    bytes to transmit
+ * @param[in]       num_bytes   number of bytes to transmit from data_buf
+ * @param[inout]    state       phase state
+ * @param[out]      samples     buffer to place modulated IQ samples in
+ *
+ * @return      number of IQ samples modulated
+ */
+static unsigned int fsk_mod_bytes(struct fsk_handle *fsk, const uint8_t *data_buf,
+                                  unsigned int num_bytes, unsigned int *state,
+                                  struct complex_sample *samples)
+{
+    const size_t byte_size = fsk->samp_per_byte * sizeof(struct complex_sample);
+    unsigned int s = *state;
+    unsigned int byte;
+    unsigned int entry;
+
+    for (byte = 0; byte < num_bytes; byte++){
+        entry = s * 256 + data_buf[byte];
+        memcpy(&samples[byte * fsk->samp_per_byte],
+                &fsk->byte_table[entry * fsk->samp_per_byte], byte_size);
+        s = fsk->byte_next_state[entry];
+    }
+
+    *state = s;
+    return num_bytes * fsk->samp_per_byte;
+}
+
+unsigned int fsk_mod(struct fsk_handle *fsk, uint8_t *data_buf, int num_bytes,
+                        struct complex_sample *samples)
+{
+    //Set initial position to 0 (1 + 0j)
+    unsigned int state = 0;
+
+    return fsk_mod_bytes(fsk, data_buf, num_bytes, &state, samples);
+}
+
+unsigned int fsk_mod_frame(struct fsk_handle *fsk, const uint8_t *header,
+                           unsigned int header_len, const uint8_t *payload,
+                           unsigned int payload_len, struct complex_sample *samples)
+{
+    //Set initial position to 0 (1 + 0j)
+    unsigned int state = 0;
+    unsigned int i;
+
+    i = fsk_mod_bytes(fsk, header, header_len, &state, samples);
+    i += fsk_mod_bytes(fsk, payload, payload_len, &state, &samples[i]);
     return i;
 }
 
@@ -241,6 +378,7 @@ unsigned int fsk_demod(struct fsk_handle *fsk, struct complex_sample *samples,
                 fsk->last_byte_demod_complete = false;
                 fsk->last_byte = data_buf[byte];
                 fsk->last_phase = phase;
+                fsk->last_sample = samples[i-1];
                 fsk->curr_dphase_tot = dphase_tot;
                 fsk->curr_samp_index = samp;
                 fsk->curr_bit_index = bit;
@@ -258,6 +396,7 @@ unsigned int fsk_demod(struct fsk_handle *fsk, struct complex_sample *samples,
             fsk->curr_dphase_tot = 0;
         }
         fsk->last_phase = phase;
+        fsk->last_sample = samples[i-1];
         fsk->curr_bit_index = 0;
         fsk->last_byte_demod_complete = true;
     }
@@ -266,40 +405,372 @@ unsigned int fsk_demod(struct fsk_handle *fsk, struct complex_sample *samples,
         return byte;
 }
 
+/**
+ * Compute the angle of re + j*im, using the interval [-pi, pi], for 'n' values.
+ * 'n' must be a multiple of 4.
+ *
+ * atan() is approximated over [0, 1] via a polynomial with a maximum error of
+ * 1e-5 radians (Abramowitz & Stegun 4.4.49), and the octant is then restored.
+ * The angle of 0 + j0 is 0.
+ */
+static inline void fast_angle(const float *re, const float *im, float *out, int n)
+{
+    const float c0 =  0.9998660f;
+    const float c1 = -0.3302995f;
+    const float c2 =  0.1801410f;
+    const float c3 = -0.0851330f;
+    const float c4 =  0.0208351f;
+    const float half_pi = (float) (M_PI / 2);
+    const float pi = (float) M_PI;
+    const float tiny = 1e-30f;
+    int k;
+
+#if defined(FSK_USE_SSE)
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (k = 0; k < n; k += 4){
+        const __m128 r  = _mm_loadu_ps(&re[k]);
+        const __m128 q  = _mm_loadu_ps(&im[k]);
+        const __m128 ar = _mm_andnot_ps(sign, r);
+        const __m128 aq = _mm_andnot_ps(sign, q);
+        const __m128 mx = _mm_max_ps(_mm_max_ps(ar, aq), _mm_set1_ps(tiny));
+        const __m128 a  = _mm_div_ps(_mm_min_ps(ar, aq), mx);
+        const __m128 s  = _mm_mul_ps(a, a);
+        __m128 mask, alt;
+        __m128 t;
+
+        t = _mm_add_ps(_mm_set1_ps(c3), _mm_mul_ps(s, _mm_set1_ps(c4)));
+        t = _mm_add_ps(_mm_set1_ps(c2), _mm_mul_ps(s, t));
+        t = _mm_add_ps(_mm_set1_ps(c1), _mm_mul_ps(s, t));
+        t = _mm_add_ps(_mm_set1_ps(c0), _mm_mul_ps(s, t));
+        t = _mm_mul_ps(a, t);
+
+        //|im| > |re|: angle = pi/2 - t
+        mask = _mm_cmpgt_ps(aq, ar);
+        alt = _mm_sub_ps(_mm_set1_ps(half_pi), t);
+        t = _mm_or_ps(_mm_and_ps(mask, alt), _mm_andnot_ps(mask, t));
+
+        //re < 0: angle = pi - t
+        mask = _mm_cmplt_ps(r, zero);
+        alt = _mm_sub_ps(_mm_set1_ps(pi), t);
+        t = _mm_or_ps(_mm_and_ps(mask, alt), _mm_andnot_ps(mask, t));
+
+        //im < 0: negate
+        mask = _mm_cmplt_ps(q, zero);
+        t = _mm_xor_ps(t, _mm_and_ps(mask, sign));
+
+        _mm_storeu_ps(&out[k], t);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+
+    for (k = 0; k < n; k += 4){
+        const float32x4_t r  = vld1q_f32(&re[k]);
+        const float32x4_t q  = vld1q_f32(&im[k]);
+        const float32x4_t ar = vabsq_f32(r);
+        const float32x4_t aq = vabsq_f32(q);
+        const float32x4_t mx = vmaxq_f32(vmaxq_f32(ar, aq), vdupq_n_f32(tiny));
+        float32x4_t a, s, t;
+
+#   if defined(__aarch64__)
+        a = vdivq_f32(vminq_f32(ar, aq), mx);
+#   else
+        //Reciprocal estimate, refined with two Newton-Raphson steps
+        float32x4_t recip = vrecpeq_f32(mx);
+        recip = vmulq_f32(vrecpsq_f32(mx, recip), recip);
+        recip = vmulq_f32(vrecpsq_f32(mx, recip), recip);
+        a = vmulq_f32(vminq_f32(ar, aq), recip);
+#   endif
+        s = vmulq_f32(a, a);
+
+        t = vmlaq_f32(vdupq_n_f32(c3), s, vdupq_n_f32(c4));
+        t = vmlaq_f32(vdupq_n_f32(c2), s, t);
+        t = vmlaq_f32(vdupq_n_f32(c1), s, t);
+        t = vmlaq_f32(vdupq_n_f32(c0), s, t);
+        t = vmulq_f32(a, t);
+
+        t = vbslq_f32(vcgtq_f32(aq, ar), vsubq_f32(vdupq_n_f32(half_pi), t), t);
+        t = vbslq_f32(vcltq_f32(r, zero), vsubq_f32(vdupq_n_f32(pi), t), t);
+        t = vbslq_f32(vcltq_f32(q, zero), vnegq_f32(t), t);
+
+        vst1q_f32(&out[k], t);
+    }
+#else
+    for (k = 0; k < n; k++){
+        const float ar = fabsf(re[k]);
+        const float aq = fabsf(im[k]);
+        const float mx = (ar > aq ? ar : aq) > tiny ? (ar > aq ? ar : aq) : tiny;
+        const float a  = (ar < aq ? ar : aq) / mx;
+        const float s  = a * a;
+        float t = a * (c0 + s * (c1 + s * (c2 + s * (c3 + s * c4))));
+
+        t = (aq > ar) ? half_pi - t : t;
+        t = (re[k] < 0.0f) ? pi - t : t;
+        out[k] = (im[k] < 0.0f) ? -t : t;
+    }
+#endif
+}
+
+/**
+ * Decide the bit of a completed symbol, and advance to the next symbol
+ */
+static inline void fsk_slice_bit(struct fsk_slicer *s, uint8_t *data_buf)
+{
+    if (s->dphase_tot > 0){
+        //Received a 1. Set bit to 1.
+        data_buf[s->byte] |= 0x01 << s->bit;
+    }else{
+        //Received a 0. Set bit to 0.
+        data_buf[s->byte] &= ~(0x01 << s->bit);
+    }
+    s->samp = 0;
+    s->dphase_tot = 0;
+    if (++s->bit == 8){
+        s->bit = 0;
+        s->byte++;
+    }
+}
+
+/**
+ * Integrate the phase change over each symbol period, and slice bits
+ *
+ * This is instantiated with constant values of samp_per_symb by the functions
+ * below, so that the per-symbol loop has a constant trip count and is unrolled.
+ * The phase changes are summed in the same order as a sample-by-sample loop would,
+ * so every instance slices identical bits.
+ *
+ * @param[in]       dphase          phase change of each sample
+ * @param[in]       count           number of samples
+ * @param[in]       samp_per_symb   samples per symbol
+ * @param[inout]    s               slicer state
+ * @param[out]      data_buf        demodulated bytes
+ */
+static inline void fsk_slice(const float *dphase, int count, const int samp_per_symb,
+                             struct fsk_slicer *s, uint8_t *data_buf)
+{
+    int k = 0;
+    int j;
+    double tot;
+
+    //Finish a symbol begun in a previous block
+    for ( ; k < count && s->samp != 0; k++){
+        s->dphase_tot += dphase[k];
+        if (++s->samp == samp_per_symb){
+            fsk_slice_bit(s, data_buf);
+        }
+    }
+    //Whole symbols
+    for ( ; k + samp_per_symb <= count; k += samp_per_symb){
+        tot = 0;
+        for (j = 0; j < samp_per_symb; j++){
+            tot += dphase[k + j];
+        }
+        s->dphase_tot = tot;
+        fsk_slice_bit(s, data_buf);
+    }
+    //Begin a symbol to be finished in the next block
+    for ( ; k < count; k++){
+        s->dphase_tot += dphase[k];
+        s->samp++;
+    }
+}
+
+static void fsk_slice_4(const float *dphase, int count, int samp_per_symb,
+                        struct fsk_slicer *s, uint8_t *data_buf)
+{
+    (void) samp_per_symb;
+    fsk_slice(dphase, count, 4, s, data_buf);
+}
+
+static void fsk_slice_8(const float *dphase, int count, int samp_per_symb,
+                        struct fsk_slicer *s, uint8_t *data_buf)
+{
+    (void) samp_per_symb;
+    fsk_slice(dphase, count, 8, s, data_buf);
+}
+
+static void fsk_slice_16(const float *dphase, int count, int samp_per_symb,
+                         struct fsk_slicer *s, uint8_t *data_buf)
+{
+    (void) samp_per_symb;
+    fsk_slice(dphase, count, 16, s, data_buf);
+}
+
+static void fsk_slice_generic(const float *dphase, int count, int samp_per_symb,
+                              struct fsk_slicer *s, uint8_t *data_buf)
+{
+    fsk_slice(dphase, count, samp_per_symb, s, data_buf);
+}
+
+unsigned int fsk_demod_fast(struct fsk_handle *fsk, const struct complex_sample *samples,
+                            int num_samples, bool new_signal, int num_bytes,
+                            uint8_t *data_buf)
+{
+    float re[FSK_DEMOD_BLOCK_LEN];
+    float im[FSK_DEMOD_BLOCK_LEN];
+    float dphase[FSK_DEMOD_BLOCK_LEN];
+    float prev_i, prev_q, curr_i, curr_q;
+    int i = 0;        //Current samples index (0 to num_samples-1)
+    struct fsk_slicer s;
+    int count, needed, k;
+
+    if (new_signal){
+        //Reset everything. The first sample defines the initial phase.
+        fsk->curr_samp_index = 0;
+        fsk->curr_dphase_tot = 0;
+        fsk->curr_bit_index = 0;
+        fsk->last_sample = samples[0];
+        i++;
+    }
+    //Initialize byte appropriately if last demod was not fully completed
+    //(i.e. last byte was partially demodulated)
+    if (!fsk->last_byte_demod_complete){
+        data_buf[0] = fsk->last_byte;
+    }
+
+    s.byte = 0;
+    s.bit = fsk->curr_bit_index;
+    s.samp = fsk->curr_samp_index;
+    s.dphase_tot = fsk->curr_dphase_tot;
+
+    //angle() treats 0 + j0 as having an angle of 0, so 1 + j0 is substituted for it
+    prev_i = fsk->last_sample.i;
+    prev_q = fsk->last_sample.q;
+    if (prev_i == 0 && prev_q == 0){
+        prev_i = 1;
+    }
+
+    while (s.byte != num_bytes && i < num_samples){
+        //Don't consume more samples than are needed to complete the requested bytes
+        count = num_samples - i;
+        if (num_bytes >= 0){
+            needed = ((num_bytes - s.byte) * 8 - s.bit) * fsk->samp_per_symb - s.samp;
+            if (count > needed){
+                count = needed;
+            }
+        }
+        if (count > FSK_DEMOD_BLOCK_LEN){
+            count = FSK_DEMOD_BLOCK_LEN;
+        }
+
+        //The phase change from the previous sample is the angle of x[n] * conj(x[n-1]).
+        //These products of integers are exactly representable as floats.
+        for (k = 0; k < count; k++){
+            curr_i = samples[i + k].i;
+            curr_q = samples[i + k].q;
+            if (curr_i == 0 && curr_q == 0){
+                curr_i = 1;
+            }
+            re[k] = curr_i * prev_i + curr_q * prev_q;
+            im[k] = curr_q * prev_i - curr_i * prev_q;
+            prev_i = curr_i;
+            prev_q = curr_q;
+        }
+        for ( ; k % 4 != 0; k++){
+            re[k] = im[k] = 0.0f;
+        }
+
+        fast_angle(re, im, dphase, k);
+
+        //Integrate the phase change over each symbol period, and slice bits
+        fsk->slice(dphase, count, fsk->samp_per_symb, &s, data_buf);
+
+        i += count;
+    }
+
+    //Save demod state
+    if (i > 0){
+        fsk->last_sample = samples[i-1];
+        fsk->last_phase = angle(samples[i-1].i, samples[i-1].q);
+    }
+    fsk->curr_samp_index = s.samp;
+    fsk->curr_bit_index = s.bit;
+    fsk->curr_dphase_tot = s.dphase_tot;
+    if (s.bit != 0 || s.samp != 0){
+        fsk->last_byte_demod_complete = false;
+        fsk->last_byte = data_buf[s.byte];
+    }else{
+        fsk->last_byte_demod_complete = true;
+    }
+
+    return s.byte;
+}
+
 struct fsk_handle *fsk_init(void)
+{
+    return fsk_init_sps(SAMP_PER_SYMB);
+}
+
+struct fsk_handle *fsk_init_sps(unsigned int samp_per_symb)
 {
     struct fsk_handle *fsk;
 
+    if (samp_per_symb < FSK_MIN_SAMP_PER_SYMB || samp_per_symb > FSK_MAX_SAMP_PER_SYMB){
+        fprintf(stderr, "Invalid number of samples per symbol: %u\n", samp_per_symb);
+        return NULL;
+    }
+
     //Allocate memory for handle
-    fsk = malloc(sizeof(struct fsk_handle));
+    fsk = calloc(1, sizeof(struct fsk_handle));
     if (fsk == NULL){
         perror("malloc");
         return NULL;
     }
-    //Set modulation/demodulation parameters
-    fsk->samp_per_symb = SAMP_PER_SYMB;
-    fsk->points_per_rev = POINTS_PER_REV;
+    //Set modulation/demodulation parameters. One quarter turn per symbol.
+    fsk->samp_per_symb = (int) samp_per_symb;
+    fsk->points_per_rev = (samp_per_symb == SAMP_PER_SYMB) ? POINTS_PER_REV :
+                                                             4 * (int) samp_per_symb;
+    switch (samp_per_symb){
+        case 4:
+            fsk->slice = fsk_slice_4;
+            break;
+        case 8:
+            fsk->slice = fsk_slice_8;
+            break;
+        case 16:
+            fsk->slice = fsk_slice_16;
+            break;
+        default:
+            fsk->slice = fsk_slice_generic;
+            break;
+    }
     //Generate the samples table
-    fsk->sample_table = fsk_gen_samples_table(POINTS_PER_REV);
+    fsk->sample_table = fsk_gen_samples_table(fsk->points_per_rev);
     if (fsk->sample_table == NULL){
         fprintf(stderr, "Couldn't generate samples table\n");
         free(fsk);
         return NULL;
     }
+    //Generate the byte table
+    if (fsk_gen_byte_table(fsk) != 0){
+        fprintf(stderr, "Couldn't generate byte table\n");
+        fsk_close(fsk);
+        return NULL;
+    }
     //Initialize demod state variables
     fsk->last_byte_demod_complete = true;
     fsk->last_byte = 0x00;
     fsk->curr_dphase_tot = 0;
     fsk->last_phase = 0;
+    fsk->last_sample.i = 2047;
+    fsk->last_sample.q = 0;
     fsk->curr_samp_index = 0;
     fsk->curr_bit_index = 0;
     return fsk;
 }
 
+unsigned int fsk_samp_per_symb(const struct fsk_handle *fsk)
+{
+    return (unsigned int) fsk->samp_per_symb;
+}
+
 void fsk_close(struct fsk_handle *fsk)
 {
     if (fsk != NULL){
         free(fsk->sample_table);
+        free(fsk->byte_table);
+        free(fsk->byte_next_state);
     }
     free(fsk);
 }
@@ -47,6 +47,12 @@
 //NOTE: If you change these^ two macros, you'll need to change the FIR channel
 //filter as well if you want the modem to work
 
+//Range of samples per symbol accepted by fsk_init_sps(). 4, 8, and 16 samples per
+//symbol use demodulator loops specialized at compile time; other values use
+//generic loops.
+#define FSK_MIN_SAMP_PER_SYMB 1
+#define FSK_MAX_SAMP_PER_SYMB 32
+
 struct fsk_handle;
 
 /**
@@ -56,6 +62,25 @@ struct fsk_handle;
  */
 struct fsk_handle *fsk_init(void);
 
+/**
+ * Initialize an fsk handle for a number of samples per symbol other than
+ * SAMP_PER_SYMB. There are 4*samp_per_symb points per revolution, so that the
+ * modulation index remains pi/2.
+ *
+ * @param[in]   samp_per_symb   samples per symbol, from FSK_MIN_SAMP_PER_SYMB to
+ *                              FSK_MAX_SAMP_PER_SYMB
+ *
+ * @return    pointer to allocated/initiailized fsk_handle on success, NULL on failure
+ */
+struct fsk_handle *fsk_init_sps(unsigned int samp_per_symb);
+
+/**
+ * @param[in]   fsk     pointer to fsk handle
+ *
+ * @return      samples per symbol
+ */
+unsigned int fsk_samp_per_symb(const struct fsk_handle *fsk);
+
 /**
  * Deinitialize / deallocate memory for an fsk handle
  *
@@ -68,6 +93,9 @@ void fsk_close(struct fsk_handle *fsk);
  * Bit order: LSb transmitted first, MSb last
  * This function assumes an initial phase of 0 (1 + 0j)
  *
+ * The samples for each byte are copied from a table, generated by fsk_init(), that
+ * holds the modulated samples of every byte for every possible starting phase.
+ *
  * @param[in]   fsk             pointer to fsk handle
  * @param[in]   data_buf        bytes to transmit
  * @param[in]   num_bytes       number of bytes to transmit from data_buf
@@ -78,6 +106,30 @@ void fsk_close(struct fsk_handle *fsk);
 unsigned int fsk_mod(struct fsk_handle *fsk, uint8_t *data_buf, int num_bytes,
                         struct complex_sample *samples);
 
+/**
+ * Modulate a complete frame: a header (e.g., training sequence and preamble)
+ * immediately followed by a payload, with continuous phase across the two.
+ * The output is equivalent to calling fsk_mod() on the concatenation of the header
+ * and payload, without requiring them to be contiguous.
+ *
+ * Because struct complex_sample matches the SC16 Q11 sample format, `samples` may
+ * be a TX stream buffer passed directly to libbladeRF.
+ *
+ * @param[in]   fsk             pointer to fsk handle
+ * @param[in]   header          header bytes to transmit
+ * @param[in]   header_len      number of bytes in header
+ * @param[in]   payload         payload bytes to transmit
+ * @param[in]   payload_len     number of bytes in payload
+ * @param[out]  samples         buffer to place modulated IQ samples in. Must have room
+ *                              for (header_len + payload_len) * 8 *
+ *                              fsk_samp_per_symb(fsk) samples.
+ *
+ * @return      number of IQ samples modulated
+ */
+unsigned int fsk_mod_frame(struct fsk_handle *fsk, const uint8_t *header,
+                           unsigned int header_len, const uint8_t *payload,
+                           unsigned int payload_len, struct complex_sample *samples);
+
 /**
  * Convert an array of modulated CPFSK IQ samples into an array of bytes.
  * Expected bit order: LSb arrives first, MSb arrives last.
@@ -103,4 +155,23 @@ unsigned int fsk_mod(struct fsk_handle *fsk, uint8_t *data_buf, int num_bytes,
 unsigned int fsk_demod(struct fsk_handle *fsk, struct complex_sample *samples,
                     int num_samples, bool new_signal, int num_bytes, uint8_t *data_buf);
 
+/**
+ * Equivalent to fsk_demod(), but much faster.
+ *
+ * Rather than computing and unwrapping the absolute phase of every sample in double
+ * precision, the phase change between consecutive samples is computed directly as the
+ * angle of x[n] * conj(x[n-1]), using a vectorized polynomial approximation of atan2.
+ * The phase change is then integrated over each symbol period. This yields the same
+ * bits as fsk_demod(), except in the (noise-dominated) case where a symbol's total
+ * phase change is within rounding error of 0.
+ *
+ * This shares the partial-byte state in the fsk_handle with fsk_demod(), so the two
+ * may be used interchangeably on successive calls.
+ *
+ * Parameters and return value are the same as fsk_demod().
+ */
+unsigned int fsk_demod_fast(struct fsk_handle *fsk, const struct complex_sample *samples,
+                            int num_samples, bool new_signal, int num_bytes,
+                            uint8_t *data_buf);
+
 #endif
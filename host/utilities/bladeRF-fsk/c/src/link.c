@@ -43,57 +43,110 @@
     #define NOTE(...)
 #endif
 
+
 /********************************************
  *                                          *
  *  PRIVATE FUNCTIONS AND DATA STRUCTURES   *
  *                                          *
  ********************************************/
 
+//Set in the payload_length field of the first data frame sent after the link is
+//opened, and after the transmitter gives up on a frame. The receiver resynchronizes
+//its expected sequence number to this frame.
+#define LINK_RESYNC_FLAG 0x8000
+//Number of bits in the ack frame's selective ack bitmap
+#define SACK_BITS 32
+
 struct data_frame {
     //Total frame length = 1009 bytes (8072 bits)
     uint8_t type;               //0x00 = data frame, 0xFF = ack frame
     uint16_t seq_num;           //Sequence number
-    uint16_t payload_length;    //Length of used payload data in bytes
+    uint16_t payload_length;    //Length of used payload data in bytes, OR'd with
+                                //LINK_RESYNC_FLAG
     uint8_t payload[PAYLOAD_LENGTH];    //payload data
     uint32_t crc32;             //32-bit CRC
 };
 
 struct ack_frame {
-    //Total frame length = 7 bytes (56 bits)
+    //Total frame length = 11 bytes (88 bits)
     uint8_t type;               //0x00 = data frame, 0xFF = ack frame
-    uint16_t ack_num;           //Acknowledgement number
+    uint16_t ack_num;           //Cumulative acknowledgement number: the next sequence
+                                //number expected. All frames before it were received.
+    uint32_t sack_bitmap;       //Selective acks: bit i set if frame (ack_num + 1 + i)
+                                //was received
     uint32_t crc32;             //32-bit CRC
 };
 
+//A frame in the transmit window
+struct tx_slot {
+    uint8_t frame[DATA_FRAME_LENGTH];   //Complete frame, ready to (re)transmit
+    bool acked;                         //Has the frame been acknowledged
+    unsigned int tries;                 //Number of times the frame has been sent
+    struct timespec sent_time;          //Time of the first transmission
+    struct timespec deadline;           //Time at which to retransmit
+};
+
 struct tx {
-    struct data_frame data_frame_buf;   //Input data frame buffer
+    //Transmit window. Sequence numbers in [base, next) have been sent and are
+    //awaiting acks, and those in [next, end) are queued but not yet sent.
+    //Frame 'seq' is held in slots[seq % LINK_MAX_WINDOW_SIZE].
+    struct tx_slot slots[LINK_MAX_WINDOW_SIZE];
+    uint16_t base;                      //Oldest unacknowledged sequence number
+    uint16_t next;                      //Next sequence number to send
+    uint16_t end;                       //Next sequence number to queue
+    unsigned int window_size;           //Maximum value of (end - base)
+    bool need_resync;                   //Mark the next queued frame with the resync flag
+    bool resync_pending;                //Is the resync frame still awaiting an ack. If
+                                        //so, no other frames are sent.
+    uint16_t resync_seq;                //Sequence number of the resync frame
+    bool failed;                        //Did a frame go unacknowledged LINK_MAX_TRIES
+                                        //times since the last call to link_send_data()
+    //Round trip time estimation (RFC 6298), in microseconds
+    bool rtt_valid;                     //Has an RTT sample been taken
+    int64_t srtt_us;                    //Smoothed round trip time
+    int64_t rttvar_us;                  //Round trip time variation
+    int64_t rto_us;                     //Retransmission timeout
     struct ack_frame ack_frame_buf;     //Input ack frame buffer
     bool stop;                          //Signal to stop tx thread
-    bool data_buf_filled;               //Is the data frame buffer filled
     pthread_t thread;                   //Transmitter thread
-    pthread_cond_t data_buf_filled_cond;    //pthread condition corresponding to
-                                            //data_buf_filled
-    pthread_mutex_t data_buf_status_lock;   //Mutex for data_buf_filled_cond
+    pthread_cond_t data_buf_filled_cond;    //Signaled when a frame is queued or acked,
+                                            //to wake the tx thread
+    pthread_cond_t window_cond;         //Signaled when the window advances, to wake
+                                        //link_send_data()
+    pthread_mutex_t data_buf_status_lock;   //Mutex for all of the above state
     bool link_on;   //Is the transmitter on
-    bool done;      //Has the transmitter finished a transmission
-    bool success;   //Was the transmitter transmission successful
+};
+
+//A frame in the receive reorder buffer
+struct rx_slot {
+    uint8_t payload[PAYLOAD_LENGTH];    //payload data
+    uint16_t payload_length;            //Length of used payload data in bytes
+    bool received;                      //Does the slot hold a frame
 };
 
 struct rx {
     struct data_frame data_frame_buf;   //Output data frame buffer
-    struct ack_frame ack_frame_buf;     //Output ack frame buffer
+    //Reorder buffer. Sequence numbers in [read_seq, expected) have been received in
+    //order and are waiting to be read with link_receive_data(). Those in
+    //[expected, read_seq + LINK_MAX_WINDOW_SIZE) may have been received out of order.
+    //Frame 'seq' is held in slots[seq % LINK_MAX_WINDOW_SIZE]. These sequence numbers
+    //are the transmitter's sequence numbers plus 'seq_offset', so that numbering
+    //continues across a resync.
+    struct rx_slot slots[LINK_MAX_WINDOW_SIZE];
+    uint16_t read_seq;                  //Next sequence number to read
+    uint16_t expected;                  //Next sequence number expected in order
+    uint16_t seq_offset;                //Local sequence number - transmitter's
+    bool synced;                        //Has a resync frame been received
+    uint16_t last_resync_seq;           //Transmitter's sequence number of the last
+                                        //resync frame
     //Leftover bytes received but not returned to the user after a call to
     //link_receive_data()
     uint8_t extra_bytes[PAYLOAD_LENGTH];
     unsigned int num_extra_bytes;       //Number of bytes in 'extra_bytes' buffer
     pthread_t thread;                   //Receiver thread
     bool stop;                          //Signal to stop rx thread
-    bool data_buf_filled;               //Is the data frame buffer filled
-    pthread_cond_t data_buf_filled_cond;    //pthread condition for data_buf_filled
-    pthread_mutex_t data_buf_status_lock;   //mutex for data_buf_filled_cond
-    bool ack_buf_filled;                    //Is the ack frame buffer filled
-    pthread_cond_t ack_buf_filled_cond;     //pthread condition for ack_buf_filled
-    pthread_mutex_t ack_buf_status_lock;    //mutex for ack_buf_filled_cond
+    pthread_cond_t data_buf_filled_cond;    //Signaled when 'expected' advances
+    pthread_mutex_t data_buf_status_lock;   //Mutex for the reorder buffer
     bool link_on;                           //Is the receiver on
 };
 
@@ -106,18 +159,21 @@ struct link_handle {
 };
 
 //internal functions
+static struct link_handle *link_open(struct phy_handle *phy);
 //tx:
 static int start_transmitter(struct link_handle *link);
 static int stop_transmitter(struct link_handle *link);
 void *transmit_data_frames(void *arg);
-static int send_payload(struct link_handle *link, uint8_t *payload,
-                        uint16_t used_payload_length);
+static int queue_payload(struct link_handle *link, uint8_t *payload,
+                         uint16_t used_payload_length);
+static void update_rto(struct link_handle *link, int64_t rtt_us);
 //rx:
 static int start_receiver(struct link_handle *link);
 static int stop_receiver(struct link_handle *link);
 void *receive_frames(void *arg);
-static int receive_ack(struct link_handle *link, uint16_t ack_num,
-                        unsigned int timeout_ms);
+static void receive_ack(struct link_handle *link, struct ack_frame *ack);
+static bool receive_data_frame(struct link_handle *link, struct data_frame *frame,
+                               struct ack_frame *ack);
 static int receive_payload(struct link_handle *link, uint8_t *payload,
                             unsigned int timeout_ms);
 //utility:
@@ -133,26 +189,72 @@ static void convert_buf_to_ack_frame_struct(uint8_t *buf, struct ack_frame *fram
  ****************************************/
 
 struct link_handle *link_init(struct bladerf *dev, struct radio_params *params)
+{
+    struct phy_handle *phy;
+
+    DEBUG_MSG("[LINK] Initializing\n");
+    //---------------Open/Initialize phy handle--------------------------
+    phy = phy_init(dev, params);
+    if (phy == NULL){
+        fprintf(stderr, "[LINK] Couldn't initialize phy handle\n");
+        return NULL;
+    }
+    return link_open(phy);
+}
+
+int link_init_loopback_pair(const struct phy_loopback_params *params,
+                            struct link_handle **link1, struct link_handle **link2)
+{
+    struct phy_handle *phy1, *phy2;
+    int status;
+
+    DEBUG_MSG("[LINK] Initializing loopback pair\n");
+    *link1 = NULL;
+    *link2 = NULL;
+
+    status = phy_init_loopback_pair(params, &phy1, &phy2);
+    if (status != 0){
+        fprintf(stderr, "[LINK] Couldn't initialize loopback phy handles\n");
+        return -1;
+    }
+    *link1 = link_open(phy1);
+    if (*link1 == NULL){
+        phy_close(phy2);
+        return -1;
+    }
+    *link2 = link_open(phy2);
+    if (*link2 == NULL){
+        link_close(*link1);
+        *link1 = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Allocate a link handle on top of an initialized phy handle, and start all threads.
+ * The link handle takes ownership of the phy handle, and closes it on failure.
+ *
+ * @param[in]   phy     pointer to phy handle
+ *
+ * @return      pointer to allocated link_handle struct on success, NULL on error
+ */
+static struct link_handle *link_open(struct phy_handle *phy)
 {
     int status;
     struct link_handle *link;
 
-    DEBUG_MSG("[LINK] Initializing\n");
     //-------------Allocate memory for link handle struct--------------
     //Calloc so all pointers are initialized to NULL, and all bools are
     //initialized to false
     link = calloc(1, sizeof(struct link_handle));
     if (link == NULL){
         perror("malloc");
+        phy_close(phy);
         return NULL;
     }
+    link->phy = phy;
 
-    //---------------Open/Initialize phy handle--------------------------
-    link->phy = phy_init(dev, params);
-    if (link->phy == NULL){
-        fprintf(stderr, "[LINK] Couldn't initialize phy handle\n");
-        goto error;
-    }
     //Start phy receiver
     status = phy_start_receiver(link->phy);
     if (status != 0){
@@ -169,24 +271,30 @@ struct link_handle *link_init(struct bladerf *dev, struct radio_params *params)
     link->phy_tx_on = true;
 
     //------------------Allocate memory for tx struct and initialize-----
-    link->tx = malloc(sizeof(struct tx));
+    link->tx = calloc(1, sizeof(struct tx));
     if (link->tx == NULL){
         perror("malloc");
         goto error;
     }
     //Initialize control/state variables
     link->tx->stop = false;
-    link->tx->data_buf_filled = false;
-    link->tx->done = false;
-    link->tx->success = false;
+    link->tx->window_size = LINK_WINDOW_SIZE;
+    link->tx->need_resync = true;
+    link->tx->rto_us = ACK_TIMEOUT_MS * 1000;
     link->tx->link_on = false;
-    //Initialize pthread condition variable
+    //Initialize pthread condition variables
     status = pthread_cond_init(&(link->tx->data_buf_filled_cond), NULL);
     if (status != 0){
         fprintf(stderr, "[LINK] Error initializing pthread_cond: %s\n",
                     strerror(status));
         goto error;
     }
+    status = pthread_cond_init(&(link->tx->window_cond), NULL);
+    if (status != 0){
+        fprintf(stderr, "[LINK] Error initializing pthread_cond: %s\n",
+                    strerror(status));
+        goto error;
+    }
     //Initialize pthread mutex variable
     status = pthread_mutex_init(&(link->tx->data_buf_status_lock), NULL);
     if (status != 0){
@@ -195,7 +303,7 @@ struct link_handle *link_init(struct bladerf *dev, struct radio_params *params)
         goto error;
     }
     //------------------Allocate memory for rx struct and initialize-----
-    link->rx = malloc(sizeof(struct rx));
+    link->rx = calloc(1, sizeof(struct rx));
     if (link->rx == NULL){
         perror("malloc");
         goto error;
@@ -214,24 +322,9 @@ struct link_handle *link_init(struct bladerf *dev, struct radio_params *params)
                     strerror(status));
         goto error;
     }
-    //Initialize pthread condition variable for ack
-    status = pthread_cond_init(&(link->rx->ack_buf_filled_cond), NULL);
-    if (status != 0){
-        fprintf(stderr, "[LINK] Error initializing pthread_cond: %s\n",
-                    strerror(status));
-        goto error;
-    }
-    //Initialize pthread mutex variable for ack
-    status = pthread_mutex_init(&(link->rx->ack_buf_status_lock), NULL);
-    if (status != 0){
-        fprintf(stderr, "[LINK] Error initializing pthread_mutex: %s\n",
-                    strerror(status));
-        goto error;
-    }
     //Initialize control/state variables
     link->rx->stop = false;
-    link->rx->data_buf_filled = false;
-    link->rx->ack_buf_filled = false;
+    link->rx->synced = false;
     link->rx->num_extra_bytes = 0;
     link->rx->link_on = false;
 
@@ -275,19 +368,11 @@ void link_close(struct link_handle *link)
                     fprintf(stderr, "[LINK] Error stopping link transmitter\n");
                 }
             }
-            status = pthread_mutex_destroy(&(link->tx->data_buf_status_lock));
-            if (status != 0){
-                fprintf(stderr, "[LINK] Error destroying pthread_mutex\n");
-            }
-            status = pthread_cond_destroy(&(link->tx->data_buf_filled_cond));
-            if (status != 0){
-                fprintf(stderr, "[LINK] Error destroying pthread_cond\n");
-            }
         }
-        free(link->tx);
         //Cleanup rx struct
         if (link->rx != NULL){
-            //Stop the link receiver if it is on
+            //Stop the link receiver if it is on. It processes acks for the
+            //transmitter, so the tx struct must be freed after this.
             if (link->rx->link_on){
                 status = stop_receiver(link);
                 if (status != 0){
@@ -302,16 +387,23 @@ void link_close(struct link_handle *link)
             if (status != 0){
                 fprintf(stderr, "[LINK] Error destroying pthread_cond\n");
             }
-            status = pthread_mutex_destroy(&(link->rx->ack_buf_status_lock));
+        }
+        free(link->rx);
+        if (link->tx != NULL){
+            status = pthread_mutex_destroy(&(link->tx->data_buf_status_lock));
             if (status != 0){
                 fprintf(stderr, "[LINK] Error destroying pthread_mutex\n");
             }
-            status = pthread_cond_destroy(&(link->rx->ack_buf_filled_cond));
+            status = pthread_cond_destroy(&(link->tx->data_buf_filled_cond));
+            if (status != 0){
+                fprintf(stderr, "[LINK] Error destroying pthread_cond\n");
+            }
+            status = pthread_cond_destroy(&(link->tx->window_cond));
             if (status != 0){
                 fprintf(stderr, "[LINK] Error destroying pthread_cond\n");
             }
         }
-        free(link->rx);
+        free(link->tx);
         //Close the phy
         if (link->phy != NULL){
             //Stop phy transmitter/receiver if they are on
@@ -335,6 +427,19 @@ void link_close(struct link_handle *link)
     link = NULL;
 }
 
+int link_set_window_size(struct link_handle *link, unsigned int size)
+{
+    if (size < 1 || size > LINK_MAX_WINDOW_SIZE){
+        fprintf(stderr, "[LINK] %s: Invalid window size %u (must be 1 - %u)\n",
+                __FUNCTION__, size, LINK_MAX_WINDOW_SIZE);
+        return -1;
+    }
+    pthread_mutex_lock(&(link->tx->data_buf_status_lock));
+    link->tx->window_size = size;
+    pthread_mutex_unlock(&(link->tx->data_buf_status_lock));
+    return 0;
+}
+
 /**
  * Convert data frame struct to a buffer of uint8_t
  * @param[in]   frame   pointer to data_frame structure to convert
@@ -383,6 +488,9 @@ static void convert_ack_frame_struct_to_buf(struct ack_frame *frame, uint8_t *bu
     //ack num
     memcpy(&buf[i], &(frame->ack_num), sizeof(frame->ack_num));
     i += sizeof(frame->ack_num);
+    //selective ack bitmap
+    memcpy(&buf[i], &(frame->sack_bitmap), sizeof(frame->sack_bitmap));
+    i += sizeof(frame->sack_bitmap);
     //crc
     memcpy(&buf[i], &(frame->crc32), sizeof(frame->crc32));
     i += sizeof(frame->crc32);
@@ -445,6 +553,9 @@ static void convert_buf_to_ack_frame_struct(uint8_t *buf, struct ack_frame *fram
     //ack num
     memcpy(&(frame->ack_num), &buf[i], sizeof(frame->ack_num));
     i += sizeof(frame->ack_num);
+    //selective ack bitmap
+    memcpy(&(frame->sack_bitmap), &buf[i], sizeof(frame->sack_bitmap));
+    i += sizeof(frame->sack_bitmap);
     //crc
     memcpy(&(frame->crc32), &buf[i], sizeof(frame->crc32));
     i += sizeof(frame->crc32);
@@ -474,10 +585,14 @@ static int start_transmitter(struct link_handle *link)
 {
     int status;
 
-    link->tx->done = false;
-    link->tx->success = false;
     //be sure stop signal is off
     link->tx->stop = false;
+    //Set initial sequence number to random value
+    srand((unsigned int)time(NULL));
+    link->tx->base = (uint16_t) (rand() % 65536);
+    link->tx->next = link->tx->base;
+    link->tx->end = link->tx->base;
+    DEBUG_MSG("[LINK] TX: Initial seq num = %hu\n", link->tx->base);
     //Kick off transmitter thread
     status = pthread_create(&(link->tx->thread), NULL, transmit_data_frames, link);
     if (status != 0){
@@ -500,18 +615,21 @@ static int stop_transmitter(struct link_handle *link)
     int status;
 
     DEBUG_MSG("[LINK] TX: Stopping transmitter...\n");
-    //signal stop
-    link->tx->stop = true;
-    //Signal the buffer filled condition so the thread will stop waiting
-    //for a filled buffer
+    //Signal stop, and signal the conditions so the thread (and link_send_data())
+    //will stop waiting
     status = pthread_mutex_lock(&(link->tx->data_buf_status_lock));
     if (status != 0){
         fprintf(stderr, "[LINK] Error locking pthread_mutex\n");
     }
+    link->tx->stop = true;
     status = pthread_cond_signal(&(link->tx->data_buf_filled_cond));
     if (status != 0){
         fprintf(stderr, "[LINK] Error signaling pthread_cond\n");
     }
+    status = pthread_cond_broadcast(&(link->tx->window_cond));
+    if (status != 0){
+        fprintf(stderr, "[LINK] Error signaling pthread_cond\n");
+    }
     status = pthread_mutex_unlock(&(link->tx->data_buf_status_lock));
     if (status != 0){
         fprintf(stderr, "[LINK] Error unlocking pthread_mutex\n");
@@ -536,55 +654,78 @@ int link_send_data(struct link_handle *link, uint8_t *data, unsigned int data_le
 
     num_full_payloads = data_length/PAYLOAD_LENGTH;
 
-    //Loop through each full payload
+    status = pthread_mutex_lock(&(link->tx->data_buf_status_lock));
+    if (status != 0){
+        fprintf(stderr, "[LINK] Error locking pthread_mutex: %s\n",
+                    strerror(status));
+        return -1;
+    }
+    link->tx->failed = false;
+
+    //Queue each full payload
     for(i = 0; i < num_full_payloads; i++){
-        //Send the frame
-        status = send_payload(link, &data[i*PAYLOAD_LENGTH], PAYLOAD_LENGTH);
+        status = queue_payload(link, &data[i*PAYLOAD_LENGTH], PAYLOAD_LENGTH);
         if (status != 0){
-            if (status == -2){
-                DEBUG_MSG("[LINK] TX: Send data failed: "
-                            "No response for payload #%d\n", i+1);
-            }else{
-                fprintf(stderr, "[LINK] TX: Send data failed: "
-                            "Unexpected error sending payload #%d\n", i+1);
-            }
-            return status;
+            goto out;
         }
     }
 
-    //Send the last payload for the remaining bytes
+    //Queue the last payload for the remaining bytes
     last_payload_length = data_length % PAYLOAD_LENGTH;
     if (last_payload_length != 0){
-        status = send_payload(link, &data[i*PAYLOAD_LENGTH],
+        status = queue_payload(link, &data[i*PAYLOAD_LENGTH],
                                 (uint16_t) last_payload_length);
         if (status != 0){
-            if (status == -2){
-                DEBUG_MSG("[LINK] TX: Send data failed: "
-                            "No response for payload #%d\n", i+1);
-            }else{
-                fprintf(stderr, "[LINK] TX: Send data failed: "
-                            "Unexpected error sending payload #%d\n", i+1);
-            }
-            return status;
+            goto out;
         }
     }
-    return 0;
+
+    //Wait for every frame to be acknowledged
+    while (link->tx->base != link->tx->end && !link->tx->failed && !link->tx->stop){
+        status = pthread_cond_wait(&(link->tx->window_cond),
+                                   &(link->tx->data_buf_status_lock));
+        if (status != 0){
+            fprintf(stderr, "[LINK] %s: Condition wait failed: %s\n", __FUNCTION__,
+                    strerror(status));
+            status = -1;
+            goto out;
+        }
+    }
+    if (link->tx->failed){
+        status = -2;
+    }else if (link->tx->stop){
+        status = -1;
+    }
+
+    out:
+        if (status == -2){
+            DEBUG_MSG("[LINK] TX: Send data failed: No response\n");
+        }else if (status != 0){
+            fprintf(stderr, "[LINK] TX: Send data failed: Unexpected error\n");
+        }
+        pthread_mutex_unlock(&(link->tx->data_buf_status_lock));
+        return status;
 }
 
 /**
- * Sends a payload. Blocks until either the transmission was successful (with an
- * acknowledgement) or there was no response (exceeded max number of retransmissions)
+ * Queues a payload for transmission. Blocks until there is room in the window.
+ * Must be called with the tx data_buf_status_lock held.
  *
  * @param[in]   link                    pointer to link handle
  * @param[in]   payload                 buffer of bytes to send
  * @param[in]   used_payload_length     number of bytes to send in 'payload'. If less
  *                                      than PAYLOAD_LENGTH, zeros will be padded.
- * @return      0 on success, -1 on error, -2 on timeout/no response
+ * @return      0 on success, -1 on error, -2 if a previously queued frame was
+ *              not acknowledged (exceeded max number of retransmissions)
  */
-static int send_payload(struct link_handle *link, uint8_t *payload,
-                    uint16_t used_payload_length)
+static int queue_payload(struct link_handle *link, uint8_t *payload,
+                         uint16_t used_payload_length)
 {
     int status;
+    struct tx *tx = link->tx;
+    struct tx_slot *slot;
+    struct data_frame frame;
+    uint32_t crc_32;
 
     if (used_payload_length > PAYLOAD_LENGTH){
         fprintf(stderr, "[LINK] %s: Invalid payload length of %hu\n", __FUNCTION__,
@@ -592,55 +733,98 @@ static int send_payload(struct link_handle *link, uint8_t *payload,
         return -1;
     }
 
-    //Wait for tx buf to be empty
-    while(link->tx->data_buf_filled){
-        usleep(50);
-    }
-    //Copy payload data into frame buffer
-    memcpy(link->tx->data_frame_buf.payload, payload, used_payload_length);
-    //Pad zeros to unused portion of the payload
-    memset(&(link->tx->data_frame_buf.payload[used_payload_length]), 0,
-            PAYLOAD_LENGTH - used_payload_length);
-    //Set payload length
-    link->tx->data_frame_buf.payload_length = used_payload_length;
-    //Mark tx not done
-    link->tx->done = false;
-    //Mark buffer filled
-    link->tx->data_buf_filled = true;
-    //Signal the buffer filled condition
-    status = pthread_mutex_lock(&(link->tx->data_buf_status_lock));
-    if (status != 0){
-        fprintf(stderr, "[LINK] Error locking pthread_mutex: %s\n",
+    //Wait for room in the window
+    while ((uint16_t)(tx->end - tx->base) >= tx->window_size && !tx->failed &&
+            !tx->stop){
+        status = pthread_cond_wait(&(tx->window_cond), &(tx->data_buf_status_lock));
+        if (status != 0){
+            fprintf(stderr, "[LINK] %s: Condition wait failed: %s\n", __FUNCTION__,
                     strerror(status));
-        return -1;
+            return -1;
+        }
     }
-    status = pthread_cond_signal(&(link->tx->data_buf_filled_cond));
-    if (status != 0){
-        fprintf(stderr, "[LINK] Error signaling pthread_cond: %s\n",
-                    strerror(status));
+    if (tx->stop){
         return -1;
     }
-    status = pthread_mutex_unlock(&(link->tx->data_buf_status_lock));
+    if (tx->failed){
+        return -2;
+    }
+
+    //Build the frame
+    frame.type = DATA_FRAME_CODE;
+    frame.seq_num = tx->end;
+    frame.payload_length = used_payload_length;
+    if (tx->need_resync){
+        frame.payload_length |= LINK_RESYNC_FLAG;
+        tx->resync_seq = tx->end;
+        tx->resync_pending = true;
+        tx->need_resync = false;
+    }
+    //Copy payload data into frame, and pad zeros to unused portion of the payload
+    memcpy(frame.payload, payload, used_payload_length);
+    memset(&(frame.payload[used_payload_length]), 0,
+            PAYLOAD_LENGTH - used_payload_length);
+
+    //Copy frame into its window slot
+    slot = &(tx->slots[tx->end % LINK_MAX_WINDOW_SIZE]);
+    convert_data_frame_struct_to_buf(&frame, slot->frame);
+    //Calculate the CRC
+    crc_32 = crc32(slot->frame, DATA_FRAME_LENGTH - sizeof(crc_32));
+    //Copy this CRC to the frame
+    memcpy(&(slot->frame[DATA_FRAME_LENGTH - sizeof(crc_32)]), &crc_32, sizeof(crc_32));
+    slot->acked = false;
+    slot->tries = 0;
+    tx->end++;
+
+    //Wake the transmitter
+    status = pthread_cond_signal(&(tx->data_buf_filled_cond));
     if (status != 0){
-        fprintf(stderr, "[LINK] Error unlocking pthread_mutex: %s\n",
+        fprintf(stderr, "[LINK] Error signaling pthread_cond: %s\n",
                     strerror(status));
         return -1;
     }
-    //Wait for the transmission to complete
-    //TODO: Change this to a pthread condition signal
-    while (!link->tx->done){
-        usleep(100);
+    return 0;
+}
+
+/**
+ * Update the round trip time estimate and retransmission timeout with a new
+ * round trip time measurement, as in RFC 6298. Must be called with the tx
+ * data_buf_status_lock held.
+ *
+ * @param[in]   link        pointer to link handle
+ * @param[in]   rtt_us      measured round trip time, in microseconds
+ */
+static void update_rto(struct link_handle *link, int64_t rtt_us)
+{
+    struct tx *tx = link->tx;
+    int64_t err;
+
+    if (!tx->rtt_valid){
+        tx->srtt_us = rtt_us;
+        tx->rttvar_us = rtt_us / 2;
+        tx->rtt_valid = true;
+    }else{
+        err = tx->srtt_us - rtt_us;
+        if (err < 0){
+            err = -err;
+        }
+        tx->rttvar_us = (3 * tx->rttvar_us + err) / 4;
+        tx->srtt_us = (7 * tx->srtt_us + rtt_us) / 8;
     }
-    //Check the status of the transmission
-    if (!link->tx->success){
-        return -2;
+    tx->rto_us = tx->srtt_us + 4 * tx->rttvar_us;
+    if (tx->rto_us < LINK_MIN_RTO_MS * 1000){
+        tx->rto_us = LINK_MIN_RTO_MS * 1000;
+    }else if (tx->rto_us > LINK_MAX_RTO_MS * 1000){
+        tx->rto_us = LINK_MAX_RTO_MS * 1000;
     }
-
-    return 0;
 }
 
 /**
- * Thread function that transmits data frames and waits for acks.
+ * Thread function that transmits queued data frames, and retransmits frames which
+ * have not been acknowledged before their retransmission timeout. Each
+ * retransmission of a frame doubles its timeout. If a frame goes unacknowledged
+ * LINK_MAX_TRIES times, the whole window is dropped, and the next frame queued
+ * resynchronizes the receiver.
  * Does not directly receive acks - the receive_frames() function does this.
  * Does not transmit acks - the receive_frames function does this.
  *
@@ -649,110 +833,97 @@ static int send_payload(struct link_handle *link, uint8_t *payload,
 void *transmit_data_frames(void *arg)
 {
     int status;
-    uint16_t seq_num;
-    uint32_t crc_32;
-    unsigned int tries;
+    uint16_t seq;
     uint8_t data_send_buf[DATA_FRAME_LENGTH];
-    bool failed;
+    struct tx_slot *slot;
+    struct timespec now, wake;
+    bool send;
 
     //cast arg
     struct link_handle *link = (struct link_handle *) arg;
-    //Set initial sequence number to random value
-    srand((unsigned int)time(NULL));
-    seq_num = rand() % 65536;
-    DEBUG_MSG("[LINK] TX: Initial seq num = %hu\n", seq_num);
-    tries = 1;
-
-    while (!link->tx->stop){
-        if (tries > LINK_MAX_TRIES){
-            DEBUG_MSG("[LINK] TX: Exceeded max tries (%u) without an ACK."
-                            " Skipping frame\n", tries-1);
-            link->tx->success = false;
-            link->tx->done = true;
-            tries = 1;
-        }
-        if (tries == 1){
-            //---------Wait for data buffer to be filled-----------
-            //Lock mutex
-            status = pthread_mutex_lock(&(link->tx->data_buf_status_lock));
-            if (status != 0){
-                fprintf(stderr, "[LINK] Mutex lock failed: %s\n",
-                        strerror(status));
-                goto out;
+    struct tx *tx = link->tx;
+
+    status = pthread_mutex_lock(&(tx->data_buf_status_lock));
+    if (status != 0){
+        fprintf(stderr, "[LINK] Mutex lock failed: %s\n", strerror(status));
+        return NULL;
+    }
+    while (!tx->stop){
+        create_timeout_abs(0, &now);
+        send = false;
+        //--Retransmit the oldest frame whose timer has expired
+        for (seq = tx->base; seq != tx->next; seq++){
+            slot = &(tx->slots[seq % LINK_MAX_WINDOW_SIZE]);
+            if (slot->acked || timespec_diff_us(&(slot->deadline), &now) > 0){
+                continue;
             }
-            //Wait for condition signal - meaning buffer is full
-            failed = false;
-            while (!link->tx->data_buf_filled && !link->tx->stop){
-                DEBUG_MSG("[LINK] TX: Waiting for buffer to be filled\n");
-                status = pthread_cond_wait(&(link->tx->data_buf_filled_cond),
-                                            &(link->tx->data_buf_status_lock));
-                if (status != 0){
-                    fprintf(stderr, "[LINK] transmit_frames(): "
-                            "Condition wait failed: %s\n", strerror(status));
-                    failed = true;
-                    break;
-                }
+            if (slot->tries >= LINK_MAX_TRIES){
+                DEBUG_MSG("[LINK] TX: Exceeded max tries (%u) without an ACK for "
+                          "frame %hu. Dropping window\n", slot->tries, seq);
+                tx->base = tx->end;
+                tx->next = tx->end;
+                tx->failed = true;
+                tx->need_resync = true;
+                tx->resync_pending = false;
+                pthread_cond_broadcast(&(tx->window_cond));
+                break;
             }
-            //Unlock mutex
-            status = pthread_mutex_unlock(&(link->tx->data_buf_status_lock));
+            DEBUG_MSG("[LINK] TX: Didn't get an ACK for frame %hu (timed out). "
+                      "Resending\n", seq);
+            slot->deadline = now;
+            timespec_add_us(&(slot->deadline), tx->rto_us << slot->tries);
+            slot->tries++;
+            memcpy(data_send_buf, slot->frame, DATA_FRAME_LENGTH);
+            send = true;
+            break;
+        }
+        //--Otherwise send the next queued frame, if any. While the resync frame is
+        //--awaiting an ack, no other frames are sent.
+        if (!send && tx->next != tx->end &&
+                !(tx->resync_pending && tx->next != tx->resync_seq)){
+            slot = &(tx->slots[tx->next % LINK_MAX_WINDOW_SIZE]);
+            slot->tries = 1;
+            slot->sent_time = now;
+            slot->deadline = now;
+            timespec_add_us(&(slot->deadline), tx->rto_us);
+            memcpy(data_send_buf, slot->frame, DATA_FRAME_LENGTH);
+            tx->next++;
+            send = true;
+        }
+        if (send){
+            //Transmit the frame
+            pthread_mutex_unlock(&(tx->data_buf_status_lock));
+            status = phy_fill_tx_buf(link->phy, data_send_buf, DATA_FRAME_LENGTH);
+            pthread_mutex_lock(&(tx->data_buf_status_lock));
             if (status != 0){
-                fprintf(stderr, "[LINK] transmit_frames(): Mutex unlock failed: %s\n",
-                        strerror(status));
-                failed = true;
-            }
-            //Stop thread if stop variable is true, or something with pthreads went wrong
-            if (link->tx->stop || failed){
-                link->tx->data_buf_filled = false;
-                goto out;
+                fprintf(stderr, "[LINK] Couldn't fill phy tx buffer\n");
+                break;
             }
-            DEBUG_MSG("[LINK] TX: Frame buffer filled. Sending...\n");
-            //Set frame type
-            link->tx->data_frame_buf.type = DATA_FRAME_CODE;
-            //Set sequence number
-            link->tx->data_frame_buf.seq_num = seq_num;
-            //Copy frame into send buf
-            convert_data_frame_struct_to_buf(&(link->tx->data_frame_buf), data_send_buf);
-            //Calculate the CRC
-            crc_32 = crc32(data_send_buf, DATA_FRAME_LENGTH - sizeof(crc_32));
-            //Copy this CRC to the send buf
-            memcpy(&data_send_buf[DATA_FRAME_LENGTH - sizeof(crc_32)],
-                    &crc_32, sizeof(crc_32));
-            //Mark tx data buffer empty
-            link->tx->data_buf_filled = false;
+            continue;
         }
-        //Transmit the frame
-        status = phy_fill_tx_buf(link->phy, data_send_buf, DATA_FRAME_LENGTH);
-        if (status != 0){
-            fprintf(stderr, "[LINK] Couldn't fill phy tx buffer\n");
-            goto out;
+        //--Nothing to send. Wait for a frame to be queued or acknowledged, or for
+        //--the earliest retransmission timeout
+        wake = now;
+        timespec_add_us(&wake, 100000);
+        for (seq = tx->base; seq != tx->next; seq++){
+            slot = &(tx->slots[seq % LINK_MAX_WINDOW_SIZE]);
+            if (!slot->acked && timespec_diff_us(&(slot->deadline), &wake) < 0){
+                wake = slot->deadline;
+            }
         }
-        DEBUG_MSG("[LINK] TX: Frame sent to PHY. Waiting for ACK...\n");
-        //Wait for an ack
-        status = receive_ack(link, seq_num, ACK_TIMEOUT_MS);
-        if (status == -2){
-            DEBUG_MSG("[LINK] TX: Didn't get an ACK (timed out). Resending\n");
-            tries++;
-            continue;
-        }else if (status == -3){
-            DEBUG_MSG("[LINK] TX: Received wrong ACK number. Resending\n");
-            tries++;
-            continue;
-        }else if (status < 0){
-            fprintf(stderr, "[LINK] TX: Error receiving ACK. "
-                            "Stopping transmitter\n");
-            goto out;
+        status = pthread_cond_timedwait(&(tx->data_buf_filled_cond),
+                                        &(tx->data_buf_status_lock), &wake);
+        if (status != 0 && status != ETIMEDOUT){
+            fprintf(stderr, "[LINK] transmit_frames(): "
+                    "Condition wait failed: %s\n", strerror(status));
+            break;
         }
-        //Success!
-        DEBUG_MSG("[LINK] TX: Got an ACK\n");
-        link->tx->success = true;
-        link->tx->done = true;
-        tries = 1;
-        seq_num++;
     }
-
-    out:
-        link->tx->done = true;
-        return NULL;
+    //Make sure link_send_data() doesn't wait on a stopped transmitter
+    tx->stop = true;
+    pthread_cond_broadcast(&(tx->window_cond));
+    pthread_mutex_unlock(&(tx->data_buf_status_lock));
+    return NULL;
 }
 
 /****************************************
@@ -885,7 +1056,7 @@ int link_receive_data(struct link_handle *link, int size, int max_timeouts,
 }
 
 /**
- * Receives a payload and copies it into the given buffer
+ * Receives the next in-order payload and copies it into the given buffer
  * @param[in]   link            pointer to link handle
  * @param[in]   timeout_ms      Amount of time to wait for a received payload
  * @param[out]  payload         pointer to buffer to place payload in
@@ -897,6 +1068,7 @@ static int receive_payload(struct link_handle *link, uint8_t *payload, unsigned
 {
     int payload_length = 10;    //must be initialized above 0
     struct timespec timeout_abs;
+    struct rx_slot *slot;
     int status;
 
     //Create absolute time format timeout
@@ -913,8 +1085,8 @@ static int receive_payload(struct link_handle *link, uint8_t *payload, unsigned
                     strerror(status));
         return -1;
     }
-    //Wait for condition signal - meaning rx data buffer is full
-    while (!link->rx->data_buf_filled){
+    //Wait for condition signal - meaning the next frame has been received
+    while (link->rx->read_seq == link->rx->expected){
         status = pthread_cond_timedwait(&(link->rx->data_buf_filled_cond),
                                     &(link->rx->data_buf_status_lock), &timeout_abs);
         if (status != 0){
@@ -928,100 +1100,187 @@ static int receive_payload(struct link_handle *link, uint8_t *payload, unsigned
             break;
         }
     }
-    //Waiting is done. Unlock mutex.
+    if (payload_length >= 0){
+        slot = &(link->rx->slots[link->rx->read_seq % LINK_MAX_WINDOW_SIZE]);
+        //Get the length of the used portion of the payload
+        payload_length = slot->payload_length;
+        //Copy the used portion of the payload
+        memcpy(payload, slot->payload, payload_length);
+        //Mark the slot empty
+        slot->received = false;
+        link->rx->read_seq++;
+    }
+    //Done. Unlock mutex.
     status = pthread_mutex_unlock(&(link->rx->data_buf_status_lock));
     if (status != 0){
         fprintf(stderr, "[LINK] RX: receive_payload(): Mutex unlock failed: %s\n",
                 strerror(status));
         payload_length = -1;
     }
-    //Did we error or timeout? Return
-    if (payload_length < 0){
-        return payload_length;
-    }
-
-    //Get the length of the used portion of the payload
-    payload_length = link->rx->data_frame_buf.payload_length;
-    //Copy the used portion of the payload
-    memcpy(payload, link->rx->data_frame_buf.payload, payload_length);
-    //Mark the rx data buffer empty
-    link->rx->data_buf_filled = false;
 
     return payload_length;
 }
 
 /**
- * Attempts to receive an ACK with the given ACK number
- * Waits until it either receives an ack or times out.
+ * Stores a received data frame in the reorder buffer (unless it is a duplicate, or
+ * there is no room for it), and builds the acknowledgement to send in response.
  *
  * @param[in]   link        pointer to link handle
- * @param[in]   ack_num     acknowledgement number to look for
- * @param[in]   timeout_ms  amount of time to wait for an ACK, in milliseconds
+ * @param[in]   frame       data frame which passed the CRC check
+ * @param[out]  ack         ack frame to send, without CRC
  *
- * @return      0 if successfully received ack, -1 if pthread error or wrong ack number,
- *              -2 if timed out, -3 if wrong ack number
+ * @return      true if 'ack' should be sent, false if the frame was dropped without
+ *              an acknowledgement
  */
-static int receive_ack(struct link_handle *link, uint16_t ack_num, unsigned int timeout_ms)
+static bool receive_data_frame(struct link_handle *link, struct data_frame *frame,
+                               struct ack_frame *ack)
 {
-    struct timespec timeout_abs;
-    int status, ret = 0;
+    struct rx *rx = link->rx;
+    struct rx_slot *slot;
+    uint16_t payload_length, seq;
+    bool resync, advanced = false;
+    unsigned int i;
 
-    //Create absolute time format timeout
-    status = create_timeout_abs(timeout_ms, &timeout_abs);
-    if (status != 0){
-        fprintf(stderr, "[LINK] RX: receive_ack(): Error creating timeout\n");
-        return -1;
+    resync = (frame->payload_length & LINK_RESYNC_FLAG) != 0;
+    payload_length = frame->payload_length & ~LINK_RESYNC_FLAG;
+    if (payload_length > PAYLOAD_LENGTH){
+        NOTE("[LINK] RX: Invalid payload length (%hu). Dropping.\n", payload_length);
+        return false;
     }
 
-    //Prepare to wait with pthread_cond_timedwait()
-    status = pthread_mutex_lock(&(link->rx->ack_buf_status_lock));
-    if (status != 0){
-        fprintf(stderr, "[LINK] RX: receive_ack(): Error locking mutex: %s\n",
-                    strerror(status));
-        return -1;
+    pthread_mutex_lock(&(rx->data_buf_status_lock));
+    //A resync frame which isn't a retransmission of the last one starts a new
+    //sequence. Frames received out of order belong to the transmitter's previous
+    //attempt, so discard them. Frames received in order are kept for the reader.
+    if (resync && (!rx->synced || frame->seq_num != rx->last_resync_seq)){
+        DEBUG_MSG("[LINK] RX: Resynchronizing to seq num %hu\n", frame->seq_num);
+        for (seq = rx->expected; seq != (uint16_t)(rx->read_seq + LINK_MAX_WINDOW_SIZE);
+                seq++){
+            rx->slots[seq % LINK_MAX_WINDOW_SIZE].received = false;
+        }
+        rx->seq_offset = rx->expected - frame->seq_num;
+        rx->last_resync_seq = frame->seq_num;
+        rx->synced = true;
     }
-    //Wait for condition signal - meaning buffer is full
-    while (!link->rx->ack_buf_filled){
-        status = pthread_cond_timedwait(&(link->rx->ack_buf_filled_cond),
-                                    &(link->rx->ack_buf_status_lock), &timeout_abs);
-        if (status != 0){
-            if (status == ETIMEDOUT){
-                ret = -2;
-            }else{
-                fprintf(stderr, "[LINK] RX: receive_ack(): Condition wait failed: %s\n",
-                    strerror(status));
-                ret = -1;
-            }
+    if (!rx->synced){
+        pthread_mutex_unlock(&(rx->data_buf_status_lock));
+        DEBUG_MSG("[LINK] RX: Not synchronized with transmitter. Dropping.\n");
+        return false;
+    }
+
+    //Store the frame if it isn't a duplicate, and there's room for it
+    seq = frame->seq_num + rx->seq_offset;
+    slot = &(rx->slots[seq % LINK_MAX_WINDOW_SIZE]);
+    if ((uint16_t)(seq - rx->expected) <
+            (uint16_t)(rx->read_seq + LINK_MAX_WINDOW_SIZE - rx->expected) &&
+            !slot->received){
+        memcpy(slot->payload, frame->payload, payload_length);
+        slot->payload_length = payload_length;
+        slot->received = true;
+    }else{
+        DEBUG_MSG("[LINK] RX: Received a duplicate frame, or no room for frame.\n");
+    }
+    //Advance past frames received in order
+    while ((uint16_t)(rx->expected - rx->read_seq) < LINK_MAX_WINDOW_SIZE &&
+            rx->slots[rx->expected % LINK_MAX_WINDOW_SIZE].received){
+        rx->expected++;
+        advanced = true;
+    }
+
+    //Build the ack, in the transmitter's sequence numbers
+    ack->type = ACK_FRAME_CODE;
+    ack->ack_num = rx->expected - rx->seq_offset;
+    ack->sack_bitmap = 0;
+    for (i = 0; i < SACK_BITS; i++){
+        seq = rx->expected + 1 + i;
+        if ((uint16_t)(seq - rx->read_seq) >= LINK_MAX_WINDOW_SIZE){
             break;
         }
+        if (rx->slots[seq % LINK_MAX_WINDOW_SIZE].received){
+            ack->sack_bitmap |= (uint32_t) 1 << i;
+        }
     }
-    //Waiting is done. Unlock mutex.
-    status = pthread_mutex_unlock(&(link->rx->ack_buf_status_lock));
-    if (status != 0){
-        fprintf(stderr, "[LINK] RX: receive_ack(): Mutex unlock failed: %s\n",
-                strerror(status));
-        ret = -1;
-    }
-    //Check the sequence number if nothing failed
-    if (ret == 0 && link->rx->ack_frame_buf.ack_num != ack_num){
-        fprintf(stderr, "[LINK] RX: receive_ack(): Incorrect ack number %hu "
-                    "(expected %hu)\n", link->rx->ack_frame_buf.ack_num, ack_num);
-        ret = -3;
+
+    //Signal that the next frame is ready to read
+    if (advanced){
+        pthread_cond_signal(&(rx->data_buf_filled_cond));
     }
-    //mark the rx ack buffer empty
-    link->rx->ack_buf_filled = false;
+    pthread_mutex_unlock(&(rx->data_buf_status_lock));
+    return true;
+}
 
-    return ret;
+/**
+ * Marks the frames acknowledged by an ack frame, advances the transmit window, and
+ * updates the retransmission timeout.
+ *
+ * @param[in]   link        pointer to link handle
+ * @param[in]   ack         ack frame which passed the CRC check
+ */
+static void receive_ack(struct link_handle *link, struct ack_frame *ack)
+{
+    struct tx *tx = link->tx;
+    struct tx_slot *slot;
+    struct timespec now;
+    uint16_t seq, dist;
+    int64_t rtt_us = -1;
+    bool acked, progress = false;
+
+    create_timeout_abs(0, &now);
+
+    pthread_mutex_lock(&(tx->data_buf_status_lock));
+    //Ignore acks which don't match the frames in flight (e.g. delayed acks for
+    //frames which were dropped from the window)
+    if ((uint16_t)(ack->ack_num - tx->base) > (uint16_t)(tx->next - tx->base)){
+        pthread_mutex_unlock(&(tx->data_buf_status_lock));
+        DEBUG_MSG("[LINK] TX: Received stale ACK number %hu\n", ack->ack_num);
+        return;
+    }
+    for (seq = tx->base; seq != tx->next; seq++){
+        slot = &(tx->slots[seq % LINK_MAX_WINDOW_SIZE]);
+        if ((uint16_t)(seq - tx->base) < (uint16_t)(ack->ack_num - tx->base)){
+            //Cumulatively acknowledged
+            acked = true;
+        }else{
+            //Selectively acknowledged?
+            dist = seq - ack->ack_num;
+            acked = dist >= 1 && dist <= SACK_BITS &&
+                    ((ack->sack_bitmap >> (dist - 1)) & 1);
+        }
+        if (acked && !slot->acked){
+            slot->acked = true;
+            progress = true;
+            //Karn's algorithm: only measure the round trip time of frames which
+            //weren't retransmitted
+            if (slot->tries == 1){
+                rtt_us = timespec_diff_us(&now, &(slot->sent_time));
+            }
+            if (tx->resync_pending && seq == tx->resync_seq){
+                tx->resync_pending = false;
+            }
+        }
+    }
+    if (rtt_us >= 0){
+        update_rto(link, rtt_us);
+    }
+    //Advance the window past acknowledged frames
+    while (tx->base != tx->next && tx->slots[tx->base % LINK_MAX_WINDOW_SIZE].acked){
+        tx->base++;
+    }
+    if (progress){
+        DEBUG_MSG("[LINK] TX: Got an ACK (base = %hu)\n", tx->base);
+        pthread_cond_broadcast(&(tx->window_cond));
+        pthread_cond_signal(&(tx->data_buf_filled_cond));
+    }
+    pthread_mutex_unlock(&(tx->data_buf_status_lock));
 }
 
 /**
  * Thread function which receives data and ACK frames from the PHY, and transmits ACKs.
- * Checks CRC on all received frames before copying them to a buffer which other
- * functions can use. If the CRC is incorrect, it disregards the frame and does not
- * copy it. If a data frame is received, it checks sequence number for duplicate.
- * If not a duplicate, it copies the frame to rx data_frame_buf and marks the buffer
- * full. An acknowledgement is always sent, regardless of whether or not the received
- * data frame is a duplicate. This is the only function that sends acks.
+ * Checks CRC on all received frames before processing them. If the CRC is incorrect,
+ * it disregards the frame. Data frames are placed in the reorder buffer (unless they
+ * are duplicates), and an acknowledgement of every frame received so far is sent in
+ * response. ACK frames are passed to the transmitter with receive_ack(). This is the
+ * only function that sends acks.
  *
  * @param[in]   arg     pointer to link handle
  */
@@ -1032,10 +1291,8 @@ void *receive_frames(void *arg)
     uint32_t crc_32, crc_32_rx;
     bool is_data_frame = false;
     int status;
-    uint8_t ack_send_buf[ACK_FRAME_LENGTH];
-    uint16_t seq_num = 0;
-    bool first_frame = true;
-    bool duplicate;
+    uint8_t *ack_send_buf;
+    struct ack_frame ack_frame;
 
     //cast arg
     struct link_handle *link = (struct link_handle *) arg;
@@ -1088,100 +1345,45 @@ void *receive_frames(void *arg)
                 }
                 break;
             case COPY:
-                //--CRC passed. Now copy the frame to link layer buffer
-                //--if it is not a duplicate frame
+                //--CRC passed. Now process the frame
                 DEBUG_MSG("[LINK] RX: State = COPY\n");
                 if (is_data_frame){
-                    //Is the previous data frame still being worked with?
-                    if (link->rx->data_buf_filled){
-                        //Instead of causing a disruption, drop the current frame
-                        fprintf(stderr, "[LINK] RX: Data frame dropped!\n");
-                        phy_release_rx_buf(link->phy);
-                        break;
-                    }
                     //Copy/convert to data frame struct
                     convert_buf_to_data_frame_struct(rx_buf,
                                                 &(link->rx->data_frame_buf));
                     //Release buffer from the phy
                     phy_release_rx_buf(link->phy);
-                    //Is this frame a duplicate of the last frame?
-                    if (link->rx->data_frame_buf.seq_num == seq_num && !first_frame){
-                        DEBUG_MSG("[LINK] RX: Received a duplicate frame.\n");
-                        duplicate = true;
+                    //Place the frame in the reorder buffer, and build the ack
+                    if (receive_data_frame(link, &(link->rx->data_frame_buf),
+                                            &(link->tx->ack_frame_buf))){
+                        //Transition to send acknowledgement
+                        state = SEND_ACK;
                     }else{
-                        duplicate = false;
-                    }
-                    seq_num = link->rx->data_frame_buf.seq_num;
-                    first_frame = false;
-                    //Mark buffer filled if not a duplicate data frame
-                    if (!duplicate){
-                        //Signal that the link data buffer is filled
-                        link->rx->data_buf_filled = true;
-                        status = pthread_mutex_lock(&(link->rx->data_buf_status_lock));
-                        if (status != 0){
-                            fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                            "Error locking pthread_mutex\n");
-                            return NULL;
-                        }
-                        status = pthread_cond_signal(&(link->rx->data_buf_filled_cond));
-                        if (status != 0){
-                            fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                            "Error signaling pthread_cond\n");
-                            return NULL;
-                        }
-                        status = pthread_mutex_unlock(&(link->rx->data_buf_status_lock));
-                        if (status != 0){
-                            fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                            "Error unlocking pthread_mutex\n");
-                            return NULL;
-                        }
+                        state = WAIT;
                     }
-                    //Transition to send acknowledgement
-                    state = SEND_ACK;
                 }else{
-                    //Is the previous ack frame still being worked with?
-                    if (link->rx->ack_buf_filled){
-                        //Instead of causing a disruption, drop the current frame
-                        fprintf(stderr, "[LINK] RX: ACK frame dropped!\n");
-                        phy_release_rx_buf(link->phy);
-                        break;
-                    }
-                    //Copy/convert to ack frame struct and mark ack buffer filled
-                    convert_buf_to_ack_frame_struct(rx_buf, &(link->rx->ack_frame_buf));
+                    //Copy/convert to ack frame struct
+                    convert_buf_to_ack_frame_struct(rx_buf, &ack_frame);
                     //Release buffer from the phy
                     phy_release_rx_buf(link->phy);
-                    //Signal that the link ack buffer is filled
-                    link->rx->ack_buf_filled = true;
-                    status = pthread_mutex_lock(&(link->rx->ack_buf_status_lock));
-                    if (status != 0){
-                        fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                        "Error locking pthread_mutex\n");
-                        return NULL;
-                    }
-                    status = pthread_cond_signal(&(link->rx->ack_buf_filled_cond));
-                    if (status != 0){
-                        fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                        "Error signaling pthread_cond\n");
-                        return NULL;
-                    }
-                    status = pthread_mutex_unlock(&(link->rx->ack_buf_status_lock));
-                    if (status != 0){
-                        fprintf(stderr, "[LINK] RX: receive_frames(): "
-                                        "Error unlocking pthread_mutex\n");
-                        return NULL;
-                    }
+                    //Pass the ack to the transmitter
+                    receive_ack(link, &ack_frame);
                     //Done with the frame. Go back to WAIT state
                     state = WAIT;
                 }
                 break;
             case SEND_ACK:
                 //--We received a data frame, now it's time to send the ack
-                DEBUG_MSG("[LINK] RX: State = SEND_ACK (ack# = %hu)\n", seq_num);
-
-                link->tx->ack_frame_buf.type = 0xFF;
-                link->tx->ack_frame_buf.ack_num = seq_num;
-
-                //Copy frame into send buf
+                DEBUG_MSG("[LINK] RX: State = SEND_ACK (ack# = %hu, sack = 0x%08x)\n",
+                            link->tx->ack_frame_buf.ack_num,
+                            link->tx->ack_frame_buf.sack_bitmap);
+
+                //Build the frame directly in a phy tx buffer
+                ack_send_buf = phy_request_tx_buf(link->phy, true);
+                if (ack_send_buf == NULL){
+                    fprintf(stderr, "[LINK] Couldn't get a phy tx buffer\n");
+                    goto out;
+                }
                 convert_ack_frame_struct_to_buf(&(link->tx->ack_frame_buf),
                                                 ack_send_buf);
                 //Calculate the CRC
@@ -1190,7 +1392,7 @@ void *receive_frames(void *arg)
                 memcpy(&ack_send_buf[ACK_FRAME_LENGTH - sizeof(crc_32)], &crc_32,
                         sizeof(crc_32));
                 //Transmit with phy
-                status = phy_fill_tx_buf(link->phy, ack_send_buf, ACK_FRAME_LENGTH);
+                status = phy_commit_tx_buf(link->phy, true, ACK_FRAME_LENGTH);
                 if (status != 0){
                     fprintf(stderr, "[LINK] Couldn't fill phy tx buffer\n");
                     goto out;
@@ -4,10 +4,12 @@
  *
  * This file handles framing, error detection, and guaranteed delivery of frames.
  * On the sender side, this file formats payload data into packets to transmit
- * using phy.c, and waits for acknowledgements. A retransmission is automatically
- * sent if no acknowledgement is received within the timeout period. On the receiver
- * side, this file extracts payload data from a packet received using phy.c, and sends
- * acknowledgements.
+ * using phy.c, and waits for acknowledgements. Up to a window of frames may be
+ * awaiting acknowledgement at once (selective repeat). A frame is automatically
+ * retransmitted if it is not acknowledged within the retransmission timeout, which
+ * adapts to the measured round trip time. On the receiver side, this file extracts
+ * payload data from packets received using phy.c, reorders them, and sends
+ * cumulative/selective acknowledgements.
  *
  * This file is part of the bladeRF project
  *
@@ -43,16 +45,25 @@
 
 #define PAYLOAD_LENGTH 1000     //If you change this, DATA_FRAME_LENGTH
                                 //ACK_FRAME_LENGTH must also be changed in phy.h
-#define ACK_TIMEOUT_MS 500      //Timeout to wait for an acknowledgement
+#define ACK_TIMEOUT_MS 500      //Initial timeout to wait for an acknowledgement,
+                                //before any round trip time has been measured
+#define LINK_MIN_RTO_MS 20      //Bounds of the adaptive retransmission timeout
+#define LINK_MAX_RTO_MS 4000
 #define LINK_MAX_TRIES 3        //Maximum number of frame retransmissions before the
                                 //transmitter gives up
+#define LINK_WINDOW_SIZE 8      //Default number of unacknowledged frames in flight
+#define LINK_MAX_WINDOW_SIZE 32 //Maximum window size. Must be a power of two no
+                                //larger than the number of bits in the ack bitmap.
 
 /** Opaque handle to link data structure */
 struct link_handle;
 
+struct phy_loopback_params;
+
 /**
- * Send data of arbitrary length. Breaks data up into packets (if needed) and sends each
- * packet one-by-one.
+ * Send data of arbitrary length. Breaks data up into packets (if needed) and sends
+ * them, keeping up to the window size of packets in flight. Blocks until every packet
+ * has been acknowledged, or one of them has gone unacknowledged LINK_MAX_TRIES times.
  *
  * @param[in]   link            pointer to link handle
  * @param[in]   data            Data to send
@@ -89,6 +100,32 @@ int link_receive_data(struct link_handle *link, int size, int max_timeouts,
  */
 struct link_handle *link_init(struct bladerf *dev, struct radio_params *params);
 
+/**
+ * Initializes a pair of link handles connected to each other through a simulated
+ * channel (see phy_init_loopback_pair()), rather than through bladeRF devices.
+ * The handles may be closed in either order.
+ *
+ * @param[in]   params      loopback channel parameters
+ * @param[out]  link1       first link handle
+ * @param[out]  link2       second link handle
+ *
+ * @return      0 on success, -1 on error
+ */
+int link_init_loopback_pair(const struct phy_loopback_params *params,
+                            struct link_handle **link1, struct link_handle **link2);
+
+/**
+ * Set the number of frames which may be awaiting acknowledgement at once. A window
+ * size of 1 gives stop-and-wait operation. Takes effect for subsequently queued
+ * frames.
+ *
+ * @param[in]   link        pointer to link handle
+ * @param[in]   size        window size, 1 - LINK_MAX_WINDOW_SIZE
+ *
+ * @return      0 on success, -1 on invalid size
+ */
+int link_set_window_size(struct link_handle *link, unsigned int size);
+
 /**
  * Deinitializes/closes/frees a link_handle struct. Does nothing if link is NULL
  *
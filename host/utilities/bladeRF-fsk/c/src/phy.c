@@ -6,8 +6,8 @@
  * samples using the bladeRF device. A different modulator could be used by swapping
  * fsk.c with a file that implements a different modulator. On the receive side the file
  * uses fir_filter.c to low-pass filter the received signal, pnorm.c to power normalize
- * the input signal, and correlator.c to correlate the received signal with a preamble.
- * waveform.
+ * the input signal, and rx_demod.c to correlate the received signal with a preamble
+ * waveform and demodulate the frame that follows.
  *
  * The structure of a physical layer transmission is as follows:
  * / ramp up | training sequence | preamble | link layer frame | ramp down \
@@ -32,13 +32,20 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#ifdef __linux__
+/* Required for pthread_setaffinity_np() */
+#   define _GNU_SOURCE
+#endif
+
 #include "phy.h"
 #include "fir_filter.h"
 #include "rx_ch_filter.h"
+#include "rx_frontend.h"
 #include "pnorm.h"
 #include "prng.h"
-#include "correlator.h"
+#include "rx_demod.h"        //frame acquisition + demodulation
 #include "fsk.h"            //modulator/demodulator
+#include "frame_ring.h"     //PHY<->link frame handoff
 #include "radio_config.h"    //bladeRF configuration
 
 #ifdef DEBUG_MODE
@@ -57,47 +64,87 @@
 #endif
 
 //Internal structs
+//A block of samples captured from the device
+struct rx_capture_block {
+    uint64_t timestamp;                     //timestamp of the first sample
+    int16_t samples[2*NUM_SAMPLES_RX];      //raw SC16 Q11 samples
+};
+//A block of filtered, power normalized samples
+struct rx_filter_block {
+    uint64_t timestamp;                     //timestamp of the first sample
+    struct complex_sample samples[NUM_SAMPLES_RX];
+};
+enum rx_stage {RX_STAGE_CAPTURE, RX_STAGE_FILTER, RX_STAGE_DEMOD, RX_NUM_STAGES};
 struct rx {
-    int16_t *in_samples;        //Raw input samples from device
     struct fir_filter *ch_filt;             //Channel filter
     struct pnorm_state_t *pnorm;            //Power normalizer
-    struct correlator *corr;                //Correlator
-    struct complex_sample *filt_samples;    //Filtered input samples
-    struct complex_sample *pnorm_samples;    //power normalized samples
-    uint8_t *data_buf;            //received data output buffer (no training seq/preamble)
-    bool buf_filled;            //is the rx data buffer filled
+    struct rx_demod *demod;                 //Preamble correlator + demodulator
+    enum rx_frontend frontend;              //Filter + pnorm implementation
+    struct complex_sample *filt_samples;    //Filtered input samples (split front end)
+    struct frame_ring *ring;    //received frames (no training seq/preamble)
     bool stop;                    //control variable to stop the receiver
-    pthread_t thread;            //pthread for the receiver
-    pthread_cond_t buf_filled_cond;        //condition variable for buf_filled
-    pthread_mutex_t buf_status_lock;    //mutex variable for accessing buf_filled
+    pthread_t threads[RX_NUM_STAGES];    //pthreads for each receiver pipeline stage
+    int cpus[RX_NUM_STAGES];            //CPU to pin each stage to, or -1
+    pthread_cond_t buf_filled_cond;        //signaled when a frame is added to the ring
+    pthread_mutex_t buf_status_lock;    //mutex variable for buf_filled_cond
+    //Pipeline queues. Not used by loopback handles.
+    bool pipeline_init;                    //have the below been initialized
+    struct frame_ring *capture_ring;    //captured blocks (struct rx_capture_block)
+    struct rx_capture_block *capture_scratch;    //captured into when capture_ring
+                                                //is full, to be dropped
+    bool realtime;                        //drop blocks when capture_ring is full,
+                                        //rather than waiting for a free slot
+    pthread_cond_t capture_filled_cond;    //signaled when a block is added to capture_ring
+    pthread_cond_t capture_free_cond;    //signaled when a block is removed from capture_ring
+    pthread_mutex_t capture_lock;        //mutex variable for the above conditions
+    struct frame_ring *filter_ring;        //filtered blocks (struct rx_filter_block)
+    pthread_cond_t filter_filled_cond;    //signaled when a block is added to filter_ring
+    pthread_cond_t filter_free_cond;    //signaled when a block is removed from filter_ring
+    pthread_mutex_t filter_lock;        //mutex variable for the above conditions
 };
 struct tx {
-    uint8_t *data_buf;            //input data to transmit (including training seq/preamble)
-    unsigned int data_length;    //length of data to transmit (not including preamble)
-    bool buf_filled;
+    struct frame_ring *data_ring;    //data frames to transmit (not including preamble)
+    struct frame_ring *ack_ring;    //ack frames to transmit. Sent before data frames.
     bool stop;
     pthread_t thread;
-    pthread_cond_t buf_filled_cond;
-    pthread_mutex_t buf_status_lock;
+    pthread_cond_t buf_filled_cond;    //signaled when a frame is added to either ring
+    pthread_cond_t buf_free_cond;    //signaled when a frame is removed from either ring
+    pthread_mutex_t buf_status_lock;    //mutex variable for the above conditions
     unsigned int max_num_samples;        //Maximum number of tx samples to transmit
-    struct complex_sample *samples;        //output samples to transmit
+    struct complex_sample *samples;        //output samples to transmit. Passed directly
+                                        //to libbladeRF, as this matches SC16 Q11.
+};
+
+//Arguments of phy_run_stage(): a PHY thread function, and the stage it implements
+struct phy_stage_thread {
+    struct phy_handle *phy;
+    enum phy_stage stage;
+    void *(*func)(void *);
 };
 
 struct phy_handle {
-    struct bladerf *dev;        //bladeRF device handle
+    struct phy_io *io;            //sample I/O (bladeRF, file, or loopback)
     struct fsk_handle *fsk;        //fsk handle
     struct tx *tx;                //tx data structure
     struct rx *rx;                //rx data structure
-    uint8_t *scrambling_sequence;
+    struct prng_scrambler *scrambler;    //cached scrambling sequence
+    struct loopback_channel *loopback;    //simulated channel, if not using a bladeRF
+    struct phy_stats stats;                //counters, written by the PHY's threads
+    struct phy_stage_thread stage_threads[PHY_NUM_STAGES];
 };
 
 //Internal functions
+static void *phy_run_stage(void *arg);
+static void *phy_capture_samples(void *arg);
+static void *phy_filter_samples(void *arg);
 void *phy_receive_frames(void *arg);
 void *phy_transmit_frames(void *arg);
-static void scramble_frame(uint8_t *frame, int frame_length, uint8_t *scrambling_sequence);
-static void unscramble_frame(uint8_t *frame, int frame_length, uint8_t *scrambling_sequence);
+static void scramble_frame(uint8_t *frame, int frame_length,
+                           const struct prng_scrambler *scrambler);
 static void create_ramps(unsigned int ramp_length, struct complex_sample ramp_down_init,
                     struct complex_sample *ramp_up, struct complex_sample *ramp_down);
+static void loopback_notify(struct loopback_channel *chan);
+static void loopback_detach(struct phy_handle *phy);
 
 /****************************************
  *                                      *
@@ -105,30 +152,177 @@ static void create_ramps(unsigned int ramp_length, struct complex_sample ramp_do
  *                                      *
  ****************************************/
 
+/**
+ * Allocate the tx struct, along with the frame rings and synchronization variables
+ * used to pass frames from the link layer to the transmitter
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int init_tx_frames(struct phy_handle *phy)
+{
+    int status;
+
+    phy->tx = calloc(1, sizeof(struct tx));
+    if (phy->tx == NULL){
+        perror("[PHY] malloc");
+        return -1;
+    }
+    //Allocate tx frame rings
+    phy->tx->data_ring = frame_ring_init(PHY_TX_RING_SLOTS, MAX_LINK_FRAME_SIZE);
+    phy->tx->ack_ring = frame_ring_init(PHY_TX_RING_SLOTS, MAX_LINK_FRAME_SIZE);
+    if (phy->tx->data_ring == NULL || phy->tx->ack_ring == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't allocate tx frame rings\n", __FUNCTION__);
+        return -1;
+    }
+    //Initialize control variables
+    phy->tx->stop = false;
+    //Initialize pthread condition variables for the tx rings
+    status = pthread_cond_init(&(phy->tx->buf_filled_cond), NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
+        return -1;
+    }
+    status = pthread_cond_init(&(phy->tx->buf_free_cond), NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
+        return -1;
+    }
+    //Initialize pthread mutex variable for the above condition(s)
+    status = pthread_mutex_init(&(phy->tx->buf_status_lock), NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Allocate the rx struct, along with the frame ring and synchronization variables
+ * used to pass received frames to the link layer
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int init_rx_frames(struct phy_handle *phy)
+{
+    int status;
+
+    phy->rx = calloc(1, sizeof(struct rx));
+    if (phy->rx == NULL){
+        perror("[PHY] malloc");
+        return -1;
+    }
+    //Allocate rx frame ring
+    phy->rx->ring = frame_ring_init(PHY_RX_RING_SLOTS, MAX_LINK_FRAME_SIZE);
+    if (phy->rx->ring == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't allocate rx frame ring\n", __FUNCTION__);
+        return -1;
+    }
+    //Initialize control variables
+    phy->rx->stop = false;
+    //Initialize pthread condition variable for the rx ring
+    status = pthread_cond_init(&(phy->rx->buf_filled_cond), NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
+        return -1;
+    }
+    //Initialize pthread mutex variable for the above condition(s)
+    status = pthread_mutex_init(&(phy->rx->buf_status_lock), NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Allocate the queues and synchronization variables which connect the stages of
+ * the receiver pipeline. The rx struct must already be allocated.
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int init_rx_pipeline(struct phy_handle *phy, struct radio_params *params)
+{
+    int i;
+
+    if (pthread_mutex_init(&(phy->rx->capture_lock), NULL) != 0 ||
+        pthread_cond_init(&(phy->rx->capture_filled_cond), NULL) != 0 ||
+        pthread_cond_init(&(phy->rx->capture_free_cond), NULL) != 0 ||
+        pthread_mutex_init(&(phy->rx->filter_lock), NULL) != 0 ||
+        pthread_cond_init(&(phy->rx->filter_filled_cond), NULL) != 0 ||
+        pthread_cond_init(&(phy->rx->filter_free_cond), NULL) != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread variables\n",
+                __FUNCTION__);
+        return -1;
+    }
+    phy->rx->pipeline_init = true;
+
+    phy->rx->capture_ring = frame_ring_init(PHY_RX_CAPTURE_BLOCKS,
+                                            sizeof(struct rx_capture_block));
+    phy->rx->filter_ring = frame_ring_init(PHY_RX_FILTER_BLOCKS,
+                                           sizeof(struct rx_filter_block));
+    if (phy->rx->capture_ring == NULL || phy->rx->filter_ring == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't allocate rx pipeline queues\n",
+                __FUNCTION__);
+        return -1;
+    }
+    phy->rx->capture_scratch = malloc(sizeof(struct rx_capture_block));
+    if (phy->rx->capture_scratch == NULL){
+        perror("[PHY] malloc");
+        return -1;
+    }
+
+    for (i = 0; i < RX_NUM_STAGES; i++){
+        phy->rx->cpus[i] = params->rx_cpus[i];
+    }
+    phy->rx->realtime = phy_io_is_realtime(phy->io);
+    return 0;
+}
+
 struct phy_handle *phy_init(struct bladerf *dev, struct radio_params *params)
 {
+    if (dev == NULL){
+        fprintf(stderr, "[PHY] %s: BladeRF device uninitialized", __FUNCTION__);
+    }
+    return phy_init_io(phy_io_open_bladerf(dev), params);
+}
+
+struct phy_handle *phy_init_io(struct phy_io *io, struct radio_params *params)
+{
+    void *(*stage_funcs[PHY_NUM_STAGES])(void *) = {
+        phy_transmit_frames, phy_capture_samples, phy_filter_samples, phy_receive_frames
+    };
     int status;
+    int i;
     struct phy_handle *phy;
-    uint64_t prng_seed;
-    uint8_t preamble[PREAMBLE_LENGTH] = PREAMBLE;
+    unsigned int samp_per_symb;
+    const float *ch_filter;
+    size_t ch_filter_len;
+
+    if (io == NULL){
+        return NULL;
+    }
 
     //------------Allocate memory for phy handle struct--------------
     //Calloc so all pointers are initialized to NULL
     phy = calloc(1, sizeof(struct phy_handle));
     if (phy == NULL){
         perror("malloc");
+        phy_io_close(io);
         return NULL;
     }
 
     DEBUG_MSG("[PHY] Initializing...\n");
 
-    if (dev == NULL){
-        fprintf(stderr, "[PHY] %s: BladeRF device uninitialized", __FUNCTION__);
+    phy->io = io;
+    //Each thread function is run by phy_run_stage(), which measures its CPU time
+    for (i = 0; i < PHY_NUM_STAGES; i++){
+        phy->stage_threads[i].phy = phy;
+        phy->stage_threads[i].stage = (enum phy_stage) i;
+        phy->stage_threads[i].func = stage_funcs[i];
     }
-    phy->dev = dev;
 
-    //--------Initialize and configure bladeRF device-------------
-    status = radio_init_and_configure(phy->dev, params);
+    //--------Initialize and configure the radio (if any)-------------
+    status = phy_io_configure(phy->io, params);
     if (status != 0){
         fprintf(stderr, "[PHY] %s: Couldn't configure bladeRF\n", __FUNCTION__);
         goto error;
@@ -136,7 +330,14 @@ struct phy_handle *phy_init(struct bladerf *dev, struct radio_params *params)
     DEBUG_MSG("[PHY] BladeRF initialized and configured successfully\n");
 
     //-------------------Open fsk handle------------------------
-    phy->fsk = fsk_init();
+    samp_per_symb = (params->samp_per_symb == 0) ? SAMP_PER_SYMB : params->samp_per_symb;
+    ch_filter = rx_ch_filter_for_sps(samp_per_symb, &ch_filter_len);
+    if (ch_filter == NULL){
+        fprintf(stderr, "[PHY] %s: Unsupported samples per symbol: %u\n", __FUNCTION__,
+                samp_per_symb);
+        goto error;
+    }
+    phy->fsk = fsk_init_sps(samp_per_symb);
     if(phy->fsk == NULL){
         fprintf(stderr, "[PHY] %s: Couldn't open fsk handle\n", __FUNCTION__);
         goto error;
@@ -144,79 +345,43 @@ struct phy_handle *phy_init(struct bladerf *dev, struct radio_params *params)
     DEBUG_MSG("[PHY] FSK Initialized\n");
 
     //------------------Initialize TX struct--------------------
-    phy->tx = calloc(1, sizeof(struct tx));
-    if (phy->tx == NULL){
-        perror("[PHY] malloc");
-        goto error;
-    }
-    //Allocate memory for tx data buffer
-    phy->tx->data_buf = malloc(TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH +
-                                MAX_LINK_FRAME_SIZE);
-    if (phy->tx->data_buf == NULL){
-        perror("[PHY] malloc");
+    status = init_tx_frames(phy);
+    if (status != 0){
         goto error;
     }
     //Allocate memory for tx samples buffer
     //2*RAMP_LENGTH for the ramp up/ramp down
     phy->tx->max_num_samples = 2*RAMP_LENGTH + (TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH +
-                    MAX_LINK_FRAME_SIZE) * 8 * SAMP_PER_SYMB;
+                    MAX_LINK_FRAME_SIZE) * 8 * samp_per_symb;
     phy->tx->samples = malloc(phy->tx->max_num_samples * sizeof(struct complex_sample));
     if (phy->tx->samples == NULL){
         perror("[PHY] malloc");
         goto error;
     }
-    //Initialize control variables
-    phy->tx->data_length = 0;
-    phy->tx->buf_filled = false;
-    phy->tx->stop = false;
-    //Initialize pthread condition variable for buf_filled
-    status = pthread_cond_init(&(phy->tx->buf_filled_cond), NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
-        goto error;
-    }
-    //Initialize pthread mutex variable for buf_filled
-    status = pthread_mutex_init(&(phy->tx->buf_status_lock), NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
-        goto error;
-    }
 
     //------------------Initialize RX struct------------------
-    phy->rx = calloc(1, sizeof(struct rx));
-    if (phy->rx == NULL){
-        perror("[PHY] malloc");
-        goto error;
-    }
-    //Allocate memory for rx data buffer
-    phy->rx->data_buf = malloc(MAX_LINK_FRAME_SIZE);
-    if (phy->rx->data_buf == NULL){
-        perror("[PHY] malloc");
-        goto error;
-    }
-    //Allocate memory for rx samples buffer
-    phy->rx->in_samples = malloc(NUM_SAMPLES_RX * 2 * sizeof(phy->rx->in_samples[0]));
-    if (phy->rx->in_samples == NULL){
-        perror("[PHY] malloc");
+    status = init_rx_frames(phy);
+    if (status != 0){
         goto error;
     }
-
-    // Allocate memory for filtered RX samples
-    phy->rx->filt_samples = malloc(NUM_SAMPLES_RX * sizeof(struct complex_sample));
-    if (phy->rx->filt_samples == NULL){
-        perror("[PHY] malloc");
+    //Allocate the queues between the receiver pipeline stages
+    status = init_rx_pipeline(phy, params);
+    if (status != 0){
         goto error;
     }
 
-    //Allocate memory for power normalized samples
-    phy->rx->pnorm_samples = malloc(NUM_SAMPLES_RX * sizeof(struct complex_sample));
-    if (phy->rx->pnorm_samples == NULL){
-        perror("[PHY] malloc");
-        goto error;
+    // Allocate memory for filtered RX samples, which only the split front end uses
+    phy->rx->frontend = params->rx_frontend;
+    if (phy->rx->frontend == RX_FRONTEND_SPLIT){
+        phy->rx->filt_samples = malloc(NUM_SAMPLES_RX * sizeof(struct complex_sample));
+        if (phy->rx->filt_samples == NULL){
+            perror("[PHY] malloc");
+            goto error;
+        }
     }
 
     // Create RX Channel Filter
-    phy->rx->ch_filt = fir_init(rx_ch_filter, rx_ch_filter_len);
+    phy->rx->ch_filt = fir_init(ch_filter, ch_filter_len);
     if (phy->rx->ch_filt == NULL) {
         fprintf(stderr, "[PHY] %s: Failed to create channel filter.\n", __FUNCTION__);
         goto error;
@@ -230,34 +395,17 @@ struct phy_handle *phy_init(struct bladerf *dev, struct radio_params *params)
         goto error;
     }
 
-    //Create RX correlator
-    phy->rx->corr = corr_init(preamble, 8*PREAMBLE_LENGTH, SAMP_PER_SYMB);
-    if (phy->rx->corr == NULL){
-        fprintf(stderr, "[PHY] %s: Couldn't initialize correlator\n", __FUNCTION__);
-        goto error;
-    }
-
-    //Initialize control variables
-    phy->rx->buf_filled = false;
-    phy->rx->stop = false;
-    //Initialize pthread condition variable for buf_filled
-    status = pthread_cond_init(&(phy->rx->buf_filled_cond), NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
-        goto error;
-    }
-    //Initialize pthread mutex variable for buf_filled
-    status = pthread_mutex_init(&(phy->rx->buf_status_lock), NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
+    //-----------------Load scrambling sequence--------------------
+    phy->scrambler = prng_scrambler_init(PRNG_SEED, MAX_LINK_FRAME_SIZE);
+    if (phy->scrambler == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't load scrambling sequence\n", __FUNCTION__);
         goto error;
     }
 
-    //-----------------Load scrambling sequence--------------------
-    prng_seed = PRNG_SEED;
-    phy->scrambling_sequence = prng_fill(&prng_seed, MAX_LINK_FRAME_SIZE);
-    if (phy->scrambling_sequence == NULL){
-        fprintf(stderr, "[PHY] %s: Couldn't load scrambling sequence\n", __FUNCTION__);
+    //Create RX correlator + demodulator
+    phy->rx->demod = rx_demod_init(phy->fsk, phy->scrambler, phy->rx->ring);
+    if (phy->rx->demod == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't initialize demodulator\n", __FUNCTION__);
         goto error;
     }
 
@@ -286,15 +434,18 @@ void phy_close(struct phy_handle *phy)
 
     DEBUG_MSG("[PHY] Closing\n");
     if (phy != NULL){
+        //Disconnect from the loopback channel, if there is one
+        loopback_detach(phy);
         //close fsk handle
         fsk_close(phy->fsk);
-        //Stop bladeRF (handle closed elsewhere)
-        radio_stop(phy->dev);
+        //Stop bladeRF (handle closed elsewhere), or close files
+        phy_io_close(phy->io);
         //free scrambling sequence buffer
-        free(phy->scrambling_sequence);
+        prng_scrambler_deinit(phy->scrambler);
         //free TX struct and its buffers
         if (phy->tx != NULL){
-            free(phy->tx->data_buf);
+            frame_ring_deinit(phy->tx->data_ring);
+            frame_ring_deinit(phy->tx->ack_ring);
             free(phy->tx->samples);
             status = pthread_mutex_destroy(&(phy->tx->buf_status_lock));
             if (status != 0){
@@ -306,17 +457,31 @@ void phy_close(struct phy_handle *phy)
                 fprintf(stderr, "[PHY] %s: Error destroying pthread_cond\n",
                         __FUNCTION__);
             }
+            status = pthread_cond_destroy(&(phy->tx->buf_free_cond));
+            if (status != 0){
+                fprintf(stderr, "[PHY] %s: Error destroying pthread_cond\n",
+                        __FUNCTION__);
+            }
         }
         free(phy->tx);
         //free RX struct and its buffers
         if (phy->rx != NULL){
-            free(phy->rx->data_buf);
+            frame_ring_deinit(phy->rx->ring);
             fir_deinit(phy->rx->ch_filt);
-            corr_deinit(phy->rx->corr);
+            rx_demod_deinit(phy->rx->demod);
             pnorm_deinit(phy->rx->pnorm);
-            free(phy->rx->in_samples);
             free(phy->rx->filt_samples);
-            free(phy->rx->pnorm_samples);
+            if (phy->rx->pipeline_init){
+                frame_ring_deinit(phy->rx->capture_ring);
+                frame_ring_deinit(phy->rx->filter_ring);
+                free(phy->rx->capture_scratch);
+                pthread_mutex_destroy(&(phy->rx->capture_lock));
+                pthread_cond_destroy(&(phy->rx->capture_filled_cond));
+                pthread_cond_destroy(&(phy->rx->capture_free_cond));
+                pthread_mutex_destroy(&(phy->rx->filter_lock));
+                pthread_cond_destroy(&(phy->rx->filter_filled_cond));
+                pthread_cond_destroy(&(phy->rx->filter_free_cond));
+            }
             status = pthread_mutex_destroy(&(phy->rx->buf_status_lock));
             if (status != 0){
                 fprintf(stderr, "[PHY] %s: Error destroying pthread_mutex\n",
@@ -335,6 +500,54 @@ void phy_close(struct phy_handle *phy)
     phy = NULL;
 }
 
+/****************************************
+ *                                      *
+ *          STATISTICS FUNCTIONS        *
+ *                                      *
+ ****************************************/
+
+/**
+ * Get the CPU time used by the calling thread
+ *
+ * @return      0 on success, -1 if this is not supported
+ */
+static int thread_cpu_time(struct timespec *ts)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    return clock_gettime(CLOCK_THREAD_CPUTIME_ID, ts);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Thread function which runs one of the PHY's thread functions, and adds the CPU
+ * time it used to the PHY's statistics
+ *
+ * @param[in]   arg     pointer to phy_stage_thread struct
+ */
+static void *phy_run_stage(void *arg)
+{
+    struct phy_stage_thread *t = (struct phy_stage_thread *) arg;
+    struct timespec start, end;
+    bool timed;
+
+    timed = (thread_cpu_time(&start) == 0);
+    t->func(t->phy);
+    if (timed && thread_cpu_time(&end) == 0){
+        t->phy->stats.cpu_time_us[t->stage] += timespec_diff_us(&end, &start);
+    }
+    return NULL;
+}
+
+void phy_get_stats(struct phy_handle *phy, struct phy_stats *stats)
+{
+    struct timespec ts;
+
+    *stats = phy->stats;
+    stats->cpu_time_valid = (thread_cpu_time(&ts) == 0);
+}
+
 /****************************************
  *                                      *
  *          TRANSMITTER FUNCTIONS       *
@@ -347,8 +560,13 @@ int phy_start_transmitter(struct phy_handle *phy)
 
     //turn off stop signal
     phy->tx->stop = false;
+    //The loopback channel's thread acts as the transmitter
+    if (phy->loopback != NULL){
+        return 0;
+    }
     //Kick off frame transmitter thread
-    status = pthread_create(&(phy->tx->thread), NULL, phy_transmit_frames, phy);
+    status = pthread_create(&(phy->tx->thread), NULL, phy_run_stage,
+                            &(phy->stage_threads[PHY_STAGE_TX]));
     if (status != 0){
         fprintf(stderr, "[PHY] %s: Error creating tx thread: %s\n", __FUNCTION__,
                 strerror(status));
@@ -364,8 +582,8 @@ int phy_stop_transmitter(struct phy_handle *phy)
     DEBUG_MSG("[PHY] TX: Stopping transmitter...\n");
     //signal stop
     phy->tx->stop = true;
-    //Signal the buffer filled condition so that the thread will stop
-    //waiting for a filled buffer
+    //Signal the buffer conditions so that the thread will stop waiting for a
+    //filled buffer, and so that producers stop waiting for a free buffer
     status = pthread_mutex_lock(&(phy->tx->buf_status_lock));
     if (status != 0){
         fprintf(stderr, "[PHY] %s: Error locking pthread_mutex\n", __FUNCTION__);
@@ -374,30 +592,64 @@ int phy_stop_transmitter(struct phy_handle *phy)
     if (status != 0){
         fprintf(stderr, "[PHY] %s: Error signaling pthread_cond\n", __FUNCTION__);
     }
+    status = pthread_cond_broadcast(&(phy->tx->buf_free_cond));
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error signaling pthread_cond\n", __FUNCTION__);
+    }
     status = pthread_mutex_unlock(&(phy->tx->buf_status_lock));
     if (status != 0){
         fprintf(stderr, "[PHY] %s: Error unlocking pthread_mutex\n", __FUNCTION__);
     }
     //Wait for tx thread to finish
-    status = pthread_join(phy->tx->thread, NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error joining tx thread: %s\n", __FUNCTION__,
-                strerror(status));
-        return -1;
+    if (phy->loopback == NULL){
+        status = pthread_join(phy->tx->thread, NULL);
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Error joining tx thread: %s\n", __FUNCTION__,
+                    strerror(status));
+            return -1;
+        }
     }
     DEBUG_MSG("[PHY] TX: Transmitter stopped\n");
     return 0;
 }
 
-int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int length)
+uint8_t *phy_request_tx_buf(struct phy_handle *phy, bool ack)
 {
     int status;
+    uint8_t *buf;
+    struct frame_ring *ring = ack ? phy->tx->ack_ring : phy->tx->data_ring;
 
-    //Check for null
-    if (data_buf == NULL){
-        fprintf(stderr, "[PHY] %s: The supplied data buf is null\n", __FUNCTION__);
-        return -1;
+    status = pthread_mutex_lock(&(phy->tx->buf_status_lock));
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error locking pthread_mutex\n", __FUNCTION__);
+        return NULL;
     }
+    //Wait for a free buffer (and therefore room for the next frame)
+    while ((buf = frame_ring_write_slot(ring)) == NULL && !phy->tx->stop){
+        status = pthread_cond_wait(&(phy->tx->buf_free_cond),
+                                   &(phy->tx->buf_status_lock));
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Condition wait failed: %s\n", __FUNCTION__,
+                    strerror(status));
+            break;
+        }
+    }
+    status = pthread_mutex_unlock(&(phy->tx->buf_status_lock));
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error unlocking pthread_mutex\n", __FUNCTION__);
+        return NULL;
+    }
+
+    if (phy->tx->stop){
+        return NULL;
+    }
+    return buf;
+}
+
+int phy_commit_tx_buf(struct phy_handle *phy, bool ack, unsigned int length)
+{
+    int status;
+
     //Check for length outside of bounds
     if (length > MAX_LINK_FRAME_SIZE){
         fprintf(stderr, "[PHY] %s: Data length of %u is greater than the maximum "
@@ -405,18 +657,9 @@ int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int leng
                         MAX_LINK_FRAME_SIZE);
         return -1;
     }
-    //Wait for the buffer to be empty (and therefore ready for the next frame)
-    //Not doing a pthread_cond_wait() because this shouldn't take long
-    while(phy->tx->buf_filled){
-        usleep(50);
-    }
 
-    //Copy the tx data into the phy's tx data buf, just after where the preamble goes
-    memcpy(&(phy->tx->data_buf[TRAINING_SEQ_LENGTH+PREAMBLE_LENGTH]), data_buf, length);
-    //Set the data length
-    phy->tx->data_length = length;
-    //Mark the buffer filled
-    phy->tx->buf_filled = true;
+    frame_ring_commit(ack ? phy->tx->ack_ring : phy->tx->data_ring, length);
+
     //Signal the buffer filled condition
     status = pthread_mutex_lock(&(phy->tx->buf_status_lock));
     if (status != 0){
@@ -433,9 +676,42 @@ int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int leng
         fprintf(stderr, "[PHY] %s: Error unlocking pthread_mutex\n", __FUNCTION__);
         return -1;
     }
+    if (phy->loopback != NULL){
+        loopback_notify(phy->loopback);
+    }
     return 0;
 }
 
+int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int length)
+{
+    uint8_t *buf;
+    bool ack;
+
+    //Check for null
+    if (data_buf == NULL){
+        fprintf(stderr, "[PHY] %s: The supplied data buf is null\n", __FUNCTION__);
+        return -1;
+    }
+    //Check for length outside of bounds
+    if (length > MAX_LINK_FRAME_SIZE){
+        fprintf(stderr, "[PHY] %s: Data length of %u is greater than the maximum "
+                        "allowed length (%u)\n", __FUNCTION__, length,
+                        MAX_LINK_FRAME_SIZE);
+        return -1;
+    }
+
+    ack = (length > 0 && data_buf[0] == ACK_FRAME_CODE);
+    buf = phy_request_tx_buf(phy, ack);
+    if (buf == NULL){
+        return -1;
+    }
+
+    //Copy the tx data into the phy's tx buffer
+    memcpy(buf, data_buf, length);
+
+    return phy_commit_tx_buf(phy, ack, length);
+}
+
 /**
  * Thread function which transmits data frames
  *
@@ -448,23 +724,17 @@ void *phy_transmit_frames(void *arg)
     struct phy_handle *phy = (struct phy_handle *) arg;
     uint8_t preamble[PREAMBLE_LENGTH] = PREAMBLE;
     uint8_t training_seq[TRAINING_SEQ_LENGTH] = TRAINING_SEQ;
+    uint8_t header[TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH];
     int ramp_down_index;
     int num_mod_samples, num_samples;
     bool failed = false;
-    struct bladerf_metadata metadata;
-    int16_t *out_samples_raw = NULL;
-
-    out_samples_raw = malloc(phy->tx->max_num_samples * 2 * sizeof(int16_t));
-    if (out_samples_raw == NULL){
-        perror("[PHY] malloc");
-        return NULL;
-    }
+    struct frame_ring *ring = NULL;
+    uint8_t *frame = NULL;
+    size_t frame_length = 0;
 
-    //Set field(s) in bladerf metadata struct
-    memset(&metadata, 0, sizeof(metadata));
-    metadata.flags =     BLADERF_META_FLAG_TX_BURST_START |
-                        BLADERF_META_FLAG_TX_NOW |
-                        BLADERF_META_FLAG_TX_BURST_END;
+    //Every frame begins with the training sequence, followed by the preamble
+    memcpy(header, training_seq, TRAINING_SEQ_LENGTH);
+    memcpy(&header[TRAINING_SEQ_LENGTH], preamble, PREAMBLE_LENGTH);
 
     while (!phy->tx->stop){
         //--------Wait for buffer to be filled---------
@@ -475,8 +745,17 @@ void *phy_transmit_frames(void *arg)
                     strerror(status));
             return NULL;
         }
-        //Wait for condition signal - meaning buffer is full
-        while (!phy->tx->buf_filled && !phy->tx->stop){
+        //Wait for condition signal - meaning a buffer is full. ACKs go first.
+        while (!phy->tx->stop){
+            ring = phy->tx->ack_ring;
+            frame = frame_ring_read_slot(ring, &frame_length);
+            if (frame == NULL){
+                ring = phy->tx->data_ring;
+                frame = frame_ring_read_slot(ring, &frame_length);
+            }
+            if (frame != NULL){
+                break;
+            }
             DEBUG_MSG("[PHY] TX: Waiting for buffer to be filled\n");
             status = pthread_cond_wait(&(phy->tx->buf_filled_cond), &(phy->tx->buf_status_lock));
             if (status != 0){
@@ -495,50 +774,46 @@ void *phy_transmit_frames(void *arg)
         }
         //Stop thread if stop variable is true, or something with pthreads went wrong
         if (phy->tx->stop || failed){
-            phy->tx->buf_filled = false;
             return NULL;
         }
         //------------Transmit the frame-------------
         DEBUG_MSG("[PHY] TX: Buffer filled. Transmitting.\n");
         //Calculate the number of samples to transmit.
         num_samples = 2*RAMP_LENGTH + (TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH +
-                    phy->tx->data_length) * 8 * SAMP_PER_SYMB;
-        //Add training sequence to tx data buffer
-        memcpy(phy->tx->data_buf, &training_seq, TRAINING_SEQ_LENGTH);
-        //Add preamble to tx data buffer
-        memcpy(&(phy->tx->data_buf[TRAINING_SEQ_LENGTH]), &preamble, PREAMBLE_LENGTH);
+                    (int) frame_length) * 8 * (int) fsk_samp_per_symb(phy->fsk);
         #ifndef BYPASS_PHY_SCRAMBLING
-            //Scramble the frame data (not including the training sequence or preamble)
-            scramble_frame(&(phy->tx->data_buf[TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH]),
-                            phy->tx->data_length, phy->scrambling_sequence);
+            //Scramble the frame data in place (the training sequence and preamble
+            //are not scrambled)
+            scramble_frame(frame, (int) frame_length, phy->scrambler);
         #endif
-        //zero the tx samples buffer
-        memset(phy->tx->samples, 0, sizeof(int16_t) * 2 * num_samples);
-        //modulate samples - leave space for ramp up/ramp down in the samples buffer
-        num_mod_samples = fsk_mod(phy->fsk, phy->tx->data_buf,
-                            TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH + phy->tx->data_length,
+        //modulate the training sequence, preamble, and frame data directly into the
+        //tx samples buffer - leave space for ramp up/ramp down
+        num_mod_samples = fsk_mod_frame(phy->fsk, header, sizeof(header),
+                            frame, (unsigned int) frame_length,
                             &(phy->tx->samples[RAMP_LENGTH]));
-        //Mark the buffer empty
-        phy->tx->buf_filled = false;
+        //Return the buffer to its producer
+        frame_ring_release(ring);
+        status = pthread_mutex_lock(&(phy->tx->buf_status_lock));
+        if (status == 0){
+            pthread_cond_broadcast(&(phy->tx->buf_free_cond));
+            pthread_mutex_unlock(&(phy->tx->buf_status_lock));
+        }
 
         //Add the ramp up/ ramp down of samples
         ramp_down_index = RAMP_LENGTH+num_mod_samples;
         create_ramps(RAMP_LENGTH, phy->tx->samples[ramp_down_index-1], phy->tx->samples,
                         &(phy->tx->samples[ramp_down_index]));
-        //Convert samples
-        conv_struct_to_samples(phy->tx->samples, num_samples, out_samples_raw);
 
-        //transmit all samples. TX_NOW
-        status = bladerf_sync_tx(phy->dev, out_samples_raw, num_samples,
-                                &metadata, 5000);
+        //transmit all samples now, retrying while a non-realtime channel is full
+        do {
+            status = phy_io_tx(phy->io, (int16_t *) phy->tx->samples, num_samples);
+        } while (status == PHY_IO_TIMEOUT && !phy->tx->stop);
         if (status != 0){
-            fprintf(stderr, "[PHY] %s: Couldn't transmit samples with bladeRF: %s\n",
-                    __FUNCTION__, bladerf_strerror(status));
             return NULL;
         }
+        phy->stats.tx_frames++;
     }
 
-    free(out_samples_raw);
     return NULL;
 }
 
@@ -593,17 +868,14 @@ static void create_ramps(unsigned int ramp_length, struct complex_sample ramp_do
 }
 
 /**
- * Scrambles the given data with the given scrambling sequence. The size of the
- * scrambling sequence array must be at least as large as the frame.
+ * Scrambles the given data with the given scrambler's sequence. The frame must
+ * not be longer than the scrambler's maximum length.
  */
 static void scramble_frame(uint8_t *frame, int frame_length,
-                            uint8_t *scrambling_sequence)
+                            const struct prng_scrambler *scrambler)
 {
-    int i;
-    for (i = 0; i < frame_length; i++){
-        //XOR byte with byte from scrambling sequence
-        frame[i] ^= scrambling_sequence[i];
-    }
+    //XOR frame with scrambling sequence, a word at a time
+    prng_scrambler_apply(scrambler, frame, frame_length);
 }
 
 /****************************************
@@ -612,38 +884,105 @@ static void scramble_frame(uint8_t *frame, int frame_length,
  *                                      *
  ****************************************/
 
+/**
+ * Pin a receiver pipeline thread to a CPU, if requested. Failure to do so is not
+ * fatal.
+ */
+static void pin_rx_thread(struct phy_handle *phy, enum rx_stage stage)
+{
+    int cpu = phy->rx->cpus[stage];
+#if BLADERF_OS_LINUX
+    cpu_set_t cpu_set;
+    int status;
+#endif
+
+    if (cpu < 0){
+        return;
+    }
+#if BLADERF_OS_LINUX
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    status = pthread_setaffinity_np(phy->rx->threads[stage], sizeof(cpu_set), &cpu_set);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Couldn't pin rx stage %d to CPU %d: %s\n",
+                __FUNCTION__, stage, cpu, strerror(status));
+    }
+#else
+    fprintf(stderr, "[PHY] %s: CPU pinning is not supported on this platform\n",
+            __FUNCTION__);
+#endif
+}
+
+/**
+ * Wake every receiver pipeline thread which is waiting on a queue, so that it
+ * sees the stop signal
+ */
+static void wake_rx_pipeline(struct phy_handle *phy)
+{
+    pthread_mutex_lock(&(phy->rx->capture_lock));
+    pthread_cond_broadcast(&(phy->rx->capture_filled_cond));
+    pthread_cond_broadcast(&(phy->rx->capture_free_cond));
+    pthread_mutex_unlock(&(phy->rx->capture_lock));
+    pthread_mutex_lock(&(phy->rx->filter_lock));
+    pthread_cond_broadcast(&(phy->rx->filter_filled_cond));
+    pthread_cond_broadcast(&(phy->rx->filter_free_cond));
+    pthread_mutex_unlock(&(phy->rx->filter_lock));
+}
+
 int phy_start_receiver(struct phy_handle *phy)
 {
     int status;
+    int i;
 
     //turn off stop signal
     phy->rx->stop = false;
-    //Kick off frame receiver thread
-    status = pthread_create(&(phy->rx->thread), NULL, phy_receive_frames, phy);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error creating rx thread: %s\n", __FUNCTION__,
-                strerror(status));
-        return -1;
+    //The loopback channel's thread delivers frames directly to the rx ring
+    if (phy->loopback != NULL){
+        return 0;
+    }
+    //Kick off the pipeline threads, downstream stages first
+    for (i = RX_NUM_STAGES - 1; i >= 0; i--){
+        status = pthread_create(&(phy->rx->threads[i]), NULL, phy_run_stage,
+                                &(phy->stage_threads[PHY_STAGE_CAPTURE + i]));
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Error creating rx thread: %s\n", __FUNCTION__,
+                    strerror(status));
+            //Stop the stages which were started
+            phy->rx->stop = true;
+            wake_rx_pipeline(phy);
+            for (i = i + 1; i < RX_NUM_STAGES; i++){
+                pthread_join(phy->rx->threads[i], NULL);
+            }
+            return -1;
+        }
+        pin_rx_thread(phy, (enum rx_stage) i);
     }
     return 0;
 }
 
 int phy_stop_receiver(struct phy_handle *phy)
 {
-    int status;
+    int status, ret = 0;
+    int i;
 
     DEBUG_MSG("[PHY] RX: Stopping receiver...\n");
     //signal stop
     phy->rx->stop = true;
-    //Wait for rx thread to finish
-    status = pthread_join(phy->rx->thread, NULL);
-    if (status != 0){
-        fprintf(stderr, "[PHY] %s: Error joining rx thread: %s\n", __FUNCTION__,
-                strerror(status));
-        return -1;
+    if (phy->loopback != NULL){
+        return 0;
+    }
+    wake_rx_pipeline(phy);
+    //Wait for the rx threads to finish
+    for (i = 0; i < RX_NUM_STAGES; i++){
+        status = pthread_join(phy->rx->threads[i], NULL);
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Error joining rx thread: %s\n", __FUNCTION__,
+                    strerror(status));
+            ret = -1;
+        }
     }
     DEBUG_MSG("[PHY] RX: Receiver stopped\n");
-    return 0;
+    return ret;
 }
 
 uint8_t *phy_request_rx_buf(struct phy_handle *phy, unsigned int timeout_ms)
@@ -651,6 +990,7 @@ uint8_t *phy_request_rx_buf(struct phy_handle *phy, unsigned int timeout_ms)
     int status;
     struct timespec timeout_abs;
     bool failed = false;
+    uint8_t *buf = NULL;
 
     //Create absolute time format timeout
     status = create_timeout_abs(timeout_ms, &timeout_abs);
@@ -666,8 +1006,8 @@ uint8_t *phy_request_rx_buf(struct phy_handle *phy, unsigned int timeout_ms)
                     strerror(status));
         return NULL;
     }
-    //Wait for condition signal - meaning buffer is full
-    while (!phy->rx->buf_filled){
+    //Wait for condition signal - meaning a buffer is full
+    while ((buf = frame_ring_read_slot(phy->rx->ring, NULL)) == NULL){
         status = pthread_cond_timedwait(&(phy->rx->buf_filled_cond), &(phy->rx->buf_status_lock),
                                         &timeout_abs);
         if (status != 0){
@@ -692,257 +1032,522 @@ uint8_t *phy_request_rx_buf(struct phy_handle *phy, unsigned int timeout_ms)
     if (failed){
         return NULL;
     }
-    return phy->rx->data_buf;
+    return buf;
 }
 
 void phy_release_rx_buf(struct phy_handle *phy)
 {
-    phy->rx->buf_filled = false;
+    frame_ring_release(phy->rx->ring);
 }
 
 /**
- * Thread function which listens for and receives frames. The steps are:
- * 1) Receive samples with libbladeRF
- * 2) Low pass filter the samples
- * 3) Power normalize the samples
- * 4) Correlate the samples with the preamble waveform
- * 5) If a match is found, demodulate the samples into data bytes
- * 6) Unscramble the data
- * 7) Copy the frame to a buffer which can be acquired with phy_request_rx_buf(), or
- *    drop the frame if the buffer is still in use
+ * Thread function for the first stage of the receiver pipeline, which receives
+ * samples directly into the capture queue. This thread does nothing else, so that
+ * the device is always read promptly. If the later stages fall so far behind that
+ * the queue is full, blocks of samples from a real-time source (i.e., a bladeRF)
+ * are dropped here. Otherwise, this thread waits for the queue to drain.
  *
  * @param    arg        pointer to phy_handle struct
  */
-void *phy_receive_frames(void *arg)
+static void *phy_capture_samples(void *arg)
 {
     struct phy_handle *phy = (struct phy_handle *) arg;
+    struct rx_capture_block *block;
+    uint64_t timestamp;
     int status;
-    unsigned int num_bytes_rx;
-    unsigned int data_index;        //Current index of rx_buffer to receive new bytes on
-                                    //doubles as the current received frame length
-    uint64_t samples_index=0;            //Current index of samples buffer to correlate/demod
-                                    //samples from
-    bool preamble_detected;
-    bool new_frame = false;
-    int frame_length = 0;            //link layer frame length
-    uint8_t *rx_buffer = NULL;    //local rx data buffer
-    uint8_t frame_type;
-    struct bladerf_metadata metadata;            //bladerf metadata for sync_rx()
-    unsigned int num_bytes_to_demod = 0;
-    uint64_t timestamp = UINT64_MAX;
 
-    enum states {RECEIVE, PREAMBLE_CORRELATE, DEMOD,
-                    CHECK_FRAME_TYPE, DECODE, COPY};
-    enum states state;                //current state variable
+    while (!phy->rx->stop){
+        block = (struct rx_capture_block *) frame_ring_write_slot(phy->rx->capture_ring);
+        if (block == NULL && !phy->rx->realtime){
+            pthread_mutex_lock(&(phy->rx->capture_lock));
+            while ((block = (struct rx_capture_block *)
+                        frame_ring_write_slot(phy->rx->capture_ring)) == NULL &&
+                    !phy->rx->stop){
+                pthread_cond_wait(&(phy->rx->capture_free_cond), &(phy->rx->capture_lock));
+            }
+            pthread_mutex_unlock(&(phy->rx->capture_lock));
+            if (phy->rx->stop){
+                break;
+            }
+        }
+        if (block == NULL){
+            block = phy->rx->capture_scratch;
+        }
+        status = phy_io_rx(phy->io, block->samples, NUM_SAMPLES_RX, &timestamp);
+        if (status == PHY_IO_TIMEOUT){
+            continue;
+        }else if (status == PHY_IO_EOF){
+            DEBUG_MSG("[PHY] RX: End of input samples\n");
+            break;
+        }else if (status < 0){
+            fprintf(stderr, "[PHY] %s: Couldn't receive samples\n", __FUNCTION__);
+            break;
+        }
+        //Check for an overrun
+        if (status == PHY_IO_OVERRUN){
+            NOTE("[PHY] %s: Got an overrun. Skipping these samples.\n", __FUNCTION__);
+            phy->stats.rx_blocks_dropped++;
+            continue;
+        }
+        if (block == phy->rx->capture_scratch){
+            NOTE("[PHY] %s: RX pipeline is full. Dropping %u samples.\n",
+                        __FUNCTION__, NUM_SAMPLES_RX);
+            phy->stats.rx_blocks_dropped++;
+            continue;
+        }
+        block->timestamp = timestamp;
+        phy->stats.rx_blocks++;
+
+        //Pass the block to the filter stage
+        frame_ring_commit(phy->rx->capture_ring, sizeof(*block));
+        pthread_mutex_lock(&(phy->rx->capture_lock));
+        pthread_cond_signal(&(phy->rx->capture_filled_cond));
+        pthread_mutex_unlock(&(phy->rx->capture_lock));
+    }
+    return NULL;
+}
 
-    /* corr_process() takes a size_t count.
-     * Ensure a cast from uint64_t to size_t is valid. */
-    assert(NUM_SAMPLES_RX < SIZE_MAX);
+/**
+ * Thread function for the second stage of the receiver pipeline, which low pass
+ * filters and power normalizes each captured block, and passes it to the
+ * acquisition/demod stage along with its timestamp.
+ *
+ * @param    arg        pointer to phy_handle struct
+ */
+static void *phy_filter_samples(void *arg)
+{
+    struct phy_handle *phy = (struct phy_handle *) arg;
+    struct rx_capture_block *in;
+    struct rx_filter_block *out;
+
+    while (!phy->rx->stop){
+        //Wait for a captured block
+        pthread_mutex_lock(&(phy->rx->capture_lock));
+        while ((in = (struct rx_capture_block *)
+                    frame_ring_read_slot(phy->rx->capture_ring, NULL)) == NULL &&
+                !phy->rx->stop){
+            pthread_cond_wait(&(phy->rx->capture_filled_cond), &(phy->rx->capture_lock));
+        }
+        pthread_mutex_unlock(&(phy->rx->capture_lock));
+        //Wait for room in the demod stage's queue
+        pthread_mutex_lock(&(phy->rx->filter_lock));
+        while ((out = (struct rx_filter_block *)
+                    frame_ring_write_slot(phy->rx->filter_ring)) == NULL &&
+                !phy->rx->stop){
+            pthread_cond_wait(&(phy->rx->filter_free_cond), &(phy->rx->filter_lock));
+        }
+        pthread_mutex_unlock(&(phy->rx->filter_lock));
+        if (phy->rx->stop){
+            break;
+        }
 
-    //Allocate memory for buffer
-    rx_buffer = malloc(MAX_LINK_FRAME_SIZE);
-    if (rx_buffer == NULL){
-        perror("[PHY] malloc");
-        goto out;
+        #if defined(BYPASS_RX_CHANNEL_FILTER) || defined(BYPASS_RX_PNORM)
+            #ifndef BYPASS_RX_CHANNEL_FILTER
+                // Apply channel filter
+                fir_process(phy->rx->ch_filt, in->samples, out->samples,
+                            NUM_SAMPLES_RX);
+            #else
+                conv_samples_to_struct(in->samples, NUM_SAMPLES_RX, out->samples);
+            #endif
+            #ifndef BYPASS_RX_PNORM
+                //Power normalize, in place
+                pnorm_block(phy->rx->pnorm, NUM_SAMPLES_RX, out->samples,
+                            out->samples, NULL, NULL);
+            #endif
+        #else
+            //Apply channel filter and power normalize
+            rx_frontend_process(phy->rx->frontend, phy->rx->ch_filt, phy->rx->pnorm,
+                                in->samples, NUM_SAMPLES_RX, phy->rx->filt_samples,
+                                out->samples);
+        #endif
+        out->timestamp = in->timestamp;
+
+        //Return the captured block, and pass the filtered one to the demod stage
+        frame_ring_release(phy->rx->capture_ring);
+        pthread_mutex_lock(&(phy->rx->capture_lock));
+        pthread_cond_signal(&(phy->rx->capture_free_cond));
+        pthread_mutex_unlock(&(phy->rx->capture_lock));
+        frame_ring_commit(phy->rx->filter_ring, sizeof(*out));
+        pthread_mutex_lock(&(phy->rx->filter_lock));
+        pthread_cond_signal(&(phy->rx->filter_filled_cond));
+        pthread_mutex_unlock(&(phy->rx->filter_lock));
     }
+    return NULL;
+}
 
-    //Set bladeRF metadata
-    memset(&metadata, 0, sizeof(metadata));
-    metadata.flags = BLADERF_META_FLAG_RX_NOW;
+/**
+ * Thread function for the last stage of the receiver pipeline, which listens for
+ * and receives frames. The steps are:
+ * 1) Get a filtered, power normalized block of samples from phy_filter_samples()
+ * 2) Correlate the samples with the preamble waveform
+ * 3) If a match is found, demodulate the samples into data bytes
+ * 4) Unscramble the data
+ * 5) Pass the frame to the link layer via phy_request_rx_buf()
+ *
+ * Steps 2-4 are performed by rx_demod_block(). Frames are demodulated directly
+ * into a free slot of the rx frame ring. If all slots are in use by the link
+ * layer, the frame is demodulated into a local buffer and dropped.
+ *
+ * @param    arg        pointer to phy_handle struct
+ */
+void *phy_receive_frames(void *arg)
+{
+    struct phy_handle *phy = (struct phy_handle *) arg;
+    struct rx_filter_block *block = NULL;        //current block of samples
+    unsigned int num_frames;
+    uint64_t timestamp = UINT64_MAX;
 
-    preamble_detected = false;
-    data_index = 0;
-    state = RECEIVE;
     //Loop until stop signal detected
     while(!phy->rx->stop){
-        switch(state){
-            case RECEIVE:
-                //--Receive samples, filter, and power normalize
-                //DEBUG_MSG("[PHY] RX: State = RECEIVE\n");
-                samples_index = 0;
-                status = bladerf_sync_rx(phy->dev, phy->rx->in_samples, NUM_SAMPLES_RX,
-                                            &metadata, 5000);
-                if (status != 0){
-                    fprintf(stderr, "[PHY] %s: Couldn't receive samples from bladeRF\n",
-                            __FUNCTION__);
-                    goto out;
-                }
-                //Check metadata
-                if (metadata.status & BLADERF_META_STATUS_OVERRUN){
-                    NOTE("[PHY] %s: Got an overrun. Expected count = %u;"
-                                " actual count = %u. Skipping these samples.\n",
-                                __FUNCTION__, NUM_SAMPLES_RX, metadata.actual_count);
-                    break;
-                }
-                if (timestamp != UINT64_MAX && metadata.timestamp != timestamp+NUM_SAMPLES_RX){
-                    NOTE("[PHY] %s: Unexpected timestamp. Expected %lu, got %lu.\n",
-                            __FUNCTION__, timestamp+NUM_SAMPLES_RX, metadata.timestamp);
-                }
-                timestamp = metadata.timestamp;
-
-                #ifndef BYPASS_RX_CHANNEL_FILTER
-                    // Apply channel filter
-                    fir_process(phy->rx->ch_filt, phy->rx->in_samples,
-                                phy->rx->filt_samples, NUM_SAMPLES_RX);
-                #else
-                    conv_samples_to_struct(phy->rx->in_samples, NUM_SAMPLES_RX,
-                                            phy->rx->filt_samples);
-                #endif
-                //Power normalize
-                #ifndef BYPASS_RX_PNORM
-                    pnorm(phy->rx->pnorm, NUM_SAMPLES_RX, phy->rx->filt_samples,
-                            phy->rx->pnorm_samples, NULL, NULL);
-                #else
-                    memcpy(phy->rx->pnorm_samples, phy->rx->filt_samples,
-                            NUM_SAMPLES_RX * sizeof(struct complex_sample));
-                #endif
-                if (preamble_detected){
-                    state = DEMOD;
-                }else{
-                    state = PREAMBLE_CORRELATE;
-                }
-                break;
-            case PREAMBLE_CORRELATE:
-                //--Cross correlate received samples with preamble to find start
-                //--of the data frame
-                //DEBUG_MSG("[PHY] RX: State = PREAMBLE_CORRELATE\n");
-                samples_index = corr_process(phy->rx->corr,
-                                            &(phy->rx->pnorm_samples[samples_index]),
-                                            (size_t) (NUM_SAMPLES_RX-samples_index), 0);
-                if (samples_index != CORRELATOR_NO_RESULT){
-                    DEBUG_MSG("[PHY] RX: Preamble matched @ index %lu\n", samples_index);
-                    preamble_detected = true;
-                    new_frame = true;
-                    //First we only demod the first byte to determine frame type
-                    num_bytes_to_demod = 1;
-                    data_index = 0;
-                    state = DEMOD;
-                }else{
-                    //No preamble match. Receive more samples
-                    state = RECEIVE;
-                }
-                break;
-            case DEMOD:
-                //--Demod samples
-                DEBUG_MSG("[PHY] RX: State = DEMOD\n");
-                num_bytes_rx = fsk_demod(phy->fsk, &(phy->rx->pnorm_samples[samples_index]),
-                                        NUM_SAMPLES_RX-(int)samples_index, new_frame,
-                                        num_bytes_to_demod, &rx_buffer[data_index]);
-                if (num_bytes_rx < num_bytes_to_demod){
-                    //Receive more samples
-                    num_bytes_to_demod -= num_bytes_rx;
-                    state = RECEIVE;
-                }else{
-                    if (new_frame){
-                        state = CHECK_FRAME_TYPE;
-                        //Account for extra sample which defines initial phase
-                        samples_index++;
-                    }else{
-                        //We demoded all samples in the frame
-                        state = DECODE;
-                    }
-                }
-                data_index += num_bytes_rx;
-                samples_index += num_bytes_rx*8*SAMP_PER_SYMB;
-                new_frame = false;
-                break;
-            case CHECK_FRAME_TYPE:
-                //--Check the frame type byte
-                DEBUG_MSG("[PHY] RX: State = CHECK_FRAME_TYPE\n");
-                #ifndef BYPASS_PHY_SCRAMBLING
-                    frame_type = rx_buffer[0] ^ phy->scrambling_sequence[0];
-                #else
-                    frame_type = rx_buffer[0];
-                #endif
-                //Set frame length according to what type of frame it is
-                if (frame_type == ACK_FRAME_CODE){
-                    DEBUG_MSG("[PHY] RX: Getting an ACK frame...\n");
-                    frame_length = ACK_FRAME_LENGTH;
-                }else if(frame_type == DATA_FRAME_CODE){
-                    DEBUG_MSG("[PHY] RX: Getting a data frame...\n");
-                    frame_length = DATA_FRAME_LENGTH;
-                }else{
-                    NOTE("[PHY] %s: rx'ed unknown frame type 0x%.2X\n",
-                            __FUNCTION__, frame_type);
-                    data_index = 0;
-                    preamble_detected = false;
-                    state = RECEIVE;
-                    break;
-                }
-                //Demod the rest of the bytes
-                num_bytes_to_demod = frame_length-1;
-                state = DEMOD;
-                break;
-            case DECODE:
-                //--Remove any phy encoding on the received frame
-                DEBUG_MSG("[PHY] RX: State = DECODE\n");
-                #ifndef BYPASS_PHY_SCRAMBLING
-                    //Unscramble the frame
-                    unscramble_frame(rx_buffer, frame_length, phy->scrambling_sequence);
-                #endif
-                state = COPY;
-                break;
-            case COPY:
-                //--Copy frame into buffer which can be accessed by the link layer
-                DEBUG_MSG("[PHY] RX: State = COPY\n");
-                //Is the link layer still working with the previous frame?
-                if (phy->rx->buf_filled){
-                    //Instead of disrupting the link layer, drop this frame
-                    NOTE("[PHY] RX: Frame dropped!\n");
-                }else{
-                    //Copy frame into rx_data_buf
-                    memcpy(phy->rx->data_buf, rx_buffer,
-                            frame_length);
-                    phy->rx->buf_filled = true;
-                    //Signal that the buffer is filled
-                    status = pthread_mutex_lock(&(phy->rx->buf_status_lock));
-                    if (status != 0){
-                        fprintf(stderr, "[PHY] %s: Error locking pthread_mutex\n",
-                                __FUNCTION__);
-                        goto out;
-                    }
-                    status = pthread_cond_signal(&(phy->rx->buf_filled_cond));
-                    if (status != 0){
-                        fprintf(stderr, "[PHY] %s: Error signaling pthread_cond\n",
-                                __FUNCTION__);
-                        goto out;
-                    }
-                    status = pthread_mutex_unlock(&(phy->rx->buf_status_lock));
-                    if (status != 0){
-                        fprintf(stderr, "[PHY] %s: Error unlocking pthread_mutex\n",
-                                __FUNCTION__);
-                        goto out;
-                    }
-                    DEBUG_MSG("[PHY] RX: Frame ready\n");
-                }
-                preamble_detected = false;
-
-                if (samples_index == NUM_SAMPLES_RX){
-                    state = RECEIVE;
-                }else{
-                    state = PREAMBLE_CORRELATE;
-                }
-                break;
-            default:
-                fprintf(stderr, "[PHY] %s: Invalid state\n", __FUNCTION__);
-                goto out;
+        //--Get the next block of filtered, power normalized samples
+        pthread_mutex_lock(&(phy->rx->filter_lock));
+        while ((block = (struct rx_filter_block *)
+                    frame_ring_read_slot(phy->rx->filter_ring, NULL)) == NULL &&
+                !phy->rx->stop){
+            pthread_cond_wait(&(phy->rx->filter_filled_cond), &(phy->rx->filter_lock));
+        }
+        pthread_mutex_unlock(&(phy->rx->filter_lock));
+        if (block == NULL){
+            //Stopping
+            break;
+        }
+        //Blocks dropped by the capture stage show up as a gap in timestamps
+        if (timestamp != UINT64_MAX && block->timestamp != timestamp+NUM_SAMPLES_RX){
+            NOTE("[PHY] %s: Unexpected timestamp. Expected %lu, got %lu.\n",
+                    __FUNCTION__, timestamp+NUM_SAMPLES_RX, block->timestamp);
+        }
+        timestamp = block->timestamp;
+
+        //--Acquire and demodulate frames
+        num_frames = rx_demod_block(phy->rx->demod, block->samples, NUM_SAMPLES_RX,
+                                    &phy->stats.rx_frames_dropped);
+
+        //--Return the block to the filter stage
+        frame_ring_release(phy->rx->filter_ring);
+        pthread_mutex_lock(&(phy->rx->filter_lock));
+        pthread_cond_signal(&(phy->rx->filter_free_cond));
+        pthread_mutex_unlock(&(phy->rx->filter_lock));
+
+        //--Pass the frames to the link layer
+        if (num_frames > 0){
+            phy->stats.rx_frames += num_frames;
+            pthread_mutex_lock(&(phy->rx->buf_status_lock));
+            pthread_cond_signal(&(phy->rx->buf_filled_cond));
+            pthread_mutex_unlock(&(phy->rx->buf_status_lock));
+            DEBUG_MSG("[PHY] RX: Frame ready\n");
         }
     }
-    out:
-        free(rx_buffer);
-        return NULL;
+    return NULL;
+}
+
+/****************************************
+ *                                      *
+ *          LOOPBACK FUNCTIONS          *
+ *                                      *
+ ****************************************/
+
+//Maximum number of frames propagating through each direction of the channel
+#define LOOPBACK_MAX_IN_FLIGHT 256
+
+struct loopback_frame {
+    uint8_t data[MAX_LINK_FRAME_SIZE];
+    size_t length;
+    struct timespec deliver_time;    //time at which the frame reaches the receiver
+};
+
+//One direction of the loopback channel: phys[i] -> phys[1-i]
+struct loopback_dir {
+    struct loopback_frame in_flight[LOOPBACK_MAX_IN_FLIGHT];    //FIFO of frames
+    unsigned int head;                //oldest frame in in_flight
+    unsigned int count;                //number of frames in in_flight
+    struct timespec idle_time;        //time at which the current frame's airtime ends
+};
+
+struct loopback_channel {
+    struct phy_loopback_params params;
+    struct phy_handle *phys[2];        //endpoints. Set to NULL when closed.
+    struct loopback_dir dir[2];
+    uint64_t prng_state;            //for loss decisions
+    unsigned int refs;                //number of open endpoints
+    bool stop;
+    pthread_t thread;
+    pthread_cond_t cond;            //signaled when either endpoint queues a frame
+    pthread_mutex_t lock;            //protects all of the above
+};
+
+//Wake the channel thread, which may be waiting for a frame to transmit
+static void loopback_notify(struct loopback_channel *chan)
+{
+    pthread_mutex_lock(&chan->lock);
+    pthread_cond_signal(&chan->cond);
+    pthread_mutex_unlock(&chan->lock);
+}
+
+//Take the next frame queued for transmission by 'src', if any, and put it on the
+//channel. ACKs are sent first, as in phy_transmit_frames().
+static void loopback_transmit(struct loopback_channel *chan, struct phy_handle *src,
+                                struct loopback_dir *dir, const struct timespec *now)
+{
+    struct frame_ring *ring = src->tx->ack_ring;
+    struct loopback_frame *f;
+    uint8_t *frame;
+    size_t frame_length;
+    uint64_t airtime_us = 0;
+    double rand_val;
+
+    if (src->tx->stop || dir->count == LOOPBACK_MAX_IN_FLIGHT){
+        return;
+    }
+
+    frame = frame_ring_read_slot(ring, &frame_length);
+    if (frame == NULL){
+        ring = src->tx->data_ring;
+        frame = frame_ring_read_slot(ring, &frame_length);
+        if (frame == NULL){
+            return;
+        }
+    }
+
+    //The channel is busy until the whole frame, including the training sequence
+    //and preamble, has been sent
+    if (chan->params.bitrate != 0){
+        airtime_us = (uint64_t) (TRAINING_SEQ_LENGTH + PREAMBLE_LENGTH + frame_length)
+                        * 8 * 1000000 / chan->params.bitrate;
+    }
+    dir->idle_time = *now;
+    timespec_add_us(&dir->idle_time, airtime_us);
+
+    //Uniform random value in [0, 1)
+    chan->prng_state = prng_update(chan->prng_state);
+    rand_val = (chan->prng_state >> 11) * (1.0 / 9007199254740992.0);
+
+    if (rand_val >= chan->params.loss_rate){
+        f = &dir->in_flight[(dir->head + dir->count) % LOOPBACK_MAX_IN_FLIGHT];
+        memcpy(f->data, frame, frame_length);
+        f->length = frame_length;
+        f->deliver_time = dir->idle_time;
+        timespec_add_us(&f->deliver_time, (uint64_t) chan->params.latency_ms * 1000);
+        dir->count++;
+    }else{
+        NOTE("[PHY] Loopback: Frame lost\n");
+    }
+
+    //Return the buffer to its producer
+    frame_ring_release(ring);
+    pthread_mutex_lock(&(src->tx->buf_status_lock));
+    pthread_cond_broadcast(&(src->tx->buf_free_cond));
+    pthread_mutex_unlock(&(src->tx->buf_status_lock));
+}
+
+//Deliver frames which have reached 'dst' by time 'now'
+static void loopback_deliver(struct phy_handle *dst, struct loopback_dir *dir,
+                                const struct timespec *now)
+{
+    struct loopback_frame *f;
+    uint8_t *buf;
+
+    while (dir->count > 0){
+        f = &dir->in_flight[dir->head];
+        if (timespec_diff_us(&f->deliver_time, now) > 0){
+            break;
+        }
+
+        if (dst != NULL){
+            buf = frame_ring_write_slot(dst->rx->ring);
+            if (buf == NULL){
+                NOTE("[PHY] RX: Frame dropped!\n");
+            }else{
+                memcpy(buf, f->data, f->length);
+                frame_ring_commit(dst->rx->ring, f->length);
+                pthread_mutex_lock(&(dst->rx->buf_status_lock));
+                pthread_cond_signal(&(dst->rx->buf_filled_cond));
+                pthread_mutex_unlock(&(dst->rx->buf_status_lock));
+            }
+        }
+
+        dir->head = (dir->head + 1) % LOOPBACK_MAX_IN_FLIGHT;
+        dir->count--;
+    }
 }
 
 /**
- * Unscrambles the given data with the given scrambling sequence. The size of the
- * scrambling sequence array must be at least as large as the frame.
+ * Thread function which carries frames across both directions of a loopback
+ * channel. This takes the place of phy_transmit_frames() and phy_receive_frames().
+ *
+ * @param[in]   arg     pointer to loopback_channel struct
  */
-static void unscramble_frame(uint8_t *frame, int frame_length,
-                                uint8_t *scrambling_sequence)
+static void *loopback_run(void *arg)
+{
+    struct loopback_channel *chan = (struct loopback_channel *) arg;
+    struct phy_handle *src, *dst;
+    struct loopback_dir *dir;
+    struct timespec now, wake;
+    int i;
+
+    pthread_mutex_lock(&chan->lock);
+    while (!chan->stop){
+        create_timeout_abs(0, &now);
+        //Wake up at least every 100 ms, regardless of activity
+        wake = now;
+        timespec_add_us(&wake, 100000);
+
+        for (i = 0; i < 2; i++){
+            src = chan->phys[i];
+            dst = chan->phys[1-i];
+            dir = &chan->dir[i];
+
+            loopback_deliver(dst, dir, &now);
+
+            if (timespec_diff_us(&dir->idle_time, &now) <= 0 && src != NULL){
+                loopback_transmit(chan, src, dir, &now);
+            }
+
+            //Wake for the end of the current frame's airtime, or the next delivery
+            if (timespec_diff_us(&dir->idle_time, &now) > 0 &&
+                    timespec_diff_us(&dir->idle_time, &wake) < 0){
+                wake = dir->idle_time;
+            }
+            if (dir->count > 0 &&
+                    timespec_diff_us(&dir->in_flight[dir->head].deliver_time, &wake) < 0){
+                wake = dir->in_flight[dir->head].deliver_time;
+            }
+        }
+
+        //Don't wait if there's already something to do
+        if (timespec_diff_us(&wake, &now) > 0){
+            pthread_cond_timedwait(&chan->cond, &chan->lock, &wake);
+        }
+    }
+    pthread_mutex_unlock(&chan->lock);
+
+    return NULL;
+}
+
+/**
+ * Allocate a phy handle which is connected to a loopback channel rather than
+ * a bladeRF
+ */
+static struct phy_handle *loopback_init_phy(struct loopback_channel *chan)
+{
+    struct phy_handle *phy;
+
+    phy = calloc(1, sizeof(struct phy_handle));
+    if (phy == NULL){
+        perror("malloc");
+        return NULL;
+    }
+
+    if (init_tx_frames(phy) != 0 || init_rx_frames(phy) != 0){
+        phy_close(phy);
+        return NULL;
+    }
+
+    phy->loopback = chan;
+    return phy;
+}
+
+int phy_init_loopback_pair(const struct phy_loopback_params *params,
+                           struct phy_handle **phy1, struct phy_handle **phy2)
+{
+    struct loopback_channel *chan;
+    int status;
+
+    *phy1 = NULL;
+    *phy2 = NULL;
+
+    if (params->loss_rate < 0.0 || params->loss_rate > 1.0){
+        fprintf(stderr, "[PHY] %s: Invalid loss rate: %f\n", __FUNCTION__,
+                params->loss_rate);
+        return -1;
+    }
+
+    chan = calloc(1, sizeof(struct loopback_channel));
+    if (chan == NULL){
+        perror("malloc");
+        return -1;
+    }
+    chan->params = *params;
+    chan->prng_state = (params->seed != 0) ? params->seed : PRNG_SEED;
+
+    status = pthread_mutex_init(&chan->lock, NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
+        free(chan);
+        return -1;
+    }
+    status = pthread_cond_init(&chan->cond, NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
+        pthread_mutex_destroy(&chan->lock);
+        free(chan);
+        return -1;
+    }
+
+    chan->phys[0] = loopback_init_phy(chan);
+    chan->phys[1] = loopback_init_phy(chan);
+    if (chan->phys[0] == NULL || chan->phys[1] == NULL){
+        goto error;
+    }
+
+    status = pthread_create(&chan->thread, NULL, loopback_run, chan);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error creating loopback thread: %s\n",
+                __FUNCTION__, strerror(status));
+        goto error;
+    }
+    chan->refs = 2;
+
+    *phy1 = chan->phys[0];
+    *phy2 = chan->phys[1];
+    return 0;
+
+    error:
+        //The channel thread isn't running; free everything directly
+        if (chan->phys[0] != NULL){
+            chan->phys[0]->loopback = NULL;
+            phy_close(chan->phys[0]);
+        }
+        if (chan->phys[1] != NULL){
+            chan->phys[1]->loopback = NULL;
+            phy_close(chan->phys[1]);
+        }
+        pthread_cond_destroy(&chan->cond);
+        pthread_mutex_destroy(&chan->lock);
+        free(chan);
+        return -1;
+}
+
+//Disconnect 'phy' from its loopback channel, if any. The channel is freed when
+//both of its endpoints have been disconnected.
+static void loopback_detach(struct phy_handle *phy)
 {
+    struct loopback_channel *chan = phy->loopback;
+    bool last;
     int i;
-    for (i = 0; i < frame_length; i++){
-        //XOR byte with byte from scrambling sequence
-        frame[i] ^= scrambling_sequence[i];
+
+    if (chan == NULL){
+        return;
+    }
+
+    pthread_mutex_lock(&chan->lock);
+    for (i = 0; i < 2; i++){
+        if (chan->phys[i] == phy){
+            chan->phys[i] = NULL;
+        }
+    }
+    last = (--chan->refs == 0);
+    if (last){
+        chan->stop = true;
+        pthread_cond_signal(&chan->cond);
+    }
+    pthread_mutex_unlock(&chan->lock);
+
+    phy->loopback = NULL;
+
+    if (last){
+        pthread_join(chan->thread, NULL);
+        pthread_cond_destroy(&chan->cond);
+        pthread_mutex_destroy(&chan->lock);
+        free(chan);
     }
 }
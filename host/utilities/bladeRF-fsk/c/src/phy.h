@@ -48,6 +48,7 @@
 #include "host_config.h"
 #include "common.h"
 #include "utils.h"
+#include "phy_io.h"
 
 //Training sequence which goes at the start of every frame
 //Note: In order for the preamble waveform not to be messed up, the last
@@ -64,7 +65,7 @@
 #define ACK_FRAME_CODE 0xFF
 //Frame lengths
 #define DATA_FRAME_LENGTH 1009
-#define ACK_FRAME_LENGTH 7
+#define ACK_FRAME_LENGTH 11
 //Maximum frame size in bytes
 #define MAX_LINK_FRAME_SIZE DATA_FRAME_LENGTH
 //Seed for pseudorandom number sequence generator
@@ -75,6 +76,14 @@
 #define NUM_SAMPLES_RX SYNC_BUFFER_SIZE
 //Correlator countdown size
 #define CORR_COUNTDOWN SAMP_PER_SYMB
+//Number of frame slots in the RX ring, and in each of the TX data/ack rings.
+//Must be a power of two.
+#define PHY_RX_RING_SLOTS 8
+#define PHY_TX_RING_SLOTS 8
+//Number of NUM_SAMPLES_RX blocks queued between the stages of the RX pipeline
+//(capture -> filter/normalize -> acquisition/demod). Must be powers of two.
+#define PHY_RX_CAPTURE_BLOCKS 16
+#define PHY_RX_FILTER_BLOCKS 4
 
 struct phy_handle;
 
@@ -98,7 +107,13 @@ int phy_start_transmitter(struct phy_handle *phy);
 int phy_stop_transmitter(struct phy_handle *phy);
 
 /**
- * Fill the tx buffer so its data will be transmitted using phy_transmit_frames()
+ * Copy a frame into the next free tx buffer so that it will be transmitted by
+ * phy_transmit_frames(). Blocks while all tx buffers of the frame's type are in
+ * use.
+ *
+ * ACK frames (first byte ACK_FRAME_CODE) and data frames are queued separately,
+ * and queued ACK frames are transmitted first. Each queue has a single producer:
+ * only one thread may queue data frames, and only one thread may queue ACKs.
  *
  * @param[in]   phy         pointer to phy handle structure
  * @param[in]   data_buf    bytes to transmit
@@ -108,9 +123,37 @@ int phy_stop_transmitter(struct phy_handle *phy);
  */
 int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int length);
 
+/**
+ * Get the next free tx buffer of the given frame type, so that a frame may be
+ * built directly in it. Blocks while all tx buffers of this type are in use.
+ * The frame is not transmitted until phy_commit_tx_buf() is called.
+ *
+ * @param[in]   phy         pointer to phy handle structure
+ * @param[in]   ack         true for an ACK frame buffer, false for a data frame
+ *                          buffer
+ *
+ * @return      buffer of MAX_LINK_FRAME_SIZE bytes on success, NULL if the
+ *              transmitter has been stopped
+ */
+uint8_t *phy_request_tx_buf(struct phy_handle *phy, bool ack);
+
+/**
+ * Queue the buffer returned by phy_request_tx_buf() for transmission
+ *
+ * @param[in]   phy         pointer to phy handle structure
+ * @param[in]   ack         must match the value passed to phy_request_tx_buf()
+ * @param[in]   length      length of the frame in the buffer
+ *
+ * @return      0 on success, -1 on failure
+ */
+int phy_commit_tx_buf(struct phy_handle *phy, bool ack, unsigned int length);
+
 //------------------------Receiver functions---------------------------
 /**
- * Start the PHY receiver  thread
+ * Start the PHY receiver threads. The receiver is a pipeline of three threads:
+ * sample capture, channel filter + power normalization, and preamble
+ * acquisition + demodulation. Each is pinned to the CPU given in the radio_params
+ * passed to phy_init(), if any.
  * 
  * @param[in]   phy     pointer to phy_handle struct
  *
@@ -119,7 +162,7 @@ int phy_fill_tx_buf(struct phy_handle *phy, uint8_t *data_buf, unsigned int leng
 int phy_start_receiver(struct phy_handle *phy);
 
 /**
- * Stop the PHY receiver thread
+ * Stop the PHY receiver threads
  * 
  * @param[in]   phy     pointer to phy_handle struct
  *
@@ -128,9 +171,9 @@ int phy_start_receiver(struct phy_handle *phy);
 int phy_stop_receiver(struct phy_handle *phy);
 
 /**
- * Request a received frame from phy_receive_frames(). Caller should call
- * phy_release_rx_buf() when done with the received frame so that 
- * phy_receive_frames() does not drop any frames.
+ * Request the oldest received frame from phy_receive_frames(). Caller should call
+ * phy_release_rx_buf() when done with the received frame. Up to PHY_RX_RING_SLOTS
+ * frames are queued; phy_receive_frames() drops frames when all are in use.
  *
  * @param[in]   phy             pointer to phy_handle struct
  * @param[in]   timeout_ms      amount of time to wait for a buffer from the PHY
@@ -140,12 +183,80 @@ int phy_stop_receiver(struct phy_handle *phy);
 uint8_t *phy_request_rx_buf(struct phy_handle *phy, unsigned int timeout_ms);
 
 /**
- * Release RX buffer so that phy_receive_frames() can copy new frames into the buffer
+ * Release the RX buffer returned by phy_request_rx_buf() so that
+ * phy_receive_frames() can receive new frames into it
  *
  * @param[in]   phy     pointer to phy_handle struct
  */
 void phy_release_rx_buf(struct phy_handle *phy);
 
+//------------------------Loopback functions---------------------------
+/**
+ * Parameters of a frame-level loopback channel. See phy_init_loopback_pair().
+ */
+struct phy_loopback_params {
+    double loss_rate;           //Probability (0.0 - 1.0) that a frame is lost
+    unsigned int latency_ms;    //One-way propagation delay
+    unsigned int bitrate;       //Channel bit rate, in bits/s, used to compute the
+                                //airtime of each frame. 0 for no airtime.
+    uint64_t seed;              //Seed for loss decisions. 0 selects a default.
+};
+
+/**
+ * Open a pair of PHY handles whose transmitters are connected to each other's
+ * receivers by a simulated channel, rather than by a bladeRF and the modem.
+ *
+ * Frames are passed whole through the same buffers as on the radio, so the link
+ * layer may be exercised without hardware. Each direction of the channel is
+ * busy for the airtime of each frame, and frames are delivered after the
+ * configured latency, or lost with the configured probability. As with the
+ * radio, a frame is dropped if the receiving PHY has no free rx buffer.
+ *
+ * Each handle must be closed with phy_close(). The handles may be closed in
+ * either order.
+ *
+ * @param[in]   params  channel parameters
+ * @param[out]  phy1    first phy handle
+ * @param[out]  phy2    second phy handle
+ *
+ * @return      0 on success, -1 on failure
+ */
+int phy_init_loopback_pair(const struct phy_loopback_params *params,
+                           struct phy_handle **phy1, struct phy_handle **phy2);
+
+//-------------------------Statistics functions-----------------------------
+//Threads of the PHY, for struct phy_stats
+enum phy_stage {
+    PHY_STAGE_TX,           //modulation and transmission
+    PHY_STAGE_CAPTURE,      //sample reception
+    PHY_STAGE_FILTER,       //channel filter and power normalization
+    PHY_STAGE_DEMOD,        //correlation and demodulation
+    PHY_NUM_STAGES
+};
+
+/**
+ * Counters accumulated by a PHY since it was initialized
+ */
+struct phy_stats {
+    uint64_t tx_frames;             //frames transmitted
+    uint64_t rx_frames;             //frames received and passed to the link layer
+    uint64_t rx_frames_dropped;     //frames received while the rx ring was full
+    uint64_t rx_blocks;             //blocks of NUM_SAMPLES_RX samples received
+    uint64_t rx_blocks_dropped;     //blocks lost to overruns, or dropped because
+                                    //the receiver pipeline was full
+    bool cpu_time_valid;            //is per-thread CPU time supported?
+    uint64_t cpu_time_us[PHY_NUM_STAGES];   //CPU time used by each thread, in us
+};
+
+/**
+ * Get the statistics of a PHY. CPU times are only updated as each thread exits,
+ * so they are complete once the transmitter and receiver have been stopped.
+ *
+ * @param[in]   phy     pointer to phy_handle struct
+ * @param[out]  stats   statistics
+ */
+void phy_get_stats(struct phy_handle *phy, struct phy_stats *stats);
+
 //-----------------------Init/Deinit functions-------------------------
 /**
  * Open/Initialize a phy_handle
@@ -157,6 +268,18 @@ void phy_release_rx_buf(struct phy_handle *phy);
  */
 struct phy_handle *phy_init(struct bladerf *dev, struct radio_params *params);
 
+/**
+ * Open/Initialize a phy_handle which transmits and receives samples through the
+ * given sample I/O handle (see phy_io.h), rather than directly with a bladeRF
+ *
+ * @param[in]   io      sample I/O handle. The phy takes ownership of it, and
+ *                      closes it in phy_close(), or here on failure.
+ * @param[in]   params  pointer to radio parameters struct
+ *
+ * @return      allocated phy_handle on success, NULL on failure
+ */
+struct phy_handle *phy_init_io(struct phy_io *io, struct radio_params *params);
+
 /**
  * Close a phy handle. Does nothing if handle is NULL
  *
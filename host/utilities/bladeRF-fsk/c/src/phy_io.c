@@ -0,0 +1,750 @@
+/**
+ * @brief   Sample I/O for the physical layer
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "phy_io.h"
+#include "phy.h"            //PRNG_SEED
+#include "prng.h"
+#include "radio_config.h"
+#include "utils.h"
+
+//Timeout for libbladeRF sync calls
+#define BLADERF_IO_TIMEOUT_MS 5000
+
+//Number of samples the loopback channel can queue. Must be a power of two, and
+//must hold the longest burst plus PHY_IO_BURST_GAP.
+#define LOOPBACK_FIFO_LEN (1 << 18)
+//Number of bursts the loopback channel's input can queue. Must be a power of two.
+#define LOOPBACK_MAX_BURSTS 64
+//Number of precomputed noise samples. Must be a power of two.
+#define LOOPBACK_NOISE_LEN (1 << 16)
+//How long phy_io_rx()/phy_io_tx() wait on the loopback channel before returning
+//PHY_IO_TIMEOUT, so the caller may check whether it should stop
+#define LOOPBACK_WAIT_MS 100
+
+struct phy_io_fns {
+    bool realtime;
+    int (*configure)(struct phy_io *io, struct radio_params *params);
+    int (*rx)(struct phy_io *io, int16_t *samples, unsigned int count,
+              uint64_t *timestamp);
+    int (*tx)(struct phy_io *io, const int16_t *samples, unsigned int count);
+    void (*close)(struct phy_io *io);
+};
+
+struct phy_io {
+    const struct phy_io_fns *fns;
+    void *priv;                 //implementation-specific state
+};
+
+static struct phy_io *phy_io_alloc(const struct phy_io_fns *fns, void *priv)
+{
+    struct phy_io *io;
+
+    io = calloc(1, sizeof(*io));
+    if (io == NULL){
+        perror("[PHY] calloc");
+        return NULL;
+    }
+    io->fns = fns;
+    io->priv = priv;
+    return io;
+}
+
+/****************************************
+ *                                      *
+ *               BLADERF                *
+ *                                      *
+ ****************************************/
+
+static int bladerf_io_configure(struct phy_io *io, struct radio_params *params)
+{
+    return radio_init_and_configure((struct bladerf *) io->priv, params);
+}
+
+static int bladerf_io_rx(struct phy_io *io, int16_t *samples, unsigned int count,
+                         uint64_t *timestamp)
+{
+    struct bladerf_metadata metadata;
+    int status;
+
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.flags = BLADERF_META_FLAG_RX_NOW;
+
+    status = bladerf_sync_rx((struct bladerf *) io->priv, samples, count, &metadata,
+                             BLADERF_IO_TIMEOUT_MS);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Couldn't receive samples from bladeRF: %s\n",
+                __FUNCTION__, bladerf_strerror(status));
+        return -1;
+    }
+    if (metadata.status & BLADERF_META_STATUS_OVERRUN){
+        return PHY_IO_OVERRUN;
+    }
+    *timestamp = metadata.timestamp;
+    return 0;
+}
+
+static int bladerf_io_tx(struct phy_io *io, const int16_t *samples, unsigned int count)
+{
+    struct bladerf_metadata metadata;
+    int status;
+
+    //Each call is a complete burst, sent immediately
+    memset(&metadata, 0, sizeof(metadata));
+    metadata.flags = BLADERF_META_FLAG_TX_BURST_START |
+                     BLADERF_META_FLAG_TX_NOW |
+                     BLADERF_META_FLAG_TX_BURST_END;
+
+    status = bladerf_sync_tx((struct bladerf *) io->priv, (void *) samples, count,
+                             &metadata, BLADERF_IO_TIMEOUT_MS);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Couldn't transmit samples with bladeRF: %s\n",
+                __FUNCTION__, bladerf_strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+static void bladerf_io_close(struct phy_io *io)
+{
+    //Stop bladeRF (handle closed elsewhere)
+    radio_stop((struct bladerf *) io->priv);
+}
+
+static const struct phy_io_fns bladerf_io_fns = {
+    true,
+    bladerf_io_configure,
+    bladerf_io_rx,
+    bladerf_io_tx,
+    bladerf_io_close,
+};
+
+struct phy_io *phy_io_open_bladerf(struct bladerf *dev)
+{
+    return phy_io_alloc(&bladerf_io_fns, dev);
+}
+
+/****************************************
+ *                                      *
+ *                FILE                  *
+ *                                      *
+ ****************************************/
+
+struct file_io {
+    FILE *rx;                   //received samples, or NULL
+    FILE *tx;                   //transmitted samples, or NULL
+    uint64_t timestamp;         //timestamp of the next received sample
+};
+
+static int file_io_rx(struct phy_io *io, int16_t *samples, unsigned int count,
+                      uint64_t *timestamp)
+{
+    struct file_io *f = (struct file_io *) io->priv;
+    size_t n;
+
+    if (f->rx == NULL){
+        return PHY_IO_EOF;
+    }
+
+    n = fread(samples, 2*sizeof(int16_t), count, f->rx);
+    if (n == 0){
+        if (ferror(f->rx)){
+            fprintf(stderr, "[PHY] %s: Couldn't read samples from file\n", __FUNCTION__);
+            return -1;
+        }
+        return PHY_IO_EOF;
+    }
+    //Zero-fill a partial block at the end of the file
+    memset(&samples[2*n], 0, (count - n) * 2*sizeof(int16_t));
+
+    *timestamp = f->timestamp;
+    f->timestamp += count;
+    return 0;
+}
+
+static int file_io_tx(struct phy_io *io, const int16_t *samples, unsigned int count)
+{
+    static const int16_t gap[2*PHY_IO_BURST_GAP];
+    struct file_io *f = (struct file_io *) io->priv;
+
+    if (f->tx == NULL){
+        return 0;
+    }
+    if (fwrite(samples, 2*sizeof(int16_t), count, f->tx) != count ||
+        fwrite(gap, 2*sizeof(int16_t), PHY_IO_BURST_GAP, f->tx) != PHY_IO_BURST_GAP){
+        fprintf(stderr, "[PHY] %s: Couldn't write samples to file\n", __FUNCTION__);
+        return -1;
+    }
+    return 0;
+}
+
+static void file_io_close(struct phy_io *io)
+{
+    struct file_io *f = (struct file_io *) io->priv;
+
+    if (f->rx != NULL){
+        fclose(f->rx);
+    }
+    if (f->tx != NULL){
+        fclose(f->tx);
+    }
+    free(f);
+}
+
+static const struct phy_io_fns file_io_fns = {
+    false,
+    NULL,
+    file_io_rx,
+    file_io_tx,
+    file_io_close,
+};
+
+struct phy_io *phy_io_open_file(const char *rx_path, const char *tx_path)
+{
+    struct file_io *f;
+    struct phy_io *io;
+
+    f = calloc(1, sizeof(*f));
+    if (f == NULL){
+        perror("[PHY] calloc");
+        return NULL;
+    }
+    if (rx_path != NULL){
+        f->rx = fopen(rx_path, "rb");
+        if (f->rx == NULL){
+            fprintf(stderr, "[PHY] Couldn't open %s for reading: %s\n", rx_path,
+                    strerror(errno));
+            goto error;
+        }
+    }
+    if (tx_path != NULL){
+        f->tx = fopen(tx_path, "wb");
+        if (f->tx == NULL){
+            fprintf(stderr, "[PHY] Couldn't open %s for writing: %s\n", tx_path,
+                    strerror(errno));
+            goto error;
+        }
+    }
+
+    io = phy_io_alloc(&file_io_fns, f);
+    if (io != NULL){
+        return io;
+    }
+
+    error:
+        if (f->rx != NULL){
+            fclose(f->rx);
+        }
+        if (f->tx != NULL){
+            fclose(f->tx);
+        }
+        free(f);
+        return NULL;
+}
+
+/****************************************
+ *                                      *
+ *              LOOPBACK                *
+ *                                      *
+ ****************************************/
+
+struct loopback_io {
+    struct phy_io_channel channel;
+
+    //The impairments are applied by a thread of the channel's own, so that their
+    //cost is not included in the CPU time of the transmitting or receiving stage
+    pthread_t thread;
+    bool thread_started;
+    bool stop;                      //set to stop the channel thread
+
+    //Transmitted bursts awaiting the channel thread. in_head and burst_head are
+    //only advanced by the transmitter, and in_tail and burst_tail only by the
+    //channel thread.
+    int16_t *in;                    //2*LOOPBACK_FIFO_LEN values
+    size_t in_head;                 //free-running sample indices
+    size_t in_tail;
+    unsigned int bursts[LOOPBACK_MAX_BURSTS];   //length of each queued burst
+    size_t burst_head;              //free-running burst indices
+    size_t burst_tail;
+
+    //Queue of samples in flight to the receiver. head is only advanced by the
+    //channel thread, and tail only by the receiver.
+    int16_t *fifo;                  //2*LOOPBACK_FIFO_LEN values
+    size_t head;                    //free-running sample indices
+    size_t tail;
+
+    pthread_mutex_t lock;           //orders index updates against queue contents
+    pthread_cond_t cond;            //signaled when any index is advanced, or on stop
+
+    //Channel thread state
+    uint64_t chan_prng;             //drop decisions and noise offsets
+    double rot_i, rot_q;            //current frequency offset phasor
+    double step_i, step_q;          //phasor rotation per sample
+    int16_t *noise;                 //2*LOOPBACK_NOISE_LEN gaussian noise values
+
+    //Receiver state
+    uint64_t rx_prng;               //noise offsets for idle samples
+    uint64_t timestamp;             //timestamp of the next received sample
+};
+
+//Uniform random value in [0, 1)
+static double loopback_uniform(uint64_t *state)
+{
+    *state = prng_update(*state);
+    return (*state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int16_t clamp_sc16(double val)
+{
+    if (val >= 32767.0){
+        return INT16_MAX;
+    }else if (val <= -32768.0){
+        return INT16_MIN;
+    }
+    return (int16_t) lrint(val);
+}
+
+//Copy n samples out of a queue of LOOPBACK_FIFO_LEN samples, starting at
+//free-running index pos
+static void loopback_fifo_read(const int16_t *fifo, size_t pos, int16_t *dest,
+                               size_t n)
+{
+    size_t first = LOOPBACK_FIFO_LEN - (pos & (LOOPBACK_FIFO_LEN - 1));
+
+    first = (first < n) ? first : n;
+    memcpy(dest, &fifo[2*(pos & (LOOPBACK_FIFO_LEN - 1))],
+           first * 2*sizeof(int16_t));
+    memcpy(&dest[2*first], fifo, (n - first) * 2*sizeof(int16_t));
+}
+
+//Copy n samples into a queue of LOOPBACK_FIFO_LEN samples, starting at
+//free-running index pos
+static void loopback_fifo_write(int16_t *fifo, size_t pos, const int16_t *src,
+                                size_t n)
+{
+    size_t first = LOOPBACK_FIFO_LEN - (pos & (LOOPBACK_FIFO_LEN - 1));
+
+    first = (first < n) ? first : n;
+    memcpy(&fifo[2*(pos & (LOOPBACK_FIFO_LEN - 1))], src,
+           first * 2*sizeof(int16_t));
+    memcpy(fifo, &src[2*first], (n - first) * 2*sizeof(int16_t));
+}
+
+/**
+ * Wait on the loopback channel's condition variable for up to LOOPBACK_WAIT_MS.
+ * The lock must be held.
+ *
+ * @return      0 if signaled, PHY_IO_TIMEOUT on timeout, -1 on failure
+ */
+static int loopback_wait(struct loopback_io *lb, const struct timespec *timeout_abs)
+{
+    int status;
+
+    status = pthread_cond_timedwait(&lb->cond, &lb->lock, timeout_abs);
+    if (status == ETIMEDOUT){
+        return PHY_IO_TIMEOUT;
+    }else if (status != 0){
+        fprintf(stderr, "[PHY] %s: Condition wait failed: %s\n", __FUNCTION__,
+                strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Pass a transmitted burst through the channel: drop a run of samples, apply the
+ * frequency offset and noise, and follow it with PHY_IO_BURST_GAP idle samples
+ *
+ * @param[in]   lb      loopback state
+ * @param[in]   in_pos  index of the burst in the input queue
+ * @param[in]   count   number of samples in the burst
+ * @param[in]   pos     index at which to write to the receive queue
+ *
+ * @return      index following the last sample written to the receive queue
+ */
+static size_t loopback_channel_burst(struct loopback_io *lb, size_t in_pos,
+                                     unsigned int count, size_t pos)
+{
+    size_t drop_start = count, drop_end = count;
+    size_t noise_pos = 0, k;
+    const int16_t *src, *noise;
+    double i, q, mag;
+    int16_t *dest;
+
+    //Pick a run of samples to drop, if any
+    if (count > 0 && loopback_uniform(&lb->chan_prng) < lb->channel.drop_rate){
+        drop_start = (size_t) (loopback_uniform(&lb->chan_prng) * count);
+        drop_end = drop_start + lb->channel.drop_len;
+        drop_end = (drop_end < count) ? drop_end : count;
+    }
+
+    //Add noise starting from a random point in the noise table
+    if (lb->noise != NULL){
+        lb->chan_prng = prng_update(lb->chan_prng);
+        noise_pos = (size_t) lb->chan_prng;
+    }
+
+    for (k = 0; k < count; k++){
+        src = &lb->in[2*((in_pos + k) & (LOOPBACK_FIFO_LEN - 1))];
+        i = src[0];
+        q = src[1];
+        //Apply the frequency offset. The channel's phase advances for dropped samples
+        //too, as if they were lost by the receiver.
+        if (lb->channel.freq_offset != 0.0){
+            const double rot_i = lb->rot_i * lb->step_i - lb->rot_q * lb->step_q;
+            const double rot_q = lb->rot_i * lb->step_q + lb->rot_q * lb->step_i;
+            const double tmp = i * lb->rot_i - q * lb->rot_q;
+            q = i * lb->rot_q + q * lb->rot_i;
+            i = tmp;
+            lb->rot_i = rot_i;
+            lb->rot_q = rot_q;
+        }
+        if (k >= drop_start && k < drop_end){
+            continue;
+        }
+        if (lb->noise != NULL){
+            noise = &lb->noise[2*(noise_pos++ & (LOOPBACK_NOISE_LEN - 1))];
+            i += noise[0];
+            q += noise[1];
+        }
+        dest = &lb->fifo[2*(pos & (LOOPBACK_FIFO_LEN - 1))];
+        dest[0] = clamp_sc16(i);
+        dest[1] = clamp_sc16(q);
+        pos++;
+    }
+    //Idle between bursts
+    for (k = 0; k < PHY_IO_BURST_GAP; k++){
+        dest = &lb->fifo[2*(pos & (LOOPBACK_FIFO_LEN - 1))];
+        if (lb->noise != NULL){
+            noise = &lb->noise[2*(noise_pos++ & (LOOPBACK_NOISE_LEN - 1))];
+            dest[0] = noise[0];
+            dest[1] = noise[1];
+        }else{
+            dest[0] = dest[1] = 0;
+        }
+        pos++;
+    }
+    //Keep the phasor's magnitude from drifting
+    mag = sqrt(lb->rot_i * lb->rot_i + lb->rot_q * lb->rot_q);
+    lb->rot_i /= mag;
+    lb->rot_q /= mag;
+
+    return pos;
+}
+
+/**
+ * Channel thread: moves bursts from the input queue to the receive queue,
+ * applying the channel's impairments
+ *
+ * @param[in]   arg     pointer to loopback_io struct
+ */
+static void *loopback_channel(void *arg)
+{
+    struct loopback_io *lb = (struct loopback_io *) arg;
+    size_t in_pos, pos;
+    unsigned int count;
+
+    pthread_mutex_lock(&lb->lock);
+    while (true){
+        //Wait for a burst, and for room for it in the receive queue
+        while (!lb->stop){
+            if (lb->burst_head != lb->burst_tail){
+                count = lb->bursts[lb->burst_tail & (LOOPBACK_MAX_BURSTS - 1)];
+                if (LOOPBACK_FIFO_LEN - (lb->head - lb->tail) >=
+                        (size_t) count + PHY_IO_BURST_GAP){
+                    break;
+                }
+            }
+            pthread_cond_wait(&lb->cond, &lb->lock);
+        }
+        if (lb->stop){
+            break;
+        }
+        in_pos = lb->in_tail;
+        pos = lb->head;
+        pthread_mutex_unlock(&lb->lock);
+
+        pos = loopback_channel_burst(lb, in_pos, count, pos);
+
+        pthread_mutex_lock(&lb->lock);
+        lb->in_tail = in_pos + count;
+        lb->burst_tail++;
+        lb->head = pos;
+        pthread_cond_broadcast(&lb->cond);
+    }
+    pthread_mutex_unlock(&lb->lock);
+
+    return NULL;
+}
+
+static int loopback_io_rx(struct phy_io *io, int16_t *samples, unsigned int count,
+                          uint64_t *timestamp)
+{
+    struct loopback_io *lb = (struct loopback_io *) io->priv;
+    struct timespec timeout_abs;
+    size_t pos, n, k, fill;
+    int status = 0;
+
+    if (create_timeout_abs(LOOPBACK_WAIT_MS, &timeout_abs) != 0){
+        return -1;
+    }
+
+    //Wait for anything to be transmitted
+    pthread_mutex_lock(&lb->lock);
+    while (lb->head == lb->tail && status == 0){
+        status = loopback_wait(lb, &timeout_abs);
+    }
+    pos = lb->tail;
+    n = lb->head - lb->tail;
+    pthread_mutex_unlock(&lb->lock);
+    if (status != 0){
+        return status;
+    }
+
+    //Copy out what is available
+    n = (n < count) ? n : count;
+    loopback_fifo_read(lb->fifo, pos, samples, n);
+
+    pthread_mutex_lock(&lb->lock);
+    lb->tail += n;
+    pthread_cond_broadcast(&lb->cond);
+    pthread_mutex_unlock(&lb->lock);
+
+    //Fill the rest of the block with idle samples, which are noise alone
+    if (lb->noise == NULL){
+        memset(&samples[2*n], 0, (count - n) * 2*sizeof(int16_t));
+    }else{
+        lb->rx_prng = prng_update(lb->rx_prng);
+        pos = (size_t) (lb->rx_prng & (LOOPBACK_NOISE_LEN - 1));
+        for (k = n; k < count; k += fill){
+            fill = LOOPBACK_NOISE_LEN - pos;
+            fill = (fill < count - k) ? fill : count - k;
+            memcpy(&samples[2*k], &lb->noise[2*pos], fill * 2*sizeof(int16_t));
+            pos = 0;
+        }
+    }
+
+    *timestamp = lb->timestamp;
+    lb->timestamp += count;
+    return 0;
+}
+
+static int loopback_io_tx(struct phy_io *io, const int16_t *samples, unsigned int count)
+{
+    struct loopback_io *lb = (struct loopback_io *) io->priv;
+    struct timespec timeout_abs;
+    size_t pos;
+    int status = 0;
+
+    if ((size_t) count + PHY_IO_BURST_GAP > LOOPBACK_FIFO_LEN){
+        fprintf(stderr, "[PHY] %s: Burst of %u samples is too long\n", __FUNCTION__,
+                count);
+        return -1;
+    }
+    if (create_timeout_abs(LOOPBACK_WAIT_MS, &timeout_abs) != 0){
+        return -1;
+    }
+
+    //Wait for room for the whole burst
+    pthread_mutex_lock(&lb->lock);
+    while ((LOOPBACK_FIFO_LEN - (lb->in_head - lb->in_tail) < count ||
+            lb->burst_head - lb->burst_tail == LOOPBACK_MAX_BURSTS) && status == 0){
+        status = loopback_wait(lb, &timeout_abs);
+    }
+    pos = lb->in_head;
+    pthread_mutex_unlock(&lb->lock);
+    if (status != 0){
+        return status;
+    }
+
+    //Queue the burst as-is. The channel thread applies the impairments.
+    loopback_fifo_write(lb->in, pos, samples, count);
+
+    pthread_mutex_lock(&lb->lock);
+    lb->in_head = pos + count;
+    lb->bursts[lb->burst_head & (LOOPBACK_MAX_BURSTS - 1)] = count;
+    lb->burst_head++;
+    pthread_cond_broadcast(&lb->cond);
+    pthread_mutex_unlock(&lb->lock);
+    return 0;
+}
+
+static void loopback_free(struct loopback_io *lb)
+{
+    pthread_mutex_destroy(&lb->lock);
+    pthread_cond_destroy(&lb->cond);
+    free(lb->in);
+    free(lb->fifo);
+    free(lb->noise);
+    free(lb);
+}
+
+static void loopback_io_close(struct phy_io *io)
+{
+    struct loopback_io *lb = (struct loopback_io *) io->priv;
+
+    if (lb->thread_started){
+        pthread_mutex_lock(&lb->lock);
+        lb->stop = true;
+        pthread_cond_broadcast(&lb->cond);
+        pthread_mutex_unlock(&lb->lock);
+        pthread_join(lb->thread, NULL);
+    }
+    loopback_free(lb);
+}
+
+static const struct phy_io_fns loopback_io_fns = {
+    false,
+    NULL,
+    loopback_io_rx,
+    loopback_io_tx,
+    loopback_io_close,
+};
+
+struct phy_io *phy_io_open_loopback(const struct phy_io_channel *channel)
+{
+    struct loopback_io *lb;
+    struct phy_io *io;
+    double noise_std, u1, u2, r;
+    uint64_t prng;
+    size_t k;
+
+    if (channel->drop_rate < 0.0 || channel->drop_rate > 1.0){
+        fprintf(stderr, "[PHY] %s: Invalid drop rate: %f\n", __FUNCTION__,
+                channel->drop_rate);
+        return NULL;
+    }
+
+    lb = calloc(1, sizeof(*lb));
+    if (lb == NULL){
+        perror("[PHY] calloc");
+        return NULL;
+    }
+    lb->channel = *channel;
+    prng = (channel->seed != 0) ? channel->seed : PRNG_SEED;
+
+    if (pthread_mutex_init(&lb->lock, NULL) != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_mutex\n", __FUNCTION__);
+        free(lb);
+        return NULL;
+    }
+    if (pthread_cond_init(&lb->cond, NULL) != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread_cond\n", __FUNCTION__);
+        pthread_mutex_destroy(&lb->lock);
+        free(lb);
+        return NULL;
+    }
+
+    lb->in = malloc(2*LOOPBACK_FIFO_LEN * sizeof(lb->in[0]));
+    lb->fifo = malloc(2*LOOPBACK_FIFO_LEN * sizeof(lb->fifo[0]));
+    if (lb->in == NULL || lb->fifo == NULL){
+        perror("[PHY] malloc");
+        loopback_free(lb);
+        return NULL;
+    }
+
+    //Frequency offset phasor
+    lb->rot_i = 1.0;
+    lb->rot_q = 0.0;
+    lb->step_i = cos(2 * M_PI * channel->freq_offset / BLADERF_SAMPLE_RATE);
+    lb->step_q = sin(2 * M_PI * channel->freq_offset / BLADERF_SAMPLE_RATE);
+
+    //Gaussian noise table (Box-Muller). A full scale signal has a power of
+    //SAMP_MAX_ABS^2 = 2048^2, split between I and Q.
+    if (!isinf(channel->snr_db)){
+        lb->noise = malloc(2*LOOPBACK_NOISE_LEN * sizeof(lb->noise[0]));
+        if (lb->noise == NULL){
+            perror("[PHY] malloc");
+            loopback_free(lb);
+            return NULL;
+        }
+        noise_std = 2048.0 / sqrt(2.0 * pow(10.0, channel->snr_db / 10.0));
+        for (k = 0; k < LOOPBACK_NOISE_LEN; k++){
+            u1 = 1.0 - loopback_uniform(&prng);
+            u2 = loopback_uniform(&prng);
+            r = noise_std * sqrt(-2.0 * log(u1));
+            lb->noise[2*k] = clamp_sc16(r * cos(2 * M_PI * u2));
+            lb->noise[2*k+1] = clamp_sc16(r * sin(2 * M_PI * u2));
+        }
+    }
+    lb->chan_prng = prng_update(prng);
+    lb->rx_prng = prng_update(lb->chan_prng);
+
+    io = phy_io_alloc(&loopback_io_fns, lb);
+    if (io == NULL){
+        loopback_free(lb);
+        return NULL;
+    }
+
+    if (pthread_create(&lb->thread, NULL, loopback_channel, lb) != 0){
+        fprintf(stderr, "[PHY] %s: Couldn't start channel thread\n", __FUNCTION__);
+        phy_io_close(io);
+        return NULL;
+    }
+    lb->thread_started = true;
+
+    return io;
+}
+
+/****************************************
+ *                                      *
+ *              INTERFACE               *
+ *                                      *
+ ****************************************/
+
+int phy_io_configure(struct phy_io *io, struct radio_params *params)
+{
+    if (io->fns->configure == NULL){
+        return 0;
+    }
+    return io->fns->configure(io, params);
+}
+
+bool phy_io_is_realtime(const struct phy_io *io)
+{
+    return io->fns->realtime;
+}
+
+int phy_io_rx(struct phy_io *io, int16_t *samples, unsigned int count,
+              uint64_t *timestamp)
+{
+    return io->fns->rx(io, samples, count, timestamp);
+}
+
+int phy_io_tx(struct phy_io *io, const int16_t *samples, unsigned int count)
+{
+    return io->fns->tx(io, samples, count);
+}
+
+void phy_io_close(struct phy_io *io)
+{
+    if (io != NULL){
+        io->fns->close(io);
+        free(io);
+    }
+}
@@ -0,0 +1,175 @@
+/**
+ * @file
+ * @brief   Sample I/O for the physical layer
+ *
+ * The PHY transmits and receives SC16 Q11 samples through a phy_io handle, so
+ * that the modem may be run without a bladeRF. Three implementations are
+ * provided:
+ *
+ *  - bladeRF:  the libbladeRF synchronous interface, as used on the air
+ *  - file:     reads received samples from, and/or writes transmitted samples
+ *              to, raw SC16 Q11 files (interleaved little-endian int16 I/Q,
+ *              as written by bladeRF-cli's "rx config format=bin")
+ *  - loopback: transmitted samples are passed through a simulated channel
+ *              with AWGN, a frequency offset, and dropped samples, and are
+ *              then received by the same handle
+ *
+ * A bladeRF must be read promptly, or samples are lost. The file and loopback
+ * implementations are not real-time: they supply samples only as quickly as
+ * they are consumed, so the PHY waits for its pipeline rather than dropping
+ * samples. See phy_io_is_realtime().
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PHY_IO_H_
+#define PHY_IO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libbladeRF.h>
+
+#include "common.h"
+
+//Return values of phy_io_rx() and phy_io_tx(), other than 0 (success) and
+//-1 (failure)
+#define PHY_IO_TIMEOUT  1   //Nothing was transferred yet. Try again.
+#define PHY_IO_OVERRUN  2   //Samples were lost. The received block should be skipped.
+#define PHY_IO_EOF      3   //There are no more samples to receive
+
+//Number of idle (zero) samples written after each burst by the file and loopback
+//implementations, as the transmitter would be idle between bursts on the air
+#define PHY_IO_BURST_GAP 256
+
+/**
+ * Impairments applied by the loopback channel. See phy_io_open_loopback().
+ */
+struct phy_io_channel {
+    double snr_db;              //Signal to noise ratio of a full scale signal, in dB.
+                                //INFINITY for no noise.
+    double freq_offset;         //Frequency offset, in Hz at BLADERF_SAMPLE_RATE
+    double drop_rate;           //Probability (0.0 - 1.0) that a run of drop_len
+                                //samples is dropped from each transmitted burst
+    unsigned int drop_len;      //Number of samples in each dropped run
+    uint64_t seed;              //Seed for noise and drops. 0 selects a default.
+};
+
+/** Opaque handle to a sample I/O implementation */
+struct phy_io;
+
+/**
+ * Open a sample I/O handle which uses a bladeRF. The device is configured by
+ * phy_io_configure(), and is stopped (but not closed) by phy_io_close().
+ *
+ * @param[in]   dev     pointer to opened bladeRF device handle
+ *
+ * @return      phy_io handle on success, NULL on failure
+ */
+struct phy_io *phy_io_open_bladerf(struct bladerf *dev);
+
+/**
+ * Open a sample I/O handle which uses files
+ *
+ * Received samples are read from `rx_path`. Once the end of the file is
+ * reached, phy_io_rx() returns PHY_IO_EOF. Transmitted bursts are written to
+ * `tx_path`, each followed by PHY_IO_BURST_GAP zero-valued samples.
+ *
+ * @param[in]   rx_path     file to receive samples from, or NULL to receive
+ *                          nothing
+ * @param[in]   tx_path     file to write transmitted samples to, or NULL to
+ *                          discard them
+ *
+ * @return      phy_io handle on success, NULL on failure
+ */
+struct phy_io *phy_io_open_file(const char *rx_path, const char *tx_path);
+
+/**
+ * Open a sample I/O handle whose transmitted samples are received by itself
+ *
+ * Each transmitted burst has the frequency offset applied and, with
+ * probability drop_rate, a run of drop_len samples removed. It is then queued
+ * for reception, followed by PHY_IO_BURST_GAP zero-valued samples. If too
+ * little has been transmitted to fill a received block, the remainder of the
+ * block is zero-valued. Gaussian noise is added to every received sample.
+ *
+ * The impairments are applied by a thread belonging to the handle, so their
+ * cost is not included in the CPU time of the threads calling phy_io_tx() and
+ * phy_io_rx().
+ *
+ * Transmission waits while the channel's queue is full, and reception waits
+ * while it is empty, so no samples are lost other than those dropped
+ * deliberately.
+ *
+ * @param[in]   channel     channel impairments
+ *
+ * @return      phy_io handle on success, NULL on failure
+ */
+struct phy_io *phy_io_open_loopback(const struct phy_io_channel *channel);
+
+/**
+ * Configure the radio, if there is one
+ *
+ * @param[in]   io      phy_io handle
+ * @param[in]   params  radio parameters
+ *
+ * @return      0 on success, <0 on failure
+ */
+int phy_io_configure(struct phy_io *io, struct radio_params *params);
+
+/**
+ * @param[in]   io      phy_io handle
+ *
+ * @return      true if samples are lost when phy_io_rx() is not called promptly
+ */
+bool phy_io_is_realtime(const struct phy_io *io);
+
+/**
+ * Receive a block of samples
+ *
+ * @param[in]   io          phy_io handle
+ * @param[out]  samples     buffer of 2*count int16_t values
+ * @param[in]   count       number of samples to receive
+ * @param[out]  timestamp   timestamp of the first sample
+ *
+ * @return      0 on success, PHY_IO_TIMEOUT, PHY_IO_OVERRUN, or PHY_IO_EOF (see
+ *              above), or -1 on failure
+ */
+int phy_io_rx(struct phy_io *io, int16_t *samples, unsigned int count,
+              uint64_t *timestamp);
+
+/**
+ * Transmit a burst of samples
+ *
+ * @param[in]   io          phy_io handle
+ * @param[in]   samples     2*count int16_t values
+ * @param[in]   count       number of samples to transmit
+ *
+ * @return      0 on success, PHY_IO_TIMEOUT if nothing was transmitted, or -1
+ *              on failure
+ */
+int phy_io_tx(struct phy_io *io, const int16_t *samples, unsigned int count);
+
+/**
+ * Close a phy_io handle. Does nothing if handle is NULL
+ *
+ * @param[in]   io      phy_io handle to close
+ */
+void phy_io_close(struct phy_io *io);
+
+#endif
@@ -0,0 +1,630 @@
+/**
+ * @brief   Multi-channel physical layer receiver
+ *
+ * One capture thread receives blocks of wideband samples and channelizes them
+ * into a queue of blocks. Every worker thread processes every queued block, but
+ * only for its own channels; a block is reused once all workers are done with it.
+ * The per-channel processing is the same as that of phy.c's filter and demod
+ * stages.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "phy_mchan.h"
+#include "channelizer.h"
+#include "fir_filter.h"
+#include "rx_ch_filter.h"
+#include "rx_frontend.h"
+#include "pnorm.h"
+#include "prng.h"
+#include "rx_demod.h"
+#include "fsk.h"
+#include "frame_ring.h"
+#include "radio_config.h"
+
+#ifdef DEBUG_MODE
+    #define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__)
+    #ifndef ENABLE_NOTES
+        #define ENABLE_NOTES
+    #endif
+#else
+    #define DEBUG_MSG(...)
+#endif
+
+#ifdef ENABLE_NOTES
+    #define NOTE(...) fprintf(stderr, __VA_ARGS__)
+#else
+    #define NOTE(...)
+#endif
+
+//Receiver state of one channel. Used only by the worker which owns the channel,
+//apart from the ring and its synchronization variables.
+struct mchan_channel {
+    struct fir_filter *ch_filt;             //Channel filter
+    struct pnorm_state_t *pnorm;            //Power normalizer
+    struct fsk_handle *fsk;                 //Demodulator
+    struct rx_demod *demod;                 //Preamble correlator + demodulator
+    struct frame_ring *ring;                //received frames
+    pthread_cond_t buf_filled_cond;         //signaled when a frame is added to the ring
+    pthread_mutex_t buf_status_lock;        //mutex variable for buf_filled_cond
+    bool sync_init;                         //have the above been initialized
+    uint64_t rx_frames;                     //frames passed to the ring
+    uint64_t rx_frames_dropped;             //frames received while the ring was full
+};
+
+//A block of channelized samples. Channel k's samples start at
+//samples[k * NUM_SAMPLES_RX].
+struct mchan_block {
+    uint64_t timestamp;                     //timestamp of the first sample, at the
+                                            //channel sample rate
+    struct complex_sample *samples;
+};
+
+struct mchan_worker {
+    struct phy_mchan *m;
+    unsigned int index;
+    pthread_t thread;
+    uint64_t next_block;                    //number of blocks processed
+    struct complex_sample *filt_samples;    //intermediate samples (split front end)
+    struct complex_sample *samples;         //filtered, power normalized samples
+};
+
+struct phy_mchan {
+    struct phy_io *io;                      //sample I/O
+    struct channelizer *chan;               //splits wideband samples into channels
+    struct prng_scrambler *scrambler;       //shared, read-only
+    enum rx_frontend frontend;              //Filter + pnorm implementation
+    unsigned int num_channels;
+    unsigned int num_workers;
+    struct mchan_channel *channels;
+    struct mchan_worker workers[PHY_MCHAN_MAX_WORKERS];
+    int16_t *wide_samples;                  //a block of wideband samples
+    bool realtime;                          //drop blocks when the queue is full,
+                                            //rather than waiting for the workers
+    bool stop;                              //control variable to stop the threads
+    pthread_t capture_thread;
+    //Queue of channelized blocks. Block i is in blocks[i % PHY_MCHAN_BLOCKS].
+    struct mchan_block blocks[PHY_MCHAN_BLOCKS];
+    uint64_t num_blocks;                    //number of blocks queued
+    pthread_cond_t block_filled_cond;       //signaled when a block is queued
+    pthread_cond_t block_free_cond;         //signaled when a worker finishes a block
+    pthread_mutex_t block_lock;             //mutex variable for the above conditions
+    bool queue_init;                        //have the above been initialized
+    uint64_t rx_blocks;                     //wideband blocks received
+    uint64_t rx_blocks_dropped;             //wideband blocks lost or dropped
+};
+
+//Internal functions
+static void *mchan_capture(void *arg);
+static void *mchan_work(void *arg);
+
+/****************************************
+ *                                      *
+ *        INIT/DEINIT  FUNCTIONS        *
+ *                                      *
+ ****************************************/
+
+/**
+ * Allocate one channel's receiver
+ *
+ * @return      0 on success, -1 on failure
+ */
+static int init_channel(struct phy_mchan *m, struct mchan_channel *ch,
+                        unsigned int samp_per_symb)
+{
+    const float *ch_filter;
+    size_t ch_filter_len;
+
+    if (pthread_mutex_init(&ch->buf_status_lock, NULL) != 0 ||
+        pthread_cond_init(&ch->buf_filled_cond, NULL) != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread variables\n",
+                __FUNCTION__);
+        return -1;
+    }
+    ch->sync_init = true;
+    ch->ring = frame_ring_init(PHY_RX_RING_SLOTS, MAX_LINK_FRAME_SIZE);
+    if (ch->ring == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't allocate rx frame ring\n", __FUNCTION__);
+        return -1;
+    }
+    ch_filter = rx_ch_filter_for_sps(samp_per_symb, &ch_filter_len);
+    if (ch_filter == NULL){
+        fprintf(stderr, "[PHY] %s: Unsupported samples per symbol: %u\n", __FUNCTION__,
+                samp_per_symb);
+        return -1;
+    }
+    ch->ch_filt = fir_init(ch_filter, ch_filter_len);
+    if (ch->ch_filt == NULL){
+        fprintf(stderr, "[PHY] %s: Failed to create channel filter.\n", __FUNCTION__);
+        return -1;
+    }
+    ch->pnorm = pnorm_init(0.95f, 0.1f, 20.0f);
+    if (ch->pnorm == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't initialize power normalizer\n",
+                __FUNCTION__);
+        return -1;
+    }
+    ch->fsk = fsk_init_sps(samp_per_symb);
+    if (ch->fsk == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't open fsk handle\n", __FUNCTION__);
+        return -1;
+    }
+    ch->demod = rx_demod_init(ch->fsk, m->scrambler, ch->ring);
+    if (ch->demod == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't initialize demodulator\n", __FUNCTION__);
+        return -1;
+    }
+    return 0;
+}
+
+static void deinit_channel(struct mchan_channel *ch)
+{
+    rx_demod_deinit(ch->demod);
+    fsk_close(ch->fsk);
+    pnorm_deinit(ch->pnorm);
+    fir_deinit(ch->ch_filt);
+    frame_ring_deinit(ch->ring);
+    if (ch->sync_init){
+        pthread_mutex_destroy(&ch->buf_status_lock);
+        pthread_cond_destroy(&ch->buf_filled_cond);
+    }
+}
+
+struct phy_mchan *phy_mchan_init(struct phy_io *io, struct radio_params *params,
+                                 unsigned int num_workers)
+{
+    struct phy_mchan *m;
+    unsigned int num_channels;
+    unsigned int samp_per_symb;
+    unsigned int i;
+
+    if (io == NULL){
+        return NULL;
+    }
+    num_channels = (params->rx_channels == 0) ? 1 : params->rx_channels;
+    if (num_channels > CHANNELIZER_MAX_CHANNELS ||
+        (num_channels & (num_channels - 1)) != 0){
+        fprintf(stderr, "[PHY] %s: Invalid number of channels: %u\n", __FUNCTION__,
+                num_channels);
+        phy_io_close(io);
+        return NULL;
+    }
+    if (num_workers == 0 || num_workers > PHY_MCHAN_MAX_WORKERS){
+        fprintf(stderr, "[PHY] %s: Invalid number of workers: %u\n", __FUNCTION__,
+                num_workers);
+        phy_io_close(io);
+        return NULL;
+    }
+
+    //Calloc so all pointers are initialized to NULL
+    m = calloc(1, sizeof(*m));
+    if (m == NULL){
+        perror("[PHY] calloc");
+        phy_io_close(io);
+        return NULL;
+    }
+    m->io = io;
+    m->num_channels = num_channels;
+    m->num_workers = (num_workers < num_channels) ? num_workers : num_channels;
+    m->frontend = params->rx_frontend;
+    m->realtime = phy_io_is_realtime(io);
+    samp_per_symb = (params->samp_per_symb == 0) ? SAMP_PER_SYMB : params->samp_per_symb;
+
+    //Configure the radio (if any) for the combined bandwidth of all channels
+    if (phy_io_configure(m->io, params) != 0){
+        fprintf(stderr, "[PHY] %s: Couldn't configure bladeRF\n", __FUNCTION__);
+        goto error;
+    }
+
+    //Allocate the wideband receive buffer and the channelized block queue
+    if (pthread_mutex_init(&m->block_lock, NULL) != 0 ||
+        pthread_cond_init(&m->block_filled_cond, NULL) != 0 ||
+        pthread_cond_init(&m->block_free_cond, NULL) != 0){
+        fprintf(stderr, "[PHY] %s: Error initializing pthread variables\n",
+                __FUNCTION__);
+        goto error;
+    }
+    m->queue_init = true;
+    m->wide_samples = malloc(2 * (size_t) num_channels * NUM_SAMPLES_RX *
+                             sizeof(m->wide_samples[0]));
+    if (m->wide_samples == NULL){
+        perror("[PHY] malloc");
+        goto error;
+    }
+    for (i = 0; i < PHY_MCHAN_BLOCKS; i++){
+        m->blocks[i].samples = malloc((size_t) num_channels * NUM_SAMPLES_RX *
+                                      sizeof(struct complex_sample));
+        if (m->blocks[i].samples == NULL){
+            perror("[PHY] malloc");
+            goto error;
+        }
+    }
+    m->chan = channelizer_init(num_channels);
+    if (m->chan == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't initialize channelizer\n", __FUNCTION__);
+        goto error;
+    }
+
+    //Every channel uses the same scrambling sequence, which is only read
+    m->scrambler = prng_scrambler_init(PRNG_SEED, MAX_LINK_FRAME_SIZE);
+    if (m->scrambler == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't load scrambling sequence\n", __FUNCTION__);
+        goto error;
+    }
+
+    //Allocate each channel's receiver
+    m->channels = calloc(num_channels, sizeof(m->channels[0]));
+    if (m->channels == NULL){
+        perror("[PHY] calloc");
+        goto error;
+    }
+    for (i = 0; i < num_channels; i++){
+        if (init_channel(m, &m->channels[i], samp_per_symb) != 0){
+            goto error;
+        }
+    }
+
+    //Allocate each worker's buffers
+    for (i = 0; i < m->num_workers; i++){
+        m->workers[i].m = m;
+        m->workers[i].index = i;
+        m->workers[i].samples = malloc(NUM_SAMPLES_RX * sizeof(struct complex_sample));
+        if (m->workers[i].samples == NULL){
+            perror("[PHY] malloc");
+            goto error;
+        }
+        if (m->frontend == RX_FRONTEND_SPLIT){
+            m->workers[i].filt_samples =
+                malloc(NUM_SAMPLES_RX * sizeof(struct complex_sample));
+            if (m->workers[i].filt_samples == NULL){
+                perror("[PHY] malloc");
+                goto error;
+            }
+        }
+    }
+
+    DEBUG_MSG("[PHY] Multi-channel receiver: %u channels, %u workers\n",
+              m->num_channels, m->num_workers);
+    return m;
+
+    error:
+        phy_mchan_close(m);
+        return NULL;
+}
+
+void phy_mchan_close(struct phy_mchan *m)
+{
+    unsigned int i;
+
+    if (m == NULL){
+        return;
+    }
+    phy_io_close(m->io);
+    if (m->channels != NULL){
+        for (i = 0; i < m->num_channels; i++){
+            deinit_channel(&m->channels[i]);
+        }
+        free(m->channels);
+    }
+    for (i = 0; i < m->num_workers; i++){
+        free(m->workers[i].samples);
+        free(m->workers[i].filt_samples);
+    }
+    prng_scrambler_deinit(m->scrambler);
+    channelizer_deinit(m->chan);
+    for (i = 0; i < PHY_MCHAN_BLOCKS; i++){
+        free(m->blocks[i].samples);
+    }
+    free(m->wide_samples);
+    if (m->queue_init){
+        pthread_mutex_destroy(&m->block_lock);
+        pthread_cond_destroy(&m->block_filled_cond);
+        pthread_cond_destroy(&m->block_free_cond);
+    }
+    free(m);
+}
+
+unsigned int phy_mchan_num_channels(const struct phy_mchan *m)
+{
+    return m->num_channels;
+}
+
+/****************************************
+ *                                      *
+ *          RECEIVER FUNCTIONS          *
+ *                                      *
+ ****************************************/
+
+/**
+ * Wake every thread which is waiting on the block queue, so that it sees the stop
+ * signal
+ */
+static void wake_threads(struct phy_mchan *m)
+{
+    pthread_mutex_lock(&m->block_lock);
+    pthread_cond_broadcast(&m->block_filled_cond);
+    pthread_cond_broadcast(&m->block_free_cond);
+    pthread_mutex_unlock(&m->block_lock);
+}
+
+int phy_mchan_start(struct phy_mchan *m)
+{
+    unsigned int i, j;
+    int status;
+
+    m->stop = false;
+    //Start the workers first, so that they are waiting for the first block
+    for (i = 0; i < m->num_workers; i++){
+        status = pthread_create(&m->workers[i].thread, NULL, mchan_work,
+                                &m->workers[i]);
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Error creating worker thread: %s\n",
+                    __FUNCTION__, strerror(status));
+            goto error;
+        }
+    }
+    status = pthread_create(&m->capture_thread, NULL, mchan_capture, m);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error creating capture thread: %s\n",
+                __FUNCTION__, strerror(status));
+        goto error;
+    }
+    return 0;
+
+    error:
+        //Stop the workers which were started
+        m->stop = true;
+        wake_threads(m);
+        for (j = 0; j < i; j++){
+            pthread_join(m->workers[j].thread, NULL);
+        }
+        return -1;
+}
+
+int phy_mchan_stop(struct phy_mchan *m)
+{
+    unsigned int i;
+    int status, ret = 0;
+
+    DEBUG_MSG("[PHY] RX: Stopping multi-channel receiver...\n");
+    m->stop = true;
+    wake_threads(m);
+    status = pthread_join(m->capture_thread, NULL);
+    if (status != 0){
+        fprintf(stderr, "[PHY] %s: Error joining capture thread: %s\n", __FUNCTION__,
+                strerror(status));
+        ret = -1;
+    }
+    for (i = 0; i < m->num_workers; i++){
+        status = pthread_join(m->workers[i].thread, NULL);
+        if (status != 0){
+            fprintf(stderr, "[PHY] %s: Error joining worker thread: %s\n",
+                    __FUNCTION__, strerror(status));
+            ret = -1;
+        }
+    }
+    DEBUG_MSG("[PHY] RX: Multi-channel receiver stopped\n");
+    return ret;
+}
+
+uint8_t *phy_mchan_request_rx_buf(struct phy_mchan *m, unsigned int channel,
+                                  unsigned int timeout_ms)
+{
+    struct mchan_channel *ch;
+    struct timespec timeout_abs;
+    uint8_t *buf;
+    int status;
+
+    if (channel >= m->num_channels){
+        fprintf(stderr, "[PHY] %s: Invalid channel: %u\n", __FUNCTION__, channel);
+        return NULL;
+    }
+    ch = &m->channels[channel];
+    if (create_timeout_abs(timeout_ms, &timeout_abs) != 0){
+        fprintf(stderr, "[PHY] %s: Error creating timeout\n", __FUNCTION__);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ch->buf_status_lock);
+    while ((buf = frame_ring_read_slot(ch->ring, NULL)) == NULL){
+        status = pthread_cond_timedwait(&ch->buf_filled_cond, &ch->buf_status_lock,
+                                        &timeout_abs);
+        if (status != 0){
+            if (status != ETIMEDOUT){
+                fprintf(stderr, "[PHY] %s: Condition wait failed: %s\n",
+                        __FUNCTION__, strerror(status));
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ch->buf_status_lock);
+    return buf;
+}
+
+void phy_mchan_release_rx_buf(struct phy_mchan *m, unsigned int channel)
+{
+    frame_ring_release(m->channels[channel].ring);
+}
+
+void phy_mchan_get_stats(struct phy_mchan *m, unsigned int channel,
+                         struct phy_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->rx_blocks = m->rx_blocks;
+    stats->rx_blocks_dropped = m->rx_blocks_dropped;
+    stats->rx_frames = m->channels[channel].rx_frames;
+    stats->rx_frames_dropped = m->channels[channel].rx_frames_dropped;
+}
+
+/**
+ * @return  true if every worker has finished with the oldest queued block, so that
+ *          another may be queued. Called with block_lock held.
+ */
+static bool queue_has_room(struct phy_mchan *m)
+{
+    unsigned int i;
+
+    for (i = 0; i < m->num_workers; i++){
+        if (m->num_blocks - m->workers[i].next_block >= PHY_MCHAN_BLOCKS){
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Thread function which receives wideband samples and channelizes them into the
+ * block queue. If the workers fall so far behind that the queue is full, blocks
+ * from a real-time source are dropped. Otherwise, this thread waits for the
+ * workers.
+ *
+ * @param    arg        pointer to phy_mchan struct
+ */
+static void *mchan_capture(void *arg)
+{
+    struct phy_mchan *m = (struct phy_mchan *) arg;
+    struct complex_sample *outputs[CHANNELIZER_MAX_CHANNELS];
+    const unsigned int count = m->num_channels * NUM_SAMPLES_RX;
+    struct mchan_block *block;
+    uint64_t timestamp;
+    bool room;
+    unsigned int k;
+    int status;
+
+    while (!m->stop){
+        status = phy_io_rx(m->io, m->wide_samples, count, &timestamp);
+        if (status == PHY_IO_TIMEOUT){
+            continue;
+        }else if (status == PHY_IO_EOF){
+            DEBUG_MSG("[PHY] RX: End of input samples\n");
+            break;
+        }else if (status < 0){
+            fprintf(stderr, "[PHY] %s: Couldn't receive samples\n", __FUNCTION__);
+            break;
+        }
+        if (status == PHY_IO_OVERRUN){
+            NOTE("[PHY] %s: Got an overrun. Skipping these samples.\n", __FUNCTION__);
+            m->rx_blocks_dropped++;
+            //The channelizer's history no longer precedes the next block
+            channelizer_reset(m->chan);
+            continue;
+        }
+
+        //Wait for a free block, unless samples would be lost by doing so
+        pthread_mutex_lock(&m->block_lock);
+        while (!(room = queue_has_room(m)) && !m->realtime && !m->stop){
+            pthread_cond_wait(&m->block_free_cond, &m->block_lock);
+        }
+        pthread_mutex_unlock(&m->block_lock);
+        if (m->stop){
+            break;
+        }
+        if (!room){
+            NOTE("[PHY] %s: RX workers are behind. Dropping %u samples.\n",
+                        __FUNCTION__, count);
+            m->rx_blocks_dropped++;
+            channelizer_reset(m->chan);
+            continue;
+        }
+
+        //Channelize into the free block. count is a multiple of the number of
+        //channels, so each channel receives exactly NUM_SAMPLES_RX samples.
+        block = &m->blocks[m->num_blocks % PHY_MCHAN_BLOCKS];
+        for (k = 0; k < m->num_channels; k++){
+            outputs[k] = &block->samples[(size_t) k * NUM_SAMPLES_RX];
+        }
+        channelizer_process(m->chan, m->wide_samples, count, outputs);
+        block->timestamp = timestamp / m->num_channels;
+        m->rx_blocks++;
+
+        //Pass the block to the workers
+        pthread_mutex_lock(&m->block_lock);
+        m->num_blocks++;
+        pthread_cond_broadcast(&m->block_filled_cond);
+        pthread_mutex_unlock(&m->block_lock);
+    }
+    return NULL;
+}
+
+/**
+ * Thread function which filters, power normalizes, and demodulates each queued
+ * block for the worker's channels, and passes the received frames to the
+ * channels' rings
+ *
+ * @param    arg        pointer to mchan_worker struct
+ */
+static void *mchan_work(void *arg)
+{
+    struct mchan_worker *w = (struct mchan_worker *) arg;
+    struct phy_mchan *m = w->m;
+    struct mchan_block *block;
+    struct mchan_channel *ch;
+    uint64_t timestamp = UINT64_MAX;
+    unsigned int num_frames;
+    unsigned int k;
+    bool ready;
+
+    while (!m->stop){
+        //Wait for the next block
+        pthread_mutex_lock(&m->block_lock);
+        while (!(ready = (w->next_block < m->num_blocks)) && !m->stop){
+            pthread_cond_wait(&m->block_filled_cond, &m->block_lock);
+        }
+        pthread_mutex_unlock(&m->block_lock);
+        if (!ready){
+            //Stopping
+            break;
+        }
+        block = &m->blocks[w->next_block % PHY_MCHAN_BLOCKS];
+        //Blocks dropped by the capture thread show up as a gap in timestamps
+        if (timestamp != UINT64_MAX && block->timestamp != timestamp+NUM_SAMPLES_RX){
+            NOTE("[PHY] %s: Unexpected timestamp. Expected %lu, got %lu.\n",
+                    __FUNCTION__, timestamp+NUM_SAMPLES_RX, block->timestamp);
+        }
+        timestamp = block->timestamp;
+
+        for (k = w->index; k < m->num_channels; k += m->num_workers){
+            ch = &m->channels[k];
+            //struct complex_sample has the same layout as interleaved SC16 Q11
+            rx_frontend_process(m->frontend, ch->ch_filt, ch->pnorm,
+                                (const int16_t *) &block->samples[(size_t) k *
+                                                                  NUM_SAMPLES_RX],
+                                NUM_SAMPLES_RX, w->filt_samples, w->samples);
+            num_frames = rx_demod_block(ch->demod, w->samples, NUM_SAMPLES_RX,
+                                        &ch->rx_frames_dropped);
+            if (num_frames > 0){
+                ch->rx_frames += num_frames;
+                pthread_mutex_lock(&ch->buf_status_lock);
+                pthread_cond_signal(&ch->buf_filled_cond);
+                pthread_mutex_unlock(&ch->buf_status_lock);
+                DEBUG_MSG("[PHY] RX: Frame ready on channel %u\n", k);
+            }
+        }
+
+        //Return the block to the capture thread
+        pthread_mutex_lock(&m->block_lock);
+        w->next_block++;
+        pthread_cond_signal(&m->block_free_cond);
+        pthread_mutex_unlock(&m->block_lock);
+    }
+    return NULL;
+}
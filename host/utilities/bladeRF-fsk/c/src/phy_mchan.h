@@ -0,0 +1,140 @@
+/**
+ * @file
+ * @brief   Multi-channel physical layer receiver
+ *
+ * Receives N adjacent FSK channels at once. The radio is tuned to the center of
+ * the band and sampled at N * BLADERF_SAMPLE_RATE (see radio_params.rx_channels).
+ * A polyphase channelizer splits each block of wideband samples into N blocks of
+ * NUM_SAMPLES_RX samples at BLADERF_SAMPLE_RATE, one per channel. Channel k is
+ * centered k * BLADERF_SAMPLE_RATE Hz (k < N/2) or (k - N) * BLADERF_SAMPLE_RATE Hz
+ * (k >= N/2) from radio_params.rx_freq.
+ *
+ * Each channel has its own channel filter, power normalizer, correlator,
+ * demodulator, and rx frame ring, exactly as the single channel PHY does. The
+ * channels are divided among a number of worker threads: worker w processes
+ * every channel c for which c % num_workers == w.
+ *
+ * This is a receiver only; frames are transmitted with the single channel PHY.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PHY_MCHAN_H_
+#define PHY_MCHAN_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "phy.h"
+#include "phy_io.h"
+
+//Number of channelized blocks queued between the capture thread and the workers
+#define PHY_MCHAN_BLOCKS 4
+
+//Maximum number of worker threads
+#define PHY_MCHAN_MAX_WORKERS 16
+
+/** Opaque handle to a multi-channel receiver */
+struct phy_mchan;
+
+/**
+ * Open a multi-channel receiver. The number of channels is taken from
+ * params->rx_channels, and must be a power of 2 no greater than
+ * CHANNELIZER_MAX_CHANNELS. The radio, if any, is configured with phy_io_configure().
+ *
+ * @param[in]   io              sample I/O handle. Closed by phy_mchan_close(), or
+ *                              on failure.
+ * @param[in]   params          radio parameters
+ * @param[in]   num_workers     number of demodulator threads, from 1 to
+ *                              PHY_MCHAN_MAX_WORKERS. Values greater than the
+ *                              number of channels are reduced to it.
+ *
+ * @return      multi-channel receiver handle on success, NULL on failure
+ */
+struct phy_mchan *phy_mchan_init(struct phy_io *io, struct radio_params *params,
+                                 unsigned int num_workers);
+
+/**
+ * Close a multi-channel receiver, which must be stopped, and its phy_io handle.
+ * Does nothing if m is NULL.
+ *
+ * @param[in]   m       multi-channel receiver
+ */
+void phy_mchan_close(struct phy_mchan *m);
+
+/**
+ * @param[in]   m       multi-channel receiver
+ *
+ * @return      number of channels
+ */
+unsigned int phy_mchan_num_channels(const struct phy_mchan *m);
+
+/**
+ * Start the capture and worker threads
+ *
+ * @param[in]   m       multi-channel receiver
+ *
+ * @return      0 on success, -1 on failure
+ */
+int phy_mchan_start(struct phy_mchan *m);
+
+/**
+ * Stop the capture and worker threads
+ *
+ * @param[in]   m       multi-channel receiver
+ *
+ * @return      0 on success, -1 on failure
+ */
+int phy_mchan_stop(struct phy_mchan *m);
+
+/**
+ * Wait for a frame received on a channel. The frame remains valid until it is
+ * released with phy_mchan_release_rx_buf(). Frames of different channels may be
+ * requested from different threads.
+ *
+ * @param[in]   m           multi-channel receiver
+ * @param[in]   channel     channel number
+ * @param[in]   timeout_ms  time to wait for a frame
+ *
+ * @return      pointer to the received frame, or NULL on timeout or failure
+ */
+uint8_t *phy_mchan_request_rx_buf(struct phy_mchan *m, unsigned int channel,
+                                  unsigned int timeout_ms);
+
+/**
+ * Release the frame returned by the last phy_mchan_request_rx_buf() call for
+ * a channel
+ *
+ * @param[in]   m           multi-channel receiver
+ * @param[in]   channel     channel number
+ */
+void phy_mchan_release_rx_buf(struct phy_mchan *m, unsigned int channel);
+
+/**
+ * Get a channel's receive counters. Block counts are shared by all channels. CPU
+ * times are not measured (stats->cpu_time_valid is false).
+ *
+ * @param[in]   m           multi-channel receiver
+ * @param[in]   channel     channel number
+ * @param[out]  stats       counters
+ */
+void phy_mchan_get_stats(struct phy_mchan *m, unsigned int channel,
+                         struct phy_stats *stats);
+
+#endif
@@ -27,10 +27,27 @@
 #include <assert.h>
 #include <stdio.h>
 #include <math.h>
+#include <float.h>
 #include "host_config.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define PNORM_USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   include <arm_neon.h>
+#endif
+
 #include "pnorm.h"
 
+//Output samples at or above this power (normalized) are blanked
+#define BLANK_PWR 10
+
+//Clamping bounds the output power to 2*CLAMP_VAL_ABS^2, so blanking cannot occur
+//unless this is at least BLANK_PWR. pnorm_block() relies upon this to skip the check.
+#if 2*CLAMP_VAL_ABS*CLAMP_VAL_ABS >= BLANK_PWR*SAMP_MAX_ABS*SAMP_MAX_ABS
+#   error "pnorm_block() does not implement impulse blanking"
+#endif
+
 struct pnorm_state_t {
     float est ;            //Estimate of signal power (essentially a running average)
     bool hold ;            //Hold the current gain?
@@ -38,6 +55,16 @@ struct pnorm_state_t {
     float invalpha ;
     float min_gain ;
     float max_gain ;
+
+    //pnorm_block() parameters
+    unsigned int block_len ;
+    //Weight of each sample's power in the estimate at the end of a sub-block:
+    //invalpha * alpha^(block_len-1-k) / SAMP_MAX_ABS^2
+    float weights[PNORM_MAX_BLOCK_LEN] ;
+    //alpha^k: Weight of the previous estimate after k samples
+    float decay[PNORM_MAX_BLOCK_LEN + 1] ;
+    //weights[], with each weight duplicated for I and Q, for pnorm_block_float()
+    float weights_iq[2*PNORM_MAX_BLOCK_LEN] ;
 } ;
 
 struct pnorm_state_t *pnorm_init(float alpha, float min_gain, float max_gain) {
@@ -56,6 +83,8 @@ struct pnorm_state_t *pnorm_init(float alpha, float min_gain, float max_gain) {
     state->min_gain = min_gain ;
     state->max_gain = max_gain ;
 
+    pnorm_set_block_len(state, PNORM_DEFAULT_BLOCK_LEN) ;
+
     return state ;
 }
 
@@ -74,9 +103,35 @@ void pnorm_hold(struct pnorm_state_t *state, bool val) {
     return ;
 }
 
-void pnorm(struct pnorm_state_t *state, uint16_t length, struct complex_sample *in,
+int pnorm_set_block_len(struct pnorm_state_t *state, unsigned int block_len) {
+    unsigned int k ;
+    double w ;
+
+    if( block_len < 1 || block_len > PNORM_MAX_BLOCK_LEN ) {
+        fprintf(stderr, "Invalid pnorm block length: %u\n", block_len) ;
+        return -1 ;
+    }
+
+    state->block_len = block_len ;
+
+    w = 1.0 ;
+    for( k = 0 ; k <= block_len ; k++ ) {
+        state->decay[k] = (float) w ;
+        w *= state->alpha ;
+    }
+
+    for( k = 0 ; k < block_len ; k++ ) {
+        state->weights[k] = state->invalpha * state->decay[block_len - 1 - k] /
+                                (float) (SAMP_MAX_ABS*SAMP_MAX_ABS) ;
+        state->weights_iq[2*k] = state->weights_iq[2*k + 1] = state->weights[k] ;
+    }
+
+    return 0 ;
+}
+
+void pnorm(struct pnorm_state_t *state, size_t length, struct complex_sample *in,
             struct complex_sample *out, float *ests, float *gains) {
-    int i ;
+    size_t i ;
     float power;
     int32_t temp;
     float gain, est;
@@ -126,7 +181,7 @@ void pnorm(struct pnorm_state_t *state, uint16_t length, struct complex_sample *
 
         /* Blank impulse power */
         power = (out[i].i * out[i].i + out[i].q * out[i].q)/(float)(SAMP_MAX_ABS*SAMP_MAX_ABS);
-        if (power >= 10.0f) {
+        if (power >= BLANK_PWR) {
             out[i].i = out[i].q = 0;
         }
 
@@ -141,6 +196,315 @@ void pnorm(struct pnorm_state_t *state, uint16_t length, struct complex_sample *
     return ;
 }
 
+/* Sum of the power of each of 'n' samples, multiplied by the corresponding weight */
+static inline float weighted_power(const struct complex_sample *in, const float *w,
+                                   size_t n) {
+    size_t k = 0 ;
+    float acc ;
+
+#if defined(PNORM_USE_SSE2)
+    __m128 sum = _mm_setzero_ps() ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        //i*i + q*q for 4 samples
+        const __m128i x = _mm_loadu_si128((const __m128i *) &in[k]) ;
+        const __m128 p = _mm_cvtepi32_ps(_mm_madd_epi16(x, x)) ;
+        sum = _mm_add_ps(sum, _mm_mul_ps(p, _mm_loadu_ps(&w[k]))) ;
+    }
+
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum)) ;
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)) ;
+    acc = _mm_cvtss_f32(sum) ;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t sum = vdupq_n_f32(0.0f) ;
+    float32x2_t sum2 ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        const int16x4x2_t x = vld2_s16((const int16_t *) &in[k]) ;
+        int32x4_t p = vmull_s16(x.val[0], x.val[0]) ;
+        p = vmlal_s16(p, x.val[1], x.val[1]) ;
+        sum = vmlaq_f32(sum, vcvtq_f32_s32(p), vld1q_f32(&w[k])) ;
+    }
+
+    sum2 = vadd_f32(vget_low_f32(sum), vget_high_f32(sum)) ;
+    acc = vget_lane_f32(vpadd_f32(sum2, sum2), 0) ;
+#else
+    acc = 0.0f ;
+#endif
+
+    for( ; k < n ; k++ ) {
+        acc += (in[k].i*in[k].i + in[k].q*in[k].q) * w[k] ;
+    }
+
+    return acc ;
+}
+
+/* As weighted_power(), for 'n' samples of interleaved float I/Q. 'w' holds each
+ * weight twice, once for I and once for Q. */
+static inline float weighted_power_float(const float *in, const float *w, size_t n) {
+    size_t k = 0 ;
+    float acc ;
+
+    n *= 2 ;
+
+#if defined(PNORM_USE_SSE2)
+    __m128 sum0 = _mm_setzero_ps() ;
+    __m128 sum1 = _mm_setzero_ps() ;
+
+    for( ; k + 8 <= n ; k += 8 ) {
+        const __m128 x0 = _mm_loadu_ps(&in[k]) ;
+        const __m128 x1 = _mm_loadu_ps(&in[k + 4]) ;
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_mul_ps(x0, x0), _mm_loadu_ps(&w[k]))) ;
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_mul_ps(x1, x1), _mm_loadu_ps(&w[k + 4]))) ;
+    }
+
+    sum0 = _mm_add_ps(sum0, sum1) ;
+    sum0 = _mm_add_ps(sum0, _mm_movehl_ps(sum0, sum0)) ;
+    sum0 = _mm_add_ss(sum0, _mm_shuffle_ps(sum0, sum0, 1)) ;
+    acc = _mm_cvtss_f32(sum0) ;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t sum0 = vdupq_n_f32(0.0f) ;
+    float32x4_t sum1 = vdupq_n_f32(0.0f) ;
+    float32x2_t sum2 ;
+
+    for( ; k + 8 <= n ; k += 8 ) {
+        const float32x4_t x0 = vld1q_f32(&in[k]) ;
+        const float32x4_t x1 = vld1q_f32(&in[k + 4]) ;
+        sum0 = vmlaq_f32(sum0, vmulq_f32(x0, x0), vld1q_f32(&w[k])) ;
+        sum1 = vmlaq_f32(sum1, vmulq_f32(x1, x1), vld1q_f32(&w[k + 4])) ;
+    }
+
+    sum0 = vaddq_f32(sum0, sum1) ;
+    sum2 = vadd_f32(vget_low_f32(sum0), vget_high_f32(sum0)) ;
+    acc = vget_lane_f32(vpadd_f32(sum2, sum2), 0) ;
+#else
+    acc = 0.0f ;
+#endif
+
+    for( ; k < n ; k++ ) {
+        acc += in[k] * in[k] * w[k] ;
+    }
+
+    return acc ;
+}
+
+/* Approximate 1/sqrt(x), for x > 0 */
+static inline float rsqrt(float x) {
+#if defined(PNORM_USE_SSE2)
+    const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x))) ;
+    //One Newton-Raphson step
+    return y * (1.5f - 0.5f * x * y * y) ;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x2_t v = vdup_n_f32(x) ;
+    float32x2_t y = vrsqrte_f32(v) ;
+    y = vmul_f32(y, vrsqrts_f32(vmul_f32(v, y), y)) ;
+    return vget_lane_f32(y, 0) ;
+#else
+    return 1.0f/sqrtf(x) ;
+#endif
+}
+
+/* Scale and clamp a single value, rounding to nearest (ties to even) */
+static inline int16_t scale_clamp(float val, float gain) {
+    int32_t temp = (int32_t) lrintf(val * gain) ;
+
+    if (temp > CLAMP_VAL_ABS){
+        temp = CLAMP_VAL_ABS;
+    }else if (temp < -CLAMP_VAL_ABS){
+        temp = -CLAMP_VAL_ABS;
+    }
+    return (int16_t) temp ;
+}
+
+/* Apply 'gain' to 'n' samples, clamping to +/- CLAMP_VAL_ABS. The scaled values must
+ * fit within an int32_t, which holds for any gain below 65536. */
+static inline void apply_gain(const struct complex_sample *in,
+                              struct complex_sample *out, size_t n, float gain) {
+    size_t k = 0 ;
+
+#if defined(PNORM_USE_SSE2)
+    const __m128 g = _mm_set1_ps(gain) ;
+    const __m128i hi = _mm_set1_epi16(CLAMP_VAL_ABS) ;
+    const __m128i lo = _mm_set1_epi16(-CLAMP_VAL_ABS) ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        const __m128i x = _mm_loadu_si128((const __m128i *) &in[k]) ;
+        //Sign-extend to 32 bits, scale, and round
+        const __m128i x0 = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16) ;
+        const __m128i x1 = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16) ;
+        const __m128i y0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(x0), g)) ;
+        const __m128i y1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(x1), g)) ;
+        //Saturate to 16 bits, then clamp
+        __m128i y = _mm_packs_epi32(y0, y1) ;
+        y = _mm_max_epi16(_mm_min_epi16(y, hi), lo) ;
+        _mm_storeu_si128((__m128i *) &out[k], y) ;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t g = vdupq_n_f32(gain) ;
+    const int16x8_t hi = vdupq_n_s16(CLAMP_VAL_ABS) ;
+    const int16x8_t lo = vdupq_n_s16(-CLAMP_VAL_ABS) ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        const int16x8_t x = vld1q_s16((const int16_t *) &in[k]) ;
+        const float32x4_t f0 = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), g) ;
+        const float32x4_t f1 = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), g) ;
+        int32x4_t y0, y1 ;
+        int16x8_t y ;
+
+#   if defined(__aarch64__)
+        y0 = vcvtnq_s32_f32(f0) ;
+        y1 = vcvtnq_s32_f32(f1) ;
+#   else
+        //Round half away from zero
+        y0 = vcvtq_s32_f32(vaddq_f32(f0, vbslq_f32(vcltq_f32(f0, vdupq_n_f32(0.0f)),
+                                vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)))) ;
+        y1 = vcvtq_s32_f32(vaddq_f32(f1, vbslq_f32(vcltq_f32(f1, vdupq_n_f32(0.0f)),
+                                vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)))) ;
+#   endif
+        //Saturate to 16 bits, then clamp
+        y = vcombine_s16(vqmovn_s32(y0), vqmovn_s32(y1)) ;
+        y = vmaxq_s16(vminq_s16(y, hi), lo) ;
+        vst1q_s16((int16_t *) &out[k], y) ;
+    }
+#endif
+
+    for( ; k < n ; k++ ) {
+        out[k].i = scale_clamp(in[k].i, gain) ;
+        out[k].q = scale_clamp(in[k].q, gain) ;
+    }
+}
+
+/* As apply_gain(), for 'n' samples of interleaved float I/Q */
+static inline void apply_gain_float(const float *in, struct complex_sample *out,
+                                    size_t n, float gain) {
+    size_t k = 0 ;
+
+#if defined(PNORM_USE_SSE2)
+    const __m128 g = _mm_set1_ps(gain) ;
+    const __m128i hi = _mm_set1_epi16(CLAMP_VAL_ABS) ;
+    const __m128i lo = _mm_set1_epi16(-CLAMP_VAL_ABS) ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        //Scale and round 4 samples
+        const __m128i y0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[2*k]), g)) ;
+        const __m128i y1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(&in[2*k + 4]), g)) ;
+        //Saturate to 16 bits, then clamp
+        __m128i y = _mm_packs_epi32(y0, y1) ;
+        y = _mm_max_epi16(_mm_min_epi16(y, hi), lo) ;
+        _mm_storeu_si128((__m128i *) &out[k], y) ;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    const float32x4_t g = vdupq_n_f32(gain) ;
+    const int16x8_t hi = vdupq_n_s16(CLAMP_VAL_ABS) ;
+    const int16x8_t lo = vdupq_n_s16(-CLAMP_VAL_ABS) ;
+
+    for( ; k + 4 <= n ; k += 4 ) {
+        const float32x4_t f0 = vmulq_f32(vld1q_f32(&in[2*k]), g) ;
+        const float32x4_t f1 = vmulq_f32(vld1q_f32(&in[2*k + 4]), g) ;
+        int32x4_t y0, y1 ;
+        int16x8_t y ;
+
+#   if defined(__aarch64__)
+        y0 = vcvtnq_s32_f32(f0) ;
+        y1 = vcvtnq_s32_f32(f1) ;
+#   else
+        //Round half away from zero
+        y0 = vcvtq_s32_f32(vaddq_f32(f0, vbslq_f32(vcltq_f32(f0, vdupq_n_f32(0.0f)),
+                                vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)))) ;
+        y1 = vcvtq_s32_f32(vaddq_f32(f1, vbslq_f32(vcltq_f32(f1, vdupq_n_f32(0.0f)),
+                                vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f)))) ;
+#   endif
+        //Saturate to 16 bits, then clamp
+        y = vcombine_s16(vqmovn_s32(y0), vqmovn_s32(y1)) ;
+        y = vmaxq_s16(vminq_s16(y, hi), lo) ;
+        vst1q_s16((int16_t *) &out[k], y) ;
+    }
+#endif
+
+    for( ; k < n ; k++ ) {
+        out[k].i = scale_clamp(in[2*k], gain) ;
+        out[k].q = scale_clamp(in[2*k + 1], gain) ;
+    }
+}
+
+/* Gain for the current power estimate, limited to [min_gain, max_gain] */
+static inline float block_gain(const struct pnorm_state_t *state) {
+    float gain ;
+
+    /* Ideal power is 1.0, so to get x to 1.0, we need to multiply by 1/est */
+    gain = rsqrt(state->est > FLT_MIN ? state->est : FLT_MIN) ;
+    gain = gain < state->min_gain ? state->min_gain : gain ;
+    gain = gain > state->max_gain ? state->max_gain : gain ;
+
+    return gain ;
+}
+
+/* Write the estimate and gain used for a sub-block to the optional debug buffers */
+static inline void write_debug(float *ests, float *gains, size_t pos, size_t n,
+                               float est, float gain) {
+    size_t k ;
+
+    if( ests != NULL ) {
+        for( k = 0 ; k < n ; k++ ) {
+            ests[pos + k] = est ;
+        }
+    }
+    if( gains != NULL ) {
+        for( k = 0 ; k < n ; k++ ) {
+            gains[pos + k] = gain ;
+        }
+    }
+}
+
+void pnorm_block(struct pnorm_state_t *state, size_t length,
+                 const struct complex_sample *in, struct complex_sample *out,
+                 float *ests, float *gains) {
+    size_t pos, n ;
+    float gain ;
+
+    for( pos = 0 ; pos < length ; pos += n ) {
+        n = length - pos ;
+        if( n > state->block_len ) {
+            n = state->block_len ;
+        }
+
+        /* Power IIR filter, advanced by n samples */
+        if( state->hold == false ) {
+            state->est = state->decay[n] * state->est +
+                weighted_power(&in[pos], &state->weights[state->block_len - n], n) ;
+        }
+
+        gain = block_gain(state) ;
+        apply_gain(&in[pos], &out[pos], n, gain) ;
+        write_debug(ests, gains, pos, n, state->est, gain) ;
+    }
+}
+
+void pnorm_block_float(struct pnorm_state_t *state, size_t length,
+                       const float *in, struct complex_sample *out,
+                       float *ests, float *gains) {
+    size_t pos, n ;
+    float gain ;
+
+    for( pos = 0 ; pos < length ; pos += n ) {
+        n = length - pos ;
+        if( n > state->block_len ) {
+            n = state->block_len ;
+        }
+
+        /* Power IIR filter, advanced by n samples */
+        if( state->hold == false ) {
+            state->est = state->decay[n] * state->est +
+                weighted_power_float(&in[2*pos],
+                                     &state->weights_iq[2*(state->block_len - n)], n) ;
+        }
+
+        gain = block_gain(state) ;
+        apply_gain_float(&in[2*pos], &out[pos], n, gain) ;
+        write_debug(ests, gains, pos, n, state->est, gain) ;
+    }
+}
+
 #ifdef PNORM_TEST
 
 #define NUM_SAMPLES 4000
@@ -155,13 +519,20 @@ int main(int argc, char *argv[]) {
     struct pnorm_state_t *state ;
     float alpha, min_gain, max_gain ;
     unsigned int count, i ;
+    unsigned int block_len = 0 ;
     int result;
 
     if( argc < 6 ) {
-        fprintf(stderr, "Usage: %s <alpha> <min gain> <max gain> <input csv> <output csv>\n", argv[0]) ;
+        fprintf(stderr, "Usage: %s <alpha> <min gain> <max gain> <input csv> <output csv> "
+                        "[block length]\n", argv[0]) ;
+        fprintf(stderr, "If a block length is given, pnorm_block() is used.\n") ;
         return 1 ;
     }
 
+    if( argc > 6 ) {
+        block_len = (unsigned int) atoi(argv[6]) ;
+    }
+
     fin = fopen( argv[4], "r" ) ;
     if( fin == NULL ) {
         fprintf( stderr, "Couldn't open %s\n for input csv",argv[2] ) ;
@@ -178,16 +549,24 @@ int main(int argc, char *argv[]) {
     max_gain = (float) atof(argv[3]) ;
 
     state = pnorm_init(alpha, min_gain, max_gain) ;
+    if( block_len != 0 && pnorm_set_block_len(state, block_len) != 0 ) {
+        return 1 ;
+    }
+
     while (!feof(fin)) {
         count = 0 ;
-        while( count < sizeof(input) && !feof(fin) ) {
+        while( count < NUM_SAMPLES && !feof(fin) ) {
             result = fscanf( fin, "%hi,%hi\n", &input[count].i, &input[count].q ) ;
             if (result == EOF){
                 break;
             }
             count++ ;
         }
-        pnorm( state, count, input, output, est, gain ) ;
+        if( block_len != 0 ) {
+            pnorm_block( state, count, input, output, est, gain ) ;
+        } else {
+            pnorm( state, count, input, output, est, gain ) ;
+        }
         for( i = 0 ; i < count ; i++ ) {
             fprintf( fout, "%hi,%hi,%15.9f,%15.9f\n", output[i].i,
                     output[i].q, est[i], gain[i] ) ;
@@ -23,6 +23,7 @@
 #ifndef PNORM_H_
 #define PNORM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "common.h"    //For struct complex_sample
@@ -30,6 +31,10 @@
 #define SAMP_MAX_ABS 2048
 #define CLAMP_VAL_ABS 3072
 
+//Default and maximum number of samples per sub-block for pnorm_block()
+#define PNORM_DEFAULT_BLOCK_LEN 16
+#define PNORM_MAX_BLOCK_LEN 256
+
 struct pnorm_state_t ;
 
 struct pnorm_state_t *pnorm_init(float alpha, float min_gain, float max_gain) ;
@@ -37,12 +42,46 @@ void pnorm_reset(struct pnorm_state_t *state) ;
 void pnorm_deinit(struct pnorm_state_t *state) ;
 void pnorm_hold(struct pnorm_state_t *state, bool val) ;
 
+/**
+ * Set the number of samples per sub-block used by pnorm_block()
+ *
+ * @param   state       pnorm state
+ * @param   block_len   Sub-block length, from 1 to PNORM_MAX_BLOCK_LEN
+ *
+ * @return  0 on success, -1 if block_len is out of range
+ */
+int pnorm_set_block_len(struct pnorm_state_t *state, unsigned int block_len) ;
+
 /**
  * Power normalize a set of samples.
  * The 'ests' and 'gains' output buffers are for extra debug information. If they are NULL,
  * the function will not attempt to place values in them.
  */
-void pnorm(struct pnorm_state_t *state, uint16_t length, struct complex_sample *in,
+void pnorm(struct pnorm_state_t *state, size_t length, struct complex_sample *in,
             struct complex_sample *out, float *est, float *gain);
 
+/**
+ * Power normalize a set of samples, updating the gain once per sub-block
+ * (see pnorm_set_block_len()) rather than once per sample.
+ *
+ * The power estimate at the end of each sub-block is the same as that computed by
+ * pnorm(), and the gain derived from it is applied to every sample in the sub-block.
+ * The gain is applied with vectorized, saturating arithmetic.
+ *
+ * The 'ests' and 'gains' output buffers are optional, and may be NULL. When provided,
+ * they receive the estimate and gain used for each sample.
+ */
+void pnorm_block(struct pnorm_state_t *state, size_t length,
+                 const struct complex_sample *in, struct complex_sample *out,
+                 float *ests, float *gains);
+
+/**
+ * Power normalize a set of samples as pnorm_block() does, taking unrounded input
+ * samples as interleaved float I/Q (e.g., from fir_process_block_float()). The
+ * output is rounded and clamped to SC16Q11 in the same manner as pnorm_block().
+ */
+void pnorm_block_float(struct pnorm_state_t *state, size_t length,
+                       const float *in, struct complex_sample *out,
+                       float *ests, float *gains);
+
 #endif
@@ -23,21 +23,19 @@
  */
 #include "prng.h"
 
-uint8_t * prng_fill(uint64_t *state_inout, size_t len)
+#include <string.h>
+
+struct prng_scrambler {
+    uint64_t *words;    /* Sequence, stored as bytes in prng_fill() order */
+    size_t len;         /* Length of the sequence, in bytes */
+};
+
+/* Fill `buf` with `len` bytes of PRNG output */
+static void prng_fill_buf(uint64_t state, uint8_t *buf, size_t len)
 {
     size_t i;
     size_t to_fill;
-    uint8_t *ret, *curr;
-    uint64_t state = *state_inout;
-
-    assert(state != 0);
-
-    ret = malloc(len);
-    if (!ret) {
-        return NULL;
-    }
-
-    curr = ret;
+    uint8_t *curr = buf;
 
     /* Fill 64-bit words first */
     to_fill = (len / 8) * 8;
@@ -64,16 +62,243 @@ uint8_t * prng_fill(uint64_t *state_inout, size_t len)
             curr++;
         }
     }
+}
+
+uint8_t * prng_fill(uint64_t *state_inout, size_t len)
+{
+    uint8_t *ret;
+
+    assert(*state_inout != 0);
+
+    ret = malloc(len);
+    if (!ret) {
+        return NULL;
+    }
+
+    prng_fill_buf(*state_inout, ret, len);
 
     return ret;
 }
 
+struct prng_scrambler * prng_scrambler_init(uint64_t seed, size_t max_len)
+{
+    struct prng_scrambler *s;
+    size_t num_words = (max_len + 7) / 8;
+
+    assert(seed != 0);
+
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+
+    /* Round up to whole words, so the final word may always be read */
+    s->words = calloc(num_words ? num_words : 1, sizeof(uint64_t));
+    if (!s->words) {
+        free(s);
+        return NULL;
+    }
+
+    prng_fill_buf(seed, (uint8_t *) s->words, max_len);
+    s->len = max_len;
+
+    return s;
+}
+
+void prng_scrambler_deinit(struct prng_scrambler *s)
+{
+    if (s) {
+        free(s->words);
+        free(s);
+    }
+}
+
+void prng_scrambler_apply(const struct prng_scrambler *s,
+                          uint8_t *data, size_t len)
+{
+    size_t i;
+    size_t num_words = len / 8;
+    const uint8_t *seq = (const uint8_t *) s->words;
+    uint64_t word;
+
+    assert(len <= s->len);
+
+    /* The sequence is stored in byte order, so XORing native words yields
+     * the same result as XORing bytes, regardless of endianness. memcpy()
+     * permits unaligned frames, and compiles to plain loads and stores. */
+    for (i = 0; i < num_words; i++) {
+        memcpy(&word, &data[i * 8], sizeof(word));
+        word ^= s->words[i];
+        memcpy(&data[i * 8], &word, sizeof(word));
+    }
+
+    for (i = num_words * 8; i < len; i++) {
+        data[i] ^= seq[i];
+    }
+}
+
+const uint8_t * prng_scrambler_sequence(const struct prng_scrambler *s)
+{
+    return (const uint8_t *) s->words;
+}
+
 #ifdef PRNG_TEST
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include "host_config.h"
+#include "utils.h"
+
+#define TEST_SEED       0x0109BBA53CFFD081ull
+#define TEST_MAX_LEN    2048
+
+/* Verify that the scrambler matches a bytewise XOR with prng_fill() output
+ * for all lengths up to TEST_MAX_LEN, at every alignment within a word */
+static int check_scrambler(void)
+{
+    struct prng_scrambler *s;
+    uint64_t seed = TEST_SEED;
+    uint8_t *seq = NULL;
+    uint8_t *orig = NULL;
+    uint8_t *data = NULL;
+    size_t len, offset, i;
+    int failures = 0;
+
+    s = prng_scrambler_init(TEST_SEED, TEST_MAX_LEN);
+    seq = prng_fill(&seed, TEST_MAX_LEN);
+    orig = malloc(TEST_MAX_LEN + 8);
+    data = malloc(TEST_MAX_LEN + 8);
+    if (!s || !seq || !orig || !data) {
+        fprintf(stderr, "Failed to allocate test buffers.\n");
+        failures++;
+        goto out;
+    }
+
+    if (memcmp(prng_scrambler_sequence(s), seq, TEST_MAX_LEN) != 0) {
+        fprintf(stderr, "Scrambling sequence differs from prng_fill().\n");
+        failures++;
+    }
+
+    srand(0);
+    for (i = 0; i < TEST_MAX_LEN + 8; i++) {
+        orig[i] = (uint8_t) rand();
+    }
+
+    for (len = 0; len <= TEST_MAX_LEN; len++) {
+        for (offset = 0; offset < 8; offset++) {
+            memcpy(data, orig, TEST_MAX_LEN + 8);
+            prng_scrambler_apply(s, data + offset, len);
+
+            for (i = 0; i < len; i++) {
+                if (data[offset + i] != (orig[offset + i] ^ seq[i])) {
+                    break;
+                }
+            }
+
+            if (i != len || data[offset + len] != orig[offset + len] ||
+                (offset > 0 && data[offset - 1] != orig[offset - 1])) {
+                fprintf(stderr, "Mismatch for len=%zd, offset=%zd\n",
+                        len, offset);
+                failures++;
+                continue;
+            }
+
+            prng_scrambler_apply(s, data + offset, len);
+            if (memcmp(data, orig, TEST_MAX_LEN + 8) != 0) {
+                fprintf(stderr, "Unscramble failed for len=%zd, offset=%zd\n",
+                        len, offset);
+                failures++;
+            }
+        }
+    }
+
+out:
+    printf("Equivalence: %s\n", failures == 0 ? "PASSED" : "FAILED");
+    prng_scrambler_deinit(s);
+    free(seq);
+    free(orig);
+    free(data);
+    return failures == 0 ? 0 : -1;
+}
+
+/* Compare the scrambler against a bytewise XOR with a cached sequence, and
+ * against generating the sequence for each frame. The lengths correspond to
+ * the PHY's ACK and data frame lengths. */
+static int benchmark(void)
+{
+    static const size_t lengths[] = { 7, 1009 };
+    const size_t total_bytes = 256 * 1024 * 1024;
+    struct prng_scrambler *s;
+    struct timespec start, end;
+    uint64_t seed = TEST_SEED;
+    uint8_t *seq, *gen;
+    uint8_t data[TEST_MAX_LEN];
+    volatile uint8_t sink = 0;
+    double t_gen, t_byte, t_word;
+    size_t l, i, n, iterations;
+
+    s = prng_scrambler_init(TEST_SEED, TEST_MAX_LEN);
+    seq = prng_fill(&seed, TEST_MAX_LEN);
+    if (!s || !seq) {
+        fprintf(stderr, "Failed to allocate test buffers.\n");
+        prng_scrambler_deinit(s);
+        free(seq);
+        return -1;
+    }
+
+    memset(data, 0xa5, sizeof(data));
+
+    printf("\n%10s %10s %10s %10s   (MB/s)\n",
+           "Length", "generate", "bytewise", "scrambler");
+
+    for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        iterations = total_bytes / lengths[l] / 16;
+
+        /* Generate the sequence per frame */
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (n = 0; n < iterations; n++) {
+            seed = TEST_SEED;
+            gen = prng_fill(&seed, lengths[l]);
+            for (i = 0; i < lengths[l]; i++) {
+                data[i] ^= gen[i];
+            }
+            free(gen);
+            sink ^= data[n % lengths[l]];
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        t_gen = elapsed(&start, &end);
+
+        /* Bytewise XOR with a cached sequence */
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (n = 0; n < iterations; n++) {
+            for (i = 0; i < lengths[l]; i++) {
+                data[i] ^= seq[i];
+            }
+            sink ^= data[n % lengths[l]];
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        t_byte = elapsed(&start, &end);
+
+        clock_gettime(CLOCK_REALTIME, &start);
+        for (n = 0; n < iterations; n++) {
+            prng_scrambler_apply(s, data, lengths[l]);
+            sink ^= data[n % lengths[l]];
+        }
+        clock_gettime(CLOCK_REALTIME, &end);
+        t_word = elapsed(&start, &end);
+
+        printf("%10zd %10.0f %10.0f %10.0f\n", lengths[l],
+               iterations * lengths[l] / 1e6 / t_gen,
+               iterations * lengths[l] / 1e6 / t_byte,
+               iterations * lengths[l] / 1e6 / t_word);
+    }
+
+    prng_scrambler_deinit(s);
+    free(seq);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -84,8 +309,19 @@ int main(int argc, char *argv[])
     ssize_t n_written;
     int status = 0;
 
+    if (argc == 2 && !strcmp(argv[1], "--benchmark")) {
+        status = check_scrambler();
+        if (status == 0) {
+            status = benchmark();
+        }
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (argc < 4 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
         fprintf(stderr, "Usage: %s <seed> <length> <output file>\n", argv[0]);
+        fprintf(stderr, "       %s --benchmark\n\n", argv[0]);
+        fprintf(stderr, "--benchmark verifies the scrambler against "
+                        "prng_fill() and reports its\nthroughput.\n");
         return EXIT_FAILURE;
     }
 
@@ -23,6 +23,9 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifndef PRNG_H_
+#define PRNG_H_
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -61,3 +64,52 @@ static inline uint64_t prng_update(uint64_t state_in)
  *         NULL on failure.
  */
 uint8_t * prng_fill(uint64_t *state, size_t len);
+
+/**
+ * Opaque handle to a scrambler, which XORs data with a fixed PRNG sequence
+ */
+struct prng_scrambler;
+
+/**
+ * Create a scrambler for data of up to `max_len` bytes.
+ *
+ * The sequence is the same one produced by prng_fill() for `seed`. It is
+ * generated once and cached, as 64-bit words, so that scrambling a frame of
+ * any length up to `max_len` is a word-wide XOR with a prefix of the cached
+ * sequence.
+ *
+ * @param[in]   seed        PRNG seed. Must be non-zero.
+ * @param[in]   max_len     Maximum length of data to scramble, in bytes
+ *
+ * @return Scrambler handle on success, NULL on failure
+ */
+struct prng_scrambler * prng_scrambler_init(uint64_t seed, size_t max_len);
+
+/**
+ * Free a scrambler created by prng_scrambler_init()
+ *
+ * @param   s       Scrambler to free. May be NULL.
+ */
+void prng_scrambler_deinit(struct prng_scrambler *s);
+
+/**
+ * XOR `len` bytes of `data`, in place, with the scrambling sequence.
+ * Applying this twice restores the original data.
+ *
+ * @param[in]       s       Scrambler handle
+ * @param[inout]    data    Data to (un)scramble
+ * @param[in]       len     Length of `data`, in bytes. Must not exceed the
+ *                          `max_len` provided to prng_scrambler_init().
+ */
+void prng_scrambler_apply(const struct prng_scrambler *s,
+                          uint8_t *data, size_t len);
+
+/**
+ * @param   s       Scrambler handle
+ *
+ * @return The scrambling sequence, as bytes. Valid until the scrambler is
+ *         freed.
+ */
+const uint8_t * prng_scrambler_sequence(const struct prng_scrambler *s);
+
+#endif
@@ -177,6 +177,20 @@ int radio_init_and_configure(struct bladerf *dev, struct radio_params *params)
     config.frequency    = params->rx_freq;
     config.bandwidth    = BLADERF_BANDWIDTH;
     config.samplerate   = BLADERF_SAMPLE_RATE;
+    //Receive all channels at once, to be split by a channelizer. The LPF passes
+    //the whole span of the channels, as far as the LMS6002D allows.
+    if (params->rx_channels > 1){
+        if (params->rx_channels > RADIO_MAX_RX_CHANNELS){
+            fprintf(stderr, "Can't receive %u channels: a sample rate of %u Hz "
+                            "exceeds the maximum of %u Hz\n", params->rx_channels,
+                    params->rx_channels * BLADERF_SAMPLE_RATE,
+                    BLADERF_SAMPLERATE_REC_MAX);
+            return BLADERF_ERR_INVAL;
+        }
+        config.samplerate *= params->rx_channels;
+        config.bandwidth   = (config.samplerate < BLADERF_BANDWIDTH_MAX) ?
+                             config.samplerate : BLADERF_BANDWIDTH_MAX;
+    }
     config.rx_lna       = params->rx_lna_gain;
     config.vga1         = params->rx_vga1_gain;
     config.vga2         = params->rx_vga2_gain;
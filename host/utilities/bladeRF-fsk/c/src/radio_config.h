@@ -34,6 +34,9 @@
 #define BLADERF_BANDWIDTH 1500000
 //2Msps
 #define BLADERF_SAMPLE_RATE 2000000
+//Most adjacent channels that may be received at once (see radio_params.rx_channels).
+//16 channels need 32Msps; 32 would exceed BLADERF_SAMPLERATE_REC_MAX.
+#define RADIO_MAX_RX_CHANNELS 16
 
 /**
  * Configure bladeRF device
@@ -79,4 +79,137 @@ static const float rx_ch_filter[] = {
 static const size_t
     rx_ch_filter_len = sizeof(rx_ch_filter) / sizeof(rx_ch_filter[0]);
 
+/**
+ * 15th Order Equiripple Low-Pass Filter, for SPS=4
+ * Pass band: Fs / 8
+ * Stop band: Fs / 3
+ *
+ * MATLAB command:
+ *      taps = firpm(15, [0 1/4 2/3 1], [1 1 0 0]);
+ *
+ * Same design goals as rx_ch_filter, relative to the symbol rate
+ */
+static const float rx_ch_filter_sps4[] = {
+  -0.003841438119465f,
+   0.000035032438052f,
+   0.018715243789038f,
+   0.007946299738051f,
+  -0.055628766843522f,
+  -0.047066426785717f,
+   0.162417861545549f,
+   0.417854024745609f,
+   0.417854024745609f,
+   0.162417861545549f,
+  -0.047066426785717f,
+  -0.055628766843522f,
+   0.007946299738051f,
+   0.018715243789038f,
+   0.000035032438052f,
+  -0.003841438119465f,
+};
+
+/**
+ * 63rd Order Equiripple Low-Pass Filter, for SPS=16
+ * Pass band: Fs / 32
+ * Stop band: Fs / 12
+ *
+ * MATLAB command:
+ *      taps = firpm(63, [0 1/16 1/6 1], [1 1 0 0]);
+ *
+ * Same design goals as rx_ch_filter, relative to the symbol rate
+ */
+static const float rx_ch_filter_sps16[] = {
+  -0.000805774584653f,
+  -0.000787758163347f,
+  -0.000984230255856f,
+  -0.001028061207321f,
+  -0.000831432409743f,
+  -0.000326090561267f,
+   0.000505073945600f,
+   0.001617383501811f,
+   0.002884868343018f,
+   0.004103849136934f,
+   0.005009604295557f,
+   0.005311969168302f,
+   0.004745110596401f,
+   0.003124296329231f,
+   0.000404462340089f,
+  -0.003274663786200f,
+  -0.007561738078378f,
+  -0.011900278327258f,
+  -0.015566026245086f,
+  -0.017741324007408f,
+  -0.017612759689045f,
+  -0.014487463567337f,
+  -0.007905662703554f,
+   0.002261153320401f,
+   0.015749259211999f,
+   0.031885783083887f,
+   0.049627852171700f,
+   0.067651566278064f,
+   0.084486014437453f,
+   0.098672511117462f,
+   0.108931770970966f,
+   0.114314147095706f,
+   0.114314147095706f,
+   0.108931770970966f,
+   0.098672511117462f,
+   0.084486014437453f,
+   0.067651566278064f,
+   0.049627852171700f,
+   0.031885783083887f,
+   0.015749259211999f,
+   0.002261153320401f,
+  -0.007905662703554f,
+  -0.014487463567337f,
+  -0.017612759689045f,
+  -0.017741324007408f,
+  -0.015566026245086f,
+  -0.011900278327258f,
+  -0.007561738078378f,
+  -0.003274663786200f,
+   0.000404462340089f,
+   0.003124296329231f,
+   0.004745110596401f,
+   0.005311969168302f,
+   0.005009604295557f,
+   0.004103849136934f,
+   0.002884868343018f,
+   0.001617383501811f,
+   0.000505073945600f,
+  -0.000326090561267f,
+  -0.000831432409743f,
+  -0.001028061207321f,
+  -0.000984230255856f,
+  -0.000787758163347f,
+  -0.000805774584653f,
+};
+
+/**
+ * Get the channel filter for a number of samples per symbol
+ *
+ * @param[in]   samp_per_symb   samples per symbol
+ * @param[out]  len             number of taps
+ *
+ * @return      filter taps, or NULL if there is no filter for samp_per_symb
+ */
+static inline const float *rx_ch_filter_for_sps(unsigned int samp_per_symb,
+                                                size_t *len)
+{
+    switch (samp_per_symb) {
+        case 4:
+            *len = sizeof(rx_ch_filter_sps4) / sizeof(rx_ch_filter_sps4[0]);
+            return rx_ch_filter_sps4;
+        case 8:
+            *len = rx_ch_filter_len;
+            return rx_ch_filter;
+        case 16:
+            *len = sizeof(rx_ch_filter_sps16) / sizeof(rx_ch_filter_sps16[0]);
+            return rx_ch_filter_sps16;
+        default:
+            *len = 0;
+            return NULL;
+    }
+}
+
 #endif
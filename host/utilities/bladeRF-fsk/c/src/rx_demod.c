@@ -0,0 +1,248 @@
+/**
+ * @brief   Frame acquisition and demodulation for one received channel
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "rx_demod.h"
+#include "phy.h"
+#include "correlator.h"
+
+#ifdef DEBUG_MODE
+    #define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__)
+    #ifndef ENABLE_NOTES
+        #define ENABLE_NOTES
+    #endif
+#else
+    #define DEBUG_MSG(...)
+#endif
+
+#ifdef ENABLE_NOTES
+    #define NOTE(...) fprintf(stderr, __VA_ARGS__)
+#else
+    #define NOTE(...)
+#endif
+
+struct rx_demod {
+    struct correlator *corr;        //preamble correlator
+    struct fsk_handle *fsk;         //demodulator (not owned)
+    const struct prng_scrambler *scrambler;     //(not owned)
+    struct frame_ring *ring;        //received frames (not owned)
+    bool preamble_detected;         //is a frame being demodulated?
+    bool new_frame;                 //has nothing of the frame been demodulated yet?
+    int frame_length;               //link layer frame length, once known (else 0)
+    unsigned int data_index;        //number of bytes of the frame demodulated
+    uint64_t frame_samples;         //symbol samples of the frame demodulated
+    unsigned int num_bytes_to_demod;    //bytes still needed for the current step
+    uint8_t *rx_buffer;             //current frame buffer (ring slot or scratch)
+    uint8_t *scratch_buffer;        //used when the ring is full
+};
+
+struct rx_demod *rx_demod_init(struct fsk_handle *fsk,
+                               const struct prng_scrambler *scrambler,
+                               struct frame_ring *ring)
+{
+    uint8_t preamble[PREAMBLE_LENGTH] = PREAMBLE;
+    struct rx_demod *demod;
+
+    demod = calloc(1, sizeof(*demod));
+    if (demod == NULL){
+        perror("[PHY] calloc");
+        return NULL;
+    }
+    demod->fsk = fsk;
+    demod->scrambler = scrambler;
+    demod->ring = ring;
+
+    demod->scratch_buffer = malloc(MAX_LINK_FRAME_SIZE);
+    if (demod->scratch_buffer == NULL){
+        perror("[PHY] malloc");
+        goto error;
+    }
+    demod->corr = corr_init(preamble, 8*PREAMBLE_LENGTH, fsk_samp_per_symb(fsk));
+    if (demod->corr == NULL){
+        fprintf(stderr, "[PHY] %s: Couldn't initialize correlator\n", __FUNCTION__);
+        goto error;
+    }
+    return demod;
+
+    error:
+        rx_demod_deinit(demod);
+        return NULL;
+}
+
+void rx_demod_deinit(struct rx_demod *demod)
+{
+    if (demod != NULL){
+        corr_deinit(demod->corr);
+        free(demod->scratch_buffer);
+        free(demod);
+    }
+}
+
+unsigned int rx_demod_block(struct rx_demod *demod,
+                            const struct complex_sample *samples,
+                            unsigned int count, uint64_t *dropped)
+{
+    unsigned int num_frames = 0;
+    unsigned int num_bytes_rx;
+    unsigned int symb_samples;      //Samples per byte
+    uint64_t samples_index = 0;     //Current index of samples to correlate/demod
+    uint64_t frame_end;             //Symbol samples through the last complete byte
+    uint8_t frame_type;
+
+    enum states {PREAMBLE_CORRELATE, DEMOD, CHECK_FRAME_TYPE, DECODE, COPY};
+    enum states state;                //current state variable
+
+    symb_samples = 8*fsk_samp_per_symb(demod->fsk);
+
+    //Continue the frame in progress, if any
+    state = demod->preamble_detected ? DEMOD : PREAMBLE_CORRELATE;
+
+    //Loop until more samples are needed
+    while (true){
+        switch(state){
+            case PREAMBLE_CORRELATE:
+                //--Cross correlate received samples with preamble to find start
+                //--of the data frame. The samples are timestamped with their index
+                //--in the block, since a frame may follow another in the same block.
+                samples_index = corr_process(demod->corr, &samples[samples_index],
+                                            (size_t) (count-samples_index),
+                                            samples_index);
+                if (samples_index == CORRELATOR_NO_RESULT){
+                    //No preamble match. Receive more samples
+                    return num_frames;
+                }
+                DEBUG_MSG("[PHY] RX: Preamble matched @ index %lu\n",
+                          (unsigned long) samples_index);
+                demod->preamble_detected = true;
+                demod->new_frame = true;
+                demod->frame_length = 0;
+                demod->frame_samples = 0;
+                //Demod into the next free ring slot, if there is one
+                demod->rx_buffer = frame_ring_write_slot(demod->ring);
+                if (demod->rx_buffer == NULL){
+                    demod->rx_buffer = demod->scratch_buffer;
+                }
+                //First we only demod the first byte to determine frame type
+                demod->num_bytes_to_demod = 1;
+                demod->data_index = 0;
+                state = DEMOD;
+                break;
+            case DEMOD:
+                //--Demod samples
+                DEBUG_MSG("[PHY] RX: State = DEMOD\n");
+                num_bytes_rx = fsk_demod_fast(demod->fsk, &samples[samples_index],
+                                        (int) (count-samples_index), demod->new_frame,
+                                        demod->num_bytes_to_demod,
+                                        &demod->rx_buffer[demod->data_index]);
+                demod->data_index += num_bytes_rx;
+                //Account for extra sample which defines initial phase
+                if (demod->new_frame){
+                    samples_index++;
+                }
+                demod->new_frame = false;
+                if (num_bytes_rx < demod->num_bytes_to_demod){
+                    //Receive more samples. The demodulator keeps any partial byte,
+                    //so its samples may end in the middle of a byte.
+                    demod->num_bytes_to_demod -= num_bytes_rx;
+                    demod->frame_samples += count - samples_index;
+                    return num_frames;
+                }
+                //Skip the samples of the completed bytes not seen in earlier blocks
+                frame_end = (uint64_t) demod->data_index * symb_samples;
+                samples_index += frame_end - demod->frame_samples;
+                demod->frame_samples = frame_end;
+                if (demod->frame_length == 0){
+                    state = CHECK_FRAME_TYPE;
+                }else{
+                    //We demoded all samples in the frame
+                    state = DECODE;
+                }
+                break;
+            case CHECK_FRAME_TYPE:
+                //--Check the frame type byte
+                DEBUG_MSG("[PHY] RX: State = CHECK_FRAME_TYPE\n");
+                #ifndef BYPASS_PHY_SCRAMBLING
+                    frame_type = demod->rx_buffer[0] ^
+                                    prng_scrambler_sequence(demod->scrambler)[0];
+                #else
+                    frame_type = demod->rx_buffer[0];
+                #endif
+                //Set frame length according to what type of frame it is
+                if (frame_type == ACK_FRAME_CODE){
+                    DEBUG_MSG("[PHY] RX: Getting an ACK frame...\n");
+                    demod->frame_length = ACK_FRAME_LENGTH;
+                }else if(frame_type == DATA_FRAME_CODE){
+                    DEBUG_MSG("[PHY] RX: Getting a data frame...\n");
+                    demod->frame_length = DATA_FRAME_LENGTH;
+                }else{
+                    NOTE("[PHY] %s: rx'ed unknown frame type 0x%.2X\n",
+                            __FUNCTION__, frame_type);
+                    //Discard the rest of the block
+                    demod->data_index = 0;
+                    demod->preamble_detected = false;
+                    return num_frames;
+                }
+                //Demod the rest of the bytes
+                demod->num_bytes_to_demod = demod->frame_length-1;
+                state = DEMOD;
+                break;
+            case DECODE:
+                //--Remove any phy encoding on the received frame
+                DEBUG_MSG("[PHY] RX: State = DECODE\n");
+                #ifndef BYPASS_PHY_SCRAMBLING
+                    //Unscramble the frame
+                    prng_scrambler_apply(demod->scrambler, demod->rx_buffer,
+                                         demod->frame_length);
+                #endif
+                state = COPY;
+                break;
+            case COPY:
+                //--Pass the frame to the link layer
+                DEBUG_MSG("[PHY] RX: State = COPY\n");
+                //Is the link layer still working with all previous frames?
+                if (demod->rx_buffer == demod->scratch_buffer){
+                    //Instead of disrupting the link layer, drop this frame
+                    NOTE("[PHY] RX: Frame dropped!\n");
+                    (*dropped)++;
+                }else{
+                    //The frame was demodulated in place; just commit it
+                    frame_ring_commit(demod->ring, demod->frame_length);
+                    num_frames++;
+                    DEBUG_MSG("[PHY] RX: Frame ready\n");
+                }
+                demod->preamble_detected = false;
+
+                if (samples_index == count){
+                    return num_frames;
+                }
+                state = PREAMBLE_CORRELATE;
+                break;
+            default:
+                fprintf(stderr, "[PHY] %s: Invalid state\n", __FUNCTION__);
+                demod->preamble_detected = false;
+                return num_frames;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/**
+ * @file
+ * @brief   Frame acquisition and demodulation for one received channel
+ *
+ * Searches blocks of filtered, power normalized samples for the preamble,
+ * demodulates the frame that follows it, and passes the unscrambled frame to
+ * a frame ring. Frames may span blocks. Each received channel has its own
+ * rx_demod, which is used by one thread at a time.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RX_DEMOD_H_
+#define RX_DEMOD_H_
+
+#include <stdint.h>
+
+#include "common.h"
+#include "fsk.h"
+#include "prng.h"
+#include "frame_ring.h"
+
+struct rx_demod;
+
+/**
+ * Create a demodulator
+ *
+ * @param[in]   fsk         fsk handle to demodulate with. It may also be used to
+ *                          modulate, but not to demodulate another channel.
+ * @param[in]   scrambler   scrambler used by the transmitter
+ * @param[in]   ring        ring to pass received frames to. Slots must hold
+ *                          MAX_LINK_FRAME_SIZE bytes.
+ *
+ * @return      rx_demod handle on success, NULL on failure
+ */
+struct rx_demod *rx_demod_init(struct fsk_handle *fsk,
+                               const struct prng_scrambler *scrambler,
+                               struct frame_ring *ring);
+
+/**
+ * Deinitialize and deallocate a demodulator. The fsk handle, scrambler, and
+ * ring are not freed. Does nothing if demod is NULL.
+ *
+ * @param[in]   demod       demodulator to free
+ */
+void rx_demod_deinit(struct rx_demod *demod);
+
+/**
+ * Process the next block of samples. Each frame completed within the block is
+ * committed to the ring, or dropped if the ring had no free slot when its
+ * preamble was found.
+ *
+ * @param[in]   demod       demodulator
+ * @param[in]   samples     filtered, power normalized samples
+ * @param[in]   count       number of samples
+ * @param[out]  dropped     incremented for each frame dropped
+ *
+ * @return      number of frames committed to the ring
+ */
+unsigned int rx_demod_block(struct rx_demod *demod,
+                            const struct complex_sample *samples,
+                            unsigned int count, uint64_t *dropped);
+
+#endif
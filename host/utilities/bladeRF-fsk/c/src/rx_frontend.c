@@ -0,0 +1,56 @@
+/**
+ * @brief   RX front end: channel filter and power normalization
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rx_frontend.h"
+
+/* Filter and normalize one tile at a time, so the float filter output
+ * (2 KiB per tile) is consumed by pnorm while it is still in L1 */
+static void rx_frontend_fused(struct fir_filter *filt, struct pnorm_state_t *pnorm,
+                              const int16_t *input, size_t count,
+                              struct complex_sample *output)
+{
+    float tile[2 * RX_FRONTEND_TILE_LEN];
+    size_t pos, n;
+
+    for (pos = 0; pos < count; pos += n) {
+        n = count - pos;
+        if (n > RX_FRONTEND_TILE_LEN) {
+            n = RX_FRONTEND_TILE_LEN;
+        }
+
+        n = fir_process_block_float(filt, &input[2 * pos], n, tile);
+        pnorm_block_float(pnorm, n, tile, &output[pos], NULL, NULL);
+    }
+}
+
+void rx_frontend_process(enum rx_frontend mode, struct fir_filter *filt,
+                         struct pnorm_state_t *pnorm, const int16_t *input,
+                         size_t count, struct complex_sample *scratch,
+                         struct complex_sample *output)
+{
+    if (mode == RX_FRONTEND_FUSED) {
+        rx_frontend_fused(filt, pnorm, input, count, output);
+    } else {
+        fir_process_block(filt, input, count, scratch);
+        pnorm_block(pnorm, count, scratch, output, NULL, NULL);
+    }
+}
@@ -0,0 +1,74 @@
+/**
+ * @file
+ * @brief   RX front end: channel filter and power normalization
+ *
+ * Each block of received SC16Q11 samples is passed through the RX channel
+ * filter and then power normalized before it is handed to the correlator and
+ * demodulator. Two implementations are provided, selected by an
+ * `enum rx_frontend` value:
+ *
+ *  - RX_FRONTEND_SPLIT runs fir_process_block() over the whole block into an
+ *    intermediate SC16Q11 buffer, and then pnorm_block() over that buffer.
+ *
+ *  - RX_FRONTEND_FUSED processes the block in tiles of RX_FRONTEND_TILE_LEN
+ *    samples. Each tile is filtered into a small float buffer, which is
+ *    power normalized while it is still in L1 cache. The input is read once,
+ *    there is no intermediate SC16Q11 rounding, and no block-sized
+ *    intermediate buffer is needed.
+ *
+ * The two are not bit-exact, as the fused path normalizes the unrounded
+ * filter output.
+ *
+ * This file is part of the bladeRF project
+ *
+ * Copyright (C) 2016 Nuand LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef RX_FRONTEND_H_
+#define RX_FRONTEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+#include "fir_filter.h"
+#include "pnorm.h"
+
+/* Samples per tile in the fused front end. This is a multiple of the pnorm
+ * sub-block length, so sub-blocks line up with those of the split path. */
+#define RX_FRONTEND_TILE_LEN 256
+
+/**
+ * Filter and power normalize a block of samples
+ *
+ * @param[in]   mode        Front end implementation to use
+ * @param[in]   filt        Channel filter. Must produce one output sample per
+ *                          input sample (i.e., created with fir_init()).
+ * @param[in]   pnorm       Power normalization state
+ * @param[in]   input       Input SC16Q11 samples (interleaved I/Q)
+ * @param[in]   count       Number of samples to process
+ * @param[in]   scratch     Intermediate buffer of `count` samples, used by
+ *                          RX_FRONTEND_SPLIT. May be NULL for
+ *                          RX_FRONTEND_FUSED.
+ * @param[out]  output      Filtered, power normalized samples
+ */
+void rx_frontend_process(enum rx_frontend mode, struct fir_filter *filt,
+                         struct pnorm_state_t *pnorm, const int16_t *input,
+                         size_t count, struct complex_sample *scratch,
+                         struct complex_sample *output);
+
+#endif
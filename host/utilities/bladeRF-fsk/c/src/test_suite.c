@@ -24,13 +24,23 @@
 #include <stdint.h>
 #include <libbladeRF.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <pthread.h>
 //Utility files
 #include "utils.h"
 #include "prng.h"
 //Units under test
 #include "phy.h"
+#include "phy_mchan.h"
 #include "link.h"
 #include "fsk.h"
+#include "fir_filter.h"
+#include "pnorm.h"
+#include "rx_ch_filter.h"
+#include "rx_frontend.h"
+#include "radio_config.h"
 
 #ifdef DEBUG_MODE
     #define DEBUG_MSG(...) fprintf(stderr, __VA_ARGS__)
@@ -87,6 +97,9 @@ int link_test(char *dev_id1, char *dev_id2, unsigned int tx_freq1, unsigned int
     params.rx_lna_gain    = BLADERF_LNA_GAIN_MAX;
     params.rx_vga1_gain = 23;
     params.rx_vga2_gain = 0;
+    params.rx_cpus[0] = params.rx_cpus[1] = params.rx_cpus[2] = -1;
+    params.rx_frontend = RX_FRONTEND_FUSED;
+    params.rx_channels = 1;
     link1 = link_init(dev1, &params);
     if (link1 == NULL){
         fprintf(stderr, "Couldn't initialize link1\n");
@@ -150,6 +163,204 @@ int link_test(char *dev_id1, char *dev_id2, unsigned int tx_freq1, unsigned int
         return status;
 }
 
+#define LOOPBACK_TEST_PAYLOADS 200     //Number of payloads to send per run
+#define LOOPBACK_TEST_BATCH 20         //Number of payloads per link_send_data() call
+
+struct loopback_rx_state {
+    struct link_handle *link;
+    pthread_mutex_t lock;       //Protects 'done'
+    bool done;                  //Set when the sender has finished
+    unsigned int received;      //Number of payloads received
+    unsigned int errors;        //Number of payloads corrupted or out of order
+};
+
+//Tell the receiver that the sender has finished
+static void loopback_set_done(struct loopback_rx_state *state)
+{
+    pthread_mutex_lock(&state->lock);
+    state->done = true;
+    pthread_mutex_unlock(&state->lock);
+}
+
+static bool loopback_is_done(struct loopback_rx_state *state)
+{
+    bool done;
+
+    pthread_mutex_lock(&state->lock);
+    done = state->done;
+    pthread_mutex_unlock(&state->lock);
+
+    return done;
+}
+
+//Fill a payload with a pattern identifying it
+static void loopback_fill_payload(uint8_t *payload, uint32_t index)
+{
+    unsigned int i;
+
+    memcpy(payload, &index, sizeof(index));
+    for (i = sizeof(index); i < PAYLOAD_LENGTH; i++){
+        payload[i] = (uint8_t) (index * 31 + i);
+    }
+}
+
+//Receive payloads, checking that each is intact and arrives in order. Payloads
+//dropped by the transmitter after LINK_MAX_TRIES are simply skipped.
+static void *loopback_receive(void *arg)
+{
+    struct loopback_rx_state *state = (struct loopback_rx_state *) arg;
+    uint8_t rx_data[PAYLOAD_LENGTH], expected[PAYLOAD_LENGTH];
+    uint32_t index;
+    int64_t last_index = -1;
+    int bytes_received;
+
+    while (true){
+        bytes_received = link_receive_data(state->link, PAYLOAD_LENGTH, 1, rx_data);
+        if (bytes_received != PAYLOAD_LENGTH){
+            if (bytes_received < 0){
+                state->errors++;
+                break;
+            }
+            if (bytes_received > 0){
+                state->errors++;
+            }
+            if (loopback_is_done(state)){
+                break;
+            }
+            continue;
+        }
+        memcpy(&index, rx_data, sizeof(index));
+        loopback_fill_payload(expected, index);
+        if ((int64_t) index <= last_index || memcmp(rx_data, expected, PAYLOAD_LENGTH) != 0){
+            state->errors++;
+        }
+        last_index = index;
+        state->received++;
+    }
+    return NULL;
+}
+
+/**
+ * Run one transfer over a loopback link pair
+ *
+ * @return  0 on success, -1 on failure
+ */
+static int link_loopback_run(const struct phy_loopback_params *params,
+                             unsigned int window_size)
+{
+    struct link_handle *link1 = NULL, *link2 = NULL;
+    struct loopback_rx_state rx_state;
+    pthread_t rx_thread;
+    bool rx_started = false;
+    uint8_t *tx_data = NULL;
+    struct timespec start, end;
+    double elapsed;
+    unsigned int i, j, failures = 0;
+    int status = -1;
+
+    memset(&rx_state, 0, sizeof(rx_state));
+    pthread_mutex_init(&rx_state.lock, NULL);
+
+    tx_data = malloc(LOOPBACK_TEST_BATCH * PAYLOAD_LENGTH);
+    if (tx_data == NULL){
+        perror("malloc");
+        goto out;
+    }
+    if (link_init_loopback_pair(params, &link1, &link2) != 0){
+        fprintf(stderr, "Couldn't initialize loopback links\n");
+        goto out;
+    }
+    if (link_set_window_size(link1, window_size) != 0){
+        goto out;
+    }
+    rx_state.link = link2;
+    if (pthread_create(&rx_thread, NULL, loopback_receive, &rx_state) != 0){
+        fprintf(stderr, "Couldn't start receive thread\n");
+        goto out;
+    }
+    rx_started = true;
+
+    create_timeout_abs(0, &start);
+    for (i = 0; i < LOOPBACK_TEST_PAYLOADS; i += LOOPBACK_TEST_BATCH){
+        for (j = 0; j < LOOPBACK_TEST_BATCH; j++){
+            loopback_fill_payload(&tx_data[j*PAYLOAD_LENGTH], i + j);
+        }
+        status = link_send_data(link1, tx_data, LOOPBACK_TEST_BATCH * PAYLOAD_LENGTH);
+        if (status == -2){
+            failures++;
+        }else if (status != 0){
+            fprintf(stderr, "Error sending data\n");
+            goto out;
+        }
+    }
+    create_timeout_abs(0, &end);
+    elapsed = timespec_diff_us(&end, &start) / 1e6;
+
+    loopback_set_done(&rx_state);
+    pthread_join(rx_thread, NULL);
+    rx_started = false;
+
+    printf("  window %2u, loss %4.1f%%: %3u/%u payloads in %6.3f s, "
+           "goodput %7.1f kbps, %u failed sends, %u errors\n",
+           window_size, params->loss_rate * 100.0, rx_state.received,
+           LOOPBACK_TEST_PAYLOADS, elapsed,
+           rx_state.received * PAYLOAD_LENGTH * 8 / elapsed / 1000.0,
+           failures, rx_state.errors);
+
+    //Nothing may be corrupted or reordered, and nothing may be lost on a lossless
+    //channel
+    status = 0;
+    if (rx_state.errors != 0 ||
+        (params->loss_rate == 0.0 && rx_state.received != LOOPBACK_TEST_PAYLOADS)){
+        status = -1;
+    }
+
+    out:
+        if (rx_started){
+            loopback_set_done(&rx_state);
+            pthread_join(rx_thread, NULL);
+        }
+        link_close(link1);
+        link_close(link2);
+        free(tx_data);
+        pthread_mutex_destroy(&rx_state.lock);
+        return status;
+}
+
+/**
+ * Test the link layer's goodput over a simulated channel (no radio), for a range
+ * of window sizes and frame loss rates
+ */
+int link_loopback_test(void)
+{
+    const unsigned int window_sizes[] = {1, LINK_WINDOW_SIZE, LINK_MAX_WINDOW_SIZE};
+    const double loss_rates[] = {0.0, 0.01, 0.05, 0.10};
+    struct phy_loopback_params params;
+    unsigned int i, j;
+    int status = 0;
+
+    printf("------------BEGINNING LINK LOOPBACK TEST-----------\n");
+    //Scaled-up channel, so the test runs quickly
+    params.bitrate = 2500000;
+    params.latency_ms = 5;
+    params.seed = 0;
+    printf("Channel: %u bps, %u ms one-way latency\n", params.bitrate,
+           params.latency_ms);
+
+    for (i = 0; i < sizeof(window_sizes)/sizeof(window_sizes[0]); i++){
+        for (j = 0; j < sizeof(loss_rates)/sizeof(loss_rates[0]); j++){
+            params.loss_rate = loss_rates[j];
+            if (link_loopback_run(&params, window_sizes[i]) != 0){
+                status = -1;
+            }
+        }
+    }
+
+    printf("Test result: %s\n", status == 0 ? "PASSED" : "FAILED");
+    printf("------------ENDING LINK LOOPBACK TEST--------------\n");
+    return status;
+}
+
 /**
  * Test phy layer code with data transfer between two devices
  */
@@ -195,6 +406,9 @@ int phy_test(char *dev_id1, char *dev_id2, unsigned int tx_freq1, unsigned int t
     params.rx_lna_gain    = BLADERF_LNA_GAIN_MAX;
     params.rx_vga1_gain = 23;
     params.rx_vga2_gain = 0;
+    params.rx_cpus[0] = params.rx_cpus[1] = params.rx_cpus[2] = -1;
+    params.rx_frontend = RX_FRONTEND_FUSED;
+    params.rx_channels = 1;
     phy1 = phy_init(dev1, &params);
     if (phy1 == NULL){
         fprintf(stderr, "Couldn't initialize phy1\n");
@@ -332,6 +546,9 @@ int phy_receive_test(void)
     params.rx_lna_gain    = BLADERF_LNA_GAIN_MAX;
     params.rx_vga1_gain = 23;
     params.rx_vga2_gain = 0;
+    params.rx_cpus[0] = params.rx_cpus[1] = params.rx_cpus[2] = -1;
+    params.rx_frontend = RX_FRONTEND_FUSED;
+    params.rx_channels = 1;
     phy = phy_init(dev, &params);
     if (phy == NULL){
         fprintf(stderr, "Couldn't initialize phy\n");
@@ -455,6 +672,697 @@ int fsk_test1(void)
         return status;
 }
 
+/**
+ * Demodulate the given samples with fsk_demod() and fsk_demod_fast(), and check that
+ * they produce identical bits. fsk_demod_fast() is also run with the samples split into
+ * pseudo-randomly sized chunks, to exercise its partial-byte resume state.
+ *
+ * @return  0 if the demodulators agree, -1 otherwise
+ */
+static int fsk_compare_demods(unsigned int samp_per_symb, struct complex_sample *samples,
+                              int num_samples)
+{
+    struct fsk_handle *fsk = NULL;
+    uint8_t *ref_data = NULL, *fast_data = NULL, *chunk_data = NULL;
+    unsigned int max_bytes = num_samples/(8*samp_per_symb) + 1;
+    unsigned int ref_bytes, fast_bytes, chunk_bytes = 0;
+    unsigned int bit_errors = 0, k;
+    int i, chunk;
+    struct timespec t0, t1, t2;
+    double t_ref, t_fast;
+    int status = -1;
+
+    fsk = fsk_init_sps(samp_per_symb);
+    ref_data = calloc(max_bytes, 1);
+    fast_data = calloc(max_bytes, 1);
+    chunk_data = calloc(max_bytes, 1);
+    if (fsk == NULL || ref_data == NULL || fast_data == NULL || chunk_data == NULL){
+        fprintf(stderr, "Couldn't allocate demodulator test resources\n");
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ref_bytes = fsk_demod(fsk, samples, num_samples, true, -1, ref_data);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    fast_bytes = fsk_demod_fast(fsk, samples, num_samples, true, -1, fast_data);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    t_ref = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+    t_fast = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec)/1e9;
+
+    //Feed the fast demodulator chunks of 1 to 1024 samples
+    srand(0);
+    for (i = 0; i < num_samples; i += chunk){
+        chunk = 1 + rand() % 1024;
+        if (chunk > num_samples - i){
+            chunk = num_samples - i;
+        }
+        chunk_bytes += fsk_demod_fast(fsk, &samples[i], chunk, i == 0, -1,
+                                        &chunk_data[chunk_bytes]);
+    }
+
+    printf("fsk_demod():      %u bytes, %.2f Msamples/s\n", ref_bytes,
+            num_samples/t_ref/1e6);
+    printf("fsk_demod_fast(): %u bytes, %.2f Msamples/s\n", fast_bytes,
+            num_samples/t_fast/1e6);
+
+    if (ref_bytes != fast_bytes || ref_bytes != chunk_bytes){
+        fprintf(stderr, "Demodulated byte counts differ (%u, %u, %u chunked)\n",
+                ref_bytes, fast_bytes, chunk_bytes);
+        goto out;
+    }
+
+    for (k = 0; k < ref_bytes; k++){
+        for (i = 0; i < 8; i++){
+            bit_errors += ((ref_data[k] ^ fast_data[k]) >> i) & 0x01;
+            bit_errors += ((ref_data[k] ^ chunk_data[k]) >> i) & 0x01;
+        }
+    }
+
+    if (bit_errors != 0){
+        fprintf(stderr, "%u demodulated bits differ\n", bit_errors);
+        goto out;
+    }
+
+    printf("Demodulators produced identical bits.\n");
+    status = 0;
+
+    out:
+        fsk_close(fsk);
+        free(ref_data);
+        free(fast_data);
+        free(chunk_data);
+        return status;
+}
+
+/**
+ * FSK demodulator comparison test.
+ * Checks that fsk_demod() and fsk_demod_fast() yield the same bits for a synthetic
+ * capture (random data with noise, a frequency offset, and zero-valued samples), and
+ * optionally, for a recorded capture in a CSV file.
+ *
+ * @param[in]   capture_file    CSV file of SC16 Q11 samples, or NULL
+ */
+int fsk_test2(char *capture_file)
+{
+    const int num_bytes = 8192;
+    const double freq_offset = 0.02;    //radians/sample
+    struct fsk_handle *fsk = NULL;
+    struct complex_sample *samples = NULL;
+    int16_t *raw_samples = NULL;
+    uint8_t *tx_data = NULL;
+    int num_samples, i;
+    double re, im, theta;
+    int status = -1;
+
+    printf("------------BEGINNING FSK TEST 2-------------\n");
+    fsk = fsk_init();
+    if (fsk == NULL){
+        fprintf(stderr, "Couldn't initialize fsk\n");
+        goto out;
+    }
+
+    num_samples = num_bytes*8*SAMP_PER_SYMB + 1;
+    tx_data = malloc(num_bytes);
+    samples = malloc(num_samples * sizeof(samples[0]));
+    if (tx_data == NULL || samples == NULL){
+        perror("malloc");
+        goto out;
+    }
+
+    srand(1);
+    for (i = 0; i < num_bytes; i++){
+        tx_data[i] = (uint8_t) rand();
+    }
+    samples[0].i = 2047;
+    samples[0].q = 0;
+    fsk_mod(fsk, tx_data, num_bytes, &samples[1]);
+
+    //Apply a gain, frequency offset, and noise
+    for (i = 0; i < num_samples; i++){
+        theta = freq_offset * i;
+        re = 0.5 * (samples[i].i*cos(theta) - samples[i].q*sin(theta));
+        im = 0.5 * (samples[i].i*sin(theta) + samples[i].q*cos(theta));
+        re += (rand() % 401) - 200;
+        im += (rand() % 401) - 200;
+        samples[i].i = (int16_t) round(re);
+        samples[i].q = (int16_t) round(im);
+        if (i % 997 == 0){
+            samples[i].i = samples[i].q = 0;
+        }
+    }
+
+    printf("Synthetic capture: %d samples\n", num_samples);
+    status = fsk_compare_demods(SAMP_PER_SYMB, samples, num_samples);
+
+    if (status == 0 && capture_file != NULL){
+        free(samples);
+        samples = NULL;
+        status = -1;
+
+        num_samples = load_samples_from_csv_file(capture_file, false, 0, &raw_samples);
+        if (num_samples <= 0){
+            fprintf(stderr, "Couldn't load samples from %s\n", capture_file);
+            goto out;
+        }
+        samples = malloc(num_samples * sizeof(samples[0]));
+        if (samples == NULL){
+            perror("malloc");
+            goto out;
+        }
+        for (i = 0; i < num_samples; i++){
+            samples[i].i = raw_samples[2*i];
+            samples[i].q = raw_samples[2*i+1];
+        }
+
+        printf("Recorded capture (%s): %d samples\n", capture_file, num_samples);
+        status = fsk_compare_demods(SAMP_PER_SYMB, samples, num_samples);
+    }
+
+    out:
+        fsk_close(fsk);
+        free(tx_data);
+        free(samples);
+        free(raw_samples);
+        if (status != 0){
+            fprintf(stderr, "ERROR: Test did not complete successfully\n");
+        }
+        printf("------------ENDING FSK TEST 2----------------\n");
+        return status;
+}
+
+/**
+ * FSK samples-per-symbol test.
+ * For each specialized samples-per-symbol value, and one that uses the generic slicer,
+ * modulates random data, checks that fsk_demod_fast() recovers it, and that it agrees
+ * with fsk_demod() when fed in chunks.
+ */
+int fsk_test3(void)
+{
+    const unsigned int sps_values[] = { 4, 8, 16, 6 };
+    const int num_bytes = 1024;
+    struct fsk_handle *fsk = NULL;
+    struct complex_sample *samples = NULL;
+    uint8_t *tx_data = NULL, *rx_data = NULL;
+    unsigned int sps, num_bytes_rx, k;
+    int num_samples, i;
+    int status = 0;
+
+    printf("------------BEGINNING FSK TEST 3-------------\n");
+    tx_data = malloc(num_bytes);
+    rx_data = malloc(num_bytes);
+    samples = malloc((num_bytes*8*FSK_MAX_SAMP_PER_SYMB + 1) * sizeof(samples[0]));
+    if (tx_data == NULL || rx_data == NULL || samples == NULL){
+        perror("malloc");
+        status = -1;
+        goto out;
+    }
+
+    srand(2);
+    for (i = 0; i < num_bytes; i++){
+        tx_data[i] = (uint8_t) rand();
+    }
+
+    for (k = 0; k < sizeof(sps_values)/sizeof(sps_values[0]) && status == 0; k++){
+        sps = sps_values[k];
+        printf("Samples per symbol: %u\n", sps);
+
+        fsk = fsk_init_sps(sps);
+        if (fsk == NULL || fsk_samp_per_symb(fsk) != sps){
+            fprintf(stderr, "Couldn't initialize fsk\n");
+            status = -1;
+            break;
+        }
+
+        num_samples = num_bytes*8*sps + 1;
+        samples[0].i = 2047;
+        samples[0].q = 0;
+        fsk_mod(fsk, tx_data, num_bytes, &samples[1]);
+
+        num_bytes_rx = fsk_demod_fast(fsk, samples, num_samples, true, num_bytes, rx_data);
+        if (num_bytes_rx != (unsigned int) num_bytes ||
+                memcmp(rx_data, tx_data, num_bytes) != 0){
+            fprintf(stderr, "Received data is incorrect (%u bytes)\n", num_bytes_rx);
+            status = -1;
+        } else {
+            status = fsk_compare_demods(sps, samples, num_samples);
+        }
+
+        fsk_close(fsk);
+        fsk = NULL;
+    }
+
+    //Out of range values are rejected
+    if (status == 0 && (fsk_init_sps(0) != NULL ||
+                        fsk_init_sps(FSK_MAX_SAMP_PER_SYMB + 1) != NULL)){
+        fprintf(stderr, "Invalid samples per symbol was accepted\n");
+        status = -1;
+    }
+
+    out:
+        fsk_close(fsk);
+        free(tx_data);
+        free(rx_data);
+        free(samples);
+        if (status != 0){
+            fprintf(stderr, "ERROR: Test did not complete successfully\n");
+        }
+        printf("------------ENDING FSK TEST 3----------------\n");
+        return status;
+}
+
+/**
+ * Run one RX front end implementation over a capture, in NUM_SAMPLES_RX blocks as the
+ * PHY does, with a freshly initialized channel filter and power normalizer
+ *
+ * @return  Processing time in seconds, or a negative value on failure
+ */
+static double rx_frontend_run(enum rx_frontend mode, const int16_t *input,
+                              int num_samples, struct complex_sample *output)
+{
+    struct fir_filter *filt;
+    struct pnorm_state_t *pnorm;
+    struct complex_sample *scratch;
+    struct timespec t0, t1;
+    int i, n;
+
+    filt = fir_init(rx_ch_filter, rx_ch_filter_len);
+    pnorm = pnorm_init(0.95f, 0.1f, 20.0f);
+    scratch = malloc(NUM_SAMPLES_RX * sizeof(scratch[0]));
+    if (filt == NULL || pnorm == NULL || scratch == NULL){
+        fir_deinit(filt);
+        pnorm_deinit(pnorm);
+        free(scratch);
+        return -1.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < num_samples; i += n){
+        n = num_samples - i;
+        if (n > NUM_SAMPLES_RX){
+            n = NUM_SAMPLES_RX;
+        }
+        rx_frontend_process(mode, filt, pnorm, &input[2*i], n, scratch, &output[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fir_deinit(filt);
+    pnorm_deinit(pnorm);
+    free(scratch);
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+}
+
+/**
+ * RX front end test.
+ * Runs the split (filter, then pnorm) and fused front ends over a synthetic capture
+ * with noise and abrupt changes in signal level, reports the throughput of each, and
+ * checks that their outputs agree closely and demodulate to identical bits.
+ */
+int rx_frontend_test(void)
+{
+    const int num_bytes = 8192;
+    const int num_runs = 5;
+    struct fsk_handle *fsk = NULL;
+    struct complex_sample *tx_samples = NULL;
+    struct complex_sample *split_out = NULL, *fused_out = NULL;
+    int16_t *raw = NULL;
+    uint8_t *tx_data = NULL, *split_data = NULL, *fused_data = NULL;
+    unsigned int split_bytes, fused_bytes, k;
+    int num_samples, i, run, diff, max_diff = 0;
+    double scale, t, t_split = 0, t_fused = 0, sum_sq = 0;
+    int status = -1;
+
+    printf("------------BEGINNING RX FRONT END TEST-------------\n");
+    fsk = fsk_init();
+    if (fsk == NULL){
+        fprintf(stderr, "Couldn't initialize fsk\n");
+        goto out;
+    }
+
+    num_samples = num_bytes*8*SAMP_PER_SYMB + 1;
+    tx_data = malloc(num_bytes);
+    split_data = calloc(num_bytes + 1, 1);
+    fused_data = calloc(num_bytes + 1, 1);
+    tx_samples = malloc(num_samples * sizeof(tx_samples[0]));
+    split_out = malloc(num_samples * sizeof(split_out[0]));
+    fused_out = malloc(num_samples * sizeof(fused_out[0]));
+    raw = malloc(2 * num_samples * sizeof(raw[0]));
+    if (tx_data == NULL || split_data == NULL || fused_data == NULL ||
+        tx_samples == NULL || split_out == NULL || fused_out == NULL || raw == NULL){
+        perror("malloc");
+        goto out;
+    }
+
+    srand(2);
+    for (i = 0; i < num_bytes; i++){
+        tx_data[i] = (uint8_t) rand();
+    }
+    tx_samples[0].i = 2047;
+    tx_samples[0].q = 0;
+    fsk_mod(fsk, tx_data, num_bytes, &tx_samples[1]);
+
+    //Step the signal level every 20000 samples, and add noise
+    scale = 1.0;
+    for (i = 0; i < num_samples; i++){
+        if (i % 20000 == 0){
+            scale = 0.1 + 0.9 * (rand() % 100) / 100.0;
+        }
+        raw[2*i]   = (int16_t) round(scale * tx_samples[i].i + (rand() % 101) - 50);
+        raw[2*i+1] = (int16_t) round(scale * tx_samples[i].q + (rand() % 101) - 50);
+    }
+
+    //Time the best of several runs of each
+    for (run = 0; run < num_runs; run++){
+        t = rx_frontend_run(RX_FRONTEND_SPLIT, raw, num_samples, split_out);
+        if (t < 0){
+            fprintf(stderr, "Couldn't run split front end\n");
+            goto out;
+        }
+        t_split = (run == 0 || t < t_split) ? t : t_split;
+
+        t = rx_frontend_run(RX_FRONTEND_FUSED, raw, num_samples, fused_out);
+        if (t < 0){
+            fprintf(stderr, "Couldn't run fused front end\n");
+            goto out;
+        }
+        t_fused = (run == 0 || t < t_fused) ? t : t_fused;
+    }
+
+    printf("Split front end: %.2f Msamples/s\n", num_samples/t_split/1e6);
+    printf("Fused front end: %.2f Msamples/s\n", num_samples/t_fused/1e6);
+
+    for (i = 0; i < num_samples; i++){
+        diff = abs(split_out[i].i - fused_out[i].i);
+        max_diff = diff > max_diff ? diff : max_diff;
+        sum_sq += diff * diff;
+        diff = abs(split_out[i].q - fused_out[i].q);
+        max_diff = diff > max_diff ? diff : max_diff;
+        sum_sq += diff * diff;
+    }
+    printf("Output difference: max %d, RMS %.3f (SC16Q11 LSBs)\n", max_diff,
+            sqrt(sum_sq / (2.0 * num_samples)));
+
+    split_bytes = fsk_demod_fast(fsk, split_out, num_samples, true, num_bytes, split_data);
+    fused_bytes = fsk_demod_fast(fsk, fused_out, num_samples, true, num_bytes, fused_data);
+    if (split_bytes != fused_bytes){
+        fprintf(stderr, "Demodulated byte counts differ (%u split, %u fused)\n",
+                split_bytes, fused_bytes);
+        goto out;
+    }
+    for (k = 0; k < split_bytes; k++){
+        if (split_data[k] != fused_data[k]){
+            fprintf(stderr, "Demodulated data differs at byte %u\n", k);
+            goto out;
+        }
+    }
+
+    //The split path rounds the filter output before normalizing, and that rounding
+    //error is scaled up by the pnorm gain. Beyond that, the outputs should agree.
+    if (sqrt(sum_sq / (2.0 * num_samples)) > SAMP_MAX_ABS / 1000.0){
+        fprintf(stderr, "Front end outputs differ by more than expected\n");
+        goto out;
+    }
+
+    printf("Front ends demodulated to identical bytes.\n");
+    status = 0;
+
+    out:
+        fsk_close(fsk);
+        free(tx_data);
+        free(split_data);
+        free(fused_data);
+        free(tx_samples);
+        free(split_out);
+        free(fused_out);
+        free(raw);
+        if (status != 0){
+            fprintf(stderr, "ERROR: Test did not complete successfully\n");
+        }
+        printf("Test result: %s\n", status == 0 ? "PASSED" : "FAILED");
+        printf("------------ENDING RX FRONT END TEST----------------\n");
+        return status;
+}
+
+//Multi-channel receiver test parameters
+#define MCHAN_TEST_CHANNELS     4
+#define MCHAN_TEST_WORKERS      2
+#define MCHAN_TEST_FRAMES       6   //per channel; fewer than PHY_RX_RING_SLOTS
+#define MCHAN_TEST_INTERP_TAPS  (16*MCHAN_TEST_CHANNELS)
+#define MCHAN_TEST_TIMEOUT_MS   5000
+
+static void mchan_fill_frame(uint8_t *frame, unsigned int channel, unsigned int index)
+{
+    unsigned int k;
+
+    frame[0] = DATA_FRAME_CODE;
+    frame[1] = (uint8_t) channel;
+    frame[2] = (uint8_t) index;
+    for (k = 3; k < DATA_FRAME_LENGTH; k++){
+        frame[k] = (uint8_t) (k*31 + channel*17 + index*7);
+    }
+}
+
+/**
+ * Transmit a channel's frames with the single channel PHY, into a file
+ *
+ * @return  0 on success, -1 on failure
+ */
+static int mchan_write_channel(const char *path, unsigned int channel,
+                               struct radio_params *params)
+{
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    struct phy_handle *phy;
+    struct phy_stats stats;
+    struct timespec timeout_abs;
+    uint8_t frame[DATA_FRAME_LENGTH];
+    unsigned int i, waited_ms = 0;
+    int status = 0;
+
+    phy = phy_init_io(phy_io_open_file(NULL, path), params);
+    if (phy == NULL || phy_start_transmitter(phy) != 0){
+        fprintf(stderr, "Couldn't start PHY transmitter\n");
+        phy_close(phy);
+        return -1;
+    }
+    for (i = 0; i < MCHAN_TEST_FRAMES && status == 0; i++){
+        mchan_fill_frame(frame, channel, i);
+        status = phy_fill_tx_buf(phy, frame, DATA_FRAME_LENGTH);
+    }
+    //Wait for the frames to be written. Nothing signals cond; it provides a timed wait.
+    pthread_mutex_lock(&lock);
+    while (status == 0){
+        phy_get_stats(phy, &stats);
+        if (stats.tx_frames >= MCHAN_TEST_FRAMES){
+            break;
+        }
+        if (waited_ms >= MCHAN_TEST_TIMEOUT_MS ||
+            create_timeout_abs(10, &timeout_abs) != 0){
+            status = -1;
+            break;
+        }
+        pthread_cond_timedwait(&cond, &lock, &timeout_abs);
+        waited_ms += 10;
+    }
+    pthread_mutex_unlock(&lock);
+    phy_stop_transmitter(phy);
+    phy_close(phy);
+    if (status != 0){
+        fprintf(stderr, "Couldn't transmit channel %u's frames\n", channel);
+    }
+    return status;
+}
+
+/**
+ * Read a file of SC16 Q11 samples into a newly allocated buffer
+ *
+ * @return  number of samples, or 0 on failure
+ */
+static size_t mchan_read_file(const char *path, int16_t **samples)
+{
+    FILE *f;
+    long len;
+    size_t n = 0;
+
+    *samples = NULL;
+    f = fopen(path, "rb");
+    if (f == NULL){
+        perror("fopen");
+        return 0;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 &&
+        fseek(f, 0, SEEK_SET) == 0){
+        n = (size_t) len / (2*sizeof(int16_t));
+        *samples = malloc(n * 2*sizeof(int16_t));
+        if (*samples == NULL || fread(*samples, 2*sizeof(int16_t), n, f) != n){
+            free(*samples);
+            *samples = NULL;
+            n = 0;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+/**
+ * Multi-channel receiver test.
+ * Transmits different frames on each of MCHAN_TEST_CHANNELS channels with the single
+ * channel PHY, interpolates each channel and shifts it to its place in the band, and
+ * receives the sum with phy_mchan. Every channel must receive all of its own frames,
+ * intact, and none of any other channel's.
+ */
+int mchan_test(void)
+{
+    const unsigned int n = MCHAN_TEST_CHANNELS;
+    char paths[MCHAN_TEST_CHANNELS + 1][32];
+    int16_t *narrow[MCHAN_TEST_CHANNELS] = { NULL };
+    size_t narrow_len[MCHAN_TEST_CHANNELS] = { 0 };
+    float taps[MCHAN_TEST_INTERP_TAPS];
+    struct fir_filter *interp = NULL;
+    struct complex_sample *up = NULL;
+    float *wide = NULL;
+    int16_t *wide_q = NULL;
+    struct phy_mchan *m = NULL;
+    struct radio_params params;
+    uint8_t expected[DATA_FRAME_LENGTH];
+    uint8_t *frame;
+    size_t max_len = 0, wide_len, i, num_up;
+    unsigned int c, received;
+    double x, sum = 0.0, theta;
+    bool rx_on = false;
+    FILE *f;
+    int status = -1;
+
+    printf("------------BEGINNING MULTI-CHANNEL RECEIVER TEST----------\n");
+    memset(&params, 0, sizeof(params));
+    params.rx_cpus[0] = params.rx_cpus[1] = params.rx_cpus[2] = -1;
+    params.rx_frontend = RX_FRONTEND_FUSED;
+    params.rx_channels = 1;
+    for (c = 0; c <= n; c++){
+        snprintf(paths[c], sizeof(paths[c]), "mchan_test_%u.bin", c);
+    }
+
+    //Transmit each channel's frames at baseband
+    for (c = 0; c < n; c++){
+        if (mchan_write_channel(paths[c], c, &params) != 0){
+            goto out;
+        }
+        narrow_len[c] = mchan_read_file(paths[c], &narrow[c]);
+        if (narrow_len[c] == 0){
+            fprintf(stderr, "Couldn't read channel %u's samples\n", c);
+            goto out;
+        }
+        max_len = narrow_len[c] > max_len ? narrow_len[c] : max_len;
+    }
+
+    //Windowed sinc interpolation filter, with a gain of n
+    for (i = 0; i < MCHAN_TEST_INTERP_TAPS; i++){
+        x = ((double) i - (MCHAN_TEST_INTERP_TAPS - 1) / 2.0) / n;
+        taps[i] = (float) ((x == 0.0 ? 1.0 : sin(M_PI*x) / (M_PI*x)) *
+                  (0.54 - 0.46*cos(2*M_PI*i / (MCHAN_TEST_INTERP_TAPS - 1))));
+        sum += taps[i];
+    }
+    for (i = 0; i < MCHAN_TEST_INTERP_TAPS; i++){
+        taps[i] = (float) (taps[i] * n / sum);
+    }
+
+    //Interpolate each channel, shift it to its center frequency, and sum
+    wide_len = max_len * n;
+    wide = calloc(2 * wide_len, sizeof(wide[0]));
+    wide_q = malloc(2 * wide_len * sizeof(wide_q[0]));
+    up = malloc((wide_len + n) * sizeof(up[0]));
+    if (wide == NULL || wide_q == NULL || up == NULL){
+        perror("malloc");
+        goto out;
+    }
+    for (c = 0; c < n; c++){
+        interp = fir_init_interp(taps, MCHAN_TEST_INTERP_TAPS, n);
+        if (interp == NULL){
+            fprintf(stderr, "Couldn't create interpolation filter\n");
+            goto out;
+        }
+        num_up = fir_process_block(interp, narrow[c], narrow_len[c], up);
+        fir_deinit(interp);
+        interp = NULL;
+        //Channel c is centered at c (or, equivalently at the wideband rate, c - n)
+        //channel widths
+        for (i = 0; i < num_up && i < wide_len; i++){
+            theta = 2*M_PI * (double) ((c * i) % n) / n;
+            wide[2*i]   += (float) (up[i].i*cos(theta) - up[i].q*sin(theta));
+            wide[2*i+1] += (float) (up[i].i*sin(theta) + up[i].q*cos(theta));
+        }
+    }
+    for (i = 0; i < 2*wide_len; i++){
+        wide_q[i] = (int16_t) lrintf(wide[i]);
+    }
+    f = fopen(paths[n], "wb");
+    if (f == NULL){
+        perror("fopen");
+        goto out;
+    }
+    if (fwrite(wide_q, 2*sizeof(int16_t), wide_len, f) != wide_len){
+        fprintf(stderr, "Couldn't write wideband samples\n");
+        fclose(f);
+        goto out;
+    }
+    fclose(f);
+
+    //Receive all channels at once
+    params.rx_channels = n;
+    m = phy_mchan_init(phy_io_open_file(paths[n], NULL), &params, MCHAN_TEST_WORKERS);
+    if (m == NULL){
+        fprintf(stderr, "Couldn't initialize multi-channel receiver\n");
+        goto out;
+    }
+    if (phy_mchan_start(m) != 0){
+        fprintf(stderr, "Couldn't start multi-channel receiver\n");
+        goto out;
+    }
+    rx_on = true;
+    for (c = 0; c < n; c++){
+        for (received = 0; received < MCHAN_TEST_FRAMES; received++){
+            frame = phy_mchan_request_rx_buf(m, c, MCHAN_TEST_TIMEOUT_MS);
+            if (frame == NULL){
+                fprintf(stderr, "Channel %u received %u of %u frames\n", c,
+                        received, MCHAN_TEST_FRAMES);
+                goto out;
+            }
+            mchan_fill_frame(expected, c, received);
+            if (memcmp(frame, expected, DATA_FRAME_LENGTH) != 0){
+                fprintf(stderr, "Channel %u frame %u is not the one transmitted "
+                        "(channel %u, frame %u)\n", c, received, frame[1], frame[2]);
+                phy_mchan_release_rx_buf(m, c);
+                goto out;
+            }
+            phy_mchan_release_rx_buf(m, c);
+        }
+        printf("Channel %u: received %u frames\n", c, received);
+    }
+    status = 0;
+
+    out:
+        if (rx_on){
+            phy_mchan_stop(m);
+        }
+        phy_mchan_close(m);
+        fir_deinit(interp);
+        for (c = 0; c < n; c++){
+            free(narrow[c]);
+        }
+        for (c = 0; c <= n; c++){
+            remove(paths[c]);
+        }
+        free(up);
+        free(wide);
+        free(wide_q);
+        if (status != 0){
+            fprintf(stderr, "ERROR: Test did not complete successfully\n");
+        }
+        printf("Test result: %s\n", status == 0 ? "PASSED" : "FAILED");
+        printf("------------ENDING MULTI-CHANNEL RECEIVER TEST-------------\n");
+        return status;
+}
+
 /**
  * Run all tests
  */
@@ -462,18 +1370,27 @@ int main(int argc, char *argv[])
 {
     char *dev_id1;
     char *dev_id2;
+    char *capture_file = NULL;
 
     //Parse arguments
     if (argc < 3){
-        fprintf(stderr, "Usage: %s [bladeRF device ID 1] [bladeRF device ID 2]\n",
-                argv[0]);
+        fprintf(stderr, "Usage: %s [bladeRF device ID 1] [bladeRF device ID 2] "
+                        "[capture CSV file]\n", argv[0]);
         return 0;
     }
 
     dev_id1 = argv[1];
     dev_id2 = argv[2];
+    if (argc > 3){
+        capture_file = argv[3];
+    }
 
     fsk_test1();
+    fsk_test2(capture_file);
+    fsk_test3();
+    rx_frontend_test();
+    mchan_test();
+    link_loopback_test();
     phy_receive_test();
     phy_test(dev_id1, dev_id2, 904000000, 924000000);
     phy_test(dev_id2, dev_id1, 904000000, 924000000);
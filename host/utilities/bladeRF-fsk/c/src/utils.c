@@ -23,6 +23,11 @@
 
 #include "utils.h"
 
+#if defined(_MSC_VER) && defined(HAVE_AVX_FMA)
+#   include <intrin.h>
+#   include <immintrin.h>
+#endif
+
 int load_samples_from_csv_file(char *filename, bool pad_zeros, int buffer_size,
                                 int16_t **samples)
 {
@@ -280,6 +285,62 @@ int create_timeout_abs(unsigned int timeout_ms, struct timespec *timeout_abs)
     return 0;
 }
 
+void timespec_add_us(struct timespec *ts, uint64_t us)
+{
+    ts->tv_sec += us / 1000000;
+    ts->tv_nsec += (us % 1000000) * 1000;
+    //Check for overflow in nsec
+    if (ts->tv_nsec >= 1000000000){
+        ts->tv_sec += ts->tv_nsec / 1000000000;
+        ts->tv_nsec %= 1000000000;
+    }
+}
+
+int64_t timespec_diff_us(const struct timespec *a, const struct timespec *b)
+{
+    return ((int64_t) a->tv_sec - (int64_t) b->tv_sec) * 1000000 +
+           ((int64_t) a->tv_nsec - (int64_t) b->tv_nsec) / 1000;
+}
+
+double elapsed(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+bool cpu_has_avx_fma(void)
+{
+#if defined(HAVE_AVX_FMA) && defined(_MSC_VER)
+    int regs[4];
+
+    __cpuid(regs, 1);
+
+    /* FMA, OSXSAVE, and AVX, with the OS saving the YMM registers */
+    return (regs[2] & 0x18001000) == 0x18001000 &&
+           (_xgetbv(0) & 0x6) == 0x6;
+#elif defined(HAVE_AVX_FMA)
+    /* This accounts for whether the OS saves the YMM registers */
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("fma");
+#else
+    return false;
+#endif
+}
+
+void *alloc_aligned(size_t size, size_t alignment, void **alloc)
+{
+    uintptr_t addr;
+
+    *alloc = calloc(1, size + alignment);
+    if (*alloc == NULL) {
+        return NULL;
+    }
+
+    addr = ((uintptr_t) *alloc + alignment - 1) & ~((uintptr_t) alignment - 1);
+
+    return (void *) addr;
+}
+
 void conv_samples_to_struct(int16_t *samples, unsigned int num_samples,
                             struct complex_sample *struct_samples)
 {
@@ -39,6 +39,18 @@
 
 #include "common.h"
 
+/* x86 AVX/FMA kernels are compiled for the required instruction set
+ * extensions via a target attribute, so no additional compiler flags are
+ * required, and are selected at runtime with cpu_has_avx_fma() */
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#   define HAVE_AVX_FMA
+#   define AVX_FMA_TARGET __attribute__((target("avx,fma")))
+#elif defined(_MSC_VER) && defined(_M_X64)
+#   define HAVE_AVX_FMA
+#   define AVX_FMA_TARGET
+#endif
+
 /**
  * Write samples to csv file
  *
@@ -109,6 +121,56 @@ void print_hex_contents(uint8_t *data, int num_bytes);
  */
 int create_timeout_abs(unsigned int timeout_ms, struct timespec *timeout_abs);
 
+/**
+ * Add a number of microseconds to a timespec (e.g., one created with
+ * create_timeout_abs())
+ *
+ * @param[inout]    ts      timespec to update
+ * @param[in]       us      number of microseconds to add
+ */
+void timespec_add_us(struct timespec *ts, uint64_t us);
+
+/**
+ * Compute the difference between two times
+ *
+ * @param[in]   a       first time
+ * @param[in]   b       second time
+ *
+ * @return      a - b, in microseconds
+ */
+int64_t timespec_diff_us(const struct timespec *a, const struct timespec *b);
+
+/**
+ * Compute the time elapsed between two times, as used by the benchmarks
+ *
+ * @param[in]   start   start time
+ * @param[in]   end     end time
+ *
+ * @return      end - start, in seconds
+ */
+double elapsed(const struct timespec *start, const struct timespec *end);
+
+/**
+ * Check whether this machine, and its OS, support the AVX and FMA
+ * instruction set extensions
+ *
+ * @return      true if supported, false otherwise (including on non-x86
+ *              machines)
+ */
+bool cpu_has_avx_fma(void);
+
+/**
+ * Allocate a zeroed buffer whose start is aligned to the specified boundary
+ *
+ * @param[in]   size        buffer size, in bytes
+ * @param[in]   alignment   alignment, in bytes. Must be a power of 2.
+ * @param[out]  alloc       the underlying allocation, to be passed to free()
+ *                          when done using the buffer
+ *
+ * @return      aligned buffer on success, NULL on failure
+ */
+void *alloc_aligned(size_t size, size_t alignment, void **alloc);
+
 /**
  * Converts an array of int16_t IQ samples to an array of 'complex_sample' structs.
  * Caller is responsible for memory allocation.